@@ -43,24 +43,24 @@ lut3d_tetrahedral(read_only image2d_t in, write_only image2d_t out, const int wi
 
 // indexes of P000 to P111 in clut
   const int color = rgbi.x + rgbi.y * level + rgbi.z * level2;
-  const int i000 = color * 3 ;  // P000
-  const int i100 = i000 + 3;  // P100
-  const int i010 = (int)(color + level) * 3;  // P010
-  const int i110 = i010 + 3;  //P110
-  const int i001 = (int)(color + level2) * 3;  // P001
-  const int i101 = i001 + 3;  // P101
-  const int i011 = (int)(color + level + level2) * 3;  // P011
-  const int i111 = i011 + 3;  // P111
-
-// float3 are 16 bytes aligned. So no way to set clut as an array of float3.
-  const float4 clut000 = (float4)(clut[i000], clut[i000+1], clut[i000+2], 0.0f);
-  const float4 clut100 = (float4)(clut[i100], clut[i100+1], clut[i100+2], 0.0f);
-  const float4 clut010 = (float4)(clut[i010], clut[i010+1], clut[i010+2], 0.0f);
-  const float4 clut110 = (float4)(clut[i110], clut[i110+1], clut[i110+2], 0.0f);
-  const float4 clut001 = (float4)(clut[i001], clut[i001+1], clut[i001+2], 0.0f);
-  const float4 clut101 = (float4)(clut[i101], clut[i101+1], clut[i101+2], 0.0f);
-  const float4 clut011 = (float4)(clut[i011], clut[i011+1], clut[i011+2], 0.0f);
-  const float4 clut111 = (float4)(clut[i111], clut[i111+1], clut[i111+2], 0.0f);
+  const int i000 = color;  // P000
+  const int i100 = i000 + 1;  // P100
+  const int i010 = (int)(color + level);  // P010
+  const int i110 = i010 + 1;  //P110
+  const int i001 = (int)(color + level2);  // P001
+  const int i101 = i001 + 1;  // P101
+  const int i011 = (int)(color + level + level2);  // P011
+  const int i111 = i011 + 1;  // P111
+
+// the clut is packed with 4 floats per node, see common/clut.h
+  const float4 clut000 = vload4(i000, clut);
+  const float4 clut100 = vload4(i100, clut);
+  const float4 clut010 = vload4(i010, clut);
+  const float4 clut110 = vload4(i110, clut);
+  const float4 clut001 = vload4(i001, clut);
+  const float4 clut101 = vload4(i101, clut);
+  const float4 clut011 = vload4(i011, clut);
+  const float4 clut111 = vload4(i111, clut);
 
   if (rgbd.x > rgbd.y)
   {
@@ -123,24 +123,24 @@ lut3d_trilinear(read_only image2d_t in, write_only image2d_t out, const int widt
 
   // indexes of P000 to P111 in clut
   const int color = rgbi.x + rgbi.y * level + rgbi.z * level2;
-  const int i000 = color * 3 ;  // P000
-  const int i100 = i000 + 3;  // P100
-  const int i010 = (int)(color + level) * 3;  // P010
-  const int i110 = i010 + 3;  //P110
-  const int i001 = (int)(color + level2) * 3;  // P001
-  const int i101 = i001 + 3;  // P101
-  const int i011 = (int)(color + level + level2) * 3;  // P011
-  const int i111 = i011 + 3;  // P111
-
-  // float3 are 16 bytes aligned. So no way to set clut as an array of float3.
-  const float4 clut000 = (float4)(clut[i000], clut[i000+1], clut[i000+2], 0.0f);
-  const float4 clut100 = (float4)(clut[i100], clut[i100+1], clut[i100+2], 0.0f);
-  const float4 clut010 = (float4)(clut[i010], clut[i010+1], clut[i010+2], 0.0f);
-  const float4 clut110 = (float4)(clut[i110], clut[i110+1], clut[i110+2], 0.0f);
-  const float4 clut001 = (float4)(clut[i001], clut[i001+1], clut[i001+2], 0.0f);
-  const float4 clut101 = (float4)(clut[i101], clut[i101+1], clut[i101+2], 0.0f);
-  const float4 clut011 = (float4)(clut[i011], clut[i011+1], clut[i011+2], 0.0f);
-  const float4 clut111 = (float4)(clut[i111], clut[i111+1], clut[i111+2], 0.0f);
+  const int i000 = color;  // P000
+  const int i100 = i000 + 1;  // P100
+  const int i010 = (int)(color + level);  // P010
+  const int i110 = i010 + 1;  //P110
+  const int i001 = (int)(color + level2);  // P001
+  const int i101 = i001 + 1;  // P101
+  const int i011 = (int)(color + level + level2);  // P011
+  const int i111 = i011 + 1;  // P111
+
+  // the clut is packed with 4 floats per node, see common/clut.h
+  const float4 clut000 = vload4(i000, clut);
+  const float4 clut100 = vload4(i100, clut);
+  const float4 clut010 = vload4(i010, clut);
+  const float4 clut110 = vload4(i110, clut);
+  const float4 clut001 = vload4(i001, clut);
+  const float4 clut101 = vload4(i101, clut);
+  const float4 clut011 = vload4(i011, clut);
+  const float4 clut111 = vload4(i111, clut);
 
   tmp1 = clut000*(1.0f-rgbd.x) + clut100*rgbd.x;
   tmp2 = clut010*(1.0f-rgbd.x) + clut110*rgbd.x;
@@ -179,24 +179,24 @@ lut3d_pyramid(read_only image2d_t in, write_only image2d_t out, const int width,
 
   // indexes of P000 to P111 in clut
   const int color = rgbi.x + rgbi.y * level + rgbi.z * level2;
-  const int i000 = color * 3 ;  // P000
-  const int i100 = i000 + 3;  // P100
-  const int i010 = (int)(color + level) * 3;  // P010
-  const int i110 = i010 + 3;  //P110
-  const int i001 = (int)(color + level2) * 3;  // P001
-  const int i101 = i001 + 3;  // P101
-  const int i011 = (int)(color + level + level2) * 3;  // P011
-  const int i111 = i011 + 3;  // P111
-
-  // float3 are 16 bytes aligned. So no way to set clut as an array of float3.
-  const float4 clut000 = (float4)(clut[i000], clut[i000+1], clut[i000+2], 0.0f);
-  const float4 clut100 = (float4)(clut[i100], clut[i100+1], clut[i100+2], 0.0f);
-  const float4 clut010 = (float4)(clut[i010], clut[i010+1], clut[i010+2], 0.0f);
-  const float4 clut110 = (float4)(clut[i110], clut[i110+1], clut[i110+2], 0.0f);
-  const float4 clut001 = (float4)(clut[i001], clut[i001+1], clut[i001+2], 0.0f);
-  const float4 clut101 = (float4)(clut[i101], clut[i101+1], clut[i101+2], 0.0f);
-  const float4 clut011 = (float4)(clut[i011], clut[i011+1], clut[i011+2], 0.0f);
-  const float4 clut111 = (float4)(clut[i111], clut[i111+1], clut[i111+2], 0.0f);
+  const int i000 = color;  // P000
+  const int i100 = i000 + 1;  // P100
+  const int i010 = (int)(color + level);  // P010
+  const int i110 = i010 + 1;  //P110
+  const int i001 = (int)(color + level2);  // P001
+  const int i101 = i001 + 1;  // P101
+  const int i011 = (int)(color + level + level2);  // P011
+  const int i111 = i011 + 1;  // P111
+
+  // the clut is packed with 4 floats per node, see common/clut.h
+  const float4 clut000 = vload4(i000, clut);
+  const float4 clut100 = vload4(i100, clut);
+  const float4 clut010 = vload4(i010, clut);
+  const float4 clut110 = vload4(i110, clut);
+  const float4 clut001 = vload4(i001, clut);
+  const float4 clut101 = vload4(i101, clut);
+  const float4 clut011 = vload4(i011, clut);
+  const float4 clut111 = vload4(i111, clut);
 
   if (rgbd.y > rgbd.x && rgbd.z > rgbd.x)
   {
@@ -40,6 +40,7 @@
 #include "control/conf.h"
 #include "develop/imageop.h"
 
+#include <glib/gstdio.h>
 #include <inttypes.h>
 #include <libintl.h>
 #include <sys/time.h>
@@ -58,6 +59,7 @@
 static void usage(const char *progname)
 {
   fprintf(stderr, "usage: %s <input file> [<xmp file>] <output file> [options] [--core <darktable options>]\n", progname);
+  fprintf(stderr, "       %s --batch <list file> [options] [--core <darktable options>]\n", progname);
   fprintf(stderr, "\n");
   fprintf(stderr, "options:\n");
   fprintf(stderr, "   --width <max width> default: 0 = full resolution\n");
@@ -68,11 +70,361 @@ static void usage(const char *progname)
   fprintf(stderr, "   --style <style name>\n");
   fprintf(stderr, "   --style-overwrite\n");
   fprintf(stderr, "   --apply-custom-presets <0|1|false|true>, default: true\n");
+  fprintf(stderr, "   --trace <trace file>, .csv or chrome trace json\n");
+  fprintf(stderr, "   --batch <list file>, one tab separated <input>[<tab><xmp>]<tab><output> per line, - for stdin\n");
+  fprintf(stderr, "   --jobs <n>, images exported in parallel in batch mode, default: 1\n");
   fprintf(stderr, "   --verbose\n");
   fprintf(stderr, "   --help,-h\n");
   fprintf(stderr, "   --version\n");
 }
 
+// export settings shared by all images of one run
+typedef struct dt_cli_params_t
+{
+  int width, height;
+  gboolean high_quality, upscale, style_overwrite;
+  const char *style;
+} dt_cli_params_t;
+
+// one line of a --batch list
+typedef struct dt_cli_job_t
+{
+  gchar *input_filename;
+  gchar *xmp_filename; // NULL to use the sidecar of the input, if any
+  gchar *output_filename;
+  int line;
+  int imgid; // 0 if the import failed
+} dt_cli_job_t;
+
+typedef struct dt_cli_batch_t
+{
+  dt_pthread_mutex_t lock;
+  GList *next; // dt_cli_job_t still to be exported
+  const dt_cli_params_t *params;
+  int total, done, failed;
+} dt_cli_batch_t;
+
+// exports the images in id_list to output_filename, which also determines the format. returns non-zero on error.
+static int _export_images(GList **id_list, const char *output_filename, const dt_cli_params_t *params)
+{
+  if(g_file_test(output_filename, G_FILE_TEST_IS_DIR))
+  {
+    fprintf(stderr, _("error: output file is a directory. please specify file name"));
+    fprintf(stderr, "\n");
+    return 1;
+  }
+
+  // the output file already exists, so there will be a sequence number added
+  if(g_file_test(output_filename, G_FILE_TEST_EXISTS))
+  {
+    fprintf(stderr, "%s\n", _("output file already exists, it will get renamed"));
+  }
+
+  // try to find out the export format from the output_filename
+  gchar *filename = g_strdup(output_filename);
+  char *ext = filename + strlen(filename);
+  while(ext > filename && *ext != '.') ext--;
+  *ext = '\0';
+  ext++;
+
+  if(!strcmp(ext, "jpg")) ext = "jpeg";
+
+  if(!strcmp(ext, "tif")) ext = "tiff";
+
+  // init the export data structures
+  dt_imageio_module_format_t *format;
+  dt_imageio_module_storage_t *storage;
+  dt_imageio_module_data_t *sdata, *fdata;
+
+  storage = dt_imageio_get_storage_by_name("disk"); // only exporting to disk makes sense
+  if(storage == NULL)
+  {
+    fprintf(
+        stderr, "%s\n",
+        _("cannot find disk storage module. please check your installation, something seems to be broken."));
+    g_free(filename);
+    return 1;
+  }
+
+  sdata = storage->get_params(storage);
+  if(sdata == NULL)
+  {
+    fprintf(stderr, "%s\n", _("failed to get parameters from storage module, aborting export ..."));
+    g_free(filename);
+    return 1;
+  }
+
+  // and now for the really ugly hacks. don't tell your children about this one or they won't sleep at night
+  // any longer ...
+  g_strlcpy((char *)sdata, filename, DT_MAX_PATH_FOR_PARAMS);
+  // all is good now, the last line didn't happen.
+
+  format = dt_imageio_get_format_by_name(ext);
+  if(format == NULL)
+  {
+    fprintf(stderr, _("unknown extension '.%s'"), ext);
+    fprintf(stderr, "\n");
+    storage->free_params(storage, sdata);
+    g_free(filename);
+    return 1;
+  }
+  g_free(filename);
+
+  fdata = format->get_params(format);
+  if(fdata == NULL)
+  {
+    fprintf(stderr, "%s\n", _("failed to get parameters from format module, aborting export ..."));
+    storage->free_params(storage, sdata);
+    return 1;
+  }
+
+  uint32_t w, h, fw, fh, sw, sh;
+  fw = fh = sw = sh = 0;
+  storage->dimension(storage, sdata, &sw, &sh);
+  format->dimension(format, fdata, &fw, &fh);
+
+  if(sw == 0 || fw == 0)
+    w = sw > fw ? sw : fw;
+  else
+    w = sw < fw ? sw : fw;
+
+  if(sh == 0 || fh == 0)
+    h = sh > fh ? sh : fh;
+  else
+    h = sh < fh ? sh : fh;
+
+  fdata->max_width = params->width;
+  fdata->max_height = params->height;
+  fdata->max_width = (w != 0 && fdata->max_width > w) ? w : fdata->max_width;
+  fdata->max_height = (h != 0 && fdata->max_height > h) ? h : fdata->max_height;
+  fdata->style[0] = '\0';
+  fdata->style_append = 1; // make append the default and override with --style-overwrite
+
+  if(params->style)
+  {
+    g_strlcpy((char *)fdata->style, params->style, DT_MAX_STYLE_NAME_LENGTH);
+    fdata->style[127] = '\0';
+    if(params->style_overwrite)
+      fdata->style_append = 0;
+  }
+
+  if(storage->initialize_store)
+  {
+    storage->initialize_store(storage, sdata, &format, &fdata, id_list, params->high_quality, params->upscale);
+
+    format->set_params(format, fdata, format->params_size(format));
+    storage->set_params(storage, sdata, storage->params_size(storage));
+  }
+
+  // TODO: do we want to use the settings from conf?
+  // TODO: expose these via command line arguments
+  dt_colorspaces_color_profile_type_t icc_type = DT_COLORSPACE_NONE;
+  const gchar *icc_filename = NULL;
+  dt_iop_color_intent_t icc_intent = DT_INTENT_LAST;
+
+  // TODO: add a callback to set the bpp without going through the config
+
+  int res = 0;
+  const int total = g_list_length(*id_list);
+  int num = 1;
+  for(GList *iter = *id_list; iter; iter = g_list_next(iter), num++)
+  {
+    int id = GPOINTER_TO_INT(iter->data);
+    // TODO: have a parameter in command line to get the export presets
+    dt_export_metadata_t metadata;
+    metadata.flags = dt_lib_export_metadata_default_flags();
+    metadata.list = NULL;
+    if(storage->store(storage, sdata, id, format, fdata, num, total, params->high_quality, params->upscale,
+                      icc_type, icc_filename, icc_intent, &metadata))
+      res = 1;
+  }
+
+  // cleanup time
+  if(storage->finalize_store) storage->finalize_store(storage, sdata);
+  storage->free_params(storage, sdata);
+  format->free_params(format, fdata);
+
+  return res;
+}
+
+static void _job_free(gpointer data)
+{
+  dt_cli_job_t *job = (dt_cli_job_t *)data;
+  g_free(job->input_filename);
+  g_free(job->xmp_filename);
+  g_free(job->output_filename);
+  free(job);
+}
+
+// reads the --batch list. returns FALSE if it can't be read or has malformed lines.
+static gboolean _batch_read(const char *list_filename, GList **jobs)
+{
+  FILE *f = strcmp(list_filename, "-") ? g_fopen(list_filename, "rb") : stdin;
+  if(!f)
+  {
+    fprintf(stderr, _("error: can't open file %s"), list_filename);
+    fprintf(stderr, "\n");
+    return FALSE;
+  }
+
+  gboolean ok = TRUE;
+  char line[3 * PATH_MAX];
+  int line_num = 0;
+  while(fgets(line, sizeof(line), f))
+  {
+    line_num++;
+    // file names may contain about anything but tabs and newlines
+    line[strcspn(line, "\r\n")] = '\0';
+    if(line[0] == '\0' || line[0] == '#') continue;
+
+    gchar **fields = g_strsplit(line, "\t", -1);
+    const guint num_fields = g_strv_length(fields);
+    if(num_fields == 2 || num_fields == 3)
+    {
+      dt_cli_job_t *job = (dt_cli_job_t *)calloc(1, sizeof(dt_cli_job_t));
+      job->input_filename = g_strdup(fields[0]);
+      job->xmp_filename = num_fields == 3 && *fields[1] ? g_strdup(fields[1]) : NULL;
+      job->output_filename = g_strdup(fields[num_fields - 1]);
+      job->line = line_num;
+      *jobs = g_list_prepend(*jobs, job);
+    }
+    else
+    {
+      fprintf(stderr, "%s:%d: %s\n", list_filename, line_num,
+              _("expected <input file>[<tab><xmp file>]<tab><output file>"));
+      ok = FALSE;
+    }
+    g_strfreev(fields);
+  }
+
+  if(f != stdin) fclose(f);
+  *jobs = g_list_reverse(*jobs);
+  return ok;
+}
+
+static int _import_image(const char *input_filename)
+{
+  dt_film_t film;
+  gchar *directory = g_path_get_dirname(input_filename);
+  const int filmid = dt_film_new(&film, directory);
+  g_free(directory);
+  return dt_image_import(filmid, input_filename, TRUE);
+}
+
+static int _attach_xmp(const int id, const char *xmp_filename)
+{
+  dt_image_t *image = dt_image_cache_get(darktable.image_cache, id, 'w');
+  const int res = dt_exif_xmp_read(image, xmp_filename, 1);
+  // don't write new xmp:
+  dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+  if(res)
+  {
+    fprintf(stderr, _("error: can't open xmp file %s"), xmp_filename);
+    fprintf(stderr, "\n");
+  }
+  return res;
+}
+
+static void *_batch_worker(void *data)
+{
+  dt_cli_batch_t *batch = (dt_cli_batch_t *)data;
+  while(TRUE)
+  {
+    dt_pthread_mutex_lock(&batch->lock);
+    dt_cli_job_t *job = batch->next ? (dt_cli_job_t *)batch->next->data : NULL;
+    if(job) batch->next = g_list_next(batch->next);
+    dt_pthread_mutex_unlock(&batch->lock);
+    if(!job) break;
+
+    const double start = dt_get_wtime();
+    int res = 1;
+    if(job->imgid)
+    {
+      GList *id_list = g_list_append(NULL, GINT_TO_POINTER(job->imgid));
+      res = _export_images(&id_list, job->output_filename, batch->params);
+      g_list_free(id_list);
+    }
+
+    // one line per image, for scripts: <count>/<total> <ok|failed> <seconds> <input> <output>
+    dt_pthread_mutex_lock(&batch->lock);
+    batch->done++;
+    if(res) batch->failed++;
+    printf("%d/%d\t%s\t%.3f\t%s\t%s\n", batch->done, batch->total, res ? "failed" : "ok",
+           dt_get_wtime() - start, job->input_filename, job->output_filename);
+    fflush(stdout);
+    dt_pthread_mutex_unlock(&batch->lock);
+  }
+  return NULL;
+}
+
+// exports all images of the list with one darktable instance, jobs of them at a time. returns the number of
+// images that failed.
+static int _batch_export(GList *jobs, const dt_cli_params_t *params, const int num_workers)
+{
+  const double start = dt_get_wtime();
+
+  // imports and xmp files go to the library, do them here rather than racing for it in the workers.
+  // inputs listed more than once get a duplicate for each line, so every line keeps its own history.
+  GHashTable *seen = g_hash_table_new(g_direct_hash, g_direct_equal);
+  for(GList *iter = jobs; iter; iter = g_list_next(iter))
+  {
+    dt_cli_job_t *job = (dt_cli_job_t *)iter->data;
+    int id = _import_image(job->input_filename);
+    if(!id)
+    {
+      fprintf(stderr, _("error: can't open file %s"), job->input_filename);
+      fprintf(stderr, "\n");
+      continue;
+    }
+    const char *xmp_filename = job->xmp_filename;
+    char sidecar[PATH_MAX] = { 0 };
+    if(g_hash_table_contains(seen, GINT_TO_POINTER(id)))
+    {
+      const int orig = id;
+      id = dt_image_duplicate(orig);
+      if(id <= 0)
+      {
+        fprintf(stderr, _("error: can't duplicate file %s"), job->input_filename);
+        fprintf(stderr, "\n");
+        continue;
+      }
+      // a duplicate starts without history, without an xmp of its own it gets the one the import read from the
+      // sidecar of the original. the original itself might have another line's xmp attached by now.
+      if(!xmp_filename)
+      {
+        gboolean from_cache = FALSE;
+        dt_image_full_path(orig, sidecar, sizeof(sidecar), &from_cache);
+        dt_image_path_append_version(orig, sidecar, sizeof(sidecar));
+        g_strlcat(sidecar, ".xmp", sizeof(sidecar));
+        if(g_file_test(sidecar, G_FILE_TEST_IS_REGULAR)) xmp_filename = sidecar;
+      }
+    }
+    else
+      g_hash_table_add(seen, GINT_TO_POINTER(id));
+    if(xmp_filename && _attach_xmp(id, xmp_filename)) continue;
+    job->imgid = id;
+  }
+  g_hash_table_destroy(seen);
+
+  dt_cli_batch_t batch = { .next = jobs, .params = params, .total = g_list_length(jobs) };
+  dt_pthread_mutex_init(&batch.lock, NULL);
+
+  const int workers = CLAMP(num_workers, 1, batch.total);
+  pthread_t *threads = (pthread_t *)calloc(workers, sizeof(pthread_t));
+  int started = 0;
+  for(; started < workers; started++)
+    if(dt_pthread_create(&threads[started], _batch_worker, &batch)) break;
+  // if no thread could be started this one does all the work
+  if(started == 0) _batch_worker(&batch);
+  for(int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+  free(threads);
+  dt_pthread_mutex_destroy(&batch.lock);
+
+  printf("%d images exported, %d failed, %.3f s\n", batch.done - batch.failed, batch.failed,
+         dt_get_wtime() - start);
+  return batch.failed;
+}
+
 int main(int argc, char *arg[])
 {
 #ifdef __APPLE__
@@ -89,6 +441,9 @@ int main(int argc, char *arg[])
   char *xmp_filename = NULL;
   char *output_filename = NULL;
   char *style = NULL;
+  char *trace_filename = NULL;
+  char *batch_filename = NULL;
+  int num_jobs = 1;
   int file_counter = 0;
   int width = 0, height = 0, bpp = 0;
   gboolean verbose = FALSE, high_quality = TRUE, upscale = FALSE, style_overwrite = FALSE, custom_presets = TRUE;
@@ -183,6 +538,21 @@ int main(int argc, char *arg[])
         }
         g_free(str);
       }
+      else if(!strcmp(arg[k], "--trace") && argc > k + 1)
+      {
+        k++;
+        trace_filename = arg[k];
+      }
+      else if(!strcmp(arg[k], "--batch") && argc > k + 1)
+      {
+        k++;
+        batch_filename = arg[k];
+      }
+      else if(!strcmp(arg[k], "--jobs") && argc > k + 1)
+      {
+        k++;
+        num_jobs = MAX(atoi(arg[k]), 1);
+      }
 
       else if(!strcmp(arg[k], "-v") || !strcmp(arg[k], "--verbose"))
       {
@@ -208,16 +578,21 @@ int main(int argc, char *arg[])
   }
 
   int m_argc = 0;
-  char **m_arg = malloc((5 + argc - k + 1) * sizeof(char *));
+  char **m_arg = malloc((7 + argc - k + 1) * sizeof(char *));
   m_arg[m_argc++] = "darktable-cli";
   m_arg[m_argc++] = "--library";
   m_arg[m_argc++] = ":memory:";
   m_arg[m_argc++] = "--conf";
   m_arg[m_argc++] = "write_sidecar_files=FALSE";
+  if(trace_filename)
+  {
+    m_arg[m_argc++] = "--trace";
+    m_arg[m_argc++] = trace_filename;
+  }
   for(; k < argc; k++) m_arg[m_argc++] = arg[k];
   m_arg[m_argc] = NULL;
 
-  if(file_counter < 2 || file_counter > 3)
+  if(batch_filename ? file_counter != 0 : (file_counter < 2 || file_counter > 3))
   {
     usage(arg[0]);
     free(m_arg);
@@ -230,27 +605,45 @@ int main(int argc, char *arg[])
     xmp_filename = NULL;
   }
 
-  if(g_file_test(output_filename, G_FILE_TEST_IS_DIR))
-  {
-    fprintf(stderr, _("error: output file is a directory. please specify file name"));
-    fprintf(stderr, "\n");
-    free(m_arg);
-    exit(1);
-  }
+  const dt_cli_params_t params = { .width = width,
+                                   .height = height,
+                                   .high_quality = high_quality,
+                                   .upscale = upscale,
+                                   .style_overwrite = style_overwrite,
+                                   .style = style };
 
-  // the output file already exists, so there will be a sequence number added
-  if(g_file_test(output_filename, G_FILE_TEST_EXISTS))
+  GList *jobs = NULL;
+  if(batch_filename)
   {
-    fprintf(stderr, "%s\n", _("output file already exists, it will get renamed"));
+    const gboolean read = _batch_read(batch_filename, &jobs);
+    if(read && !jobs) fprintf(stderr, _("no images to export, aborting\n"));
+    if(!read || !jobs)
+    {
+      g_list_free_full(jobs, _job_free);
+      free(m_arg);
+      exit(1);
+    }
   }
 
   // init dt without gui and without data.db:
   if(dt_init(m_argc, m_arg, FALSE, custom_presets, NULL))
   {
+    g_list_free_full(jobs, _job_free);
     free(m_arg);
     exit(1);
   }
 
+  if(batch_filename)
+  {
+    const int failed = _batch_export(jobs, &params, num_jobs);
+    g_list_free_full(jobs, _job_free);
+
+    dt_cleanup();
+
+    free(m_arg);
+    exit(failed ? 1 : 0);
+  }
+
   GList *id_list = NULL;
 
   if(g_file_test(input_filename, G_FILE_TEST_IS_DIR))
@@ -267,13 +660,7 @@ int main(int argc, char *arg[])
   }
   else
   {
-    dt_film_t film;
-    int id = 0;
-    int filmid = 0;
-
-    gchar *directory = g_path_get_dirname(input_filename);
-    filmid = dt_film_new(&film, directory);
-    id = dt_image_import(filmid, input_filename, TRUE);
+    const int id = _import_image(input_filename);
     if(!id)
     {
       fprintf(stderr, _("error: can't open file %s"), input_filename);
@@ -281,7 +668,6 @@ int main(int argc, char *arg[])
       free(m_arg);
       exit(1);
     }
-    g_free(directory);
 
     id_list = g_list_append(id_list, GINT_TO_POINTER(id));
   }
@@ -300,17 +686,11 @@ int main(int argc, char *arg[])
   {
     for(GList *iter = id_list; iter; iter = g_list_next(iter))
     {
-      int id = GPOINTER_TO_INT(iter->data);
-      dt_image_t *image = dt_image_cache_get(darktable.image_cache, id, 'w');
-      if(dt_exif_xmp_read(image, xmp_filename, 1) != 0)
+      if(_attach_xmp(GPOINTER_TO_INT(iter->data), xmp_filename))
       {
-        fprintf(stderr, _("error: can't open xmp file %s"), xmp_filename);
-        fprintf(stderr, "\n");
         free(m_arg);
         exit(1);
       }
-      // don't write new xmp:
-      dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
     }
   }
 
@@ -325,128 +705,14 @@ int main(int argc, char *arg[])
       printf("[%s]\n", _("empty history stack"));
   }
 
-  // try to find out the export format from the output_filename
-  char *ext = output_filename + strlen(output_filename);
-  while(ext > output_filename && *ext != '.') ext--;
-  *ext = '\0';
-  ext++;
-
-  if(!strcmp(ext, "jpg")) ext = "jpeg";
-
-  if(!strcmp(ext, "tif")) ext = "tiff";
-
-  // init the export data structures
-  dt_imageio_module_format_t *format;
-  dt_imageio_module_storage_t *storage;
-  dt_imageio_module_data_t *sdata, *fdata;
-
-  storage = dt_imageio_get_storage_by_name("disk"); // only exporting to disk makes sense
-  if(storage == NULL)
-  {
-    fprintf(
-        stderr, "%s\n",
-        _("cannot find disk storage module. please check your installation, something seems to be broken."));
-    free(m_arg);
-    exit(1);
-  }
+  const int res = _export_images(&id_list, output_filename, &params);
 
-  sdata = storage->get_params(storage);
-  if(sdata == NULL)
-  {
-    fprintf(stderr, "%s\n", _("failed to get parameters from storage module, aborting export ..."));
-    free(m_arg);
-    exit(1);
-  }
-
-  // and now for the really ugly hacks. don't tell your children about this one or they won't sleep at night
-  // any longer ...
-  g_strlcpy((char *)sdata, output_filename, DT_MAX_PATH_FOR_PARAMS);
-  // all is good now, the last line didn't happen.
-
-  format = dt_imageio_get_format_by_name(ext);
-  if(format == NULL)
-  {
-    fprintf(stderr, _("unknown extension '.%s'"), ext);
-    fprintf(stderr, "\n");
-    free(m_arg);
-    exit(1);
-  }
-
-  fdata = format->get_params(format);
-  if(fdata == NULL)
-  {
-    fprintf(stderr, "%s\n", _("failed to get parameters from format module, aborting export ..."));
-    free(m_arg);
-    exit(1);
-  }
-
-  uint32_t w, h, fw, fh, sw, sh;
-  fw = fh = sw = sh = 0;
-  storage->dimension(storage, sdata, &sw, &sh);
-  format->dimension(format, fdata, &fw, &fh);
-
-  if(sw == 0 || fw == 0)
-    w = sw > fw ? sw : fw;
-  else
-    w = sw < fw ? sw : fw;
-
-  if(sh == 0 || fh == 0)
-    h = sh > fh ? sh : fh;
-  else
-    h = sh < fh ? sh : fh;
-
-  fdata->max_width = width;
-  fdata->max_height = height;
-  fdata->max_width = (w != 0 && fdata->max_width > w) ? w : fdata->max_width;
-  fdata->max_height = (h != 0 && fdata->max_height > h) ? h : fdata->max_height;
-  fdata->style[0] = '\0';
-  fdata->style_append = 1; // make append the default and override with --style-overwrite
-
-  if(style)
-  {
-    g_strlcpy((char *)fdata->style, style, DT_MAX_STYLE_NAME_LENGTH);
-    fdata->style[127] = '\0';
-    if(style_overwrite)
-      fdata->style_append = 0;
-  }
-
-  if(storage->initialize_store)
-  {
-    storage->initialize_store(storage, sdata, &format, &fdata, &id_list, high_quality, upscale);
-
-    format->set_params(format, fdata, format->params_size(format));
-    storage->set_params(storage, sdata, storage->params_size(storage));
-  }
-
-  // TODO: do we want to use the settings from conf?
-  // TODO: expose these via command line arguments
-  dt_colorspaces_color_profile_type_t icc_type = DT_COLORSPACE_NONE;
-  const gchar *icc_filename = NULL;
-  dt_iop_color_intent_t icc_intent = DT_INTENT_LAST;
-
-  // TODO: add a callback to set the bpp without going through the config
-
-  int num = 1;
-  for(GList *iter = id_list; iter; iter = g_list_next(iter), num++)
-  {
-    int id = GPOINTER_TO_INT(iter->data);
-    // TODO: have a parameter in command line to get the export presets
-    dt_export_metadata_t metadata;
-    metadata.flags = dt_lib_export_metadata_default_flags();
-    metadata.list = NULL;
-    storage->store(storage, sdata, id, format, fdata, num, total, high_quality, upscale,
-                   icc_type, icc_filename, icc_intent, &metadata);
-  }
-
-  // cleanup time
-  if(storage->finalize_store) storage->finalize_store(storage, sdata);
-  storage->free_params(storage, sdata);
-  format->free_params(format, fdata);
   g_list_free(id_list);
 
   dt_cleanup();
 
   free(m_arg);
+  return res;
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
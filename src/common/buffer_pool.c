@@ -0,0 +1,212 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/buffer_pool.h"
+#include "common/darktable.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+typedef struct dt_buffer_pool_entry_t
+{
+  void *buf;
+  size_t size;
+  uint32_t generation; // of the last return to the pool
+} dt_buffer_pool_entry_t;
+
+static long _page_faults()
+{
+#ifndef _WIN32
+  struct rusage usage;
+  if(!getrusage(RUSAGE_SELF, &usage)) return usage.ru_minflt;
+#endif
+  return 0;
+}
+
+static size_t _size_class(const size_t size)
+{
+  size_t step = 1;
+  while(step <= size / 2) step <<= 1;
+  step = MAX(step / 8, 64);
+  return (size + step - 1) / step * step;
+}
+
+static void _entry_free(dt_buffer_pool_t *pool, dt_buffer_pool_entry_t *entry)
+{
+  pool->size -= entry->size;
+  dt_free_align(entry->buf);
+  free(entry);
+}
+
+void dt_buffer_pool_init(dt_buffer_pool_t *pool, const size_t max_size)
+{
+  memset(pool, 0, sizeof(dt_buffer_pool_t));
+  dt_pthread_mutex_init(&pool->lock, NULL);
+  pool->max_size = max_size;
+  pool->busy = g_hash_table_new(g_direct_hash, g_direct_equal);
+  pool->faults_start = _page_faults();
+}
+
+void dt_buffer_pool_cleanup(dt_buffer_pool_t *pool)
+{
+  if(!pool->busy) return;
+  // nothing is processing anymore, so nobody is going to return these.
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, pool->busy);
+  while(g_hash_table_iter_next(&iter, &key, &value)) _entry_free(pool, (dt_buffer_pool_entry_t *)value);
+  g_hash_table_destroy(pool->busy);
+  pool->busy = NULL;
+  for(GList *l = pool->idle; l; l = g_list_next(l)) _entry_free(pool, (dt_buffer_pool_entry_t *)l->data);
+  g_list_free(pool->idle);
+  pool->idle = NULL;
+  dt_pthread_mutex_destroy(&pool->lock);
+}
+
+void *dt_buffer_pool_alloc(dt_buffer_pool_t *pool, const size_t size)
+{
+  if(size < DT_BUFFER_POOL_MIN_SIZE || pool->max_size == 0) return dt_alloc_align(64, size);
+
+  const size_t class_size = _size_class(size);
+  dt_buffer_pool_entry_t *entry = NULL;
+
+  dt_pthread_mutex_lock(&pool->lock);
+  pool->requests++;
+  for(GList *l = pool->idle; l; l = g_list_next(l))
+  {
+    dt_buffer_pool_entry_t *idle = (dt_buffer_pool_entry_t *)l->data;
+    if(idle->size == class_size)
+    {
+      entry = idle;
+      pool->idle = g_list_delete_link(pool->idle, l);
+      pool->reused++;
+      break;
+    }
+  }
+  if(!entry)
+  {
+    // make room by dropping the least recently returned buffers
+    while(pool->size + class_size > pool->max_size && pool->idle)
+    {
+      GList *last = g_list_last(pool->idle);
+      _entry_free(pool, (dt_buffer_pool_entry_t *)last->data);
+      pool->idle = g_list_delete_link(pool->idle, last);
+    }
+    if(pool->size + class_size <= pool->max_size)
+    {
+      void *buf = dt_alloc_align(64, class_size);
+      entry = buf ? (dt_buffer_pool_entry_t *)malloc(sizeof(dt_buffer_pool_entry_t)) : NULL;
+      if(entry)
+      {
+        entry->buf = buf;
+        entry->size = class_size;
+        pool->size += class_size;
+        pool->peak = MAX(pool->peak, pool->size);
+        pool->fresh++;
+      }
+      else
+        dt_free_align(buf);
+    }
+  }
+  if(entry)
+  {
+    g_hash_table_insert(pool->busy, entry->buf, entry);
+    pool->busy_size += entry->size;
+    pool->peak_busy = MAX(pool->peak_busy, pool->busy_size);
+  }
+  else
+    pool->unpooled++;
+  dt_pthread_mutex_unlock(&pool->lock);
+
+  return entry ? entry->buf : dt_alloc_align(64, size);
+}
+
+void dt_buffer_pool_free(dt_buffer_pool_t *pool, void *buf)
+{
+  if(!buf) return;
+  if(pool->max_size == 0 || !pool->busy)
+  {
+    dt_free_align(buf);
+    return;
+  }
+  dt_pthread_mutex_lock(&pool->lock);
+  dt_buffer_pool_entry_t *entry = (dt_buffer_pool_entry_t *)g_hash_table_lookup(pool->busy, buf);
+  if(entry)
+  {
+    g_hash_table_remove(pool->busy, buf);
+    pool->busy_size -= entry->size;
+    entry->generation = pool->generation;
+    pool->idle = g_list_prepend(pool->idle, entry);
+  }
+  dt_pthread_mutex_unlock(&pool->lock);
+  // not ours, it was too small or did not fit
+  if(!entry) dt_free_align(buf);
+}
+
+void dt_buffer_pool_trim(dt_buffer_pool_t *pool)
+{
+  dt_pthread_mutex_lock(&pool->lock);
+  pool->generation++;
+  GList *l = pool->idle;
+  while(l)
+  {
+    GList *next = g_list_next(l);
+    dt_buffer_pool_entry_t *entry = (dt_buffer_pool_entry_t *)l->data;
+    if(entry->generation + 1 < pool->generation)
+    {
+      _entry_free(pool, entry);
+      pool->idle = g_list_delete_link(pool->idle, l);
+    }
+    l = next;
+  }
+  dt_pthread_mutex_unlock(&pool->lock);
+}
+
+void dt_buffer_pool_release_idle(dt_buffer_pool_t *pool)
+{
+  dt_pthread_mutex_lock(&pool->lock);
+  for(GList *l = pool->idle; l; l = g_list_next(l)) _entry_free(pool, (dt_buffer_pool_entry_t *)l->data);
+  g_list_free(pool->idle);
+  pool->idle = NULL;
+  dt_pthread_mutex_unlock(&pool->lock);
+}
+
+void dt_buffer_pool_print(dt_buffer_pool_t *pool, const char *name)
+{
+  dt_pthread_mutex_lock(&pool->lock);
+  fprintf(stderr,
+          "[buffer_pool] [%s] %" PRIu64 " requests, %.1f%% reused, %" PRIu64 " fresh, %" PRIu64
+          " over the cap of %.1f MB\n",
+          name, pool->requests, pool->requests ? 100.0 * pool->reused / pool->requests : 0.0, pool->fresh,
+          pool->unpooled, pool->max_size / (1024.0 * 1024.0));
+  fprintf(stderr,
+          "[buffer_pool] [%s] %.1f MB held, %.1f MB borrowed, peak %.1f MB held, %.1f MB borrowed, %ld page faults in "
+          "the process since creation\n",
+          name, pool->size / (1024.0 * 1024.0), pool->busy_size / (1024.0 * 1024.0), pool->peak / (1024.0 * 1024.0),
+          pool->peak_busy / (1024.0 * 1024.0), _page_faults() - pool->faults_start);
+  dt_pthread_mutex_unlock(&pool->lock);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,81 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/dtpthread.h"
+
+#include <glib.h>
+#include <inttypes.h>
+#include <stddef.h>
+
+/**
+ * pool of large scratch buffers, one per pixelpipe.
+ *
+ * full frame temporaries are allocated over and over with the same sizes while the same image is being
+ * edited. returning them to the pool instead of the system saves the mmap/munmap round trip and, more
+ * importantly, faulting in the pages again on first touch. sizes are rounded up to classes 1/8 of a power
+ * of two apart, so slightly different rois still share buffers. the memory owned by the pool, in use or
+ * idle, never exceeds its cap; requests beyond that are served by plain allocations.
+ *
+ * buffers keep the numa placement they got on first touch, which is by the threads that processed them.
+ */
+
+// smaller buffers are cheap enough to get from malloc
+#define DT_BUFFER_POOL_MIN_SIZE (((size_t)1) << 20)
+
+typedef struct dt_buffer_pool_t
+{
+  dt_pthread_mutex_t lock;
+  size_t max_size;   // hard cap on the bytes owned by the pool
+  size_t size;       // bytes owned by the pool, idle or in use
+  GHashTable *busy;  // pointer -> dt_buffer_pool_entry_t of borrowed buffers
+  GList *idle;       // dt_buffer_pool_entry_t of returned buffers, most recently returned first
+  uint32_t generation;
+  // statistics:
+  uint64_t requests;
+  uint64_t reused;
+  uint64_t fresh;    // buffers that had to be allocated and faulted in
+  uint64_t unpooled; // requests that did not fit under the cap
+  size_t peak;       // largest size
+  size_t peak_busy;  // largest amount of borrowed bytes
+  size_t busy_size;
+  long faults_start; // minor page faults of the process when the pool was created
+} dt_buffer_pool_t;
+
+/** max_size 0 disables pooling, all buffers are plain allocations. */
+void dt_buffer_pool_init(dt_buffer_pool_t *pool, const size_t max_size);
+void dt_buffer_pool_cleanup(dt_buffer_pool_t *pool);
+
+/** borrows a 64 byte aligned buffer of at least size bytes, uninitialized. NULL if out of memory. */
+void *dt_buffer_pool_alloc(dt_buffer_pool_t *pool, const size_t size);
+
+/** returns a buffer obtained from dt_buffer_pool_alloc(). NULL is fine. */
+void dt_buffer_pool_free(dt_buffer_pool_t *pool, void *buf);
+
+/** releases idle buffers that have not been used since the previous call. call after each pipe run. */
+void dt_buffer_pool_trim(dt_buffer_pool_t *pool);
+
+/** releases all idle buffers, for when the memory has to go to something else, like tiling. */
+void dt_buffer_pool_release_idle(dt_buffer_pool_t *pool);
+
+void dt_buffer_pool_print(dt_buffer_pool_t *pool, const char *name);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
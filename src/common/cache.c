@@ -27,84 +27,275 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-// this implements a concurrent LRU cache
+// this implements a concurrent LRU cache.
+//
+// the key space is split into a power of two number of shards, each with its own
+// mutex, hashtable and intrusive lru list. threads working on different images
+// thus (mostly) never touch the same lock. the cost is tracked globally so the
+// quota keeps its meaning; garbage collection starts in the shard of the caller
+// and only try-locks the other shards, so it can never deadlock.
 
-void dt_cache_init(
+static inline uint32_t _shard_index(const dt_cache_t *cache, const uint32_t key)
+{
+  // fibonacci hashing: image ids are sequential, spread them over all shards
+  return ((key * 2654435761u) >> 16) & (cache->num_shards - 1);
+}
+
+static inline dt_cache_shard_t *_get_shard(const dt_cache_t *cache, const uint32_t key)
+{
+  return cache->shards + _shard_index(cache, key);
+}
+
+static inline void _lru_unlink(dt_cache_shard_t *shard, dt_cache_entry_t *entry)
+{
+  if(entry->lru_prev) entry->lru_prev->lru_next = entry->lru_next;
+  else shard->lru = entry->lru_next;
+  if(entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+  else shard->mru = entry->lru_prev;
+  entry->lru_prev = entry->lru_next = NULL;
+}
+
+static inline void _lru_append(dt_cache_shard_t *shard, dt_cache_entry_t *entry)
+{
+  entry->lru_next = NULL;
+  entry->lru_prev = shard->mru;
+  if(shard->mru) shard->mru->lru_next = entry;
+  else shard->lru = entry;
+  shard->mru = entry;
+}
+
+// called with the shard lock held, after the entry has been locked on a hit.
+static inline void _lru_touch(dt_cache_t *cache, dt_cache_shard_t *shard, dt_cache_entry_t *entry)
+{
+  if(cache->policy == DT_CACHE_POLICY_CLOCK)
+    entry->_referenced = 1;
+  else if(shard->mru != entry)
+  {
+    // bubble up in lru list:
+    _lru_unlink(shard, entry);
+    _lru_append(shard, entry);
+  }
+}
+
+static void _free_entry(dt_cache_t *cache, dt_cache_entry_t *entry)
+{
+  if(cache->cleanup)
+  {
+    assert(entry->data_size);
+    ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
+
+    cache->cleanup(cache->cleanup_data, entry);
+  }
+  else
+    dt_free_align(entry->data);
+}
+
+void dt_cache_init_sharded(
     dt_cache_t *cache,
     size_t entry_size,
-    size_t cost_quota)
+    size_t cost_quota,
+    uint32_t num_shards)
 {
+  uint32_t shards = 1;
+  while(shards < num_shards) shards <<= 1;
+
   cache->cost = 0;
-  cache->lru = 0;
   cache->entry_size = entry_size;
   cache->cost_quota = cost_quota;
-  dt_pthread_mutex_init(&cache->lock, 0);
+  cache->num_shards = shards;
+  cache->policy = DT_CACHE_POLICY_LRU;
   cache->allocate = 0;
   cache->allocate_data = 0;
   cache->cleanup = 0;
   cache->cleanup_data = 0;
-  cache->hashtable = g_hash_table_new(0, 0);
+  cache->shards = (dt_cache_shard_t *)dt_alloc_align(64, sizeof(dt_cache_shard_t) * shards);
+  memset(cache->shards, 0, sizeof(dt_cache_shard_t) * shards);
+  for(uint32_t k = 0; k < shards; k++)
+  {
+    dt_cache_shard_t *shard = cache->shards + k;
+    dt_pthread_mutex_init(&shard->lock, 0);
+    shard->hashtable = g_hash_table_new(0, 0);
+    shard->lru = shard->mru = NULL;
+    shard->num_entries = 0;
+  }
+}
+
+void dt_cache_init(
+    dt_cache_t *cache,
+    size_t entry_size,
+    size_t cost_quota)
+{
+  dt_cache_init_sharded(cache, entry_size, cost_quota, DT_CACHE_DEFAULT_SHARDS);
 }
 
 void dt_cache_cleanup(dt_cache_t *cache)
 {
-  g_hash_table_destroy(cache->hashtable);
-  GList *l = cache->lru;
-  while(l)
+  for(uint32_t k = 0; k < cache->num_shards; k++)
   {
-    dt_cache_entry_t *entry = (dt_cache_entry_t *)l->data;
-
-    if(cache->cleanup)
+    dt_cache_shard_t *shard = cache->shards + k;
+    g_hash_table_destroy(shard->hashtable);
+    dt_cache_entry_t *entry = shard->lru;
+    while(entry)
     {
-      assert(entry->data_size);
-      ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
-
-      cache->cleanup(cache->cleanup_data, entry);
+      dt_cache_entry_t *next = entry->lru_next;
+      _free_entry(cache, entry);
+      dt_pthread_rwlock_destroy(&entry->lock);
+      g_slice_free1(sizeof(*entry), entry);
+      entry = next;
     }
-    else
-      dt_free_align(entry->data);
-
-    dt_pthread_rwlock_destroy(&entry->lock);
-    g_slice_free1(sizeof(*entry), entry);
-    l = g_list_next(l);
+    dt_pthread_mutex_destroy(&shard->lock);
   }
-  g_list_free(cache->lru);
-  dt_pthread_mutex_destroy(&cache->lock);
+  dt_free_align(cache->shards);
+  cache->shards = NULL;
+  cache->num_shards = 0;
 }
 
 int32_t dt_cache_contains(dt_cache_t *cache, const uint32_t key)
 {
-  dt_pthread_mutex_lock(&cache->lock);
-  int32_t result = g_hash_table_contains(cache->hashtable, GINT_TO_POINTER(key));
-  dt_pthread_mutex_unlock(&cache->lock);
+  dt_cache_shard_t *shard = _get_shard(cache, key);
+  dt_pthread_mutex_lock(&shard->lock);
+  int32_t result = g_hash_table_contains(shard->hashtable, GINT_TO_POINTER(key));
+  dt_pthread_mutex_unlock(&shard->lock);
   return result;
 }
 
+size_t dt_cache_size(dt_cache_t *cache)
+{
+  size_t size = 0;
+  for(uint32_t k = 0; k < cache->num_shards; k++)
+  {
+    dt_cache_shard_t *shard = cache->shards + k;
+    dt_pthread_mutex_lock(&shard->lock);
+    size += shard->num_entries;
+    dt_pthread_mutex_unlock(&shard->lock);
+  }
+  return size;
+}
+
+int dt_cache_check_consistency(dt_cache_t *cache)
+{
+  int total = 0;
+  for(uint32_t k = 0; k < cache->num_shards; k++)
+  {
+    dt_cache_shard_t *shard = cache->shards + k;
+    int fwd = 0, bwd = 0;
+    for(dt_cache_entry_t *e = shard->lru; e; e = e->lru_next)
+    {
+      if(_shard_index(cache, e->key) != k) return -1;
+      if(g_hash_table_lookup(shard->hashtable, GINT_TO_POINTER(e->key)) != e) return -1;
+      fwd++;
+    }
+    for(dt_cache_entry_t *e = shard->mru; e; e = e->lru_prev) bwd++;
+    if(fwd != bwd || fwd != (int)shard->num_entries || fwd != (int)g_hash_table_size(shard->hashtable))
+      return -1;
+    total += fwd;
+  }
+  return total;
+}
+
 int dt_cache_for_all(
     dt_cache_t *cache,
     int (*process)(const uint32_t key, const void *data, void *user_data),
     void *user_data)
 {
-  dt_pthread_mutex_lock(&cache->lock);
-  GHashTableIter iter;
-  gpointer key, value;
-
-  g_hash_table_iter_init (&iter, cache->hashtable);
-  while (g_hash_table_iter_next (&iter, &key, &value))
+  for(uint32_t k = 0; k < cache->num_shards; k++)
   {
-    dt_cache_entry_t *entry = (dt_cache_entry_t *)value;
-    const int err = process(GPOINTER_TO_INT(key), entry->data, user_data);
-    if(err)
+    dt_cache_shard_t *shard = cache->shards + k;
+    dt_pthread_mutex_lock(&shard->lock);
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init (&iter, shard->hashtable);
+    while (g_hash_table_iter_next (&iter, &key, &value))
     {
-      dt_pthread_mutex_unlock(&cache->lock);
-      return err;
+      dt_cache_entry_t *entry = (dt_cache_entry_t *)value;
+      const int err = process(GPOINTER_TO_INT(key), entry->data, user_data);
+      if(err)
+      {
+        dt_pthread_mutex_unlock(&shard->lock);
+        return err;
+      }
     }
+    dt_pthread_mutex_unlock(&shard->lock);
   }
-  dt_pthread_mutex_unlock(&cache->lock);
   return 0;
 }
 
+// evict unlocked entries from one shard until the global fill ratio is met.
+// the shard lock has to be held by the caller.
+static void _cache_gc_shard(dt_cache_t *cache, dt_cache_shard_t *shard, const float fill_ratio)
+{
+  dt_cache_entry_t *entry = shard->lru;
+  // for the clock policy every entry gets at most one second chance per sweep:
+  size_t budget = 2 * shard->num_entries;
+  while(entry && budget--)
+  {
+    // we might remove this element, so walk to the next one while we still have the pointer..
+    dt_cache_entry_t *next = entry->lru_next;
+    if(cache->cost < cache->cost_quota * fill_ratio) break;
+
+    if(cache->policy == DT_CACHE_POLICY_CLOCK && entry->_referenced)
+    {
+      // second chance: clear the reference bit and move behind the hand
+      entry->_referenced = 0;
+      if(next)
+      {
+        _lru_unlink(shard, entry);
+        _lru_append(shard, entry);
+      }
+      entry = next;
+      continue;
+    }
+
+    // if still locked by anyone else give up:
+    if(dt_pthread_rwlock_trywrlock(&entry->lock))
+    {
+      entry = next;
+      continue;
+    }
+
+    if(entry->_lock_demoting)
+    {
+      // oops, we are currently demoting (rw -> r) lock to this entry in some thread. do not touch!
+      dt_pthread_rwlock_unlock(&entry->lock);
+      entry = next;
+      continue;
+    }
+
+    // delete!
+    g_hash_table_remove(shard->hashtable, GINT_TO_POINTER(entry->key));
+    _lru_unlink(shard, entry);
+    shard->num_entries--;
+    __sync_fetch_and_sub(&cache->cost, entry->cost);
+
+    _free_entry(cache, entry);
+
+    dt_pthread_rwlock_unlock(&entry->lock);
+    dt_pthread_rwlock_destroy(&entry->lock);
+    g_slice_free1(sizeof(*entry), entry);
+    entry = next;
+  }
+}
+
+// garbage collection from within dt_cache_get(), with the lock of `own` held.
+// other shards are only try-locked: we hold a shard lock already and must not
+// impose a lock order.
+static void _cache_gc_locked(dt_cache_t *cache, dt_cache_shard_t *own, const float fill_ratio)
+{
+  _cache_gc_shard(cache, own, fill_ratio);
+  const uint32_t own_index = own - cache->shards;
+  for(uint32_t k = 1; k < cache->num_shards; k++)
+  {
+    if(cache->cost < cache->cost_quota * fill_ratio) return;
+    dt_cache_shard_t *shard = cache->shards + ((own_index + k) & (cache->num_shards - 1));
+    if(dt_pthread_mutex_trylock(&shard->lock)) continue;
+    _cache_gc_shard(cache, shard, fill_ratio);
+    dt_pthread_mutex_unlock(&shard->lock);
+  }
+}
+
 // return read locked bucket, or NULL if it's not already there.
 // never attempt to allocate a new slot.
 dt_cache_entry_t *dt_cache_testget(dt_cache_t *cache, const uint32_t key, char mode)
@@ -113,9 +304,10 @@ dt_cache_entry_t *dt_cache_testget(dt_cache_t *cache, const uint32_t key, char m
   gboolean res;
   int result;
   double start = dt_get_wtime();
-  dt_pthread_mutex_lock(&cache->lock);
+  dt_cache_shard_t *shard = _get_shard(cache, key);
+  dt_pthread_mutex_lock(&shard->lock);
   res = g_hash_table_lookup_extended(
-      cache->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
+      shard->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
   if(res)
   {
     dt_cache_entry_t *entry = (dt_cache_entry_t *)value;
@@ -125,13 +317,11 @@ dt_cache_entry_t *dt_cache_testget(dt_cache_t *cache, const uint32_t key, char m
     if(result)
     { // need to give up mutex so other threads have a chance to get in between and
       // free the lock we're trying to acquire:
-      dt_pthread_mutex_unlock(&cache->lock);
+      dt_pthread_mutex_unlock(&shard->lock);
       return 0;
     }
-    // bubble up in lru list:
-    cache->lru = g_list_remove_link(cache->lru, entry->link);
-    cache->lru = g_list_concat(cache->lru, entry->link);
-    dt_pthread_mutex_unlock(&cache->lock);
+    _lru_touch(cache, shard, entry);
+    dt_pthread_mutex_unlock(&shard->lock);
     double end = dt_get_wtime();
     if(end - start > 0.1)
       fprintf(stderr, "try+ wait time %.06fs mode %c \n", end - start, mode);
@@ -146,7 +336,7 @@ dt_cache_entry_t *dt_cache_testget(dt_cache_t *cache, const uint32_t key, char m
 
     return entry;
   }
-  dt_pthread_mutex_unlock(&cache->lock);
+  dt_pthread_mutex_unlock(&shard->lock);
   double end = dt_get_wtime();
   if(end - start > 0.1)
     fprintf(stderr, "try- wait time %.06fs\n", end - start);
@@ -162,10 +352,11 @@ dt_cache_entry_t *dt_cache_get_with_caller(dt_cache_t *cache, const uint32_t key
   gboolean res;
   int result;
   double start = dt_get_wtime();
+  dt_cache_shard_t *shard = _get_shard(cache, key);
 restart:
-  dt_pthread_mutex_lock(&cache->lock);
+  dt_pthread_mutex_lock(&shard->lock);
   res = g_hash_table_lookup_extended(
-      cache->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
+      shard->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
   if(res)
   { // yay, found. read lock and pass on.
     dt_cache_entry_t *entry = (dt_cache_entry_t *)value;
@@ -174,14 +365,12 @@ restart:
     if(result)
     { // need to give up mutex so other threads have a chance to get in between and
       // free the lock we're trying to acquire:
-      dt_pthread_mutex_unlock(&cache->lock);
+      dt_pthread_mutex_unlock(&shard->lock);
       g_usleep(5);
       goto restart;
     }
-    // bubble up in lru list:
-    cache->lru = g_list_remove_link(cache->lru, entry->link);
-    cache->lru = g_list_concat(cache->lru, entry->link);
-    dt_pthread_mutex_unlock(&cache->lock);
+    _lru_touch(cache, shard, entry);
+    dt_pthread_mutex_unlock(&shard->lock);
 
 #ifdef _DEBUG
     const pthread_t writer = dt_pthread_rwlock_get_writer(&entry->lock);
@@ -213,7 +402,7 @@ restart:
   if(cache->cost > 0.8f * cache->cost_quota)
   {
     // need to roll back all the way to get a consistent lock state:
-    dt_cache_gc(cache, 0.8f);
+    _cache_gc_locked(cache, shard, 0.8f);
   }
 
   // here dies your 32-bit system:
@@ -223,11 +412,12 @@ restart:
   entry->data = 0;
   entry->data_size = cache->entry_size;
   entry->cost = 1;
-  entry->link = g_list_append(0, entry);
+  entry->lru_prev = entry->lru_next = NULL;
   entry->key = key;
   entry->_lock_demoting = 0;
+  entry->_referenced = 0;
 
-  g_hash_table_insert(cache->hashtable, GINT_TO_POINTER(key), entry);
+  g_hash_table_insert(shard->hashtable, GINT_TO_POINTER(key), entry);
 
   assert(cache->allocate || entry->data_size);
 
@@ -246,12 +436,13 @@ restart:
   if(write) dt_pthread_rwlock_wrlock_with_caller(&entry->lock, file, line);
   else      dt_pthread_rwlock_rdlock_with_caller(&entry->lock, file, line);
 
-  cache->cost += entry->cost;
+  __sync_fetch_and_add(&cache->cost, entry->cost);
 
   // put at end of lru list (most recently used):
-  cache->lru = g_list_concat(cache->lru, entry->link);
+  _lru_append(shard, entry);
+  shard->num_entries++;
 
-  dt_pthread_mutex_unlock(&cache->lock);
+  dt_pthread_mutex_unlock(&shard->lock);
   double end = dt_get_wtime();
   if(end - start > 0.1)
     fprintf(stderr, "wait time %.06fs\n", end - start);
@@ -267,22 +458,23 @@ int dt_cache_remove(dt_cache_t *cache, const uint32_t key)
   gboolean res;
   int result;
   dt_cache_entry_t *entry;
+  dt_cache_shard_t *shard = _get_shard(cache, key);
 restart:
-  dt_pthread_mutex_lock(&cache->lock);
+  dt_pthread_mutex_lock(&shard->lock);
 
   res = g_hash_table_lookup_extended(
-      cache->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
+      shard->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
   entry = (dt_cache_entry_t *)value;
   if(!res)
   { // not found in cache, not deleting.
-    dt_pthread_mutex_unlock(&cache->lock);
+    dt_pthread_mutex_unlock(&shard->lock);
     return 1;
   }
   // need write lock to be able to delete:
   result = dt_pthread_rwlock_trywrlock(&entry->lock);
   if(result)
   {
-    dt_pthread_mutex_unlock(&cache->lock);
+    dt_pthread_mutex_unlock(&shard->lock);
     g_usleep(5);
     goto restart;
   }
@@ -291,76 +483,38 @@ restart:
   {
     // oops, we are currently demoting (rw -> r) lock to this entry in some thread. do not touch!
     dt_pthread_rwlock_unlock(&entry->lock);
-    dt_pthread_mutex_unlock(&cache->lock);
+    dt_pthread_mutex_unlock(&shard->lock);
     g_usleep(5);
     goto restart;
   }
 
-  gboolean removed = g_hash_table_remove(cache->hashtable, GINT_TO_POINTER(key));
+  gboolean removed = g_hash_table_remove(shard->hashtable, GINT_TO_POINTER(key));
   (void)removed; // make non-assert compile happy
   assert(removed);
-  cache->lru = g_list_delete_link(cache->lru, entry->link);
-
-  if(cache->cleanup)
-  {
-    assert(entry->data_size);
-    ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
+  _lru_unlink(shard, entry);
+  shard->num_entries--;
 
-    cache->cleanup(cache->cleanup_data, entry);
-  }
-  else
-    dt_free_align(entry->data);
+  _free_entry(cache, entry);
 
   dt_pthread_rwlock_unlock(&entry->lock);
   dt_pthread_rwlock_destroy(&entry->lock);
-  cache->cost -= entry->cost;
+  __sync_fetch_and_sub(&cache->cost, entry->cost);
   g_slice_free1(sizeof(*entry), entry);
 
-  dt_pthread_mutex_unlock(&cache->lock);
+  dt_pthread_mutex_unlock(&shard->lock);
   return 0;
 }
 
-// best-effort garbage collection. never blocks, never fails. well, sometimes it just doesn't free anything.
+// best-effort garbage collection. never blocks on entries, never fails. well, sometimes it just doesn't free anything.
 void dt_cache_gc(dt_cache_t *cache, const float fill_ratio)
 {
-  GList *l = cache->lru;
-  int cnt = 0;
-  while(l)
+  for(uint32_t k = 0; k < cache->num_shards; k++)
   {
-    cnt++;
-    dt_cache_entry_t *entry = (dt_cache_entry_t *)l->data;
-    assert(entry->link->data == entry);
-    l = g_list_next(l); // we might remove this element, so walk to the next one while we still have the pointer..
-    if(cache->cost < cache->cost_quota * fill_ratio) break;
-
-    // if still locked by anyone else give up:
-    if(dt_pthread_rwlock_trywrlock(&entry->lock)) continue;
-
-    if(entry->_lock_demoting)
-    {
-      // oops, we are currently demoting (rw -> r) lock to this entry in some thread. do not touch!
-      dt_pthread_rwlock_unlock(&entry->lock);
-      continue;
-    }
-
-    // delete!
-    g_hash_table_remove(cache->hashtable, GINT_TO_POINTER(entry->key));
-    cache->lru = g_list_delete_link(cache->lru, entry->link);
-    cache->cost -= entry->cost;
-
-    if(cache->cleanup)
-    {
-      assert(entry->data_size);
-      ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
-
-      cache->cleanup(cache->cleanup_data, entry);
-    }
-    else
-      dt_free_align(entry->data);
-
-    dt_pthread_rwlock_unlock(&entry->lock);
-    dt_pthread_rwlock_destroy(&entry->lock);
-    g_slice_free1(sizeof(*entry), entry);
+    if(cache->cost < cache->cost_quota * fill_ratio) return;
+    dt_cache_shard_t *shard = cache->shards + k;
+    dt_pthread_mutex_lock(&shard->lock);
+    _cache_gc_shard(cache, shard, fill_ratio);
+    dt_pthread_mutex_unlock(&shard->lock);
   }
 }
 
@@ -23,14 +23,26 @@
 #include <inttypes.h>
 #include <stddef.h>
 
+// default number of independently locked shards, has to be a power of two.
+#define DT_CACHE_DEFAULT_SHARDS 16
+
+typedef enum dt_cache_policy_t
+{
+  DT_CACHE_POLICY_LRU = 0,   // exact lru: every hit moves the entry to the tail of its shard's list
+  DT_CACHE_POLICY_CLOCK = 1  // approximate lru (second chance): a hit only sets the reference bit
+} dt_cache_policy_t;
+
 typedef struct dt_cache_entry_t
 {
   void *data;
   size_t data_size;
   size_t cost;
-  GList *link;
+  // intrusive lru list of the shard this entry lives in, no allocation per access
+  struct dt_cache_entry_t *lru_prev;
+  struct dt_cache_entry_t *lru_next;
   dt_pthread_rwlock_t lock;
   int _lock_demoting;
+  int _referenced; // clock policy: touched since the hand last passed by
   uint32_t key;
 }
 dt_cache_entry_t;
@@ -38,17 +50,30 @@ dt_cache_entry_t;
 typedef void((*dt_cache_allocate_t)(void *userdata, dt_cache_entry_t *entry));
 typedef void((*dt_cache_cleanup_t)(void *userdata, dt_cache_entry_t *entry));
 
+typedef struct dt_cache_shard_t
+{
+  dt_pthread_mutex_t lock; // protects the hashtable and the lru list of this shard only
+
+  GHashTable *hashtable;   // stores (key, entry) pairs
+  dt_cache_entry_t *lru;   // head: about to be kicked from cache
+  dt_cache_entry_t *mru;   // tail: most recently used (or inserted, for the clock policy)
+  size_t num_entries;
+
+  // keep neighbouring shard locks on separate cache lines
+  char _padding[64];
+}
+dt_cache_shard_t;
+
 typedef struct dt_cache_t
 {
-  dt_pthread_mutex_t lock; // big fat lock. we're only expecting a couple hand full of cpu threads to use this concurrently.
+  dt_cache_shard_t *shards; // one lock per shard, entries are distributed by hashed key
+  uint32_t num_shards;      // power of two
+  dt_cache_policy_t policy;
 
   size_t entry_size; // cache line allocation
-  size_t cost;       // user supplied cost per cache line (bytes?)
+  size_t cost;       // user supplied cost per cache line (bytes?), sum over all shards. updated atomically.
   size_t cost_quota; // quota to try and meet. but don't use as hard limit.
 
-  GHashTable *hashtable; // stores (key, entry) pairs
-  GList *lru;            // last element is most recently used, first is about to be kicked from cache.
-
   // callback functions for cache misses/garbage collection
   dt_cache_allocate_t allocate;
   dt_cache_allocate_t cleanup;
@@ -59,8 +84,16 @@ dt_cache_t;
 
 // entry size is only used if alloc callback is 0
 void dt_cache_init(dt_cache_t *cache, size_t entry_size, size_t cost_quota);
+// same, with an explicit number of shards (rounded up to a power of two, 1 gives the old single lock behaviour)
+void dt_cache_init_sharded(dt_cache_t *cache, size_t entry_size, size_t cost_quota, uint32_t num_shards);
 void dt_cache_cleanup(dt_cache_t *cache);
 
+// only change the replacement policy before the cache is used
+static inline void dt_cache_set_policy(dt_cache_t *cache, dt_cache_policy_t policy)
+{
+  cache->policy = policy;
+}
+
 static inline void dt_cache_set_allocate_callback(dt_cache_t *cache, dt_cache_allocate_t allocate_cb,
                                                   void *allocate_data)
 {
@@ -87,14 +120,20 @@ void dt_cache_release_with_caller(dt_cache_t *cache, dt_cache_entry_t *entry, co
 int32_t dt_cache_contains(dt_cache_t *cache, const uint32_t key);
 // returns 0 on success, 1 if the key was not found.
 int32_t dt_cache_remove(dt_cache_t *cache, const uint32_t key);
-// removes from the tip of the lru list, until the fill ratio of the hashtable
+// removes from the tip of the lru lists, until the fill ratio of the hashtable
 // goes below the given parameter, in terms of the user defined cost measure.
-// will never lock and never fail, but sometimes not free memory (in case all
-// is locked)
+// will never block on entries and never fail, but sometimes not free memory
+// (in case all is locked). must not be called with any shard lock held.
 void dt_cache_gc(dt_cache_t *cache, const float fill_ratio);
 
+// number of entries currently in the cache, summed over all shards.
+size_t dt_cache_size(dt_cache_t *cache);
+// walks all lru lists forward and backward and returns the number of entries, or -1 if
+// the lists are inconsistent with the hashtables. not thread safe, for tests only.
+int dt_cache_check_consistency(dt_cache_t *cache);
+
 // iterate over all currently contained data blocks.
-// not thread safe! only use this for init/cleanup!
+// locks one shard at a time, so not a consistent snapshot! only use this for init/cleanup!
 // returns non zero the first time process() returns non zero.
 int dt_cache_for_all(dt_cache_t *cache,
     int (*process)(const uint32_t key, const void *data, void *user_data),
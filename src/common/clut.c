@@ -0,0 +1,369 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/clut.h"
+
+#include <glib/gstdio.h>
+#include <inttypes.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// unused cluts kept around, a packed 65^3 clut takes 4.4 MB
+#define DT_CLUT_CACHE_UNUSED 4
+
+struct dt_clut_cache_t
+{
+  dt_pthread_mutex_t lock;
+  GHashTable *entries; // key -> entry
+  GHashTable *cluts;   // packed clut -> entry
+  GQueue unused;       // entries nobody holds, most recently released first
+  uint64_t hits, misses;
+};
+
+typedef struct dt_clut_cache_entry_t
+{
+  gchar *key;
+  int refcount;
+  float *clut;
+  uint16_t level;
+} dt_clut_cache_entry_t;
+
+float *dt_clut_pack(const float *const clut, const uint16_t level)
+{
+  const size_t nodes = (size_t)level * level * level;
+  float *const packed = dt_alloc_align(64, sizeof(float) * 4 * nodes);
+  if(!packed) return NULL;
+#ifdef _OPENMP
+#pragma omp parallel for SIMD() default(none) dt_omp_firstprivate(clut, nodes, packed) schedule(static)
+#endif
+  for(size_t k = 0; k < nodes; k++)
+  {
+    packed[4 * k + 0] = clut[3 * k + 0];
+    packed[4 * k + 1] = clut[3 * k + 1];
+    packed[4 * k + 2] = clut[3 * k + 2];
+    packed[4 * k + 3] = 0.0f;
+  }
+  return packed;
+}
+
+// the node below the color and the offsets from there, shared by all kernels
+static inline size_t _clut_locate(const float *const pixel, const uint16_t level, float rgbd[3])
+{
+  int rgbi[3];
+  for(int c = 0; c < 3; c++)
+  {
+    const float v = fminf(fmaxf(pixel[c], 0.0f), 1.0f) * (float)(level - 1);
+    rgbi[c] = CLAMP((int)v, 0, level - 2);
+    rgbd[c] = v - rgbi[c];
+  }
+  return 4 * (rgbi[0] + ((size_t)rgbi[1] + (size_t)rgbi[2] * level) * level);
+}
+
+// the two inner corners of the tetrahedron holding rgbd and the weights of its four corners
+static inline void _clut_tetrahedron(const float rgbd[3], const size_t level, size_t *a, size_t *b, float w[4])
+{
+  const size_t r = 4, g = 4 * level, bl = 4 * level * level;
+  float max, mid, min;
+  if(rgbd[0] > rgbd[1])
+  {
+    if(rgbd[1] > rgbd[2])
+    {
+      *a = r; *b = r + g;
+      max = rgbd[0]; mid = rgbd[1]; min = rgbd[2];
+    }
+    else if(rgbd[0] > rgbd[2])
+    {
+      *a = r; *b = r + bl;
+      max = rgbd[0]; mid = rgbd[2]; min = rgbd[1];
+    }
+    else
+    {
+      *a = bl; *b = r + bl;
+      max = rgbd[2]; mid = rgbd[0]; min = rgbd[1];
+    }
+  }
+  else
+  {
+    if(rgbd[2] > rgbd[1])
+    {
+      *a = bl; *b = g + bl;
+      max = rgbd[2]; mid = rgbd[1]; min = rgbd[0];
+    }
+    else if(rgbd[2] > rgbd[0])
+    {
+      *a = g; *b = g + bl;
+      max = rgbd[1]; mid = rgbd[2]; min = rgbd[0];
+    }
+    else
+    {
+      *a = g; *b = r + g;
+      max = rgbd[1]; mid = rgbd[0]; min = rgbd[2];
+    }
+  }
+  w[0] = 1.0f - max;
+  w[1] = max - mid;
+  w[2] = mid - min;
+  w[3] = min;
+}
+
+// from OpenColorIO
+// https://github.com/imageworks/OpenColorIO/blob/master/src/OpenColorIO/ops/Lut3D/Lut3DOp.cpp
+void dt_clut_tetrahedral(const float *const in, float *const out, const size_t pixel_nb,
+                         const float *const clut, const uint16_t level)
+{
+  const size_t i111 = 4 * (1 + (size_t)level + (size_t)level * level);
+#ifdef _OPENMP
+#pragma omp parallel for default(none) dt_omp_firstprivate(clut, in, i111, level, out, pixel_nb) schedule(static)
+#endif
+  for(size_t k = 0; k < pixel_nb; k++)
+  {
+    const float *const input = in + 4 * k;
+    float *const output = out + 4 * k;
+    float rgbd[3], w[4];
+    size_t a, b;
+    const float *const c000 = clut + _clut_locate(input, level, rgbd);
+    _clut_tetrahedron(rgbd, level, &a, &b, w);
+    const float alpha = input[3];
+    for(int c = 0; c < 3; c++)
+      output[c] = w[0] * c000[c] + w[1] * c000[a + c] + w[2] * c000[b + c] + w[3] * c000[i111 + c];
+    output[3] = alpha;
+  }
+}
+
+// From `HaldCLUT_correct.c' by Eskil Steenberg (http://www.quelsolaar.com) (BSD licensed)
+void dt_clut_trilinear(const float *const in, float *const out, const size_t pixel_nb,
+                       const float *const clut, const uint16_t level)
+{
+  const size_t g = 4 * (size_t)level, b = 4 * (size_t)level * level;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) dt_omp_firstprivate(b, clut, g, in, level, out, pixel_nb) schedule(static)
+#endif
+  for(size_t k = 0; k < pixel_nb; k++)
+  {
+    const float *const input = in + 4 * k;
+    float *const output = out + 4 * k;
+    float rgbd[3];
+    const float *const c000 = clut + _clut_locate(input, level, rgbd);
+    const float alpha = input[3];
+    for(int c = 0; c < 3; c++)
+    {
+      const float c00 = c000[c] + (c000[4 + c] - c000[c]) * rgbd[0];
+      const float c10 = c000[g + c] + (c000[g + 4 + c] - c000[g + c]) * rgbd[0];
+      const float c01 = c000[b + c] + (c000[b + 4 + c] - c000[b + c]) * rgbd[0];
+      const float c11 = c000[b + g + c] + (c000[b + g + 4 + c] - c000[b + g + c]) * rgbd[0];
+      const float c0 = c00 + (c10 - c00) * rgbd[1];
+      const float c1 = c01 + (c11 - c01) * rgbd[1];
+      output[c] = c0 + (c1 - c0) * rgbd[2];
+    }
+    output[3] = alpha;
+  }
+}
+
+#if defined(__SSE2__)
+// the node below the color, the offsets from there in offset and broadcast to each lane in dr, dg and db
+static inline size_t _clut_locate_sse2(const __m128 pixel, const uint16_t level, float offset[4], __m128 *dr,
+                                       __m128 *dg, __m128 *db)
+{
+  const __m128 v = _mm_mul_ps(_mm_min_ps(_mm_max_ps(pixel, _mm_setzero_ps()), _mm_set1_ps(1.0f)),
+                              _mm_set1_ps(level - 1));
+  // v is not negative, so truncating is flooring
+  const __m128 node = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(v)), _mm_set1_ps(level - 2));
+  const __m128 d = _mm_sub_ps(v, node);
+  int rgbi[4] DT_ALIGNED_PIXEL;
+  _mm_store_si128((__m128i *)rgbi, _mm_cvttps_epi32(node));
+  _mm_store_ps(offset, d);
+  *dr = _mm_shuffle_ps(d, d, _MM_SHUFFLE(0, 0, 0, 0));
+  *dg = _mm_shuffle_ps(d, d, _MM_SHUFFLE(1, 1, 1, 1));
+  *db = _mm_shuffle_ps(d, d, _MM_SHUFFLE(2, 2, 2, 2));
+  return 4 * (rgbi[0] + ((size_t)rgbi[1] + (size_t)rgbi[2] * level) * level);
+}
+
+static inline __m128 _clut_lerp_sse2(const __m128 a, const __m128 b, const __m128 t)
+{
+  return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+}
+
+void dt_clut_tetrahedral_sse2(const float *const in, float *const out, const size_t pixel_nb,
+                              const float *const clut, const uint16_t level)
+{
+  const size_t i111 = 4 * (1 + (size_t)level + (size_t)level * level);
+#ifdef _OPENMP
+#pragma omp parallel for default(none) dt_omp_firstprivate(clut, in, i111, level, out, pixel_nb) schedule(static)
+#endif
+  for(size_t k = 0; k < pixel_nb; k++)
+  {
+    const __m128 alpha = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+    const __m128 pixel = _mm_load_ps(in + 4 * k);
+    float rgbd[4] DT_ALIGNED_PIXEL;
+    float w[4] DT_ALIGNED_PIXEL;
+    __m128 dr, dg, db;
+    size_t a, b;
+    const float *const c000 = clut + _clut_locate_sse2(pixel, level, rgbd, &dr, &dg, &db);
+    _clut_tetrahedron(rgbd, level, &a, &b, w);
+    const __m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(w[0]), _mm_load_ps(c000)),
+                                             _mm_mul_ps(_mm_set1_ps(w[1]), _mm_load_ps(c000 + a))),
+                                  _mm_add_ps(_mm_mul_ps(_mm_set1_ps(w[2]), _mm_load_ps(c000 + b)),
+                                             _mm_mul_ps(_mm_set1_ps(w[3]), _mm_load_ps(c000 + i111))));
+    _mm_store_ps(out + 4 * k, _mm_or_ps(_mm_andnot_ps(alpha, sum), _mm_and_ps(alpha, pixel)));
+  }
+}
+
+void dt_clut_trilinear_sse2(const float *const in, float *const out, const size_t pixel_nb,
+                            const float *const clut, const uint16_t level)
+{
+  const size_t g = 4 * (size_t)level, b = 4 * (size_t)level * level;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) dt_omp_firstprivate(b, clut, g, in, level, out, pixel_nb) schedule(static)
+#endif
+  for(size_t k = 0; k < pixel_nb; k++)
+  {
+    const __m128 alpha = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+    const __m128 pixel = _mm_load_ps(in + 4 * k);
+    float rgbd[4] DT_ALIGNED_PIXEL;
+    __m128 dr, dg, db;
+    const float *const c000 = clut + _clut_locate_sse2(pixel, level, rgbd, &dr, &dg, &db);
+    const __m128 c00 = _clut_lerp_sse2(_mm_load_ps(c000), _mm_load_ps(c000 + 4), dr);
+    const __m128 c10 = _clut_lerp_sse2(_mm_load_ps(c000 + g), _mm_load_ps(c000 + g + 4), dr);
+    const __m128 c01 = _clut_lerp_sse2(_mm_load_ps(c000 + b), _mm_load_ps(c000 + b + 4), dr);
+    const __m128 c11 = _clut_lerp_sse2(_mm_load_ps(c000 + b + g), _mm_load_ps(c000 + b + g + 4), dr);
+    const __m128 sum = _clut_lerp_sse2(_clut_lerp_sse2(c00, c10, dg), _clut_lerp_sse2(c01, c11, dg), db);
+    _mm_store_ps(out + 4 * k, _mm_or_ps(_mm_andnot_ps(alpha, sum), _mm_and_ps(alpha, pixel)));
+  }
+}
+#endif
+
+static void _cache_entry_free(gpointer data)
+{
+  dt_clut_cache_entry_t *entry = (dt_clut_cache_entry_t *)data;
+  dt_free_align(entry->clut);
+  g_free(entry->key);
+  free(entry);
+}
+
+dt_clut_cache_t *dt_clut_cache_init(void)
+{
+  dt_clut_cache_t *cache = (dt_clut_cache_t *)calloc(1, sizeof(dt_clut_cache_t));
+  dt_pthread_mutex_init(&cache->lock, NULL);
+  cache->entries = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, _cache_entry_free);
+  cache->cluts = g_hash_table_new(g_direct_hash, g_direct_equal);
+  g_queue_init(&cache->unused);
+  return cache;
+}
+
+void dt_clut_cache_cleanup(dt_clut_cache_t *cache)
+{
+  if(!cache) return;
+  dt_print(DT_DEBUG_PERF, "[clut] cache: %" PRIu64 " hits, %" PRIu64 " misses\n", cache->hits, cache->misses);
+  g_queue_clear(&cache->unused);
+  g_hash_table_destroy(cache->cluts);
+  g_hash_table_destroy(cache->entries);
+  dt_pthread_mutex_destroy(&cache->lock);
+  free(cache);
+}
+
+const float *dt_clut_cache_acquire(const char *const key, const char *const filename, dt_clut_loader_t loader,
+                                   void *data, uint16_t *level)
+{
+  dt_clut_cache_t *cache = darktable.clut_cache;
+  *level = 0;
+
+  // a lut edited or replaced in place gets a new entry, the old one goes once it is released.
+  // if the file can't be read the loader fails and reports it.
+  GStatBuf st;
+  gchar *fullkey = (filename && !g_stat(filename, &st))
+                       ? g_strdup_printf("%s %" PRId64 " %" PRId64, key, (int64_t)st.st_mtime, (int64_t)st.st_size)
+                       : g_strdup(key);
+
+  dt_pthread_mutex_lock(&cache->lock);
+  dt_clut_cache_entry_t *entry = (dt_clut_cache_entry_t *)g_hash_table_lookup(cache->entries, fullkey);
+  if(entry)
+  {
+    if(entry->refcount == 0) g_queue_remove(&cache->unused, entry);
+    entry->refcount++;
+    cache->hits++;
+    *level = entry->level;
+    dt_pthread_mutex_unlock(&cache->lock);
+    g_free(fullkey);
+    return entry->clut;
+  }
+  cache->misses++;
+  dt_pthread_mutex_unlock(&cache->lock);
+
+  // reading and parsing the file is the expensive part, don't block the other pipes meanwhile
+  const double start = dt_get_wtime();
+  float *clut = NULL;
+  const uint16_t l = loader(data, &clut);
+  float *packed = (clut && l >= 2) ? dt_clut_pack(clut, l) : NULL;
+  if(clut) dt_free_align(clut);
+  // failures are not cached, the file may be fixed
+  if(!packed)
+  {
+    g_free(fullkey);
+    return NULL;
+  }
+  dt_print(DT_DEBUG_PERF, "[clut] loading %s took %0.04f sec\n", fullkey, dt_get_wtime() - start);
+
+  dt_pthread_mutex_lock(&cache->lock);
+  entry = (dt_clut_cache_entry_t *)g_hash_table_lookup(cache->entries, fullkey);
+  if(entry)
+  {
+    // another pipe was faster
+    if(entry->refcount == 0) g_queue_remove(&cache->unused, entry);
+    dt_free_align(packed);
+    g_free(fullkey);
+  }
+  else
+  {
+    entry = (dt_clut_cache_entry_t *)calloc(1, sizeof(dt_clut_cache_entry_t));
+    entry->key = fullkey;
+    entry->clut = packed;
+    entry->level = l;
+    g_hash_table_insert(cache->entries, entry->key, entry);
+    g_hash_table_insert(cache->cluts, entry->clut, entry);
+  }
+  entry->refcount++;
+  *level = entry->level;
+  packed = entry->clut;
+  dt_pthread_mutex_unlock(&cache->lock);
+  return packed;
+}
+
+void dt_clut_cache_release(const float *const clut)
+{
+  if(!clut) return;
+  dt_clut_cache_t *cache = darktable.clut_cache;
+  dt_pthread_mutex_lock(&cache->lock);
+  dt_clut_cache_entry_t *entry = (dt_clut_cache_entry_t *)g_hash_table_lookup(cache->cluts, clut);
+  if(entry && --entry->refcount == 0)
+  {
+    g_queue_push_head(&cache->unused, entry);
+    while(cache->unused.length > DT_CLUT_CACHE_UNUSED)
+    {
+      dt_clut_cache_entry_t *last = (dt_clut_cache_entry_t *)g_queue_pop_tail(&cache->unused);
+      g_hash_table_remove(cache->cluts, last->clut);
+      g_hash_table_remove(cache->entries, last->key);
+    }
+  }
+  dt_pthread_mutex_unlock(&cache->lock);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
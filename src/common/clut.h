@@ -0,0 +1,67 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/darktable.h"
+
+/**
+ * packed 3d color lookup tables.
+ *
+ * a clut of level^3 nodes is kept with 4 floats per node (r, g, b and 0), red varying fastest, so every node
+ * is one aligned vector load and the 8 nodes around a color are at most 4 cache lines apart.
+ *
+ * the packed cluts are shared by all pixelpipes through a cache keyed by the name of the lut, and for luts read
+ * from a file by its modification time and size, so a lut is read, parsed and packed once however many pipes
+ * and instances use it.
+ */
+
+typedef struct dt_clut_cache_t dt_clut_cache_t;
+
+/** reads a clut with 3 floats per node, allocated with dt_alloc_align(). returns the level, 0 on error. */
+typedef uint16_t (*dt_clut_loader_t)(void *data, float **clut);
+
+/** converts a clut of 3 floats per node into a newly allocated packed one. */
+float *dt_clut_pack(const float *const clut, const uint16_t level);
+
+/** apply the packed clut to pixel_nb pixels of 4 floats, input clamped to [0, 1]. alpha is copied.
+    in and out may be the same buffer. */
+void dt_clut_tetrahedral(const float *const in, float *const out, const size_t pixel_nb,
+                         const float *const clut, const uint16_t level);
+void dt_clut_trilinear(const float *const in, float *const out, const size_t pixel_nb,
+                       const float *const clut, const uint16_t level);
+#if defined(__SSE2__)
+void dt_clut_tetrahedral_sse2(const float *const in, float *const out, const size_t pixel_nb,
+                              const float *const clut, const uint16_t level);
+void dt_clut_trilinear_sse2(const float *const in, float *const out, const size_t pixel_nb,
+                            const float *const clut, const uint16_t level);
+#endif
+
+dt_clut_cache_t *dt_clut_cache_init(void);
+void dt_clut_cache_cleanup(dt_clut_cache_t *cache);
+
+/** get the packed clut named key. if filename is not NULL its modification time and size are part of the key.
+    on a miss the loader is called with data and its result is packed and inserted.
+    returns NULL and level 0 if the loader fails. every clut returned has to be released. */
+const float *dt_clut_cache_acquire(const char *const key, const char *const filename, dt_clut_loader_t loader,
+                                   void *data, uint16_t *level);
+void dt_clut_cache_release(const float *const clut);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -21,6 +21,7 @@
 #include "common/image.h"
 #include "common/imageio_rawspeed.h"
 #include "common/metadata.h"
+#include "common/tag_index.h"
 #include "common/utility.h"
 #include "control/conf.h"
 #include "control/control.h"
@@ -42,6 +43,11 @@
 #define SELECT_QUERY "SELECT DISTINCT * FROM %s"
 #define LIMIT_QUERY "LIMIT ?1, ?2"
 
+// more changed images than this and the cached result is recomputed instead of patched
+#define MAX_CHANGED_IMAGES 1000
+// results of earlier queries kept for going back to them
+#define MAX_CACHED_RESULTS 8
+
 static const char *comparators[] = {
   "<",  // DT_COLLECTION_RATING_COMP_LT = 0,
   "<=", // DT_COLLECTION_RATING_COMP_LEQ,
@@ -59,15 +65,158 @@ static uint32_t _dt_collection_compute_count(const dt_collection_t *collection,
  * we need 2 different since there are different kinds of signals we need to listen to. */
 static void _dt_collection_recount_callback_1(gpointer instace, gpointer user_data);
 static void _dt_collection_recount_callback_2(gpointer instance, uint8_t id, gpointer user_data);
+/* patches the cached result for images whose properties changed */
+static void _dt_collection_images_changed_callback(gpointer instance, gpointer imgs, gpointer user_data);
+/* the same for the images whose tags changed, as recorded by the tag index */
+static void _dt_collection_tags_changed_callback(gpointer instance, gpointer user_data);
+/* drops the cached results, they get computed again on the next access */
+static void _dt_collection_invalidate(dt_collection_t *collection);
+/* puts the result aside when the query changed and takes the one of the new query if it is still good */
+static void _dt_collection_switch(dt_collection_t *collection, const gchar *old_key);
 
 /* determine image offset of specified imgid for the given collection */
 static int dt_collection_image_offset_with_collection(const dt_collection_t *collection, int imgid);
 /* update aspect ratio for the selected images */
 static void _collection_update_aspect_ratio(const dt_collection_t *collection);
 
+static void _ids_init(dt_collection_ids_t *r)
+{
+  r->ids = g_array_new(FALSE, FALSE, sizeof(int));
+  r->pos = g_hash_table_new(NULL, NULL);
+  r->touch_pre = r->touch_post = NULL;
+}
+
+static void _ids_cleanup(dt_collection_ids_t *r)
+{
+  g_array_free(r->ids, TRUE);
+  g_hash_table_destroy(r->pos);
+  g_free(r->touch_pre);
+  g_free(r->touch_post);
+}
+
+static void _ids_set_touch(dt_collection_ids_t *r, const gchar *touch_pre, const gchar *touch_post)
+{
+  g_free(r->touch_pre);
+  g_free(r->touch_post);
+  r->touch_pre = g_strdup(touch_pre);
+  r->touch_post = g_strdup(touch_post);
+}
+
+static void _ids_clear(dt_collection_ids_t *r)
+{
+  g_array_set_size(r->ids, 0);
+  g_hash_table_remove_all(r->pos);
+}
+
+// exchanges the ids of a and b, the touch queries stay where they are
+static void _ids_swap(dt_collection_ids_t *a, dt_collection_ids_t *b)
+{
+  GArray *ids = a->ids;
+  GHashTable *pos = a->pos;
+  a->ids = b->ids;
+  a->pos = b->pos;
+  b->ids = ids;
+  b->pos = pos;
+}
+
+static void _ids_fill(dt_collection_ids_t *r, const gchar *query, const gboolean use_limit)
+{
+  _ids_clear(r);
+  if(!query) return;
+
+  sqlite3_stmt *stmt = NULL;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  if(use_limit)
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, 0);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, -1);
+  }
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const int imgid = sqlite3_column_int(stmt, 0);
+    g_array_append_val(r->ids, imgid);
+    g_hash_table_insert(r->pos, GINT_TO_POINTER(imgid), GINT_TO_POINTER(r->ids->len));
+  }
+  sqlite3_finalize(stmt);
+}
+
+// the key of the current queries in the result cache, NULL if the result can't be cached. the counts of a
+// collection using only the extended where part don't come from its result.
+static gchar *_dt_collection_key(const dt_collection_t *collection)
+{
+  if(!collection->query || (collection->params.query_flags & COLLECTION_QUERY_USE_ONLY_WHERE_EXT)) return NULL;
+  return g_strdup_printf("%d\n%s\n%s", collection->grouping, collection->query,
+                         collection->grouping ? collection->query_no_group : "");
+}
+
+static void _cached_free(gpointer data)
+{
+  dt_collection_cached_t *cached = (dt_collection_cached_t *)data;
+  _ids_cleanup(&cached->result);
+  _ids_cleanup(&cached->result_no_group);
+  g_free(cached->key);
+  g_free(cached);
+}
+
+/* brings the result up to date after the images in idlist (comma separated) changed. images that dropped out
+ * are removed and prepended to left. returns FALSE if that is not enough, because an image got in or may have
+ * moved, and the result has to be computed again. */
+static gboolean _ids_touch(dt_collection_ids_t *r, const gchar *idlist, const GArray *touched,
+                           const gboolean order_may_change, GList **left)
+{
+  if(!r->touch_pre) return FALSE;
+
+  GHashTable *in = g_hash_table_new(NULL, NULL);
+  gchar *query = g_strdup_printf("%s%s%s", r->touch_pre, idlist, r->touch_post);
+  sqlite3_stmt *stmt = NULL;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW) g_hash_table_add(in, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+  sqlite3_finalize(stmt);
+  g_free(query);
+
+  gboolean patched = TRUE;
+  guint removed = 0;
+  for(guint k = 0; k < touched->len; k++)
+  {
+    const int imgid = g_array_index(touched, int, k);
+    const gboolean was_in = g_hash_table_contains(r->pos, GINT_TO_POINTER(imgid));
+    const gboolean is_in = g_hash_table_contains(in, GINT_TO_POINTER(imgid));
+    if(is_in && (!was_in || order_may_change))
+    {
+      patched = FALSE;
+      break;
+    }
+    if(was_in && !is_in)
+    {
+      g_hash_table_remove(r->pos, GINT_TO_POINTER(imgid));
+      if(left) *left = g_list_prepend(*left, GINT_TO_POINTER(imgid));
+      removed++;
+    }
+  }
+  g_hash_table_destroy(in);
+
+  if(patched && removed)
+  {
+    // close the gaps, the remaining images keep their order
+    guint n = 0;
+    for(guint k = 0; k < r->ids->len; k++)
+    {
+      const int imgid = g_array_index(r->ids, int, k);
+      if(!g_hash_table_contains(r->pos, GINT_TO_POINTER(imgid))) continue;
+      g_array_index(r->ids, int, n++) = imgid;
+      g_hash_table_insert(r->pos, GINT_TO_POINTER(imgid), GINT_TO_POINTER(n));
+    }
+    g_array_set_size(r->ids, n);
+  }
+  return patched;
+}
+
 const dt_collection_t *dt_collection_new(const dt_collection_t *clone)
 {
   dt_collection_t *collection = g_malloc0(sizeof(dt_collection_t));
+  dt_pthread_mutex_init(&collection->lock, NULL);
+  _ids_init(&collection->result);
+  _ids_init(&collection->result_no_group);
 
   /* initialize collection context*/
   if(clone) /* if clone is provided let's copy it into this context */
@@ -80,6 +229,12 @@ const dt_collection_t *dt_collection_new(const dt_collection_t *clone)
     collection->clone = 1;
     collection->count = clone->count;
     collection->count_no_group = clone->count_no_group;
+    collection->grouping = clone->grouping;
+    dt_pthread_mutex_lock((dt_pthread_mutex_t *)&clone->lock);
+    _ids_set_touch(&collection->result, clone->result.touch_pre, clone->result.touch_post);
+    _ids_set_touch(&collection->result_no_group, clone->result_no_group.touch_pre,
+                   clone->result_no_group.touch_post);
+    dt_pthread_mutex_unlock((dt_pthread_mutex_t *)&clone->lock);
   }
   else /* else we just initialize using the reset */
     dt_collection_reset(collection);
@@ -87,7 +242,7 @@ const dt_collection_t *dt_collection_new(const dt_collection_t *clone)
   /* connect to all the signals that might indicate that the count of images matching the collection changed
    */
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_TAG_CHANGED,
-                            G_CALLBACK(_dt_collection_recount_callback_1), collection);
+                            G_CALLBACK(_dt_collection_tags_changed_callback), collection);
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_FILMROLLS_CHANGED,
                             G_CALLBACK(_dt_collection_recount_callback_1), collection);
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_FILMROLLS_REMOVED,
@@ -98,6 +253,9 @@ const dt_collection_t *dt_collection_new(const dt_collection_t *clone)
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_FILMROLLS_IMPORTED,
                             G_CALLBACK(_dt_collection_recount_callback_2), collection);
 
+  dt_control_signal_connect(darktable.signals, DT_SIGNAL_IMAGE_INFO_CHANGED,
+                            G_CALLBACK(_dt_collection_images_changed_callback), collection);
+
   return collection;
 }
 
@@ -107,7 +265,16 @@ void dt_collection_free(const dt_collection_t *collection)
                                (gpointer)collection);
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_dt_collection_recount_callback_2),
                                (gpointer)collection);
+  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_dt_collection_images_changed_callback),
+                               (gpointer)collection);
+  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_dt_collection_tags_changed_callback),
+                               (gpointer)collection);
 
+  _ids_cleanup((dt_collection_ids_t *)&collection->result);
+  _ids_cleanup((dt_collection_ids_t *)&collection->result_no_group);
+  g_list_free_full(collection->cached, _cached_free);
+  g_free(collection->result_key);
+  dt_pthread_mutex_destroy((dt_pthread_mutex_t *)&collection->lock);
   g_free(collection->query);
   g_free(collection->query_no_group);
   g_strfreev(collection->where_ext);
@@ -336,8 +503,33 @@ int dt_collection_update(const dt_collection_t *collection)
   query_no_group
       = dt_util_dstrcat(query_no_group, "%s%s%s %s%s", selq_pre, wq_no_group, selq_post ? selq_post : "", sq ? sq : "",
                         (collection->params.query_flags & COLLECTION_QUERY_USE_LIMIT) ? " " LIMIT_QUERY : "");
+  dt_pthread_mutex_lock((dt_pthread_mutex_t *)&collection->lock);
+  gchar *old_key = _dt_collection_key(collection);
+  dt_pthread_mutex_unlock((dt_pthread_mutex_t *)&collection->lock);
   result = _dt_collection_store(collection, query, query_no_group);
 
+  /* the same queries limited to a list of ids, to find out where images belong after they changed. the where
+   * part goes into parentheses as the extended where may have a top level OR. */
+  dt_pthread_mutex_lock((dt_pthread_mutex_t *)&collection->lock);
+  ((dt_collection_t *)collection)->grouping = darktable.gui && darktable.gui->grouping;
+  if(!(collection->params.query_flags & COLLECTION_QUERY_USE_ONLY_WHERE_EXT))
+  {
+    gchar *touch_pre = g_strdup_printf("%s(%s) AND id IN (", selq_pre, wq);
+    gchar *touch_pre_no_group = g_strdup_printf("%s(%s) AND id IN (", selq_pre, wq_no_group);
+    gchar *touch_post = g_strdup_printf(")%s", selq_post ? selq_post : "");
+    _ids_set_touch((dt_collection_ids_t *)&collection->result, touch_pre, touch_post);
+    _ids_set_touch((dt_collection_ids_t *)&collection->result_no_group, touch_pre_no_group, touch_post);
+    g_free(touch_pre);
+    g_free(touch_pre_no_group);
+    g_free(touch_post);
+  }
+  else
+  {
+    _ids_set_touch((dt_collection_ids_t *)&collection->result, NULL, NULL);
+    _ids_set_touch((dt_collection_ids_t *)&collection->result_no_group, NULL, NULL);
+  }
+  dt_pthread_mutex_unlock((dt_pthread_mutex_t *)&collection->lock);
+
 #ifdef _DEBUG
   printf("SQL Collection for 1st:%d and 2nd:%d: %s\n\n",collection->params.sort,collection->params.sort_second_order,query);/*only for debugging*/
 #endif
@@ -352,14 +544,15 @@ int dt_collection_update(const dt_collection_t *collection)
   g_free(query);
   g_free(query_no_group);
 
-  /* update the cached count. collection isn't a real const anyway, we are writing to it in
-   * _dt_collection_store, too. */
-  ((dt_collection_t *)collection)->count = _dt_collection_compute_count(collection, FALSE);
-  ((dt_collection_t *)collection)->count_no_group = _dt_collection_compute_count(collection, TRUE);
-  dt_collection_hint_message(collection);
-
+  /* the aspect ratios have to be known before the images get sorted by them */
   _collection_update_aspect_ratio(collection);
 
+  /* drop the result and count or take them from the cache. collection isn't a real const anyway, we are
+   * writing to it in _dt_collection_store, too. */
+  _dt_collection_switch((dt_collection_t *)collection, old_key);
+  g_free(old_key);
+  dt_collection_hint_message(collection);
+
   return result;
 }
 
@@ -511,10 +704,12 @@ static void _collection_update_aspect_ratio(const dt_collection_t *collection)
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
 
     double start = dt_get_wtime();
+    gboolean changed = FALSE;
     while(sqlite3_step(stmt) == SQLITE_ROW)
     {
       const int imgid = sqlite3_column_int(stmt, 0);
       dt_image_set_raw_aspect_ratio(imgid);
+      changed = TRUE;
 
       if(dt_get_wtime() - start > MAX_TIME)
       {
@@ -524,6 +719,14 @@ static void _collection_update_aspect_ratio(const dt_collection_t *collection)
     }
     sqlite3_finalize(stmt);
     g_free(query);
+
+    // cached results sorted by aspect ratio had these images at 0
+    if(changed)
+    {
+      dt_pthread_mutex_lock((dt_pthread_mutex_t *)&collection->lock);
+      ((dt_collection_t *)collection)->data_generation++;
+      dt_pthread_mutex_unlock((dt_pthread_mutex_t *)&collection->lock);
+    }
   }
 }
 
@@ -756,11 +959,13 @@ static int _dt_collection_store(const dt_collection_t *collection, gchar *query,
   }
 
   /* store query in context */
+  dt_pthread_mutex_lock((dt_pthread_mutex_t *)&collection->lock);
   g_free(collection->query);
   g_free(collection->query_no_group);
 
   ((dt_collection_t *)collection)->query = g_strdup(query);
   ((dt_collection_t *)collection)->query_no_group = g_strdup(query_no_group);
+  dt_pthread_mutex_unlock((dt_pthread_mutex_t *)&collection->lock);
 
   return 1;
 }
@@ -796,14 +1001,194 @@ static uint32_t _dt_collection_compute_count(const dt_collection_t *collection,
   return count;
 }
 
+static void _dt_collection_materialize(dt_collection_t *collection)
+{
+  const double start = dt_get_wtime();
+  const gboolean use_limit = collection->params.query_flags & COLLECTION_QUERY_USE_LIMIT;
+
+  // the queries run without the lock, into a copy which gets swapped in at the end. readers keep seeing the
+  // previous result meanwhile. the tag changes are taken first, any change recorded later gets patched in.
+  const guint64 tag_changes = darktable.tag_index ? dt_tag_index_changes(darktable.tag_index) : 0;
+  dt_pthread_mutex_lock(&collection->lock);
+  const uint32_t generation = collection->generation;
+  const gboolean grouping = collection->grouping;
+  gchar *query = g_strdup(collection->query);
+  gchar *query_no_group = g_strdup(collection->query_no_group);
+  gchar *key = _dt_collection_key(collection);
+  dt_pthread_mutex_unlock(&collection->lock);
+
+  dt_collection_ids_t result, result_no_group;
+  _ids_init(&result);
+  _ids_init(&result_no_group);
+  _ids_fill(&result, query, use_limit);
+  if(grouping) _ids_fill(&result_no_group, query_no_group, use_limit);
+
+  uint32_t count, count_no_group;
+  if(collection->params.query_flags & COLLECTION_QUERY_USE_ONLY_WHERE_EXT)
+  {
+    count = _dt_collection_compute_count(collection, FALSE);
+    count_no_group = _dt_collection_compute_count(collection, TRUE);
+  }
+  else
+  {
+    count = result.ids->len;
+    count_no_group = grouping ? result_no_group.ids->len : count;
+  }
+
+  dt_pthread_mutex_lock(&collection->lock);
+  _ids_swap(&collection->result, &result);
+  _ids_swap(&collection->result_no_group, &result_no_group);
+  collection->count = count;
+  collection->count_no_group = count_no_group;
+  g_free(collection->result_key);
+  collection->result_key = key;
+  collection->tag_changes = tag_changes;
+  // if something changed while the queries ran this is only good enough for the caller
+  collection->valid = generation == collection->generation;
+  dt_pthread_mutex_unlock(&collection->lock);
+
+  _ids_cleanup(&result);
+  _ids_cleanup(&result_no_group);
+  g_free(query);
+  g_free(query_no_group);
+
+  dt_print(DT_DEBUG_PERF, "[collection] collected %u images (%u without grouping) in %.3f secs\n", count,
+           count_no_group, dt_get_wtime() - start);
+}
+
+static void _dt_collection_invalidate(dt_collection_t *collection)
+{
+  dt_pthread_mutex_lock(&collection->lock);
+  collection->valid = FALSE;
+  collection->generation++;
+  collection->data_generation++;
+  dt_pthread_mutex_unlock(&collection->lock);
+}
+
+static void _dt_collection_switch(dt_collection_t *collection, const gchar *old_key)
+{
+  dt_pthread_mutex_lock(&collection->lock);
+  gchar *key = _dt_collection_key(collection);
+  const gboolean keep = collection->valid && old_key && !g_strcmp0(old_key, collection->result_key);
+  collection->valid = FALSE;
+  collection->generation++;
+
+  if(!g_strcmp0(old_key, key))
+  {
+    // the same query again is how callers ask to see changes which came without a signal
+    collection->data_generation++;
+    g_list_free_full(collection->cached, _cached_free);
+    collection->cached = NULL;
+    dt_pthread_mutex_unlock(&collection->lock);
+    g_free(key);
+    return;
+  }
+
+  if(keep)
+  {
+    dt_collection_cached_t *cached = g_malloc0(sizeof(dt_collection_cached_t));
+    _ids_init(&cached->result);
+    _ids_init(&cached->result_no_group);
+    _ids_swap(&cached->result, &collection->result);
+    _ids_swap(&cached->result_no_group, &collection->result_no_group);
+    cached->key = g_strdup(old_key);
+    cached->count = collection->count;
+    cached->count_no_group = collection->count_no_group;
+    cached->data_generation = collection->data_generation;
+    cached->tag_changes = collection->tag_changes;
+    collection->cached = g_list_prepend(collection->cached, cached);
+  }
+
+  // take out the result of the new query and the outdated ones
+  dt_collection_cached_t *found = NULL;
+  GList *l = collection->cached;
+  while(l)
+  {
+    GList *next = g_list_next(l);
+    dt_collection_cached_t *cached = (dt_collection_cached_t *)l->data;
+    const gboolean current = cached->data_generation == collection->data_generation;
+    if(!current || !g_strcmp0(cached->key, key))
+    {
+      collection->cached = g_list_delete_link(collection->cached, l);
+      if(current)
+        found = cached;
+      else
+        _cached_free(cached);
+    }
+    l = next;
+  }
+  while(g_list_length(collection->cached) > MAX_CACHED_RESULTS)
+  {
+    GList *last = g_list_last(collection->cached);
+    _cached_free(last->data);
+    collection->cached = g_list_delete_link(collection->cached, last);
+  }
+
+  if(found)
+  {
+    _ids_swap(&collection->result, &found->result);
+    _ids_swap(&collection->result_no_group, &found->result_no_group);
+    collection->count = found->count;
+    collection->count_no_group = found->count_no_group;
+    collection->tag_changes = found->tag_changes;
+    g_free(collection->result_key);
+    collection->result_key = g_strdup(key);
+    collection->valid = TRUE;
+    _cached_free(found);
+  }
+  dt_pthread_mutex_unlock(&collection->lock);
+
+  dt_print(DT_DEBUG_PERF, "[collection] %s\n", found ? "took the result from the cache" : "query changed");
+  g_free(key);
+}
+
+/* returns with the lock held and the result filled in, to be released by the caller */
+static dt_collection_t *_dt_collection_lock_result(const dt_collection_t *collection)
+{
+  dt_collection_t *c = (dt_collection_t *)collection;
+  if(!c->query) dt_collection_update(collection);
+  dt_pthread_mutex_lock(&c->lock);
+  if(!c->valid)
+  {
+    dt_pthread_mutex_unlock(&c->lock);
+    _dt_collection_materialize(c);
+    dt_pthread_mutex_lock(&c->lock);
+  }
+  return c;
+}
+
+/* the count as it was last computed, without computing it again */
+static uint32_t _dt_collection_cached_count(dt_collection_t *collection)
+{
+  dt_pthread_mutex_lock(&collection->lock);
+  const uint32_t count = collection->count;
+  dt_pthread_mutex_unlock(&collection->lock);
+  return count;
+}
+
 uint32_t dt_collection_get_count(const dt_collection_t *collection)
 {
-  return collection->count;
+  dt_collection_t *c = _dt_collection_lock_result(collection);
+  const uint32_t count = c->count;
+  dt_pthread_mutex_unlock(&c->lock);
+  return count;
 }
 
 uint32_t dt_collection_get_count_no_group(const dt_collection_t *collection)
 {
-  return collection->count_no_group;
+  dt_collection_t *c = _dt_collection_lock_result(collection);
+  const uint32_t count = c->count_no_group;
+  dt_pthread_mutex_unlock(&c->lock);
+  return count;
+}
+
+GArray *dt_collection_get_ids(const dt_collection_t *collection)
+{
+  dt_collection_t *c = _dt_collection_lock_result(collection);
+  GArray *ids = g_array_sized_new(FALSE, FALSE, sizeof(int), c->result.ids->len);
+  g_array_append_vals(ids, c->result.ids->data, c->result.ids->len);
+  dt_pthread_mutex_unlock(&c->lock);
+  return ids;
 }
 
 uint32_t dt_collection_get_selected_count(const dt_collection_t *collection)
@@ -819,6 +1204,19 @@ uint32_t dt_collection_get_selected_count(const dt_collection_t *collection)
 
 GList *dt_collection_get(const dt_collection_t *collection, int limit, gboolean selected)
 {
+  if(!selected && dt_collection_get_query(collection))
+  {
+    // served from the cached result
+    dt_collection_t *c = _dt_collection_lock_result(collection);
+    const GArray *ids = c->result.ids;
+    guint num = ids->len;
+    if((collection->params.query_flags & COLLECTION_QUERY_USE_LIMIT) && limit >= 0) num = MIN(num, limit);
+    GList *list = NULL;
+    for(guint k = num; k > 0; k--) list = g_list_prepend(list, GINT_TO_POINTER(g_array_index(ids, int, k - 1)));
+    dt_pthread_mutex_unlock(&c->lock);
+    return list;
+  }
+
   GList *list = NULL;
   const gchar *query = dt_collection_get_query(collection);
   if(query)
@@ -873,24 +1271,10 @@ GList *dt_collection_get_all(const dt_collection_t *collection, int limit)
 
 int dt_collection_get_nth(const dt_collection_t *collection, int nth)
 {
-  if(nth < 0 || nth >= dt_collection_get_count(collection))
-    return -1;
-  const gchar *query = dt_collection_get_query(collection);
-  sqlite3_stmt *stmt = NULL;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, nth);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, 1);
-
-  int result = -1;
-  if(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    result  = sqlite3_column_int(stmt, 0);
-  }
-
-  sqlite3_finalize(stmt);
-
-  return result;
-
+  dt_collection_t *c = _dt_collection_lock_result(collection);
+  const int imgid = nth < 0 || nth >= c->result.ids->len ? -1 : g_array_index(c->result.ids, int, nth);
+  dt_pthread_mutex_unlock(&c->lock);
+  return imgid;
 }
 
 GList *dt_collection_get_selected(const dt_collection_t *collection, int limit)
@@ -1599,6 +1983,26 @@ void dt_collection_deserialize(char *buf)
   dt_collection_update_query(darktable.collection);
 }
 
+static void _dt_collection_unselect_outside(const dt_collection_t *collection)
+{
+  sqlite3_stmt *stmt = NULL;
+  const gchar *cquery = dt_collection_get_query_no_group(collection);
+  gchar *complete_query = NULL;
+  if(cquery && cquery[0] != '\0')
+  {
+    complete_query
+        = dt_util_dstrcat(complete_query, "DELETE FROM main.selected_images WHERE imgid NOT IN (%s)", cquery);
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), complete_query, -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, 0);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, -1);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+
+    /* free allocated strings */
+    g_free(complete_query);
+  }
+}
+
 void dt_collection_update_query(const dt_collection_t *collection)
 {
   char confname[200];
@@ -1649,22 +2053,7 @@ void dt_collection_update_query(const dt_collection_t *collection)
   dt_collection_update(collection);
 
   // remove from selected images where not in this query.
-  sqlite3_stmt *stmt = NULL;
-  const gchar *cquery = dt_collection_get_query_no_group(collection);
-  gchar *complete_query = NULL;
-  if(cquery && cquery[0] != '\0')
-  {
-    complete_query
-        = dt_util_dstrcat(complete_query, "DELETE FROM main.selected_images WHERE imgid NOT IN (%s)", cquery);
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), complete_query, -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, 0);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, -1);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-
-    /* free allocated strings */
-    g_free(complete_query);
-  }
+  _dt_collection_unselect_outside(collection);
 
   /* raise signal of collection change, only if this is an original */
   if(!collection->clone) dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
@@ -1679,22 +2068,31 @@ gboolean dt_collection_hint_message_internal(void *message)
 
 void dt_collection_hint_message(const dt_collection_t *collection)
 {
-  /* if relevant, determine offset of selection */
-  GList *selected_imgids = dt_collection_get_selected(collection, 1);
-  int selected = -1;
-
-  if(selected_imgids)
-  {
-    selected = GPOINTER_TO_INT(selected_imgids->data);
-    selected = dt_collection_image_offset_with_collection(collection, selected);
-    selected++;
-  }
   /* collection hinting */
   gchar *message;
 
   int c = dt_collection_get_count_no_group(collection);
   int cs = dt_collection_get_selected_count(collection);
 
+  /* if relevant, determine offset of selection. looked up in the cached result instead of joining the
+   * selection with the whole query. */
+  int selected = -1;
+  if(cs == 1)
+  {
+    sqlite3_stmt *stmt = NULL;
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT imgid FROM main.selected_images LIMIT 1",
+                                -1, &stmt, NULL);
+    if(sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      dt_collection_t *col = _dt_collection_lock_result(collection);
+      const int pos = GPOINTER_TO_INT(
+          g_hash_table_lookup(col->result.pos, GINT_TO_POINTER(sqlite3_column_int(stmt, 0))));
+      dt_pthread_mutex_unlock(&col->lock);
+      if(pos > 0) selected = pos;
+    }
+    sqlite3_finalize(stmt);
+  }
+
   if(cs == 1)
   {
     message = g_strdup_printf(_("%d image of %d (#%d) in current collection is selected"), cs, c, selected);
@@ -1715,39 +2113,10 @@ void dt_collection_hint_message(const dt_collection_t *collection)
 static int dt_collection_image_offset_with_collection(const dt_collection_t *collection, int imgid)
 {
   if(imgid == -1) return 0;
-  const gchar *qin = dt_collection_get_query(collection);
-  int offset = 0;
-  sqlite3_stmt *stmt;
-
-  if(qin)
-  {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), qin, -1, &stmt, NULL);
-
-    // was the limit portion of the query tacked on?
-    if(collection->params.query_flags & COLLECTION_QUERY_USE_LIMIT)
-    {
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, 0);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, -1);
-    }
-
-    gboolean found = FALSE;
-
-    while(sqlite3_step(stmt) == SQLITE_ROW)
-    {
-      int id = sqlite3_column_int(stmt, 0);
-      if(imgid == id)
-      {
-        found = TRUE;
-        break;
-      }
-      offset++;
-    }
-
-    if(!found) offset = 0;
-
-    sqlite3_finalize(stmt);
-  }
-  return offset;
+  dt_collection_t *c = _dt_collection_lock_result(collection);
+  const int pos = GPOINTER_TO_INT(g_hash_table_lookup(c->result.pos, GINT_TO_POINTER(imgid)));
+  dt_pthread_mutex_unlock(&c->lock);
+  return pos > 0 ? pos - 1 : 0;
 }
 
 int dt_collection_image_offset(int imgid)
@@ -1758,12 +2127,11 @@ int dt_collection_image_offset(int imgid)
 static void _dt_collection_recount_callback_1(gpointer instace, gpointer user_data)
 {
   dt_collection_t *collection = (dt_collection_t *)user_data;
-  int old_count = collection->count;
-  collection->count = _dt_collection_compute_count(collection, FALSE);
-  collection->count_no_group = _dt_collection_compute_count(collection, TRUE);
+  const uint32_t old_count = _dt_collection_cached_count(collection);
+  _dt_collection_invalidate(collection);
   if(!collection->clone)
   {
-    if(old_count != collection->count) dt_collection_hint_message(collection);
+    if(old_count != dt_collection_get_count(collection)) dt_collection_hint_message(collection);
     dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
   }
 }
@@ -1771,16 +2139,165 @@ static void _dt_collection_recount_callback_1(gpointer instace, gpointer user_da
 static void _dt_collection_recount_callback_2(gpointer instance, uint8_t id, gpointer user_data)
 {
   dt_collection_t *collection = (dt_collection_t *)user_data;
-  int old_count = collection->count;
-  collection->count = _dt_collection_compute_count(collection, FALSE);
-  collection->count_no_group = _dt_collection_compute_count(collection, TRUE);
+  const uint32_t old_count = _dt_collection_cached_count(collection);
+  _dt_collection_invalidate(collection);
   if(!collection->clone)
   {
-    if(old_count != collection->count) dt_collection_hint_message(collection);
+    if(old_count != dt_collection_get_count(collection)) dt_collection_hint_message(collection);
     dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
   }
 }
 
+static gboolean _dt_collection_sort_uses_image_info(const dt_collection_t *collection)
+{
+  if(!(collection->params.query_flags & COLLECTION_QUERY_USE_SORT)) return FALSE;
+  const dt_collection_sort_t sort[2] = { collection->params.sort, collection->params.sort_second_order };
+  for(int k = 0; k < 2; k++)
+    if(sort[k] == DT_COLLECTION_SORT_RATING || sort[k] == DT_COLLECTION_SORT_COLOR
+       || sort[k] == DT_COLLECTION_SORT_TITLE || sort[k] == DT_COLLECTION_SORT_DESCRIPTION)
+      return TRUE;
+  return FALSE;
+}
+
+/* re-evaluates the query for the changed images only and drops the ones which don't match anymore. images
+ * leaving the ungrouped result are prepended to left. returns FALSE if the result has to be computed again. */
+static gboolean _dt_collection_patch(dt_collection_t *collection, GList *imgs, GList **left)
+{
+  if(!imgs || g_list_length(imgs) > MAX_CHANGED_IMAGES) return FALSE;
+
+  GString *idlist = g_string_new(NULL);
+  for(GList *l = imgs; l; l = g_list_next(l))
+    g_string_append_printf(idlist, "%s%d", l == imgs ? "" : ",", GPOINTER_TO_INT(l->data));
+
+  GArray *touched = g_array_new(FALSE, FALSE, sizeof(int));
+  if(collection->grouping)
+  {
+    // a change can make another image the representative of its group, so all members have to be checked
+    gchar *query = g_strdup_printf("SELECT id FROM main.images WHERE group_id IN "
+                                   "(SELECT group_id FROM main.images WHERE id IN (%s))", idlist->str);
+    sqlite3_stmt *stmt = NULL;
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+    g_string_truncate(idlist, 0);
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      const int imgid = sqlite3_column_int(stmt, 0);
+      g_array_append_val(touched, imgid);
+      g_string_append_printf(idlist, "%s%d", touched->len == 1 ? "" : ",", imgid);
+    }
+    sqlite3_finalize(stmt);
+    g_free(query);
+  }
+  else
+  {
+    for(GList *l = imgs; l; l = g_list_next(l))
+    {
+      const int imgid = GPOINTER_TO_INT(l->data);
+      g_array_append_val(touched, imgid);
+    }
+  }
+
+  // the ungrouped result is only used for counting, so its order doesn't matter
+  gboolean patched = touched->len > 0 && touched->len <= MAX_CHANGED_IMAGES
+                     && _ids_touch(&collection->result, idlist->str, touched,
+                                   _dt_collection_sort_uses_image_info(collection),
+                                   collection->grouping ? NULL : left);
+  if(patched && collection->grouping)
+    patched = _ids_touch(&collection->result_no_group, idlist->str, touched, FALSE, left);
+
+  if(patched)
+  {
+    collection->count = collection->result.ids->len;
+    collection->count_no_group = collection->grouping ? collection->result_no_group.ids->len : collection->count;
+  }
+
+  g_array_free(touched, TRUE);
+  g_string_free(idlist, TRUE);
+  return patched;
+}
+
+/* brings the result up to date after imgs changed, or drops it if that isn't possible. with from_tags the
+ * images come from the tag index, as everything it recorded since the result was last brought up to date. */
+static void _dt_collection_changed(dt_collection_t *collection, GList *imgs, const gboolean from_tags)
+{
+  if(!collection->query) return;
+
+  const double start = dt_get_wtime();
+  GList *left = NULL, *tagged = NULL;
+  guint64 tag_changes = 0;
+  // the lock is held across the small queries of the patch, so that no reader sees it half done
+  dt_pthread_mutex_lock(&collection->lock);
+  gboolean known = collection->valid;
+  if(from_tags)
+  {
+    known = known && darktable.tag_index
+            && dt_tag_index_changes_since(darktable.tag_index, collection->tag_changes, &tagged, &tag_changes);
+    imgs = tagged;
+    if(known && !imgs)
+    {
+      // a change of a tag nobody has, of flags or synonyms
+      collection->tag_changes = tag_changes;
+      dt_pthread_mutex_unlock(&collection->lock);
+      return;
+    }
+  }
+  const uint32_t old_count = collection->count;
+  const gboolean patched = known && _dt_collection_patch(collection, imgs, &left);
+  const uint32_t new_count = collection->count;
+  if(patched && from_tags) collection->tag_changes = tag_changes;
+  // a result being computed right now may not have seen the change, the ones put aside haven't either
+  collection->generation++;
+  collection->data_generation++;
+  if(!patched) collection->valid = FALSE;
+  dt_pthread_mutex_unlock(&collection->lock);
+  if(!patched)
+  {
+    g_list_free(left);
+    left = NULL;
+  }
+
+  dt_print(DT_DEBUG_PERF, "[collection] %s after %u images changed%s in %.3f secs\n",
+           patched ? "patched" : "dropped result", g_list_length(imgs), from_tags ? " their tags" : "",
+           dt_get_wtime() - start);
+  g_list_free(tagged);
+
+  if(!collection->clone)
+  {
+    if(patched)
+    {
+      // nothing to tell if all images stayed where they were
+      if(!left && old_count == new_count) return;
+
+      // images which left the collection can't stay selected, same as in dt_collection_update_query
+      sqlite3_stmt *stmt = NULL;
+      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                  "DELETE FROM main.selected_images WHERE imgid = ?1", -1, &stmt, NULL);
+      for(GList *l = left; l; l = g_list_next(l))
+      {
+        DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, GPOINTER_TO_INT(l->data));
+        sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+      }
+      sqlite3_finalize(stmt);
+    }
+    else
+      _dt_collection_unselect_outside(collection);
+
+    if(old_count != dt_collection_get_count(collection) || left) dt_collection_hint_message(collection);
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
+  }
+  g_list_free(left);
+}
+
+static void _dt_collection_images_changed_callback(gpointer instance, gpointer imgs, gpointer user_data)
+{
+  _dt_collection_changed((dt_collection_t *)user_data, (GList *)imgs, FALSE);
+}
+
+static void _dt_collection_tags_changed_callback(gpointer instance, gpointer user_data)
+{
+  _dt_collection_changed((dt_collection_t *)user_data, NULL, TRUE);
+}
+
 int64_t dt_collection_get_image_position(const int32_t image_id)
 {
   int64_t image_position = -1;
@@ -1867,7 +2384,7 @@ void dt_collection_move_before(const int32_t image_id, GList * selected_images)
     dt_collection_shift_image_positions(selected_images_length, target_image_pos);
 
     sqlite3_stmt *stmt = NULL;
-    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "BEGIN", NULL, NULL, NULL);
+    const gboolean transaction = dt_database_start_transaction(darktable.db);
 
     // move images to their intended positions
     int64_t new_image_pos = target_image_pos;
@@ -1890,7 +2407,7 @@ void dt_collection_move_before(const int32_t image_id, GList * selected_images)
       new_image_pos++;
     }
     sqlite3_finalize(stmt);
-    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+    dt_database_release_transaction(darktable.db, transaction);
   }
   else
   {
@@ -1912,7 +2429,7 @@ void dt_collection_move_before(const int32_t image_id, GList * selected_images)
     sqlite3_finalize(stmt);
     sqlite3_stmt *update_stmt = NULL;
 
-    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "BEGIN", NULL, NULL, NULL);
+    const gboolean transaction = dt_database_start_transaction(darktable.db);
 
     // move images to last position in custom image order table
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
@@ -1933,7 +2450,7 @@ void dt_collection_move_before(const int32_t image_id, GList * selected_images)
     }
 
     sqlite3_finalize(update_stmt);
-    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+    dt_database_release_transaction(darktable.db, transaction);
   }
 }
 
@@ -18,6 +18,8 @@
 
 #pragma once
 
+#include "common/dtpthread.h"
+
 #include <glib.h>
 #include <inttypes.h>
 
@@ -133,12 +135,45 @@ typedef struct dt_collection_params_t
 
 } dt_collection_params_t;
 
+/** the materialized result of a collection query */
+typedef struct dt_collection_ids_t
+{
+  GArray *ids;      // image ids in collection order
+  GHashTable *pos;  // imgid -> position in ids + 1
+  gchar *touch_pre; // the query restricted to a list of ids, which goes in between
+  gchar *touch_post;
+} dt_collection_ids_t;
+
+/** a result put aside when the query changed, to be used again if the query comes back */
+typedef struct dt_collection_cached_t
+{
+  gchar *key; // the queries and grouping the result belongs to
+  dt_collection_ids_t result, result_no_group;
+  unsigned int count, count_no_group;
+  uint32_t data_generation; // the data the result was up to date with
+  guint64 tag_changes;
+} dt_collection_cached_t;
+
 typedef struct dt_collection_t
 {
   int clone;
   gchar *query, *query_no_group;
   gchar **where_ext;
   unsigned int count, count_no_group;
+  /* results of query and query_no_group, filled on demand. the second one is only used with grouping on */
+  gboolean valid, grouping;
+  dt_collection_ids_t result, result_no_group;
+  /* protects the results, valid and the counts, they get read from the gui, jobs and lua at the same time.
+   * generation counts the invalidations, a result computed meanwhile is outdated already. */
+  dt_pthread_mutex_t lock;
+  uint32_t generation;
+  /* the key of the queries the result was computed for and the tag index changes it has seen */
+  gchar *result_key;
+  guint64 tag_changes;
+  /* results of earlier queries, most recent first. data_generation counts the changes of the images, a
+   * cached result from an older generation can't be used anymore. */
+  GList *cached;
+  uint32_t data_generation;
   dt_collection_params_t params;
   dt_collection_params_t store;
 } dt_collection_t;
@@ -202,6 +237,8 @@ gchar *dt_collection_get_sort_query(const dt_collection_t *collection);
 uint32_t dt_collection_get_count(const dt_collection_t *collection);
 /** get the count of query including the images hidden in groups */
 uint32_t dt_collection_get_count_no_group(const dt_collection_t *collection);
+/** get a copy of the image ids of query in collection order, to be freed with g_array_free() */
+GArray *dt_collection_get_ids(const dt_collection_t *collection);
 /** get the nth image in the query */
 int dt_collection_get_nth(const dt_collection_t *collection, int nth);
 /** get all image ids order as current selection. no more than limit many images are returned, <0 ==
@@ -43,13 +43,12 @@ typedef struct dt_undo_colorlabels_t
 int dt_colorlabels_get_labels(const int imgid)
 {
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT color FROM main.color_labels WHERE imgid = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, "SELECT color FROM main.color_labels WHERE imgid = ?1", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   int colors = 0;
   while(sqlite3_step(stmt) == SQLITE_ROW)
     colors |= (1<<sqlite3_column_int(stmt, 0));
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
   return colors;
 }
 
@@ -83,6 +82,7 @@ static void _pop_undo(gpointer user_data, dt_undo_type_t type, dt_undo_data_t da
       *imgs = g_list_prepend(*imgs, GINT_TO_POINTER(undocolorlabels->imgid));
       list = g_list_next(list);
     }
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_IMAGE_INFO_CHANGED, *imgs);
     dt_collection_hint_message(darktable.collection);
   }
 }
@@ -187,6 +187,7 @@ void dt_colorlabels_set_labels(const int imgid, const int labels, const gboolean
     if(undo_on) dt_undo_start_group(darktable.undo, DT_UNDO_COLORLABELS);
 
     _colorlabels_execute(imgs, labels, &undo, undo_on, clear_on ? DT_CA_SET : DT_CA_ADD);
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_IMAGE_INFO_CHANGED, imgs);
 
     g_list_free(imgs);
     if(undo_on)
@@ -214,6 +215,7 @@ void dt_colorlabels_toggle_label(const int imgid, const int color, const gboolea
     if(undo_on) dt_undo_start_group(darktable.undo, DT_UNDO_COLORLABELS);
 
     _colorlabels_execute(imgs, label, &undo, undo_on, DT_CA_TOGGLE);
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_IMAGE_INFO_CHANGED, imgs);
 
     g_list_free(imgs);
     if(undo_on)
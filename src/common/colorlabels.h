@@ -19,11 +19,12 @@ extern const char *dt_colorlabels_name[];
 int dt_colorlabels_get_labels(const int imgid);
 /** remove labels associated to imgid */
 void dt_colorlabels_remove_labels(const int imgid);
-/** assign a color label to imgid - no undo no image group*/
+/** assign a color label to imgid - no undo no image group, no DT_SIGNAL_IMAGE_INFO_CHANGED either: the xmp
+ * decoding of imports calls it from jobs. callers outside of that raise the signal themselves */
 void dt_colorlabels_set_label(const int imgid, const int color);
 /** assign a color label to image imgid or all selected for imgid == -1*/
 void dt_colorlabels_set_labels(const int imgid, const int color, const gboolean clear_on, const gboolean undo_on, const gboolean group_on);
-/** remove a color label from imgid */
+/** remove a color label from imgid, doesn't raise DT_SIGNAL_IMAGE_INFO_CHANGED either */
 void dt_colorlabels_remove_label(const int imgid, const int color);
 /** get the name of the color for a given number (could be replaced by an array) */
 const char *dt_colorlabels_to_string(int label);
@@ -262,16 +262,252 @@ static int dt_colorspaces_get_matrix_from_profile(cmsHPROFILE prof, float *matri
   return 0;
 }
 
+// unused entries kept around, for the next image or pipe
+#define DT_COLORSPACES_CACHE_UNUSED 16
+
+typedef struct dt_colorspaces_cache_entry_t
+{
+  gchar *key;
+  int refcount;        // pipes holding the transform
+  cmsHTRANSFORM xform; // either a transform,
+  float matrix[9];     // or a matrix with curves
+  float *lut;          // lutsize values for each channel, not for linear ones
+  int lutsize;
+  gboolean linear[3];
+} dt_colorspaces_cache_entry_t;
+
+static void _cache_entry_free(gpointer data)
+{
+  dt_colorspaces_cache_entry_t *entry = (dt_colorspaces_cache_entry_t *)data;
+  if(entry->xform) cmsDeleteTransform(entry->xform);
+  free(entry->lut);
+  g_free(entry->key);
+  free(entry);
+}
+
+static void _cache_init(dt_colorspaces_t *self)
+{
+  dt_pthread_mutex_init(&self->cache_lock, NULL);
+  self->cache = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, _cache_entry_free);
+  self->cache_xforms = g_hash_table_new(g_direct_hash, g_direct_equal);
+  g_queue_init(&self->cache_unused);
+}
+
+static void _cache_cleanup(dt_colorspaces_t *self)
+{
+  dt_print(DT_DEBUG_PERF, "[colorspaces] transform cache: %" PRIu64 " hits, %" PRIu64 " misses\n",
+           self->cache_hits, self->cache_misses);
+  g_queue_clear(&self->cache_unused);
+  g_hash_table_destroy(self->cache_xforms);
+  g_hash_table_destroy(self->cache);
+  dt_pthread_mutex_destroy(&self->cache_lock);
+}
+
+/* adds the contents of profile to checksum. the creation date and the profile id in the header are left out,
+ * so profiles that are built again each time, like the camera matrices, still match. */
+static gboolean _cache_add_profile(GChecksum *checksum, cmsHPROFILE profile)
+{
+  if(!profile)
+  {
+    g_checksum_update(checksum, (const guchar *)"-", 1);
+    return TRUE;
+  }
+  cmsUInt32Number size = 0;
+  if(!cmsSaveProfileToMem(profile, NULL, &size) || size < 128) return FALSE;
+  guchar *data = malloc(size);
+  const gboolean ok = data && cmsSaveProfileToMem(profile, data, &size);
+  if(ok)
+  {
+    g_checksum_update(checksum, data, 24);
+    g_checksum_update(checksum, data + 36, 84 - 36);
+    g_checksum_update(checksum, data + 100, size - 100);
+  }
+  free(data);
+  return ok;
+}
+
+/* has to be called with the lock held */
+static dt_colorspaces_cache_entry_t *_cache_lookup(dt_colorspaces_t *self, const char *key)
+{
+  dt_colorspaces_cache_entry_t *entry = (dt_colorspaces_cache_entry_t *)g_hash_table_lookup(self->cache, key);
+  if(entry)
+  {
+    if(entry->refcount == 0) g_queue_remove(&self->cache_unused, entry);
+    self->cache_hits++;
+  }
+  else
+    self->cache_misses++;
+  return entry;
+}
+
+/* has to be called with the lock held */
+static void _cache_unused(dt_colorspaces_t *self, dt_colorspaces_cache_entry_t *entry)
+{
+  g_queue_push_head(&self->cache_unused, entry);
+  while(self->cache_unused.length > DT_COLORSPACES_CACHE_UNUSED)
+  {
+    dt_colorspaces_cache_entry_t *last = (dt_colorspaces_cache_entry_t *)g_queue_pop_tail(&self->cache_unused);
+    if(last->xform) g_hash_table_remove(self->cache_xforms, last->xform);
+    g_hash_table_remove(self->cache, last->key);
+  }
+}
+
+static int _get_matrix_from_profile_cached(cmsHPROFILE prof, float *matrix, float *lutr, float *lutg, float *lutb,
+                                           const int lutsize, const int input, const int intent)
+{
+  dt_colorspaces_t *self = darktable.color_profiles;
+  GChecksum *checksum = g_checksum_new(G_CHECKSUM_MD5);
+  if(!self || !prof || !_cache_add_profile(checksum, prof))
+  {
+    g_checksum_free(checksum);
+    return dt_colorspaces_get_matrix_from_profile(prof, matrix, lutr, lutg, lutb, lutsize, input, intent);
+  }
+  gchar *key = g_strdup_printf("matrix %s %d %d %d", g_checksum_get_string(checksum), input, lutsize, intent);
+  g_checksum_free(checksum);
+
+  float *lut[3] = { lutr, lutg, lutb };
+
+  dt_pthread_mutex_lock(&self->cache_lock);
+  dt_colorspaces_cache_entry_t *entry = _cache_lookup(self, key);
+  if(entry)
+  {
+    memcpy(matrix, entry->matrix, sizeof(entry->matrix));
+    for(int c = 0; c < 3; c++)
+    {
+      if(entry->linear[c])
+        lut[c][0] = -1.0f;
+      else
+        memcpy(lut[c], entry->lut + (size_t)c * lutsize, sizeof(float) * lutsize);
+    }
+    _cache_unused(self, entry);
+    dt_pthread_mutex_unlock(&self->cache_lock);
+    g_free(key);
+    return 0;
+  }
+  dt_pthread_mutex_unlock(&self->cache_lock);
+
+  const int ret = dt_colorspaces_get_matrix_from_profile(prof, matrix, lutr, lutg, lutb, lutsize, input, intent);
+  // failures are cheap to find again
+  if(ret)
+  {
+    g_free(key);
+    return ret;
+  }
+
+  entry = (dt_colorspaces_cache_entry_t *)calloc(1, sizeof(dt_colorspaces_cache_entry_t));
+  entry->key = key;
+  entry->lutsize = lutsize;
+  entry->lut = malloc(sizeof(float) * 3 * lutsize);
+  memcpy(entry->matrix, matrix, sizeof(entry->matrix));
+  for(int c = 0; c < 3; c++)
+  {
+    entry->linear[c] = lut[c][0] < 0.0f;
+    if(!entry->linear[c]) memcpy(entry->lut + (size_t)c * lutsize, lut[c], sizeof(float) * lutsize);
+  }
+
+  dt_pthread_mutex_lock(&self->cache_lock);
+  if(g_hash_table_contains(self->cache, key))
+    _cache_entry_free(entry); // another pipe was faster
+  else
+  {
+    g_hash_table_insert(self->cache, entry->key, entry);
+    _cache_unused(self, entry);
+  }
+  dt_pthread_mutex_unlock(&self->cache_lock);
+  return 0;
+}
+
 int dt_colorspaces_get_matrix_from_input_profile(cmsHPROFILE prof, float *matrix, float *lutr, float *lutg,
                                                  float *lutb, const int lutsize, const int intent)
 {
-  return dt_colorspaces_get_matrix_from_profile(prof, matrix, lutr, lutg, lutb, lutsize, 1, intent);
+  return _get_matrix_from_profile_cached(prof, matrix, lutr, lutg, lutb, lutsize, 1, intent);
 }
 
 int dt_colorspaces_get_matrix_from_output_profile(cmsHPROFILE prof, float *matrix, float *lutr, float *lutg,
                                                   float *lutb, const int lutsize, const int intent)
 {
-  return dt_colorspaces_get_matrix_from_profile(prof, matrix, lutr, lutg, lutb, lutsize, 0, intent);
+  return _get_matrix_from_profile_cached(prof, matrix, lutr, lutg, lutb, lutsize, 0, intent);
+}
+
+cmsHTRANSFORM dt_colorspaces_acquire_transform(cmsHPROFILE input, cmsUInt32Number input_format,
+                                               cmsHPROFILE output, cmsUInt32Number output_format,
+                                               cmsHPROFILE proofing, cmsUInt32Number intent,
+                                               cmsUInt32Number proofing_intent, cmsUInt32Number flags)
+{
+  dt_colorspaces_t *self = darktable.color_profiles;
+  GChecksum *checksum = g_checksum_new(G_CHECKSUM_MD5);
+  if(!self || !input || !output || !_cache_add_profile(checksum, input) || !_cache_add_profile(checksum, output)
+     || !_cache_add_profile(checksum, proofing))
+  {
+    // not shared, dt_colorspaces_release_transform() deletes it
+    g_checksum_free(checksum);
+    return cmsCreateProofingTransform(input, input_format, output, output_format, proofing, intent,
+                                      proofing_intent, flags);
+  }
+  gchar *key = g_strdup_printf("transform %s %u %u %u %u %u", g_checksum_get_string(checksum), input_format,
+                               output_format, intent, proofing_intent, flags);
+  g_checksum_free(checksum);
+
+  dt_pthread_mutex_lock(&self->cache_lock);
+  dt_colorspaces_cache_entry_t *entry = _cache_lookup(self, key);
+  if(entry)
+  {
+    entry->refcount++;
+    dt_pthread_mutex_unlock(&self->cache_lock);
+    g_free(key);
+    return entry->xform;
+  }
+  dt_pthread_mutex_unlock(&self->cache_lock);
+
+  // creating and optimizing the transform is the expensive part, don't block the other pipes meanwhile
+  const double start = dt_get_wtime();
+  cmsHTRANSFORM xform = cmsCreateProofingTransform(input, input_format, output, output_format, proofing, intent,
+                                                   proofing_intent, flags);
+  if(!xform)
+  {
+    g_free(key);
+    return NULL;
+  }
+  dt_print(DT_DEBUG_PERF, "[colorspaces] creating transform took %0.04f sec\n", dt_get_wtime() - start);
+
+  dt_pthread_mutex_lock(&self->cache_lock);
+  entry = (dt_colorspaces_cache_entry_t *)g_hash_table_lookup(self->cache, key);
+  if(entry)
+  {
+    // another pipe was faster
+    if(entry->refcount == 0) g_queue_remove(&self->cache_unused, entry);
+    cmsDeleteTransform(xform);
+    g_free(key);
+  }
+  else
+  {
+    entry = (dt_colorspaces_cache_entry_t *)calloc(1, sizeof(dt_colorspaces_cache_entry_t));
+    entry->key = key;
+    entry->xform = xform;
+    g_hash_table_insert(self->cache, entry->key, entry);
+    g_hash_table_insert(self->cache_xforms, entry->xform, entry);
+  }
+  entry->refcount++;
+  xform = entry->xform;
+  dt_pthread_mutex_unlock(&self->cache_lock);
+  return xform;
+}
+
+void dt_colorspaces_release_transform(cmsHTRANSFORM xform)
+{
+  if(!xform) return;
+  dt_colorspaces_t *self = darktable.color_profiles;
+  if(!self)
+  {
+    cmsDeleteTransform(xform);
+    return;
+  }
+  dt_pthread_mutex_lock(&self->cache_lock);
+  dt_colorspaces_cache_entry_t *entry
+      = (dt_colorspaces_cache_entry_t *)g_hash_table_lookup(self->cache_xforms, xform);
+  if(entry && --entry->refcount == 0) _cache_unused(self, entry);
+  dt_pthread_mutex_unlock(&self->cache_lock);
+  if(!entry) cmsDeleteTransform(xform);
 }
 
 static cmsHPROFILE dt_colorspaces_create_lab_profile()
@@ -1368,6 +1604,7 @@ dt_colorspaces_t *dt_colorspaces_init()
   _compute_prequantized_primaries(&D65xyY, &Rec709_Primaries, &Rec709_Primaries_Prequantized);
 
   pthread_rwlock_init(&res->xprofile_lock, NULL);
+  _cache_init(res);
 
   int in_pos = -1,
       out_pos = -1,
@@ -1573,6 +1810,8 @@ void dt_colorspaces_cleanup(dt_colorspaces_t *self)
   if(self->transform_adobe_rgb_to_display2) cmsDeleteTransform(self->transform_adobe_rgb_to_display2);
   self->transform_adobe_rgb_to_display2 = NULL;
 
+  _cache_cleanup(self);
+
   for(GList *iter = self->profiles; iter; iter = g_list_next(iter))
   {
     dt_colorspaces_color_profile_t *p = (dt_colorspaces_color_profile_t *)iter->data;
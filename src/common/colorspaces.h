@@ -134,6 +134,12 @@ typedef struct dt_colorspaces_t
   cmsHTRANSFORM transform_srgb_to_display, transform_adobe_rgb_to_display;
   cmsHTRANSFORM transform_srgb_to_display2, transform_adobe_rgb_to_display2;
 
+  // lcms2 transforms and matrices with curves derived from profiles, shared by all pipes
+  dt_pthread_mutex_t cache_lock;
+  GHashTable *cache;        // key -> dt_colorspaces_cache_entry_t
+  GHashTable *cache_xforms; // cmsHTRANSFORM -> dt_colorspaces_cache_entry_t
+  GQueue cache_unused;      // entries no pipe holds, most recently used first
+  uint64_t cache_hits, cache_misses;
 } dt_colorspaces_t;
 
 typedef struct dt_colorspaces_color_profile_t
@@ -188,7 +194,7 @@ cmsHPROFILE dt_colorspaces_get_rgb_profile_from_mem(uint8_t *data, uint32_t size
 void dt_colorspaces_cleanup_profile(cmsHPROFILE p);
 
 /** extracts tonecurves and color matrix prof to XYZ from a given input profile, returns 0 on success (curves
- * and matrix are inverted for input) */
+ * and matrix are inverted for input). the results are cached by the contents of the profile. */
 int dt_colorspaces_get_matrix_from_input_profile(cmsHPROFILE prof, float *matrix, float *lutr, float *lutg,
                                                  float *lutb, const int lutsize, const int intent);
 
@@ -196,6 +202,16 @@ int dt_colorspaces_get_matrix_from_input_profile(cmsHPROFILE prof, float *matrix
 int dt_colorspaces_get_matrix_from_output_profile(cmsHPROFILE prof, float *matrix, float *lutr, float *lutg,
                                                   float *lutb, const int lutsize, const int intent);
 
+/** like cmsCreateProofingTransform(), proofing may be NULL. transforms between profiles with the same contents
+ * are created once and shared between all pipes and threads, and kept for a while after the last one gave it
+ * back. so they have to be given back with dt_colorspaces_release_transform(), never deleted. */
+cmsHTRANSFORM dt_colorspaces_acquire_transform(cmsHPROFILE input, cmsUInt32Number input_format,
+                                               cmsHPROFILE output, cmsUInt32Number output_format,
+                                               cmsHPROFILE proofing, cmsUInt32Number intent,
+                                               cmsUInt32Number proofing_intent, cmsUInt32Number flags);
+/** gives back a transform of dt_colorspaces_acquire_transform(), NULL is fine. */
+void dt_colorspaces_release_transform(cmsHTRANSFORM xform);
+
 /** wrapper to get the name from a color profile. this tries to handle character encodings. */
 void dt_colorspaces_get_profile_name(cmsHPROFILE p, const char *language, const char *country, char *name,
                                      size_t len);
@@ -161,6 +161,70 @@ static inline __m128 dt_prophotoRGB_to_XYZ_sse2(__m128 rgb)
 }
 #endif
 
+#if defined(DT_HAVE_AVX_CODEPATHS)
+/** lab_f_m_sse2() for two pixels at once. */
+__DT_TARGET_AVX2__
+static inline __m256 lab_f_m_avx2(const __m256 x)
+{
+  const __m256 epsilon = _mm256_set1_ps(216.0f / 24389.0f);
+  const __m256 kappa = _mm256_set1_ps(24389.0f / 27.0f);
+
+  // calculate as if x > epsilon : result = cbrtf(x)
+  // approximate cbrtf(x):
+  const __m256 a = _mm256_castsi256_ps(
+      _mm256_add_epi32(_mm256_cvtps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(_mm256_castps_si256(x)),
+                                                        _mm256_set1_ps(3.0f))),
+                       _mm256_set1_epi32(709921077)));
+  const __m256 a3 = a * a * a;
+  const __m256 res_big = a * (a3 + x + x) / (a3 + a3 + x);
+
+  // calculate as if x <= epsilon : result = (kappa*x+16)/116
+  const __m256 res_small = (kappa * x + _mm256_set1_ps(16.0f)) / _mm256_set1_ps(116.0f);
+
+  return _mm256_blendv_ps(res_small, res_big, _mm256_cmp_ps(x, epsilon, _CMP_GT_OQ));
+}
+
+/** dt_XYZ_to_Lab_sse2() for two pixels at once. uses D50 white point. */
+__DT_TARGET_AVX2__
+static inline __m256 dt_XYZ_to_Lab_avx2(const __m256 XYZ)
+{
+  const __m256 d50_inv = _mm256_setr_ps(0.9642f, 1.0f, 0.8249f, 1.0f, 0.9642f, 1.0f, 0.8249f, 1.0f);
+  const __m256 coef = _mm256_setr_ps(116.0f, 500.0f, 200.0f, 0.0f, 116.0f, 500.0f, 200.0f, 0.0f);
+  const __m256 f = lab_f_m_avx2(XYZ / d50_inv);
+  // shuffles stay within the 128 bit lanes, which is one pixel each
+  return coef * (_mm256_permute_ps(f, _MM_SHUFFLE(3, 1, 0, 1)) - _mm256_permute_ps(f, _MM_SHUFFLE(3, 2, 1, 3)));
+}
+
+/** lab_f_m_sse2() for four pixels at once. */
+__DT_TARGET_AVX512__
+static inline __m512 lab_f_m_avx512(const __m512 x)
+{
+  const __m512 epsilon = _mm512_set1_ps(216.0f / 24389.0f);
+  const __m512 kappa = _mm512_set1_ps(24389.0f / 27.0f);
+
+  const __m512 a = _mm512_castsi512_ps(
+      _mm512_add_epi32(_mm512_cvtps_epi32(_mm512_div_ps(_mm512_cvtepi32_ps(_mm512_castps_si512(x)),
+                                                        _mm512_set1_ps(3.0f))),
+                       _mm512_set1_epi32(709921077)));
+  const __m512 a3 = a * a * a;
+  const __m512 res_big = a * (a3 + x + x) / (a3 + a3 + x);
+
+  const __m512 res_small = (kappa * x + _mm512_set1_ps(16.0f)) / _mm512_set1_ps(116.0f);
+
+  return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, epsilon, _CMP_GT_OQ), res_small, res_big);
+}
+
+/** dt_XYZ_to_Lab_sse2() for four pixels at once. uses D50 white point. */
+__DT_TARGET_AVX512__
+static inline __m512 dt_XYZ_to_Lab_avx512(const __m512 XYZ)
+{
+  const __m512 d50_inv = _mm512_broadcast_f32x4(_mm_setr_ps(0.9642f, 1.0f, 0.8249f, 1.0f));
+  const __m512 coef = _mm512_broadcast_f32x4(_mm_setr_ps(116.0f, 500.0f, 200.0f, 0.0f));
+  const __m512 f = lab_f_m_avx512(XYZ / d50_inv);
+  return coef * (_mm512_permute_ps(f, _MM_SHUFFLE(3, 1, 0, 1)) - _mm512_permute_ps(f, _MM_SHUFFLE(3, 2, 1, 3)));
+}
+#endif
+
 #ifdef _OPENMP
 #pragma omp declare simd
 #endif
@@ -41,6 +41,7 @@
 #include "common/camera_control.h"
 #endif
 #include "bauhaus/bauhaus.h"
+#include "common/clut.h"
 #include "common/cpuid.h"
 #include "common/file_location.h"
 #include "common/film.h"
@@ -54,7 +55,10 @@
 #include "common/noiseprofiles.h"
 #include "common/opencl.h"
 #include "common/points.h"
+#include "common/profiler.h"
 #include "common/resource_limits.h"
+#include "common/sidecar_writer.h"
+#include "common/tag_index.h"
 #include "common/undo.h"
 #include "control/conf.h"
 #include "control/control.h"
@@ -63,6 +67,7 @@
 #include "control/signal.h"
 #include "develop/blend.h"
 #include "develop/imageop.h"
+#include "develop/pixelpipe_cache_disk.h"
 #include "gui/gtk.h"
 #include "gui/guides.h"
 #include "gui/presets.h"
@@ -140,6 +145,7 @@ static int usage(const char *argv0)
   printf("  --noiseprofiles <noiseprofiles json file>\n");
   printf("  -t <num openmp threads>\n");
   printf("  --tmpdir <tmp directory>\n");
+  printf("  --trace <trace file>\n");
   printf("  --version\n");
 #ifdef _WIN32
   printf("\n");
@@ -310,16 +316,29 @@ static void dt_codepaths_init()
 #else
     dt_cpu_flags_t flags = dt_detect_cpu_features();
     darktable.codepath.SSE2 = ((flags & (CPU_FLAG_SSE)) && (flags & (CPU_FLAG_SSE2)));
+#endif
+    // the wider sets are only used through functions compiled for them on their own, see __DT_TARGET_AVX2__.
+    // __builtin_cpu_supports() also checks that the os saves the wide registers.
+#if defined(DT_HAVE_AVX_CODEPATHS) && defined(HAVE_BUILTIN_CPU_SUPPORTS)
+    darktable.codepath.AVX2 = (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"));
+    darktable.codepath.AVX512 = (darktable.codepath.AVX2 && __builtin_cpu_supports("avx512f"));
 #endif
   }
 
   // second, apply overrides from conf
   // NOTE: all intrinsics sets can only be overridden to OFF
   if(!dt_conf_get_bool("codepaths/sse2")) darktable.codepath.SSE2 = 0;
+  // the wider ones build on sse2 and fall back to it
+  if(!dt_conf_get_bool("codepaths/avx2") || !darktable.codepath.SSE2) darktable.codepath.AVX2 = 0;
+  if(!dt_conf_get_bool("codepaths/avx512") || !darktable.codepath.AVX2) darktable.codepath.AVX512 = 0;
 
   // last: do we have any intrinsics sets enabled?
   darktable.codepath._no_intrinsics = !(darktable.codepath.SSE2);
 
+  dt_print(DT_DEBUG_PERF, "[dt_codepaths_init] intrinsics codepaths enabled:%s%s%s\n",
+           darktable.codepath.SSE2 ? " sse2" : "", darktable.codepath.AVX2 ? " avx2" : "",
+           darktable.codepath.AVX512 ? " avx512" : "");
+
 // if there is no SSE, we must enable plain codepath by default,
 // else, enable it conditionally.
 #if defined(__SSE__)
@@ -450,6 +469,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   dt_pthread_mutex_init(&(darktable.dev_threadsafe), NULL);
   dt_pthread_mutex_init(&(darktable.capabilities_threadsafe), NULL);
   dt_pthread_mutex_init(&(darktable.exiv2_threadsafe), NULL);
+  dt_pthread_mutex_init(&(darktable.exiv2_xmp_threadsafe), NULL);
   dt_pthread_mutex_init(&(darktable.readFile_mutex), NULL);
   darktable.control = (dt_control_t *)calloc(1, sizeof(dt_control_t));
 
@@ -665,6 +685,13 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
         argv[k-1] = NULL;
         argv[k] = NULL;
       }
+      else if(!strcmp(argv[k], "--trace") && argc > k + 1)
+      {
+        k++;
+        if(!darktable.profiler) darktable.profiler = dt_profiler_init(argv[k]);
+        argv[k-1] = NULL;
+        argv[k] = NULL;
+      }
       else if(!strcmp(argv[k], "--conf") && argc > k + 1)
       {
         gchar *keyval = g_strdup(argv[++k]), *c = keyval;
@@ -828,6 +855,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
 
   // get the list of color profiles
   darktable.color_profiles = dt_colorspaces_init();
+  darktable.clut_cache = dt_clut_cache_init();
 
   // initialize the database
   darktable.db = dt_database_init(dbfilename_from_command, load_data, init_gui);
@@ -933,9 +961,18 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   darktable.image_cache = (dt_image_cache_t *)calloc(1, sizeof(dt_image_cache_t));
   dt_image_cache_init(darktable.image_cache);
 
+  darktable.sidecar_writer = (dt_sidecar_writer_t *)calloc(1, sizeof(dt_sidecar_writer_t));
+  dt_sidecar_writer_init(darktable.sidecar_writer);
+
+  darktable.tag_index = (dt_tag_index_t *)calloc(1, sizeof(dt_tag_index_t));
+  dt_tag_index_init(darktable.tag_index);
+
   darktable.mipmap_cache = (dt_mipmap_cache_t *)calloc(1, sizeof(dt_mipmap_cache_t));
   dt_mipmap_cache_init(darktable.mipmap_cache);
 
+  darktable.pixelpipe_cache_disk = (dt_dev_pixelpipe_cache_disk_t *)calloc(1, sizeof(dt_dev_pixelpipe_cache_disk_t));
+  dt_dev_pixelpipe_cache_disk_init(darktable.pixelpipe_cache_disk);
+
   // The GUI must be initialized before the views, because the init()
   // functions of the views depend on darktable.control->accels_* to register
   // their keyboard accelerators
@@ -1124,17 +1161,31 @@ void dt_cleanup()
     free(darktable.imageio);
     free(darktable.gui);
   }
+  // the writer needs the image cache and the database
+  dt_sidecar_writer_cleanup(darktable.sidecar_writer);
+  free(darktable.sidecar_writer);
+  darktable.sidecar_writer = NULL;
+  dt_tag_index_cleanup(darktable.tag_index);
+  free(darktable.tag_index);
+  darktable.tag_index = NULL;
   dt_image_cache_cleanup(darktable.image_cache);
   free(darktable.image_cache);
   dt_mipmap_cache_cleanup(darktable.mipmap_cache);
   free(darktable.mipmap_cache);
+  dt_dev_pixelpipe_cache_disk_cleanup(darktable.pixelpipe_cache_disk);
+  free(darktable.pixelpipe_cache_disk);
   if(init_gui)
   {
     dt_control_cleanup(darktable.control);
     free(darktable.control);
     dt_undo_cleanup(darktable.undo);
   }
+  // no more pipes running
+  dt_profiler_cleanup(darktable.profiler);
+  darktable.profiler = NULL;
   dt_colorspaces_cleanup(darktable.color_profiles);
+  dt_clut_cache_cleanup(darktable.clut_cache);
+  darktable.clut_cache = NULL;
   dt_conf_cleanup(darktable.conf);
   free(darktable.conf);
   dt_points_cleanup(darktable.points);
@@ -1174,6 +1225,7 @@ void dt_cleanup()
   dt_pthread_mutex_destroy(&(darktable.dev_threadsafe));
   dt_pthread_mutex_destroy(&(darktable.capabilities_threadsafe));
   dt_pthread_mutex_destroy(&(darktable.exiv2_threadsafe));
+  dt_pthread_mutex_destroy(&(darktable.exiv2_xmp_threadsafe));
   dt_pthread_mutex_destroy(&(darktable.readFile_mutex));
 
   dt_exif_cleanup();
@@ -109,6 +109,15 @@ typedef unsigned int u_int;
 #define __DT_CLONE_TARGETS__
 #endif
 
+/* Functions compiled for AVX2 with FMA or for AVX-512F on top of the baseline, see dt_codepath_t.
+   They must only be called after checking darktable.codepath.AVX2 or darktable.codepath.AVX512. */
+#if __has_attribute(target) && !defined(_WIN32) && defined(__SSE2__)
+#define DT_HAVE_AVX_CODEPATHS
+#define __DT_TARGET_AVX2__ __attribute__((target("avx2,fma")))
+#define __DT_TARGET_AVX512__ __attribute__((target("avx512f,avx2,fma")))
+#include <immintrin.h>
+#endif
+
 /* Helper to force heap vectors to be aligned on 64 bits blocks to enable AVX2 */
 #define DT_ALIGNED_ARRAY __attribute__((aligned(64)))
 #define DT_ALIGNED_PIXEL __attribute__((aligned(16)))
@@ -193,6 +202,8 @@ struct dt_gui_gtk_t;
 struct dt_control_t;
 struct dt_develop_t;
 struct dt_mipmap_cache_t;
+struct dt_dev_pixelpipe_cache_disk_t;
+struct dt_profiler_t;
 struct dt_image_cache_t;
 struct dt_lib_t;
 struct dt_conf_t;
@@ -201,6 +212,7 @@ struct dt_imageio_t;
 struct dt_bauhaus_t;
 struct dt_undo_t;
 struct dt_colorspaces_t;
+struct dt_clut_cache_t;
 struct dt_l10n_t;
 
 typedef enum dt_debug_thread_t
@@ -229,6 +241,8 @@ typedef enum dt_debug_thread_t
 typedef struct dt_codepath_t
 {
   unsigned int SSE2 : 1;
+  unsigned int AVX2 : 1;   // including FMA
+  unsigned int AVX512 : 1; // AVX-512F
   unsigned int _no_intrinsics : 1;
   unsigned int OPENMP_SIMD : 1; // always stays the last one
 } dt_codepath_t;
@@ -252,7 +266,11 @@ typedef struct darktable_t
   struct dt_control_signal_t *signals;
   struct dt_gui_gtk_t *gui;
   struct dt_mipmap_cache_t *mipmap_cache;
+  struct dt_dev_pixelpipe_cache_disk_t *pixelpipe_cache_disk;
+  struct dt_profiler_t *profiler;
   struct dt_image_cache_t *image_cache;
+  struct dt_sidecar_writer_t *sidecar_writer;
+  struct dt_tag_index_t *tag_index;
   struct dt_bauhaus_t *bauhaus;
   const struct dt_database_t *db;
   const struct dt_pwstorage_t *pwstorage;
@@ -265,12 +283,14 @@ typedef struct darktable_t
   struct dt_dbus_t *dbus;
   struct dt_undo_t *undo;
   struct dt_colorspaces_t *color_profiles;
+  struct dt_clut_cache_t *clut_cache;
   struct dt_l10n_t *l10n;
   dt_pthread_mutex_t db_image[DT_IMAGE_DBLOCKS];
   dt_pthread_mutex_t dev_threadsafe;
   dt_pthread_mutex_t plugin_threadsafe;
   dt_pthread_mutex_t capabilities_threadsafe;
   dt_pthread_mutex_t exiv2_threadsafe;
+  dt_pthread_mutex_t exiv2_xmp_threadsafe;
   dt_pthread_mutex_t readFile_mutex;
   char *progname;
   char *datadir;
@@ -631,6 +651,22 @@ static inline size_t dt_get_total_memory()
 #endif
 }
 
+// size of the L2 cache of one core in bytes, 0 if unknown
+static inline size_t dt_get_l2_cache_size()
+{
+#if defined(__linux__) && defined(_SC_LEVEL2_CACHE_SIZE)
+  const long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  return size > 0 ? size : 0;
+#elif defined(__APPLE__)
+  uint64_t size = 0;
+  size_t length = sizeof(size);
+  if(sysctlbyname("hw.l2cachesize", &size, &length, NULL, 0) != 0) return 0;
+  return size;
+#else
+  return 0;
+#endif
+}
+
 void dt_configure_performance();
 
 // helper function which loads whatever image_to_load points to: single image files or whole directories
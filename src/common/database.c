@@ -44,9 +44,12 @@
 
 // whenever _create_*_schema() gets changed you HAVE to bump this version and add an update path to
 // _upgrade_*_schema_step()!
-#define CURRENT_DATABASE_VERSION_LIBRARY 23
+#define CURRENT_DATABASE_VERSION_LIBRARY 25
 #define CURRENT_DATABASE_VERSION_DATA     5
 
+// idle prepared statements kept around for reuse, more than that get finalized when handed back
+#define DT_DATABASE_STATEMENT_CACHE_SIZE 128
+
 typedef struct dt_database_t
 {
   gboolean lock_acquired;
@@ -61,12 +64,24 @@ typedef struct dt_database_t
   sqlite3 *handle;
 
   gchar *error_message, *error_dbfilename;
+
+  /* prepared statements not in use right now, keyed by their sql text */
+  dt_pthread_mutex_t statements_mutex;
+  GHashTable *statements; // sql -> GSList of sqlite3_stmt
+  guint statements_idle;
+  guint64 statements_hits, statements_misses;
+
+  /* held by whoever has the transaction of dt_database_start_transaction() open */
+  dt_pthread_mutex_t transaction_mutex;
 } dt_database_t;
 
 
 /* migrates database from old place to new */
 static void _database_migrate_to_xdg_structure();
 
+/* finalizes a list of idle statements from the statement cache */
+static void _statements_free(gpointer data);
+
 /* delete old mipmaps files */
 static void _database_delete_mipmaps_files();
 
@@ -1415,6 +1430,51 @@ static int _upgrade_library_schema_step(dt_database_t *db, int version)
 
     new_version = 23;
   }
+  else if(version == 23)
+  {
+    sqlite3_exec(db->handle, "BEGIN TRANSACTION", NULL, NULL, NULL);
+    // images are looked up by film roll and filename together on import, duplicates and renames. the old film_id
+    // index is a prefix of the new one and only costs time on writes.
+    TRY_EXEC("CREATE INDEX IF NOT EXISTS main.images_film_id_filename_index ON images (film_id, filename)",
+             "[init] can't create film_id, filename index on image\n");
+    TRY_EXEC("DROP INDEX IF EXISTS main.images_film_id_index",
+             "[init] can't drop film_id index on image\n");
+    // tagged_images is covered by its (imgid, tagid) primary key, make sure history has its imgid index
+    TRY_EXEC("CREATE INDEX IF NOT EXISTS main.history_imgid_index ON history (imgid)",
+             "[init] can't create imgid index on history\n");
+    sqlite3_exec(db->handle, "COMMIT", NULL, NULL, NULL);
+
+    new_version = 24;
+  }
+  else if(version == 24)
+  {
+    sqlite3_exec(db->handle, "BEGIN TRANSACTION", NULL, NULL, NULL);
+    // the filters of the collect module. the sub-selects on tags, color labels and metadata are answered from
+    // the indexes alone, the tagid index is a prefix of the new one.
+    TRY_EXEC("CREATE INDEX IF NOT EXISTS main.tagged_images_tagid_imgid_index ON tagged_images (tagid, imgid)",
+             "[init] can't create tagid, imgid index on tagged_images\n");
+    TRY_EXEC("DROP INDEX IF EXISTS main.tagged_images_tagid_index",
+             "[init] can't drop tagid index on tagged_images\n");
+    TRY_EXEC("CREATE INDEX IF NOT EXISTS main.color_labels_color_imgid_index ON color_labels (color, imgid)",
+             "[init] can't create color, imgid index on color_labels\n");
+    TRY_EXEC("CREATE INDEX IF NOT EXISTS main.metadata_key_value_index ON meta_data (key, value, id)",
+             "[init] can't create key, value index on meta_data\n");
+    TRY_EXEC("CREATE INDEX IF NOT EXISTS main.images_maker_model_index ON images (maker, model)",
+             "[init] can't create maker, model index on images\n");
+    TRY_EXEC("CREATE INDEX IF NOT EXISTS main.images_datetime_taken_index ON images (datetime_taken)",
+             "[init] can't create datetime_taken index on images\n");
+    TRY_EXEC("CREATE INDEX IF NOT EXISTS main.images_iso_index ON images (iso)",
+             "[init] can't create iso index on images\n");
+    TRY_EXEC("CREATE INDEX IF NOT EXISTS main.images_focal_length_index ON images (focal_length)",
+             "[init] can't create focal_length index on images\n");
+    TRY_EXEC("CREATE INDEX IF NOT EXISTS main.images_exposure_index ON images (exposure)",
+             "[init] can't create exposure index on images\n");
+    TRY_EXEC("CREATE INDEX IF NOT EXISTS main.images_aspect_ratio_index ON images (aspect_ratio)",
+             "[init] can't create aspect_ratio index on images\n");
+    sqlite3_exec(db->handle, "COMMIT", NULL, NULL, NULL);
+
+    new_version = 25;
+  }
   else
     new_version = version; // should be the fallback so that calling code sees that we are in an infinite loop
 
@@ -1658,9 +1718,17 @@ static void _create_library_schema(dt_database_t *db)
       "max_version INTEGER, write_timestamp INTEGER, history_end INTEGER, position INTEGER, aspect_ratio REAL)",
       NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE INDEX main.images_group_id_index ON images (group_id)", NULL, NULL, NULL);
-  sqlite3_exec(db->handle, "CREATE INDEX main.images_film_id_index ON images (film_id)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.images_film_id_filename_index ON images (film_id, filename)", NULL,
+               NULL, NULL);
   sqlite3_exec(db->handle, "CREATE INDEX main.images_filename_index ON images (filename)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE INDEX main.image_position_index ON images (position)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.images_maker_model_index ON images (maker, model)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.images_datetime_taken_index ON images (datetime_taken)", NULL, NULL,
+               NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.images_iso_index ON images (iso)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.images_focal_length_index ON images (focal_length)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.images_exposure_index ON images (exposure)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.images_aspect_ratio_index ON images (aspect_ratio)", NULL, NULL, NULL);
 
   ////////////////////////////// selected_images
   sqlite3_exec(db->handle, "CREATE TABLE main.selected_images (imgid INTEGER PRIMARY KEY)", NULL, NULL, NULL);
@@ -1685,14 +1753,19 @@ static void _create_library_schema(dt_database_t *db)
   ////////////////////////////// tagged_images
   sqlite3_exec(db->handle, "CREATE TABLE main.tagged_images (imgid INTEGER, tagid INTEGER, "
                            "PRIMARY KEY (imgid, tagid))", NULL, NULL, NULL);
-  sqlite3_exec(db->handle, "CREATE INDEX main.tagged_images_tagid_index ON tagged_images (tagid)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.tagged_images_tagid_imgid_index ON tagged_images (tagid, imgid)", NULL,
+               NULL, NULL);
   ////////////////////////////// color_labels
   sqlite3_exec(db->handle, "CREATE TABLE main.color_labels (imgid INTEGER, color INTEGER)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE UNIQUE INDEX main.color_labels_idx ON color_labels (imgid, color)", NULL, NULL,
                NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.color_labels_color_imgid_index ON color_labels (color, imgid)", NULL,
+               NULL, NULL);
   ////////////////////////////// meta_data
   sqlite3_exec(db->handle, "CREATE TABLE main.meta_data (id INTEGER, key INTEGER, value VARCHAR)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE INDEX main.metadata_index ON meta_data (id, key)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.metadata_key_value_index ON meta_data (key, value, id)", NULL, NULL,
+               NULL);
 
   sqlite3_exec(db->handle, "CREATE TABLE main.module_order (imgid INTEGER PRIMARY KEY, version INTEGER, iop_list VARCHAR)",
                NULL, NULL, NULL);
@@ -1749,10 +1822,6 @@ static void _create_memory_schema(dt_database_t *db)
       "CREATE TABLE memory.collected_images (rowid INTEGER PRIMARY KEY AUTOINCREMENT, imgid INTEGER)", NULL,
       NULL, NULL);
   sqlite3_exec(db->handle, "CREATE TABLE memory.tmp_selection (imgid INTEGER PRIMARY KEY)", NULL, NULL, NULL);
-  sqlite3_exec(db->handle, "CREATE TABLE memory.taglist "
-                           "(tmpid INTEGER PRIMARY KEY, id INTEGER UNIQUE ON CONFLICT IGNORE, count INTEGER)",
-               NULL, NULL, NULL);
-  sqlite3_exec(db->handle, "CREATE TABLE memory.similar_tags (tagid INTEGER PRIMARY KEY)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE TABLE memory.darktable_tags (tagid INTEGER PRIMARY KEY)", NULL, NULL, NULL);
   sqlite3_exec(
       db->handle,
@@ -2195,6 +2264,10 @@ start:
     return NULL;
   }
 
+  dt_pthread_mutex_init(&db->statements_mutex, NULL);
+  db->statements = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, _statements_free);
+  dt_pthread_mutex_init(&db->transaction_mutex, NULL);
+
   /* attach a memory database to db connection for use with temporary tables
      used during instance life time, which is discarded on exit.
   */
@@ -2215,10 +2288,22 @@ start:
   }
   sqlite3_finalize(stmt);
 
-  // some sqlite3 config
-  sqlite3_exec(db->handle, "PRAGMA synchronous = OFF", NULL, NULL, NULL);
-  sqlite3_exec(db->handle, "PRAGMA journal_mode = MEMORY", NULL, NULL, NULL);
+  // some sqlite3 config. the page size has to be set before switching to wal, it can't change afterwards
   sqlite3_exec(db->handle, "PRAGMA page_size = 32768", NULL, NULL, NULL);
+  if(dt_conf_get_bool("database_wal"))
+  {
+    // commits only append to the log, and a crash can't corrupt the database like it can with the journal
+    // in memory. needs a file system with working shared memory, so it is opt-in.
+    sqlite3_exec(db->handle, "PRAGMA main.journal_mode = WAL", NULL, NULL, NULL);
+    sqlite3_exec(db->handle, "PRAGMA data.journal_mode = WAL", NULL, NULL, NULL);
+    sqlite3_exec(db->handle, "PRAGMA main.synchronous = NORMAL", NULL, NULL, NULL);
+    sqlite3_exec(db->handle, "PRAGMA data.synchronous = NORMAL", NULL, NULL, NULL);
+  }
+  else
+  {
+    sqlite3_exec(db->handle, "PRAGMA synchronous = OFF", NULL, NULL, NULL);
+    sqlite3_exec(db->handle, "PRAGMA journal_mode = MEMORY", NULL, NULL, NULL);
+  }
 
   /* now that we got functional databases that are locked for us we can make sure that the schema is set up */
 
@@ -2437,8 +2522,78 @@ error:
   return db;
 }
 
+static void _statements_free(gpointer data)
+{
+  g_slist_free_full((GSList *)data, (GDestroyNotify)sqlite3_finalize);
+}
+
+int dt_database_prepare_cached(const struct dt_database_t *db, const char *query, sqlite3_stmt **stmt)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  dt_pthread_mutex_lock(&d->statements_mutex);
+  gpointer key = NULL, value = NULL;
+  if(g_hash_table_lookup_extended(d->statements, query, &key, &value))
+  {
+    GSList *idle = (GSList *)value;
+    *stmt = (sqlite3_stmt *)idle->data;
+    // take the list out without finalizing it and put back what's left
+    g_hash_table_steal(d->statements, query);
+    if(idle->next)
+      g_hash_table_insert(d->statements, key, idle->next);
+    else
+      g_free(key);
+    g_slist_free_1(idle);
+    d->statements_idle--;
+    d->statements_hits++;
+    dt_pthread_mutex_unlock(&d->statements_mutex);
+    return SQLITE_OK;
+  }
+  d->statements_misses++;
+  dt_pthread_mutex_unlock(&d->statements_mutex);
+
+#if SQLITE_VERSION_NUMBER >= 3020000
+  return sqlite3_prepare_v3(d->handle, query, -1, SQLITE_PREPARE_PERSISTENT, stmt, NULL);
+#else
+  return sqlite3_prepare_v2(d->handle, query, -1, stmt, NULL);
+#endif
+}
+
+void dt_database_release_cached(const struct dt_database_t *db, sqlite3_stmt *stmt)
+{
+  if(!stmt) return;
+  dt_database_t *d = (dt_database_t *)db;
+
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+
+  dt_pthread_mutex_lock(&d->statements_mutex);
+  if(d->statements_idle >= DT_DATABASE_STATEMENT_CACHE_SIZE)
+  {
+    dt_pthread_mutex_unlock(&d->statements_mutex);
+    sqlite3_finalize(stmt);
+    return;
+  }
+  const char *query = sqlite3_sql(stmt);
+  GSList *idle = g_hash_table_lookup(d->statements, query);
+  if(idle)
+    idle->next = g_slist_prepend(idle->next, stmt);
+  else
+    g_hash_table_insert(d->statements, g_strdup(query), g_slist_prepend(NULL, stmt));
+  d->statements_idle++;
+  dt_pthread_mutex_unlock(&d->statements_mutex);
+}
+
 void dt_database_destroy(const dt_database_t *db)
 {
+  if(db->statements)
+  {
+    dt_print(DT_DEBUG_PERF, "[database] statement cache: %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT
+             " misses\n", db->statements_hits, db->statements_misses);
+    // sqlite refuses to close with statements left
+    g_hash_table_destroy(db->statements);
+    dt_pthread_mutex_destroy((dt_pthread_mutex_t *)&db->statements_mutex);
+    dt_pthread_mutex_destroy((dt_pthread_mutex_t *)&db->transaction_mutex);
+  }
   sqlite3_close(db->handle);
   if (db->lockfile_data)
   {
@@ -2522,6 +2677,26 @@ gboolean dt_database_get_lock_acquired(const dt_database_t *db)
   return db->lock_acquired;
 }
 
+gboolean dt_database_start_transaction(const struct dt_database_t *db)
+{
+  // never wait here: the one holding it may be a job waiting for the gui thread
+  if(dt_pthread_mutex_trylock((dt_pthread_mutex_t *)&db->transaction_mutex)) return FALSE;
+  // a savepoint, as some code still opens its own ones without taking the mutex
+  if(sqlite3_exec(db->handle, "SAVEPOINT dt_transaction", NULL, NULL, NULL) == SQLITE_OK) return TRUE;
+  dt_print(DT_DEBUG_SQL, "[sql] can't start a transaction: %s\n", sqlite3_errmsg(db->handle));
+  dt_pthread_mutex_unlock((dt_pthread_mutex_t *)&db->transaction_mutex);
+  return FALSE;
+}
+
+void dt_database_release_transaction(const struct dt_database_t *db, const gboolean started)
+{
+  if(!started) return;
+  // fails if a COMMIT of code not using the mutex got here first, which has written our changes already
+  if(sqlite3_exec(db->handle, "RELEASE dt_transaction", NULL, NULL, NULL) != SQLITE_OK)
+    dt_print(DT_DEBUG_SQL, "[sql] can't release a transaction: %s\n", sqlite3_errmsg(db->handle));
+  dt_pthread_mutex_unlock((dt_pthread_mutex_t *)&db->transaction_mutex);
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
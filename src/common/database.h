@@ -35,6 +35,20 @@ gboolean dt_database_get_lock_acquired(const struct dt_database_t *db);
 /** show an error popup. this has to be postponed until after we tried using dbus to reach another instance */
 void dt_database_show_error(const struct dt_database_t *db);
 
+/** prepare query, or reuse an idle statement prepared for the same query earlier. returns the sqlite result code.
+ * the statement goes back with dt_database_release_cached() instead of sqlite3_finalize(). for queries which run
+ * often, with constant sql text. */
+int dt_database_prepare_cached(const struct dt_database_t *db, const char *query, struct sqlite3_stmt **stmt);
+/** resets stmt and keeps it for the next dt_database_prepare_cached() of the same query. */
+void dt_database_release_cached(const struct dt_database_t *db, struct sqlite3_stmt *stmt);
+
+/** groups the following statements into one transaction. the connection is shared by the gui and the jobs, if
+ * some other thread has one open already the statements become part of that one instead. returns whether a
+ * transaction got started, to be handed to dt_database_release_transaction(). never blocks. */
+gboolean dt_database_start_transaction(const struct dt_database_t *db);
+/** commits the transaction of dt_database_start_transaction() if it started one. */
+void dt_database_release_transaction(const struct dt_database_t *db, const gboolean started);
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
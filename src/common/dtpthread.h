@@ -199,6 +199,12 @@ static inline int dt_pthread_cond_wait(pthread_cond_t *cond, dt_pthread_mutex_t
   return pthread_cond_wait(cond, &(mutex->mutex));
 }
 
+static inline int dt_pthread_cond_timedwait(pthread_cond_t *cond, dt_pthread_mutex_t *mutex,
+                                            const struct timespec *abstime)
+{
+  return pthread_cond_timedwait(cond, &(mutex->mutex), abstime);
+}
+
 
 static inline int dt_pthread_rwlock_init(dt_pthread_rwlock_t *lock,
     const pthread_rwlockattr_t *attr)
@@ -327,6 +333,12 @@ static inline int dt_pthread_cond_wait(pthread_cond_t *cond, dt_pthread_mutex_t
   return pthread_cond_wait(cond, &mutex->mutex);
 };
 
+static inline int dt_pthread_cond_timedwait(pthread_cond_t *cond, dt_pthread_mutex_t *mutex,
+                                            const struct timespec *abstime)
+{
+  return pthread_cond_timedwait(cond, &mutex->mutex, abstime);
+};
+
 #define dt_pthread_rwlock_t pthread_rwlock_t
 #define dt_pthread_rwlock_init pthread_rwlock_init
 #define dt_pthread_rwlock_destroy pthread_rwlock_destroy
@@ -62,6 +62,7 @@ extern "C" {
 #include "common/exif.h"
 #include "common/imageio_jpeg.h"
 #include "common/metadata.h"
+#include "common/tag_index.h"
 #include "common/tags.h"
 #include "common/iop_order.h"
 #include "common/variables.h"
@@ -141,6 +142,15 @@ static const char *_get_exiv2_type(const int type)
   }
 }
 
+// XmpLockFct for exiv2: every call into the xmp toolkit, also the one inside readMetadata(), is wrapped in it.
+static void _exif_xmp_lock(void *data, bool lock)
+{
+  if(lock)
+    dt_pthread_mutex_lock(&darktable.exiv2_xmp_threadsafe);
+  else
+    dt_pthread_mutex_unlock(&darktable.exiv2_xmp_threadsafe);
+}
+
 static void _get_xmp_tags(const char *prefix, GList **taglist)
 {
   const Exiv2::XmpPropertyInfo *pl = Exiv2::XmpProperties::propertyList(prefix);
@@ -156,7 +166,7 @@ static void _get_xmp_tags(const char *prefix, GList **taglist)
 
 GList *dt_get_exiv2_taglist()
 {
-  Exiv2::XmpParser::initialize();
+  Exiv2::XmpParser::initialize(_exif_xmp_lock, NULL);
   ::atexit(Exiv2::XmpParser::terminate);
   GList *taglist = NULL;
 
@@ -245,7 +255,15 @@ GList *dt_get_exiv2_taglist()
 
 // exiv2's readMetadata is not thread safe in 0.26. so we lock it. since readMetadata might throw an exception we
 // wrap it into some c++ magic to make sure we unlock in all cases. well, actually not magic but basic raii.
-// FIXME: check again once we rely on 0.27
+// from 0.27 on the exif and iptc parsing of distinct images is fine to run in parallel, which is what lets the
+// import parse files concurrently. the xmp toolkit behind it is not thread safe at all, exiv2 serializes it with
+// the lock function handed to XmpParser::initialize() (see _exif_xmp_lock()).
+#if EXIV2_VERSION >= EXIV2_MAKE_VERSION(0,27,0)
+#define read_metadata_threadsafe(image)                       \
+{                                                             \
+  image->readMetadata();                                      \
+}
+#else
 class Lock
 {
 public:
@@ -258,6 +276,7 @@ public:
   Lock lock;                                                  \
   image->readMetadata();                                      \
 }
+#endif
 
 static void _exif_import_tags(dt_image_t *img, Exiv2::XmpData::iterator &pos);
 
@@ -1313,7 +1332,51 @@ int dt_exif_get_thumbnail(const char *path, uint8_t **buffer, size_t *size, char
 /** read the metadata of an image.
  * XMP data trumps IPTC data trumps EXIF data
  */
+struct dt_exif_prefetch_t
+{
+  std::unique_ptr<Exiv2::Image> image;
+};
+
+dt_exif_prefetch_t *dt_exif_prefetch(const char *path)
+{
+  try
+  {
+    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(path)));
+    assert(image.get() != 0);
+    read_metadata_threadsafe(image);
+    dt_exif_prefetch_t *prefetch = new dt_exif_prefetch_t;
+    prefetch->image = std::move(image);
+    return prefetch;
+  }
+  catch(Exiv2::AnyError &e)
+  {
+    // the reader will open the file again and complain if it still fails
+    return NULL;
+  }
+}
+
+void dt_exif_prefetch_free(dt_exif_prefetch_t *prefetch)
+{
+  delete prefetch;
+}
+
+// the image a prefetch holds, or the file opened now
+static std::unique_ptr<Exiv2::Image> _exif_open(const char *path, dt_exif_prefetch_t *prefetch)
+{
+  if(prefetch && prefetch->image) return std::move(prefetch->image);
+
+  std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(path)));
+  assert(image.get() != 0);
+  read_metadata_threadsafe(image);
+  return image;
+}
+
 int dt_exif_read(dt_image_t *img, const char *path)
+{
+  return dt_exif_read_prefetched(img, path, NULL);
+}
+
+int dt_exif_read_prefetched(dt_image_t *img, const char *path, dt_exif_prefetch_t *prefetch)
 {
   // at least set datetime taken to something useful in case there is no exif data in this file (pfm, png,
   // ...)
@@ -1327,9 +1390,7 @@ int dt_exif_read(dt_image_t *img, const char *path)
 
   try
   {
-    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(path)));
-    assert(image.get() != 0);
-    read_metadata_threadsafe(image);
+    std::unique_ptr<Exiv2::Image> image = _exif_open(path, prefetch);
     bool res = true;
 
     // EXIF metadata
@@ -1968,12 +2029,14 @@ static void _exif_import_tags(dt_image_t *img, Exiv2::XmpData::iterator &pos)
         sqlite3_reset(stmt_ins_tags);
         sqlite3_clear_bindings(stmt_ins_tags);
       }
+      if(tagid > 0) dt_tag_index_tag_new(darktable.tag_index, tagid, tag);
       // associate image and tag.
       DT_DEBUG_SQLITE3_BIND_INT(stmt_ins_tagged, 1, tagid);
       DT_DEBUG_SQLITE3_BIND_INT(stmt_ins_tagged, 2, img->id);
       sqlite3_step(stmt_ins_tagged);
       sqlite3_reset(stmt_ins_tagged);
       sqlite3_clear_bindings(stmt_ins_tagged);
+      dt_tag_index_attach(darktable.tag_index, tagid, img->id);
 
       tag = next_tag;
     }
@@ -2569,6 +2632,12 @@ int _get_max_multi_priority(GList *history, const char *operation)
 
 // need a write lock on *img (non-const) to write stars (and soon color labels).
 int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_only)
+{
+  return dt_exif_xmp_read_prefetched(img, filename, history_only, NULL);
+}
+
+int dt_exif_xmp_read_prefetched(dt_image_t *img, const char *filename, const int history_only,
+                                dt_exif_prefetch_t *prefetch)
 {
   // exclude pfm to avoid stupid errors on the console
   const char *c = filename + strlen(filename) - 4;
@@ -2576,9 +2645,7 @@ int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_on
   try
   {
     // read xmp sidecar
-    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(filename)));
-    assert(image.get() != 0);
-    read_metadata_threadsafe(image);
+    std::unique_ptr<Exiv2::Image> image = _exif_open(filename, prefetch);
     Exiv2::XmpData &xmpData = image->xmpData();
 
     sqlite3_stmt *stmt;
@@ -2685,7 +2752,8 @@ int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_on
 
     // now add all masks that are not used for cloning. keeping them might be useful.
     // TODO: make this configurable? or remove it altogether?
-    sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+    // savepoints instead of transactions, the import might already have one open.
+    sqlite3_exec(dt_database_get(darktable.db), "SAVEPOINT xmp_masks", NULL, NULL, NULL);
     if(version < 3)
     {
       g_hash_table_foreach(mask_entries, add_non_clone_mask_entries_to_db, &img->id);
@@ -2702,7 +2770,7 @@ int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_on
         m_entries = g_list_next(m_entries);
       }
     }
-    sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+    sqlite3_exec(dt_database_get(darktable.db), "RELEASE xmp_masks", NULL, NULL, NULL);
 
     // history
     int num = 0;
@@ -2725,7 +2793,7 @@ int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_on
       return 1;
     }
 
-    sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+    sqlite3_exec(dt_database_get(darktable.db), "SAVEPOINT xmp_history", NULL, NULL, NULL);
 
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.history WHERE imgid = ?1", -1,
                                 &stmt, NULL);
@@ -2942,12 +3010,13 @@ end:
 
     if(all_ok)
     {
-      sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+      sqlite3_exec(dt_database_get(darktable.db), "RELEASE xmp_history", NULL, NULL, NULL);
     }
     else
     {
       std::cerr << "[exif] error reading history from '" << filename << "'" << std::endl;
-      sqlite3_exec(dt_database_get(darktable.db), "ROLLBACK TRANSACTION", NULL, NULL, NULL);
+      sqlite3_exec(dt_database_get(darktable.db), "ROLLBACK TO xmp_history", NULL, NULL, NULL);
+      sqlite3_exec(dt_database_get(darktable.db), "RELEASE xmp_history", NULL, NULL, NULL);
       return 1;
     }
 
@@ -3824,7 +3893,7 @@ void dt_exif_init()
   // preface the exiv2 messages with "[exiv2] "
   Exiv2::LogMsg::setHandler(&dt_exif_log_handler);
 
-  Exiv2::XmpParser::initialize();
+  Exiv2::XmpParser::initialize(_exif_xmp_lock, NULL);
   // this has to stay with the old url (namespace already propagated outside dt)
   Exiv2::XmpProperties::registerNs("http://darktable.sf.net/", "darktable");
   Exiv2::XmpProperties::registerNs("http://ns.adobe.com/lightroom/1.0/", "lr");
@@ -33,6 +33,17 @@ GList *dt_get_exiv2_taglist();
  * struct. returns 0 on success. */
 int dt_exif_read(dt_image_t *img, const char *path);
 
+/** the parsed metadata of a file, not yet applied to any image. */
+typedef struct dt_exif_prefetch_t dt_exif_prefetch_t;
+
+/** open and parse the file, touching neither the database nor the image cache, so it can run on any thread.
+ * returns NULL if the file could not be read. */
+dt_exif_prefetch_t *dt_exif_prefetch(const char *path);
+void dt_exif_prefetch_free(dt_exif_prefetch_t *prefetch);
+
+/** dt_exif_read() taking the parsed data from a prefetch if it isn't NULL. the prefetch is used up. */
+int dt_exif_read_prefetched(dt_image_t *img, const char *path, dt_exif_prefetch_t *prefetch);
+
 /** read exif data to image struct from given data blob, wherever you got it from. */
 int dt_exif_read_from_blob(dt_image_t *img, uint8_t *blob, const int size);
 
@@ -59,6 +70,10 @@ char *dt_exif_xmp_read_string(const int imgid);
 /** read xmp sidecar file. */
 int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_only);
 
+/** dt_exif_xmp_read() taking the parsed sidecar from a prefetch if it isn't NULL. the prefetch is used up. */
+int dt_exif_xmp_read_prefetched(dt_image_t *img, const char *filename, const int history_only,
+                                dt_exif_prefetch_t *prefetch);
+
 /** fetch largest exif thumbnail jpg bytestream into buffer*/
 int dt_exif_get_thumbnail(const char *path, uint8_t **buffer, size_t *size, char **mime_type);
 
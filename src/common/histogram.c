@@ -43,16 +43,56 @@ inline static void histogram_helper_cs_RAW_helper_process_pixel_float(
   histogram[4 * i]++;
 }
 
+#if defined(__SSE2__)
+// 4 pixels at once, only the increments stay scalar
+inline static void histogram_helper_cs_RAW_helper_process_row_m128(
+    const dt_dev_histogram_collection_params_t *const histogram_params, const float *input, uint32_t *histogram,
+    const int width)
+{
+  const __m128 scale = _mm_set1_ps(histogram_params->mul);
+  const __m128 val_min = _mm_setzero_ps();
+  const __m128 val_max = _mm_set1_ps(histogram_params->bins_count - 1);
+
+  int i = 0;
+  for(; i + 4 <= width; i += 4, input += 4)
+  {
+    const __m128 scaled = _mm_mul_ps(_mm_loadu_ps(input), scale);
+    const __m128 clamped = _mm_max_ps(_mm_min_ps(scaled, val_max), val_min);
+
+    // truncate like the scalar path does
+    __m128i values __attribute__((aligned(16)));
+    _mm_store_si128(&values, _mm_cvttps_epi32(clamped));
+
+    const uint32_t *valuesi = (uint32_t *)(&values);
+
+    histogram[4 * valuesi[0]]++;
+    histogram[4 * valuesi[1]]++;
+    histogram[4 * valuesi[2]]++;
+    histogram[4 * valuesi[3]]++;
+  }
+  for(; i < width; i++, input++) histogram_helper_cs_RAW_helper_process_pixel_float(histogram_params, input, histogram);
+}
+#endif
+
 inline static void histogram_helper_cs_RAW(const dt_dev_histogram_collection_params_t *const histogram_params,
                                            const void *pixel, uint32_t *histogram, int j,
                                            const dt_iop_order_iccprofile_info_t *const profile_info)
 {
   const dt_histogram_roi_t *roi = histogram_params->roi;
   const float *input = (float *)pixel + roi->width * j + roi->crop_x;
-  for(int i = 0; i < roi->width - roi->crop_width - roi->crop_x; i++, input++)
+  const int width = roi->width - roi->crop_width - roi->crop_x;
+
+  if(darktable.codepath.OPENMP_SIMD)
   {
-    histogram_helper_cs_RAW_helper_process_pixel_float(histogram_params, input, histogram);
+    for(int i = 0; i < width; i++, input++)
+      histogram_helper_cs_RAW_helper_process_pixel_float(histogram_params, input, histogram);
   }
+#if defined(__SSE2__)
+  else if(darktable.codepath.SSE2)
+    histogram_helper_cs_RAW_helper_process_row_m128(histogram_params, input, histogram, width);
+#endif
+  else
+    dt_unreachable_codepath();
 }
 
 //------------------------------------------------------------------------------
@@ -166,18 +206,22 @@ inline static void histogram_helper_cs_rgb(const dt_dev_histogram_collection_par
   const dt_histogram_roi_t *roi = histogram_params->roi;
   float *in = (float *)pixel + 4 * (roi->width * j + roi->crop_x);
 
-  // process aligned pixels with SSE
-  for(int i = 0; i < roi->width - roi->crop_width - roi->crop_x; i++, in += 4)
+  const int width = roi->width - roi->crop_width - roi->crop_x;
+
+  // the codepath can't change within a row, don't ask for every pixel
+  if(darktable.codepath.OPENMP_SIMD)
   {
-    if(darktable.codepath.OPENMP_SIMD)
-      histogram_helper_cs_rgb_helper_process_pixel_float(histogram_params, in, histogram);
+    for(int i = 0; i < width; i++, in += 4) histogram_helper_cs_rgb_helper_process_pixel_float(histogram_params, in, histogram);
+  }
 #if defined(__SSE2__)
-    else if(darktable.codepath.SSE2)
-      histogram_helper_cs_rgb_helper_process_pixel_m128(histogram_params, in, histogram);
-#endif
-    else
-      dt_unreachable_codepath();
+  else if(darktable.codepath.SSE2)
+  {
+    // process aligned pixels with SSE
+    for(int i = 0; i < width; i++, in += 4) histogram_helper_cs_rgb_helper_process_pixel_m128(histogram_params, in, histogram);
   }
+#endif
+  else
+    dt_unreachable_codepath();
 }
 
 inline static void histogram_helper_cs_rgb_compensated(const dt_dev_histogram_collection_params_t *const histogram_params,
@@ -187,18 +231,24 @@ inline static void histogram_helper_cs_rgb_compensated(const dt_dev_histogram_co
   const dt_histogram_roi_t *roi = histogram_params->roi;
   float *in = (float *)pixel + 4 * (roi->width * j + roi->crop_x);
 
-  // process aligned pixels with SSE
-  for(int i = 0; i < roi->width - roi->crop_width - roi->crop_x; i++, in += 4)
+  const int width = roi->width - roi->crop_width - roi->crop_x;
+
+  // the codepath can't change within a row, don't ask for every pixel
+  if(darktable.codepath.OPENMP_SIMD)
   {
-    if(darktable.codepath.OPENMP_SIMD)
+    for(int i = 0; i < width; i++, in += 4)
       histogram_helper_cs_rgb_helper_process_pixel_float_compensated(histogram_params, in, histogram, profile_info);
+  }
 #if defined(__SSE2__)
-    else if(darktable.codepath.SSE2)
+  else if(darktable.codepath.SSE2)
+  {
+    // process aligned pixels with SSE
+    for(int i = 0; i < width; i++, in += 4)
       histogram_helper_cs_rgb_helper_process_pixel_m128_compensated(histogram_params, in, histogram, profile_info);
-#endif
-    else
-      dt_unreachable_codepath();
   }
+#endif
+  else
+    dt_unreachable_codepath();
 }
 
 //------------------------------------------------------------------------------
@@ -255,18 +305,22 @@ inline static void histogram_helper_cs_Lab(const dt_dev_histogram_collection_par
   const dt_histogram_roi_t *roi = histogram_params->roi;
   float *in = (float *)pixel + 4 * (roi->width * j + roi->crop_x);
 
-  // process aligned pixels with SSE
-  for(int i = 0; i < roi->width - roi->crop_width - roi->crop_x; i++, in += 4)
+  const int width = roi->width - roi->crop_width - roi->crop_x;
+
+  // the codepath can't change within a row, don't ask for every pixel
+  if(darktable.codepath.OPENMP_SIMD)
   {
-    if(darktable.codepath.OPENMP_SIMD)
-      histogram_helper_cs_Lab_helper_process_pixel_float(histogram_params, in, histogram);
+    for(int i = 0; i < width; i++, in += 4) histogram_helper_cs_Lab_helper_process_pixel_float(histogram_params, in, histogram);
+  }
 #if defined(__SSE2__)
-    else if(darktable.codepath.SSE2)
-      histogram_helper_cs_Lab_helper_process_pixel_m128(histogram_params, in, histogram);
-#endif
-    else
-      dt_unreachable_codepath();
+  else if(darktable.codepath.SSE2)
+  {
+    // process aligned pixels with SSE
+    for(int i = 0; i < width; i++, in += 4) histogram_helper_cs_Lab_helper_process_pixel_m128(histogram_params, in, histogram);
   }
+#endif
+  else
+    dt_unreachable_codepath();
 }
 
 inline static void __attribute__((__unused__)) histogram_helper_cs_Lab_LCh_helper_process_pixel_float(
@@ -310,50 +364,64 @@ void dt_histogram_worker(dt_dev_histogram_collection_params_t *const histogram_p
                          uint32_t **histogram, const dt_worker Worker,
                          const dt_iop_order_iccprofile_info_t *const profile_info)
 {
+#ifdef _OPENMP
   const int nthreads = omp_get_max_threads();
+#else
+  const int nthreads = 1;
+#endif
 
   const size_t bins_total = (size_t)4 * histogram_params->bins_count;
   const size_t buf_size = bins_total * sizeof(uint32_t);
-  void *partial_hists = calloc(nthreads, buf_size);
+  // pad the per-thread histograms to whole cache lines, so that no two threads ever write the same line
+  const size_t stride = ((buf_size + 63) & ~(size_t)63) / sizeof(uint32_t);
+  uint32_t *partial_hists = dt_alloc_align(64, nthreads * stride * sizeof(uint32_t));
+  if(!partial_hists) return;
 
   if(histogram_params->mul == 0) histogram_params->mul = (double)(histogram_params->bins_count - 1);
 
   const dt_histogram_roi_t *const roi = histogram_params->roi;
+  const int row_start = roi->crop_y;
+  const int row_end = roi->height - roi->crop_height;
 
+  // every thread bins one band of rows into its own histogram, then the histograms are summed pairwise in
+  // log2(threads) rounds. the thread that owns a histogram adds into it, so it stays in that thread's cache.
 #ifdef _OPENMP
-#pragma omp parallel for default(none) \
-  dt_omp_firstprivate(histogram_params, pixel, Worker, profile_info, bins_total, roi) \
-  shared(partial_hists) \
-  schedule(static)
+#pragma omp parallel default(none) num_threads(nthreads) \
+  dt_omp_firstprivate(histogram_params, pixel, Worker, profile_info, bins_total, stride, row_start, row_end) \
+  shared(partial_hists)
 #endif
-  for(int j = roi->crop_y; j < roi->height - roi->crop_height; j++)
   {
-    uint32_t *thread_hist = (uint32_t *)partial_hists + bins_total * omp_get_thread_num();
-    Worker(histogram_params, pixel, thread_hist, j, profile_info);
-  }
-
 #ifdef _OPENMP
-  *histogram = realloc(*histogram, buf_size);
-  memset(*histogram, 0, buf_size);
-  uint32_t *hist = *histogram;
+    const int team = omp_get_num_threads();
+    const int tid = omp_get_thread_num();
+#else
+    const int team = 1;
+    const int tid = 0;
+#endif
+    uint32_t *const thread_hist = partial_hists + stride * tid;
+    memset(thread_hist, 0, bins_total * sizeof(uint32_t));
 
-#pragma omp parallel for default(none) \
-  dt_omp_firstprivate(nthreads, bins_total) \
-  shared(hist, partial_hists) \
-  schedule(static)
-  for(size_t k = 0; k < bins_total; k++)
-  {
-    for(size_t n = 0; n < nthreads; n++)
+    const int band = (row_end - row_start + team - 1) / team;
+    const int j_start = row_start + tid * band;
+    const int j_end = MIN(row_end, j_start + band);
+    for(int j = j_start; j < j_end; j++) Worker(histogram_params, pixel, thread_hist, j, profile_info);
+
+    for(int step = 1; step < team; step *= 2)
     {
-      const uint32_t *thread_hist = (uint32_t *)partial_hists + bins_total * n;
-      hist[k] += thread_hist[k];
+#ifdef _OPENMP
+#pragma omp barrier
+#endif
+      if(tid % (2 * step) == 0 && tid + step < team)
+      {
+        const uint32_t *const other = partial_hists + stride * (tid + step);
+        for(size_t k = 0; k < bins_total; k++) thread_hist[k] += other[k];
+      }
     }
   }
-#else
+
   *histogram = realloc(*histogram, buf_size);
-  memmove(*histogram, partial_hists, buf_size);
-#endif
-  free(partial_hists);
+  memcpy(*histogram, partial_hists, buf_size);
+  dt_free_align(partial_hists);
 
   histogram_stats->bins_count = histogram_params->bins_count;
   histogram_stats->pixels = (roi->width - roi->crop_width - roi->crop_x)
@@ -189,6 +189,13 @@ int dt_history_load_and_apply(const int imgid, gchar *filename, int history_only
     dt_image_reset_final_size(imgid);
   }
   dt_unlock_image(imgid);
+  if(img && !history_only)
+  {
+    // rating, labels and the like came from the sidecar as well
+    GList *imgs = g_list_prepend(NULL, GINT_TO_POINTER(imgid));
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_IMAGE_INFO_CHANGED, imgs);
+    g_list_free(imgs);
+  }
   return 0;
 }
 
@@ -28,6 +28,8 @@
 #include "common/imageio.h"
 #include "common/imageio_rawspeed.h"
 #include "common/mipmap_cache.h"
+#include "common/sidecar_writer.h"
+#include "common/tag_index.h"
 #include "common/tags.h"
 #include "common/undo.h"
 #include "control/conf.h"
@@ -157,15 +159,14 @@ const char *dt_image_film_roll_name(const char *path)
 void dt_image_film_roll_directory(const dt_image_t *img, char *pathname, size_t pathname_len)
 {
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT folder FROM main.film_rolls WHERE id = ?1",
-                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, "SELECT folder FROM main.film_rolls WHERE id = ?1", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->film_id);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
     char *f = (char *)sqlite3_column_text(stmt, 0);
     snprintf(pathname, pathname_len, "%s", f);
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
   pathname[pathname_len - 1] = '\0';
 }
 
@@ -173,8 +174,7 @@ void dt_image_film_roll_directory(const dt_image_t *img, char *pathname, size_t
 void dt_image_film_roll(const dt_image_t *img, char *pathname, size_t pathname_len)
 {
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT folder FROM main.film_rolls WHERE id = ?1",
-                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, "SELECT folder FROM main.film_rolls WHERE id = ?1", &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->film_id);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
@@ -186,7 +186,7 @@ void dt_image_film_roll(const dt_image_t *img, char *pathname, size_t pathname_l
   {
     snprintf(pathname, pathname_len, "%s", _("orphaned image"));
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
   pathname[pathname_len - 1] = '\0';
 }
 
@@ -825,6 +825,7 @@ int32_t dt_image_duplicate_with_version(const int32_t imgid, const int32_t newve
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
     sqlite3_step(stmt);
     sqlite3_finalize(stmt);
+    dt_tag_index_image_copy(darktable.tag_index, newid, imgid);
 
     if(darktable.develop->image_storage.id == imgid)
     {
@@ -884,6 +885,9 @@ void dt_image_remove(const int32_t imgid)
 
   if(dt_image_local_copy_reset(imgid)) return;
 
+  // there is no sidecar to update anymore
+  if(darktable.sidecar_writer) dt_sidecar_writer_forget(darktable.sidecar_writer, imgid);
+
   sqlite3_stmt *stmt;
   const dt_image_t *img = dt_image_cache_get(darktable.image_cache, imgid, 'r');
   int old_group_id = img->group_id;
@@ -906,6 +910,7 @@ void dt_image_remove(const int32_t imgid)
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
+  dt_tag_index_image_remove(darktable.tag_index, imgid);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.history WHERE imgid = ?1", -1,
                               &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
@@ -1026,13 +1031,11 @@ GList* dt_image_find_duplicates(const char* filename)
 }
 
 
-void dt_image_read_duplicates(const uint32_t id, const char *filename)
+// import the sidecars of duplicates found by dt_image_find_duplicates(), frees files
+static void _image_read_duplicates(const uint32_t id, const char *filename, GList *files)
 {
-  // Search for duplicate's sidecar files and import them if found and not in DB yet
   gchar pattern[PATH_MAX] = { 0 };
 
-  GList *files = dt_image_find_duplicates(filename);
-
   // we store the xmp filename without version part in pattern to speed up string comparison later
   g_snprintf(pattern, sizeof(pattern), "%s.xmp", filename);
 
@@ -1078,14 +1081,41 @@ void dt_image_read_duplicates(const uint32_t id, const char *filename)
 
 }
 
+void dt_image_read_duplicates(const uint32_t id, const char *filename)
+{
+  // Search for duplicate's sidecar files and import them if found and not in DB yet
+  _image_read_duplicates(id, filename, dt_image_find_duplicates(filename));
+}
+
+struct dt_image_import_prefetch_t
+{
+  gchar *filename; // normalized
+  gchar *ext;      // lower case
+  GList *duplicates;
+  // parsed metadata of the file and its sidecar, NULL if not prefetched
+  dt_exif_prefetch_t *exif;
+  dt_exif_prefetch_t *xmp;
+};
+
+static void _image_import_prefetch_free(dt_image_import_prefetch_t *prefetch)
+{
+  g_free(prefetch->filename);
+  g_free(prefetch->ext);
+  g_list_free_full(prefetch->duplicates, g_free);
+  dt_exif_prefetch_free(prefetch->exif);
+  dt_exif_prefetch_free(prefetch->xmp);
+  free(prefetch);
+}
 
-static uint32_t dt_image_import_internal(const int32_t film_id, const char *filename, gboolean override_ignore_jpegs, gboolean lua_locking)
+// everything of an import that works without the database. returns NULL for files not to be imported.
+static dt_image_import_prefetch_t *_image_import_prepare(const char *filename, gboolean override_ignore_jpegs,
+                                                         gboolean parse)
 {
   char *normalized_filename = dt_util_normalize_path(filename);
   if(!normalized_filename || !g_file_test(normalized_filename, G_FILE_TEST_IS_REGULAR) || dt_util_get_file_size(normalized_filename) == 0)
   {
     g_free(normalized_filename);
-    return 0;
+    return NULL;
   }
   const char *cc = normalized_filename + strlen(normalized_filename);
   for(; *cc != '.' && cc > normalized_filename; cc--)
@@ -1093,7 +1123,7 @@ static uint32_t dt_image_import_internal(const int32_t film_id, const char *file
   if(!strcasecmp(cc, ".dt") || !strcasecmp(cc, ".dttags") || !strcasecmp(cc, ".xmp"))
   {
     g_free(normalized_filename);
-    return 0;
+    return NULL;
   }
   char *ext = g_ascii_strdown(cc + 1, -1);
   if(override_ignore_jpegs == FALSE && (!strcmp(ext, "jpg") || !strcmp(ext, "jpeg"))
@@ -1101,7 +1131,7 @@ static uint32_t dt_image_import_internal(const int32_t film_id, const char *file
   {
     g_free(normalized_filename);
     g_free(ext);
-    return 0;
+    return NULL;
   }
   int supported = 0;
   for(const char **i = dt_supported_extensions; *i != NULL; i++)
@@ -1114,33 +1144,59 @@ static uint32_t dt_image_import_internal(const int32_t film_id, const char *file
   {
     g_free(normalized_filename);
     g_free(ext);
-    return 0;
+    return NULL;
+  }
+
+  dt_image_import_prefetch_t *prefetch = calloc(1, sizeof(dt_image_import_prefetch_t));
+  prefetch->filename = normalized_filename;
+  prefetch->ext = ext;
+  prefetch->duplicates = dt_image_find_duplicates(normalized_filename);
+  if(parse)
+  {
+    prefetch->exif = dt_exif_prefetch(normalized_filename);
+    gchar *xmpfilename = g_strconcat(normalized_filename, ".xmp", NULL);
+    if(g_file_test(xmpfilename, G_FILE_TEST_IS_REGULAR)) prefetch->xmp = dt_exif_prefetch(xmpfilename);
+    g_free(xmpfilename);
   }
+  return prefetch;
+}
+
+dt_image_import_prefetch_t *dt_image_import_prefetch(const char *filename, gboolean override_ignore_jpegs)
+{
+  return _image_import_prepare(filename, override_ignore_jpegs, TRUE);
+}
+
+// the database part of an import, frees prefetch
+static uint32_t _image_import_commit(const int32_t film_id, dt_image_import_prefetch_t *prefetch,
+                                     gboolean lua_locking)
+{
+  const char *normalized_filename = prefetch->filename;
+  const char *ext = prefetch->ext;
   int rc;
   uint32_t id = 0;
   // select from images; if found => return
   gchar *imgfname;
   imgfname = g_path_get_basename(normalized_filename);
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT id FROM main.images WHERE film_id = ?1 AND filename = ?2", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, "SELECT id FROM main.images WHERE film_id = ?1 AND filename = ?2",
+                                  &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, film_id);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, imgfname, -1, SQLITE_STATIC);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
     id = sqlite3_column_int(stmt, 0);
     g_free(imgfname);
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
     dt_image_t *img = dt_image_cache_get(darktable.image_cache, id, 'w');
     img->flags &= ~DT_IMAGE_REMOVE;
     dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
-    dt_image_read_duplicates(id, normalized_filename);
+    _image_read_duplicates(id, normalized_filename, prefetch->duplicates);
+    prefetch->duplicates = NULL;
     dt_image_synch_all_xmp(normalized_filename);
-    g_free(ext);
-    g_free(normalized_filename);
+    _image_import_prefetch_free(prefetch);
     return id;
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
   // also need to set the no-legacy bit, to make sure we get the right presets (new ones)
   uint32_t flags = dt_conf_get_int("ui_last/import_initial_rating");
@@ -1194,12 +1250,12 @@ static uint32_t dt_image_import_internal(const int32_t film_id, const char *file
   if(rc != SQLITE_DONE) fprintf(stderr, "sqlite3 error %d\n", rc);
   sqlite3_finalize(stmt);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT id FROM main.images WHERE film_id = ?1 AND filename = ?2", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(darktable.db, "SELECT id FROM main.images WHERE film_id = ?1 AND filename = ?2",
+                                  &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, film_id);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, imgfname, -1, SQLITE_STATIC);
   if(sqlite3_step(stmt) == SQLITE_ROW) id = sqlite3_column_int(stmt, 0);
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
   // Try to find out if this should be grouped already.
   gchar *basename = g_strdup(imgfname);
@@ -1293,13 +1349,13 @@ static uint32_t dt_image_import_internal(const int32_t film_id, const char *file
   img->group_id = group_id;
 
   // read dttags and exif for database queries!
-  (void)dt_exif_read(img, normalized_filename);
+  (void)dt_exif_read_prefetched(img, normalized_filename, prefetch->exif);
   char dtfilename[PATH_MAX] = { 0 };
   g_strlcpy(dtfilename, normalized_filename, sizeof(dtfilename));
   // dt_image_path_append_version(id, dtfilename, sizeof(dtfilename));
   g_strlcat(dtfilename, ".xmp", sizeof(dtfilename));
 
-  const int res = dt_exif_xmp_read(img, dtfilename, 0);
+  const int res = dt_exif_xmp_read_prefetched(img, dtfilename, 0, prefetch->xmp);
 
   // write through to db, but not to xmp.
   dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
@@ -1314,7 +1370,6 @@ static uint32_t dt_image_import_internal(const int32_t film_id, const char *file
   guint tagid = 0;
   char tagname[512];
   snprintf(tagname, sizeof(tagname), "darktable|format|%s", ext);
-  g_free(ext);
   dt_tag_new(tagname, &tagid);
   dt_tag_attach(tagid, id, FALSE, FALSE);
 
@@ -1322,13 +1377,14 @@ static uint32_t dt_image_import_internal(const int32_t film_id, const char *file
   dt_mipmap_cache_remove(darktable.mipmap_cache, id);
 
   // read all sidecar files
-  dt_image_read_duplicates(id, normalized_filename);
+  _image_read_duplicates(id, normalized_filename, prefetch->duplicates);
+  prefetch->duplicates = NULL;
   dt_image_synch_all_xmp(normalized_filename);
 
   g_free(imgfname);
   g_free(basename);
   g_free(sql_pattern);
-  g_free(normalized_filename);
+  _image_import_prefetch_free(prefetch);
 
 #ifdef USE_LUA
   //Synchronous calling of lua post-import-image events
@@ -1352,6 +1408,18 @@ static uint32_t dt_image_import_internal(const int32_t film_id, const char *file
   return id;
 }
 
+uint32_t dt_image_import_prefetched(const int32_t film_id, dt_image_import_prefetch_t *prefetch)
+{
+  return _image_import_commit(film_id, prefetch, TRUE);
+}
+
+static uint32_t dt_image_import_internal(const int32_t film_id, const char *filename, gboolean override_ignore_jpegs, gboolean lua_locking)
+{
+  dt_image_import_prefetch_t *prefetch = _image_import_prepare(filename, override_ignore_jpegs, FALSE);
+  if(!prefetch) return 0;
+  return _image_import_commit(film_id, prefetch, lua_locking);
+}
+
 uint32_t dt_image_import(const int32_t film_id, const char *filename, gboolean override_ignore_jpegs)
 {
   return dt_image_import_internal(film_id, filename, override_ignore_jpegs, TRUE);
@@ -1493,6 +1561,9 @@ int32_t dt_image_rename(const int32_t imgid, const int32_t filmid, const gchar *
     // get current local copy if any
     _image_local_copy_full_path(imgid, copysrcpath, sizeof(copysrcpath));
 
+    // pending sidecar writes would go astray while we move things around
+    if(darktable.sidecar_writer) dt_sidecar_writer_flush(darktable.sidecar_writer);
+
     // move image
     GError *moveError = NULL;
     gboolean moveStatus = g_file_move(old, new, 0, NULL, NULL, NULL, &moveError);
@@ -1771,6 +1842,7 @@ int32_t dt_image_copy_rename(const int32_t imgid, const int32_t filmid, const gc
         DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
         sqlite3_step(stmt);
         sqlite3_finalize(stmt);
+        dt_tag_index_image_copy(darktable.tag_index, newid, imgid);
 
         // get max_version of image duplicates in destination filmroll
         int32_t max_version = -1;
@@ -1985,7 +2057,7 @@ int dt_image_local_copy_reset(const int32_t imgid)
 
     // first sync the xmp with the original picture
 
-    dt_image_write_sidecar_file(imgid);
+    dt_image_write_sidecar_file_now(imgid, NULL, 0);
 
     // delete image from cache directory only if there is no other local cache image referencing it
     // for example duplicates are all referencing the same base picture.
@@ -2021,6 +2093,16 @@ int dt_image_local_copy_reset(const int32_t imgid)
 // *******************************************************
 
 void dt_image_write_sidecar_file(int imgid)
+{
+  if(imgid <= 0 || !dt_conf_get_bool("write_sidecar_files")) return;
+
+  if(darktable.sidecar_writer)
+    dt_sidecar_writer_queue(darktable.sidecar_writer, imgid);
+  else
+    dt_image_write_sidecar_file_now(imgid, NULL, 0);
+}
+
+gboolean dt_image_write_sidecar_file_now(const int imgid, char *xmpfilename, const size_t xmpfilename_len)
 {
   // TODO: compute hash and don't write if not needed!
   // write .xmp file
@@ -2039,7 +2121,7 @@ void dt_image_write_sidecar_file(int imgid)
       dt_image_full_path(imgid, filename, sizeof(filename), &from_cache);
 
       //  nothing to do, the original is not accessible and there is no local copy
-      if (!from_cache) return;
+      if (!from_cache) return FALSE;
     }
 
     dt_image_path_append_version(imgid, filename, sizeof(filename));
@@ -2056,8 +2138,11 @@ void dt_image_write_sidecar_file(int imgid)
       DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
       sqlite3_step(stmt);
       sqlite3_finalize(stmt);
+      if(xmpfilename) g_strlcpy(xmpfilename, filename, xmpfilename_len);
+      return TRUE;
     }
   }
+  return FALSE;
 }
 
 
@@ -250,6 +250,13 @@ void dt_image_read_duplicates(uint32_t id, const char *filename);
 uint32_t dt_image_import(int32_t film_id, const char *filename, gboolean override_ignore_jpegs);
 /** imports a new image from raw/etc file and adds it to the data base and image cache. Use from lua thread.*/
 uint32_t dt_image_import_lua(int32_t film_id, const char *filename, gboolean override_ignore_jpegs);
+/** a file checked and parsed for import, but not yet in the data base. */
+typedef struct dt_image_import_prefetch_t dt_image_import_prefetch_t;
+/** the part of dt_image_import() not touching the data base: file checks, sidecar search and exif/xmp parsing.
+    can run on any thread. returns NULL for files that would not be imported.*/
+dt_image_import_prefetch_t *dt_image_import_prefetch(const char *filename, gboolean override_ignore_jpegs);
+/** the rest of dt_image_import(), to be called in import order from one thread. frees prefetch.*/
+uint32_t dt_image_import_prefetched(int32_t film_id, dt_image_import_prefetch_t *prefetch);
 /** removes the given image from the database. */
 void dt_image_remove(const int32_t imgid);
 /** duplicates the given image in the database with the duplicate getting the supplied version number. if that
@@ -333,7 +340,11 @@ gboolean dt_image_safe_remove(const int32_t imgid);
 /* try to sync .xmp for all local copies */
 void dt_image_local_copy_synch(void);
 // xmp functions:
+/* queue writing the sidecar with the background writer. */
 void dt_image_write_sidecar_file(int imgid);
+/* write the sidecar on the calling thread. xmpfilename gets the path written if not NULL. returns TRUE if
+   something was written. */
+gboolean dt_image_write_sidecar_file_now(const int imgid, char *xmpfilename, const size_t xmpfilename_len);
 void dt_image_synch_xmp(const int selected);
 void dt_image_synch_all_xmp(const gchar *pathname);
 
@@ -36,13 +36,13 @@ void dt_image_cache_allocate(void *data, dt_cache_entry_t *entry)
   // load stuff from db and store in cache:
   char *str;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(
-      dt_database_get(darktable.db),
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(
+      darktable.db,
       "SELECT id, group_id, film_id, width, height, filename, maker, model, lens, exposure, "
       "aperture, iso, focal_length, datetime_taken, flags, crop, orientation, focus_distance, "
       "raw_parameters, longitude, latitude, altitude, color_matrix, colorspace, version, raw_black, "
       "raw_maximum, aspect_ratio FROM main.images WHERE id = ?1",
-      -1, &stmt, NULL);
+      &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, entry->key);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
@@ -142,7 +142,7 @@ void dt_image_cache_allocate(void *data, dt_cache_entry_t *entry)
     fprintf(stderr, "[image_cache_allocate] failed to open image %d from database: %s\n", entry->key,
             sqlite3_errmsg(dt_database_get(darktable.db)));
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
   img->cache_entry = entry; // init backref
   // could downgrade lock write->read on entry->lock if we were using concurrencykit..
   dt_image_refresh_makermodel(img);
@@ -231,15 +231,15 @@ void dt_image_cache_write_release(dt_image_cache_t *cache, dt_image_t *img, dt_i
   }
   if(img->id <= 0) return;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(
-      dt_database_get(darktable.db),
+  DT_DEBUG_SQLITE3_PREPARE_CACHED(
+      darktable.db,
       "UPDATE main.images SET width = ?1, height = ?2, filename = ?3, maker = ?4, model = ?5, "
       "lens = ?6, exposure = ?7, aperture = ?8, iso = ?9, focal_length = ?10, "
       "focus_distance = ?11, film_id = ?12, datetime_taken = ?13, flags = ?14, "
       "crop = ?15, orientation = ?16, raw_parameters = ?17, group_id = ?18, longitude = ?19, "
       "latitude = ?20, altitude = ?21, color_matrix = ?22, colorspace = ?23, raw_black = ?24, "
       "raw_maximum = ?25, aspect_ratio = ROUND(?26,1) WHERE id = ?27",
-      -1, &stmt, NULL);
+      &stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->width);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, img->height);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, img->filename, -1, SQLITE_STATIC);
@@ -270,7 +270,7 @@ void dt_image_cache_write_release(dt_image_cache_t *cache, dt_image_t *img, dt_i
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 27, img->id);
   const int rc = sqlite3_step(stmt);
   if(rc != SQLITE_DONE) fprintf(stderr, "[image_cache_write_release] sqlite3 error %d\n", rc);
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
   // TODO: make this work in relaxed mode, too.
   if(mode == DT_IMAGE_CACHE_SAFE)
@@ -52,6 +52,8 @@
 #include "develop/blend.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
+#include "develop/imageop_math.h"
+#include "develop/tiling.h"
 
 #ifdef HAVE_GRAPHICSMAGICK
 #include <magick/api.h>
@@ -606,6 +608,258 @@ void dt_imageio_to_fractional(float in, uint32_t *num, uint32_t *den)
   }
 }
 
+// process the rows [y, y + height) of the final image
+static int _export_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const gboolean high_quality_processing,
+                           const int bpp, const int y, const int width, const int height, const double scale)
+{
+  if(high_quality_processing)
+  {
+    /*
+     * if high quality processing was requested, downsampling will be done
+     * at the very end of the pipe (just before border and watermark)
+     */
+    return dt_dev_pixelpipe_process_no_gamma(pipe, dev, 0, y, width, height, scale);
+  }
+
+  // else, downsampling will be right after demosaic
+
+  // so we need to turn temporarily disable in-pipe late downsampling iop.
+
+  // find the finalscale module
+  dt_dev_pixelpipe_iop_t *finalscale = NULL;
+  {
+    GList *nodes = g_list_last(pipe->nodes);
+    while(nodes)
+    {
+      dt_dev_pixelpipe_iop_t *node = (dt_dev_pixelpipe_iop_t *)(nodes->data);
+      if(!strcmp(node->module->op, "finalscale"))
+      {
+        finalscale = node;
+        break;
+      }
+      nodes = g_list_previous(nodes);
+    }
+  }
+
+  if(finalscale) finalscale->enabled = 0;
+
+  // do the processing (8-bit with special treatment, to make sure we can use openmp further down):
+  int res;
+  if(bpp == 8)
+    res = dt_dev_pixelpipe_process(pipe, dev, 0, y, width, height, scale);
+  else
+    res = dt_dev_pixelpipe_process_no_gamma(pipe, dev, 0, y, width, height, scale);
+
+  if(finalscale) finalscale->enabled = 1;
+
+  return res;
+}
+
+// downconversion of the processed buffer to the low-precision formats, in place
+static void _export_convert(uint8_t *const outbuf, const int processed_width, const int processed_height,
+                            const int bpp, const gboolean high_quality_processing,
+                            const gboolean display_byteorder)
+{
+  if(bpp == 8)
+  {
+    if(display_byteorder)
+    {
+      if(high_quality_processing)
+      {
+        const float *const inbuf = (float *)outbuf;
+        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
+        {
+          // convert in place, this is unfortunately very serial..
+          const uint8_t r = CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff);
+          const uint8_t g = CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff);
+          const uint8_t b = CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff);
+          outbuf[4 * k + 0] = r;
+          outbuf[4 * k + 1] = g;
+          outbuf[4 * k + 2] = b;
+        }
+      }
+      // else processing output was 8-bit already, and no need to swap order
+    }
+    else // need to flip
+    {
+      // ldr output: char
+      if(high_quality_processing)
+      {
+        const float *const inbuf = (float *)outbuf;
+        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
+        {
+          // convert in place, this is unfortunately very serial..
+          const uint8_t r = CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff);
+          const uint8_t g = CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff);
+          const uint8_t b = CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff);
+          outbuf[4 * k + 0] = r;
+          outbuf[4 * k + 1] = g;
+          outbuf[4 * k + 2] = b;
+        }
+      }
+      else
+      { // !display_byteorder, need to swap:
+        uint8_t *const buf8 = outbuf;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(processed_width, processed_height, buf8) \
+  schedule(static)
+#endif
+        // just flip byte order
+        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
+        {
+          uint8_t tmp = buf8[4 * k + 0];
+          buf8[4 * k + 0] = buf8[4 * k + 2];
+          buf8[4 * k + 2] = tmp;
+        }
+      }
+    }
+  }
+  else if(bpp == 16)
+  {
+    // uint16_t per color channel
+    float *buff = (float *)outbuf;
+    uint16_t *buf16 = (uint16_t *)outbuf;
+    for(int y = 0; y < processed_height; y++)
+      for(int x = 0; x < processed_width; x++)
+      {
+        // convert in place
+        const size_t k = (size_t)processed_width * y + x;
+        for(int i = 0; i < 3; i++) buf16[4 * k + i] = CLAMP(buff[4 * k + i] * 0x10000, 0, 0xffff);
+      }
+  }
+  // else output float, no further harm done to the pixels :)
+}
+
+// modules whose output for a region only depends on a bounded neighbourhood of it, the one they report as
+// tiling overlap. the ones computing statistics over their whole input (globaltonemap, hazeremoval, cacorrect,
+// defringe, clahe, basecurve's exposure fusion, ...) would come up with a different value for every stripe and
+// leave seams. so would bilat, whose bilateral grid and laplacian pyramid are laid out from the roi.
+static const char *_export_stripe_safe_ops[]
+    = { "rawprepare", "temperature", "highlights", "hotpixels", "demosaic", "denoiseprofile", "nlmeans", "lens",
+        "flip", "clipping", "ashift", "scalepixels", "rotatepixels", "exposure", "colorin", "colorout", "gamma",
+        "finalscale", "dither", "filmic", "filmicrgb", "tonecurve", "rgbcurve", "channelmixer", "colorbalance",
+        "colorcorrection", "colorcontrast", "colorize", "colorzones", "colisa", "velvia", "vibrance", "vignette",
+        "splittoning", "monochrome", "graduatednd", "profile_gamma", "invert", "sharpen", "highpass", "lowpass",
+        "shadhi", "soften", "bloom", "grain", "borders", "watermark", "lut3d", "colorchecker", "relight",
+        "atrous", "lowlight", "overexposed", "rawoverexposed", NULL };
+
+// some of the modules above have modes which do need the whole image: highlight reconstruction in color
+// sweeps along full rows and columns, denoiseprofile's wavelets and variance modes take statistics over all of
+// their input, and the bilateral grid of shadhi and lowpass is laid out from the corner of the roi.
+static gboolean _export_stripe_safe_mode(const dt_iop_module_t *module)
+{
+  const char *field = !strcmp(module->op, "highlights") ? "mode"
+                      : !strcmp(module->op, "denoiseprofile") ? "mode"
+                      : !strcmp(module->op, "shadhi") ? "shadhi_algo"
+                      : !strcmp(module->op, "lowpass") ? "lowpass_algo"
+                      : NULL;
+  if(!field) return TRUE;
+  const int *mode = module->get_p ? (const int *)module->get_p(module->params, field) : NULL;
+  if(!mode) return FALSE;
+
+  if(!strcmp(module->op, "highlights")) return *mode != 2;                     // DT_IOP_HIGHLIGHTS_INPAINT
+  if(!strcmp(module->op, "denoiseprofile")) return *mode == 0 || *mode == 3;   // MODE_NLMEANS(_AUTO)
+  return *mode == 0;                                                           // the gaussian
+}
+
+// streaming runs the pipe once per stripe, which is only the same as one pass if every enabled module is
+// known to cope with that
+static gboolean _export_stripes_safe(const dt_dev_pixelpipe_t *pipe)
+{
+  for(const GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    const dt_dev_pixelpipe_iop_t *piece = (const dt_dev_pixelpipe_iop_t *)nodes->data;
+    if(!piece->enabled) continue;
+
+    gboolean safe = FALSE;
+    for(const char **op = _export_stripe_safe_ops; *op && !safe; op++) safe = !strcmp(piece->module->op, *op);
+    if(!safe || !_export_stripe_safe_mode(piece->module))
+    {
+      dt_print(DT_DEBUG_DEV, "[export] not streaming, module `%s' needs the whole image\n", piece->module->op);
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+int dt_imageio_export_stripe_margin(struct dt_dev_pixelpipe_t *pipe, const int width, const int height,
+                                    const double scale)
+{
+  // the overlaps are in pixels of the module's roi, which scale with the roi. asking at the scale of the export
+  // gives them in output pixels.
+  const dt_iop_roi_t roi = { .x = 0, .y = 0, .width = width, .height = height, .scale = scale };
+  int margin = DT_IMAGEIO_STRIPE_EXTRA_MARGIN;
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    if(!piece->enabled) continue;
+    dt_develop_tiling_t tiling = { 0 };
+    piece->module->tiling_callback(piece->module, piece, &roi, &roi, &tiling);
+    margin += MAX(tiling.overlap, 0);
+  }
+  return margin;
+}
+
+// number of rows to process at once when streaming the export into the format, without the margin of context
+// rows above and below. returns height if the image should be processed in one go.
+static int _export_stripe_height(dt_imageio_module_format_t *format, const dt_dev_pixelpipe_t *pipe,
+                                 const gboolean thumbnail_export, const int width, const int height,
+                                 const int margin)
+{
+  if(thumbnail_export || !format->write_image_begin || !dt_conf_get_bool("export_streaming")) return height;
+
+  const size_t limit = (size_t)MAX(dt_conf_get_int("host_memory_limit"), 0) * 1024 * 1024;
+  if(limit == 0) return height;
+
+  // the processed stripe is kept as 4 floats per pixel, along with all intermediate buffers of its size.
+  // only stream if the full frame would take more than half of host_memory_limit.
+  const size_t budget = limit / 2;
+  const size_t rowsize = (size_t)width * 4 * sizeof(float);
+  if(rowsize * height <= budget || !_export_stripes_safe(pipe)) return height;
+
+  // stripes with most of their rows spent on context are not worth it
+  const int stripe = MAX(16, (int)(budget / rowsize - 2 * margin) & ~15);
+  return stripe < 2 * margin || stripe >= height ? height : stripe;
+}
+
+// thumbnails of raws that only get a half size (bayer) or third size (x-trans) demosaic don't need the full
+// mosaic. returns the mosaic downscaled by 2, 4 or 8 so that this still holds, with its pattern kept, or NULL if
+// the full mosaic has to be processed. the pipe gets the factor as its iscale, so the modules see the same scale
+// as on the full mosaic, like the preview pipe working on the mip_f.
+static void *_thumbnail_mosaic(const int32_t imgid, const dt_image_t *img, const dt_mipmap_buffer_t *buf,
+                               const int max_width, const int max_height, int *width, int *height, float *iscale)
+{
+  if(!img->buf_dsc.filters || (img->flags & DT_IMAGE_4BAYER) || max_width <= 0 || max_height <= 0) return NULL;
+  if(dt_mipmap_cache_thumbnail_hq(darktable.mipmap_cache, max_width, max_height)) return NULL;
+
+  int final_width = 0, final_height = 0;
+  dt_image_get_final_size(imgid, &final_width, &final_height);
+  if(final_width <= 0 || final_height <= 0) return NULL;
+
+  // scale of the thumbnail on the full mosaic, and up to which demosaic downscales the mosaic itself
+  const float scale = fminf(max_width / (float)final_width, max_height / (float)final_height);
+  const float half_size = img->buf_dsc.filters == 9u ? 0.333f : 0.5f;
+  int factor = 8;
+  while(factor > 1 && scale * factor > half_size) factor /= 2;
+  if(factor == 1) return NULL;
+
+  dt_iop_roi_t roi_in = { .x = 0, .y = 0, .width = buf->width, .height = buf->height, .scale = 1.0f };
+  dt_iop_roi_t roi_out = { .x = 0, .y = 0, .width = buf->width / factor, .height = buf->height / factor,
+                           .scale = 1.0f / factor };
+  void *mosaic = dt_alloc_align(64, (size_t)roi_out.width * roi_out.height * dt_iop_buffer_dsc_to_bpp(&img->buf_dsc));
+  if(!mosaic) return NULL;
+
+  dt_iop_clip_and_zoom_mosaic(mosaic, buf->buf, &roi_out, &roi_in, roi_out.width, roi_in.width, &img->buf_dsc);
+
+  dt_print(DT_DEBUG_DEV, "[export] thumbnail of %d x %d from the mosaic downscaled by %d\n", max_width, max_height,
+           factor);
+  *width = roi_out.width;
+  *height = roi_out.height;
+  *iscale = buf->iscale * buf->width / (float)roi_out.width;
+  return mosaic;
+}
+
 int dt_imageio_export(const uint32_t imgid, const char *filename, dt_imageio_module_format_t *format,
                       dt_imageio_module_data_t *format_params, const gboolean high_quality, const gboolean upscale,
                       const gboolean copy_metadata, dt_colorspaces_color_profile_type_t icc_type,
@@ -658,6 +912,12 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
   const int wd = img->width;
   const int ht = img->height;
 
+  int input_width = buf.width, input_height = buf.height;
+  float input_iscale = buf.iscale;
+  void *mosaic = NULL;
+  if(thumbnail_export && !buf_is_downscaled)
+    mosaic = _thumbnail_mosaic(imgid, img, &buf, format_params->max_width, format_params->max_height, &input_width,
+                               &input_height, &input_iscale);
 
   int res = 0;
 
@@ -706,7 +966,8 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
   dt_ioppr_resync_modules_order(&dev);
 
   dt_dev_pixelpipe_set_icc(&pipe, icc_type, icc_filename, icc_intent);
-  dt_dev_pixelpipe_set_input(&pipe, &dev, (float *)buf.buf, buf.width, buf.height, buf.iscale);
+  dt_dev_pixelpipe_set_input(&pipe, &dev, mosaic ? (float *)mosaic : (float *)buf.buf, input_width, input_height,
+                             input_iscale);
   dt_dev_pixelpipe_create_nodes(&pipe, &dev);
   dt_dev_pixelpipe_synch_all(&pipe, &dev);
 
@@ -785,151 +1046,74 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
 
   const int bpp = format->bpp(format_params);
 
-  dt_get_times(&start);
-  if(high_quality_processing)
-  {
-    /*
-     * if high quality processing was requested, downsampling will be done
-     * at the very end of the pipe (just before border and watermark)
-     */
-    dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
-  }
-  else
-  {
-    // else, downsampling will be right after demosaic
-
-    // so we need to turn temporarily disable in-pipe late downsampling iop.
-
-    // find the finalscale module
-    dt_dev_pixelpipe_iop_t *finalscale = NULL;
-    {
-      GList *nodes = g_list_last(pipe.nodes);
-      while(nodes)
-      {
-        dt_dev_pixelpipe_iop_t *node = (dt_dev_pixelpipe_iop_t *)(nodes->data);
-        if(!strcmp(node->module->op, "finalscale"))
-        {
-          finalscale = node;
-          break;
-        }
-        nodes = g_list_previous(nodes);
-      }
-    }
-
-    if(finalscale) finalscale->enabled = 0;
-
-    // do the processing (8-bit with special treatment, to make sure we can use openmp further down):
-    if(bpp == 8)
-      dt_dev_pixelpipe_process(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
-    else
-      dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
-
-    if(finalscale) finalscale->enabled = 1;
-  }
-  dt_show_times(&start, thumbnail_export ? "[dev_process_thumbnail] pixel pipeline processing"
-                                         : "[dev_process_export] pixel pipeline processing");
-
-  uint8_t *outbuf = pipe.backbuf;
-
-  // downconversion to low-precision formats:
-  if(bpp == 8)
-  {
-    if(display_byteorder)
-    {
-      if(high_quality_processing)
-      {
-        const float *const inbuf = (float *)outbuf;
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          // convert in place, this is unfortunately very serial..
-          const uint8_t r = CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff);
-          const uint8_t g = CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff);
-          const uint8_t b = CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff);
-          outbuf[4 * k + 0] = r;
-          outbuf[4 * k + 1] = g;
-          outbuf[4 * k + 2] = b;
-        }
-      }
-      // else processing output was 8-bit already, and no need to swap order
-    }
-    else // need to flip
-    {
-      // ldr output: char
-      if(high_quality_processing)
-      {
-        const float *const inbuf = (float *)outbuf;
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          // convert in place, this is unfortunately very serial..
-          const uint8_t r = CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff);
-          const uint8_t g = CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff);
-          const uint8_t b = CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff);
-          outbuf[4 * k + 0] = r;
-          outbuf[4 * k + 1] = g;
-          outbuf[4 * k + 2] = b;
-        }
-      }
-      else
-      { // !display_byteorder, need to swap:
-        uint8_t *const buf8 = pipe.backbuf;
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-  dt_omp_firstprivate(processed_width, processed_height, buf8) \
-  schedule(static)
-#endif
-        // just flip byte order
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          uint8_t tmp = buf8[4 * k + 0];
-          buf8[4 * k + 0] = buf8[4 * k + 2];
-          buf8[4 * k + 2] = tmp;
-        }
-      }
-    }
-  }
-  else if(bpp == 16)
-  {
-    // uint16_t per color channel
-    float *buff = (float *)outbuf;
-    uint16_t *buf16 = (uint16_t *)outbuf;
-    for(int y = 0; y < processed_height; y++)
-      for(int x = 0; x < processed_width; x++)
-      {
-        // convert in place
-        const size_t k = (size_t)processed_width * y + x;
-        for(int i = 0; i < 3; i++) buf16[4 * k + i] = CLAMP(buff[4 * k + i] * 0x10000, 0, 0xffff);
-      }
-  }
-  // else output float, no further harm done to the pixels :)
-
   format_params->width = processed_width;
   format_params->height = processed_height;
 
+  int length = 0;
+  uint8_t *exif_profile = NULL; // Exif data should be 65536 bytes max, but if original size is close to that,
+                                // adding new tags could make it go over that... so let it be and see what
+                                // happens when we write the image
   if(!ignore_exif)
   {
-    int length;
-    uint8_t *exif_profile = NULL; // Exif data should be 65536 bytes max, but if original size is close to that,
-                                  // adding new tags could make it go over that... so let it be and see what
-                                  // happens when we write the image
     char pathname[PATH_MAX] = { 0 };
     gboolean from_cache = TRUE;
     dt_image_full_path(imgid, pathname, sizeof(pathname), &from_cache);
     // last param is dng mode, it's false here
     length = dt_exif_read_blob(&exif_profile, pathname, imgid, sRGB, processed_width, processed_height, 0);
+  }
+
+  const int margin = dt_imageio_export_stripe_margin(&pipe, processed_width, processed_height, scale);
+  const int stripe
+      = _export_stripe_height(format, &pipe, thumbnail_export, processed_width, processed_height, margin);
 
-    res = format->write_image(format_params, filename, outbuf, icc_type, icc_filename, exif_profile, length, imgid,
-                              num, total, &pipe);
+  dt_get_times(&start);
+  if(stripe < processed_height)
+  {
+    // stream the image: process it in horizontal stripes and hand every stripe to the format right away,
+    // so neither the full frame nor its converted copy has to be kept in memory.
+    dt_print(DT_DEBUG_DEV, "[export] streaming %d x %d image to format in stripes of %d rows, %d rows of margin\n",
+             processed_width, processed_height, stripe, margin);
+
+    void *handle = format->write_image_begin(format_params, filename, icc_type, icc_filename, exif_profile,
+                                             length, imgid, num, total, &pipe);
+    res = handle ? 0 : 1;
+    for(int y = 0; !res && y < processed_height; y += stripe)
+    {
+      // every stripe is processed with rows of context around it, so that the modules working on a
+      // neighbourhood see the same pixels as in one pass. only the stripe itself goes to the format.
+      const int rows = MIN(stripe, processed_height - y);
+      const int top = MIN(margin, y);
+      const int bottom = MIN(margin, processed_height - y - rows);
+      res = _export_process(&pipe, &dev, high_quality_processing, bpp, y - top, processed_width,
+                            top + rows + bottom, scale);
+      if(res) break;
+      const size_t pixel = (bpp == 8 && !high_quality_processing) ? 4 : 4 * sizeof(float);
+      uint8_t *const outbuf = (uint8_t *)pipe.backbuf + (size_t)top * processed_width * pixel;
+      _export_convert(outbuf, processed_width, rows, bpp, high_quality_processing, display_byteorder);
+      res = format->write_image_rows(format_params, handle, outbuf, rows);
+    }
+    if(handle) res = format->write_image_end(format_params, handle, res) || res;
 
-    free(exif_profile);
+    dt_show_times(&start, "[dev_process_export] pixel pipeline processing and writing");
   }
   else
   {
-    res = format->write_image(format_params, filename, outbuf, icc_type, icc_filename, NULL, 0, imgid, num, total,
-                              &pipe);
+    _export_process(&pipe, &dev, high_quality_processing, bpp, 0, processed_width, processed_height, scale);
+    dt_show_times(&start, thumbnail_export ? "[dev_process_thumbnail] pixel pipeline processing"
+                                           : "[dev_process_export] pixel pipeline processing");
+
+    uint8_t *outbuf = pipe.backbuf;
+    _export_convert(outbuf, processed_width, processed_height, bpp, high_quality_processing, display_byteorder);
+
+    res = format->write_image(format_params, filename, outbuf, icc_type, icc_filename, exif_profile, length,
+                              imgid, num, total, &pipe);
   }
 
+  free(exif_profile);
+
   dt_dev_pixelpipe_cleanup(&pipe);
   dt_dev_cleanup(&dev);
+  dt_free_align(mosaic);
   dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
 
   /* now write xmp into that container, if possible */
@@ -972,6 +1156,7 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
 
 error:
   dt_dev_pixelpipe_cleanup(&pipe);
+  dt_free_align(mosaic);
 error_early:
   dt_dev_cleanup(&dev);
   dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
@@ -80,6 +80,16 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
                                  dt_iop_color_intent_t icc_intent, dt_imageio_module_storage_t *storage,
                                  dt_imageio_module_data_t *storage_params, int num, int total, dt_export_metadata_t *metadata);
 
+// rows on top of the tiling overlaps, for demosaic and the resampling which read a bit further than they report
+#define DT_IMAGEIO_STRIPE_EXTRA_MARGIN 16
+
+struct dt_dev_pixelpipe_t;
+/** rows of context a streamed export processes above and below every stripe of the width x height output at
+ *  scale, so that the modules working on a neighbourhood come up with the same pixels as in one pass: the
+ *  tiling overlaps of all enabled modules of the committed pipe. */
+int dt_imageio_export_stripe_margin(struct dt_dev_pixelpipe_t *pipe, const int width, const int height,
+                                    const double scale);
+
 size_t dt_imageio_write_pos(int i, int j, int wd, int ht, float fwd, float fht,
                             dt_image_orientation_t orientation);
 
@@ -110,6 +110,14 @@ static int dt_imageio_load_module_format(dt_imageio_module_format_t *module, con
   if(!g_module_symbol(module->module, "free_params", (gpointer) & (module->free_params))) goto error;
   if(!g_module_symbol(module->module, "set_params", (gpointer) & (module->set_params))) goto error;
   if(!g_module_symbol(module->module, "write_image", (gpointer) & (module->write_image))) goto error;
+  if(!g_module_symbol(module->module, "write_image_begin", (gpointer) & (module->write_image_begin))
+     || !g_module_symbol(module->module, "write_image_rows", (gpointer) & (module->write_image_rows))
+     || !g_module_symbol(module->module, "write_image_end", (gpointer) & (module->write_image_end)))
+  {
+    module->write_image_begin = NULL;
+    module->write_image_rows = NULL;
+    module->write_image_end = NULL;
+  }
   if(!g_module_symbol(module->module, "bpp", (gpointer) & (module->bpp))) goto error;
   if(!g_module_symbol(module->module, "flags", (gpointer) & (module->flags)))
     module->flags = _default_format_flags;
@@ -245,6 +253,8 @@ static int dt_imageio_load_module_storage(dt_imageio_module_storage_t *module, c
     module->initialize_store = NULL;
   if(!g_module_symbol(module->module, "finalize_store", (gpointer) & (module->finalize_store)))
     module->finalize_store = NULL;
+  if(!g_module_symbol(module->module, "parallel_store", (gpointer) & (module->parallel_store)))
+    module->parallel_store = NULL;
   if(!g_module_symbol(module->module, "set_params", (gpointer) & (module->set_params))) goto error;
 
   if(!g_module_symbol(module->module, "supported", (gpointer) & (module->supported)))
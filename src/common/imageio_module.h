@@ -120,6 +120,16 @@ typedef struct dt_imageio_module_format_t
   int (*write_image)(dt_imageio_module_data_t *data, const char *filename, const void *in,
                      dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
                      void *exif, int exif_len, int imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe);
+  /* optional row based writing, lets the export stream the image while it is being processed.
+     begin returns a handle (NULL on failure), exif has to stay valid until write_image_end(). */
+  void *(*write_image_begin)(dt_imageio_module_data_t *data, const char *filename,
+                             dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                             void *exif, int exif_len, int imgid, int num, int total,
+                             struct dt_dev_pixelpipe_t *pipe);
+  /* write the next rows, top to bottom, in the same layout as the buffer passed to write_image(). */
+  int (*write_image_rows)(dt_imageio_module_data_t *data, void *handle, const void *in, int rows);
+  /* finish the file and free the handle. abort != 0 if not all rows could be delivered. return != 0 on fail. */
+  int (*write_image_end)(dt_imageio_module_data_t *data, void *handle, int abort);
   /* flag that describes the available precision/levels of output format. mainly used for dithering. */
   int (*levels)(dt_imageio_module_data_t *data);
 
@@ -181,6 +191,8 @@ typedef struct dt_imageio_module_storage_t
                dt_iop_color_intent_t icc_intent, dt_export_metadata_t *metadata_flags);
   /* called once at the end (after exporting all images), if implemented. */
   void (*finalize_store)(struct dt_imageio_module_storage_t *self, dt_imageio_module_data_t *data);
+  /* return non-zero if store() may be called from several threads at once, if implemented. */
+  int (*parallel_store)(struct dt_imageio_module_storage_t *self);
 
   void *(*legacy_params)(struct dt_imageio_module_storage_t *self, const void *const old_params,
                          const size_t old_params_size, const int old_version, const int new_version,
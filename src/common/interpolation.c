@@ -23,6 +23,7 @@
 #include <assert.h>
 #include <glib.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <math.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -1266,11 +1267,13 @@ const struct dt_interpolation *dt_interpolation_new(enum dt_interpolation_type t
  * arrays of information
  * @param pmeta [out] Array of int triplets (length, kernel, index) telling where to start for an arbitrary
  * out position meta[3*out]
+ * @param plain [in] compute the taps with the plain kernel functions whatever the codepath, for plans that get
+ * shared by all codepaths
  * @return 0 for success, !0 for failure
  */
 static int prepare_resampling_plan(const struct dt_interpolation *itor, int in, const int in_x0, int out,
                                    const int out_x0, float scale, int **plength, float **pkernel,
-                                   int **pindex, int **pmeta)
+                                   int **pindex, int **pmeta, const gboolean plain)
 {
   // Safe return values
   *plength = NULL;
@@ -1356,7 +1359,10 @@ static int prepare_resampling_plan(const struct dt_interpolation *itor, int in,
 
       // Compute the filter kernel at that position
       int first;
-      compute_upsampling_kernel(itor, scratchpad, NULL, &first, fx);
+      if(plain)
+        compute_upsampling_kernel_plain(itor, scratchpad, NULL, &first, fx);
+      else
+        compute_upsampling_kernel(itor, scratchpad, NULL, &first, fx);
 
       /* Check lower and higher bound pixel index and skip as many pixels as
        * necessary to fall into range */
@@ -1405,7 +1411,10 @@ static int prepare_resampling_plan(const struct dt_interpolation *itor, int in,
       // Compute downsampling kernel centered on output position
       int taps;
       int first;
-      compute_downsampling_kernel(itor, &taps, &first, scratchpad, NULL, scale, out_x0 + x);
+      if(plain)
+        compute_downsampling_kernel_plain(itor, &taps, &first, scratchpad, NULL, scale, out_x0 + x);
+      else
+        compute_downsampling_kernel(itor, &taps, &first, scratchpad, NULL, scale, out_x0 + x);
 
       /* Check lower and higher bound pixel index and skip as many pixels as
        * necessary to fall into range */
@@ -1449,182 +1458,279 @@ static int prepare_resampling_plan(const struct dt_interpolation *itor, int in,
   return 0;
 }
 
-static void dt_interpolation_resample_plain(const struct dt_interpolation *itor, float *out,
-                                            const dt_iop_roi_t *const roi_out, const int32_t out_stride,
-                                            const float *const in, const dt_iop_roi_t *const roi_in,
-                                            const int32_t in_stride)
-{
-  int *hindex = NULL;
-  int *hlength = NULL;
-  float *hkernel = NULL;
-  int *vindex = NULL;
-  int *vlength = NULL;
-  float *vkernel = NULL;
-  int *vmeta = NULL;
+/* The resampling is separable: every thread takes a tile of output rows and columns, filters the input rows the
+ * tile needs horizontally into a buffer of its own, and filters that buffer vertically into the output. Compared
+ * to filtering the full footprint of every output pixel, that saves a factor of about the number of vertical
+ * taps, which gets large when downscaling a lot, e.g. for exports. Tiles have few enough columns for the buffer to
+ * stay in cache, and enough rows for the input rows shared with the neighbouring tiles to be a small overhead.
+ * The weights of both directions only depend on the interpolator and the geometry, which the pipes request over
+ * and over, so the last plans are kept, see resampling_plan_get(). */
 
-  int r;
+// output columns and rows of a tile, and the bytes its buffer should not exceed
+#define RESAMPLING_TILE_WIDTH 128
+#define RESAMPLING_TILE_HEIGHT 32
+#define RESAMPLING_TILE_BUFFER (512 * 1024)
 
-  debug_info("resampling %p (%dx%d@%dx%d scale %f) -> %p (%dx%d@%dx%d scale %f)\n", in, roi_in->width,
-             roi_in->height, roi_in->x, roi_in->y, roi_in->scale, out, roi_out->width, roi_out->height,
-             roi_out->x, roi_out->y, roi_out->scale);
+// plans kept for reuse, and the bytes they may take together
+#define RESAMPLING_PLAN_CACHE 16
+#define RESAMPLING_PLAN_CACHE_BYTES (64 * 1024 * 1024)
 
-  // Fast code path for 1:1 copy, only cropping area can change
-  if(roi_out->scale == 1.f)
+typedef struct resampling_plan_t
+{
+  // what the plan was computed for
+  enum dt_interpolation_type id;
+  int in, in_x0, out, out_x0;
+  float scale;
+  // see prepare_resampling_plan(), length is the allocation
+  int *length, *index, *meta;
+  float *kernel;
+  size_t size;
+  int users;     // resamplings using the plan right now, it is only freed when there are none
+  uint64_t used; // last use, the least recently used plan gets evicted
+  gboolean cached;
+} resampling_plan_t;
+
+static GMutex plan_cache_lock;
+static resampling_plan_t plan_cache[RESAMPLING_PLAN_CACHE];
+static size_t plan_cache_size = 0;
+static uint64_t plan_cache_clock = 0;
+
+/* Returns the plan for resampling in samples from in_x0 to out samples from out_x0 at scale, from the cache if
+ * possible, to be given back with resampling_plan_release(). The taps are always computed with the plain kernels:
+ * the plans are shared by all codepaths and their output must not depend on which one computed the plan first.
+ * @return NULL if out of memory */
+static resampling_plan_t *resampling_plan_get(const struct dt_interpolation *itor, const int in, const int in_x0,
+                                              const int out, const int out_x0, const float scale)
+{
+  g_mutex_lock(&plan_cache_lock);
+  for(int k = 0; k < RESAMPLING_PLAN_CACHE; k++)
   {
-    const int x0 = roi_out->x * 4 * sizeof(float);
-#if DEBUG_RESAMPLING_TIMING
-    int64_t ts_resampling = getts();
-#endif
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-    dt_omp_firstprivate(in, in_stride, out_stride, roi_out, x0) \
-    shared(out)
-#endif
-    for(int y = 0; y < roi_out->height; y++)
+    resampling_plan_t *p = plan_cache + k;
+    if(p->length && p->id == itor->id && p->in == in && p->in_x0 == in_x0 && p->out == out
+       && p->out_x0 == out_x0 && p->scale == scale)
     {
-      memcpy((char *)out + (size_t)out_stride * y,
-             (char *)in + (size_t)in_stride * (y + roi_out->y) + x0,
-             out_stride);
+      p->users++;
+      p->used = ++plan_cache_clock;
+      g_mutex_unlock(&plan_cache_lock);
+      return p;
     }
-#if DEBUG_RESAMPLING_TIMING
-    ts_resampling = getts() - ts_resampling;
-    fprintf(stderr, "resampling %p plan:0us resampling:%" PRId64 "us\n", in, ts_resampling);
-#endif
-    // All done, so easy case
-    return;
+  }
+  g_mutex_unlock(&plan_cache_lock);
+
+  // not there, compute it without holding up the others. two threads might both do it, no harm done
+  resampling_plan_t plan = { .id = itor->id, .in = in, .in_x0 = in_x0, .out = out, .out_x0 = out_x0,
+                             .scale = scale, .users = 1 };
+  if(prepare_resampling_plan(itor, in, in_x0, out, out_x0, scale, &plan.length, &plan.kernel, &plan.index,
+                             &plan.meta, TRUE))
+    return NULL;
+  // the meta triplets come last in the allocation
+  plan.size = (char *)(plan.meta + 3 * out) - (char *)plan.length;
+
+  g_mutex_lock(&plan_cache_lock);
+  // make room by evicting the least recently used plans nobody is using
+  resampling_plan_t *slot = NULL;
+  while(plan.size <= RESAMPLING_PLAN_CACHE_BYTES)
+  {
+    resampling_plan_t *victim = NULL;
+    slot = NULL;
+    for(int k = 0; k < RESAMPLING_PLAN_CACHE; k++)
+    {
+      resampling_plan_t *p = plan_cache + k;
+      if(!p->length)
+        slot = p;
+      else if(!p->users && (!victim || p->used < victim->used))
+        victim = p;
+    }
+    if(slot && plan_cache_size + plan.size <= RESAMPLING_PLAN_CACHE_BYTES) break;
+    slot = NULL;
+    if(!victim) break;
+    plan_cache_size -= victim->size;
+    dt_free_align(victim->length);
+    memset(victim, 0, sizeof(resampling_plan_t));
   }
 
-// Generic non 1:1 case... much more complicated :D
-#if DEBUG_RESAMPLING_TIMING
-  int64_t ts_plan = getts();
-#endif
-
-  // Prepare resampling plans once and for all
-  r = prepare_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale,
-                              &hlength, &hkernel, &hindex, NULL);
-  if(r)
+  if(slot)
   {
-    goto exit;
+    plan.cached = TRUE;
+    plan.used = ++plan_cache_clock;
+    *slot = plan;
+    plan_cache_size += plan.size;
+    g_mutex_unlock(&plan_cache_lock);
+    return slot;
   }
+  g_mutex_unlock(&plan_cache_lock);
 
-  r = prepare_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale,
-                              &vlength, &vkernel, &vindex, &vmeta);
-  if(r)
+  // too large, or all plans in use: this one is private and gets freed on release
+  resampling_plan_t *p = malloc(sizeof(resampling_plan_t));
+  if(!p)
   {
-    goto exit;
+    dt_free_align(plan.length);
+    return NULL;
   }
+  *p = plan;
+  return p;
+}
 
-#if DEBUG_RESAMPLING_TIMING
-  ts_plan = getts() - ts_plan;
-#endif
-
-#if DEBUG_RESAMPLING_TIMING
-  int64_t ts_resampling = getts();
-#endif
-
-// Process each output line
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-  dt_omp_firstprivate(in, in_stride, out_stride, roi_out) \
-  shared(out, hindex, hlength, hkernel, vindex, vlength, vkernel, vmeta)
-#endif
-  for(int oy = 0; oy < roi_out->height; oy++)
+static void resampling_plan_release(resampling_plan_t *p)
+{
+  if(!p) return;
+  if(!p->cached)
   {
-    // Initialize column resampling indexes
-    int vlidx = vmeta[3 * oy + 0]; // V(ertical) L(ength) I(n)d(e)x
-    int vkidx = vmeta[3 * oy + 1]; // V(ertical) K(ernel) I(n)d(e)x
-    int viidx = vmeta[3 * oy + 2]; // V(ertical) I(ndex) I(n)d(e)x
-
-    // Initialize row resampling indexes
-    int hlidx = 0; // H(orizontal) L(ength) I(n)d(e)x
-    int hkidx = 0; // H(orizontal) K(ernel) I(n)d(e)x
-    int hiidx = 0; // H(orizontal) I(ndex) I(n)d(e)x
-
-    // Number of lines contributing to the output line
-    int vl = vlength[vlidx++]; // V(ertical) L(ength)
+    dt_free_align(p->length);
+    free(p);
+    return;
+  }
+  g_mutex_lock(&plan_cache_lock);
+  p->users--;
+  g_mutex_unlock(&plan_cache_lock);
+}
 
-    // Process each output column
-    for(int ox = 0; ox < roi_out->width; ox++)
+/* horizontal pass: filters one input row into count output pixels, lengths, kernel and index point to the plan of
+ * the first of them. */
+typedef void(resample_hpass_t)(const float *const i, float *o, const int *lengths, const float *kernel,
+                               const int *index, const int count);
+/* vertical pass: o = sum of kernel[k] * row index[k] over length rows of count floats each. rows holds the rows
+ * from first on, stride floats apart. */
+typedef void(resample_vpass_t)(const float *const rows, const size_t stride, const int first, float *const o,
+                               const int length, const float *kernel, const int *index, const int count);
+
+static void resample_hpass_plain(const float *const i, float *o, const int *lengths, const float *kernel,
+                                 const int *index, const int count)
+{
+  for(int ox = 0; ox < count; ox++, o += 4)
+  {
+    float vhs[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    const int hl = *lengths++;
+    for(int ix = 0; ix < hl; ix++)
     {
-      debug_extra("output %p [% 4d % 4d]\n", out, ox, oy);
-
-      // This will hold the resulting pixel
-      float vs[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
-
-      // Number of horizontal samples contributing to the output
-      int hl = hlength[hlidx++]; // H(orizontal) L(ength)
-
-      for(int iy = 0; iy < vl; iy++)
-      {
-        // This is our input line
-        const float *i = (float *)((char *)in + (size_t)in_stride * vindex[viidx++]);
-
-        float vhs[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
-
-        for(int ix = 0; ix < hl; ix++)
-        {
-          // Apply the precomputed filter kernel
-          size_t baseidx = (size_t)hindex[hiidx++] * 4;
-          const float htap = hkernel[hkidx++];
-          for(int c = 0; c < 3; c++) vhs[c] += i[baseidx + c] * htap;
-        }
-
-        // Accumulate contribution from this line
-        const float vtap = vkernel[vkidx++];
-        for(int c = 0; c < 3; c++) vs[c] += vhs[c] * vtap;
-
-        // Reset horizontal resampling context
-        hkidx -= hl;
-        hiidx -= hl;
-      }
-
-      // Output pixel is ready
-      float *o = (float *)((char *)out + (size_t)oy * out_stride + (size_t)ox * 4 * sizeof(float));
-      for(int c = 0; c < 3; c++) o[c] = vs[c];
+      // Apply the precomputed filter kernel
+      const size_t baseidx = (size_t)*index++ * 4;
+      const float htap = *kernel++;
+      for(int c = 0; c < 4; c++) vhs[c] += i[baseidx + c] * htap;
+    }
+    for(int c = 0; c < 4; c++) o[c] = vhs[c];
+  }
+}
 
-      // Reset vertical resampling context
-      viidx -= vl;
-      vkidx -= vl;
+static void resample_vpass_plain(const float *const rows, const size_t stride, const int first,
+                                 float *const o, const int length, const float *kernel, const int *index,
+                                 const int count)
+{
+  const float *r = rows + stride * (index[0] - first);
+  for(int k = 0; k < count; k++) o[k] = r[k] * kernel[0];
+  for(int iy = 1; iy < length; iy++)
+  {
+    r = rows + stride * (index[iy] - first);
+    const float vtap = kernel[iy];
+    for(int k = 0; k < count; k++) o[k] += r[k] * vtap;
+  }
+}
 
-      // Progress in horizontal context
-      hiidx += hl;
-      hkidx += hl;
+#if defined(__SSE2__)
+static void resample_hpass_sse(const float *const i, float *o, const int *lengths, const float *kernel,
+                               const int *index, const int count)
+{
+  for(int ox = 0; ox < count; ox++, o += 4)
+  {
+    __m128 vhs = _mm_setzero_ps();
+    const int hl = *lengths++;
+    for(int ix = 0; ix < hl; ix++)
+    {
+      // Apply the precomputed filter kernel
+      const size_t baseidx = (size_t)*index++ * 4;
+      const __m128 vhtap = _mm_set_ps1(*kernel++);
+      vhs = _mm_add_ps(vhs, _mm_mul_ps(_mm_loadu_ps(&i[baseidx]), vhtap));
     }
+    _mm_store_ps(o, vhs);
   }
+}
 
-#if DEBUG_RESAMPLING_TIMING
-  ts_resampling = getts() - ts_resampling;
-  fprintf(stderr, "resampling %p plan:%" PRId64 "us resampling:%" PRId64 "us\n", in, ts_plan, ts_resampling);
+// count is a multiple of 4, the rows are 16 byte aligned
+static void resample_vpass_sse(const float *const rows, const size_t stride, const int first,
+                               float *const o, const int length, const float *kernel, const int *index,
+                               const int count)
+{
+  const float *r = rows + stride * (index[0] - first);
+  const __m128 vtap0 = _mm_set_ps1(kernel[0]);
+  for(int k = 0; k < count; k += 4) _mm_storeu_ps(o + k, _mm_mul_ps(_mm_load_ps(r + k), vtap0));
+  for(int iy = 1; iy < length; iy++)
+  {
+    r = rows + stride * (index[iy] - first);
+    const __m128 vtap = _mm_set_ps1(kernel[iy]);
+    for(int k = 0; k < count; k += 4)
+      _mm_storeu_ps(o + k, _mm_add_ps(_mm_loadu_ps(o + k), _mm_mul_ps(_mm_load_ps(r + k), vtap)));
+  }
+}
 #endif
 
-exit:
-  /* Free the resampling plans. It's nasty to optimize allocs like that, but
-   * it simplifies the code :-D. The length array is in fact the only memory
-   * allocated. */
-  dt_free_align(hlength);
-  dt_free_align(vlength);
+#if defined(DT_HAVE_AVX_CODEPATHS)
+/* two taps per vector, one in each lane. they are summed up at the end, so results differ from the sse2 ones by
+ * rounding only. */
+__DT_TARGET_AVX2__
+static void resample_hpass_avx2(const float *const i, float *o, const int *lengths, const float *kernel,
+                                const int *index, const int count)
+{
+  for(int ox = 0; ox < count; ox++, o += 4)
+  {
+    __m256 vhs = _mm256_setzero_ps();
+    const int hl = *lengths++;
+    int ix = 0;
+    for(; ix + 1 < hl; ix += 2, index += 2, kernel += 2)
+    {
+      const __m256 px = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&i[(size_t)index[0] * 4])),
+                                             _mm_loadu_ps(&i[(size_t)index[1] * 4]), 1);
+      const __m256 vhtap = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(kernel[0])),
+                                                _mm_set1_ps(kernel[1]), 1);
+      vhs = _mm256_fmadd_ps(px, vhtap, vhs);
+    }
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(vhs), _mm256_extractf128_ps(vhs, 1));
+    if(ix < hl) sum = _mm_fmadd_ps(_mm_loadu_ps(&i[(size_t)*index++ * 4]), _mm_set1_ps(*kernel++), sum);
+    _mm_store_ps(o, sum);
+  }
 }
 
-#if defined(__SSE2__)
-static void dt_interpolation_resample_sse(const struct dt_interpolation *itor, float *out,
-                                          const dt_iop_roi_t *const roi_out, const int32_t out_stride,
-                                          const float *const in, const dt_iop_roi_t *const roi_in,
-                                          const int32_t in_stride)
+// count is a multiple of 4, two pixels per vector and one more with sse if it is odd
+__DT_TARGET_AVX2__
+static void resample_vpass_avx2(const float *const rows, const size_t stride, const int first,
+                                float *const o, const int length, const float *kernel, const int *index,
+                                const int count)
 {
-  int *hindex = NULL;
-  int *hlength = NULL;
-  float *hkernel = NULL;
-  int *vindex = NULL;
-  int *vlength = NULL;
-  float *vkernel = NULL;
-  int *vmeta = NULL;
+  const int count8 = count & ~7;
+  const float *r = rows + stride * (index[0] - first);
+  const __m256 vtap0 = _mm256_set1_ps(kernel[0]);
+  for(int k = 0; k < count8; k += 8) _mm256_storeu_ps(o + k, _mm256_mul_ps(_mm256_loadu_ps(r + k), vtap0));
+  if(count8 < count) _mm_storeu_ps(o + count8, _mm_mul_ps(_mm_load_ps(r + count8), _mm_set1_ps(kernel[0])));
+  for(int iy = 1; iy < length; iy++)
+  {
+    r = rows + stride * (index[iy] - first);
+    const __m256 vtap = _mm256_set1_ps(kernel[iy]);
+    for(int k = 0; k < count8; k += 8)
+      _mm256_storeu_ps(o + k, _mm256_fmadd_ps(_mm256_loadu_ps(r + k), vtap, _mm256_loadu_ps(o + k)));
+    if(count8 < count)
+      _mm_storeu_ps(o + count8,
+                    _mm_fmadd_ps(_mm_load_ps(r + count8), _mm_set1_ps(kernel[iy]), _mm_loadu_ps(o + count8)));
+  }
+}
+#endif
 
-  int r;
+static void dt_interpolation_resample_tiled(const struct dt_interpolation *itor, float *out,
+                                            const dt_iop_roi_t *const roi_out, const int32_t out_stride,
+                                            const float *const in, const dt_iop_roi_t *const roi_in,
+                                            const int32_t in_stride, resample_hpass_t *const hpass,
+                                            resample_vpass_t *const vpass)
+{
+  resampling_plan_t *hplan = NULL;
+  resampling_plan_t *vplan = NULL;
+  int *tile_rows = NULL;
+  float *buffers = NULL;
 
   debug_info("resampling %p (%dx%d@%dx%d scale %f) -> %p (%dx%d@%dx%d scale %f)\n", in, roi_in->width,
              roi_in->height, roi_in->x, roi_in->y, roi_in->scale, out, roi_out->width, roi_out->height,
              roi_out->x, roi_out->y, roi_out->scale);
 
+  // Nothing to do, and no tile to size the buffers from
+  if(roi_out->width <= 0 || roi_out->height <= 0 || roi_in->width <= 0 || roi_in->height <= 0) return;
+
   // Fast code path for 1:1 copy, only cropping area can change
   if(roi_out->scale == 1.f)
   {
@@ -1639,9 +1745,9 @@ static void dt_interpolation_resample_sse(const struct dt_interpolation *itor, f
 #endif
     for(int y = 0; y < roi_out->height; y++)
     {
-      float *i = (float *)((char *)in + (size_t)in_stride * (y + roi_out->y) + x0);
-      float *o = (float *)((char *)out + (size_t)out_stride * y);
-      memcpy(o, i, out_stride);
+      memcpy((char *)out + (size_t)out_stride * y,
+             (char *)in + (size_t)in_stride * (y + roi_out->y) + x0,
+             out_stride);
     }
 #if DEBUG_RESAMPLING_TIMING
     ts_resampling = getts() - ts_resampling;
@@ -1656,17 +1762,63 @@ static void dt_interpolation_resample_sse(const struct dt_interpolation *itor, f
   int64_t ts_plan = getts();
 #endif
 
-  // Prepare resampling plans once and for all
-  r = prepare_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale,
-                              &hlength, &hkernel, &hindex, NULL);
-  if(r)
+  // Get the resampling plans, usually from the last runs
+  hplan = resampling_plan_get(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale);
+  if(!hplan)
   {
     goto exit;
   }
 
-  r = prepare_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale,
-                              &vlength, &vkernel, &vindex, &vmeta);
-  if(r)
+  vplan = resampling_plan_get(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale);
+  if(!vplan)
+  {
+    goto exit;
+  }
+
+  const int *const hindex = hplan->index;
+  const int *const hlength = hplan->length;
+  const float *const hkernel = hplan->kernel;
+  const int *const hmeta = hplan->meta;
+  const int *const vindex = vplan->index;
+  const int *const vlength = vplan->length;
+  const float *const vkernel = vplan->kernel;
+  const int *const vmeta = vplan->meta;
+
+  // the span of input rows needed by every row of tiles, and the largest of them to size the buffers
+  const int tiles_y = (roi_out->height + RESAMPLING_TILE_HEIGHT - 1) / RESAMPLING_TILE_HEIGHT;
+  tile_rows = malloc(sizeof(int) * 2 * tiles_y);
+  if(!tile_rows)
+  {
+    goto exit;
+  }
+  int max_rows = 0;
+  for(int ty = 0; ty < tiles_y; ty++)
+  {
+    const int oy_end = MIN(roi_out->height, (ty + 1) * RESAMPLING_TILE_HEIGHT);
+    int first = INT_MAX, last = INT_MIN;
+    for(int oy = ty * RESAMPLING_TILE_HEIGHT; oy < oy_end; oy++)
+    {
+      const int vl = vlength[vmeta[3 * oy + 0]];
+      const int *const index = vindex + vmeta[3 * oy + 2];
+      for(int iy = 0; iy < vl; iy++)
+      {
+        first = MIN(first, index[iy]);
+        last = MAX(last, index[iy]);
+      }
+    }
+    tile_rows[2 * ty + 0] = first;
+    tile_rows[2 * ty + 1] = last - first + 1;
+    max_rows = MAX(max_rows, last - first + 1);
+  }
+
+  // strong downscales need many input rows, keep the buffer in cache by making the tiles narrower then
+  const int tile_width = CLAMP(RESAMPLING_TILE_BUFFER / (max_rows * 4 * (int)sizeof(float)), 16,
+                               RESAMPLING_TILE_WIDTH);
+  const int tiles_x = (roi_out->width + tile_width - 1) / tile_width;
+  const int nthreads = dt_get_num_threads();
+  const size_t buffer_size = (size_t)max_rows * tile_width * 4;
+  buffers = dt_alloc_align(SSE_ALIGNMENT, sizeof(float) * buffer_size * nthreads);
+  if(!buffers)
   {
     goto exit;
   }
@@ -1679,93 +1831,52 @@ static void dt_interpolation_resample_sse(const struct dt_interpolation *itor, f
   int64_t ts_resampling = getts();
 #endif
 
-// Process each output line
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(in, in_stride, out_stride, roi_out) \
-  shared(out, hindex, hlength, hkernel, vindex, vlength, vkernel, vmeta)
+  dt_omp_firstprivate(in, in_stride, out_stride, roi_out, tile_width, tiles_x, tiles_y, buffer_size, hpass, \
+                      vpass, hindex, hlength, hkernel, hmeta, vindex, vlength, vkernel, vmeta) \
+  shared(out, buffers, tile_rows) \
+  schedule(dynamic) collapse(2)
 #endif
-  for(int oy = 0; oy < roi_out->height; oy++)
+  for(int ty = 0; ty < tiles_y; ty++)
   {
-    // Initialize column resampling indexes
-    int vlidx = vmeta[3 * oy + 0]; // V(ertical) L(ength) I(n)d(e)x
-    int vkidx = vmeta[3 * oy + 1]; // V(ertical) K(ernel) I(n)d(e)x
-    int viidx = vmeta[3 * oy + 2]; // V(ertical) I(ndex) I(n)d(e)x
-
-    // Initialize row resampling indexes
-    int hlidx = 0; // H(orizontal) L(ength) I(n)d(e)x
-    int hkidx = 0; // H(orizontal) K(ernel) I(n)d(e)x
-    int hiidx = 0; // H(orizontal) I(ndex) I(n)d(e)x
-
-    // Number of lines contributing to the output line
-    int vl = vlength[vlidx++]; // V(ertical) L(ength)
-
-    // Process each output column
-    for(int ox = 0; ox < roi_out->width; ox++)
+    for(int tx = 0; tx < tiles_x; tx++)
     {
-      debug_extra("output %p [% 4d % 4d]\n", out, ox, oy);
-
-      // This will hold the resulting pixel
-      __m128 vs = _mm_setzero_ps();
-
-      // Number of horizontal samples contributing to the output
-      int hl = hlength[hlidx++]; // H(orizontal) L(ength)
-
-      for(int iy = 0; iy < vl; iy++)
+      float *const buf = buffers + buffer_size * dt_get_thread_num();
+      const int ox = tx * tile_width;
+      const int width = MIN(tile_width, roi_out->width - ox);
+      const int first = tile_rows[2 * ty + 0];
+      const int rows = tile_rows[2 * ty + 1];
+      const size_t stride = (size_t)4 * width;
+
+      // horizontal pass of all input rows of the tile
+      for(int iy = 0; iy < rows; iy++)
+        hpass((const float *)((const char *)in + (size_t)in_stride * (first + iy)), buf + stride * iy,
+              hlength + hmeta[3 * ox + 0], hkernel + hmeta[3 * ox + 1], hindex + hmeta[3 * ox + 2], width);
+
+      // vertical pass, straight into the output
+      const int oy_end = MIN(roi_out->height, (ty + 1) * RESAMPLING_TILE_HEIGHT);
+      for(int oy = ty * RESAMPLING_TILE_HEIGHT; oy < oy_end; oy++)
       {
-        // This is our input line
-        const float *i = (float *)((char *)in + (size_t)in_stride * vindex[viidx++]);
-
-        __m128 vhs = _mm_setzero_ps();
-
-        for(int ix = 0; ix < hl; ix++)
-        {
-          // Apply the precomputed filter kernel
-          size_t baseidx = (size_t)hindex[hiidx++] * 4;
-          float htap = hkernel[hkidx++];
-          __m128 vhtap = _mm_set_ps1(htap);
-          vhs = _mm_add_ps(vhs, _mm_mul_ps(*(__m128 *)&i[baseidx], vhtap));
-        }
-
-        // Accumulate contribution from this line
-        float vtap = vkernel[vkidx++];
-        __m128 vvtap = _mm_set_ps1(vtap);
-        vs = _mm_add_ps(vs, _mm_mul_ps(vhs, vvtap));
-
-        // Reset horizontal resampling context
-        hkidx -= hl;
-        hiidx -= hl;
+        float *const o = (float *)((char *)out + (size_t)oy * out_stride + (size_t)ox * 4 * sizeof(float));
+        debug_extra("output %p [% 4d % 4d]\n", out, ox, oy);
+        vpass(buf, stride, first, o, vlength[vmeta[3 * oy + 0]], vkernel + vmeta[3 * oy + 1],
+              vindex + vmeta[3 * oy + 2], 4 * width);
       }
-
-      // Output pixel is ready
-      float *o = (float *)((char *)out + (size_t)oy * out_stride + (size_t)ox * 4 * sizeof(float));
-      _mm_stream_ps(o, vs);
-
-      // Reset vertical resampling context
-      viidx -= vl;
-      vkidx -= vl;
-
-      // Progress in horizontal context
-      hiidx += hl;
-      hkidx += hl;
     }
   }
 
-  _mm_sfence();
-
 #if DEBUG_RESAMPLING_TIMING
   ts_resampling = getts() - ts_resampling;
   fprintf(stderr, "resampling %p plan:%" PRId64 "us resampling:%" PRId64 "us\n", in, ts_plan, ts_resampling);
 #endif
 
 exit:
-  /* Free the resampling plans. It's nasty to optimize allocs like that, but
-   * it simplifies the code :-D. The length array is in fact the only memory
-   * allocated. */
-  dt_free_align(hlength);
-  dt_free_align(vlength);
+  resampling_plan_release(hplan);
+  resampling_plan_release(vplan);
+  dt_free_align(buffers);
+  free(tile_rows);
 }
-#endif
 
 /** Applies resampling (re-scaling) on *full* input and output buffers.
  *  roi_in and roi_out define the part of the buffers that is affected.
@@ -1775,11 +1886,18 @@ void dt_interpolation_resample(const struct dt_interpolation *itor, float *out,
                                const float *const in, const dt_iop_roi_t *const roi_in,
                                const int32_t in_stride)
 {
+#if defined(DT_HAVE_AVX_CODEPATHS)
+  if(!darktable.codepath.OPENMP_SIMD && darktable.codepath.AVX2)
+    return dt_interpolation_resample_tiled(itor, out, roi_out, out_stride, in, roi_in, in_stride,
+                                           resample_hpass_avx2, resample_vpass_avx2);
+#endif
   if(darktable.codepath.OPENMP_SIMD)
-    return dt_interpolation_resample_plain(itor, out, roi_out, out_stride, in, roi_in, in_stride);
+    return dt_interpolation_resample_tiled(itor, out, roi_out, out_stride, in, roi_in, in_stride,
+                                           resample_hpass_plain, resample_vpass_plain);
 #if defined(__SSE2__)
   else if(darktable.codepath.SSE2)
-    return dt_interpolation_resample_sse(itor, out, roi_out, out_stride, in, roi_in, in_stride);
+    return dt_interpolation_resample_tiled(itor, out, roi_out, out_stride, in, roi_in, in_stride,
+                                           resample_hpass_sse, resample_vpass_sse);
 #endif
   else
     dt_unreachable_codepath();
@@ -1895,14 +2013,14 @@ int dt_interpolation_resample_cl(const struct dt_interpolation *itor, int devid,
 
   // Prepare resampling plans once and for all
   r = prepare_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale,
-                              &hlength, &hkernel, &hindex, &hmeta);
+                              &hlength, &hkernel, &hindex, &hmeta, FALSE);
   if(r)
   {
     goto error;
   }
 
   r = prepare_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale,
-                              &vlength, &vkernel, &vindex, &vmeta);
+                              &vlength, &vkernel, &vindex, &vmeta, FALSE);
   if(r)
   {
     goto error;
@@ -2108,14 +2226,14 @@ static void dt_interpolation_resample_1c_plain(const struct dt_interpolation *it
 
   // Prepare resampling plans once and for all
   r = prepare_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale,
-                              &hlength, &hkernel, &hindex, NULL);
+                              &hlength, &hkernel, &hindex, NULL, FALSE);
   if(r)
   {
     goto exit;
   }
 
   r = prepare_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale,
-                              &vlength, &vkernel, &vindex, &vmeta);
+                              &vlength, &vkernel, &vindex, &vmeta, FALSE);
   if(r)
   {
     goto exit;
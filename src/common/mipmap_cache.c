@@ -26,6 +26,7 @@
 #include "common/imageio.h"
 #include "common/imageio_jpeg.h"
 #include "common/imageio_module.h"
+#include "common/mipmap_pack.h"
 #include "control/conf.h"
 #include "control/jobs.h"
 #include "develop/imageop_math.h"
@@ -373,9 +374,20 @@ void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
                               || (dt_conf_get_bool("cache_disk_backend_full") && mip == DT_MIPMAP_8)))
     {
       // try and load from disk, if successful set flag
+      int color_space = DT_COLORSPACE_NONE;
+      if(cache->pack[mip]
+         && !dt_mipmap_pack_read(cache->pack[mip], get_imgid(entry->key), entry->data + sizeof(*dsc),
+                                 cache->max_width[mip], cache->max_height[mip], &dsc->width, &dsc->height,
+                                 &color_space))
+      {
+        dsc->iscale = 1.0f;
+        dsc->color_space = color_space;
+        loaded_from_disk = 1;
+      }
       char filename[PATH_MAX] = {0};
       snprintf(filename, sizeof(filename), "%s.d/%d/%d.jpg", cache->cachedir, mip, get_imgid(entry->key));
-      FILE *f = g_fopen(filename, "rb");
+      // jpg files written before switching to pack files are still picked up
+      FILE *f = loaded_from_disk ? NULL : g_fopen(filename, "rb");
       if(f)
       {
         uint8_t *blob = 0;
@@ -440,6 +452,17 @@ static void dt_mipmap_cache_unlink_ondisk_thumbnail(void *data, uint32_t imgid,
     snprintf(filename, sizeof(filename), "%s.d/%d/%"PRIu32".jpg", cache->cachedir, (int)mip, imgid);
     g_unlink(filename);
   }
+  if(mip < DT_MIPMAP_F && cache->pack[mip]) dt_mipmap_pack_remove(cache->pack[mip], imgid);
+}
+
+gboolean dt_mipmap_cache_ondisk_thumbnail_exists(const dt_mipmap_cache_t *cache, const uint32_t imgid,
+                                                 const dt_mipmap_size_t mip)
+{
+  if(!cache->cachedir[0] || mip >= DT_MIPMAP_F) return FALSE;
+  if(cache->pack[mip] && dt_mipmap_pack_contains(cache->pack[mip], imgid)) return TRUE;
+  char filename[PATH_MAX] = { 0 };
+  snprintf(filename, sizeof(filename), "%s.d/%d/%"PRIu32".jpg", cache->cachedir, (int)mip, imgid);
+  return g_file_test(filename, G_FILE_TEST_EXISTS);
 }
 
 void dt_mipmap_cache_deallocate_dynamic(void *data, dt_cache_entry_t *entry)
@@ -459,6 +482,12 @@ void dt_mipmap_cache_deallocate_dynamic(void *data, dt_cache_entry_t *entry)
       else if(cache->cachedir[0] && ((dt_conf_get_bool("cache_disk_backend") && mip < DT_MIPMAP_8)
                                      || (dt_conf_get_bool("cache_disk_backend_full") && mip == DT_MIPMAP_8)))
       {
+        if(cache->pack[mip])
+        {
+          dt_mipmap_pack_write(cache->pack[mip], get_imgid(entry->key), entry->data + sizeof(*dsc), dsc->width,
+                               dsc->height, dsc->color_space);
+          goto written;
+        }
         // serialize to disk
         char filename[PATH_MAX] = {0};
         snprintf(filename, sizeof(filename), "%s.d/%d", cache->cachedir, mip);
@@ -511,6 +540,7 @@ write_error:
       }
     }
   }
+written:
   dt_free_align(entry->data);
 }
 
@@ -524,6 +554,16 @@ static uint32_t nearest_power_of_two(const uint32_t value)
 void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
 {
   dt_mipmap_cache_get_filename(cache->cachedir, sizeof(cache->cachedir));
+  for(int k = 0; k < DT_MIPMAP_F; k++)
+  {
+    cache->pack[k] = NULL;
+    if(cache->cachedir[0] && dt_conf_get_bool("cache_disk_backend_pack"))
+    {
+      char dirname[PATH_MAX] = { 0 };
+      snprintf(dirname, sizeof(dirname), "%s.d/%d", cache->cachedir, k);
+      cache->pack[k] = dt_mipmap_pack_open(dirname);
+    }
+  }
   // make sure static memory is initialized
   struct dt_mipmap_buffer_dsc *dsc = (struct dt_mipmap_buffer_dsc *)dt_mipmap_cache_static_dead_image;
   dead_image_f((dt_mipmap_buffer_t *)(dsc + 1));
@@ -606,6 +646,12 @@ void dt_mipmap_cache_cleanup(dt_mipmap_cache_t *cache)
   dt_cache_cleanup(&cache->mip_thumbs.cache);
   dt_cache_cleanup(&cache->mip_full.cache);
   dt_cache_cleanup(&cache->mip_f.cache);
+  // after the caches, they write back to the packs on cleanup
+  for(int k = 0; k < DT_MIPMAP_F; k++)
+  {
+    dt_mipmap_pack_close(cache->pack[k]);
+    cache->pack[k] = NULL;
+  }
 }
 
 void dt_mipmap_cache_print(dt_mipmap_cache_t *cache)
@@ -730,10 +776,8 @@ void dt_mipmap_cache_get_with_caller(
     if(!cache->cachedir[0]) return;
     if(mip > DT_MIPMAP_FULL || (int)mip < DT_MIPMAP_0)
       return; // remove the (int) once we no longer have to support gcc < 4.8 :/
-    char filename[PATH_MAX] = {0};
-    snprintf(filename, sizeof(filename), "%s.d/%d/%"PRIu32".jpg", cache->cachedir, (int)mip, key);
     // don't attempt to load if disk cache doesn't exist
-    if(!g_file_test(filename, G_FILE_TEST_EXISTS)) return;
+    if(!dt_mipmap_cache_ondisk_thumbnail_exists(cache, imgid, mip)) return;
     dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_FG, dt_image_load_job_create(imgid, mip));
   }
   else if(flags == DT_MIPMAP_BLOCKING)
@@ -913,13 +957,8 @@ void dt_mipmap_cache_get_with_caller(
     __sync_fetch_and_add(&(_get_cache(cache, mip)->stats_misses), 1);
     // in case we don't even have a disk cache for our requested thumbnail,
     // prefetch at least mip0, in case we have that in the disk caches:
-    if(cache->cachedir[0])
-    {
-      char filename[PATH_MAX] = {0};
-      snprintf(filename, sizeof(filename), "%s.d/%d/%"PRIu32".jpg", cache->cachedir, (int)mip, key);
-      if(g_file_test(filename, G_FILE_TEST_EXISTS))
-        dt_mipmap_cache_get(cache, 0, imgid, DT_MIPMAP_0, DT_MIPMAP_PREFETCH_DISK, 0);
-    }
+    if(dt_mipmap_cache_ondisk_thumbnail_exists(cache, imgid, mip))
+      dt_mipmap_cache_get(cache, 0, imgid, DT_MIPMAP_0, DT_MIPMAP_PREFETCH_DISK, 0);
     // nothing found :(
     buf->buf = NULL;
     buf->imgid = 0;
@@ -972,6 +1011,26 @@ dt_mipmap_size_t dt_mipmap_cache_get_matching_size(const dt_mipmap_cache_t *cach
   return best;
 }
 
+gboolean dt_mipmap_cache_thumbnail_hq(const dt_mipmap_cache_t *cache, const int32_t width, const int32_t height)
+{
+  // we check if we need ultra-high quality thumbnail for this size
+  char *min = dt_conf_get_string("plugins/lighttable/thumbnail_hq_min_level");
+
+  const int level = dt_mipmap_cache_get_matching_size(cache, width, height);
+  gboolean res = FALSE;
+  if(strcmp(min, "always") == 0) res = TRUE;
+  else if(strcmp(min, "small") == 0) res = (level >= 1);
+  else if(strcmp(min, "VGA") == 0) res = (level >= 2);
+  else if(strcmp(min, "720p") == 0) res = (level >= 3);
+  else if(strcmp(min, "1080p") == 0) res = (level >= 4);
+  else if(strcmp(min, "WQXGA") == 0) res = (level >= 5);
+  else if(strcmp(min, "4k") == 0) res = (level >= 6);
+  else if(strcmp(min, "5K") == 0) res = (level >= 7);
+
+  g_free(min);
+  return res;
+}
+
 void dt_mipmap_cache_remove(dt_mipmap_cache_t *cache, const uint32_t imgid)
 {
   // get rid of all ldr thumbnails:
@@ -1070,30 +1129,7 @@ static void _init_f(dt_mipmap_buffer_t *mipmap_buf, float *out, uint32_t *width,
 
   if(image->buf_dsc.filters)
   {
-    if(image->buf_dsc.filters != 9u && image->buf_dsc.datatype == TYPE_FLOAT)
-    {
-      dt_iop_clip_and_zoom_mosaic_half_size_f((float *const)out, (const float *const)buf.buf, &roi_out, &roi_in,
-                                              roi_out.width, roi_in.width, image->buf_dsc.filters);
-    }
-    else if(image->buf_dsc.filters != 9u && image->buf_dsc.datatype == TYPE_UINT16)
-    {
-      dt_iop_clip_and_zoom_mosaic_half_size((uint16_t * const)out, (const uint16_t *)buf.buf, &roi_out, &roi_in,
-                                            roi_out.width, roi_in.width, image->buf_dsc.filters);
-    }
-    else if(image->buf_dsc.filters == 9u && image->buf_dsc.datatype == TYPE_UINT16)
-    {
-      dt_iop_clip_and_zoom_mosaic_third_size_xtrans((uint16_t * const)out, (const uint16_t *)buf.buf, &roi_out,
-                                                    &roi_in, roi_out.width, roi_in.width, image->buf_dsc.xtrans);
-    }
-    else if(image->buf_dsc.filters == 9u && image->buf_dsc.datatype == TYPE_FLOAT)
-    {
-      dt_iop_clip_and_zoom_mosaic_third_size_xtrans_f(out, (const float *)buf.buf, &roi_out, &roi_in,
-                                                      roi_out.width, roi_in.width, image->buf_dsc.xtrans);
-    }
-    else
-    {
-      dt_unreachable_codepath();
-    }
+    dt_iop_clip_and_zoom_mosaic(out, buf.buf, &roi_out, &roi_in, roi_out.width, roi_in.width, &image->buf_dsc);
   }
   else
   {
@@ -1297,6 +1333,7 @@ void dt_mipmap_cache_copy_thumbnails(const dt_mipmap_cache_t *cache, const uint3
   {
     for(dt_mipmap_size_t mip = DT_MIPMAP_0; mip < DT_MIPMAP_F; mip++)
     {
+      if(cache->pack[mip]) dt_mipmap_pack_copy(cache->pack[mip], dst_imgid, src_imgid);
       // try and load from disk, if successful set flag
       char srcpath[PATH_MAX] = {0};
       char dstpath[PATH_MAX] = {0};
@@ -99,6 +99,8 @@ typedef struct dt_mipmap_cache_t
   dt_mipmap_cache_one_t mip_f;
   dt_mipmap_cache_one_t mip_full;
   char cachedir[PATH_MAX]; // cached sha1sum filename for faster access
+  // pack file disk backend per thumbnail level, NULL if thumbnails are stored as jpg
+  struct dt_mipmap_pack_t *pack[DT_MIPMAP_F];
 } dt_mipmap_cache_t;
 
 // dynamic memory allocation interface for imageio backend: a write locked
@@ -110,6 +112,10 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache);
 void dt_mipmap_cache_cleanup(dt_mipmap_cache_t *cache);
 void dt_mipmap_cache_print(dt_mipmap_cache_t *cache);
 
+// whether the disk backend has a thumbnail of the image at this size
+gboolean dt_mipmap_cache_ondisk_thumbnail_exists(const dt_mipmap_cache_t *cache, const uint32_t imgid,
+                                                 const dt_mipmap_size_t mip);
+
 // get a buffer and lock according to mode ('r' or 'w').
 // see dt_mipmap_get_flags_t for explanation of the exact
 // behaviour. pass 0 as flags for the default (best effort)
@@ -157,6 +163,9 @@ dt_mipmap_size_t dt_mipmap_cache_get_matching_size(
     const int32_t width,
     const int32_t height);
 
+// whether thumbnails of this size are demosaiced at full quality, see plugins/lighttable/thumbnail_hq_min_level
+gboolean dt_mipmap_cache_thumbnail_hq(const dt_mipmap_cache_t *cache, const int32_t width, const int32_t height);
+
 // returns the colorspace to use for created thumbnails, takes config into account
 dt_colorspaces_color_profile_type_t dt_mipmap_cache_get_colorspace();
 
@@ -0,0 +1,542 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "common/mipmap_pack.h"
+#include "common/darktable.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/statvfs.h>
+#endif
+
+/* layout of the directory of one mip level:
+   index      header, followed by fixed size records. later records override earlier ones for the same image.
+   NNNN.pack  pixels of the thumbnails, 3 bytes per pixel, one after the other.
+   pixels are always written before their record, so a crash can only lose the tail of the index. */
+
+#define DT_MIPMAP_PACK_MAGIC 0x504d5444u // "DTMP"
+#define DT_MIPMAP_PACK_VERSION 1
+
+// don't fill up the disk with thumbnails
+#define DT_MIPMAP_PACK_MIN_FREE_MB 100
+
+typedef struct dt_mipmap_pack_header_t
+{
+  uint32_t magic;
+  uint32_t version;
+} dt_mipmap_pack_header_t;
+
+typedef struct dt_mipmap_pack_record_t
+{
+  uint32_t imgid;
+  uint32_t pack;   // number of the pack file
+  uint64_t offset; // of the pixels in the pack file
+  uint32_t width;  // 0 marks a removed thumbnail
+  uint32_t height;
+  int32_t color_space;
+  uint32_t padding;
+} dt_mipmap_pack_record_t;
+
+static inline uint64_t _record_size(const dt_mipmap_pack_record_t *rec)
+{
+  return (uint64_t)rec->width * rec->height * 3;
+}
+
+static void _pack_filename(const dt_mipmap_pack_t *pack, const uint32_t num, char *filename, const size_t size)
+{
+  snprintf(filename, size, "%s/%04" PRIu32 ".pack", pack->path, num);
+}
+
+static int _write_all(const int fd, const void *data, size_t size)
+{
+  const uint8_t *p = (const uint8_t *)data;
+  while(size > 0)
+  {
+    const ssize_t written = write(fd, p, size);
+    if(written < 0 && errno == EINTR) continue;
+    if(written <= 0) return 1;
+    p += written;
+    size -= written;
+  }
+  return 0;
+}
+
+// maps the whole address range a pack file can grow to, so appending never invalidates a mapping.
+// only bytes covered by records are ever read, and those have been written before the record.
+static const uint8_t *_map(dt_mipmap_pack_t *pack, const uint32_t num)
+{
+#ifdef _WIN32
+  return NULL;
+#else
+  if(num >= pack->num_maps)
+  {
+    uint8_t **maps = realloc(pack->maps, sizeof(uint8_t *) * (num + 1));
+    if(!maps) return NULL;
+    memset(maps + pack->num_maps, 0, sizeof(uint8_t *) * (num + 1 - pack->num_maps));
+    pack->maps = maps;
+    pack->num_maps = num + 1;
+  }
+  if(!pack->maps[num])
+  {
+    char filename[PATH_MAX] = { 0 };
+    _pack_filename(pack, num, filename, sizeof(filename));
+    const int fd = g_open(filename, O_RDONLY, 0);
+    if(fd < 0) return NULL;
+    void *addr = mmap(NULL, DT_MIPMAP_PACK_FILE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED) return NULL;
+    pack->maps[num] = (uint8_t *)addr;
+  }
+  return pack->maps[num];
+#endif
+}
+
+static void _unmap_all(dt_mipmap_pack_t *pack)
+{
+#ifndef _WIN32
+  for(uint32_t k = 0; k < pack->num_maps; k++)
+    if(pack->maps[k]) munmap(pack->maps[k], DT_MIPMAP_PACK_FILE_SIZE);
+#endif
+  free(pack->maps);
+  pack->maps = NULL;
+  pack->num_maps = 0;
+}
+
+static void _insert(dt_mipmap_pack_t *pack, const dt_mipmap_pack_record_t *rec)
+{
+  dt_mipmap_pack_record_t *old = (dt_mipmap_pack_record_t *)g_hash_table_lookup(pack->index, &rec->imgid);
+  if(old)
+  {
+    pack->live -= _record_size(old);
+    pack->dead += _record_size(old);
+  }
+  if(rec->width == 0)
+  {
+    if(old) g_hash_table_remove(pack->index, &rec->imgid);
+    return;
+  }
+  dt_mipmap_pack_record_t *copy = (dt_mipmap_pack_record_t *)g_malloc(sizeof(dt_mipmap_pack_record_t));
+  *copy = *rec;
+  // replace, not insert: the key lives inside the value.
+  g_hash_table_replace(pack->index, &copy->imgid, copy);
+  pack->live += _record_size(rec);
+}
+
+static void _load_index(dt_mipmap_pack_t *pack)
+{
+  char filename[PATH_MAX] = { 0 };
+  snprintf(filename, sizeof(filename), "%s/index", pack->path);
+  gchar *contents = NULL;
+  gsize length = 0;
+  if(!g_file_get_contents(filename, &contents, &length, NULL)) return;
+
+  const dt_mipmap_pack_header_t *header = (const dt_mipmap_pack_header_t *)contents;
+  if(length < sizeof(dt_mipmap_pack_header_t) || header->magic != DT_MIPMAP_PACK_MAGIC
+     || header->version != DT_MIPMAP_PACK_VERSION)
+  {
+    // unknown format, start from scratch. the pack files will be swept as unreferenced.
+    g_unlink(filename);
+    g_free(contents);
+    return;
+  }
+
+  const size_t num_records = (length - sizeof(dt_mipmap_pack_header_t)) / sizeof(dt_mipmap_pack_record_t);
+  const dt_mipmap_pack_record_t *records
+      = (const dt_mipmap_pack_record_t *)(contents + sizeof(dt_mipmap_pack_header_t));
+
+  // sizes of the pack files, to drop records whose pixels did not make it to disk
+  GArray *pack_sizes = g_array_new(FALSE, TRUE, sizeof(int64_t));
+  for(size_t k = 0; k < num_records; k++)
+  {
+    const dt_mipmap_pack_record_t *rec = records + k;
+    if(rec->width > 0)
+    {
+      if(rec->pack >= pack_sizes->len)
+      {
+        const guint old_len = pack_sizes->len;
+        g_array_set_size(pack_sizes, rec->pack + 1);
+        for(guint p = old_len; p < pack_sizes->len; p++) g_array_index(pack_sizes, int64_t, p) = -1;
+      }
+      int64_t *pack_size = &g_array_index(pack_sizes, int64_t, rec->pack);
+      if(*pack_size < 0)
+      {
+        char packname[PATH_MAX] = { 0 };
+        _pack_filename(pack, rec->pack, packname, sizeof(packname));
+        GStatBuf statbuf;
+        *pack_size = g_stat(packname, &statbuf) ? 0 : statbuf.st_size;
+      }
+      if(rec->offset + _record_size(rec) > (uint64_t)*pack_size
+         || rec->offset + _record_size(rec) > DT_MIPMAP_PACK_FILE_SIZE)
+        continue;
+      pack->pack_num = MAX(pack->pack_num, rec->pack);
+    }
+    _insert(pack, rec);
+  }
+  g_array_free(pack_sizes, TRUE);
+
+  // cut off a partially written record, appending would shift all following ones.
+  pack->index_size = sizeof(dt_mipmap_pack_header_t) + num_records * sizeof(dt_mipmap_pack_record_t);
+  if(pack->index_size != length && truncate(filename, pack->index_size))
+    g_unlink(filename);
+
+  g_free(contents);
+}
+
+// rewrites all live thumbnails into fresh pack files. images sharing pixels after a copy get their own,
+// which is also why live counts shared pixels once per image.
+static void _compact(dt_mipmap_pack_t *pack)
+{
+  char filename[PATH_MAX] = { 0 };
+  snprintf(filename, sizeof(filename), "%s/index.new", pack->path);
+  const int index_fd = g_open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+  if(index_fd < 0) return;
+
+  const dt_mipmap_pack_header_t header = { DT_MIPMAP_PACK_MAGIC, DT_MIPMAP_PACK_VERSION };
+  GArray *records = g_array_sized_new(FALSE, FALSE, sizeof(dt_mipmap_pack_record_t),
+                                      g_hash_table_size(pack->index));
+  uint32_t num = pack->pack_num;
+  uint64_t size = 0;
+  int fd = -1;
+  int err = _write_all(index_fd, &header, sizeof(header));
+
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, pack->index);
+  while(!err && g_hash_table_iter_next(&iter, &key, &value))
+  {
+    const dt_mipmap_pack_record_t *rec = (const dt_mipmap_pack_record_t *)value;
+    const uint8_t *base = _map(pack, rec->pack);
+    if(!base)
+    {
+      err = 1;
+      break;
+    }
+    if(fd < 0 || size + _record_size(rec) > DT_MIPMAP_PACK_FILE_SIZE)
+    {
+      if(fd >= 0)
+      {
+        g_fsync(fd);
+        close(fd);
+      }
+      char packname[PATH_MAX] = { 0 };
+      _pack_filename(pack, ++num, packname, sizeof(packname));
+      fd = g_open(packname, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+      size = 0;
+      if(fd < 0)
+      {
+        err = 1;
+        break;
+      }
+    }
+    dt_mipmap_pack_record_t moved = *rec;
+    moved.pack = num;
+    moved.offset = size;
+    err = _write_all(fd, base + rec->offset, _record_size(rec))
+          || _write_all(index_fd, &moved, sizeof(moved));
+    g_array_append_val(records, moved);
+    size += _record_size(rec);
+  }
+  if(fd >= 0)
+  {
+    g_fsync(fd);
+    close(fd);
+  }
+  g_fsync(index_fd);
+  close(index_fd);
+
+  char indexname[PATH_MAX] = { 0 };
+  snprintf(indexname, sizeof(indexname), "%s/index", pack->path);
+  if(err || g_rename(filename, indexname))
+  {
+    // the old index is still valid, new pack files get swept.
+    g_unlink(filename);
+    g_array_free(records, TRUE);
+    return;
+  }
+
+  for(guint k = 0; k < records->len; k++)
+  {
+    const dt_mipmap_pack_record_t *moved = &g_array_index(records, dt_mipmap_pack_record_t, k);
+    dt_mipmap_pack_record_t *rec = (dt_mipmap_pack_record_t *)g_hash_table_lookup(pack->index, &moved->imgid);
+    *rec = *moved;
+  }
+  dt_print(DT_DEBUG_CACHE, "[mipmap_pack] compacted `%s', reclaimed %.1f MB\n", pack->path,
+           pack->dead / (1024.0 * 1024.0));
+  _unmap_all(pack);
+  pack->pack_num = num;
+  pack->dead = 0;
+  pack->index_size = sizeof(header) + records->len * sizeof(dt_mipmap_pack_record_t);
+  g_array_free(records, TRUE);
+}
+
+// removes pack files no record points to anymore, except the one we append to.
+static void _sweep(dt_mipmap_pack_t *pack)
+{
+  GDir *dir = g_dir_open(pack->path, 0, NULL);
+  if(!dir) return;
+
+  GHashTable *used = g_hash_table_new(g_direct_hash, g_direct_equal);
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, pack->index);
+  while(g_hash_table_iter_next(&iter, &key, &value))
+    g_hash_table_add(used, GUINT_TO_POINTER(((dt_mipmap_pack_record_t *)value)->pack + 1));
+
+  const gchar *name;
+  while((name = g_dir_read_name(dir)))
+  {
+    if(!g_str_has_suffix(name, ".pack")) continue;
+    const uint32_t num = strtoul(name, NULL, 10);
+    if(num == pack->pack_num || g_hash_table_contains(used, GUINT_TO_POINTER(num + 1))) continue;
+    gchar *filename = g_build_filename(pack->path, name, NULL);
+    g_unlink(filename);
+    g_free(filename);
+  }
+  g_hash_table_destroy(used);
+  g_dir_close(dir);
+}
+
+// opens the index and the current pack file for appending. expects the lock to be held.
+static int _open_for_append(dt_mipmap_pack_t *pack)
+{
+  if(pack->index_fd < 0)
+  {
+    if(g_mkdir_with_parents(pack->path, 0750)) return 1;
+    char filename[PATH_MAX] = { 0 };
+    snprintf(filename, sizeof(filename), "%s/index", pack->path);
+    pack->index_fd = g_open(filename, O_WRONLY | O_CREAT | O_APPEND, 0640);
+    if(pack->index_fd < 0) return 1;
+    pack->index_size = lseek(pack->index_fd, 0, SEEK_END);
+    if(pack->index_size == 0)
+    {
+      const dt_mipmap_pack_header_t header = { DT_MIPMAP_PACK_MAGIC, DT_MIPMAP_PACK_VERSION };
+      if(_write_all(pack->index_fd, &header, sizeof(header)))
+      {
+        close(pack->index_fd);
+        pack->index_fd = -1;
+        return 1;
+      }
+      pack->index_size = sizeof(header);
+    }
+  }
+  if(pack->pack_fd < 0)
+  {
+    char filename[PATH_MAX] = { 0 };
+    _pack_filename(pack, pack->pack_num, filename, sizeof(filename));
+    pack->pack_fd = g_open(filename, O_WRONLY | O_CREAT | O_APPEND, 0640);
+    if(pack->pack_fd < 0) return 1;
+    pack->pack_size = lseek(pack->pack_fd, 0, SEEK_END);
+  }
+  return 0;
+}
+
+static int _append_record(dt_mipmap_pack_t *pack, const dt_mipmap_pack_record_t *rec)
+{
+  if(_write_all(pack->index_fd, rec, sizeof(dt_mipmap_pack_record_t)))
+  {
+    // keep the records aligned
+    if(ftruncate(pack->index_fd, pack->index_size)) {}
+    return 1;
+  }
+  pack->index_size += sizeof(dt_mipmap_pack_record_t);
+  return 0;
+}
+
+dt_mipmap_pack_t *dt_mipmap_pack_open(const char *path)
+{
+#ifdef _WIN32
+  return NULL;
+#else
+  dt_mipmap_pack_t *pack = (dt_mipmap_pack_t *)calloc(1, sizeof(dt_mipmap_pack_t));
+  if(!pack) return NULL;
+  g_strlcpy(pack->path, path, sizeof(pack->path));
+  dt_pthread_mutex_init(&pack->lock, NULL);
+  pack->index = g_hash_table_new_full(g_int_hash, g_int_equal, NULL, g_free);
+  pack->index_fd = pack->pack_fd = -1;
+
+  _load_index(pack);
+  if(pack->dead > pack->live && pack->dead > DT_MIPMAP_PACK_FILE_SIZE / 16) _compact(pack);
+  _sweep(pack);
+
+  dt_print(DT_DEBUG_CACHE, "[mipmap_pack] `%s': %u thumbnails, %.1f MB, %.1f MB unused\n", pack->path,
+           g_hash_table_size(pack->index), pack->live / (1024.0 * 1024.0), pack->dead / (1024.0 * 1024.0));
+  return pack;
+#endif
+}
+
+void dt_mipmap_pack_close(dt_mipmap_pack_t *pack)
+{
+  if(!pack) return;
+  if(pack->index_fd >= 0) close(pack->index_fd);
+  if(pack->pack_fd >= 0) close(pack->pack_fd);
+  _unmap_all(pack);
+  g_hash_table_destroy(pack->index);
+  dt_pthread_mutex_destroy(&pack->lock);
+  free(pack);
+}
+
+gboolean dt_mipmap_pack_contains(dt_mipmap_pack_t *pack, const uint32_t imgid)
+{
+  dt_pthread_mutex_lock(&pack->lock);
+  const gboolean found = g_hash_table_contains(pack->index, &imgid);
+  dt_pthread_mutex_unlock(&pack->lock);
+  return found;
+}
+
+int dt_mipmap_pack_read(dt_mipmap_pack_t *pack, const uint32_t imgid, uint8_t *out, const uint32_t max_width,
+                        const uint32_t max_height, uint32_t *width, uint32_t *height, int *color_space)
+{
+  dt_pthread_mutex_lock(&pack->lock);
+  const dt_mipmap_pack_record_t *found = (dt_mipmap_pack_record_t *)g_hash_table_lookup(pack->index, &imgid);
+  dt_mipmap_pack_record_t rec = { 0 };
+  const uint8_t *base = NULL;
+  if(found)
+  {
+    rec = *found;
+    base = _map(pack, rec.pack);
+  }
+  dt_pthread_mutex_unlock(&pack->lock);
+
+  // mappings stay valid until the pack is closed, no need to hold the lock while copying.
+  if(!base || rec.width > max_width || rec.height > max_height) return 1;
+
+  const uint8_t *in = base + rec.offset;
+  const size_t npixels = (size_t)rec.width * rec.height;
+  for(size_t k = 0; k < npixels; k++)
+  {
+    out[4 * k + 0] = in[3 * k + 0];
+    out[4 * k + 1] = in[3 * k + 1];
+    out[4 * k + 2] = in[3 * k + 2];
+    out[4 * k + 3] = 0xff;
+  }
+  *width = rec.width;
+  *height = rec.height;
+  *color_space = rec.color_space;
+  return 0;
+}
+
+int dt_mipmap_pack_write(dt_mipmap_pack_t *pack, const uint32_t imgid, const uint8_t *in, const uint32_t width,
+                         const uint32_t height, const int color_space)
+{
+  const dt_mipmap_pack_record_t rec_size = { .width = width, .height = height };
+  const size_t size = _record_size(&rec_size);
+  if(size == 0 || size > DT_MIPMAP_PACK_FILE_SIZE) return 1;
+  // thumbnails don't change without being removed first
+  if(dt_mipmap_pack_contains(pack, imgid)) return 0;
+
+#ifndef _WIN32
+  struct statvfs vfsbuf;
+  if(!statvfs(pack->path, &vfsbuf))
+  {
+    const int64_t free_mb = ((vfsbuf.f_frsize * vfsbuf.f_bavail) >> 20);
+    if(free_mb < DT_MIPMAP_PACK_MIN_FREE_MB)
+    {
+      fprintf(stderr, "[mipmap_pack] aborting thumbnail write as only %" PRId64 " MB free in %s\n", free_mb,
+              pack->path);
+      return 1;
+    }
+  }
+#endif
+
+  uint8_t *rgb = (uint8_t *)dt_alloc_align(64, size);
+  if(!rgb) return 1;
+  const size_t npixels = (size_t)width * height;
+  for(size_t k = 0; k < npixels; k++)
+  {
+    rgb[3 * k + 0] = in[4 * k + 0];
+    rgb[3 * k + 1] = in[4 * k + 1];
+    rgb[3 * k + 2] = in[4 * k + 2];
+  }
+
+  int err = 0;
+  dt_mipmap_pack_record_t rec = { .imgid = imgid, .width = width, .height = height, .color_space = color_space };
+  dt_pthread_mutex_lock(&pack->lock);
+  if(g_hash_table_contains(pack->index, &imgid)) goto done;
+  if((err = _open_for_append(pack))) goto done;
+  if(pack->pack_size + size > DT_MIPMAP_PACK_FILE_SIZE)
+  {
+    close(pack->pack_fd);
+    pack->pack_fd = -1;
+    pack->pack_num++;
+    if((err = _open_for_append(pack))) goto done;
+  }
+
+  rec.pack = pack->pack_num;
+  rec.offset = pack->pack_size;
+  if(_write_all(pack->pack_fd, rgb, size))
+  {
+    // whatever made it is garbage now
+    pack->pack_size = lseek(pack->pack_fd, 0, SEEK_END);
+    err = 1;
+    goto done;
+  }
+  pack->pack_size += size;
+  if((err = _append_record(pack, &rec)))
+  {
+    pack->dead += size;
+    goto done;
+  }
+  _insert(pack, &rec);
+
+done:
+  dt_pthread_mutex_unlock(&pack->lock);
+  dt_free_align(rgb);
+  return err;
+}
+
+void dt_mipmap_pack_remove(dt_mipmap_pack_t *pack, const uint32_t imgid)
+{
+  dt_pthread_mutex_lock(&pack->lock);
+  if(g_hash_table_contains(pack->index, &imgid))
+  {
+    const dt_mipmap_pack_record_t tombstone = { .imgid = imgid };
+    if(!_open_for_append(pack)) _append_record(pack, &tombstone);
+    _insert(pack, &tombstone);
+  }
+  dt_pthread_mutex_unlock(&pack->lock);
+}
+
+void dt_mipmap_pack_copy(dt_mipmap_pack_t *pack, const uint32_t dst_imgid, const uint32_t src_imgid)
+{
+  dt_pthread_mutex_lock(&pack->lock);
+  const dt_mipmap_pack_record_t *src
+      = (dt_mipmap_pack_record_t *)g_hash_table_lookup(pack->index, &src_imgid);
+  if(src && !_open_for_append(pack))
+  {
+    dt_mipmap_pack_record_t rec = *src;
+    rec.imgid = dst_imgid;
+    if(!_append_record(pack, &rec)) _insert(pack, &rec);
+  }
+  dt_pthread_mutex_unlock(&pack->lock);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
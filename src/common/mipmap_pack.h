@@ -0,0 +1,77 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/dtpthread.h"
+
+#include <glib.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stddef.h>
+
+/**
+ * pack file backend for the thumbnail disk cache of one mip level.
+ *
+ * instead of one jpg per image, thumbnails are appended as uncompressed 8-bit rgb to a few large pack
+ * files which are memory mapped for reading, so loading a thumbnail is a lookup and a copy. an append-only
+ * index file maps image ids to the location of their pixels, removals are recorded as tombstones. dead
+ * space is reclaimed when the pack is opened and more than half of it is garbage.
+ */
+
+// largest size of one pack file, a new one is started when it would be exceeded
+#define DT_MIPMAP_PACK_FILE_SIZE (((size_t)1) << 30)
+
+typedef struct dt_mipmap_pack_t
+{
+  char path[PATH_MAX]; // directory holding the index and the pack files
+  dt_pthread_mutex_t lock;
+  GHashTable *index;   // imgid -> dt_mipmap_pack_record_t
+  int index_fd;        // opened for appending on first write
+  uint64_t index_size; // bytes of complete records in it
+  int pack_fd;         // pack file currently appended to
+  uint32_t pack_num;   // its number
+  uint64_t pack_size;  // and its size
+  uint8_t **maps;      // read-only mappings of the pack files, by number
+  uint32_t num_maps;
+  uint64_t live, dead; // bytes of pixels still referenced and orphaned
+} dt_mipmap_pack_t;
+
+/** returns NULL if pack files are not supported on this platform. does not create any files yet. */
+dt_mipmap_pack_t *dt_mipmap_pack_open(const char *path);
+void dt_mipmap_pack_close(dt_mipmap_pack_t *pack);
+
+gboolean dt_mipmap_pack_contains(dt_mipmap_pack_t *pack, const uint32_t imgid);
+
+/** copies the thumbnail of imgid as 4 channel 8-bit into out, if it is at most max_width x max_height.
+    returns 0 on success. */
+int dt_mipmap_pack_read(dt_mipmap_pack_t *pack, const uint32_t imgid, uint8_t *out, const uint32_t max_width,
+                        const uint32_t max_height, uint32_t *width, uint32_t *height, int *color_space);
+
+/** appends the 4 channel 8-bit thumbnail of imgid, unless there is one already. returns 0 on success. */
+int dt_mipmap_pack_write(dt_mipmap_pack_t *pack, const uint32_t imgid, const uint8_t *in, const uint32_t width,
+                         const uint32_t height, const int color_space);
+
+void dt_mipmap_pack_remove(dt_mipmap_pack_t *pack, const uint32_t imgid);
+
+/** lets dst_imgid share the pixels of src_imgid. */
+void dt_mipmap_pack_copy(dt_mipmap_pack_t *pack, const uint32_t dst_imgid, const uint32_t src_imgid);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,201 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "common/profiler.h"
+#include "develop/pixelpipe_hb.h"
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct dt_profiler_event_t
+{
+  const char *category;
+  gchar *name;
+  gchar *instance;
+  int pipe_type;
+  int32_t imgid;
+  int device;
+  int thread;
+  double start; // seconds since the profiler was started
+  double wall;
+  double process_cpu; // of all threads of the process, see profiler.h
+  size_t bytes_in;
+  size_t bytes_out;
+  int tiles;
+  int threads;
+} dt_profiler_event_t;
+
+struct dt_profiler_t
+{
+  gchar *filename;
+  dt_pthread_mutex_t lock;
+  GArray *events;
+  double start;
+  int num_threads; // threads seen so far, to number them densely
+};
+
+// small ids are easier on the trace viewers than pthread_t
+static __thread int _thread_id = -1;
+
+dt_profiler_t *dt_profiler_init(const char *filename)
+{
+  dt_profiler_t *profiler = (dt_profiler_t *)calloc(1, sizeof(dt_profiler_t));
+  profiler->filename = g_strdup(filename);
+  dt_pthread_mutex_init(&profiler->lock, NULL);
+  profiler->events = g_array_new(FALSE, FALSE, sizeof(dt_profiler_event_t));
+  profiler->start = dt_get_wtime();
+  return profiler;
+}
+
+void dt_profiler_record(dt_profiler_t *profiler, const char *category, const char *name, const char *instance,
+                        const struct dt_dev_pixelpipe_t *pipe, const dt_times_t *start, const size_t bytes_in,
+                        const size_t bytes_out, const int tiles, const int device)
+{
+  if(!profiler) return;
+
+  dt_times_t end;
+  dt_get_times(&end);
+
+  dt_profiler_event_t event = { .category = category,
+                                .name = g_strdup(name),
+                                .instance = g_strdup(instance ? instance : ""),
+                                .pipe_type = pipe ? pipe->type : -1,
+                                .imgid = pipe ? pipe->image.id : -1,
+                                .device = device,
+                                .start = start->clock - profiler->start,
+                                .wall = end.clock - start->clock,
+                                .process_cpu = end.user - start->user,
+                                .bytes_in = bytes_in,
+                                .bytes_out = bytes_out,
+                                .tiles = tiles,
+                                .threads = device < 0 ? dt_get_num_threads() : 0 };
+
+  dt_pthread_mutex_lock(&profiler->lock);
+  if(_thread_id < 0) _thread_id = profiler->num_threads++;
+  event.thread = _thread_id;
+  g_array_append_val(profiler->events, event);
+  dt_pthread_mutex_unlock(&profiler->lock);
+}
+
+// instance names are user supplied
+static void _write_csv_string(FILE *f, const char *s)
+{
+  fputc('"', f);
+  for(; *s; s++)
+  {
+    if(*s == '"') fputc('"', f);
+    fputc(*s, f);
+  }
+  fputc('"', f);
+}
+
+static void _write_json_string(FILE *f, const char *s)
+{
+  fputc('"', f);
+  for(; *s; s++)
+  {
+    if(*s == '"' || *s == '\\')
+      fprintf(f, "\\%c", *s);
+    else if((unsigned char)*s < 0x20)
+      fprintf(f, "\\u%04x", (unsigned char)*s);
+    else
+      fputc(*s, f);
+  }
+  fputc('"', f);
+}
+
+static void _write_csv(dt_profiler_t *profiler, FILE *f)
+{
+  fprintf(f, "category,module,instance,pipe,imgid,device,thread,start_ms,wall_ms,process_cpu_ms,bytes_in,bytes_out,"
+             "tiles,threads\n");
+  for(guint k = 0; k < profiler->events->len; k++)
+  {
+    const dt_profiler_event_t *e = &g_array_index(profiler->events, dt_profiler_event_t, k);
+    fprintf(f, "%s,%s,", e->category, e->name);
+    _write_csv_string(f, e->instance);
+    fprintf(f, ",%s,%d,%s,%d,%.3f,%.3f,%.3f,%zu,%zu,%d,%d\n", dt_dev_pixelpipe_type_to_str(e->pipe_type),
+            e->imgid, e->device < 0 ? "cpu" : "gpu", e->thread, 1000.0 * e->start, 1000.0 * e->wall,
+            1000.0 * e->process_cpu, e->bytes_in, e->bytes_out, e->tiles, e->threads);
+  }
+}
+
+static void _write_trace_events(dt_profiler_t *profiler, FILE *f)
+{
+  fprintf(f, "{\"traceEvents\":[\n");
+  for(guint k = 0; k < profiler->events->len; k++)
+  {
+    const dt_profiler_event_t *e = &g_array_index(profiler->events, dt_profiler_event_t, k);
+    fprintf(f, "{\"name\":");
+    if(*e->instance)
+    {
+      gchar *label = g_strdup_printf("%s %s", e->name, e->instance);
+      _write_json_string(f, label);
+      g_free(label);
+    }
+    else
+      _write_json_string(f, e->name);
+    // microseconds, with the cpu path and every opencl device as a process of its own
+    fprintf(f,
+            ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.1f,\"dur\":%.1f,\"pid\":%d,\"tid\":%d,\"args\":{\"pipe\":\"%s\","
+            "\"imgid\":%d,\"process_cpu_ms\":%.3f,\"bytes_in\":%zu,\"bytes_out\":%zu,\"tiles\":%d,"
+            "\"threads\":%d}}%s\n",
+            e->category, 1e6 * e->start, 1e6 * e->wall, e->device + 1, e->thread,
+            dt_dev_pixelpipe_type_to_str(e->pipe_type), e->imgid, 1000.0 * e->process_cpu, e->bytes_in, e->bytes_out,
+            e->tiles, e->threads, k + 1 < profiler->events->len ? "," : "");
+  }
+  fprintf(f, "],\n\"metadata\":{\"darktable-version\":\"%s\"}}\n", darktable_package_version);
+}
+
+void dt_profiler_cleanup(dt_profiler_t *profiler)
+{
+  if(!profiler) return;
+
+  FILE *f = g_fopen(profiler->filename, "wb");
+  if(f)
+  {
+    if(g_str_has_suffix(profiler->filename, ".csv"))
+      _write_csv(profiler, f);
+    else
+      _write_trace_events(profiler, f);
+    fclose(f);
+    fprintf(stderr, "[profiler] wrote %u events to `%s'\n", profiler->events->len, profiler->filename);
+  }
+  else
+    fprintf(stderr, "[profiler] could not write `%s'\n", profiler->filename);
+
+  for(guint k = 0; k < profiler->events->len; k++)
+  {
+    dt_profiler_event_t *e = &g_array_index(profiler->events, dt_profiler_event_t, k);
+    g_free(e->name);
+    g_free(e->instance);
+  }
+  g_array_free(profiler->events, TRUE);
+  dt_pthread_mutex_destroy(&profiler->lock);
+  g_free(profiler->filename);
+  free(profiler);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
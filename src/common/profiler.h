@@ -0,0 +1,57 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/darktable.h"
+
+/**
+ * structured timing of the pixelpipe, enabled with --trace <file>.
+ *
+ * the pixelpipe records one event per module run, and nested in it one per call of process(),
+ * process_tiling(), blending and colorspace conversion. events are collected in memory and written on
+ * shutdown, as comma separated values if the file name ends in .csv, as chrome trace event json
+ * (chrome://tracing, perfetto) otherwise.
+ *
+ * opencl kernels run asynchronously, their times are only meaningful with opencl_async_pixelpipe off or
+ * opencl profiling enabled.
+ *
+ * the cpu time is the user time of the whole process over the event, as the work of a module is spread over
+ * the openmp threads. it includes whatever else ran meanwhile, like other pipes, hence process_cpu_ms.
+ */
+
+struct dt_dev_pixelpipe_t;
+
+typedef struct dt_profiler_t dt_profiler_t;
+
+// use in front of any expensive preparation of an event
+#define dt_profiler_enabled() (darktable.profiler != NULL)
+
+dt_profiler_t *dt_profiler_init(const char *filename);
+/** writes the trace and frees the profiler. */
+void dt_profiler_cleanup(dt_profiler_t *profiler);
+
+/** records an event from start to now. name and instance are copied, category has to be a static string.
+    device is the opencl device or -1 for the cpu. tiles is 0 if there was no tiling. */
+void dt_profiler_record(dt_profiler_t *profiler, const char *category, const char *name, const char *instance,
+                        const struct dt_dev_pixelpipe_t *pipe, const dt_times_t *start, const size_t bytes_in,
+                        const size_t bytes_out, const int tiles, const int device);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
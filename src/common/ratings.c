@@ -76,6 +76,7 @@ static void _pop_undo(gpointer user_data, dt_undo_type_t type, dt_undo_data_t da
       *imgs = g_list_prepend(*imgs, GINT_TO_POINTER(ratings->imgid));
       list = g_list_next(list);
     }
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_IMAGE_INFO_CHANGED, *imgs);
     dt_collection_hint_message(darktable.collection);
   }
 }
@@ -147,6 +148,7 @@ void dt_ratings_apply(const int imgid, const int rating, const gboolean toggle_o
     
     if(undo_on) dt_undo_start_group(darktable.undo, DT_UNDO_RATINGS);
     _ratings_apply(imgs, new_rating, &undo, undo_on);
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_IMAGE_INFO_CHANGED, imgs);
 
     g_list_free(imgs);
     if(undo_on)
@@ -0,0 +1,233 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/sidecar_writer.h"
+#include "common/darktable.h"
+#include "common/image.h"
+
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <time.h>
+#include <unistd.h>
+
+// seconds an image stays dirty before it is written, so that bursts of changes end up in one write
+#define DT_SIDECAR_WRITER_DELAY 0.5
+// sidecars written between two looks at the queue
+#define DT_SIDECAR_WRITER_BATCH 256
+
+typedef struct dt_sidecar_writer_entry_t
+{
+  int imgid; // 0 once forgotten
+  double time; // when it got dirty, see _now()
+} dt_sidecar_writer_entry_t;
+
+// wall clock seconds since the epoch. unlike dt_get_wtime() this is the clock pthread_cond_timedwait()
+// takes its deadline in
+static inline double _now()
+{
+  return g_get_real_time() / 1e6;
+}
+
+static gboolean _entry_due(const dt_sidecar_writer_t *w, const dt_sidecar_writer_entry_t *e, const double now)
+{
+  return w->shutdown || w->flush || e->time + DT_SIDECAR_WRITER_DELAY <= now;
+}
+
+static void _write_batch(dt_sidecar_writer_t *w, const int *imgids, const int num)
+{
+  const double start = dt_get_wtime();
+  GPtrArray *written = g_ptr_array_new_with_free_func(g_free);
+  for(int k = 0; k < num; k++)
+  {
+    char filename[PATH_MAX] = { 0 };
+    if(dt_image_write_sidecar_file_now(imgids[k], filename, sizeof(filename)))
+      g_ptr_array_add(written, g_strdup(filename));
+  }
+#ifndef _WIN32
+  // sync them all after writing, so the disk gets to flush the whole batch at once
+  for(guint k = 0; k < written->len; k++)
+  {
+    const int fd = g_open(g_ptr_array_index(written, k), O_RDONLY, 0);
+    if(fd < 0) continue;
+    fsync(fd);
+    close(fd);
+  }
+#endif
+  const double time = dt_get_wtime() - start;
+
+  dt_pthread_mutex_lock(&w->mutex);
+  w->written += written->len;
+  w->batches++;
+  w->write_time += time;
+  dt_print(DT_DEBUG_PERF, "[sidecar_writer] wrote %u sidecars in %.3f secs (%.1f/s), %u still queued\n",
+           written->len, time, time > 0.0 ? written->len / time : 0.0, g_hash_table_size(w->dirty));
+  dt_pthread_mutex_unlock(&w->mutex);
+
+  g_ptr_array_free(written, TRUE);
+}
+
+static void *_sidecar_writer_thread(void *data)
+{
+  dt_sidecar_writer_t *w = (dt_sidecar_writer_t *)data;
+  int imgids[DT_SIDECAR_WRITER_BATCH];
+
+  dt_pthread_setname("sidecar");
+
+  dt_pthread_mutex_lock(&w->mutex);
+  while(TRUE)
+  {
+    const dt_sidecar_writer_entry_t *oldest = g_queue_peek_head(w->queue);
+    if(!oldest)
+    {
+      if(w->shutdown) break;
+      dt_pthread_cond_wait(&w->cond, &w->mutex);
+      continue;
+    }
+
+    const double now = _now();
+    if(!_entry_due(w, oldest, now))
+    {
+      // wait for the oldest to be due, changes until then get merged
+      const double due = oldest->time + DT_SIDECAR_WRITER_DELAY;
+      struct timespec ts;
+      ts.tv_sec = (time_t)due;
+      ts.tv_nsec = (long)((due - (double)ts.tv_sec) * 1e9);
+      dt_pthread_cond_timedwait(&w->cond, &w->mutex, &ts);
+      continue;
+    }
+
+    int num = 0;
+    dt_sidecar_writer_entry_t *e;
+    while(num < DT_SIDECAR_WRITER_BATCH && (e = g_queue_peek_head(w->queue)) && _entry_due(w, e, now))
+    {
+      g_queue_pop_head(w->queue);
+      if(e->imgid > 0)
+      {
+        g_hash_table_remove(w->dirty, GINT_TO_POINTER(e->imgid));
+        g_hash_table_add(w->batch, GINT_TO_POINTER(e->imgid));
+        imgids[num++] = e->imgid;
+      }
+      free(e);
+    }
+    dt_pthread_mutex_unlock(&w->mutex);
+
+    if(num) _write_batch(w, imgids, num);
+
+    dt_pthread_mutex_lock(&w->mutex);
+    g_hash_table_remove_all(w->batch);
+    pthread_cond_broadcast(&w->cond);
+  }
+  dt_pthread_mutex_unlock(&w->mutex);
+  return NULL;
+}
+
+void dt_sidecar_writer_init(dt_sidecar_writer_t *w)
+{
+  memset(w, 0, sizeof(dt_sidecar_writer_t));
+  dt_pthread_mutex_init(&w->mutex, NULL);
+  pthread_cond_init(&w->cond, NULL);
+  w->dirty = g_hash_table_new(NULL, NULL);
+  w->queue = g_queue_new();
+  w->batch = g_hash_table_new(NULL, NULL);
+  w->running = !dt_pthread_create(&w->thread, _sidecar_writer_thread, w);
+  if(!w->running)
+    fprintf(stderr, "[dt_sidecar_writer_init] failed to start the sidecar writer, writing them right away\n");
+}
+
+void dt_sidecar_writer_cleanup(dt_sidecar_writer_t *w)
+{
+  if(w->running)
+  {
+    dt_pthread_mutex_lock(&w->mutex);
+    w->shutdown = TRUE;
+    pthread_cond_broadcast(&w->cond);
+    dt_pthread_mutex_unlock(&w->mutex);
+    pthread_join(w->thread, NULL);
+    w->running = FALSE;
+  }
+
+  if(w->batches)
+    dt_print(DT_DEBUG_PERF, "[sidecar_writer] %" G_GUINT64_FORMAT " changes merged into %" G_GUINT64_FORMAT
+             " sidecars in %" G_GUINT64_FORMAT " batches, %.1f/s while writing, at most %u queued\n",
+             w->marked, w->written, w->batches, w->write_time > 0.0 ? w->written / w->write_time : 0.0,
+             w->max_depth);
+
+  g_queue_free_full(w->queue, free);
+  g_hash_table_destroy(w->dirty);
+  g_hash_table_destroy(w->batch);
+  pthread_cond_destroy(&w->cond);
+  dt_pthread_mutex_destroy(&w->mutex);
+}
+
+void dt_sidecar_writer_queue(dt_sidecar_writer_t *w, const int imgid)
+{
+  if(imgid <= 0) return;
+  if(!w->running)
+  {
+    dt_image_write_sidecar_file_now(imgid, NULL, 0);
+    return;
+  }
+
+  dt_pthread_mutex_lock(&w->mutex);
+  w->marked++;
+  if(!g_hash_table_contains(w->dirty, GINT_TO_POINTER(imgid)))
+  {
+    dt_sidecar_writer_entry_t *e = (dt_sidecar_writer_entry_t *)malloc(sizeof(dt_sidecar_writer_entry_t));
+    e->imgid = imgid;
+    e->time = _now();
+    g_queue_push_tail(w->queue, e);
+    g_hash_table_insert(w->dirty, GINT_TO_POINTER(imgid), e);
+    w->max_depth = MAX(w->max_depth, g_hash_table_size(w->dirty));
+    // the thread sleeps until the oldest entry is due, only an empty queue needs waking it
+    if(g_queue_get_length(w->queue) == 1) pthread_cond_signal(&w->cond);
+  }
+  dt_pthread_mutex_unlock(&w->mutex);
+}
+
+void dt_sidecar_writer_flush(dt_sidecar_writer_t *w)
+{
+  if(!w->running) return;
+
+  dt_pthread_mutex_lock(&w->mutex);
+  w->flush++;
+  pthread_cond_broadcast(&w->cond);
+  while(!g_queue_is_empty(w->queue) || g_hash_table_size(w->batch))
+    dt_pthread_cond_wait(&w->cond, &w->mutex);
+  w->flush--;
+  dt_pthread_mutex_unlock(&w->mutex);
+}
+
+void dt_sidecar_writer_forget(dt_sidecar_writer_t *w, const int imgid)
+{
+  if(!w->running) return;
+
+  dt_pthread_mutex_lock(&w->mutex);
+  dt_sidecar_writer_entry_t *e = g_hash_table_lookup(w->dirty, GINT_TO_POINTER(imgid));
+  if(e)
+  {
+    // stays in the queue until the thread gets to it
+    e->imgid = 0;
+    g_hash_table_remove(w->dirty, GINT_TO_POINTER(imgid));
+  }
+  while(g_hash_table_contains(w->batch, GINT_TO_POINTER(imgid))) dt_pthread_cond_wait(&w->cond, &w->mutex);
+  dt_pthread_mutex_unlock(&w->mutex);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,58 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/dtpthread.h"
+
+#include <glib.h>
+
+// writes xmp sidecars in the background. images are marked dirty, every image is written once per batch no
+// matter how often it changed in the meantime, and a batch goes to disk a short while after its oldest change.
+typedef struct dt_sidecar_writer_t
+{
+  dt_pthread_mutex_t mutex; // protects everything below
+  pthread_cond_t cond;      // new work, or a batch got done
+  pthread_t thread;
+  gboolean running;
+  gboolean shutdown;
+  int flush;         // callers waiting for everything queued to be written
+  GHashTable *dirty; // imgid -> entry in queue
+  GQueue *queue;     // dirty images, oldest first
+  GHashTable *batch; // imgids being written right now
+
+  // statistics, printed with -d perf
+  guint64 marked, written, batches;
+  guint max_depth;
+  double write_time;
+} dt_sidecar_writer_t;
+
+void dt_sidecar_writer_init(dt_sidecar_writer_t *w);
+/** writes everything still queued and stops the thread. */
+void dt_sidecar_writer_cleanup(dt_sidecar_writer_t *w);
+
+/** mark the sidecar of imgid as outdated. */
+void dt_sidecar_writer_queue(dt_sidecar_writer_t *w, const int imgid);
+/** blocks until everything queued so far is on disk. for whoever touches sidecar files directly. */
+void dt_sidecar_writer_flush(dt_sidecar_writer_t *w);
+/** drop a pending write of imgid, for images about to be removed. blocks while it is being written. */
+void dt_sidecar_writer_forget(dt_sidecar_writer_t *w, const int imgid);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
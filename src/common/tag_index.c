@@ -0,0 +1,790 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/tag_index.h"
+#include "common/darktable.h"
+#include "common/debug.h"
+#include "common/tags.h"
+
+#include <string.h>
+
+// changes remembered for dt_tag_index_changes_since()
+#define DT_TAG_INDEX_JOURNAL 4096
+
+// 64 images of a tag, starting at imgid index * 64
+typedef struct dt_tag_index_word_t
+{
+  guint32 index;
+  guint64 bits;
+} dt_tag_index_word_t;
+
+typedef struct dt_tag_index_tag_t
+{
+  guint id;
+  gint flags;
+  gchar *synonyms;
+  gboolean darktable; // one of the internal darktable|... tags
+  struct dt_tag_index_node_t *node;
+  GArray *words; // images it is attached to, dt_tag_index_word_t sorted by index
+  guint count;   // bits set in words
+} dt_tag_index_tag_t;
+
+typedef struct dt_tag_index_node_t
+{
+  gchar *path;       // full name up to this component
+  const gchar *name; // this component, points into path
+  gchar *haystack;   // lower case path and synonyms, what keywords are matched against
+  struct dt_tag_index_node_t *parent;
+  GHashTable *children;    // component -> node
+  dt_tag_index_tag_t *tag; // NULL for components which are no tag of their own
+  guint size;              // tags at and below this node, it goes away at 0
+} dt_tag_index_node_t;
+
+/* sparse bitsets of imgids */
+
+// position of the word for index in words, or where it would have to go
+static guint _words_find(const GArray *words, const guint32 index, gboolean *found)
+{
+  guint lo = 0, hi = words->len;
+  while(lo < hi)
+  {
+    const guint mid = (lo + hi) / 2;
+    if(g_array_index(words, dt_tag_index_word_t, mid).index < index)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  *found = lo < words->len && g_array_index(words, dt_tag_index_word_t, lo).index == index;
+  return lo;
+}
+
+static gboolean _words_test(const GArray *words, const int imgid)
+{
+  gboolean found;
+  const guint k = _words_find(words, imgid >> 6, &found);
+  return found && ((g_array_index(words, dt_tag_index_word_t, k).bits >> (imgid & 63)) & 1);
+}
+
+// returns TRUE if imgid wasn't in yet
+static gboolean _words_set(GArray *words, const int imgid)
+{
+  gboolean found;
+  const guint k = _words_find(words, imgid >> 6, &found);
+  const guint64 bit = (guint64)1 << (imgid & 63);
+  if(!found)
+  {
+    const dt_tag_index_word_t w = { .index = imgid >> 6, .bits = bit };
+    g_array_insert_val(words, k, w);
+    return TRUE;
+  }
+  dt_tag_index_word_t *w = &g_array_index(words, dt_tag_index_word_t, k);
+  if(w->bits & bit) return FALSE;
+  w->bits |= bit;
+  return TRUE;
+}
+
+// returns TRUE if imgid was in
+static gboolean _words_clear(GArray *words, const int imgid)
+{
+  gboolean found;
+  const guint k = _words_find(words, imgid >> 6, &found);
+  const guint64 bit = (guint64)1 << (imgid & 63);
+  if(!found) return FALSE;
+  dt_tag_index_word_t *w = &g_array_index(words, dt_tag_index_word_t, k);
+  if(!(w->bits & bit)) return FALSE;
+  w->bits &= ~bit;
+  if(!w->bits) g_array_remove_index(words, k);
+  return TRUE;
+}
+
+static gint _words_sort(gconstpointer a, gconstpointer b)
+{
+  const guint32 ia = ((const dt_tag_index_word_t *)a)->index;
+  const guint32 ib = ((const dt_tag_index_word_t *)b)->index;
+  return (ia > ib) - (ia < ib);
+}
+
+// the images any of tags is attached to, as sorted words
+static GArray *_words_union(const GPtrArray *tags)
+{
+  GArray *all = g_array_new(FALSE, FALSE, sizeof(dt_tag_index_word_t));
+  for(guint k = 0; k < tags->len; k++)
+  {
+    const GArray *words = ((const dt_tag_index_tag_t *)g_ptr_array_index(tags, k))->words;
+    g_array_append_vals(all, words->data, words->len);
+  }
+  if(tags->len < 2) return all;
+
+  g_array_sort(all, _words_sort);
+  guint n = 0;
+  for(guint k = 0; k < all->len; k++)
+  {
+    const dt_tag_index_word_t w = g_array_index(all, dt_tag_index_word_t, k);
+    if(n && g_array_index(all, dt_tag_index_word_t, n - 1).index == w.index)
+      g_array_index(all, dt_tag_index_word_t, n - 1).bits |= w.bits;
+    else
+      g_array_index(all, dt_tag_index_word_t, n++) = w;
+  }
+  g_array_set_size(all, n);
+  return all;
+}
+
+/* the trie over the path components */
+
+static void _node_free(gpointer data)
+{
+  dt_tag_index_node_t *node = (dt_tag_index_node_t *)data;
+  if(node->children) g_hash_table_destroy(node->children);
+  g_free(node->haystack);
+  g_free(node->path);
+  g_free(node);
+}
+
+static void _node_set_haystack(dt_tag_index_node_t *node)
+{
+  g_free(node->haystack);
+  if(node->tag && node->tag->synonyms && node->tag->synonyms[0])
+  {
+    gchar *text = g_strdup_printf("%s, %s", node->path, node->tag->synonyms);
+    node->haystack = g_utf8_strdown(text, -1);
+    g_free(text);
+  }
+  else
+    node->haystack = g_utf8_strdown(node->path, -1);
+}
+
+static dt_tag_index_node_t *_node_new(dt_tag_index_node_t *parent, const char *path, const size_t len)
+{
+  dt_tag_index_node_t *node = (dt_tag_index_node_t *)g_malloc0(sizeof(dt_tag_index_node_t));
+  node->path = g_strndup(path, len);
+  const char *sep = strrchr(node->path, '|');
+  node->name = sep ? sep + 1 : node->path;
+  node->parent = parent;
+  _node_set_haystack(node);
+  if(parent)
+  {
+    // children don't own their key, it is the name inside the node
+    if(!parent->children) parent->children = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, _node_free);
+    g_hash_table_insert(parent->children, (gpointer)node->name, node);
+  }
+  return node;
+}
+
+// the node of path, created together with the ones above it if create is set
+static dt_tag_index_node_t *_node_lookup(dt_tag_index_node_t *root, const char *path, const gboolean create)
+{
+  dt_tag_index_node_t *node = root;
+  const char *start = path;
+  while(node)
+  {
+    const char *end = strchr(start, '|');
+    const size_t len = end ? (size_t)(end - start) : strlen(start);
+    gchar *name = g_strndup(start, len);
+    dt_tag_index_node_t *child = node->children ? g_hash_table_lookup(node->children, name) : NULL;
+    g_free(name);
+    if(!child && create) child = _node_new(node, path, start + len - path);
+    node = child;
+    if(!end) break;
+    start = end + 1;
+  }
+  return node;
+}
+
+static void _node_acquire(dt_tag_index_node_t *node)
+{
+  for(; node; node = node->parent) node->size++;
+}
+
+// one tag less at node, nodes left without tags below them go away
+static void _node_release(dt_tag_index_node_t *node)
+{
+  while(node)
+  {
+    dt_tag_index_node_t *parent = node->parent;
+    node->size--;
+    if(!node->size && parent) g_hash_table_remove(parent->children, node->name);
+    node = parent;
+  }
+}
+
+static void _node_collect_tags(const dt_tag_index_node_t *node, GPtrArray *tags)
+{
+  if(node->tag) g_ptr_array_add(tags, node->tag);
+  if(!node->children) return;
+  GHashTableIter it;
+  gpointer value;
+  g_hash_table_iter_init(&it, node->children);
+  while(g_hash_table_iter_next(&it, NULL, &value)) _node_collect_tags((dt_tag_index_node_t *)value, tags);
+}
+
+static void _node_collect(dt_tag_index_node_t *node, GPtrArray *nodes)
+{
+  if(!node->children) return;
+  GHashTableIter it;
+  gpointer value;
+  g_hash_table_iter_init(&it, node->children);
+  while(g_hash_table_iter_next(&it, NULL, &value))
+  {
+    g_ptr_array_add(nodes, value);
+    _node_collect((dt_tag_index_node_t *)value, nodes);
+  }
+}
+
+/* tags and images */
+
+static void _match_reset(dt_tag_index_t *index)
+{
+  g_free(index->needle);
+  index->needle = NULL;
+  g_ptr_array_set_size(index->matches, 0);
+}
+
+static void _tag_free(gpointer data)
+{
+  dt_tag_index_tag_t *tag = (dt_tag_index_tag_t *)data;
+  g_array_free(tag->words, TRUE);
+  g_free(tag->synonyms);
+  g_free(tag);
+}
+
+static void _image_tags_free(gpointer data)
+{
+  g_array_free((GArray *)data, TRUE);
+}
+
+static void _image_add_tag(dt_tag_index_t *index, const int imgid, const guint tagid)
+{
+  GArray *tags = (GArray *)g_hash_table_lookup(index->images, GINT_TO_POINTER(imgid));
+  if(!tags)
+  {
+    tags = g_array_new(FALSE, FALSE, sizeof(guint));
+    g_hash_table_insert(index->images, GINT_TO_POINTER(imgid), tags);
+  }
+  g_array_append_val(tags, tagid);
+}
+
+static void _image_remove_tag(dt_tag_index_t *index, const int imgid, const guint tagid)
+{
+  GArray *tags = (GArray *)g_hash_table_lookup(index->images, GINT_TO_POINTER(imgid));
+  if(!tags) return;
+  for(guint k = 0; k < tags->len; k++)
+    if(g_array_index(tags, guint, k) == tagid)
+    {
+      g_array_remove_index_fast(tags, k);
+      break;
+    }
+  if(!tags->len) g_hash_table_remove(index->images, GINT_TO_POINTER(imgid));
+}
+
+static void _tag_set_name(dt_tag_index_t *index, dt_tag_index_tag_t *tag, const char *name)
+{
+  if(tag->node)
+  {
+    tag->node->tag = NULL;
+    _node_set_haystack(tag->node);
+    _node_release(tag->node);
+  }
+  tag->node = _node_lookup(index->root, name, TRUE);
+  tag->node->tag = tag;
+  _node_set_haystack(tag->node);
+  _node_acquire(tag->node);
+  tag->darktable = !g_ascii_strncasecmp(name, "darktable|", strlen("darktable|"));
+  _match_reset(index);
+}
+
+static void _tag_insert(dt_tag_index_t *index, const guint tagid, const char *name, const gint flags,
+                        const char *synonyms)
+{
+  dt_tag_index_tag_t *tag = (dt_tag_index_tag_t *)g_malloc0(sizeof(dt_tag_index_tag_t));
+  tag->id = tagid;
+  tag->flags = flags;
+  tag->synonyms = g_strdup(synonyms);
+  tag->words = g_array_new(FALSE, FALSE, sizeof(dt_tag_index_word_t));
+  g_hash_table_insert(index->tags, GUINT_TO_POINTER(tagid), tag);
+  _tag_set_name(index, tag, name);
+}
+
+static void _tag_remove(dt_tag_index_t *index, dt_tag_index_tag_t *tag)
+{
+  for(guint k = 0; k < tag->words->len; k++)
+  {
+    const dt_tag_index_word_t *w = &g_array_index(tag->words, dt_tag_index_word_t, k);
+    for(guint64 bits = w->bits; bits; bits &= bits - 1)
+      _image_remove_tag(index, w->index * 64 + __builtin_ctzll(bits), tag->id);
+  }
+  tag->node->tag = NULL;
+  _node_set_haystack(tag->node);
+  _node_release(tag->node);
+  _match_reset(index);
+  g_hash_table_remove(index->tags, GUINT_TO_POINTER(tag->id));
+}
+
+static void _attach(dt_tag_index_t *index, const guint tagid, const int imgid)
+{
+  dt_tag_index_tag_t *tag = (dt_tag_index_tag_t *)g_hash_table_lookup(index->tags, GUINT_TO_POINTER(tagid));
+  if(!tag || imgid <= 0) return;
+  if(_words_set(tag->words, imgid))
+  {
+    tag->count++;
+    _image_add_tag(index, imgid, tagid);
+  }
+}
+
+static void _detach(dt_tag_index_t *index, const guint tagid, const int imgid)
+{
+  dt_tag_index_tag_t *tag = (dt_tag_index_tag_t *)g_hash_table_lookup(index->tags, GUINT_TO_POINTER(tagid));
+  if(!tag || imgid <= 0) return;
+  if(_words_clear(tag->words, imgid))
+  {
+    tag->count--;
+    _image_remove_tag(index, imgid, tagid);
+  }
+}
+
+// record a change of the tags of imgid, or of all images for imgid 0. called with the lock held.
+static void _journal(dt_tag_index_t *index, const int imgid)
+{
+  if(index->journal->len >= DT_TAG_INDEX_JOURNAL)
+  {
+    g_array_remove_range(index->journal, 0, DT_TAG_INDEX_JOURNAL / 2);
+    index->journal_start += DT_TAG_INDEX_JOURNAL / 2;
+  }
+  g_array_append_val(index->journal, imgid);
+  index->changes++;
+}
+
+static void _clear(dt_tag_index_t *index)
+{
+  g_hash_table_remove_all(index->images);
+  g_hash_table_remove_all(index->tags);
+  if(index->root->children) g_hash_table_destroy(index->root->children);
+  index->root->children = NULL;
+  index->root->size = 0;
+  _match_reset(index);
+  index->loaded = FALSE;
+}
+
+static void _load(dt_tag_index_t *index)
+{
+  if(index->loaded) return;
+
+  const double start = dt_get_wtime();
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT id, name, flags, synonyms FROM data.tags",
+                              -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const char *name = (const char *)sqlite3_column_text(stmt, 1);
+    if(!name) continue;
+    _tag_insert(index, sqlite3_column_int(stmt, 0), name, sqlite3_column_int(stmt, 2),
+                (const char *)sqlite3_column_text(stmt, 3));
+  }
+  sqlite3_finalize(stmt);
+
+  // in order of imgid the bitsets only ever grow at their end
+  guint tagged = 0;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT imgid, tagid FROM main.tagged_images ORDER BY imgid", -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    _attach(index, sqlite3_column_int(stmt, 1), sqlite3_column_int(stmt, 0));
+    tagged++;
+  }
+  sqlite3_finalize(stmt);
+
+  index->loaded = TRUE;
+  index->loads++;
+  const double time = dt_get_wtime() - start;
+  index->load_time += time;
+  dt_print(DT_DEBUG_PERF, "[tag_index] read %u tags attached %u times in %.3f secs\n",
+           g_hash_table_size(index->tags), tagged, time);
+}
+
+// locks the index and makes sure it is filled. returns the time the query started at.
+static double _query_begin(dt_tag_index_t *index)
+{
+  dt_pthread_mutex_lock(&index->mutex);
+  _load(index);
+  return dt_get_wtime();
+}
+
+static void _query_end(dt_tag_index_t *index, const double start)
+{
+  index->queries++;
+  index->query_time += dt_get_wtime() - start;
+  dt_pthread_mutex_unlock(&index->mutex);
+}
+
+void dt_tag_index_init(dt_tag_index_t *index)
+{
+  memset(index, 0, sizeof(dt_tag_index_t));
+  dt_pthread_mutex_init(&index->mutex, NULL);
+  index->tags = g_hash_table_new_full(NULL, NULL, NULL, _tag_free);
+  index->images = g_hash_table_new_full(NULL, NULL, NULL, _image_tags_free);
+  index->root = _node_new(NULL, "", 0);
+  index->matches = g_ptr_array_new();
+  index->journal = g_array_new(FALSE, FALSE, sizeof(int));
+}
+
+void dt_tag_index_cleanup(dt_tag_index_t *index)
+{
+  if(index->queries)
+    dt_print(DT_DEBUG_PERF, "[tag_index] %" G_GUINT64_FORMAT " queries in %.3f secs, read %" G_GUINT64_FORMAT
+             " times in %.3f secs\n", index->queries, index->query_time, index->loads, index->load_time);
+
+  g_hash_table_destroy(index->images);
+  g_hash_table_destroy(index->tags);
+  _node_free(index->root);
+  g_free(index->needle);
+  g_ptr_array_free(index->matches, TRUE);
+  g_array_free(index->journal, TRUE);
+  dt_pthread_mutex_destroy(&index->mutex);
+}
+
+void dt_tag_index_invalidate(dt_tag_index_t *index)
+{
+  dt_pthread_mutex_lock(&index->mutex);
+  _clear(index);
+  _journal(index, 0);
+  dt_pthread_mutex_unlock(&index->mutex);
+}
+
+void dt_tag_index_tag_new(dt_tag_index_t *index, const guint tagid, const char *name)
+{
+  if(!name || !name[0]) return;
+  dt_pthread_mutex_lock(&index->mutex);
+  if(index->loaded && !g_hash_table_contains(index->tags, GUINT_TO_POINTER(tagid)))
+    _tag_insert(index, tagid, name, 0, NULL);
+  dt_pthread_mutex_unlock(&index->mutex);
+}
+
+void dt_tag_index_tag_remove(dt_tag_index_t *index, const guint tagid)
+{
+  dt_pthread_mutex_lock(&index->mutex);
+  dt_tag_index_tag_t *tag = index->loaded ? g_hash_table_lookup(index->tags, GUINT_TO_POINTER(tagid)) : NULL;
+  if(tag) _tag_remove(index, tag);
+  _journal(index, 0);
+  dt_pthread_mutex_unlock(&index->mutex);
+}
+
+void dt_tag_index_tag_rename(dt_tag_index_t *index, const guint tagid, const char *name)
+{
+  if(!name || !name[0]) return;
+  dt_pthread_mutex_lock(&index->mutex);
+  dt_tag_index_tag_t *tag = index->loaded ? g_hash_table_lookup(index->tags, GUINT_TO_POINTER(tagid)) : NULL;
+  if(tag && strcmp(tag->node->path, name)) _tag_set_name(index, tag, name);
+  _journal(index, 0);
+  dt_pthread_mutex_unlock(&index->mutex);
+}
+
+void dt_tag_index_tag_set_flags(dt_tag_index_t *index, const guint tagid, const gint flags)
+{
+  dt_pthread_mutex_lock(&index->mutex);
+  dt_tag_index_tag_t *tag = index->loaded ? g_hash_table_lookup(index->tags, GUINT_TO_POINTER(tagid)) : NULL;
+  if(tag) tag->flags = flags;
+  dt_pthread_mutex_unlock(&index->mutex);
+}
+
+void dt_tag_index_tag_set_synonyms(dt_tag_index_t *index, const guint tagid, const char *synonyms)
+{
+  dt_pthread_mutex_lock(&index->mutex);
+  dt_tag_index_tag_t *tag = index->loaded ? g_hash_table_lookup(index->tags, GUINT_TO_POINTER(tagid)) : NULL;
+  if(tag)
+  {
+    g_free(tag->synonyms);
+    tag->synonyms = g_strdup(synonyms);
+    _node_set_haystack(tag->node);
+    _match_reset(index);
+  }
+  dt_pthread_mutex_unlock(&index->mutex);
+}
+
+void dt_tag_index_attach(dt_tag_index_t *index, const guint tagid, const int imgid)
+{
+  dt_pthread_mutex_lock(&index->mutex);
+  if(index->loaded) _attach(index, tagid, imgid);
+  _journal(index, imgid);
+  dt_pthread_mutex_unlock(&index->mutex);
+}
+
+void dt_tag_index_detach(dt_tag_index_t *index, const guint tagid, const int imgid)
+{
+  dt_pthread_mutex_lock(&index->mutex);
+  if(index->loaded) _detach(index, tagid, imgid);
+  _journal(index, imgid);
+  dt_pthread_mutex_unlock(&index->mutex);
+}
+
+void dt_tag_index_image_copy(dt_tag_index_t *index, const int newid, const int imgid)
+{
+  dt_pthread_mutex_lock(&index->mutex);
+  const GArray *tags = index->loaded ? g_hash_table_lookup(index->images, GINT_TO_POINTER(imgid)) : NULL;
+  for(guint k = 0; tags && k < tags->len; k++) _attach(index, g_array_index(tags, guint, k), newid);
+  _journal(index, newid);
+  dt_pthread_mutex_unlock(&index->mutex);
+}
+
+void dt_tag_index_image_remove(dt_tag_index_t *index, const int imgid)
+{
+  dt_pthread_mutex_lock(&index->mutex);
+  const GArray *tags = index->loaded ? g_hash_table_lookup(index->images, GINT_TO_POINTER(imgid)) : NULL;
+  for(guint k = 0; tags && k < tags->len; k++)
+  {
+    dt_tag_index_tag_t *tag
+        = (dt_tag_index_tag_t *)g_hash_table_lookup(index->tags, GUINT_TO_POINTER(g_array_index(tags, guint, k)));
+    if(tag && _words_clear(tag->words, imgid)) tag->count--;
+  }
+  if(tags) g_hash_table_remove(index->images, GINT_TO_POINTER(imgid));
+  _journal(index, imgid);
+  dt_pthread_mutex_unlock(&index->mutex);
+}
+
+guint64 dt_tag_index_changes(dt_tag_index_t *index)
+{
+  dt_pthread_mutex_lock(&index->mutex);
+  const guint64 changes = index->changes;
+  dt_pthread_mutex_unlock(&index->mutex);
+  return changes;
+}
+
+gboolean dt_tag_index_changes_since(dt_tag_index_t *index, const guint64 since, GList **imgs, guint64 *now)
+{
+  *imgs = NULL;
+  dt_pthread_mutex_lock(&index->mutex);
+  *now = index->changes;
+  gboolean known = since >= index->journal_start && since <= index->changes;
+  GHashTable *seen = g_hash_table_new(NULL, NULL);
+  for(guint64 k = since - index->journal_start; known && k < index->journal->len; k++)
+  {
+    const int imgid = g_array_index(index->journal, int, k);
+    if(imgid <= 0)
+      known = FALSE;
+    else if(g_hash_table_add(seen, GINT_TO_POINTER(imgid)))
+      *imgs = g_list_prepend(*imgs, GINT_TO_POINTER(imgid));
+  }
+  dt_pthread_mutex_unlock(&index->mutex);
+  g_hash_table_destroy(seen);
+  if(!known)
+  {
+    g_list_free(*imgs);
+    *imgs = NULL;
+  }
+  return known;
+}
+
+gboolean dt_tag_index_is_attached(dt_tag_index_t *index, const guint tagid, const int imgid)
+{
+  const double start = _query_begin(index);
+  const dt_tag_index_tag_t *tag = g_hash_table_lookup(index->tags, GUINT_TO_POINTER(tagid));
+  const gboolean attached = tag && imgid > 0 && _words_test(tag->words, imgid);
+  _query_end(index, start);
+  return attached;
+}
+
+guint dt_tag_index_images_count(dt_tag_index_t *index, const guint tagid)
+{
+  const double start = _query_begin(index);
+  const dt_tag_index_tag_t *tag = g_hash_table_lookup(index->tags, GUINT_TO_POINTER(tagid));
+  const guint count = tag ? tag->count : 0;
+  _query_end(index, start);
+  return count;
+}
+
+// tags named path or below it
+static GPtrArray *_family(dt_tag_index_t *index, const char *path)
+{
+  GPtrArray *tags = g_ptr_array_new();
+  const dt_tag_index_node_t *node = _node_lookup(index->root, path, FALSE);
+  if(node) _node_collect_tags(node, tags);
+  return tags;
+}
+
+void dt_tag_index_count_family(dt_tag_index_t *index, const char *path, int *tag_count, int *img_count)
+{
+  const double start = _query_begin(index);
+  GPtrArray *tags = _family(index, path);
+  GArray *words = _words_union(tags);
+  int count = 0;
+  for(guint k = 0; k < words->len; k++)
+    count += __builtin_popcountll(g_array_index(words, dt_tag_index_word_t, k).bits);
+  *tag_count = tags->len;
+  *img_count = count;
+  g_array_free(words, TRUE);
+  g_ptr_array_free(tags, TRUE);
+  _query_end(index, start);
+}
+
+void dt_tag_index_get_family(dt_tag_index_t *index, const char *path, GList **tags, GList **images)
+{
+  const double start = _query_begin(index);
+  GPtrArray *family = _family(index, path);
+  for(guint k = 0; k < family->len; k++)
+  {
+    const dt_tag_index_tag_t *tag = (const dt_tag_index_tag_t *)g_ptr_array_index(family, k);
+    dt_tag_t *t = g_malloc0(sizeof(dt_tag_t));
+    t->id = tag->id;
+    t->tag = g_strdup(tag->node->path);
+    *tags = g_list_prepend(*tags, t);
+  }
+  GArray *words = _words_union(family);
+  GList *imgs = NULL;
+  for(guint k = 0; k < words->len; k++)
+  {
+    const dt_tag_index_word_t *w = &g_array_index(words, dt_tag_index_word_t, k);
+    for(guint64 bits = w->bits; bits; bits &= bits - 1)
+      imgs = g_list_prepend(imgs, GINT_TO_POINTER(w->index * 64 + __builtin_ctzll(bits)));
+  }
+  *images = g_list_concat(*images, g_list_reverse(imgs));
+  g_array_free(words, TRUE);
+  g_ptr_array_free(family, TRUE);
+  _query_end(index, start);
+}
+
+// tagid -> number of images of selected it is attached to
+static GHashTable *_selected_counts(dt_tag_index_t *index, const GArray *selected)
+{
+  GHashTable *counts = g_hash_table_new(NULL, NULL);
+  for(guint k = 0; selected && k < selected->len; k++)
+  {
+    const GArray *tags = g_hash_table_lookup(index->images, GINT_TO_POINTER(g_array_index(selected, int, k)));
+    for(guint i = 0; tags && i < tags->len; i++)
+    {
+      gpointer key = GUINT_TO_POINTER(g_array_index(tags, guint, i));
+      g_hash_table_insert(counts, key, GUINT_TO_POINTER(GPOINTER_TO_UINT(g_hash_table_lookup(counts, key)) + 1));
+    }
+  }
+  return counts;
+}
+
+static dt_tag_t *_tag_result(const dt_tag_index_tag_t *tag, const guint imgnb, const guint nb_selected)
+{
+  dt_tag_t *t = g_malloc0(sizeof(dt_tag_t));
+  t->tag = g_strdup(tag->node->path);
+  t->leave = g_strrstr(t->tag, "|");
+  t->leave = t->leave ? t->leave + 1 : t->tag;
+  t->id = tag->id;
+  t->count = tag->count;
+  // 0: no selection or no tag not attached
+  // 1: tag attached on some selected images
+  // 2: tag attached on all selected images
+  t->select = (nb_selected == 0) ? 0 : (imgnb == nb_selected) ? 2 : (imgnb == 0) ? 0 : 1;
+  t->flags = tag->flags;
+  t->synonym = g_strdup(tag->synonyms);
+  return t;
+}
+
+static gint _sort_by_name(gconstpointer a, gconstpointer b)
+{
+  const dt_tag_index_tag_t *ta = *(const dt_tag_index_tag_t **)a;
+  const dt_tag_index_tag_t *tb = *(const dt_tag_index_tag_t **)b;
+  return strcmp(ta->node->path, tb->node->path);
+}
+
+static gint _sort_by_count(gconstpointer a, gconstpointer b)
+{
+  const dt_tag_index_tag_t *ta = *(const dt_tag_index_tag_t **)a;
+  const dt_tag_index_tag_t *tb = *(const dt_tag_index_tag_t **)b;
+  if(ta->count != tb->count) return ta->count < tb->count ? 1 : -1;
+  return strcmp(ta->node->path, tb->node->path);
+}
+
+// the tags of the index matching suggestions or not, as a sorted list of dt_tag_t
+static GList *_get_tags(dt_tag_index_t *index, const GArray *selected, const gboolean suggestions,
+                        const guint limit)
+{
+  const guint nb_selected = selected ? selected->len : 0;
+  GHashTable *counts = _selected_counts(index, selected);
+  GPtrArray *tags = g_ptr_array_new();
+  GHashTableIter it;
+  gpointer value;
+  g_hash_table_iter_init(&it, index->tags);
+  while(g_hash_table_iter_next(&it, NULL, &value))
+  {
+    const dt_tag_index_tag_t *tag = (const dt_tag_index_tag_t *)value;
+    if(tag->darktable) continue;
+    if(suggestions)
+    {
+      const guint imgnb = GPOINTER_TO_UINT(g_hash_table_lookup(counts, GUINT_TO_POINTER(tag->id)));
+      if(!tag->count || (tag->flags & DT_TF_CATEGORY) || (nb_selected && imgnb == nb_selected)) continue;
+    }
+    g_ptr_array_add(tags, value);
+  }
+  g_ptr_array_sort(tags, suggestions ? _sort_by_count : _sort_by_name);
+  if(tags->len > limit) g_ptr_array_set_size(tags, limit);
+
+  GList *result = NULL;
+  for(guint k = tags->len; k > 0; k--)
+  {
+    const dt_tag_index_tag_t *tag = (const dt_tag_index_tag_t *)g_ptr_array_index(tags, k - 1);
+    const guint imgnb = GPOINTER_TO_UINT(g_hash_table_lookup(counts, GUINT_TO_POINTER(tag->id)));
+    result = g_list_prepend(result, _tag_result(tag, imgnb, nb_selected));
+  }
+  g_ptr_array_free(tags, TRUE);
+  g_hash_table_destroy(counts);
+  return result;
+}
+
+GList *dt_tag_index_get_tags(dt_tag_index_t *index, const GArray *selected)
+{
+  const double start = _query_begin(index);
+  GList *result = _get_tags(index, selected, FALSE, G_MAXUINT);
+  _query_end(index, start);
+  return result;
+}
+
+GList *dt_tag_index_get_suggestions(dt_tag_index_t *index, const GArray *selected, const guint limit)
+{
+  const double start = _query_begin(index);
+  GList *result = _get_tags(index, selected, TRUE, limit);
+  _query_end(index, start);
+  return result;
+}
+
+GHashTable *dt_tag_index_match(dt_tag_index_t *index, const char *keyword)
+{
+  GHashTable *paths = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  if(!keyword || !keyword[0]) return paths;
+
+  gchar *needle = g_utf8_strdown(keyword, -1);
+  const double start = _query_begin(index);
+  // whatever contains the new keyword also contains the last one if that is a part of it
+  if(!index->needle || !strstr(needle, index->needle))
+  {
+    g_ptr_array_set_size(index->matches, 0);
+    _node_collect(index->root, index->matches);
+  }
+  guint n = 0;
+  for(guint k = 0; k < index->matches->len; k++)
+  {
+    dt_tag_index_node_t *node = (dt_tag_index_node_t *)g_ptr_array_index(index->matches, k);
+    if(strstr(node->haystack, needle))
+    {
+      g_ptr_array_index(index->matches, n++) = node;
+      g_hash_table_add(paths, g_strdup(node->path));
+    }
+  }
+  g_ptr_array_set_size(index->matches, n);
+  g_free(index->needle);
+  index->needle = needle;
+  _query_end(index, start);
+  return paths;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,95 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/dtpthread.h"
+
+#include <glib.h>
+
+// all tags and the images they are attached to, kept in memory so that the tagging module doesn't go to the
+// database on every key press. tags hang in a trie over the '|' separated components of their names, the images
+// of a tag are a sparse bitset. it is read from the database on first use and kept in sync by tags.c.
+typedef struct dt_tag_index_t
+{
+  dt_pthread_mutex_t mutex; // protects everything below
+  gboolean loaded;          // FALSE until first use and after dt_tag_index_invalidate()
+  GHashTable *tags;         // tagid -> dt_tag_index_tag_t
+  GHashTable *images;       // imgid -> GArray of the tagids attached to it
+  struct dt_tag_index_node_t *root;
+
+  // nodes matching the last keyword. typing more characters only has to look at those again.
+  gchar *needle;
+  GPtrArray *matches;
+
+  // the images whose tags changed, so that others can catch up with the changes without reading everything
+  // again. entry k is change number journal_start + k, 0 for a change not tied to some images.
+  guint64 changes;
+  guint64 journal_start;
+  GArray *journal;
+
+  // statistics, printed with -d perf
+  guint64 loads, queries;
+  double load_time, query_time;
+} dt_tag_index_t;
+
+void dt_tag_index_init(dt_tag_index_t *index);
+void dt_tag_index_cleanup(dt_tag_index_t *index);
+
+/** drop everything, it is read from the database again when needed. for changes done in sql behind its back. */
+void dt_tag_index_invalidate(dt_tag_index_t *index);
+
+/* keeping it in sync. to be called once the database has been changed, calling them twice does no harm. */
+
+void dt_tag_index_tag_new(dt_tag_index_t *index, const guint tagid, const char *name);
+void dt_tag_index_tag_remove(dt_tag_index_t *index, const guint tagid);
+void dt_tag_index_tag_rename(dt_tag_index_t *index, const guint tagid, const char *name);
+void dt_tag_index_tag_set_flags(dt_tag_index_t *index, const guint tagid, const gint flags);
+void dt_tag_index_tag_set_synonyms(dt_tag_index_t *index, const guint tagid, const char *synonyms);
+void dt_tag_index_attach(dt_tag_index_t *index, const guint tagid, const int imgid);
+void dt_tag_index_detach(dt_tag_index_t *index, const guint tagid, const int imgid);
+/** newid got all tags of imgid, for duplicates. */
+void dt_tag_index_image_copy(dt_tag_index_t *index, const int newid, const int imgid);
+void dt_tag_index_image_remove(dt_tag_index_t *index, const int imgid);
+
+/** the number of changes so far, to be handed to dt_tag_index_changes_since() later. */
+guint64 dt_tag_index_changes(dt_tag_index_t *index);
+/** the images whose tags changed after change number since as a list of distinct imgids, and the number of
+ * changes now. returns FALSE if that is not known, because it was too long ago or a tag got renamed or removed. */
+gboolean dt_tag_index_changes_since(dt_tag_index_t *index, const guint64 since, GList **imgs, guint64 *now);
+
+/* queries. selected is an array of the int imgids the selection state is computed for, can be NULL. */
+
+gboolean dt_tag_index_is_attached(dt_tag_index_t *index, const guint tagid, const int imgid);
+/** number of images tagid is attached to. */
+guint dt_tag_index_images_count(dt_tag_index_t *index, const guint tagid);
+/** tags named path or below it, and the number of distinct images they are attached to. */
+void dt_tag_index_count_family(dt_tag_index_t *index, const char *path, int *tag_count, int *img_count);
+/** same as above, as a list of dt_tag_t with id and tag set, and a list of imgids. */
+void dt_tag_index_get_family(dt_tag_index_t *index, const char *path, GList **tags, GList **images);
+/** all tags but the darktable| ones as a list of dt_tag_t sorted by name, with count and select filled in. */
+GList *dt_tag_index_get_tags(dt_tag_index_t *index, const GArray *selected);
+/** the limit most used tags which are no category and not attached to all of selected, by count. */
+GList *dt_tag_index_get_suggestions(dt_tag_index_t *index, const GArray *selected, const guint limit);
+/** set of the paths of tags and path components whose name or synonyms contain keyword, ignoring case. the
+ * hash table belongs to the caller. */
+GHashTable *dt_tag_index_match(dt_tag_index_t *index, const char *keyword);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
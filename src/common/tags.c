@@ -21,6 +21,7 @@
 #include "common/collection.h"
 #include "common/darktable.h"
 #include "common/debug.h"
+#include "common/tag_index.h"
 #include "common/undo.h"
 #include "common/grouping.h"
 #include "control/conf.h"
@@ -125,6 +126,11 @@ static void _pop_undo_execute(const int imgid, GList *before, GList *after)
 
   g_free(tobe_removed_list);
   g_free(tobe_added_list);
+
+  for(GList *b = before; b; b = g_list_next(b))
+    if(!g_list_find(after, b->data)) dt_tag_index_detach(darktable.tag_index, GPOINTER_TO_UINT(b->data), imgid);
+  for(GList *a = after; a; a = g_list_next(a))
+    if(!g_list_find(before, a->data)) dt_tag_index_attach(darktable.tag_index, GPOINTER_TO_UINT(a->data), imgid);
 }
 
 static void _pop_undo(gpointer user_data, dt_undo_type_t type, dt_undo_data_t data, dt_undo_action_t action, GList **imgs)
@@ -230,15 +236,15 @@ gboolean dt_tag_new(const char *name, guint *tagid)
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
 
-  if(tagid != NULL)
-  {
-    *tagid = 0;
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT id FROM data.tags WHERE name = ?1", -1,
-                                &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, -1, SQLITE_TRANSIENT);
-    if(sqlite3_step(stmt) == SQLITE_ROW) *tagid = sqlite3_column_int(stmt, 0);
-    sqlite3_finalize(stmt);
-  }
+  guint id = 0;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT id FROM data.tags WHERE name = ?1", -1,
+                              &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, -1, SQLITE_TRANSIENT);
+  if(sqlite3_step(stmt) == SQLITE_ROW) id = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+
+  if(id) dt_tag_index_tag_new(darktable.tag_index, id, name);
+  if(tagid != NULL) *tagid = id;
 
   return TRUE;
 }
@@ -278,6 +284,8 @@ guint dt_tag_remove(const guint tagid, gboolean final)
     sqlite3_step(stmt);
     sqlite3_finalize(stmt);
 
+    dt_tag_index_tag_remove(darktable.tag_index, tagid);
+
     /* raise signal of tags change to refresh keywords module */
     dt_control_signal_raise(darktable.signals, DT_SIGNAL_TAG_CHANGED);
   }
@@ -333,6 +341,8 @@ guint dt_tag_remove_list(GList *tag_list)
     g_free(flatlist);
     tcount = tcount + count;
   }
+  for (GList *taglist = tag_list; taglist ; taglist = g_list_next(taglist))
+    dt_tag_index_tag_remove(darktable.tag_index, ((dt_tag_t *)taglist->data)->id);
   /* raise signal of tags change to refresh keywords module */
   dt_control_signal_raise(darktable.signals, DT_SIGNAL_TAG_CHANGED);
   return tcount;
@@ -367,6 +377,7 @@ void dt_tag_rename(const guint tagid, const gchar *new_tagname)
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
 
+  dt_tag_index_tag_rename(darktable.tag_index, tagid, new_tagname);
 }
 
 gboolean dt_tag_exists(const char *name, guint *tagid)
@@ -1013,207 +1024,74 @@ GList *dt_tag_get_hierarchical_export(gint imgid, int32_t flags)
   return tags;
 }
 
-gboolean dt_is_tag_attached(const guint tagid, const gint imgid)
+// the imgids of the selected images
+static GArray *_get_selected_images()
 {
+  GArray *selected = g_array_new(FALSE, FALSE, sizeof(int));
   sqlite3_stmt *stmt;
-
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT imgid"
-                              " FROM main.tagged_images"
-                              " WHERE imgid = ?1 AND tagid = ?2", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, tagid);
-
-  const gboolean ret = (sqlite3_step(stmt) == SQLITE_ROW);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT imgid FROM main.selected_images", -1, &stmt,
+                              NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const int imgid = sqlite3_column_int(stmt, 0);
+    g_array_append_val(selected, imgid);
+  }
   sqlite3_finalize(stmt);
-  return ret;
+  return selected;
+}
+
+gboolean dt_is_tag_attached(const guint tagid, const gint imgid)
+{
+  return dt_tag_index_is_attached(darktable.tag_index, tagid, imgid);
 }
 
 GList *dt_tag_get_images_from_selection(gint imgid, gint tagid)
 {
   GList *result = NULL;
-  sqlite3_stmt *stmt;
 
   if(imgid > 0)
   {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT imgid FROM main.tagged_images WHERE "
-                                "imgid = ?1 AND tagid = ?2", -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, tagid);
-  }
-  else
-  {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT imgid FROM main.tagged_images WHERE "
-                                "tagid = ?1 AND imgid IN (SELECT imgid FROM main.selected_images)", -1, &stmt,
-                                NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
+    if(dt_tag_index_is_attached(darktable.tag_index, tagid, imgid))
+      result = g_list_append(result, GINT_TO_POINTER(imgid));
+    return result;
   }
 
-
-  while(sqlite3_step(stmt) == SQLITE_ROW)
+  GArray *selected = _get_selected_images();
+  for(guint k = selected->len; k > 0; k--)
   {
-    int id = sqlite3_column_int(stmt, 0);
-    result = g_list_append(result, GINT_TO_POINTER(id));
+    const int id = g_array_index(selected, int, k - 1);
+    if(dt_tag_index_is_attached(darktable.tag_index, tagid, id))
+      result = g_list_prepend(result, GINT_TO_POINTER(id));
   }
-
-  sqlite3_finalize(stmt);
+  g_array_free(selected, TRUE);
 
   return result;
 }
 
 uint32_t dt_tag_get_suggestions(GList **result)
 {
-  sqlite3_stmt *stmt;
-
-  dt_set_darktable_tags();
-
-  /* list tags and count */
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "INSERT INTO memory.taglist (id, count)"
-                              " SELECT S.tagid, COUNT(*)"
-                              "  FROM main.tagged_images AS S"
-                              "  WHERE S.tagid NOT IN memory.darktable_tags"
-                              "  GROUP BY S.tagid",
-                              -1, &stmt, NULL);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-
-  const uint32_t nb_selected = dt_selected_images_count();
-  /* Now put all the bits together */
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT T.name, T.id, MT.count, CT.imgnb, T.flags, T.synonyms "
-                              "FROM memory.taglist MT "
-                              "JOIN data.tags T ON MT.id = T.id "
-                              "LEFT JOIN (SELECT tagid, COUNT(DISTINCT imgid) AS imgnb FROM main.tagged_images "
-                                "WHERE imgid IN (SELECT imgid FROM main.selected_images) GROUP BY tagid) AS CT "
-                                "ON CT.tagid = MT.id "
-                              "WHERE T.id NOT IN (SELECT DISTINCT tagid "
-                                "FROM (SELECT TI.tagid, COUNT(DISTINCT SI.imgid) AS imgnb "
-                                  "FROM main.selected_images AS SI "
-                                  "JOIN main.tagged_images AS TI ON TI.imgid = SI.imgid "
-                                  "GROUP BY TI.tagid) "
-                                  "WHERE imgnb = ?1) "
-                              "AND (T.flags IS NULL OR (T.flags & 1) = 0) "
-                              "ORDER BY MT.count DESC "
-                              "LIMIT 500",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, nb_selected);
-
-  /* ... and create the result list to send upwards */
-  uint32_t count = 0;
-  while(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    dt_tag_t *t = g_malloc0(sizeof(dt_tag_t));
-    t->tag = g_strdup((char *)sqlite3_column_text(stmt, 0));
-    t->leave = g_strrstr(t->tag, "|");
-    t->leave = t->leave ? t->leave + 1 : t->tag;
-    t->id = sqlite3_column_int(stmt, 1);
-    t->count = sqlite3_column_int(stmt, 2);
-    uint32_t imgnb = sqlite3_column_int(stmt, 3);
-    // 0: no selection or no tag not attached
-    // 1: tag attached on some selected images
-    // 2: tag attached on all selected images
-    t->select = (nb_selected == 0) ? 0 : (imgnb == nb_selected) ? 2 : (imgnb == 0) ? 0 : 1;
-    t->flags = sqlite3_column_int(stmt, 4);
-    t->synonym = g_strdup((char *)sqlite3_column_text(stmt, 5));
-    *result = g_list_append(*result, t);
-    count++;
-  }
-
-  sqlite3_finalize(stmt);
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.taglist", NULL, NULL, NULL);
+  GArray *selected = _get_selected_images();
+  GList *tags = dt_tag_index_get_suggestions(darktable.tag_index, selected, 500);
+  g_array_free(selected, TRUE);
 
+  const uint32_t count = g_list_length(tags);
+  *result = g_list_concat(*result, tags);
   return count;
 }
 
 void dt_tag_count_tags_images(const gchar *keyword, int *tag_count, int *img_count)
 {
-  sqlite3_stmt *stmt;
   *tag_count = 0;
   *img_count = 0;
 
   if(!keyword) return;
-  gchar *keyword_expr = g_strdup_printf("%s|", keyword);
-
-  /* Only select tags that are equal or child to the one we are looking for once. */
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "INSERT INTO memory.similar_tags (tagid) SELECT id FROM data.tags "
-                              "WHERE name = ?1 OR SUBSTR(name, 1, LENGTH(?2)) = ?2 ",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, keyword, -1, SQLITE_TRANSIENT);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, keyword_expr, -1, SQLITE_TRANSIENT);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-
-  g_free(keyword_expr);
-
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT COUNT(DISTINCT tagid) FROM memory.similar_tags",
-                              -1, &stmt, NULL);
-  sqlite3_step(stmt);
-  *tag_count = sqlite3_column_int(stmt, 0);
-  sqlite3_finalize(stmt);
-
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT COUNT(DISTINCT ti.imgid) FROM main.tagged_images AS ti "
-                              "JOIN memory.similar_tags AS st ON st.tagid = ti.tagid",
-                              -1, &stmt, NULL);
-
-  sqlite3_step(stmt);
-  *img_count = sqlite3_column_int(stmt, 0);
-  sqlite3_finalize(stmt);
-
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.similar_tags", NULL, NULL, NULL);
-  }
+  dt_tag_index_count_family(darktable.tag_index, keyword, tag_count, img_count);
+}
 
 void dt_tag_get_tags_images(const gchar *keyword, GList **tag_list, GList **img_list)
 {
-  sqlite3_stmt *stmt;
-
   if(!keyword) return;
-  gchar *keyword_expr = g_strdup_printf("%s|", keyword);
-
-/* Only select tags that are equal or child to the one we are looking for once. */
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "INSERT INTO memory.similar_tags (tagid) SELECT id FROM data.tags "
-                              "WHERE name = ?1 OR SUBSTR(name, 1, LENGTH(?2)) = ?2 ",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, keyword, -1, SQLITE_TRANSIENT);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, keyword_expr, -1, SQLITE_TRANSIENT);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-
-  g_free(keyword_expr);
-
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT ST.tagid, T.name"
-                              " FROM memory.similar_tags ST"
-                              " JOIN data.tags T"
-                              "   ON T.id = ST.tagid ",
-                              -1, &stmt, NULL);
-
-  while(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    dt_tag_t *t = g_malloc0(sizeof(dt_tag_t));
-    t->id = sqlite3_column_int(stmt, 0);
-    t->tag = g_strdup((char *)sqlite3_column_text(stmt, 1));
-    *tag_list = g_list_append((*tag_list), t);
-  }
-  sqlite3_finalize(stmt);
-
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT DISTINCT ti.imgid"
-                              " FROM main.tagged_images AS ti"
-                              " JOIN memory.similar_tags AS st"
-                              "   ON st.tagid = ti.tagid",
-                              -1, &stmt, NULL);
-  while(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    *img_list = g_list_append((*img_list), GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
-  }
-  sqlite3_finalize(stmt);
-
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.similar_tags", NULL, NULL, NULL);
+  dt_tag_index_get_family(darktable.tag_index, keyword, tag_list, img_list);
 }
 
 uint32_t dt_selected_images_count()
@@ -1231,73 +1109,17 @@ uint32_t dt_selected_images_count()
 
 uint32_t dt_tag_images_count(gint tagid)
 {
-  sqlite3_stmt *stmt;
-
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT COUNT(DISTINCT imgid) AS imgnb"
-                              " FROM main.tagged_images"
-                              " WHERE tagid = ?1",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
-  sqlite3_step(stmt);
-  const uint32_t nb_images = sqlite3_column_int(stmt, 0);
-  sqlite3_finalize(stmt);
-  return nb_images;
+  return dt_tag_index_images_count(darktable.tag_index, tagid);
 }
 
 uint32_t dt_tag_get_with_usage(GList **result)
 {
-  sqlite3_stmt *stmt;
-
-  dt_set_darktable_tags();
-
-  /* Select tags that are similar to the keyword and are actually used to tag images*/
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "INSERT INTO memory.taglist (id, count) SELECT tagid, COUNT(*)"
-                              " FROM main.tagged_images"
-                              " GROUP BY tagid",
-                              -1, &stmt, NULL);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-
-  const uint32_t nb_selected = dt_selected_images_count();
-
-  /* Now put all the bits together */
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT T.name, T.id, MT.count, CT.imgnb, T.flags, T.synonyms "
-                              "FROM data.tags T "
-                              "LEFT JOIN memory.taglist MT ON MT.id = T.id "
-                              "LEFT JOIN (SELECT tagid, COUNT(DISTINCT imgid) AS imgnb FROM main.tagged_images "
-                                "WHERE imgid IN (SELECT imgid FROM main.selected_images) GROUP BY tagid) AS CT "
-                                "ON CT.tagid = T.id "
-                              "WHERE T.id NOT IN memory.darktable_tags "
-                              "ORDER BY T.name ",
-                              -1, &stmt, NULL);
-
-  /* ... and create the result list to send upwards */
-  uint32_t count = 0;
-  while(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    dt_tag_t *t = g_malloc0(sizeof(dt_tag_t));
-    t->tag = g_strdup((char *)sqlite3_column_text(stmt, 0));
-    t->leave = g_strrstr(t->tag, "|");
-    t->leave = t->leave ? t->leave + 1 : t->tag;
-    t->id = sqlite3_column_int(stmt, 1);
-    t->count = sqlite3_column_int(stmt, 2);
-    uint32_t imgnb = sqlite3_column_int(stmt, 3);
-    // 0: no selection or no tag not attached
-    // 1: tag attached on some selected images
-    // 2: tag attached on all selected images
-    t->select = (nb_selected == 0) ? 0 : (imgnb == nb_selected) ? 2 : (imgnb == 0) ? 0 : 1;
-    t->flags = sqlite3_column_int(stmt, 4);
-    t->synonym = g_strdup((char *)sqlite3_column_text(stmt, 5));
-    *result = g_list_append(*result, t);
-    count++;
-  }
-
-  sqlite3_finalize(stmt);
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.taglist", NULL, NULL, NULL);
+  GArray *selected = _get_selected_images();
+  GList *tags = dt_tag_index_get_tags(darktable.tag_index, selected);
+  g_array_free(selected, TRUE);
 
+  const uint32_t count = g_list_length(tags);
+  *result = g_list_concat(*result, tags);
   return count;
 }
 
@@ -1368,6 +1190,7 @@ void dt_tag_set_synonyms(gint tagid, gchar *synonyms_entry)
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, synonyms, -1, SQLITE_TRANSIENT);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
+  dt_tag_index_tag_set_synonyms(darktable.tag_index, tagid, synonyms);
   g_free(synonyms);
 }
 
@@ -1400,6 +1223,7 @@ void dt_tag_set_flags(gint tagid, gint flags)
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, flags);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
+  dt_tag_index_tag_set_flags(darktable.tag_index, tagid, flags);
 }
 
 void dt_tag_add_synonym(gint tagid, gchar *synonym)
@@ -1421,6 +1245,7 @@ void dt_tag_add_synonym(gint tagid, gchar *synonym)
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, synonyms, -1, SQLITE_TRANSIENT);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
+  dt_tag_index_tag_set_synonyms(darktable.tag_index, tagid, synonyms);
   g_free(synonyms);
 }
 
@@ -181,10 +181,17 @@ typedef struct dt_control_t
   pthread_cond_t cond;
   int32_t num_threads;
   pthread_t *thread, kick_on_workers_thread;
-  dt_job_t **job;
+  dt_job_t **job;                           // the job each worker runs, for job deduping
+  dt_pthread_mutex_t *worker_mutex;         // per worker, guards job[k] and the worker's stats
 
+  // DT_JOB_QUEUE_SYSTEM_FG is a bounded stack with deduplication which needs a global view (queue_mutex).
+  // all other queues are FIFOs split into one deque per worker, idle workers steal from the others.
   GList *queues[DT_JOB_QUEUE_MAX];
-  size_t queue_length[DT_JOB_QUEUE_MAX];
+  size_t queue_length[DT_JOB_QUEUE_MAX];   // total over all deques, atomically updated
+  int32_t queue_priority[DT_JOB_QUEUE_MAX]; // aged whenever another queue wins
+  struct dt_control_job_deque_t *deques;   // num_threads * DT_JOB_QUEUE_MAX
+  uint32_t next_deque;                     // round robin target for jobs added from outside the pool
+  dt_control_job_stats_t *worker_stats;     // num_threads * DT_JOB_QUEUE_MAX, summed up when printed
 
   dt_pthread_mutex_t res_mutex;
   dt_job_t *job_res[DT_CTL_WORKER_RESERVED];
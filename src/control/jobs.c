@@ -36,6 +36,14 @@ typedef struct worker_thread_parameters_t
   int32_t threadid;
 } worker_thread_parameters_t;
 
+// one per worker and queue. the owner and thieves both take the oldest job,
+// so jobs of a queue still start in (roughly) the order they were added.
+typedef struct dt_control_job_deque_t
+{
+  dt_pthread_mutex_t mutex;
+  GQueue jobs;
+} dt_control_job_deque_t;
+
 typedef struct _dt_job_t
 {
   dt_job_execute_callback execute;
@@ -55,6 +63,8 @@ typedef struct _dt_job_t
 
   dt_progress_t *progress;
 
+  double queued_time, start_time;
+
   char description[DT_CONTROL_DESCRIPTION_LEN];
 } _dt_job_t;
 
@@ -228,69 +238,185 @@ static int32_t dt_control_run_job_res(dt_control_t *control, int32_t res)
   return 0;
 }
 
+static const int32_t _queue_base_priority[DT_JOB_QUEUE_MAX] = {
+  DT_CONTROL_FG_PRIORITY, // DT_JOB_QUEUE_USER_FG
+  DT_CONTROL_FG_PRIORITY, // DT_JOB_QUEUE_SYSTEM_FG
+  0,                      // DT_JOB_QUEUE_USER_BG
+  0,                      // DT_JOB_QUEUE_USER_EXPORT
+  0,                      // DT_JOB_QUEUE_SYSTEM_BG
+};
+
+// the worker index of the calling thread, -1 for all threads outside of the pool
+static __thread int worker_index = -1;
+
+static inline dt_control_job_deque_t *_get_deque(dt_control_t *control, const int worker, const int queue)
+{
+  return control->deques + (size_t)worker * DT_JOB_QUEUE_MAX + queue;
+}
+
+static _dt_job_t *_deque_pop(dt_control_job_deque_t *deque)
+{
+  dt_pthread_mutex_lock(&deque->mutex);
+  _dt_job_t *job = (_dt_job_t *)g_queue_pop_head(&deque->jobs);
+  dt_pthread_mutex_unlock(&deque->mutex);
+  return job;
+}
+
+// the scheduled job array is read by dt_control_add_job() while holding queue_mutex, the slot of each worker is
+// guarded by its own mutex so that the workers do not need queue_mutex for every job.
+static void _set_worker_job(dt_control_t *control, _dt_job_t *job)
+{
+  const int32_t threadid = dt_control_get_threadid();
+  dt_pthread_mutex_lock(&control->worker_mutex[threadid]);
+  control->job[threadid] = job;
+  dt_pthread_mutex_unlock(&control->worker_mutex[threadid]);
+}
+
+// take the oldest job of the given queue: from our own deque first, then steal.
+static _dt_job_t *_queue_pop(dt_control_t *control, const int queue)
+{
+  _dt_job_t *job = NULL;
+  if(queue == DT_JOB_QUEUE_SYSTEM_FG)
+  {
+    dt_pthread_mutex_lock(&control->queue_mutex);
+    if(control->queues[queue])
+    {
+      job = (_dt_job_t *)control->queues[queue]->data;
+      control->queues[queue] = g_list_delete_link(control->queues[queue], control->queues[queue]);
+      control->queue_length[queue]--;
+      // place it in scheduled job array (for job deduping) before anybody can miss it in the queue
+      _set_worker_job(control, job);
+    }
+    dt_pthread_mutex_unlock(&control->queue_mutex);
+  }
+  else
+  {
+    const int self = MAX(worker_index, 0);
+    for(int k = 0; k < control->num_threads && !job; k++)
+      job = _deque_pop(_get_deque(control, (self + k) % control->num_threads, queue));
+    if(job)
+    {
+      __sync_fetch_and_sub(&control->queue_length[queue], 1);
+      _set_worker_job(control, job);
+    }
+  }
+  return job;
+}
+
 static _dt_job_t *dt_control_schedule_job(dt_control_t *control)
 {
   /*
    * job scheduling works like this:
-   * - when there is a single job in the queue head with a maximal priority -> pick it
+   * - when there is a single queue with a maximal priority -> pick its oldest job
    * - otherwise pick among the ones with the maximal priority in the following order:
    *   * user foreground
    *   * system foreground
    *   * user background
    *   * system background
-   * - the jobs that didn't get picked this round get their priority incremented
+   * - the queues that didn't get picked this round get their priority incremented
+   *
+   * jobs of all queues but the system foreground stack live in per worker deques,
+   * idle workers steal from the others, so there is no global lock on this path.
    */
 
-  dt_pthread_mutex_lock(&control->queue_mutex);
-
-  // find the job
   _dt_job_t *job = NULL;
   int winner_queue = DT_JOB_QUEUE_MAX;
-  int max_priority = -1;
-  for(int i = 0; i < DT_JOB_QUEUE_MAX; i++)
+  int tried = 0;
+  while(!job)
   {
-    if(control->queues[i] == NULL) continue;
-    if(control->export_scheduled && i == DT_JOB_QUEUE_USER_EXPORT) continue;
-    _dt_job_t *_job = (_dt_job_t *)control->queues[i]->data;
-    if(_job->priority > max_priority)
+    // find the queue
+    winner_queue = DT_JOB_QUEUE_MAX;
+    int max_priority = -1;
+    for(int i = 0; i < DT_JOB_QUEUE_MAX; i++)
     {
-      max_priority = _job->priority;
-      job = _job;
-      winner_queue = i;
+      if((tried & (1 << i)) || control->queue_length[i] == 0) continue;
+      if(control->export_scheduled && i == DT_JOB_QUEUE_USER_EXPORT) continue;
+      const int priority = control->queue_priority[i];
+      if(priority > max_priority)
+      {
+        max_priority = priority;
+        winner_queue = i;
+      }
     }
-  }
+    if(winner_queue == DT_JOB_QUEUE_MAX) return NULL;
+    tried |= 1 << winner_queue;
 
-  if(!job)
-  {
-    dt_pthread_mutex_unlock(&control->queue_mutex);
-    return NULL;
+    if(winner_queue == DT_JOB_QUEUE_USER_EXPORT)
+    {
+      // claim the one export slot before taking the job
+      if(!__sync_bool_compare_and_swap(&control->export_scheduled, FALSE, TRUE)) continue;
+      job = _queue_pop(control, winner_queue);
+      if(!job) control->export_scheduled = FALSE;
+    }
+    else
+      job = _queue_pop(control, winner_queue);
   }
 
-  // the order of the queues in control->queues matches our priority, and we only update job when the priority
+  // the order of the queues matches our priority, and we only update the winner when the priority
   // is strictly bigger
   // invariant -> job is the one we are looking for
 
-  // remove the to be scheduled job from its queue
-  GList **queue = &control->queues[winner_queue];
-  *queue = g_list_delete_link(*queue, *queue);
-  control->queue_length[winner_queue]--;
-  if(winner_queue == DT_JOB_QUEUE_USER_EXPORT) control->export_scheduled = TRUE;
-
-  // and place it in scheduled job array (for job deduping)
-  control->job[dt_control_get_threadid()] = job;
-
-  // increment the priorities of the others
+  // reset the priority of the winner and increment the priorities of the others
+  int32_t priority;
+  do
+    priority = control->queue_priority[winner_queue];
+  while(!__sync_bool_compare_and_swap(&control->queue_priority[winner_queue], priority,
+                                      _queue_base_priority[winner_queue]));
   for(int i = 0; i < DT_JOB_QUEUE_MAX; i++)
   {
-    if(i == winner_queue || control->queues[i] == NULL) continue;
-    ((_dt_job_t *)control->queues[i]->data)->priority++;
+    if(i == winner_queue || control->queue_length[i] == 0) continue;
+    __sync_fetch_and_add(&control->queue_priority[i], 1);
   }
 
-  dt_pthread_mutex_unlock(&control->queue_mutex);
-
+  job->start_time = dt_get_wtime();
   return job;
 }
 
+// called by the worker with its worker_mutex held
+static void _update_stats(dt_control_t *control, _dt_job_t *job)
+{
+  const double end = dt_get_wtime();
+  const double wait = job->start_time - job->queued_time;
+  const double run = end - job->start_time;
+  dt_control_job_stats_t *stats
+      = &control->worker_stats[(size_t)dt_control_get_threadid() * DT_JOB_QUEUE_MAX + job->queue];
+  stats->jobs++;
+  stats->wait_total += wait;
+  stats->wait_max = MAX(stats->wait_max, wait);
+  stats->run_total += run;
+  dt_print(DT_DEBUG_PERF, "[jobs] queue %d: `%s' waited %.3f secs, ran %.3f secs\n", job->queue, job->description,
+           wait, run);
+}
+
+void dt_control_jobs_print_stats(dt_control_t *control)
+{
+  if(!(darktable.unmuted & DT_DEBUG_PERF)) return;
+  static const char *names[DT_JOB_QUEUE_MAX] = { "user fg", "system fg", "user bg", "user export", "system bg" };
+  dt_control_job_stats_t total[DT_JOB_QUEUE_MAX] = { { 0 } };
+  for(int k = 0; k < control->num_threads; k++)
+  {
+    dt_pthread_mutex_lock(&control->worker_mutex[k]);
+    for(int i = 0; i < DT_JOB_QUEUE_MAX; i++)
+    {
+      const dt_control_job_stats_t *stats = &control->worker_stats[(size_t)k * DT_JOB_QUEUE_MAX + i];
+      total[i].jobs += stats->jobs;
+      total[i].wait_total += stats->wait_total;
+      total[i].wait_max = MAX(total[i].wait_max, stats->wait_max);
+      total[i].run_total += stats->run_total;
+    }
+    dt_pthread_mutex_unlock(&control->worker_mutex[k]);
+  }
+  for(int i = 0; i < DT_JOB_QUEUE_MAX; i++)
+  {
+    const dt_control_job_stats_t *stats = &total[i];
+    if(!stats->jobs) continue;
+    dt_print(DT_DEBUG_PERF,
+             "[jobs] %-11s %6" PRIu64 " jobs, wait avg %.3f max %.3f secs, run avg %.3f secs, %.2f jobs/sec\n",
+             names[i], stats->jobs, stats->wait_total / stats->jobs, stats->wait_max,
+             stats->run_total / stats->jobs, stats->run_total > 0.0 ? stats->jobs / stats->run_total : 0.0);
+  }
+}
+
 static void dt_control_job_execute(_dt_job_t *job)
 {
   dt_print(DT_DEBUG_CONTROL, "[run_job+] %02d %f ", DT_CTL_WORKER_RESERVED + dt_control_get_threadid(),
@@ -325,10 +451,13 @@ static int32_t dt_control_run_job(dt_control_t *control)
   dt_pthread_mutex_unlock(&job->wait_mutex);
 
   // remove the job from scheduled job array (for job deduping)
-  dt_pthread_mutex_lock(&control->queue_mutex);
-  control->job[dt_control_get_threadid()] = NULL;
-  if(job->queue == DT_JOB_QUEUE_USER_EXPORT) control->export_scheduled = FALSE;
-  dt_pthread_mutex_unlock(&control->queue_mutex);
+  const int32_t threadid = dt_control_get_threadid();
+  dt_pthread_mutex_lock(&control->worker_mutex[threadid]);
+  control->job[threadid] = NULL;
+  _update_stats(control, job);
+  dt_pthread_mutex_unlock(&control->worker_mutex[threadid]);
+  if(job->queue == DT_JOB_QUEUE_USER_EXPORT)
+    __sync_bool_compare_and_swap(&control->export_scheduled, TRUE, FALSE);
 
   // and free it
   dt_control_job_dispose(job);
@@ -391,33 +520,39 @@ int dt_control_add_job(dt_control_t *control, dt_job_queue_t queue_id, _dt_job_t
   }
 
   job->queue = queue_id;
+  job->queued_time = dt_get_wtime();
 
   _dt_job_t *job_for_disposal = NULL;
 
-  dt_pthread_mutex_lock(&control->queue_mutex);
-
-  GList **queue = &control->queues[queue_id];
-  size_t length = control->queue_length[queue_id];
-
-  dt_print(DT_DEBUG_CONTROL, "[add_job] %zu | ", length);
+  dt_print(DT_DEBUG_CONTROL, "[add_job] %zu | ", control->queue_length[queue_id]);
   dt_control_job_print(job);
   dt_print(DT_DEBUG_CONTROL, "\n");
 
   if(queue_id == DT_JOB_QUEUE_SYSTEM_FG)
   {
+    dt_pthread_mutex_lock(&control->queue_mutex);
+
+    GList **queue = &control->queues[queue_id];
+    size_t length = control->queue_length[queue_id];
+
     // this is a stack with limited size and bubble up and all that stuff
     job->priority = DT_CONTROL_FG_PRIORITY;
 
     // check if we have already scheduled the job
     for(int k = 0; k < control->num_threads; k++)
     {
+      dt_pthread_mutex_lock(&control->worker_mutex[k]);
       _dt_job_t *other_job = (_dt_job_t *)control->job[k];
-      if(dt_control_job_equal(job, other_job))
+      const int scheduled = dt_control_job_equal(job, other_job);
+      if(scheduled)
       {
         dt_print(DT_DEBUG_CONTROL, "[add_job] found job already in scheduled: ");
         dt_control_job_print(other_job);
         dt_print(DT_DEBUG_CONTROL, "\n");
-
+      }
+      dt_pthread_mutex_unlock(&control->worker_mutex[k]);
+      if(scheduled)
+      {
         dt_pthread_mutex_unlock(&control->queue_mutex);
 
         dt_control_job_set_state(job, DT_JOB_STATE_DISCARDED);
@@ -462,21 +597,22 @@ int dt_control_add_job(dt_control_t *control, dt_job_queue_t queue_id, _dt_job_t
     }
 
     control->queue_length[queue_id] = length;
+    dt_control_job_set_state(job, DT_JOB_STATE_QUEUED);
+    dt_pthread_mutex_unlock(&control->queue_mutex);
   }
   else
   {
-    // the rest are FIFOs
-    if(queue_id == DT_JOB_QUEUE_USER_BG ||
-       queue_id == DT_JOB_QUEUE_USER_EXPORT ||
-       queue_id == DT_JOB_QUEUE_SYSTEM_BG)
-      job->priority = 0;
-    else
-      job->priority = DT_CONTROL_FG_PRIORITY;
-    *queue = g_list_append(*queue, job);
-    control->queue_length[queue_id]++;
+    // the rest are FIFOs. workers keep what they spawn, everything else is dealt round robin.
+    job->priority = _queue_base_priority[queue_id];
+    const int worker = worker_index >= 0 ? worker_index
+                                         : __sync_fetch_and_add(&control->next_deque, 1) % control->num_threads;
+    dt_control_job_deque_t *deque = _get_deque(control, worker, queue_id);
+    dt_control_job_set_state(job, DT_JOB_STATE_QUEUED);
+    dt_pthread_mutex_lock(&deque->mutex);
+    g_queue_push_tail(&deque->jobs, job);
+    __sync_fetch_and_add(&control->queue_length[queue_id], 1);
+    dt_pthread_mutex_unlock(&deque->mutex);
   }
-  dt_control_job_set_state(job, DT_JOB_STATE_QUEUED);
-  dt_pthread_mutex_unlock(&control->queue_mutex);
 
   // notify workers
   dt_pthread_mutex_lock(&control->cond_mutex);
@@ -557,6 +693,7 @@ static void *dt_control_work(void *ptr)
   worker_thread_parameters_t *params = (worker_thread_parameters_t *)ptr;
   dt_control_t *control = params->self;
   threadid = params->threadid;
+  worker_index = params->threadid;
   char name[16] = {0};
   snprintf(name, sizeof(name), "worker %d", threadid);
   dt_pthread_setname(name);
@@ -612,6 +749,23 @@ void dt_control_jobs_init(dt_control_t *control)
   control->num_threads = CLAMP(dt_conf_get_int("worker_threads"), 1, 8);
   control->thread = (pthread_t *)calloc(control->num_threads, sizeof(pthread_t));
   control->job = (dt_job_t **)calloc(control->num_threads, sizeof(dt_job_t *));
+  control->worker_mutex = (dt_pthread_mutex_t *)calloc(control->num_threads, sizeof(dt_pthread_mutex_t));
+  control->worker_stats = (dt_control_job_stats_t *)calloc((size_t)control->num_threads * DT_JOB_QUEUE_MAX,
+                                                           sizeof(dt_control_job_stats_t));
+  for(int k = 0; k < control->num_threads; k++) dt_pthread_mutex_init(&control->worker_mutex[k], NULL);
+  control->deques = (dt_control_job_deque_t *)calloc((size_t)control->num_threads * DT_JOB_QUEUE_MAX,
+                                                     sizeof(dt_control_job_deque_t));
+  for(int k = 0; k < control->num_threads * DT_JOB_QUEUE_MAX; k++)
+  {
+    dt_pthread_mutex_init(&control->deques[k].mutex, NULL);
+    g_queue_init(&control->deques[k].jobs);
+  }
+  for(int i = 0; i < DT_JOB_QUEUE_MAX; i++)
+  {
+    control->queue_priority[i] = _queue_base_priority[i];
+    control->queue_length[i] = 0;
+  }
+  control->next_deque = 0;
   dt_pthread_mutex_lock(&control->run_mutex);
   control->running = 1;
   dt_pthread_mutex_unlock(&control->run_mutex);
@@ -641,6 +795,16 @@ void dt_control_jobs_init(dt_control_t *control)
 
 void dt_control_jobs_cleanup(dt_control_t *control)
 {
+  dt_control_jobs_print_stats(control);
+  for(int k = 0; k < control->num_threads * DT_JOB_QUEUE_MAX; k++)
+  {
+    g_queue_clear(&control->deques[k].jobs);
+    dt_pthread_mutex_destroy(&control->deques[k].mutex);
+  }
+  free(control->deques);
+  for(int k = 0; k < control->num_threads; k++) dt_pthread_mutex_destroy(&control->worker_mutex[k]);
+  free(control->worker_mutex);
+  free(control->worker_stats);
   free(control->job);
   free(control->thread);
 }
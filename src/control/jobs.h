@@ -47,13 +47,23 @@ typedef enum dt_job_queue_t
   DT_JOB_QUEUE_USER_FG = 0,     // gui actions, ...
   DT_JOB_QUEUE_SYSTEM_FG = 1,   // thumbnail creation, ..., may be pushed out of the queue
   DT_JOB_QUEUE_USER_BG = 2,     // imports, ...
-  DT_JOB_QUEUE_USER_EXPORT = 3, // exports. only one of these jobs will ever be scheduled at a time
+  DT_JOB_QUEUE_USER_EXPORT = 3, // exports. only one of these jobs will ever be scheduled at a time,
+                                //          it runs several pipelines in parallel itself
   DT_JOB_QUEUE_SYSTEM_BG = 4,   // some lua stuff that may not be pushed out of the queue, ...
   DT_JOB_QUEUE_MAX = 5
 } dt_job_queue_t;
 
 typedef struct _dt_job_t dt_job_t;
 
+// per queue latency/throughput counters, printed with -d perf
+typedef struct dt_control_job_stats_t
+{
+  uint64_t jobs;      // finished jobs
+  double wait_total;  // seconds spent queued
+  double wait_max;
+  double run_total;   // seconds spent executing
+} dt_control_job_stats_t;
+
 typedef int32_t (*dt_job_execute_callback)(dt_job_t *);
 typedef void (*dt_job_state_change_callback)(dt_job_t *, dt_job_state_t state);
 typedef void (*dt_job_destroy_callback)(void *data);
@@ -92,6 +102,9 @@ int32_t dt_control_add_job_res(struct dt_control_t *s, dt_job_t *job, int32_t re
 
 int32_t dt_control_get_threadid();
 
+/** print the per queue latency/throughput counters (-d perf). */
+void dt_control_jobs_print_stats(struct dt_control_t *control);
+
 #ifdef HAVE_GPHOTO2
 #include "control/jobs/camera_jobs.h"
 #endif
@@ -1199,6 +1199,116 @@ static int32_t dt_control_refresh_exif_run(dt_job_t *job)
 }
 
 
+// state shared by the parallel pipelines of one export job
+typedef struct dt_control_export_pipelines_t
+{
+  dt_job_t *job;
+  dt_control_export_t *settings;
+  dt_imageio_module_format_t *mformat;
+  dt_imageio_module_storage_t *mstorage;
+  dt_export_metadata_t *metadata;
+  guint tagid, etagid;
+  int omp_threads; // openmp threads per pipeline
+
+  dt_pthread_mutex_t mutex; // protects everything below
+  GList *t;
+  guint total, num;
+  double fraction;
+} dt_control_export_pipelines_t;
+
+typedef struct dt_control_export_pipeline_t
+{
+  dt_control_export_pipelines_t *shared;
+  dt_imageio_module_data_t *fdata; // every pipeline needs its own format data
+  pthread_t thread;
+} dt_control_export_pipeline_t;
+
+// number of images exported at the same time. every pipeline is bounded by host_memory_limit
+// through tiling, so by default only run as many as fit twice into the physical memory.
+static int _export_concurrency(dt_imageio_module_storage_t *mstorage, const guint total)
+{
+  if(!mstorage->parallel_store || !mstorage->parallel_store(mstorage)) return 1;
+  int pipelines = dt_conf_get_int("max_parallel_exports");
+  if(pipelines <= 0)
+  {
+    const size_t mem_mb = dt_get_total_memory() >> 10;
+    const int host_memory_limit = dt_conf_get_int("host_memory_limit");
+    pipelines = host_memory_limit > 0 ? mem_mb / (2 * (size_t)host_memory_limit) : 1;
+  }
+  return CLAMP(pipelines, 1, MAX(1, MIN((int)total, darktable.num_openmp_threads)));
+}
+
+static void *_export_pipeline_run(void *data)
+{
+  dt_control_export_pipeline_t *pipeline = (dt_control_export_pipeline_t *)data;
+  dt_control_export_pipelines_t *p = pipeline->shared;
+  dt_control_export_t *settings = p->settings;
+  dt_imageio_module_format_t *mformat = p->mformat;
+  dt_imageio_module_storage_t *mstorage = p->mstorage;
+  dt_imageio_module_data_t *sdata = settings->sdata;
+  dt_imageio_module_data_t *fdata = pipeline->fdata;
+
+#ifdef _OPENMP // need to do this in every thread
+  omp_set_num_threads(p->omp_threads);
+#endif
+
+  while(dt_control_job_get_state(p->job) != DT_JOB_STATE_CANCELLED)
+  {
+    dt_pthread_mutex_lock(&p->mutex);
+    if(!p->t)
+    {
+      dt_pthread_mutex_unlock(&p->mutex);
+      break;
+    }
+    const int imgid = GPOINTER_TO_INT(p->t->data);
+    p->t = g_list_delete_link(p->t, p->t);
+    const guint num = ++p->num;
+    const guint total = p->total;
+
+    // progress message
+    char message[512] = { 0 };
+    snprintf(message, sizeof(message), _("exporting %d / %d to %s"), num, total, mstorage->name(mstorage));
+    // update the message. initialize_store() might have changed the number of images
+    dt_control_job_set_progress_message(p->job, message);
+    dt_pthread_mutex_unlock(&p->mutex);
+
+    // remove 'changed' tag from image
+    dt_tag_detach(p->tagid, imgid, FALSE, FALSE);
+    // make sure the 'exported' tag is set on the image
+    dt_tag_attach_from_gui(p->etagid, imgid, FALSE, FALSE);
+    // check if image still exists:
+    char imgfilename[PATH_MAX] = { 0 };
+    const dt_image_t *image = dt_image_cache_get(darktable.image_cache, (int32_t)imgid, 'r');
+    if(image)
+    {
+      gboolean from_cache = TRUE;
+      dt_image_full_path(image->id, imgfilename, sizeof(imgfilename), &from_cache);
+      if(!g_file_test(imgfilename, G_FILE_TEST_IS_REGULAR))
+      {
+        dt_control_log(_("image `%s' is currently unavailable"), image->filename);
+        fprintf(stderr, "image `%s' is currently unavailable\n", imgfilename);
+        // dt_image_remove(imgid);
+        dt_image_cache_read_release(darktable.image_cache, image);
+      }
+      else
+      {
+        dt_image_cache_read_release(darktable.image_cache, image);
+        if(mstorage->store(mstorage, sdata, imgid, mformat, fdata, num, total, settings->high_quality,
+                           settings->upscale, settings->icc_type, settings->icc_filename, settings->icc_intent,
+                           p->metadata) != 0)
+          dt_control_job_cancel(p->job);
+      }
+    }
+
+    dt_pthread_mutex_lock(&p->mutex);
+    p->fraction += 1.0 / total;
+    if(p->fraction > 1.0) p->fraction = 1.0;
+    dt_control_job_set_progress(p->job, p->fraction);
+    dt_pthread_mutex_unlock(&p->mutex);
+  }
+  return NULL;
+}
+
 static int32_t dt_control_export_job_run(dt_job_t *job)
 {
   dt_control_image_enumerator_t *params = (dt_control_image_enumerator_t *)dt_control_job_get_params(job);
@@ -1243,8 +1353,6 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
   const guint total = g_list_length(t);
   dt_control_log(ngettext("exporting %d image..", "exporting %d images..", total), total);
 
-  double fraction = 0;
-
   // set up the fdata struct
   fdata->max_width = (settings->max_width != 0 && w != 0) ? MIN(w, settings->max_width) : MAX(w, settings->max_width);
   fdata->max_height = (settings->max_height != 0 && h != 0) ? MIN(h, settings->max_height) : MAX(h, settings->max_height);
@@ -1265,50 +1373,56 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
     metadata.list = g_list_remove(metadata.list, metadata.list->data);
   }
 
-  while(t && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED)
+  dt_control_export_pipelines_t shared = { 0 };
+  shared.job = job;
+  shared.settings = settings;
+  shared.mformat = mformat;
+  shared.mstorage = mstorage;
+  shared.metadata = &metadata;
+  shared.tagid = tagid;
+  shared.etagid = etagid;
+  shared.t = t;
+  shared.total = total;
+  shared.fraction = 0.0;
+  dt_pthread_mutex_init(&shared.mutex, NULL);
+
+  // storages which may be called concurrently get several pipelines, each with its own fdata.
+  // they share the cores, so openmp in each pipeline only gets a fair share.
+  const int pipelines = _export_concurrency(mstorage, total);
+  shared.omp_threads = MAX(1, darktable.num_openmp_threads / pipelines);
+  dt_print(DT_DEBUG_PERF, "[export_job] exporting %d images with %d pipelines\n", total, pipelines);
+
+  dt_control_export_pipeline_t *pipeline
+      = (dt_control_export_pipeline_t *)calloc(pipelines, sizeof(dt_control_export_pipeline_t));
+  for(int k = 0; k < pipelines; k++)
   {
-    const int imgid = GPOINTER_TO_INT(t->data);
-    t = g_list_delete_link(t, t);
-    const guint num = total - g_list_length(t);
-
-    // progress message
-    char message[512] = { 0 };
-    snprintf(message, sizeof(message), _("exporting %d / %d to %s"), num, total, mstorage->name(mstorage));
-    // update the message. initialize_store() might have changed the number of images
-    dt_control_job_set_progress_message(job, message);
-
-    // remove 'changed' tag from image
-    dt_tag_detach(tagid, imgid, FALSE, FALSE);
-    // make sure the 'exported' tag is set on the image
-    dt_tag_attach_from_gui(etagid, imgid, FALSE, FALSE);
-    // check if image still exists:
-    char imgfilename[PATH_MAX] = { 0 };
-    const dt_image_t *image = dt_image_cache_get(darktable.image_cache, (int32_t)imgid, 'r');
-    if(image)
+    pipeline[k].shared = &shared;
+    if(k == 0)
     {
-      gboolean from_cache = TRUE;
-      dt_image_full_path(image->id, imgfilename, sizeof(imgfilename), &from_cache);
-      if(!g_file_test(imgfilename, G_FILE_TEST_IS_REGULAR))
-      {
-        dt_control_log(_("image `%s' is currently unavailable"), image->filename);
-        fprintf(stderr, "image `%s' is currently unavailable\n", imgfilename);
-        // dt_image_remove(imgid);
-        dt_image_cache_read_release(darktable.image_cache, image);
-      }
-      else
-      {
-        dt_image_cache_read_release(darktable.image_cache, image);
-        if(mstorage->store(mstorage, sdata, imgid, mformat, fdata, num, total, settings->high_quality, settings->upscale,
-                           settings->icc_type, settings->icc_filename, settings->icc_intent,
-                          &metadata) != 0)
-          dt_control_job_cancel(job);
-      }
+      pipeline[k].fdata = fdata;
+      continue;
     }
-
-    fraction += 1.0 / total;
-    if(fraction > 1.0) fraction = 1.0;
-    dt_control_job_set_progress(job, fraction);
+    pipeline[k].fdata = mformat->get_params(mformat);
+    pipeline[k].fdata->max_width = fdata->max_width;
+    pipeline[k].fdata->max_height = fdata->max_height;
+    g_strlcpy(pipeline[k].fdata->style, fdata->style, sizeof(pipeline[k].fdata->style));
+    pipeline[k].fdata->style_append = fdata->style_append;
+    dt_pthread_create(&pipeline[k].thread, _export_pipeline_run, &pipeline[k]);
   }
+  // the job's own worker thread runs the first pipeline
+  _export_pipeline_run(&pipeline[0]);
+#ifdef _OPENMP
+  omp_set_num_threads(darktable.num_openmp_threads);
+#endif
+  for(int k = 1; k < pipelines; k++)
+  {
+    pthread_join(pipeline[k].thread, NULL);
+    mformat->free_params(mformat, pipeline[k].fdata);
+  }
+  free(pipeline);
+  dt_pthread_mutex_destroy(&shared.mutex);
+  g_list_free(shared.t);
+
   params->index = NULL;
   g_list_free_full(metadata.list, g_free);
 
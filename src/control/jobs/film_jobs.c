@@ -18,8 +18,15 @@
 #include "control/jobs/film_jobs.h"
 #include "common/darktable.h"
 #include "common/film.h"
+#include "common/image.h"
 #include <stdlib.h>
 
+// images added to the library per transaction. the gui joins the transaction while it is open, so this is kept
+// short enough for its changes to be written soon.
+#define DT_IMPORT_BATCH 16
+// how far the readers may run ahead of the thread adding the images to the library
+#define DT_IMPORT_AHEAD 512
+
 typedef struct dt_film_import1_t
 {
   dt_film_t *film;
@@ -133,6 +140,68 @@ int _film_filename_cmp(gchar *a, gchar *b)
   return ret;
 }
 
+// the files of an import are checked and parsed by a pool of readers, in any order. the job's own thread takes
+// them in import order and adds them to the library, as only that needs the database.
+typedef struct dt_film_import_readers_t
+{
+  gchar **files;
+  int total;
+
+  dt_pthread_mutex_t mutex; // protects everything below
+  pthread_cond_t cond;      // a file got read, or the writer made room
+  dt_image_import_prefetch_t **prefetch;
+  gboolean *ready;
+  int next;    // next file to read
+  int written; // files taken by the writer
+  int running; // reader threads that got started, the writer reads the files itself if none did
+} dt_film_import_readers_t;
+
+static void *_film_import_reader(void *data)
+{
+  dt_film_import_readers_t *r = (dt_film_import_readers_t *)data;
+  dt_pthread_setname("import");
+  dt_pthread_mutex_lock(&r->mutex);
+  while(r->next < r->total)
+  {
+    if(r->next >= r->written + DT_IMPORT_AHEAD)
+    {
+      dt_pthread_cond_wait(&r->cond, &r->mutex);
+      continue;
+    }
+    const int k = r->next++;
+    dt_pthread_mutex_unlock(&r->mutex);
+
+    dt_image_import_prefetch_t *prefetch = dt_image_import_prefetch(r->files[k], FALSE);
+
+    dt_pthread_mutex_lock(&r->mutex);
+    r->prefetch[k] = prefetch;
+    r->ready[k] = TRUE;
+    pthread_cond_broadcast(&r->cond);
+  }
+  dt_pthread_mutex_unlock(&r->mutex);
+  return NULL;
+}
+
+// wait for file k to be read. NULL if it is not to be imported.
+static dt_image_import_prefetch_t *_film_import_take(dt_film_import_readers_t *r, const int k)
+{
+  if(!r->running) return dt_image_import_prefetch(r->files[k], FALSE);
+
+  dt_pthread_mutex_lock(&r->mutex);
+  while(!r->ready[k]) dt_pthread_cond_wait(&r->cond, &r->mutex);
+  dt_image_import_prefetch_t *prefetch = r->prefetch[k];
+  r->written = k + 1;
+  pthread_cond_broadcast(&r->cond);
+  dt_pthread_mutex_unlock(&r->mutex);
+  return prefetch;
+}
+
+static int _film_import_num_readers(const int total)
+{
+  const int readers = dt_conf_get_int("import_parallel_readers");
+  return CLAMP(readers > 0 ? readers : darktable.num_openmp_threads, 1, MAX(1, total));
+}
+
 static void dt_film_import1(dt_job_t *job, dt_film_t *film)
 {
   gboolean recursive = dt_conf_get_bool("ui_last/import_recursive");
@@ -200,12 +269,40 @@ static void dt_film_import1(dt_job_t *job, dt_film_t *film)
   dt_control_job_set_progress_message(job, message);
 
 
+  /* start reading the images ahead of the import */
+  dt_film_import_readers_t readers = { 0 };
+  readers.total = total;
+  readers.files = (gchar **)calloc(total, sizeof(gchar *));
+  readers.prefetch = (dt_image_import_prefetch_t **)calloc(total, sizeof(dt_image_import_prefetch_t *));
+  readers.ready = (gboolean *)calloc(total, sizeof(gboolean));
+  int k = 0;
+  for(GList *image = images; image; image = g_list_next(image)) readers.files[k++] = (gchar *)image->data;
+  dt_pthread_mutex_init(&readers.mutex, NULL);
+  pthread_cond_init(&readers.cond, NULL);
+  const int num_readers = _film_import_num_readers(total);
+  pthread_t *reader_threads = (pthread_t *)calloc(num_readers, sizeof(pthread_t));
+  for(int t = 0; t < num_readers; t++)
+    if(!dt_pthread_create(&reader_threads[readers.running], _film_import_reader, &readers)) readers.running++;
+  if(readers.running < num_readers)
+    fprintf(stderr, "[film_import] could only start %d of %d readers\n", readers.running, num_readers);
+  dt_print(DT_DEBUG_PERF, "[film_import] importing %d images with %d readers\n", total, readers.running);
+  const double start = dt_get_wtime();
+
+  // add the images in batches instead of one transaction per statement. the connection is shared with the gui
+  // and other jobs, if one of them has a transaction open the images go into that one.
+  gboolean batch = dt_database_start_transaction(darktable.db);
+
   /* loop thru the images and import to current film roll */
   dt_film_t *cfr = film;
-  GList *image = g_list_first(images);
-  do
+  for(k = 0; k < readers.total; k++)
   {
-    gchar *cdn = g_path_get_dirname((const gchar *)image->data);
+    if(k > 0 && k % DT_IMPORT_BATCH == 0)
+    {
+      dt_database_release_transaction(darktable.db, batch);
+      batch = dt_database_start_transaction(darktable.db);
+    }
+
+    gchar *cdn = g_path_get_dirname(readers.files[k]);
 
     /* check if we need to initialize a new filmroll */
     if(!cfr || g_strcmp0(cfr->dirname, cdn) != 0)
@@ -253,13 +350,23 @@ static void dt_film_import1(dt_job_t *job, dt_film_t *film)
     g_free(cdn);
 
     /* import image */
-    dt_image_import(cfr->id, (const gchar *)image->data, FALSE);
+    dt_image_import_prefetch_t *prefetch = _film_import_take(&readers, k);
+    if(prefetch) dt_image_import_prefetched(cfr->id, prefetch);
 
     fraction += 1.0 / total;
     dt_control_job_set_progress(job, fraction);
+  }
 
+  dt_database_release_transaction(darktable.db, batch);
 
-  } while((image = g_list_next(image)) != NULL);
+  for(int t = 0; t < readers.running; t++) pthread_join(reader_threads[t], NULL);
+  dt_print(DT_DEBUG_PERF, "[film_import] imported %d images in %.3f secs\n", total, dt_get_wtime() - start);
+  free(reader_threads);
+  pthread_cond_destroy(&readers.cond);
+  dt_pthread_mutex_destroy(&readers.mutex);
+  free(readers.files);
+  free(readers.prefetch);
+  free(readers.ready);
 
   g_list_free_full(images, g_free);
 
@@ -120,6 +120,11 @@ typedef enum dt_signal_t
     */
   DT_SIGNAL_DEVELOP_UI_PIPE_FINISHED,
 
+  /** \brief This signal is raised when the scopes computed in the background have been updated
+  no param, no returned value
+    */
+  DT_SIGNAL_DEVELOP_HISTOGRAM_UPDATED,
+
   /** \brief This signal is raised when develop history is about to be changed
     1 : GList *  the current history
     2 : uint32_t the correpsing history end
@@ -162,6 +167,12 @@ typedef enum dt_signal_t
     */
   DT_SIGNAL_IMAGE_IMPORT,
 
+  /** \brief This signal is raised when properties of some images changed, like rating or color labels
+    1 GList * : the image ids, NULL if any image may have changed. owned by the caller
+    no return
+    */
+  DT_SIGNAL_IMAGE_INFO_CHANGED,
+
   /** \brief This signal is raised after an image has been exported
     to a file, but before it is sent to facebook/picasa etc...
     export won't happen until this function returns
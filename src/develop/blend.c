@@ -474,6 +474,63 @@ static void _blend_normal_unbounded(const _blend_buffer_desc_t *bd, const float
   }
 }
 
+#if defined(DT_HAVE_AVX_CODEPATHS)
+/* normal blend of 4 channel Lab or rgb rows, two pixels at a time. an odd pixel at the end of the row is left
+ * to the plain version. */
+__DT_TARGET_AVX2__
+static inline void _blend_normal_avx2(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                                      const int clamp, _blend_row_func *const blend_plain)
+{
+  const size_t npixels = bd->stride / 4;
+  const int Lab = (bd->cst == iop_cs_Lab);
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 scale = Lab ? _mm256_setr_ps(1.0f / 100.0f, 1.0f / 128.0f, 1.0f / 128.0f, 1.0f, 1.0f / 100.0f,
+                                            1.0f / 128.0f, 1.0f / 128.0f, 1.0f)
+                           : one;
+  const __m256 rescale
+      = Lab ? _mm256_setr_ps(100.0f, 128.0f, 128.0f, 1.0f, 100.0f, 128.0f, 128.0f, 1.0f) : one;
+  // see _blend_colorspace_channel_range()
+  const __m256 min = Lab ? _mm256_setr_ps(0.0f, -1.0f, -1.0f, 0.0f, 0.0f, -1.0f, -1.0f, 0.0f) : _mm256_setzero_ps();
+
+  for(size_t i = 0; i + 1 < npixels; i += 2)
+  {
+    const __m256 opacity
+        = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(mask[i])), _mm_set1_ps(mask[i + 1]), 1);
+    const __m256 ta = _mm256_loadu_ps(a + 4 * i) * scale;
+    const __m256 tb = _mm256_loadu_ps(b + 4 * i) * scale;
+    __m256 res = _mm256_fmadd_ps(tb, opacity, ta * (one - opacity));
+    if(clamp) res = _mm256_min_ps(_mm256_max_ps(res, min), one);
+    _mm256_storeu_ps(b + 4 * i, _mm256_blend_ps(res * rescale, opacity, 0x88));
+  }
+
+  if(npixels & 1)
+  {
+    const _blend_buffer_desc_t last = { .cst = bd->cst, .stride = 4, .ch = 4, .bch = bd->bch };
+    blend_plain(&last, a + 4 * (npixels - 1), b + 4 * (npixels - 1), mask + npixels - 1);
+  }
+}
+
+__DT_TARGET_AVX2__
+static void _blend_normal_bounded_avx2(const _blend_buffer_desc_t *bd, const float *a, float *b,
+                                       const float *mask)
+{
+  if(bd->cst == iop_cs_RAW || bd->ch != 4)
+    _blend_normal_bounded(bd, a, b, mask);
+  else
+    _blend_normal_avx2(bd, a, b, mask, TRUE, _blend_normal_bounded);
+}
+
+__DT_TARGET_AVX2__
+static void _blend_normal_unbounded_avx2(const _blend_buffer_desc_t *bd, const float *a, float *b,
+                                         const float *mask)
+{
+  if(bd->cst == iop_cs_RAW || bd->ch != 4)
+    _blend_normal_unbounded(bd, a, b, mask);
+  else
+    _blend_normal_avx2(bd, a, b, mask, FALSE, _blend_normal_unbounded);
+}
+#endif
+
 /* lighten */
 static void _blend_lighten(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
@@ -2464,6 +2521,76 @@ static void display_channel(const _blend_buffer_desc_t *bd, const float *a, floa
 }
 
 
+typedef enum _blend_mask_source_t
+{
+  _BLEND_MASK_UNIFORM, // global opacity only
+  _BLEND_MASK_RASTER,  // raster mask of an earlier module
+  _BLEND_MASK_FILL,    // parametric mask on top of a constant
+  _BLEND_MASK_DRAWN    // parametric mask on top of the already rendered drawn mask
+} _blend_mask_source_t;
+
+/* everything of the mask that can be computed from one row alone: the source, the parametric mask and the
+ * global opacity. raster is the row of the raster mask, NULL if it could not be obtained. */
+static void _blend_mask_row(const _blend_buffer_desc_t *bd, const dt_develop_blend_params_t *const d,
+                            const _blend_mask_source_t source, const float *const raster, const float fill,
+                            const float opacity, const float *in, const float *out, float *mask,
+                            const dt_iop_order_iccprofile_info_t *const work_profile)
+{
+  const size_t width = bd->stride / bd->ch;
+  switch(source)
+  {
+    case _BLEND_MASK_UNIFORM:
+      for(size_t i = 0; i < width; i++) mask[i] = opacity;
+      break;
+    case _BLEND_MASK_RASTER:
+      if(!raster)
+        for(size_t i = 0; i < width; i++) mask[i] = fill;
+      else if(d->raster_mask_invert)
+        for(size_t i = 0; i < width; i++) mask[i] = (1.0f - raster[i]) * opacity;
+      else
+        for(size_t i = 0; i < width; i++) mask[i] = raster[i] * opacity;
+      break;
+    case _BLEND_MASK_FILL:
+      for(size_t i = 0; i < width; i++) mask[i] = fill;
+      _blend_make_mask(bd, d->blendif, d->blendif_parameters, d->mask_mode, d->mask_combine, opacity, in, out,
+                       mask, work_profile);
+      break;
+    case _BLEND_MASK_DRAWN:
+      // if we have a mask and this flag is set -> invert the mask
+      if(d->mask_combine & DEVELOP_COMBINE_MASKS_POS)
+        for(size_t i = 0; i < width; i++) mask[i] = 1.0f - mask[i];
+      _blend_make_mask(bd, d->blendif, d->blendif_parameters, d->mask_mode, d->mask_combine, opacity, in, out,
+                       mask, work_profile);
+      break;
+  }
+}
+
+/* contrast and brightness of the mask, e = exp(3 * contrast) */
+static void _blend_mask_tone_curve_row(float *mask, const size_t width, const float e, const float brightness,
+                                       const float opacity)
+{
+  for(size_t k = 0; k < width; k++)
+  {
+    float x = mask[k] / opacity;
+    x = 2.f * x - 1.f;
+    if (1.f - brightness <= 0.f)
+      x = mask[k] <= 16 * FLT_EPSILON ? -1.f : 1.f;
+    else if (1.f + brightness <= 0.f)
+      x = mask[k] >= 1.f - 16 * FLT_EPSILON ? 1.f : -1.f;
+    else if (brightness > 0.f)
+    {
+      x = (x + brightness) / (1.f - brightness);
+      x = fminf(x, 1.f);
+    }
+    else
+    {
+      x = (x + brightness) / (1.f + brightness);
+      x = fmaxf(x, -1.f);
+    }
+    mask[k] = ((x * e / (1.f + (e - 1.f) * fabsf(x))) / 2.f + 0.5f) * opacity;
+  }
+}
+
 _blend_row_func *dt_develop_choose_blend_func(const unsigned int blend_mode)
 {
   _blend_row_func *blend = NULL;
@@ -2575,6 +2702,17 @@ _blend_row_func *dt_develop_choose_blend_func(const unsigned int blend_mode)
       break;
   }
 
+#if defined(DT_HAVE_AVX_CODEPATHS)
+  // normal blending is by far the most frequent one
+  if(darktable.codepath.AVX2)
+  {
+    if(blend == _blend_normal_bounded)
+      blend = _blend_normal_bounded_avx2;
+    else if(blend == _blend_normal_unbounded)
+      blend = _blend_normal_unbounded_avx2;
+  }
+#endif
+
   return blend;
 }
 
@@ -2652,52 +2790,26 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
   }
   float *const mask = _mask;
 
+  // find out where the mask comes from. everything that is computed per pixel is done row by row in the same
+  // pass as the blending itself, while the row is in the cache.
+  _blend_mask_source_t source;
+  float fill = 1.0f;
+  float *raster_mask = NULL;
+  gboolean free_raster_mask = FALSE; // if no transformations were applied we get the cached original back
+
   if(mask_mode == DEVELOP_MASK_ENABLED || suppress_mask)
   {
     // blend uniformly (no drawn or parametric mask)
-
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-    dt_omp_firstprivate(buffsize, mask, opacity)
-#endif
-    for(size_t i = 0; i < buffsize; i++) mask[i] = opacity;
+    source = _BLEND_MASK_UNIFORM;
   }
   else if(mask_mode & DEVELOP_MASK_RASTER)
   {
     /* use a raster mask from another module earlier in the pipe */
-    gboolean free_mask = FALSE; // if no transformations were applied we get the cached original back
-    float *raster_mask = dt_dev_get_raster_mask(piece->pipe, self->raster_mask.sink.source, self->raster_mask.sink.id,
-                                                self, &free_mask);
-
-    if(raster_mask)
-    {
-      // invert if required
-      if(d->raster_mask_invert)
-#ifdef _OPENMP
-  #pragma omp parallel for default(none) \
-        dt_omp_firstprivate(buffsize, mask, opacity) \
-        shared(raster_mask)
-#endif
-        for(size_t i = 0; i < buffsize; i++) mask[i] = (1.0 - raster_mask[i]) * opacity;
-      else
-#ifdef _OPENMP
-  #pragma omp parallel for default(none) \
-        dt_omp_firstprivate(buffsize, mask, opacity) \
-        shared(raster_mask)
-#endif
-        for(size_t i = 0; i < buffsize; i++) mask[i] = raster_mask[i] * opacity;
-      if(free_mask) dt_free_align(raster_mask);
-    }
-    else
-    {
-      // fallback for when the raster mask couldn't be applied
-      const float value = d->raster_mask_invert ? 0.0 : 1.0;
-#ifdef _OPENMP
-  #pragma omp parallel for default(none) \
-      dt_omp_firstprivate(buffsize, mask, value)
-#endif
-      for(size_t i = 0; i < buffsize; i++) mask[i] = value;
-    }
+    source = _BLEND_MASK_RASTER;
+    raster_mask = dt_dev_get_raster_mask(piece->pipe, self->raster_mask.sink.source, self->raster_mask.sink.id,
+                                         self, &free_raster_mask);
+    // fallback for when the raster mask couldn't be applied
+    fill = d->raster_mask_invert ? 0.0f : 1.0f;
   }
   else
   {
@@ -2708,56 +2820,46 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
 
     if(form && (!(self->flags() & IOP_FLAGS_NO_MASKS)) && (d->mask_mode & DEVELOP_MASK_MASK))
     {
+      // the rasterization of the shapes is a pass of its own
       dt_masks_group_render_roi(self, piece, form, roi_out, mask);
-
-      if(d->mask_combine & DEVELOP_COMBINE_MASKS_POS)
-      {
-        // if we have a mask and this flag is set -> invert the mask
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-        dt_omp_firstprivate(buffsize, mask)
-#endif
-        for(size_t i = 0; i < buffsize; i++) mask[i] = 1.0f - mask[i];
-      }
+      source = _BLEND_MASK_DRAWN;
     }
     else if((!(self->flags() & IOP_FLAGS_NO_MASKS)) && (d->mask_mode & DEVELOP_MASK_MASK))
     {
       // no form defined but drawn mask active
       // we fill the buffer with 1.0f or 0.0f depending on mask_combine
-      const float fill = (d->mask_combine & DEVELOP_COMBINE_MASKS_POS) ? 0.0f : 1.0f;
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-      dt_omp_firstprivate(buffsize, mask, fill)
-#endif
-      for(size_t i = 0; i < buffsize; i++) mask[i] = fill;
+      source = _BLEND_MASK_FILL;
+      fill = (d->mask_combine & DEVELOP_COMBINE_MASKS_POS) ? 0.0f : 1.0f;
     }
     else
     {
       // we fill the buffer with 1.0f or 0.0f depending on mask_combine
-      const float fill = (d->mask_combine & DEVELOP_COMBINE_INCL) ? 0.0f : 1.0f;
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-      dt_omp_firstprivate(buffsize, mask, fill)
-#endif
-      for(size_t i = 0; i < buffsize; i++) mask[i] = fill;
+      source = _BLEND_MASK_FILL;
+      fill = (d->mask_combine & DEVELOP_COMBINE_INCL) ? 0.0f : 1.0f;
     }
+  }
 
-    // get parametric mask (if any) and apply global opacity
+  const _Bool parametric = (source == _BLEND_MASK_DRAWN || source == _BLEND_MASK_FILL);
+  // feathering and blurring need the neighbourhood, they have to wait for the whole mask
+  const _Bool fused = !(parametric && (mask_feather || mask_blur));
+  const _Bool tone_curve = parametric && mask_tone_curve && opacity > 1e-4f;
+  const float tone_curve_e = expf(3.f * d->contrast);
+
+  if(!fused)
+  {
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-    dt_omp_firstprivate(bch, ch, cst, d, oheight, opacity, ivoid, iwidth, \
-                        mask, owidth, ovoid, work_profile, xoffs, yoffs)
+    dt_omp_firstprivate(bch, ch, cst, d, fill, ivoid, iwidth, mask, oheight, opacity, \
+                        owidth, ovoid, raster_mask, source, work_profile, xoffs, yoffs) \
+    schedule(static)
 #endif
     for(size_t y = 0; y < oheight; y++)
     {
       size_t iindex = ((y + yoffs) * iwidth + xoffs) * ch;
       size_t oindex = y * owidth * ch;
       _blend_buffer_desc_t bd = { .cst = cst, .stride = (size_t)owidth * ch, .ch = ch, .bch = bch };
-      float *in = (float *)ivoid + iindex;
-      float *out = (float *)ovoid + oindex;
-      float *m = mask + y * owidth;
-      _blend_make_mask(&bd, d->blendif, d->blendif_parameters, d->mask_mode, d->mask_combine, opacity, in, out, m,
-                       work_profile);
+      _blend_mask_row(&bd, d, source, raster_mask ? raster_mask + y * owidth : NULL, fill, opacity,
+                      (float *)ivoid + iindex, (float *)ovoid + oindex, mask + y * owidth, work_profile);
     }
 
     if(mask_feather)
@@ -2813,46 +2915,17 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
         dt_gaussian_free(g);
       }
     }
-
-    if(mask_tone_curve && opacity > 1e-4f)
-    {
-      const float e = expf(3.f * d->contrast);
-      const float brightness = d->brightness;
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-      dt_omp_firstprivate(brightness, buffsize, e, mask, opacity)
-#endif
-      for(size_t k = 0; k < buffsize; k++)
-      {
-        float x = mask[k] / opacity;
-        x = 2.f * x - 1.f;
-        if (1.f - brightness <= 0.f)
-          x = mask[k] <= 16 * FLT_EPSILON ? -1.f : 1.f;
-        else if (1.f + brightness <= 0.f)
-          x = mask[k] >= 1.f - 16 * FLT_EPSILON ? 1.f : -1.f;
-        else if (brightness > 0.f)
-        {
-          x = (x + brightness) / (1.f - brightness);
-          x = fminf(x, 1.f);
-        }
-        else
-        {
-          x = (x + brightness) / (1.f + brightness);
-          x = fmaxf(x, -1.f);
-        }
-        mask[k] = ((x * e / (1.f + (e - 1.f) * fabsf(x))) / 2.f + 0.5f) * opacity;
-      }
-    }
   }
 
   // now apply blending with per-pixel opacity value as defined in mask
   // select the blend operator
   _blend_row_func *const blend = dt_develop_choose_blend_func(d->blend_mode);
 #ifdef _OPENMP
-#pragma omp parallel for default(none)                                                                            \
-  dt_omp_firstprivate(bch, blend, ch, cst, ivoid, iwidth, mask, \
-                      mask_display, oheight, ovoid, owidth, \
-                        request_mask_display, work_profile, xoffs, yoffs)
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(bch, blend, ch, cst, d, fill, fused, ivoid, iwidth, mask, mask_display, oheight, opacity, \
+                      owidth, ovoid, raster_mask, request_mask_display, source, tone_curve, tone_curve_e, \
+                      work_profile, xoffs, yoffs) \
+  schedule(static)
 #endif
   for(size_t y = 0; y < oheight; y++)
   {
@@ -2863,6 +2936,11 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
     float *out = (float *)ovoid + oindex;
     float *m = mask + y * owidth;
 
+    if(fused)
+      _blend_mask_row(&bd, d, source, raster_mask ? raster_mask + y * owidth : NULL, fill, opacity, in, out, m,
+                      work_profile);
+    if(tone_curve) _blend_mask_tone_curve_row(m, owidth, tone_curve_e, d->brightness, opacity);
+
     if(request_mask_display & DT_DEV_PIXELPIPE_DISPLAY_ANY)
       display_channel(&bd, in, out, m, request_mask_display, work_profile);
     else
@@ -2872,6 +2950,8 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
       for(size_t j = 0; j < bd.stride; j += 4) out[j + 3] = in[j + 3];
   }
 
+  if(free_raster_mask) dt_free_align(raster_mask);
+
   // register if _this_ module should expose mask or display channel
   if(request_mask_display & (DT_DEV_PIXELPIPE_DISPLAY_MASK | DT_DEV_PIXELPIPE_DISPLAY_CHANNEL))
   {
@@ -40,6 +40,7 @@
 #include "develop/imageop.h"
 #include "develop/lightroom.h"
 #include "develop/masks.h"
+#include "develop/scopes.h"
 #include "gui/gtk.h"
 #include "gui/presets.h"
 
@@ -83,6 +84,8 @@ void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
   dev->histogram = NULL;
   dev->histogram_pre_tonecurve = NULL;
   dev->histogram_pre_levels = NULL;
+  dev->scopes = NULL;
+  dt_pthread_mutex_init(&dev->histogram_mutex, NULL);
   gchar *mode = dt_conf_get_string("plugins/darkroom/histogram/mode");
   if(g_strcmp0(mode, "linear") == 0)
     dev->histogram_type = DT_DEV_HISTOGRAM_LINEAR;
@@ -127,6 +130,8 @@ void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
     dev->histogram_waveform_height = 175;
     dev->histogram_waveform_stride = 4 * dev->histogram_waveform_width;
     dev->histogram_waveform = (uint8_t *)calloc(dev->histogram_waveform_height * dev->histogram_waveform_stride, sizeof(uint8_t));
+
+    dt_dev_scopes_init(dev);
   }
 
   dev->iop_instance = 0;
@@ -162,6 +167,8 @@ void dt_dev_cleanup(dt_develop_t *dev)
 {
   if(!dev) return;
   // image_cache does not have to be unref'd, this is done outside develop module.
+  // the scopes may still use the profiles and the histogram buffers
+  dt_dev_scopes_cleanup(dev);
   dt_pthread_mutex_destroy(&dev->pipe_mutex);
   dt_pthread_mutex_destroy(&dev->pipe_mutex);
   dt_pthread_mutex_destroy(&dev->preview_pipe_mutex);
@@ -210,6 +217,7 @@ void dt_dev_cleanup(dt_develop_t *dev)
   free(dev->histogram_pre_tonecurve);
   free(dev->histogram_pre_levels);
   free(dev->histogram_waveform);
+  dt_pthread_mutex_destroy(&dev->histogram_mutex);
 
   g_list_free_full(dev->forms, (void (*)(void *))dt_masks_free_form);
   g_list_free_full(dev->allforms, (void (*)(void *))dt_masks_free_form);
@@ -1481,7 +1489,7 @@ static void _dev_merge_history(dt_develop_t *dev, const int imgid)
                                   "UPDATE memory.history SET num=?1 WHERE rowid=?2", -1, &stmt, NULL);
 
       // let's wrap this into a transaction, it might make it a little faster.
-      sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+      const gboolean transaction = dt_database_start_transaction(darktable.db);
       for(GList *r = rowids; r; r = g_list_next(r))
       {
         DT_DEBUG_SQLITE3_CLEAR_BINDINGS(stmt);
@@ -1494,7 +1502,7 @@ static void _dev_merge_history(dt_develop_t *dev, const int imgid)
         v++;
       }
 
-      sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+      dt_database_release_transaction(darktable.db, transaction);
 
       g_list_free(rowids);
     }
@@ -183,6 +183,9 @@ typedef struct dt_develop_t
   uint8_t *histogram_waveform;
   uint32_t histogram_waveform_width, histogram_waveform_height, histogram_waveform_stride;
   dt_dev_histogram_type_t histogram_type;
+  // guards histogram, histogram_max and the waveform, which the scopes replace while the gui draws them
+  dt_pthread_mutex_t histogram_mutex;
+  struct dt_dev_scopes_t *scopes;
 
   // list of forms iop can use for masks or whatever
   GList *forms;
@@ -258,6 +258,12 @@ typedef struct dt_iop_module_so_t
   void (*process_sse2)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                        const void *const i, void *const o, const struct dt_iop_roi_t *const roi_in,
                        const struct dt_iop_roi_t *const roi_out);
+  void (*process_avx2)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                       const void *const i, void *const o, const struct dt_iop_roi_t *const roi_in,
+                       const struct dt_iop_roi_t *const roi_out);
+  void (*process_avx512)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                         const void *const i, void *const o, const struct dt_iop_roi_t *const roi_in,
+                         const struct dt_iop_roi_t *const roi_out);
   int (*process_cl)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const i,
                     void *const o, const struct dt_iop_roi_t *const roi_in,
                     const struct dt_iop_roi_t *const roi_out);
@@ -505,6 +511,13 @@ typedef struct dt_iop_module_t
   void (*process_sse2)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                        const void *const i, void *const o, const struct dt_iop_roi_t *const roi_in,
                        const struct dt_iop_roi_t *const roi_out);
+  /** variants of process() compiled for AVX2 with FMA and for AVX-512F, preferred over process_sse2(). */
+  void (*process_avx2)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                       const void *const i, void *const o, const struct dt_iop_roi_t *const roi_in,
+                       const struct dt_iop_roi_t *const roi_out);
+  void (*process_avx512)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                         const void *const i, void *const o, const struct dt_iop_roi_t *const roi_in,
+                         const struct dt_iop_roi_t *const roi_out);
   /** the opencl equivalent of process(). */
   int (*process_cl)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const i,
                     void *const o, const struct dt_iop_roi_t *const roi_in,
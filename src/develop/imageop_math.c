@@ -954,6 +954,26 @@ void dt_iop_clip_and_zoom_mosaic_third_size_xtrans_f(float *const out, const flo
   }
 }
 
+void dt_iop_clip_and_zoom_mosaic(void *const out, const void *const in, const dt_iop_roi_t *const roi_out,
+                                 const dt_iop_roi_t *const roi_in, const int32_t out_stride,
+                                 const int32_t in_stride, const dt_iop_buffer_dsc_t *const dsc)
+{
+  if(dsc->filters != 9u && dsc->datatype == TYPE_FLOAT)
+    dt_iop_clip_and_zoom_mosaic_half_size_f((float *const)out, (const float *const)in, roi_out, roi_in, out_stride,
+                                            in_stride, dsc->filters);
+  else if(dsc->filters != 9u && dsc->datatype == TYPE_UINT16)
+    dt_iop_clip_and_zoom_mosaic_half_size((uint16_t *const)out, (const uint16_t *const)in, roi_out, roi_in,
+                                          out_stride, in_stride, dsc->filters);
+  else if(dsc->filters == 9u && dsc->datatype == TYPE_UINT16)
+    dt_iop_clip_and_zoom_mosaic_third_size_xtrans((uint16_t *const)out, (const uint16_t *const)in, roi_out, roi_in,
+                                                  out_stride, in_stride, dsc->xtrans);
+  else if(dsc->filters == 9u && dsc->datatype == TYPE_FLOAT)
+    dt_iop_clip_and_zoom_mosaic_third_size_xtrans_f((float *const)out, (const float *const)in, roi_out, roi_in,
+                                                    out_stride, in_stride, dsc->xtrans);
+  else
+    dt_unreachable_codepath();
+}
+
 void dt_iop_clip_and_zoom_demosaic_passthrough_monochrome_f_plain(float *out, const float *const in,
                                                                   const dt_iop_roi_t *const roi_out,
                                                                   const dt_iop_roi_t *const roi_in,
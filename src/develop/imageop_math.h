@@ -78,6 +78,12 @@ void dt_iop_clip_and_zoom_mosaic_third_size_xtrans_f(float *const out, const flo
                                                      const dt_iop_roi_t *const roi_in, const int32_t out_stride,
                                                      const int32_t in_stride, const uint8_t (*const xtrans)[6]);
 
+/** downscales a bayer or x-trans mosaic of uint16 or float keeping its pattern, with the one of the above that
+    fits dsc. */
+void dt_iop_clip_and_zoom_mosaic(void *const out, const void *const in, const dt_iop_roi_t *const roi_out,
+                                 const dt_iop_roi_t *const roi_in, const int32_t out_stride,
+                                 const int32_t in_stride, const dt_iop_buffer_dsc_t *const dsc);
+
 void dt_iop_clip_and_zoom_demosaic_passthrough_monochrome_f(float *out, const float *const in,
                                                             const struct dt_iop_roi_t *const roi_out,
                                                             const struct dt_iop_roi_t *const roi_in,
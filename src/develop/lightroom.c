@@ -1534,6 +1534,9 @@ void dt_lightroom_import(int imgid, dt_develop_t *dev, gboolean iauto)
   if(dev == NULL && data.has_colorlabel)
   {
     dt_colorlabels_set_label(imgid, data.color);
+    GList *imgs = g_list_prepend(NULL, GINT_TO_POINTER(imgid));
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_IMAGE_INFO_CHANGED, imgs);
+    g_list_free(imgs);
 
     if(imported[0]) g_strlcat(imported, ", ", sizeof(imported));
     g_strlcat(imported, _("color label"), sizeof(imported));
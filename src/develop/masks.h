@@ -269,6 +269,25 @@ int dt_masks_group_render(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece
 int dt_masks_group_render_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
                               const dt_iop_roi_t *roi, float *buffer);
 
+/** cache of the masks above, one per pixelpipe. max_size is in bytes, 0 disables the cache and returns NULL. */
+typedef struct dt_masks_cache_t dt_masks_cache_t;
+dt_masks_cache_t *dt_masks_cache_init(const size_t max_size);
+void dt_masks_cache_cleanup(dt_masks_cache_t *cache);
+void dt_masks_cache_print(dt_masks_cache_t *cache, const char *name);
+
+/** a falloff segment goes from a point of a brush or path to the matching point of its border. its opacity is
+    density for the first hardness of its length and then falls off linearly towards the border. path segments
+    are stepped the way paths always were, from 1 at the shape to 0 at the border, hardness and density unused. */
+typedef struct dt_masks_falloff_segment_t
+{
+  int p0[2], p1[2];
+  float hardness, density;
+  gboolean path;
+} dt_masks_falloff_segment_t;
+/** draws the segments into buffer, keeping the maximum with what is there. they are clipped to the buffer. */
+void dt_masks_falloff_render(float *const buffer, const int width, const int height,
+                             const dt_masks_falloff_segment_t *const segments, const int count);
+
 // returns current masks version
 int dt_masks_version(void);
 
@@ -2695,49 +2695,6 @@ static int dt_brush_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *pi
   return 1;
 }
 
-/** we write a falloff segment respecting limits of buffer */
-static inline void _brush_falloff_roi(float *buffer, const int *p0, const int *p1, int bw, int bh, float hardness,
-                                      float density)
-{
-  // segment length (increase by 1 to avoid division-by-zero special case handling)
-  const int l = sqrt((p1[0] - p0[0]) * (p1[0] - p0[0]) + (p1[1] - p0[1]) * (p1[1] - p0[1])) + 1;
-  const int solid = hardness * l;
-
-  const float lx = (float)(p1[0] - p0[0]) / (float)l;
-  const float ly = (float)(p1[1] - p0[1]) / (float)l;
-
-  const int dx = lx <= 0 ? -1 : 1;
-  const int dy = ly <= 0 ? -1 : 1;
-  const int dpx = dx;
-  const int dpy = dy * bw;
-
-  float fx = p0[0];
-  float fy = p0[1];
-
-  float op = density;
-  float dop = density / (float)(l - solid);
-
-  for(int i = 0; i < l; i++)
-  {
-    const int x = fx;
-    const int y = fy;
-
-    fx += lx;
-    fy += ly;
-    if(i > solid) op -= dop;
-
-    if(x < 0 || x >= bw || y < 0 || y >= bh) continue;
-
-    float *buf = buffer + (size_t)y * bw + x;
-
-    *buf = MAX(*buf, op);
-    if(x + dx >= 0 && x + dx < bw)
-      buf[dpx] = MAX(buf[dpx], op); // this one is to avoid gaps due to int rounding
-    if(y + dy >= 0 && y + dy < bh)
-      buf[dpy] = MAX(buf[dpy], op); // this one is to avoid gaps due to int rounding
-  }
-}
-
 static int dt_brush_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece,
                                  dt_masks_form_t *form, const dt_iop_roi_t *roi, float *buffer)
 {
@@ -2832,26 +2789,25 @@ static int dt_brush_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t
   }
 
   // now we fill the falloff
-#ifdef _OPENMP
-#if !defined(__SUNOS__) && !defined(__NetBSD__)
-#pragma omp parallel for default(none) \
-  dt_omp_firstprivate(nb_corner, border_count, width, height) \
-  shared(buffer, points, border, payload)
-#else
-#pragma omp parallel for shared(buffer)
-#endif
-#endif
-  for(int i = nb_corner * 3; i < border_count; i++)
+  dt_masks_falloff_segment_t *segments
+      = dt_alloc_align(64, MAX(border_count - nb_corner * 3, 1) * sizeof(dt_masks_falloff_segment_t));
+  if(segments == NULL)
   {
-    const int p0[] = { points[i * 2], points[i * 2 + 1] };
-    const int p1[] = { border[i * 2], border[i * 2 + 1] };
+    dt_free_align(points);
+    dt_free_align(border);
+    dt_free_align(payload);
+    return 0;
+  }
 
-    if(MAX(p0[0], p1[0]) < 0 || MIN(p0[0], p1[0]) >= width || MAX(p0[1], p1[1]) < 0
-       || MIN(p0[1], p1[1]) >= height)
-      continue;
+  int count = 0;
+  for(int i = nb_corner * 3; i < border_count; i++)
+    segments[count++] = (dt_masks_falloff_segment_t){ .p0 = { points[i * 2], points[i * 2 + 1] },
+                                                      .p1 = { border[i * 2], border[i * 2 + 1] },
+                                                      .hardness = payload[i * 2],
+                                                      .density = payload[i * 2 + 1] };
 
-    _brush_falloff_roi(buffer, p0, p1, width, height, payload[i * 2], payload[i * 2 + 1]);
-  }
+  dt_masks_falloff_render(buffer, width, height, segments, count);
+  dt_free_align(segments);
 
   dt_free_align(points);
   dt_free_align(border);
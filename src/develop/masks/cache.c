@@ -0,0 +1,270 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* cache of rasterized shapes, one per pixelpipe.
+ *
+ * a shape is only rasterized again if its points, its place in the group, the roi or one of the distorting
+ * modules up to the module it is used in have changed. so editing one brush stroke of many only costs that
+ * stroke, and changing a slider anywhere does not rasterize any shape. only the bounding box of the pixels
+ * which are not zero is stored, the cache is evicted least recently used first. */
+
+typedef struct dt_masks_cache_entry_t
+{
+  uint64_t key;
+  int ok;                  // what the rasterizer returned
+  int x, y, width, height; // of the stored pixels, in roi or pipe input coordinates
+  float *pixels;
+  size_t size;
+  GList *link;             // in the lru queue
+} dt_masks_cache_entry_t;
+
+struct dt_masks_cache_t
+{
+  dt_pthread_mutex_t lock;
+  GHashTable *entries; // key -> dt_masks_cache_entry_t
+  GQueue lru;          // most recently used first
+  size_t size, max_size;
+  uint64_t hits, misses;
+};
+
+static void _masks_cache_entry_free(gpointer data)
+{
+  dt_masks_cache_entry_t *entry = (dt_masks_cache_entry_t *)data;
+  dt_free_align(entry->pixels);
+  free(entry);
+}
+
+dt_masks_cache_t *dt_masks_cache_init(const size_t max_size)
+{
+  if(max_size == 0) return NULL;
+  dt_masks_cache_t *cache = (dt_masks_cache_t *)calloc(1, sizeof(dt_masks_cache_t));
+  dt_pthread_mutex_init(&cache->lock, NULL);
+  cache->entries = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, _masks_cache_entry_free);
+  g_queue_init(&cache->lru);
+  cache->max_size = max_size;
+  return cache;
+}
+
+void dt_masks_cache_cleanup(dt_masks_cache_t *cache)
+{
+  if(!cache) return;
+  g_queue_clear(&cache->lru);
+  g_hash_table_destroy(cache->entries);
+  dt_pthread_mutex_destroy(&cache->lock);
+  free(cache);
+}
+
+void dt_masks_cache_print(dt_masks_cache_t *cache, const char *name)
+{
+  if(!cache) return;
+  dt_pthread_mutex_lock(&cache->lock);
+  fprintf(stderr, "[masks cache] [%s] %u shapes in %.1f MB, %" PRIu64 " hits, %" PRIu64 " misses\n", name,
+          g_hash_table_size(cache->entries), cache->size / (1024.0 * 1024.0), cache->hits, cache->misses);
+  dt_pthread_mutex_unlock(&cache->lock);
+}
+
+static inline uint64_t _masks_cache_hash(uint64_t hash, const void *data, const size_t size)
+{
+  const char *str = (const char *)data;
+  for(size_t i = 0; i < size; i++) hash = ((hash << 5) + hash) ^ str[i];
+  return hash;
+}
+
+/* roi is NULL for the masks of dt_masks_get_mask(), which are in pipe input coordinates */
+static uint64_t _masks_cache_key(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
+                                 const dt_iop_roi_t *roi)
+{
+  const dt_dev_pixelpipe_t *pipe = piece->pipe;
+  uint64_t hash = 5381;
+
+  // the shapes are transformed by the same modules as in dt_dev_distort_transform_plus(), with
+  // DT_DEV_TRANSFORM_DIR_BACK_INCL
+  dt_develop_t *dev = module->dev;
+  dt_pthread_mutex_lock(&dev->history_mutex);
+  const int filter = dev->gui_module ? dev->gui_module->operation_tags_filter() : 0;
+  for(GList *modules = pipe->iop, *pieces = pipe->nodes; modules && pieces;
+      modules = g_list_next(modules), pieces = g_list_next(pieces))
+  {
+    const dt_iop_module_t *m = (dt_iop_module_t *)modules->data;
+    const dt_dev_pixelpipe_iop_t *p = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    if(p->enabled && m->iop_order <= module->iop_order && (m->operation_tags() & IOP_TAG_DISTORT)
+       && !(filter & m->operation_tags()))
+    {
+      hash = _masks_cache_hash(hash, &m->iop_order, sizeof(m->iop_order));
+      hash = _masks_cache_hash(hash, &p->hash, sizeof(p->hash));
+    }
+  }
+  dt_pthread_mutex_unlock(&dev->history_mutex);
+
+  const float geometry[9] = { roi ? 1.0f : 0.0f,
+                              roi ? roi->x : 0.0f,
+                              roi ? roi->y : 0.0f,
+                              roi ? roi->width : 0.0f,
+                              roi ? roi->height : 0.0f,
+                              roi ? roi->scale : 0.0f,
+                              pipe->iwidth,
+                              pipe->iheight,
+                              pipe->iscale };
+  hash = _masks_cache_hash(hash, geometry, sizeof(geometry));
+
+  const int length = dt_masks_group_get_hash_buffer_length(form);
+  char *str = malloc(length);
+  dt_masks_group_get_hash_buffer(form, str);
+  hash = _masks_cache_hash(hash, str, length);
+  free(str);
+
+  return hash;
+}
+
+/* box is x0, y0, x1, y1 of the pixels of buffer that are not zero, x0 >= x1 if there are none */
+static void _masks_bounding_box(const float *const buffer, const int width, const int height, int box[4])
+{
+  box[0] = width;
+  box[1] = height;
+  box[2] = box[3] = 0;
+  for(int y = 0; y < height; y++)
+  {
+    const float *const row = buffer + (size_t)y * width;
+    int x0 = 0;
+    while(x0 < width && row[x0] == 0.0f) x0++;
+    if(x0 == width) continue;
+    int x1 = width;
+    while(row[x1 - 1] == 0.0f) x1--;
+    box[0] = MIN(box[0], x0);
+    box[2] = MAX(box[2], x1);
+    box[1] = MIN(box[1], y);
+    box[3] = y + 1;
+  }
+}
+
+static void _masks_cache_insert(dt_masks_cache_t *cache, const uint64_t key, const int ok, const int x,
+                                const int y, const int width, const int height, const float *const src,
+                                const int src_width)
+{
+  const size_t size = sizeof(dt_masks_cache_entry_t) + (size_t)MAX(width, 0) * MAX(height, 0) * sizeof(float);
+  if(size > cache->max_size) return;
+
+  dt_masks_cache_entry_t *entry = (dt_masks_cache_entry_t *)calloc(1, sizeof(dt_masks_cache_entry_t));
+  entry->key = key;
+  entry->ok = ok;
+  entry->x = x;
+  entry->y = y;
+  entry->width = MAX(width, 0);
+  entry->height = MAX(height, 0);
+  entry->size = size;
+  if(entry->width && entry->height)
+  {
+    entry->pixels = dt_alloc_align(64, (size_t)entry->width * entry->height * sizeof(float));
+    if(!entry->pixels)
+    {
+      free(entry);
+      return;
+    }
+    for(int j = 0; j < entry->height; j++)
+      memcpy(entry->pixels + (size_t)j * entry->width, src + (size_t)j * src_width,
+             sizeof(float) * entry->width);
+  }
+
+  dt_pthread_mutex_lock(&cache->lock);
+  if(g_hash_table_contains(cache->entries, &key))
+  {
+    // another thread was faster
+    dt_pthread_mutex_unlock(&cache->lock);
+    _masks_cache_entry_free(entry);
+    return;
+  }
+  while(cache->size + size > cache->max_size && cache->lru.tail)
+  {
+    dt_masks_cache_entry_t *last = (dt_masks_cache_entry_t *)g_queue_pop_tail(&cache->lru);
+    cache->size -= last->size;
+    g_hash_table_remove(cache->entries, &last->key);
+  }
+  g_queue_push_head(&cache->lru, entry);
+  entry->link = cache->lru.head;
+  g_hash_table_insert(cache->entries, &entry->key, entry);
+  cache->size += size;
+  dt_pthread_mutex_unlock(&cache->lock);
+}
+
+/* has to be called with the lock held. entries of empty shapes only count if the caller takes them */
+static dt_masks_cache_entry_t *_masks_cache_lookup(dt_masks_cache_t *cache, const uint64_t key,
+                                                   const gboolean allow_empty)
+{
+  dt_masks_cache_entry_t *entry = (dt_masks_cache_entry_t *)g_hash_table_lookup(cache->entries, &key);
+  if(entry && !allow_empty && !entry->pixels) entry = NULL;
+  if(entry)
+  {
+    g_queue_unlink(&cache->lru, entry->link);
+    g_queue_push_head_link(&cache->lru, entry->link);
+    cache->hits++;
+  }
+  else
+    cache->misses++;
+  return entry;
+}
+
+/* copies a cached shape into buffer, with zeroes around the bounding box only if clear is set */
+static gboolean _masks_cache_get_roi(dt_masks_cache_t *cache, const uint64_t key, const dt_iop_roi_t *roi,
+                                     float *buffer, int box[4], const gboolean clear, int *ok)
+{
+  dt_pthread_mutex_lock(&cache->lock);
+  const dt_masks_cache_entry_t *entry = _masks_cache_lookup(cache, key, TRUE);
+  if(entry)
+  {
+    if(clear) memset(buffer, 0, sizeof(float) * roi->width * roi->height);
+    for(int j = 0; j < entry->height; j++)
+      memcpy(buffer + (size_t)(entry->y + j) * roi->width + entry->x, entry->pixels + (size_t)j * entry->width,
+             sizeof(float) * entry->width);
+    box[0] = entry->x;
+    box[1] = entry->y;
+    box[2] = entry->x + entry->width;
+    box[3] = entry->y + entry->height;
+    *ok = entry->ok;
+  }
+  dt_pthread_mutex_unlock(&cache->lock);
+  return entry != NULL;
+}
+
+/* returns a copy of a cached shape like dt_masks_get_mask() */
+static gboolean _masks_cache_get_mask(dt_masks_cache_t *cache, const uint64_t key, float **buffer, int *width,
+                                      int *height, int *posx, int *posy, int *ok)
+{
+  dt_pthread_mutex_lock(&cache->lock);
+  const dt_masks_cache_entry_t *entry = _masks_cache_lookup(cache, key, FALSE);
+  float *pixels = NULL;
+  if(entry)
+  {
+    pixels = dt_alloc_align(64, sizeof(float) * entry->width * entry->height);
+    if(pixels)
+    {
+      memcpy(pixels, entry->pixels, sizeof(float) * entry->width * entry->height);
+      *buffer = pixels;
+      *width = entry->width;
+      *height = entry->height;
+      *posx = entry->x;
+      *posy = entry->y;
+      *ok = entry->ok;
+    }
+  }
+  dt_pthread_mutex_unlock(&cache->lock);
+  return pixels != NULL;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
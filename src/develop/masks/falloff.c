@@ -0,0 +1,206 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* row band rasterizer of the falloff of brushes and paths.
+ *
+ * the falloff is drawn as many segments from the shape to its border, each walked one pixel step at a time.
+ * walking them all in parallel scatters writes from all threads over the whole mask, racing on the pixels
+ * where segments cross. instead the segments are sorted into bands of rows and every band is filled by one
+ * thread, which walks only the steps of each segment that touch its rows. so the writes of a thread stay in a
+ * few rows that fit in its cache, and the result no longer depends on the scheduling.
+ *
+ * brushes and paths used to step differently: a brush adds up its steps, a path computes every step from the
+ * start of the segment. both are kept, so that neither changes its masks. */
+
+// rows per band, small enough to keep all threads busy on a single stroke
+#define DT_MASKS_FALLOFF_BAND 32
+
+typedef struct dt_masks_falloff_line_t
+{
+  float x, y;   // start, at the shape
+  float lx, ly; // one step towards the border
+  int l, solid; // steps, the first solid ones at full density
+  float density, dop;
+  int dx, dy;   // direction of the neighbours written to avoid gaps
+  int y0, y1;   // rows that might be written, clipped to the buffer
+  gboolean path;
+  int px, py;   // paths: start and whole length, each step is computed from them
+  float plx, ply;
+} dt_masks_falloff_line_t;
+
+static void _masks_falloff_line_init(dt_masks_falloff_line_t *line, const dt_masks_falloff_segment_t *seg,
+                                     const int width, const int height)
+{
+  const int *p0 = seg->p0, *p1 = seg->p1;
+  if(MAX(p0[0], p1[0]) < -1 || MIN(p0[0], p1[0]) > width)
+  {
+    // no rows, so it does not go into any band
+    line->y0 = 0;
+    line->y1 = -1;
+    return;
+  }
+
+  // segment length (increase by 1 to avoid division-by-zero special case handling)
+  line->l = sqrt((p1[0] - p0[0]) * (p1[0] - p0[0]) + (p1[1] - p0[1]) * (p1[1] - p0[1])) + 1;
+  line->solid = seg->hardness * line->l;
+  line->x = p0[0];
+  line->y = p0[1];
+  line->lx = (float)(p1[0] - p0[0]) / (float)line->l;
+  line->ly = (float)(p1[1] - p0[1]) / (float)line->l;
+  line->density = seg->density;
+  line->dop = seg->density / (float)(line->l - line->solid);
+  line->dx = line->lx <= 0 ? -1 : 1;
+  line->dy = line->ly <= 0 ? -1 : 1;
+  line->y0 = MAX(0, MIN(p0[1], p1[1]) - 1);
+  line->y1 = MIN(height - 1, MAX(p0[1], p1[1]) + 1);
+
+  line->path = seg->path;
+  if(seg->path)
+  {
+    line->px = p0[0];
+    line->py = p0[1];
+    line->plx = p1[0] - p0[0];
+    line->ply = p1[1] - p0[1];
+    line->dx = line->plx < 0 ? -1 : 1;
+    line->dy = line->ply < 0 ? -1 : 1;
+  }
+}
+
+static inline void _masks_falloff_plot(float *const buffer, const int width, const int band0, const int rows,
+                                       const int x, const int y, const int dx, const int dy, const float op)
+{
+  // unsigned compares for the bounds checks, this is all the work
+  if((unsigned)x >= (unsigned)width) return;
+  if((unsigned)(y - band0) < (unsigned)rows)
+  {
+    float *buf = buffer + (size_t)y * width + x;
+    *buf = MAX(*buf, op);
+    if((unsigned)(x + dx) < (unsigned)width)
+      buf[dx] = MAX(buf[dx], op); // this one is to avoid gaps due to int rounding
+  }
+  if((unsigned)(y + dy - band0) < (unsigned)rows)
+  {
+    float *buf = buffer + (size_t)(y + dy) * width + x;
+    *buf = MAX(*buf, op); // this one is to avoid gaps due to int rounding
+  }
+}
+
+static void _masks_falloff_band(const dt_masks_falloff_line_t *const line, float *const buffer, const int width,
+                                const int band0, const int band1)
+{
+  // the steps that can reach these rows, with a row and a step of margin for rounding
+  int i0 = 0, i1 = line->l - 1;
+  if(fabsf(line->ly) > 1e-6f)
+  {
+    const float ia = (band0 - 2 - line->y) / line->ly;
+    const float ib = (band1 + 3 - line->y) / line->ly;
+    i0 = MAX(i0, (int)floorf(fminf(ia, ib)) - 1);
+    i1 = MIN(i1, (int)ceilf(fmaxf(ia, ib)) + 1);
+  }
+
+  const int dx = line->dx, dy = line->dy, rows = band1 - band0 + 1;
+  if(line->path)
+  {
+    const int l = line->l, px = line->px, py = line->py;
+    const float plx = line->plx, ply = line->ply;
+    for(int i = i0; i <= i1; i++)
+    {
+      const int x = (int)((float)i * plx / (float)l) + px;
+      const int y = (int)((float)i * ply / (float)l) + py;
+      const float op = 1.0 - (float)i / (float)l;
+      // unlike brushes, paths draw the neighbour to the side even if the step itself is outside
+      const gboolean in_x = (unsigned)x < (unsigned)width, in_y = (unsigned)(y - band0) < (unsigned)rows;
+      float *buf = buffer + (size_t)y * width + x;
+      if(in_x && in_y) buf[0] = MAX(buf[0], op);
+      if(in_y && (unsigned)(x + dx) < (unsigned)width)
+        buf[dx] = MAX(buf[dx], op); // this one is to avoid gaps due to int rounding
+      if(in_x && (unsigned)(y + dy - band0) < (unsigned)rows)
+        buf[dy * width] = MAX(buf[dy * width], op); // this one is to avoid gaps due to int rounding
+    }
+    return;
+  }
+
+  const int solid = line->solid;
+  const float lx = line->lx, ly = line->ly, dop = line->dop;
+  float fx = line->x + i0 * lx;
+  float fy = line->y + i0 * ly;
+  float op = i0 <= solid ? line->density : line->density - (i0 - solid) * dop;
+  for(int i = i0; i <= i1; i++)
+  {
+    const int x = fx;
+    const int y = fy;
+    fx += lx;
+    fy += ly;
+    if(i > solid && i > i0) op -= dop;
+    _masks_falloff_plot(buffer, width, band0, rows, x, y, dx, dy, op);
+  }
+}
+
+void dt_masks_falloff_render(float *const buffer, const int width, const int height,
+                             const dt_masks_falloff_segment_t *const segments, const int count)
+{
+  if(count <= 0 || width <= 0 || height <= 0) return;
+
+  const int bands = (height + DT_MASKS_FALLOFF_BAND - 1) / DT_MASKS_FALLOFF_BAND;
+  dt_masks_falloff_line_t *lines = dt_alloc_align(64, sizeof(dt_masks_falloff_line_t) * count);
+  int *start = calloc(bands + 1, sizeof(int));
+  int *fill = malloc(sizeof(int) * bands);
+  int *index = NULL;
+  if(!lines || !start || !fill) goto error;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static) dt_omp_firstprivate(count, lines, segments, width, height)
+#endif
+  for(int k = 0; k < count; k++) _masks_falloff_line_init(lines + k, segments + k, width, height);
+
+  // bucket the segments by band, counting first
+  for(int k = 0; k < count; k++)
+    if(lines[k].y0 <= lines[k].y1)
+      for(int b = lines[k].y0 / DT_MASKS_FALLOFF_BAND; b <= lines[k].y1 / DT_MASKS_FALLOFF_BAND; b++)
+        start[b + 1]++;
+  for(int b = 0; b < bands; b++) start[b + 1] += start[b];
+
+  index = malloc(sizeof(int) * MAX(start[bands], 1));
+  if(!index) goto error;
+  memcpy(fill, start, sizeof(int) * bands);
+  for(int k = 0; k < count; k++)
+    if(lines[k].y0 <= lines[k].y1)
+      for(int b = lines[k].y0 / DT_MASKS_FALLOFF_BAND; b <= lines[k].y1 / DT_MASKS_FALLOFF_BAND; b++)
+        index[fill[b]++] = k;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(dynamic) \
+  dt_omp_firstprivate(bands, buffer, width, height, lines, start, index)
+#endif
+  for(int b = 0; b < bands; b++)
+  {
+    const int band0 = b * DT_MASKS_FALLOFF_BAND;
+    const int band1 = MIN(height, band0 + DT_MASKS_FALLOFF_BAND) - 1;
+    for(int k = start[b]; k < start[b + 1]; k++) _masks_falloff_band(lines + index[k], buffer, width, band0, band1);
+  }
+
+error:
+  free(index);
+  free(fill);
+  free(start);
+  dt_free_align(lines);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -474,9 +474,19 @@ static int dt_group_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t
 
     if(sel)
     {
-      const int ok = dt_masks_get_mask_roi(module, piece, sel, roi, bufs);
       const float op = fpt->opacity;
       const int state = fpt->state;
+      // these leave the group mask alone where the shape is zero, so they only need the shape's bounding box
+      const int combine_in_box = !(state & DT_MASKS_STATE_INVERSE)
+                                 && ((state & DT_MASKS_STATE_UNION)
+                                     || (!(state & DT_MASKS_STATE_INTERSECTION)
+                                         && (state & (DT_MASKS_STATE_DIFFERENCE | DT_MASKS_STATE_EXCLUSION))));
+      int box[4];
+      const int ok = _masks_get_mask_roi_cached(module, piece, sel, roi, bufs, box, !combine_in_box);
+      const int x0 = combine_in_box ? box[0] : 0;
+      const int y0 = combine_in_box ? box[1] : 0;
+      const int x1 = combine_in_box ? box[2] : width;
+      const int y1 = combine_in_box ? box[3] : height;
 
       if(ok)
       {
@@ -505,14 +515,14 @@ static int dt_group_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t
 #ifdef _OPENMP
 #if !defined(__SUNOS__) && !defined(__NetBSD__)
 #pragma omp parallel for default(none) \
-          dt_omp_firstprivate(width, height, op) \
+          dt_omp_firstprivate(op, width, x0, x1, y0, y1) \
           shared(buffer, bufs)
 #else
 #pragma omp parallel for shared(bufs, buffer)
 #endif
 #endif
-          for(int y = 0; y < height; y++)
-            for(int x = 0; x < width; x++)
+          for(int y = y0; y < y1; y++)
+            for(int x = x0; x < x1; x++)
             {
               const size_t index = (size_t)y * width + x;
               buffer[index] = MAX(buffer[index], bufs[index] * op);
@@ -523,14 +533,14 @@ static int dt_group_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t
 #ifdef _OPENMP
 #if !defined(__SUNOS__) && !defined(__NetBSD__)
 #pragma omp parallel for default(none) \
-            dt_omp_firstprivate(width, height, op) \
+            dt_omp_firstprivate(op, width, x0, x1, y0, y1) \
             shared(buffer, bufs)
 #else
 #pragma omp parallel for shared(bufs, buffer)
 #endif
 #endif
-          for(int y = 0; y < height; y++)
-            for(int x = 0; x < width; x++)
+          for(int y = y0; y < y1; y++)
+            for(int x = x0; x < x1; x++)
             {
               const size_t index = (size_t)y * width + x;
               const float b1 = buffer[index];
@@ -546,14 +556,14 @@ static int dt_group_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t
 #ifdef _OPENMP
 #if !defined(__SUNOS__) && !defined(__NetBSD__)
 #pragma omp parallel for default(none) \
-          dt_omp_firstprivate(width, height, op) \
+          dt_omp_firstprivate(op, width, x0, x1, y0, y1) \
           shared(buffer, bufs)
 #else
 #pragma omp parallel for shared(bufs, buffer)
 #endif
 #endif
-          for(int y = 0; y < height; y++)
-            for(int x = 0; x < width; x++)
+          for(int y = y0; y < y1; y++)
+            for(int x = x0; x < x1; x++)
             {
               const size_t index = (size_t)y * width + x;
               const float b1 = buffer[index];
@@ -566,14 +576,14 @@ static int dt_group_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t
 #ifdef _OPENMP
 #if !defined(__SUNOS__) && !defined(__NetBSD__)
 #pragma omp parallel for default(none) \
-          dt_omp_firstprivate(width, height, op) \
+          dt_omp_firstprivate(op, width, x0, x1, y0, y1) \
           shared(buffer, bufs)
 #else
 #pragma omp parallel for shared(bufs, buffer)
 #endif
 #endif
-          for(int y = 0; y < height; y++)
-            for(int x = 0; x < width; x++)
+          for(int y = y0; y < y1; y++)
+            for(int x = x0; x < x1; x++)
             {
               const size_t index = (size_t)y * width + x;
               const float b1 = buffer[index];
@@ -589,14 +599,14 @@ static int dt_group_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t
 #ifdef _OPENMP
 #if !defined(__SUNOS__) && !defined(__NetBSD__)
 #pragma omp parallel for default(none) \
-          dt_omp_firstprivate(width, height, op) \
+          dt_omp_firstprivate(op, width, x0, x1, y0, y1) \
           shared(buffer, bufs)
 #else
 #pragma omp parallel for shared(bufs, buffer)
 #endif
 #endif
-          for(int y = 0; y < height; y++)
-            for(int x = 0; x < width; x++)
+          for(int y = y0; y < y1; y++)
+            for(int x = x0; x < x1; x++)
             {
               const size_t index = (size_t)y * width + x;
               buffer[index] = bufs[index] * op;
@@ -27,7 +27,13 @@
 
 #pragma GCC diagnostic ignored "-Wshadow"
 
+static int _masks_get_mask_roi_cached(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece,
+                                      dt_masks_form_t *form, const dt_iop_roi_t *roi, float *buffer, int box[4],
+                                      const gboolean clear);
+
 // clang-format off
+#include "develop/masks/cache.c"
+#include "develop/masks/falloff.c"
 #include "develop/masks/circle.c"
 #include "develop/masks/path.c"
 #include "develop/masks/brush.c"
@@ -830,8 +836,8 @@ int dt_masks_get_source_area(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *pi
   return 0;
 }
 
-int dt_masks_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
-                      float **buffer, int *width, int *height, int *posx, int *posy)
+static int _masks_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
+                           float **buffer, int *width, int *height, int *posx, int *posy)
 {
   if(form->type & DT_MASKS_CIRCLE)
   {
@@ -860,8 +866,8 @@ int dt_masks_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt
   return 0;
 }
 
-int dt_masks_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
-                          const dt_iop_roi_t *roi, float *buffer)
+static int _masks_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
+                               const dt_iop_roi_t *roi, float *buffer)
 {
   if(form->type & DT_MASKS_CIRCLE)
   {
@@ -890,6 +896,57 @@ int dt_masks_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece
   return 0;
 }
 
+int dt_masks_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
+                      float **buffer, int *width, int *height, int *posx, int *posy)
+{
+  dt_masks_cache_t *cache = piece->pipe->masks_cache;
+  if(!cache || !module) return _masks_get_mask(module, piece, form, buffer, width, height, posx, posy);
+
+  const uint64_t key = _masks_cache_key(module, piece, form, NULL);
+  int ok = 0;
+  if(_masks_cache_get_mask(cache, key, buffer, width, height, posx, posy, &ok)) return ok;
+
+  ok = _masks_get_mask(module, piece, form, buffer, width, height, posx, posy);
+  if(ok && *buffer && *width > 0 && *height > 0)
+    _masks_cache_insert(cache, key, ok, *posx, *posy, *width, *height, *buffer, *width);
+  return ok;
+}
+
+/* box receives the part of buffer that can be non-zero. if clear is not set, a shape from the cache is only
+ * written there and the rest of buffer is left as it was. */
+static int _masks_get_mask_roi_cached(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece,
+                                      dt_masks_form_t *form, const dt_iop_roi_t *roi, float *buffer, int box[4],
+                                      const gboolean clear)
+{
+  dt_masks_cache_t *cache = piece->pipe->masks_cache;
+  box[0] = box[1] = 0;
+  box[2] = roi->width;
+  box[3] = roi->height;
+  if(!cache || !module) return _masks_get_mask_roi(module, piece, form, roi, buffer);
+
+  const uint64_t key = _masks_cache_key(module, piece, form, roi);
+  int ok = 0;
+  if(_masks_cache_get_roi(cache, key, roi, buffer, box, clear, &ok)) return ok;
+
+  ok = _masks_get_mask_roi(module, piece, form, roi, buffer);
+  if(ok)
+  {
+    _masks_bounding_box(buffer, roi->width, roi->height, box);
+    const int empty = box[0] >= box[2];
+    if(empty) box[0] = box[1] = box[2] = box[3] = 0;
+    _masks_cache_insert(cache, key, ok, box[0], box[1], box[2] - box[0], box[3] - box[1],
+                        buffer + (size_t)box[1] * roi->width + box[0], roi->width);
+  }
+  return ok;
+}
+
+int dt_masks_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
+                          const dt_iop_roi_t *roi, float *buffer)
+{
+  int box[4];
+  return _masks_get_mask_roi_cached(module, piece, form, roi, buffer, box, TRUE);
+}
+
 int dt_masks_version(void)
 {
   return DEVELOP_MASKS_VERSION;
@@ -2540,34 +2540,6 @@ static int _path_crop_to_roi(float *path, const int point_count, float xmin, flo
   return 1;
 }
 
-/** we write a falloff segment respecting limits of buffer */
-static void _path_falloff_roi(float *buffer, int *p0, int *p1, int bw, int bh)
-{
-  // segment length
-  const int l = sqrt((p1[0] - p0[0]) * (p1[0] - p0[0]) + (p1[1] - p0[1]) * (p1[1] - p0[1])) + 1;
-
-  const float lx = p1[0] - p0[0];
-  const float ly = p1[1] - p0[1];
-
-  const int dx = lx < 0 ? -1 : 1;
-  const int dy = ly < 0 ? -1 : 1;
-  const int dpy = dy * bw;
-
-  for(int i = 0; i < l; i++)
-  {
-    // position
-    const int x = (int)((float)i * lx / (float)l) + p0[0];
-    const int y = (int)((float)i * ly / (float)l) + p0[1];
-    const float op = 1.0 - (float)i / (float)l;
-    float *buf = buffer + (size_t)y * bw + x;
-    if(x >= 0 && x < bw && y >= 0 && y < bh) buf[0] = MAX(buf[0], op);
-    if(x + dx >= 0 && x + dx < bw && y >= 0 && y < bh)
-      buf[dx] = MAX(buf[dx], op); // this one is to avoid gap due to int rounding
-    if(x >= 0 && x < bw && y + dy >= 0 && y + dy < bh)
-      buf[dpy] = MAX(buf[dpy], op); // this one is to avoid gap due to int rounding
-  }
-}
-
 static int dt_path_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
                                 const dt_iop_roi_t *roi, float *buffer)
 {
@@ -2847,15 +2819,15 @@ static int dt_path_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t
   // deal with feather if it does not lie outside of roi
   if(!path_encircles_roi)
   {
-    int *dpoints = dt_alloc_align(64, 4 * border_count * sizeof(int));
-    if(dpoints == NULL)
+    dt_masks_falloff_segment_t *segments = dt_alloc_align(64, border_count * sizeof(dt_masks_falloff_segment_t));
+    if(segments == NULL)
     {
       dt_free_align(points);
       dt_free_align(border);
       return 0;
     }
 
-    int dindex = 0;
+    int count = 0;
     int p0[2], p1[2];
     float pf1[2];
     int last0[2] = { -100, -100 };
@@ -2891,11 +2863,8 @@ static int dt_path_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t
       // and we draw the falloff
       if(last0[0] != p0[0] || last0[1] != p0[1] || last1[0] != p1[0] || last1[1] != p1[1])
       {
-        dpoints[dindex] = p0[0];
-        dpoints[dindex + 1] = p0[1];
-        dpoints[dindex + 2] = p1[0];
-        dpoints[dindex + 3] = p1[1];
-        dindex += 4;
+        segments[count++]
+            = (dt_masks_falloff_segment_t){ .p0 = { p0[0], p0[1] }, .p1 = { p1[0], p1[1] }, .path = TRUE };
 
         last0[0] = p0[0];
         last0[1] = p0[1];
@@ -2904,19 +2873,9 @@ static int dt_path_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t
       }
     }
 
-#ifdef _OPENMP
-#if !defined(__SUNOS__) && !defined(__NetBSD__)
-#pragma omp parallel for default(none) \
-  dt_omp_firstprivate(width, height, dindex) \
-  shared(buffer, dpoints)
-#else
-#pragma omp parallel for shared(buffer)
-#endif
-#endif
-    for(int n = 0; n < dindex; n += 4)
-      _path_falloff_roi(buffer, dpoints + n, dpoints + n + 2, width, height);
+    dt_masks_falloff_render(buffer, width, height, segments, count);
 
-    dt_free_align(dpoints);
+    dt_free_align(segments);
 
     if(darktable.unmuted & DT_DEBUG_PERF)
       dt_print(DT_DEBUG_MASKS, "[masks %s] path_fill fill falloff took %0.04f sec\n", form->name,
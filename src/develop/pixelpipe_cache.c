@@ -20,6 +20,7 @@
 #include "develop/format.h"
 #include "develop/pixelpipe_hb.h"
 #include "libs/lib.h"
+#include <float.h>
 #include <stdlib.h>
 
 
@@ -32,7 +33,15 @@
 //   ping, pong, and priority buffer (focused plugin)
 // - drop read by the time another is requested (with priority, drop that, or alternating ping and pong?)
 
+#define DT_PIXELPIPE_CACHE_INVALID ((uint64_t)-1)
+
 int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size)
+{
+  return dt_dev_pixelpipe_cache_init_budget(cache, entries, size, 0);
+}
+
+int dt_dev_pixelpipe_cache_init_budget(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size,
+                                       size_t max_memory)
 {
   cache->entries = entries;
   cache->data = (void **)calloc(entries, sizeof(void *));
@@ -42,7 +51,14 @@ int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, si
   memset(cache->dsc, 0x2c, sizeof(dt_iop_buffer_dsc_t) * entries);
 #endif
   cache->hash = (uint64_t *)calloc(entries, sizeof(uint64_t));
-  cache->used = (int32_t *)calloc(entries, sizeof(int32_t));
+  cache->used = (int64_t *)calloc(entries, sizeof(int64_t));
+  cache->cost = (double *)calloc(entries, sizeof(double));
+  cache->index = g_hash_table_new(g_int64_hash, g_int64_equal);
+  cache->module_stats = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  cache->tick = 0;
+  cache->memory = 0;
+  cache->max_memory = max_memory;
+  cache->pinned = -1;
   for(int k = 0; k < entries; k++)
   {
     cache->size[k] = size;
@@ -54,10 +70,12 @@ int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, si
       memset(cache->data[k], 0x5d, size);
 #endif
       ASAN_POISON_MEMORY_REGION(cache->data[k], cache->size[k]);
+      cache->memory += size;
     }
     else cache->data[k] = 0;
-    cache->hash[k] = -1;
+    cache->hash[k] = DT_PIXELPIPE_CACHE_INVALID;
     cache->used[k] = 0;
+    cache->cost[k] = 0.0;
   }
   cache->queries = cache->misses = 0;
   return 1;
@@ -73,7 +91,9 @@ alloc_memory_fail:
     dt_free_align(cache->data[k]);
     cache->size[k] = 0;
     cache->data[k] = NULL;
+    cache->hash[k] = DT_PIXELPIPE_CACHE_INVALID;
   }
+  cache->memory = 0;
   return 0;
 }
 
@@ -84,7 +104,10 @@ void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache)
   free(cache->dsc);
   free(cache->hash);
   free(cache->used);
+  free(cache->cost);
   free(cache->size);
+  g_hash_table_destroy(cache->index);
+  g_hash_table_destroy(cache->module_stats);
 }
 
 uint64_t dt_dev_pixelpipe_cache_hash(int imgid, const dt_iop_roi_t *roi, dt_dev_pixelpipe_t *pipe, int module)
@@ -122,12 +145,130 @@ uint64_t dt_dev_pixelpipe_cache_hash(int imgid, const dt_iop_roi_t *roi, dt_dev_
   return hash;
 }
 
+// returns the cache line holding the given hash, or -1
+static inline int _cache_find(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash)
+{
+  if(hash == DT_PIXELPIPE_CACHE_INVALID) return -1;
+  return GPOINTER_TO_INT(g_hash_table_lookup(cache->index, &hash)) - 1;
+}
+
+static inline int _cache_find_data(dt_dev_pixelpipe_cache_t *cache, const void *data)
+{
+  if(!data) return -1;
+  for(int k = 0; k < cache->entries; k++)
+    if(cache->data[k] == data) return k;
+  return -1;
+}
+
+// the index stores pointers into cache->hash[], so it has to be kept in sync on every change
+static void _cache_set_hash(dt_dev_pixelpipe_cache_t *cache, const int k, const uint64_t hash)
+{
+  if(cache->hash[k] == hash) return;
+  if(cache->hash[k] != DT_PIXELPIPE_CACHE_INVALID) g_hash_table_remove(cache->index, &cache->hash[k]);
+  cache->hash[k] = DT_PIXELPIPE_CACHE_INVALID;
+  if(hash == DT_PIXELPIPE_CACHE_INVALID) return;
+  // no two lines may carry the same hash:
+  const int other = _cache_find(cache, hash);
+  if(other >= 0) _cache_set_hash(cache, other, DT_PIXELPIPE_CACHE_INVALID);
+  cache->hash[k] = hash;
+  g_hash_table_insert(cache->index, &cache->hash[k], GINT_TO_POINTER(k + 1));
+}
+
+// returns the line which is cheapest to lose, or -1 if all lines are in use.
+// the two most recently touched lines (the input of the module being processed and
+// its predecessor), lines reweighted into the future and the pinned line are never chosen.
+// empty lines which are already large enough win right away.
+static int _cache_pick_victim(dt_dev_pixelpipe_cache_t *cache, const size_t size, const int except,
+                              const int allocated_only)
+{
+  int victim = -1;
+  double max_score = -1.0;
+  for(int k = 0; k < cache->entries; k++)
+  {
+    if(k == except || k == cache->pinned) continue;
+    if(allocated_only && !cache->data[k]) continue;
+    if(cache->hash[k] == DT_PIXELPIPE_CACHE_INVALID)
+    {
+      if(cache->size[k] >= size && !allocated_only) return k;
+      // empty lines are always preferred over valid ones
+      const double score = DBL_MAX / 2.0 + cache->size[k];
+      if(score > max_score)
+      {
+        max_score = score;
+        victim = k;
+      }
+      continue;
+    }
+    const int64_t age = cache->tick - cache->used[k];
+    if(age < 2) continue;
+    // old, large and cheap to recompute lines go first:
+    const double mb = cache->size[k] / (1024.0 * 1024.0);
+    const double score = age * (1.0 + mb) / (1.0 + 1000.0 * cache->cost[k]);
+    if(score > max_score)
+    {
+      max_score = score;
+      victim = k;
+    }
+  }
+  return victim;
+}
+
+// the plain lru line, used if everything is protected. only the pinned line stays.
+static int _cache_pick_lru(dt_dev_pixelpipe_cache_t *cache)
+{
+  int max = 0;
+  int64_t max_age = INT64_MIN;
+  for(int k = 0; k < cache->entries; k++)
+  {
+    if(k == cache->pinned && cache->entries > 1) continue;
+    const int64_t age = cache->tick - cache->used[k];
+    if(age > max_age)
+    {
+      max_age = age;
+      max = k;
+    }
+  }
+  return max;
+}
+
+static void _cache_free_line(dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+  dt_free_align(cache->data[k]);
+  cache->memory -= cache->size[k];
+  cache->data[k] = NULL;
+  cache->size[k] = 0;
+  cache->cost[k] = 0.0;
+  _cache_set_hash(cache, k, DT_PIXELPIPE_CACHE_INVALID);
+}
+
+// make sure line k can hold size bytes, dropping other lines if the memory budget requires it.
+static void _cache_reserve(dt_dev_pixelpipe_cache_t *cache, const int k, const size_t size)
+{
+  // without a budget, lines only ever grow. with a budget, also give back grossly oversized lines.
+  const gboolean shrink = cache->max_memory && cache->size[k] > 2 * size;
+  if(cache->size[k] >= size && !shrink) return;
+
+  dt_free_align(cache->data[k]);
+  cache->memory -= cache->size[k];
+  cache->data[k] = NULL;
+  cache->size[k] = 0;
+
+  while(cache->max_memory && cache->memory + size > cache->max_memory)
+  {
+    const int victim = _cache_pick_victim(cache, 0, k, TRUE);
+    if(victim < 0) break; // everything else is in use, overcommit.
+    _cache_free_line(cache, victim);
+  }
+
+  cache->data[k] = (void *)dt_alloc_align(64, size);
+  cache->size[k] = cache->data[k] ? size : 0;
+  cache->memory += cache->size[k];
+}
+
 int dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash)
 {
   // search for hash in cache
-  for(int32_t k = 0; k < cache->entries; k++)
-    if(cache->hash[k] == hash) return 1;
-  return 0;
+  return _cache_find(cache, hash) >= 0;
 }
 
 int dt_dev_pixelpipe_cache_get_important(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size,
@@ -146,104 +287,140 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const u
                                         void **data, dt_iop_buffer_dsc_t **dsc, int weight)
 {
   cache->queries++;
+  cache->tick++; // age all entries
   *data = NULL;
-  int max_used = -1, max = 0;
-  size_t sz = 0;
-  for(int k = 0; k < cache->entries; k++)
+
+  int k = _cache_find(cache, hash);
+  if(k >= 0 && cache->size[k] >= size)
   {
-    // search for hash in cache
-    if(cache->used[k] > max_used)
-    {
-      max_used = cache->used[k];
-      max = k;
-    }
-    cache->used[k]++; // age all entries
-    if(cache->hash[k] == hash)
-    {
-      *data = cache->data[k];
-      *dsc = &cache->dsc[k];
-      sz = cache->size[k];
-      cache->used[k] = weight; // this is the MRU entry
+    *data = cache->data[k];
+    *dsc = &cache->dsc[k];
+    cache->used[k] = cache->tick - weight; // this is the MRU entry
 
-      ASAN_POISON_MEMORY_REGION(*data, sz);
-      ASAN_UNPOISON_MEMORY_REGION(*data, size);
-    }
+    ASAN_POISON_MEMORY_REGION(*data, cache->size[k]);
+    ASAN_UNPOISON_MEMORY_REGION(*data, size);
+    return 0;
   }
 
-  if(!*data || sz < size)
+  // not found, or found but too small: in that case resize the very same line, unless it is pinned.
+  if(k >= 0 && k == cache->pinned)
   {
+    _cache_set_hash(cache, k, DT_PIXELPIPE_CACHE_INVALID);
+    k = -1;
+  }
+  if(k < 0)
+  {
+    k = _cache_pick_victim(cache, size, -1, FALSE);
     // kill LRU entry
-    // printf("[pixelpipe_cache_get] hash not found, returning slot %d/%d age %d\n", max, cache->entries,
-    // weight);
-    if(cache->size[max] < size)
-    {
-      dt_free_align(cache->data[max]);
-      cache->data[max] = (void *)dt_alloc_align(64, size);
-      cache->size[max] = size;
-    }
-    *data = cache->data[max];
-    sz = cache->size[max];
+    if(k < 0) k = _cache_pick_lru(cache);
+  }
+  // printf("[pixelpipe_cache_get] hash not found, returning slot %d/%d age %d\n", k, cache->entries,
+  // weight);
+  _cache_reserve(cache, k, size);
+  *data = cache->data[k];
 
-    ASAN_POISON_MEMORY_REGION(*data, sz);
-    ASAN_UNPOISON_MEMORY_REGION(*data, size);
+  ASAN_POISON_MEMORY_REGION(*data, cache->size[k]);
+  ASAN_UNPOISON_MEMORY_REGION(*data, size);
 
-    // first, update our copy, then update the pointer to point at our copy
-    cache->dsc[max] = **dsc;
-    *dsc = &cache->dsc[max];
+  // first, update our copy, then update the pointer to point at our copy
+  cache->dsc[k] = **dsc;
+  *dsc = &cache->dsc[k];
 
-    cache->hash[max] = hash;
-    cache->used[max] = weight;
-    cache->misses++;
-    return 1;
-  }
-  else
-    return 0;
+  _cache_set_hash(cache, k, hash);
+  cache->used[k] = cache->tick - weight;
+  cache->cost[k] = 0.0;
+  cache->misses++;
+  return 1;
 }
 
 void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache)
 {
+  g_hash_table_remove_all(cache->index);
   for(int k = 0; k < cache->entries; k++)
   {
-    cache->hash[k] = -1;
-    cache->used[k] = 0;
+    cache->hash[k] = DT_PIXELPIPE_CACHE_INVALID;
+    cache->used[k] = cache->tick;
+    cache->cost[k] = 0.0;
     ASAN_POISON_MEMORY_REGION(cache->data[k], cache->size[k]);
   }
 }
 
 void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data)
 {
-  for(int k = 0; k < cache->entries; k++)
+  const int k = _cache_find_data(cache, data);
+  if(k >= 0) cache->used[k] = cache->tick + cache->entries;
+}
+
+void dt_dev_pixelpipe_cache_pin(dt_dev_pixelpipe_cache_t *cache, void *data)
+{
+  cache->pinned = _cache_find_data(cache, data);
+}
+
+void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *data)
+{
+  const int k = _cache_find_data(cache, data);
+  if(k >= 0)
   {
-    if(cache->data[k] == data)
-    {
-      cache->used[k] = -cache->entries;
-    }
+    _cache_set_hash(cache, k, DT_PIXELPIPE_CACHE_INVALID);
+    cache->cost[k] = 0.0;
+    ASAN_POISON_MEMORY_REGION(cache->data[k], cache->size[k]);
   }
 }
 
-void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *data)
+void dt_dev_pixelpipe_cache_set_cost(dt_dev_pixelpipe_cache_t *cache, void *data, double cost)
 {
-  for(int k = 0; k < cache->entries; k++)
+  const int k = _cache_find_data(cache, data);
+  if(k >= 0) cache->cost[k] = cost;
+}
+
+double dt_dev_pixelpipe_cache_get_cost(dt_dev_pixelpipe_cache_t *cache, void *data)
+{
+  const int k = _cache_find_data(cache, data);
+  return k >= 0 ? cache->cost[k] : 0.0;
+}
+
+void dt_dev_pixelpipe_cache_count(dt_dev_pixelpipe_cache_t *cache, const char *op, const int hit)
+{
+  dt_dev_pixelpipe_cache_module_stats_t *stats = g_hash_table_lookup(cache->module_stats, op);
+  if(!stats)
   {
-    if(cache->data[k] == data)
-    {
-      cache->hash[k] = -1;
-      ASAN_POISON_MEMORY_REGION(cache->data[k], cache->size[k]);
-    }
+    stats = g_malloc0(sizeof(dt_dev_pixelpipe_cache_module_stats_t));
+    g_hash_table_insert(cache->module_stats, g_strdup(op), stats);
   }
+  if(hit)
+    stats->hits++;
+  else
+    stats->misses++;
 }
 
 void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache)
 {
   for(int k = 0; k < cache->entries; k++)
   {
+    if(!cache->data[k]) continue;
     printf("pixelpipe cacheline %d ", k);
-    printf("used %d by %" PRIu64 "", cache->used[k], cache->hash[k]);
+    printf("age %" PRId64 " by %" PRIu64 ", %.2f MB, cost %.3fs", cache->tick - cache->used[k], cache->hash[k],
+           cache->size[k] / (1024.0 * 1024.0), cache->cost[k]);
     printf("\n");
   }
+  printf("cache memory %.2f MB", cache->memory / (1024.0 * 1024.0));
+  if(cache->max_memory) printf(" of %.2f MB", cache->max_memory / (1024.0 * 1024.0));
+  printf("\n");
+
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, cache->module_stats);
+  while(g_hash_table_iter_next(&iter, &key, &value))
+  {
+    const dt_dev_pixelpipe_cache_module_stats_t *stats = (dt_dev_pixelpipe_cache_module_stats_t *)value;
+    printf("pixelpipe cache module %-20s hits %" PRIu64 " misses %" PRIu64 "\n", (const char *)key, stats->hits,
+           stats->misses);
+  }
   printf("cache hit rate so far: %.3f\n", (cache->queries - cache->misses) / (float)cache->queries);
 }
 
+#undef DT_PIXELPIPE_CACHE_INVALID
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -18,18 +18,32 @@
 
 #pragma once
 
+#include <glib.h>
 #include <inttypes.h>
+#include <stddef.h>
 
 struct dt_dev_pixelpipe_t;
 struct dt_iop_buffer_dsc_t;
 struct dt_iop_roi_t;
 
 /**
- * implements a simple pixel cache suitable for caching float images
+ * implements a pixel cache suitable for caching float images
  * corresponding to history items and zoom/pan settings in the develop module.
- * it is optimized for very few entries (~5), so most operations are O(N).
+ * cache lines have variable size and are found through a hash index. the cache
+ * is bounded by a line count and, optionally, by the total number of bytes held.
+ * eviction weighs the age of a line against its size and the time it took to
+ * compute it, so cheap large buffers go first and expensive early nodes stay.
  */
 
+// number of cache lines of the darkroom pipes, their memory budget is the real limit
+#define DT_PIXELPIPE_CACHE_INTERACTIVE_ENTRIES 64
+
+typedef struct dt_dev_pixelpipe_cache_module_stats_t
+{
+  uint64_t hits;
+  uint64_t misses;
+} dt_dev_pixelpipe_cache_module_stats_t;
+
 typedef struct dt_dev_pixelpipe_cache_t
 {
   int32_t entries;
@@ -37,19 +51,29 @@ typedef struct dt_dev_pixelpipe_cache_t
   size_t *size;
   struct dt_iop_buffer_dsc_t *dsc;
   uint64_t *hash;
-  int32_t *used;
+  int64_t *used;   // tick of the last access, lines touched in the future are protected (important)
+  double *cost;    // seconds it took to compute this line, including its uncached inputs
+  GHashTable *index; // hash -> line + 1
+  int64_t tick;
+  size_t memory;     // bytes currently allocated in all lines
+  size_t max_memory; // 0 means unlimited, only the line count bounds the cache
+  int pinned;        // line the pipe's backbuf points into, never freed or reused, -1 for none
 #ifdef HAVE_OPENCL
   void **gpu_mem;
 #endif
   // profiling:
   uint64_t queries;
   uint64_t misses;
+  GHashTable *module_stats; // module op -> dt_dev_pixelpipe_cache_module_stats_t
 } dt_dev_pixelpipe_cache_t;
 
 /** constructs a new cache with given cache line count (entries) and float buffer entry size in bytes.
   \param[out] returns 0 if fail to allocate mem cache.
 */
 int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size);
+/** same, but additionally bounds the bytes held by all cache lines (0: unlimited). */
+int dt_dev_pixelpipe_cache_init_budget(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size,
+                                       size_t max_memory);
 void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache);
 
 /** creates a hopefully unique hash from the complete module stack up to the module-th. */
@@ -75,9 +99,22 @@ void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache);
 /** makes this buffer very important after it has been pulled from the cache. */
 void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data);
 
+/** keeps the line holding data as it is until another one is pinned, NULL pins none. for the backbuf, which
+ * is read after the pipe is done and may be followed by other runs. */
+void dt_dev_pixelpipe_cache_pin(dt_dev_pixelpipe_cache_t *cache, void *data);
+
 /** mark the given cache line pointer as invalid. */
 void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *data);
 
+/** remember how long it took to compute the given cache line, used to weigh eviction. */
+void dt_dev_pixelpipe_cache_set_cost(dt_dev_pixelpipe_cache_t *cache, void *data, double cost);
+
+/** returns the cost of the given cache line, or 0 if it is not part of the cache. */
+double dt_dev_pixelpipe_cache_get_cost(dt_dev_pixelpipe_cache_t *cache, void *data);
+
+/** count a cache hit or miss for the given module operation (profiling). */
+void dt_dev_pixelpipe_cache_count(dt_dev_pixelpipe_cache_t *cache, const char *op, const int hit);
+
 /** print out cache lines/hashes (debug). */
 void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache);
 
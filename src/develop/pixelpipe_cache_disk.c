@@ -0,0 +1,430 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "develop/pixelpipe_cache_disk.h"
+#include "common/darktable.h"
+#include "common/file_location.h"
+#include "common/image.h"
+#include "control/conf.h"
+#include "develop/format.h"
+#include "develop/pixelpipe_hb.h"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* file layout: a header, followed by the buffer in chunks. every chunk is compressed on its own, after
+   separating the bytes of the 32 bit words into planes, which helps deflate a lot with float data. */
+
+#define DT_PIXELPIPE_CACHE_DISK_MAGIC 0x43504454u // "TDPC"
+#define DT_PIXELPIPE_CACHE_DISK_VERSION 1
+#define DT_PIXELPIPE_CACHE_DISK_CHUNK ((size_t)1 << 22)
+
+typedef struct dt_pixelpipe_cache_disk_header_t
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  uint64_t size;
+  double cost;
+  // dt_iop_buffer_dsc_t without the pointer to the work profile
+  uint32_t channels;
+  uint32_t datatype;
+  uint32_t filters;
+  uint8_t xtrans[6][6];
+  uint16_t raw_black_level;
+  uint16_t raw_white_point;
+  int32_t temperature_enabled;
+  float temperature_coeffs[4];
+  float processed_maximum[4];
+  int32_t cst;
+} dt_pixelpipe_cache_disk_header_t;
+
+typedef struct dt_pixelpipe_cache_disk_chunk_t
+{
+  uint32_t size;
+  uint32_t compressed;
+} dt_pixelpipe_cache_disk_chunk_t;
+
+typedef struct dt_pixelpipe_cache_disk_file_t
+{
+  gchar *name;
+  size_t size;
+  gint64 mtime;
+} dt_pixelpipe_cache_disk_file_t;
+
+static inline uint64_t _hash_bytes(uint64_t hash, const void *data, const size_t size)
+{
+  // same bernstein hash as the memory cache
+  const char *str = (const char *)data;
+  for(size_t i = 0; i < size; i++) hash = ((hash << 5) + hash) ^ str[i];
+  return hash;
+}
+
+static void _cache_filename(dt_dev_pixelpipe_cache_disk_t *cache, const uint64_t key, char *filename,
+                            const size_t size)
+{
+  snprintf(filename, size, "%s/%016" PRIx64 ".dtpc", cache->path, key);
+}
+
+static inline uint64_t _cache_key(dt_dev_pixelpipe_t *pipe, const uint64_t hash)
+{
+  uint64_t key = _hash_bytes(pipe->disk_cache_hash, &hash, sizeof(hash));
+  return _hash_bytes(key, &pipe->type, sizeof(pipe->type));
+}
+
+static void _shuffle(uint8_t *const out, const uint8_t *const in, const size_t size)
+{
+  const size_t words = size / 4;
+  for(size_t k = 0; k < words; k++)
+    for(int b = 0; b < 4; b++) out[b * words + k] = in[4 * k + b];
+  memcpy(out + 4 * words, in + 4 * words, size - 4 * words);
+}
+
+static void _unshuffle(uint8_t *const out, const uint8_t *const in, const size_t size)
+{
+  const size_t words = size / 4;
+  for(size_t k = 0; k < words; k++)
+    for(int b = 0; b < 4; b++) out[4 * k + b] = in[b * words + k];
+  memcpy(out + 4 * words, in + 4 * words, size - 4 * words);
+}
+
+static size_t _cache_scan(dt_dev_pixelpipe_cache_disk_t *cache, GList **files)
+{
+  size_t total = 0;
+  GDir *dir = g_dir_open(cache->path, 0, NULL);
+  if(!dir) return 0;
+
+  const gchar *name;
+  while((name = g_dir_read_name(dir)))
+  {
+    if(!g_str_has_suffix(name, ".dtpc")) continue;
+    gchar *filename = g_build_filename(cache->path, name, NULL);
+    GStatBuf st;
+    if(!g_stat(filename, &st))
+    {
+      total += st.st_size;
+      if(files)
+      {
+        dt_pixelpipe_cache_disk_file_t *f = g_malloc(sizeof(dt_pixelpipe_cache_disk_file_t));
+        f->name = filename;
+        f->size = st.st_size;
+        f->mtime = st.st_mtime;
+        *files = g_list_prepend(*files, f);
+        filename = NULL;
+      }
+    }
+    g_free(filename);
+  }
+  g_dir_close(dir);
+  return total;
+}
+
+static gint _sort_by_mtime(gconstpointer a, gconstpointer b)
+{
+  const dt_pixelpipe_cache_disk_file_t *fa = (const dt_pixelpipe_cache_disk_file_t *)a;
+  const dt_pixelpipe_cache_disk_file_t *fb = (const dt_pixelpipe_cache_disk_file_t *)b;
+  return fa->mtime < fb->mtime ? -1 : fa->mtime > fb->mtime;
+}
+
+static void _free_file(gpointer data)
+{
+  dt_pixelpipe_cache_disk_file_t *f = (dt_pixelpipe_cache_disk_file_t *)data;
+  g_free(f->name);
+  g_free(f);
+}
+
+// evict least recently used files until we are at 90% of the size limit. other processes may be doing the
+// same at the same time, files which are gone already are just skipped.
+static void _cache_gc(dt_dev_pixelpipe_cache_disk_t *cache)
+{
+  GList *files = NULL;
+  size_t total = _cache_scan(cache, &files);
+  files = g_list_sort(files, _sort_by_mtime);
+
+  const size_t target = cache->max_size / 10 * 9;
+  int removed = 0;
+  for(GList *l = files; l && total > target; l = g_list_next(l))
+  {
+    dt_pixelpipe_cache_disk_file_t *f = (dt_pixelpipe_cache_disk_file_t *)l->data;
+    if(!g_unlink(f->name) || errno == ENOENT)
+    {
+      total -= MIN(total, f->size);
+      removed++;
+    }
+  }
+  g_list_free_full(files, _free_file);
+
+  cache->size = total;
+  dt_print(DT_DEBUG_DEV, "[pixelpipe_cache_disk] removed %d files, %.1f MB left\n", removed,
+           total / (1024.0 * 1024.0));
+}
+
+void dt_dev_pixelpipe_cache_disk_init(dt_dev_pixelpipe_cache_disk_t *cache)
+{
+  memset(cache, 0, sizeof(*cache));
+  dt_pthread_mutex_init(&cache->lock, NULL);
+
+  if(!dt_conf_get_bool("cache_disk_pixelpipe")) return;
+
+  char cachedir[PATH_MAX] = { 0 };
+  dt_loc_get_user_cache_dir(cachedir, sizeof(cachedir));
+  snprintf(cache->path, sizeof(cache->path), "%s/pixelpipe", cachedir);
+  if(g_mkdir_with_parents(cache->path, 0750))
+  {
+    fprintf(stderr, "[pixelpipe_cache_disk] could not create directory `%s'\n", cache->path);
+    return;
+  }
+
+  cache->max_size = MAX(dt_conf_get_int64("cache_disk_pixelpipe_size"), (int64_t)64 << 20);
+  cache->size = _cache_scan(cache, NULL);
+  cache->enabled = 1;
+
+  dt_print(DT_DEBUG_DEV, "[pixelpipe_cache_disk] using `%s', %.1f of %.1f MB in use\n", cache->path,
+           cache->size / (1024.0 * 1024.0), cache->max_size / (1024.0 * 1024.0));
+}
+
+void dt_dev_pixelpipe_cache_disk_cleanup(dt_dev_pixelpipe_cache_disk_t *cache)
+{
+  dt_dev_pixelpipe_cache_disk_print(cache);
+  dt_pthread_mutex_destroy(&cache->lock);
+}
+
+uint64_t dt_dev_pixelpipe_cache_disk_image_hash(dt_dev_pixelpipe_cache_disk_t *cache, dt_dev_pixelpipe_t *pipe)
+{
+  if(!cache->enabled || pipe->image.id <= 0) return 0;
+
+  // the image id alone is not enough: darktable-cli uses a fresh library every time
+  char pathname[PATH_MAX] = { 0 };
+  gboolean from_cache = FALSE;
+  dt_image_full_path(pipe->image.id, pathname, sizeof(pathname), &from_cache);
+  GStatBuf st;
+  if(!pathname[0] || g_stat(pathname, &st)) return 0;
+
+  uint64_t hash = 5381;
+  hash = _hash_bytes(hash, darktable_package_version, strlen(darktable_package_version));
+  hash = _hash_bytes(hash, pathname, strlen(pathname));
+  const int64_t mtime = st.st_mtime, fsize = st.st_size;
+  hash = _hash_bytes(hash, &mtime, sizeof(mtime));
+  hash = _hash_bytes(hash, &fsize, sizeof(fsize));
+  hash = _hash_bytes(hash, &pipe->iwidth, sizeof(pipe->iwidth));
+  hash = _hash_bytes(hash, &pipe->iheight, sizeof(pipe->iheight));
+  hash = _hash_bytes(hash, &pipe->iscale, sizeof(pipe->iscale));
+  return hash ? hash : 1;
+}
+
+int dt_dev_pixelpipe_cache_disk_available(dt_dev_pixelpipe_cache_disk_t *cache, dt_dev_pixelpipe_t *pipe,
+                                          const uint64_t hash)
+{
+  if(!cache->enabled || !pipe->disk_cache_hash) return FALSE;
+
+  char filename[PATH_MAX] = { 0 };
+  _cache_filename(cache, _cache_key(pipe, hash), filename, sizeof(filename));
+  if(g_file_test(filename, G_FILE_TEST_EXISTS)) return TRUE;
+
+  __sync_fetch_and_add(&cache->misses, 1);
+  return FALSE;
+}
+
+int dt_dev_pixelpipe_cache_disk_read(dt_dev_pixelpipe_cache_disk_t *cache, dt_dev_pixelpipe_t *pipe,
+                                     const uint64_t hash, void *data, const size_t size,
+                                     dt_iop_buffer_dsc_t *dsc, double *cost)
+{
+  if(!cache->enabled || !pipe->disk_cache_hash) return 1;
+
+  const uint64_t key = _cache_key(pipe, hash);
+  char filename[PATH_MAX] = { 0 };
+  _cache_filename(cache, key, filename, sizeof(filename));
+
+  // a file which gets evicted by another process while we read it stays valid for us
+  FILE *f = g_fopen(filename, "rb");
+  if(!f) return 1;
+
+  dt_times_t start;
+  dt_get_times(&start);
+
+  int err = 1;
+  uint8_t *compressed = NULL;
+  uint8_t *shuffled = NULL;
+
+  dt_pixelpipe_cache_disk_header_t header;
+  if(fread(&header, sizeof(header), 1, f) != 1 || header.magic != DT_PIXELPIPE_CACHE_DISK_MAGIC
+     || header.version != DT_PIXELPIPE_CACHE_DISK_VERSION || header.key != key || header.size != size)
+    goto error;
+
+  compressed = dt_alloc_align(64, compressBound(DT_PIXELPIPE_CACHE_DISK_CHUNK));
+  shuffled = dt_alloc_align(64, DT_PIXELPIPE_CACHE_DISK_CHUNK);
+  if(!compressed || !shuffled) goto error;
+
+  for(size_t offset = 0; offset < size; offset += DT_PIXELPIPE_CACHE_DISK_CHUNK)
+  {
+    const size_t chunk_size = MIN(DT_PIXELPIPE_CACHE_DISK_CHUNK, size - offset);
+    dt_pixelpipe_cache_disk_chunk_t chunk;
+    if(fread(&chunk, sizeof(chunk), 1, f) != 1 || chunk.size != chunk_size
+       || chunk.compressed > compressBound(DT_PIXELPIPE_CACHE_DISK_CHUNK)
+       || fread(compressed, 1, chunk.compressed, f) != chunk.compressed)
+      goto error;
+
+    uLongf len = chunk_size;
+    if(uncompress(shuffled, &len, compressed, chunk.compressed) != Z_OK || len != chunk_size) goto error;
+    _unshuffle((uint8_t *)data + offset, shuffled, chunk_size);
+  }
+
+  dsc->channels = header.channels;
+  dsc->datatype = header.datatype;
+  dsc->filters = header.filters;
+  memcpy(dsc->xtrans, header.xtrans, sizeof(dsc->xtrans));
+  dsc->rawprepare.raw_black_level = header.raw_black_level;
+  dsc->rawprepare.raw_white_point = header.raw_white_point;
+  dsc->temperature.enabled = header.temperature_enabled;
+  memcpy(dsc->temperature.coeffs, header.temperature_coeffs, sizeof(dsc->temperature.coeffs));
+  memcpy(dsc->processed_maximum, header.processed_maximum, sizeof(dsc->processed_maximum));
+  dsc->cst = header.cst;
+  *cost = header.cost;
+  err = 0;
+
+error:
+  fclose(f);
+  dt_free_align(compressed);
+  dt_free_align(shuffled);
+
+  if(err)
+  {
+    // broken or from an incompatible version, make room for a good one
+    g_unlink(filename);
+    return 1;
+  }
+
+  // mark as recently used
+  g_utime(filename, NULL);
+  __sync_fetch_and_add(&cache->hits, 1);
+  dt_show_times_f(&start, "[pixelpipe_cache_disk]", "read %.1f MB (saved %.3f secs)",
+                  size / (1024.0 * 1024.0), header.cost);
+  return 0;
+}
+
+void dt_dev_pixelpipe_cache_disk_write(dt_dev_pixelpipe_cache_disk_t *cache, dt_dev_pixelpipe_t *pipe,
+                                       const uint64_t hash, const void *data, const size_t size,
+                                       const dt_iop_buffer_dsc_t *dsc, const double cost)
+{
+  if(!cache->enabled || !pipe->disk_cache_hash || size > cache->max_size / 4) return;
+
+  const uint64_t key = _cache_key(pipe, hash);
+  char filename[PATH_MAX] = { 0 };
+  _cache_filename(cache, key, filename, sizeof(filename));
+  if(g_file_test(filename, G_FILE_TEST_EXISTS)) return;
+
+  dt_times_t start;
+  dt_get_times(&start);
+
+  // write to a temporary file first and move it in place when complete, readers never see partial files
+  gchar *tmpname = g_strdup_printf("%s.XXXXXX", filename);
+  const int fd = g_mkstemp(tmpname);
+  if(fd == -1)
+  {
+    g_free(tmpname);
+    return;
+  }
+  FILE *f = fdopen(fd, "wb");
+  if(!f)
+  {
+    close(fd);
+    g_unlink(tmpname);
+    g_free(tmpname);
+    return;
+  }
+
+  int err = 1;
+  size_t written = sizeof(dt_pixelpipe_cache_disk_header_t);
+  const uLong bound = compressBound(DT_PIXELPIPE_CACHE_DISK_CHUNK);
+  uint8_t *compressed = dt_alloc_align(64, bound);
+  uint8_t *shuffled = dt_alloc_align(64, DT_PIXELPIPE_CACHE_DISK_CHUNK);
+  if(!compressed || !shuffled) goto error;
+
+  dt_pixelpipe_cache_disk_header_t header = { 0 };
+  header.magic = DT_PIXELPIPE_CACHE_DISK_MAGIC;
+  header.version = DT_PIXELPIPE_CACHE_DISK_VERSION;
+  header.key = key;
+  header.size = size;
+  header.cost = cost;
+  header.channels = dsc->channels;
+  header.datatype = dsc->datatype;
+  header.filters = dsc->filters;
+  memcpy(header.xtrans, dsc->xtrans, sizeof(header.xtrans));
+  header.raw_black_level = dsc->rawprepare.raw_black_level;
+  header.raw_white_point = dsc->rawprepare.raw_white_point;
+  header.temperature_enabled = dsc->temperature.enabled;
+  memcpy(header.temperature_coeffs, dsc->temperature.coeffs, sizeof(header.temperature_coeffs));
+  memcpy(header.processed_maximum, dsc->processed_maximum, sizeof(header.processed_maximum));
+  header.cst = dsc->cst;
+  if(fwrite(&header, sizeof(header), 1, f) != 1) goto error;
+
+  for(size_t offset = 0; offset < size; offset += DT_PIXELPIPE_CACHE_DISK_CHUNK)
+  {
+    const size_t chunk_size = MIN(DT_PIXELPIPE_CACHE_DISK_CHUNK, size - offset);
+    _shuffle(shuffled, (const uint8_t *)data + offset, chunk_size);
+
+    uLongf len = bound;
+    if(compress2(compressed, &len, shuffled, chunk_size, Z_BEST_SPEED) != Z_OK) goto error;
+
+    const dt_pixelpipe_cache_disk_chunk_t chunk = { .size = chunk_size, .compressed = len };
+    if(fwrite(&chunk, sizeof(chunk), 1, f) != 1 || fwrite(compressed, 1, len, f) != len) goto error;
+    written += sizeof(chunk) + len;
+  }
+
+  if(fclose(f) == 0 && g_rename(tmpname, filename) == 0) err = 0;
+  f = NULL;
+
+error:
+  if(f) fclose(f);
+  if(err) g_unlink(tmpname);
+  g_free(tmpname);
+  dt_free_align(compressed);
+  dt_free_align(shuffled);
+  if(err) return;
+
+  __sync_fetch_and_add(&cache->writes, 1);
+  dt_show_times_f(&start, "[pixelpipe_cache_disk]", "wrote %.1f MB as %.1f MB",
+                  size / (1024.0 * 1024.0), written / (1024.0 * 1024.0));
+
+  // our estimate ignores what other processes add, so we rescan the directory once we think we are full
+  dt_pthread_mutex_lock(&cache->lock);
+  cache->size += written;
+  if(cache->size > cache->max_size) _cache_gc(cache);
+  dt_pthread_mutex_unlock(&cache->lock);
+}
+
+void dt_dev_pixelpipe_cache_disk_print(dt_dev_pixelpipe_cache_disk_t *cache)
+{
+  if(!cache->enabled) return;
+  dt_print(DT_DEBUG_DEV | DT_DEBUG_PERF,
+           "[pixelpipe_cache_disk] %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " writes, %.1f MB in use\n",
+           cache->hits, cache->misses, cache->writes, cache->size / (1024.0 * 1024.0));
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,81 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/dtpthread.h"
+
+#include <glib.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stddef.h>
+
+struct dt_dev_pixelpipe_t;
+struct dt_iop_buffer_dsc_t;
+
+/**
+ * second level cache for pixelpipe buffers, kept on disk below the user's cache directory.
+ * buffers of expensive nodes are stored compressed, keyed by the pipe hash of the node (computed
+ * without the image id, which depends on the library) and an identification of the input image. files are created atomically and the directory is bounded
+ * in size by evicting the least recently used files, so several darktable processes can share it.
+ */
+
+// nodes taking less than this (in seconds) are not worth the disk space
+#define DT_PIXELPIPE_CACHE_DISK_MIN_COST 0.2
+
+typedef struct dt_dev_pixelpipe_cache_disk_t
+{
+  int enabled;
+  char path[PATH_MAX];
+  size_t max_size;
+  dt_pthread_mutex_t lock;
+  size_t size; // our estimate of the bytes in the cache directory
+  // statistics:
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t writes;
+} dt_dev_pixelpipe_cache_disk_t;
+
+void dt_dev_pixelpipe_cache_disk_init(dt_dev_pixelpipe_cache_disk_t *cache);
+void dt_dev_pixelpipe_cache_disk_cleanup(dt_dev_pixelpipe_cache_disk_t *cache);
+
+/** identifies the input image of the pipe across processes: file, modification time and input size.
+    returns 0 if the disk cache should not be used for this pipe. */
+uint64_t dt_dev_pixelpipe_cache_disk_image_hash(dt_dev_pixelpipe_cache_disk_t *cache,
+                                                struct dt_dev_pixelpipe_t *pipe);
+
+/** cheap check if there is an entry for the given pipe hash. */
+int dt_dev_pixelpipe_cache_disk_available(dt_dev_pixelpipe_cache_disk_t *cache, struct dt_dev_pixelpipe_t *pipe,
+                                          const uint64_t hash);
+
+/** fills data (size bytes) and dsc from the cache entry of the given pipe hash. returns 0 on success.
+    work_profile_info of dsc is left untouched. cost is set to the seconds it took to compute the entry. */
+int dt_dev_pixelpipe_cache_disk_read(dt_dev_pixelpipe_cache_disk_t *cache, struct dt_dev_pixelpipe_t *pipe,
+                                     const uint64_t hash, void *data, const size_t size,
+                                     struct dt_iop_buffer_dsc_t *dsc, double *cost);
+
+/** stores the buffer under the given pipe hash, unless it is there already. */
+void dt_dev_pixelpipe_cache_disk_write(dt_dev_pixelpipe_cache_disk_t *cache, struct dt_dev_pixelpipe_t *pipe,
+                                       const uint64_t hash, const void *data, const size_t size,
+                                       const struct dt_iop_buffer_dsc_t *dsc, const double cost);
+
+void dt_dev_pixelpipe_cache_disk_print(dt_dev_pixelpipe_cache_disk_t *cache);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
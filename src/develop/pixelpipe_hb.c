@@ -23,12 +23,15 @@
 #include "common/imageio.h"
 #include "common/opencl.h"
 #include "common/iop_order.h"
+#include "common/profiler.h"
 #include "control/control.h"
 #include "control/signal.h"
 #include "develop/blend.h"
 #include "develop/format.h"
 #include "develop/imageop_math.h"
 #include "develop/pixelpipe.h"
+#include "develop/pixelpipe_cache_disk.h"
+#include "develop/scopes.h"
 #include "develop/tiling.h"
 #include "develop/masks.h"
 #include "gui/gtk.h"
@@ -68,9 +71,9 @@ typedef enum dt_pixelpipe_picker_source_t
 static void get_output_format(dt_iop_module_t *module, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece,
                               dt_develop_t *dev, dt_iop_buffer_dsc_t *dsc);
 
-static char *_pipe_type_to_str(int pipe_type)
+const char *dt_dev_pixelpipe_type_to_str(const int pipe_type)
 {
-  char *r;
+  const char *r;
 
   switch(pipe_type)
   {
@@ -95,6 +98,126 @@ static char *_pipe_type_to_str(int pipe_type)
   return r;
 }
 
+// the following wrap the expensive calls of dt_dev_pixelpipe_process_rec() to time them with --trace
+
+static void _profiler_record(const char *category, dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece,
+                             const dt_times_t *start, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
+                             const int tiles, const int device)
+{
+  const size_t bytes_in = (size_t)roi_in->width * roi_in->height * dt_iop_buffer_dsc_to_bpp(&piece->dsc_in);
+  const size_t bytes_out = (size_t)roi_out->width * roi_out->height * dt_iop_buffer_dsc_to_bpp(&piece->dsc_out);
+  dt_profiler_record(darktable.profiler, category, module->op, module->multi_name, piece->pipe, start, bytes_in,
+                     bytes_out, tiles, device);
+}
+
+static void _process(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, const void *const input,
+                     void *const output, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_times_t start = { 0 };
+  if(dt_profiler_enabled()) dt_get_times(&start);
+  module->process(module, piece, input, output, roi_in, roi_out);
+  if(dt_profiler_enabled()) _profiler_record("process", module, piece, &start, roi_in, roi_out, 0, -1);
+}
+
+static void _process_tiling(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, const void *const input,
+                            void *const output, const dt_iop_roi_t *const roi_in,
+                            const dt_iop_roi_t *const roi_out, const int bpp)
+{
+  dt_times_t start = { 0 };
+  if(dt_profiler_enabled()) dt_get_times(&start);
+  piece->pipe->tiles = 0;
+  module->process_tiling(module, piece, input, output, roi_in, roi_out, bpp);
+  if(dt_profiler_enabled())
+    _profiler_record("process_tiling", module, piece, &start, roi_in, roi_out, piece->pipe->tiles, -1);
+}
+
+static void _blend_process(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, const void *const input,
+                           void *const output, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_times_t start = { 0 };
+  if(dt_profiler_enabled()) dt_get_times(&start);
+  dt_develop_blend_process(module, piece, input, output, roi_in, roi_out);
+  if(dt_profiler_enabled()) _profiler_record("blend", module, piece, &start, roi_in, roi_out, 0, -1);
+}
+
+static void _transform_image_colorspace(dt_dev_pixelpipe_iop_t *piece, dt_iop_module_t *module,
+                                        const float *const image_in, float *const image_out, const int width,
+                                        const int height, const int cst_from, const int cst_to, int *converted_cst,
+                                        const dt_iop_order_iccprofile_info_t *const profile_info)
+{
+  // most calls find the buffer in the right colorspace already, these are not worth an event
+  const gboolean record = dt_profiler_enabled() && cst_from != cst_to;
+  dt_times_t start = { 0 };
+  if(record) dt_get_times(&start);
+  dt_ioppr_transform_image_colorspace(module, image_in, image_out, width, height, cst_from, cst_to, converted_cst,
+                                      profile_info);
+  if(record)
+  {
+    const size_t bytes = (size_t)width * height * 4 * sizeof(float);
+    dt_profiler_record(darktable.profiler, "colorspace", module->op, module->multi_name, piece->pipe, &start,
+                       bytes, bytes, 0, -1);
+  }
+}
+
+#ifdef HAVE_OPENCL
+static int _process_cl(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+                       const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_times_t start = { 0 };
+  if(dt_profiler_enabled()) dt_get_times(&start);
+  const int success = module->process_cl(module, piece, dev_in, dev_out, roi_in, roi_out);
+  if(dt_profiler_enabled())
+    _profiler_record("process", module, piece, &start, roi_in, roi_out, 0, piece->pipe->devid);
+  return success;
+}
+
+static int _process_tiling_cl(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, const void *const input,
+                              void *const output, const dt_iop_roi_t *const roi_in,
+                              const dt_iop_roi_t *const roi_out, const int bpp)
+{
+  dt_times_t start = { 0 };
+  if(dt_profiler_enabled()) dt_get_times(&start);
+  piece->pipe->tiles = 0;
+  const int success = module->process_tiling_cl(module, piece, input, output, roi_in, roi_out, bpp);
+  if(dt_profiler_enabled())
+    _profiler_record("process_tiling", module, piece, &start, roi_in, roi_out, piece->pipe->tiles,
+                     piece->pipe->devid);
+  return success;
+}
+
+static int _blend_process_cl(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in,
+                             cl_mem dev_out, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_times_t start = { 0 };
+  if(dt_profiler_enabled()) dt_get_times(&start);
+  const int success = dt_develop_blend_process_cl(module, piece, dev_in, dev_out, roi_in, roi_out);
+  if(dt_profiler_enabled())
+    _profiler_record("blend", module, piece, &start, roi_in, roi_out, 0, piece->pipe->devid);
+  return success;
+}
+
+static int _transform_image_colorspace_cl(dt_dev_pixelpipe_iop_t *piece, dt_iop_module_t *module,
+                                          const int devid, cl_mem dev_img_in, cl_mem dev_img_out, const int width,
+                                          const int height, const int cst_from, const int cst_to,
+                                          int *converted_cst,
+                                          const dt_iop_order_iccprofile_info_t *const profile_info)
+{
+  const gboolean record = dt_profiler_enabled() && cst_from != cst_to;
+  dt_times_t start = { 0 };
+  if(record) dt_get_times(&start);
+  const int success = dt_ioppr_transform_image_colorspace_cl(module, devid, dev_img_in, dev_img_out, width,
+                                                             height, cst_from, cst_to, converted_cst,
+                                                             profile_info);
+  if(record)
+  {
+    const size_t bytes = (size_t)width * height * 4 * sizeof(float);
+    dt_profiler_record(darktable.profiler, "colorspace", module->op, module->multi_name, piece->pipe, &start,
+                       bytes, bytes, 0, devid);
+  }
+  return success;
+}
+#endif
+
 int dt_dev_pixelpipe_init_export(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height, int levels,
                                  gboolean store_masks)
 {
@@ -119,11 +242,18 @@ int dt_dev_pixelpipe_init_dummy(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t
   return res;
 }
 
+// interactive pipes keep many variable sized cache lines, bounded by memory instead of count
+static size_t _interactive_cache_budget()
+{
+  const int64_t budget = dt_conf_get_int64("pixelpipe_cache_memory");
+  return CLAMPS(budget, (int64_t)64 << 20, (int64_t)32 << 30);
+}
+
 int dt_dev_pixelpipe_init_preview(dt_dev_pixelpipe_t *pipe)
 {
   // don't know which buffer size we're going to need, set to 0 (will be alloced on demand)
-  int res = dt_dev_pixelpipe_init_cached(
-      pipe, 0, 5);
+  int res = dt_dev_pixelpipe_init_cached_budget(pipe, 0, DT_PIXELPIPE_CACHE_INTERACTIVE_ENTRIES,
+                                                _interactive_cache_budget());
   pipe->type = DT_DEV_PIXELPIPE_PREVIEW;
   return res;
 }
@@ -131,7 +261,8 @@ int dt_dev_pixelpipe_init_preview(dt_dev_pixelpipe_t *pipe)
 int dt_dev_pixelpipe_init_preview2(dt_dev_pixelpipe_t *pipe)
 {
   // don't know which buffer size we're going to need, set to 0 (will be alloced on demand)
-  int res = dt_dev_pixelpipe_init_cached(pipe, 0, 5);
+  int res = dt_dev_pixelpipe_init_cached_budget(pipe, 0, DT_PIXELPIPE_CACHE_INTERACTIVE_ENTRIES,
+                                                _interactive_cache_budget());
   pipe->type = DT_DEV_PIXELPIPE_PREVIEW2;
   return res;
 }
@@ -139,13 +270,19 @@ int dt_dev_pixelpipe_init_preview2(dt_dev_pixelpipe_t *pipe)
 int dt_dev_pixelpipe_init(dt_dev_pixelpipe_t *pipe)
 {
   // don't know which buffer size we're going to need, set to 0 (will be alloced on demand)
-  int res = dt_dev_pixelpipe_init_cached(
-      pipe, 0, 5);
+  int res = dt_dev_pixelpipe_init_cached_budget(pipe, 0, DT_PIXELPIPE_CACHE_INTERACTIVE_ENTRIES,
+                                                _interactive_cache_budget());
   pipe->type = DT_DEV_PIXELPIPE_FULL;
   return res;
 }
 
 int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries)
+{
+  return dt_dev_pixelpipe_init_cached_budget(pipe, size, entries, 0);
+}
+
+int dt_dev_pixelpipe_init_cached_budget(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries,
+                                        size_t max_memory)
 {
   pipe->devid = -1;
   pipe->changed = DT_DEV_PIPE_UNCHANGED;
@@ -153,7 +290,9 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->processed_height = pipe->backbuf_height = pipe->iheight = 0;
   pipe->nodes = NULL;
   pipe->backbuf_size = size;
-  if(!dt_dev_pixelpipe_cache_init(&(pipe->cache), entries, pipe->backbuf_size)) return 0;
+  if(!dt_dev_pixelpipe_cache_init_budget(&(pipe->cache), entries, pipe->backbuf_size, max_memory)) return 0;
+  dt_buffer_pool_init(&pipe->pool, (size_t)MAX(0, dt_conf_get_int64("pixelpipe_buffer_pool_size")) << 20);
+  pipe->masks_cache = dt_masks_cache_init((size_t)MAX(0, dt_conf_get_int64("pixelpipe_masks_cache_size")) << 20);
   pipe->cache_obsolete = 0;
   pipe->backbuf = NULL;
   pipe->backbuf_scale = 0.f;
@@ -194,6 +333,7 @@ void dt_dev_pixelpipe_set_input(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, flo
   pipe->iscale = iscale;
   pipe->input = input;
   pipe->image = dev->image_storage;
+  pipe->disk_cache_hash = dt_dev_pixelpipe_cache_disk_image_hash(darktable.pixelpipe_cache_disk, pipe);
   get_output_format(NULL, pipe, NULL, dev, &pipe->dsc);
 }
 
@@ -214,6 +354,13 @@ void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe)
   dt_dev_pixelpipe_cleanup_nodes(pipe);
   // so now it's safe to clean up cache:
   dt_dev_pixelpipe_cache_cleanup(&(pipe->cache));
+  if(darktable.unmuted & DT_DEBUG_MEMORY)
+    dt_buffer_pool_print(&pipe->pool, dt_dev_pixelpipe_type_to_str(pipe->type));
+  dt_buffer_pool_cleanup(&pipe->pool);
+  if(darktable.unmuted & DT_DEBUG_MEMORY)
+    dt_masks_cache_print(pipe->masks_cache, dt_dev_pixelpipe_type_to_str(pipe->type));
+  dt_masks_cache_cleanup(pipe->masks_cache);
+  pipe->masks_cache = NULL;
   dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
   dt_pthread_mutex_destroy(&(pipe->backbuf_mutex));
   dt_pthread_mutex_destroy(&(pipe->busy_mutex));
@@ -458,14 +605,14 @@ static void histogram_collect_cl(int devid, dt_dev_pixelpipe_iop_t *piece, cl_me
   if(buffer && bufsize >= (size_t)roi->width * roi->height * 4 * sizeof(float))
     pixel = buffer;
   else
-    pixel = tmpbuf = dt_alloc_align(64, (size_t)roi->width * roi->height * 4 * sizeof(float));
+    pixel = tmpbuf = dt_buffer_pool_alloc(&piece->pipe->pool, (size_t)roi->width * roi->height * 4 * sizeof(float));
 
   if(!pixel) return;
 
   cl_int err = dt_opencl_copy_device_to_host(devid, pixel, img, roi->width, roi->height, 4 * sizeof(float));
   if(err != CL_SUCCESS)
   {
-    if(tmpbuf) dt_free_align(tmpbuf);
+    dt_buffer_pool_free(&piece->pipe->pool, tmpbuf);
     return;
   }
 
@@ -489,7 +636,7 @@ static void histogram_collect_cl(int devid, dt_dev_pixelpipe_iop_t *piece, cl_me
       piece->module->histogram_middle_grey, dt_ioppr_get_pipe_work_profile_info(piece->pipe));
   dt_histogram_max_helper(&piece->histogram_stats, cst, piece->module->histogram_cst, histogram, histogram_max);
 
-  if(tmpbuf) dt_free_align(tmpbuf);
+  dt_buffer_pool_free(&piece->pipe->pool, tmpbuf);
 }
 #endif
 
@@ -913,219 +1060,75 @@ static void _pixelpipe_pick_primary_colorpicker(dt_develop_t *dev, const float *
   if(xform_rgb2rgb) cmsDeleteTransform(xform_rgb2rgb);
 }
 
-static void _pixelpipe_final_histogram(dt_develop_t *dev, const float *const input, const dt_iop_roi_t *roi_in)
+// returns 1 if blend process need the module default colorspace
+static int _transform_for_blend(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const int cst_in, const int cst_out)
 {
-  float *img_tmp = NULL;
-
-  dt_dev_histogram_collection_params_t histogram_params = { 0 };
-  const dt_iop_colorspace_type_t cst = iop_cs_rgb;
-  dt_dev_histogram_stats_t histogram_stats = { .bins_count = 256, .ch = 4, .pixels = 0 };
-  uint32_t histogram_max[4] = { 0 };
-  dt_histogram_roi_t histogram_roi = { .width = roi_in->width, .height = roi_in->height,
-                                      .crop_x = 0, .crop_y = 0, .crop_width = 0, .crop_height = 0 };
-
-  // Constraining the area if the colorpicker is active in area mode
-  if(dev->gui_module && !strcmp(dev->gui_module->op, "colorout")
-     && dev->gui_module->request_color_pick != DT_REQUEST_COLORPICK_OFF
-     && darktable.lib->proxy.colorpicker.restrict_histogram)
+  int ret = 0;
+  const dt_develop_blend_params_t *const d = (const dt_develop_blend_params_t *const)piece->blendop_data;
+  if(d)
   {
-    if(darktable.lib->proxy.colorpicker.size == DT_COLORPICKER_SIZE_BOX)
-    {
-      histogram_roi.crop_x = MIN(roi_in->width, MAX(0, dev->gui_module->color_picker_box[0] * roi_in->width));
-      histogram_roi.crop_y = MIN(roi_in->height, MAX(0, dev->gui_module->color_picker_box[1] * roi_in->height));
-      histogram_roi.crop_width = roi_in->width - MIN(roi_in->width, MAX(0, dev->gui_module->color_picker_box[2] * roi_in->width));
-      histogram_roi.crop_height = roi_in->height - MIN(roi_in->height, MAX(0, dev->gui_module->color_picker_box[3] * roi_in->height));
-    }
-    else
+    // check only if blend is active
+    if((self->flags() & IOP_FLAGS_SUPPORTS_BLENDING) && (d->mask_mode != DEVELOP_MASK_DISABLED))
     {
-      histogram_roi.crop_x = MIN(roi_in->width, MAX(0, dev->gui_module->color_picker_point[0] * roi_in->width));
-      histogram_roi.crop_y = MIN(roi_in->height, MAX(0, dev->gui_module->color_picker_point[1] * roi_in->height));
-      histogram_roi.crop_width = roi_in->width - MIN(roi_in->width, MAX(0, dev->gui_module->color_picker_point[0] * roi_in->width));
-      histogram_roi.crop_height = roi_in->height - MIN(roi_in->height, MAX(0, dev->gui_module->color_picker_point[1] * roi_in->height));
+      ret = 1;
     }
   }
 
-  dt_colorspaces_color_profile_type_t histogram_type = DT_COLORSPACE_SRGB;
-  gchar *histogram_filename = NULL;
-  gchar _histogram_filename[1] = { 0 };
-
-  dt_ioppr_get_histogram_profile_type(&histogram_type, &histogram_filename);
-  if(histogram_filename == NULL) histogram_filename = _histogram_filename;
-
-  if((histogram_type != darktable.color_profiles->display_type)
-     || (histogram_type == DT_COLORSPACE_FILE
-         && strcmp(histogram_filename, darktable.color_profiles->display_filename)))
-  {
-    img_tmp = dt_alloc_align(64, roi_in->width * roi_in->height * 4 * sizeof(float));
-
-    const dt_iop_order_iccprofile_info_t *const profile_info_from
-        = dt_ioppr_add_profile_info_to_list(dev, darktable.color_profiles->display_type,
-                                            darktable.color_profiles->display_filename, INTENT_PERCEPTUAL);
-    const dt_iop_order_iccprofile_info_t *const profile_info_to
-        = dt_ioppr_add_profile_info_to_list(dev, histogram_type, histogram_filename, INTENT_PERCEPTUAL);
-
-    dt_ioppr_transform_image_colorspace_rgb(input, img_tmp, roi_in->width, roi_in->height, profile_info_from,
-                                            profile_info_to, "final histogram");
-  }
-
-  dt_times_t start_time = { 0 };
-  if(darktable.unmuted & DT_DEBUG_PERF) dt_get_times(&start_time);
-
-  dev->histogram_max = 0;
-  memset(dev->histogram, 0, sizeof(uint32_t) * 4 * 256);
-
-  histogram_params.roi = &histogram_roi;
-  histogram_params.bins_count = 256;
-  histogram_params.mul = histogram_params.bins_count - 1;
-
-  dt_histogram_helper(&histogram_params, &histogram_stats, cst, iop_cs_NONE, (img_tmp) ? img_tmp: input, &dev->histogram, FALSE, NULL);
-  dt_histogram_max_helper(&histogram_stats, cst, iop_cs_NONE, &dev->histogram, histogram_max);
-  dev->histogram_max = MAX(MAX(histogram_max[0], histogram_max[1]), histogram_max[2]);
-
-  if(img_tmp) dt_free_align(img_tmp);
-
-  if(darktable.unmuted & DT_DEBUG_PERF)
-  {
-    dt_times_t end_time = { 0 };
-    dt_get_times(&end_time);
-    fprintf(stderr, "final histogram took %.3f secs (%.3f CPU)\n", end_time.clock - start_time.clock, end_time.user - start_time.user);
-  }
+  return ret;
 }
 
-static void _pixelpipe_final_histogram_waveform(dt_develop_t *dev, const float *const input, const dt_iop_roi_t *roi_in)
+// a buffer from the disk cache skips the modules up to pos, and with them the raster masks they would have
+// stored for the modules after it
+static gboolean _pixelpipe_raster_mask_used_after(const dt_dev_pixelpipe_t *pipe, const int pos)
 {
-  dt_times_t start_time = { 0 };
-  if(darktable.unmuted & DT_DEBUG_PERF) dt_get_times(&start_time);
-
-  const int waveform_height = dev->histogram_waveform_height;
-  const int waveform_stride = dev->histogram_waveform_stride;
-  uint8_t *const waveform = dev->histogram_waveform;
-  // Use integral sized bins for columns, as otherwise they will be
-  // unequal and have banding. Rely on GUI to smoothly do horizontal
-  // scaling.
-  // Note that histogram_waveform_stride is pre-initialized/hardcoded,
-  // but histogram_waveform_width varies, depending on preview image
-  // width and # of bins.
-  const int bin_width = ceilf((float)(roi_in->width) / (float)(waveform_stride/4));
-  const int waveform_width = ceilf(roi_in->width / (float)bin_width);
-  dev->histogram_waveform_width = waveform_width;
-
-  // max input size should be 1440x900, and with a bin_width of 1,
-  // that makes a maximum possible count of 900 in buf, while even if
-  // waveform buffer is 128 (about smallest possible), bin_width is
-  // 12, making max count of 10,800, still much smaller than uint16_t
-  uint16_t *buf = (uint16_t *)calloc(waveform_width * waveform_height * 3, sizeof(uint16_t));
-  memset(dev->histogram_waveform, 0, sizeof(uint8_t) * waveform_height * waveform_stride);
-
-  // 1.0 is at 8/9 of the height!
-  const double _height = (double)(waveform_height - 1);
-
-  // count the colors into buf ...
-  // work bin-wise so omp threads won't conflict
-#ifdef _OPENMP
-#pragma omp parallel for SIMD() default(none) \
-  dt_omp_firstprivate(roi_in, bin_width, _height, waveform_width, input, buf) \
-  schedule(static,bin_width*64)
-#endif
-  for(int in_x = 0; in_x < roi_in->width; in_x++)
+  int k = 0;
+  for(const GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes), k++)
   {
-    const int out_x = in_x / bin_width;
-    for(int in_y = 0; in_y < roi_in->height; in_y++)
-    {
-      const float *const in = input + 4 * (in_y*roi_in->width + in_x);
-      for(int k = 0; k < 3; k++)
-      {
-        const float c = in[2 - k];
-        // catch NaNs as they don't convert well to integers
-        // FIXME: skip NaN's rather than treating as 0?
-        const float v = isnan(c) ? 0.0f : c;
-        const int out_y = CLAMP(1.0 - (8.0 / 9.0) * v, 0.0, 1.0) * _height;
-        uint16_t *const out = buf + (out_x + waveform_width * out_y) * 3 + k;
-        (*out)++;
-      }
-    }
+    if(k < pos) continue;
+    const dt_dev_pixelpipe_iop_t *piece = (const dt_dev_pixelpipe_iop_t *)nodes->data;
+    const dt_develop_blend_params_t *const d = (const dt_develop_blend_params_t *const)piece->blendop_data;
+    if(piece->enabled && d && (d->mask_mode & DEVELOP_MASK_ENABLED) && (d->mask_mode & DEVELOP_MASK_RASTER)
+       && piece->module->raster_mask.sink.source)
+      return TRUE;
   }
+  return FALSE;
+}
 
-  // TODO: Find a nicer function to map buf -> image than just clipping
-  //         float factor[3];
-  //         for(int k = 0; k < 3; k++)
-  //           factor[k] = 255.0 / (float)(maxcol[k] - mincol[k]); // leave some clipping
-
-  // ... and scale that into a nice image. putting the pixels into the image directly gets too
-  // saturated/clips.
-
-  // new scale factor to do about the same as the old one for 1MP views, but scale to hidpi
-  const float scale = 0.5 * 1e6f/(roi_in->height*roi_in->width) *
-    (waveform_width*waveform_height) / (350.0f*233.)
-    / 255.0f; // normalization to 0..1 for gamma correction
-  const float gamma = 1.0 / 1.5; // TODO make this settable from the gui?
-  //uint32_t mincol[3] = {UINT32_MAX,UINT32_MAX,UINT32_MAX}, maxcol[3] = {0,0,0};
-  // even bin_width 12 and height 900 image gives 10,800 byte cache, more normal will ~1K
-  const int cache_size = (roi_in->height * bin_width) + 1;
-  uint8_t *cache = (uint8_t *)calloc(cache_size, sizeof(uint8_t));
+// recursive helper for process:
+// try to fill a cache line from the disk cache. disk_hash is the pipe hash without the image id, which
+// is not stable between libraries.
+static int _pixelpipe_cache_disk_get(dt_dev_pixelpipe_t *pipe, const uint64_t hash, const uint64_t disk_hash,
+                                     const size_t bufsize, void **output, dt_iop_buffer_dsc_t **out_format)
+{
+  dt_dev_pixelpipe_cache_disk_t *disk = darktable.pixelpipe_cache_disk;
+  if(!dt_dev_pixelpipe_cache_disk_available(disk, pipe, disk_hash)) return FALSE;
 
-#ifdef _OPENMP
-#pragma omp parallel for SIMD() default(none) \
-  dt_omp_firstprivate(waveform_width, waveform_height, waveform_stride, buf, waveform, cache, scale, gamma) \
-  schedule(static)
-#endif
-  for(int out_y = 0; out_y < waveform_height; out_y++)
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown)
   {
-    for(int out_x = 0; out_x < waveform_width; out_x++)
-    {
-      const uint16_t *const in = buf + (waveform_width * out_y + out_x) * 3;
-      uint8_t *const out = waveform + (out_y * waveform_stride) + (out_x * 4);
-      for(int k = 0; k < 3; k++)
-      {
-        //mincol[k] = MIN(mincol[k], in[k]);
-        //maxcol[k] = MAX(maxcol[k], in[k]);
-        const uint16_t v = in[k];
-        // cache XORd result so common casees cached and cache misses are quick to find
-        if(!cache[v])
-        {
-          // multiple threads may be writing to cache[v], but as
-          // they're writing the same value, don't declare omp atomic
-          cache[v] = (uint8_t)(CLAMP(powf(v * scale, gamma) * 255.0, 0, 255)) ^ 1;
-        }
-        out[k] = cache[v] ^ 1;
-        //               if(in[k] == 0)
-        //                 out[k] = 0;
-        //               else
-        //                 out[k] = (float)(in[k] - mincol[k]) * factor[k];
-      }
-    }
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return FALSE;
   }
-  //printf("mincol %d,%d,%d maxcol %d,%d,%d\n", mincol[0], mincol[1], mincol[2], maxcol[0], maxcol[1], maxcol[2]);
-
-  free(cache);
-  free(buf);
+  // keeps the work profile of the current pipe
+  dt_iop_buffer_dsc_t dsc = **out_format;
+  (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
 
-  if(darktable.unmuted & DT_DEBUG_PERF)
-  {
-    dt_times_t end_time = { 0 };
-    dt_get_times(&end_time);
-    fprintf(stderr, "final histogram waveform took %.3f secs (%.3f CPU)\n", end_time.clock - start_time.clock, end_time.user - start_time.user);
-  }
-}
+  double cost = 0.0;
+  const int err = dt_dev_pixelpipe_cache_disk_read(disk, pipe, disk_hash, *output, bufsize, &dsc, &cost);
 
-// returns 1 if blend process need the module default colorspace
-static int _transform_for_blend(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const int cst_in, const int cst_out)
-{
-  int ret = 0;
-  const dt_develop_blend_params_t *const d = (const dt_develop_blend_params_t *const)piece->blendop_data;
-  if(d)
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(err)
+    dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+  else
   {
-    // check only if blend is active
-    if((self->flags() & IOP_FLAGS_SUPPORTS_BLENDING) && (d->mask_mode != DEVELOP_MASK_DISABLED))
-    {
-      ret = 1;
-    }
+    **out_format = dsc;
+    dt_dev_pixelpipe_cache_set_cost(&(pipe->cache), *output, cost);
   }
-
-  return ret;
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  return !err;
 }
 
-// recursive helper for process:
 static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
                                         void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
                                         const dt_iop_roi_t *roi_out, GList *modules, GList *pieces, int pos)
@@ -1163,11 +1166,19 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
   }
   int cache_available = 0;
   uint64_t hash = 0;
+  uint64_t disk_hash = 0;
   // do not get gamma from cache on preview pipe so we can compute the final histogram
   if(pipe->type != DT_DEV_PIXELPIPE_PREVIEW || module == NULL || strcmp(module->op, "gamma") != 0)
   {
     hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, roi_out, pipe, pos);
     cache_available = dt_dev_pixelpipe_cache_available(&(pipe->cache), hash);
+    if(module) dt_dev_pixelpipe_cache_count(&(pipe->cache), module->op, cache_available);
+    if(module && pipe->disk_cache_hash && !_pixelpipe_raster_mask_used_after(pipe, pos))
+    {
+      disk_hash = dt_dev_pixelpipe_cache_hash(0, roi_out, pipe, pos);
+      // a mask preview must never be taken for the image, or the other way round
+      disk_hash = ((disk_hash << 5) + disk_hash) ^ pipe->mask_display;
+    }
   }
   if(cache_available)
   {
@@ -1184,6 +1195,10 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
   else
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
 
+  // 1b) maybe this buffer has been computed before, by an earlier run or another darktable process
+  if(disk_hash && _pixelpipe_cache_disk_get(pipe, hash, disk_hash, bufsize, output, out_format))
+    goto post_process_collect_info;
+
   // 2) if history changed or exit event, abort processing?
   // preview pipe: abort on all but zoom events (same buffer anyways)
   if(dt_iop_breakpoint(dev, pipe)) return 1;
@@ -1251,7 +1266,8 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       // else found in cache.
     }
 
-    dt_show_times_f(&start, "[dev_pixelpipe]", "initing base buffer [%s]", _pipe_type_to_str(pipe->type));
+    dt_show_times_f(&start, "[dev_pixelpipe]", "initing base buffer [%s]",
+                    dt_dev_pixelpipe_type_to_str(pipe->type));
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
   }
   else
@@ -1495,9 +1511,9 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
           // transform to input colorspace
           if(success_opencl)
           {
-            success_opencl = dt_ioppr_transform_image_colorspace_cl(
-                module, piece->pipe->devid, cl_mem_input, cl_mem_input, roi_in.width, roi_in.height, input_cst_cl,
-                module->input_colorspace(module, pipe, piece), &input_cst_cl,
+            success_opencl = _transform_image_colorspace_cl(
+                piece, module, piece->pipe->devid, cl_mem_input, cl_mem_input, roi_in.width, roi_in.height,
+                input_cst_cl, module->input_colorspace(module, pipe, piece), &input_cst_cl,
                 dt_ioppr_get_pipe_work_profile_info(pipe));
           }
 
@@ -1541,7 +1557,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
           if(success_opencl)
           {
             success_opencl
-                = module->process_cl(module, piece, cl_mem_input, *cl_mem_output, &roi_in, roi_out);
+                = _process_cl(module, piece, cl_mem_input, *cl_mem_output, &roi_in, roi_out);
             pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_GPU);
             pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_CPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
 
@@ -1591,13 +1607,13 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
           {
             if(_transform_for_blend(module, piece, input_cst_cl, pipe->dsc.cst))
             {
-              success_opencl = dt_ioppr_transform_image_colorspace_cl(
-                  module, piece->pipe->devid, cl_mem_input, cl_mem_input, roi_in.width, roi_in.height,
+              success_opencl = _transform_image_colorspace_cl(
+                  piece, module, piece->pipe->devid, cl_mem_input, cl_mem_input, roi_in.width, roi_in.height,
                   input_cst_cl, module->blend_colorspace(module, pipe, piece), &input_cst_cl,
                   dt_ioppr_get_pipe_work_profile_info(pipe));
 
-              success_opencl = dt_ioppr_transform_image_colorspace_cl(
-                  module, piece->pipe->devid, *cl_mem_output, *cl_mem_output, roi_out->width, roi_out->height,
+              success_opencl = _transform_image_colorspace_cl(
+                  piece, module, piece->pipe->devid, *cl_mem_output, *cl_mem_output, roi_out->width, roi_out->height,
                   pipe->dsc.cst, module->blend_colorspace(module, pipe, piece), &pipe->dsc.cst,
                   dt_ioppr_get_pipe_work_profile_info(pipe));
             }
@@ -1607,7 +1623,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
           if(success_opencl)
           {
             success_opencl
-                = dt_develop_blend_process_cl(module, piece, cl_mem_input, *cl_mem_output, &roi_in, roi_out);
+                = _blend_process_cl(module, piece, cl_mem_input, *cl_mem_output, &roi_in, roi_out);
             pixelpipe_flow |= (PIXELPIPE_FLOW_BLENDED_ON_GPU);
             pixelpipe_flow &= ~(PIXELPIPE_FLOW_BLENDED_ON_CPU);
           }
@@ -1669,9 +1685,9 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
           // transform to module input colorspace
           if(success_opencl)
           {
-            dt_ioppr_transform_image_colorspace(module, input, input, roi_in.width, roi_in.height,
-                                                input_format->cst, module->input_colorspace(module, pipe, piece),
-                                                &input_format->cst, dt_ioppr_get_pipe_work_profile_info(pipe));
+            _transform_image_colorspace(piece, module, input, input, roi_in.width, roi_in.height,
+                                        input_format->cst, module->input_colorspace(module, pipe, piece),
+                                        &input_format->cst, dt_ioppr_get_pipe_work_profile_info(pipe));
           }
 
           // histogram collection for module
@@ -1709,7 +1725,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
           if(success_opencl)
           {
             success_opencl
-                = module->process_tiling_cl(module, piece, input, *output, &roi_in, roi_out, in_bpp);
+                = _process_tiling_cl(module, piece, input, *output, &roi_in, roi_out, in_bpp);
             pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
             pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_CPU);
 
@@ -1753,20 +1769,20 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
           {
             if(_transform_for_blend(module, piece, input_format->cst, pipe->dsc.cst))
             {
-              dt_ioppr_transform_image_colorspace(module, input, input, roi_in.width, roi_in.height,
-                                                  input_format->cst, module->blend_colorspace(module, pipe, piece),
-                                                  &input_format->cst, dt_ioppr_get_pipe_work_profile_info(pipe));
+              _transform_image_colorspace(piece, module, input, input, roi_in.width, roi_in.height,
+                                          input_format->cst, module->blend_colorspace(module, pipe, piece),
+                                          &input_format->cst, dt_ioppr_get_pipe_work_profile_info(pipe));
 
-              dt_ioppr_transform_image_colorspace(module, *output, *output, roi_out->width, roi_out->height,
-                                                  pipe->dsc.cst, module->blend_colorspace(module, pipe, piece),
-                                                  &pipe->dsc.cst, dt_ioppr_get_pipe_work_profile_info(pipe));
+              _transform_image_colorspace(piece, module, *output, *output, roi_out->width, roi_out->height,
+                                          pipe->dsc.cst, module->blend_colorspace(module, pipe, piece),
+                                          &pipe->dsc.cst, dt_ioppr_get_pipe_work_profile_info(pipe));
             }
           }
 
           /* do process blending on cpu (this is anyhow fast enough) */
           if(success_opencl)
           {
-            dt_develop_blend_process(module, piece, input, *output, &roi_in, roi_out);
+            _blend_process(module, piece, input, *output, &roi_in, roi_out);
             pixelpipe_flow |= (PIXELPIPE_FLOW_BLENDED_ON_CPU);
             pixelpipe_flow &= ~(PIXELPIPE_FLOW_BLENDED_ON_GPU);
           }
@@ -1906,9 +1922,9 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
           }
 
           // transform to module input colorspace
-          dt_ioppr_transform_image_colorspace(module, input, input, roi_in.width, roi_in.height, input_format->cst,
-                                              module->input_colorspace(module, pipe, piece), &input_format->cst,
-                                              dt_ioppr_get_pipe_work_profile_info(pipe));
+          _transform_image_colorspace(piece, module, input, input, roi_in.width, roi_in.height, input_format->cst,
+                                      module->input_colorspace(module, pipe, piece), &input_format->cst,
+                                      dt_ioppr_get_pipe_work_profile_info(pipe));
 
           // histogram collection for module
           if((dev->gui_attached || !(piece->request_histogram & DT_REQUEST_ONLY_IN_GUI))
@@ -1947,13 +1963,13 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
                                                   MAX(roi_in.height, roi_out->height), MAX(in_bpp, bpp),
                                                   tiling.factor, tiling.overhead))
           {
-            module->process_tiling(module, piece, input, *output, &roi_in, roi_out, in_bpp);
+            _process_tiling(module, piece, input, *output, &roi_in, roi_out, in_bpp);
             pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
             pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU);
           }
           else
           {
-            module->process(module, piece, input, *output, &roi_in, roi_out);
+            _process(module, piece, input, *output, &roi_in, roi_out);
             pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU);
             pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
           }
@@ -1995,17 +2011,17 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
           // blend needs input/output images with default colorspace
           if(_transform_for_blend(module, piece, input_format->cst, pipe->dsc.cst))
           {
-            dt_ioppr_transform_image_colorspace(module, input, input, roi_in.width, roi_in.height,
-                                                input_format->cst, module->blend_colorspace(module, pipe, piece),
-                                                &input_format->cst, dt_ioppr_get_pipe_work_profile_info(pipe));
+            _transform_image_colorspace(piece, module, input, input, roi_in.width, roi_in.height,
+                                        input_format->cst, module->blend_colorspace(module, pipe, piece),
+                                        &input_format->cst, dt_ioppr_get_pipe_work_profile_info(pipe));
 
-            dt_ioppr_transform_image_colorspace(module, *output, *output, roi_out->width, roi_out->height,
-                                                pipe->dsc.cst, module->blend_colorspace(module, pipe, piece),
-                                                &pipe->dsc.cst, dt_ioppr_get_pipe_work_profile_info(pipe));
+            _transform_image_colorspace(piece, module, *output, *output, roi_out->width, roi_out->height,
+                                        pipe->dsc.cst, module->blend_colorspace(module, pipe, piece),
+                                        &pipe->dsc.cst, dt_ioppr_get_pipe_work_profile_info(pipe));
           }
 
           /* process blending on cpu */
-          dt_develop_blend_process(module, piece, input, *output, &roi_in, roi_out);
+          _blend_process(module, piece, input, *output, &roi_in, roi_out);
           pixelpipe_flow |= (PIXELPIPE_FLOW_BLENDED_ON_CPU);
           pixelpipe_flow &= ~(PIXELPIPE_FLOW_BLENDED_ON_GPU);
         }
@@ -2061,9 +2077,9 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
         }
 
         // transform to module input colorspace
-        dt_ioppr_transform_image_colorspace(module, input, input, roi_in.width, roi_in.height, input_format->cst,
-                                            module->input_colorspace(module, pipe, piece), &input_format->cst,
-                                            dt_ioppr_get_pipe_work_profile_info(pipe));
+        _transform_image_colorspace(piece, module, input, input, roi_in.width, roi_in.height, input_format->cst,
+                                    module->input_colorspace(module, pipe, piece), &input_format->cst,
+                                    dt_ioppr_get_pipe_work_profile_info(pipe));
 
         // histogram collection for module
         if((dev->gui_attached || !(piece->request_histogram & DT_REQUEST_ONLY_IN_GUI))
@@ -2102,13 +2118,13 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
                                                 MAX(roi_in.height, roi_out->height), MAX(in_bpp, bpp),
                                                 tiling.factor, tiling.overhead))
         {
-          module->process_tiling(module, piece, input, *output, &roi_in, roi_out, in_bpp);
+          _process_tiling(module, piece, input, *output, &roi_in, roi_out, in_bpp);
           pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
           pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU);
         }
         else
         {
-          module->process(module, piece, input, *output, &roi_in, roi_out);
+          _process(module, piece, input, *output, &roi_in, roi_out);
           pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU);
           pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
         }
@@ -2150,17 +2166,17 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
         // blend needs input/output images with default colorspace
         if(_transform_for_blend(module, piece, input_format->cst, pipe->dsc.cst))
         {
-          dt_ioppr_transform_image_colorspace(module, input, input, roi_in.width, roi_in.height, input_format->cst,
-                                              module->blend_colorspace(module, pipe, piece), &input_format->cst,
-                                              dt_ioppr_get_pipe_work_profile_info(pipe));
+          _transform_image_colorspace(piece, module, input, input, roi_in.width, roi_in.height, input_format->cst,
+                                      module->blend_colorspace(module, pipe, piece), &input_format->cst,
+                                      dt_ioppr_get_pipe_work_profile_info(pipe));
 
-          dt_ioppr_transform_image_colorspace(module, *output, *output, roi_out->width, roi_out->height,
-                                              pipe->dsc.cst, module->blend_colorspace(module, pipe, piece),
-                                              &pipe->dsc.cst, dt_ioppr_get_pipe_work_profile_info(pipe));
+          _transform_image_colorspace(piece, module, *output, *output, roi_out->width, roi_out->height,
+                                      pipe->dsc.cst, module->blend_colorspace(module, pipe, piece),
+                                      &pipe->dsc.cst, dt_ioppr_get_pipe_work_profile_info(pipe));
         }
 
         /* process blending */
-        dt_develop_blend_process(module, piece, input, *output, &roi_in, roi_out);
+        _blend_process(module, piece, input, *output, &roi_in, roi_out);
         pixelpipe_flow |= (PIXELPIPE_FLOW_BLENDED_ON_CPU);
         pixelpipe_flow &= ~(PIXELPIPE_FLOW_BLENDED_ON_GPU);
 
@@ -2179,9 +2195,9 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       /* opencl is not inited or not enabled or we got no resource/device -> everything runs on cpu */
 
       // transform to module input colorspace
-      dt_ioppr_transform_image_colorspace(module, input, input, roi_in.width, roi_in.height, input_format->cst,
-                                          module->input_colorspace(module, pipe, piece), &input_format->cst,
-                                          dt_ioppr_get_pipe_work_profile_info(pipe));
+      _transform_image_colorspace(piece, module, input, input, roi_in.width, roi_in.height, input_format->cst,
+                                  module->input_colorspace(module, pipe, piece), &input_format->cst,
+                                  dt_ioppr_get_pipe_work_profile_info(pipe));
 
       // histogram collection for module
       if((dev->gui_attached || !(piece->request_histogram & DT_REQUEST_ONLY_IN_GUI))
@@ -2220,13 +2236,13 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
                                               MAX(roi_in.height, roi_out->height), MAX(in_bpp, bpp),
                                               tiling.factor, tiling.overhead))
       {
-        module->process_tiling(module, piece, input, *output, &roi_in, roi_out, in_bpp);
+        _process_tiling(module, piece, input, *output, &roi_in, roi_out, in_bpp);
         pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
         pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU);
       }
       else
       {
-        module->process(module, piece, input, *output, &roi_in, roi_out);
+        _process(module, piece, input, *output, &roi_in, roi_out);
         pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU);
         pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
       }
@@ -2269,25 +2285,25 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       // blend needs input/output images with default colorspace
       if(_transform_for_blend(module, piece, input_format->cst, pipe->dsc.cst))
       {
-        dt_ioppr_transform_image_colorspace(module, input, input, roi_in.width, roi_in.height, input_format->cst,
-                                            module->blend_colorspace(module, pipe, piece), &input_format->cst,
-                                            dt_ioppr_get_pipe_work_profile_info(pipe));
+        _transform_image_colorspace(piece, module, input, input, roi_in.width, roi_in.height, input_format->cst,
+                                    module->blend_colorspace(module, pipe, piece), &input_format->cst,
+                                    dt_ioppr_get_pipe_work_profile_info(pipe));
 
-        dt_ioppr_transform_image_colorspace(module, *output, *output, roi_out->width, roi_out->height,
-                                            pipe->dsc.cst, module->blend_colorspace(module, pipe, piece),
-                                            &pipe->dsc.cst, dt_ioppr_get_pipe_work_profile_info(pipe));
+        _transform_image_colorspace(piece, module, *output, *output, roi_out->width, roi_out->height,
+                                    pipe->dsc.cst, module->blend_colorspace(module, pipe, piece),
+                                    &pipe->dsc.cst, dt_ioppr_get_pipe_work_profile_info(pipe));
       }
 
       /* process blending */
-      dt_develop_blend_process(module, piece, input, *output, &roi_in, roi_out);
+      _blend_process(module, piece, input, *output, &roi_in, roi_out);
       pixelpipe_flow |= (PIXELPIPE_FLOW_BLENDED_ON_CPU);
       pixelpipe_flow &= ~(PIXELPIPE_FLOW_BLENDED_ON_GPU);
     }
 #else // HAVE_OPENCL
     // transform to module input colorspace
-    dt_ioppr_transform_image_colorspace(module, input, input, roi_in.width, roi_in.height, input_format->cst,
-                                        module->input_colorspace(module, pipe, piece), &input_format->cst,
-                                        dt_ioppr_get_pipe_work_profile_info(pipe));
+    _transform_image_colorspace(piece, module, input, input, roi_in.width, roi_in.height, input_format->cst,
+                                module->input_colorspace(module, pipe, piece), &input_format->cst,
+                                dt_ioppr_get_pipe_work_profile_info(pipe));
 
     // histogram collection for module
     if((dev->gui_attached || !(piece->request_histogram & DT_REQUEST_ONLY_IN_GUI))
@@ -2326,13 +2342,13 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
                                             MAX(roi_in.height, roi_out->height), MAX(in_bpp, bpp),
                                             tiling.factor, tiling.overhead))
     {
-      module->process_tiling(module, piece, input, *output, &roi_in, roi_out, in_bpp);
+      _process_tiling(module, piece, input, *output, &roi_in, roi_out, in_bpp);
       pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
       pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU);
     }
     else
     {
-      module->process(module, piece, input, *output, &roi_in, roi_out);
+      _process(module, piece, input, *output, &roi_in, roi_out);
       pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU);
       pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
     }
@@ -2373,17 +2389,17 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     // blend needs input/output images with default colorspace
     if(_transform_for_blend(module, piece, input_format->cst, pipe->dsc.cst))
     {
-      dt_ioppr_transform_image_colorspace(module, input, input, roi_in.width, roi_in.height, input_format->cst,
-                                          module->blend_colorspace(module, pipe, piece), &input_format->cst,
-                                          dt_ioppr_get_pipe_work_profile_info(pipe));
+      _transform_image_colorspace(piece, module, input, input, roi_in.width, roi_in.height, input_format->cst,
+                                  module->blend_colorspace(module, pipe, piece), &input_format->cst,
+                                  dt_ioppr_get_pipe_work_profile_info(pipe));
 
-      dt_ioppr_transform_image_colorspace(module, *output, *output, roi_out->width, roi_out->height, pipe->dsc.cst,
-                                          module->blend_colorspace(module, pipe, piece), &pipe->dsc.cst,
-                                          dt_ioppr_get_pipe_work_profile_info(pipe));
+      _transform_image_colorspace(piece, module, *output, *output, roi_out->width, roi_out->height, pipe->dsc.cst,
+                                  module->blend_colorspace(module, pipe, piece), &pipe->dsc.cst,
+                                  dt_ioppr_get_pipe_work_profile_info(pipe));
     }
 
     /* process blending */
-    dt_develop_blend_process(module, piece, input, *output, &roi_in, roi_out);
+    _blend_process(module, piece, input, *output, &roi_in, roi_out);
     pixelpipe_flow |= (PIXELPIPE_FLOW_BLENDED_ON_CPU);
     pixelpipe_flow &= ~(PIXELPIPE_FLOW_BLENDED_ON_GPU);
 #endif // HAVE_OPENCL
@@ -2410,14 +2426,31 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
         pixelpipe_flow & PIXELPIPE_FLOW_BLENDED_ON_GPU
             ? "GPU"
             : pixelpipe_flow & PIXELPIPE_FLOW_BLENDED_ON_CPU ? "CPU" : "",
-        _pipe_type_to_str(pipe->type));
+        dt_dev_pixelpipe_type_to_str(pipe->type));
     g_free(module_label);
     module_label = NULL;
 
+    if(dt_profiler_enabled())
+      dt_profiler_record(darktable.profiler, "module", module->op, module->multi_name, pipe, &start,
+                         (size_t)roi_in.width * roi_in.height * in_bpp,
+                         (size_t)roi_out->width * roi_out->height * out_bpp,
+                         pixelpipe_flow & PIXELPIPE_FLOW_PROCESSED_WITH_TILING ? pipe->tiles : 0,
+                         pixelpipe_flow & PIXELPIPE_FLOW_PROCESSED_ON_GPU ? pipe->devid : -1);
+
+    // recomputing this line means recomputing its input as well, unless that comes straight from the image
+    const double module_cost = dt_get_wtime() - start.clock;
+    const double line_cost = module_cost + dt_dev_pixelpipe_cache_get_cost(&(pipe->cache), input);
+    dt_dev_pixelpipe_cache_set_cost(&(pipe->cache), *output, line_cost);
+
     // in case we get this buffer from the cache in the future, cache some stuff:
     **out_format = piece->dsc_out = pipe->dsc;
 
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
+
+    // expensive results are worth keeping on disk, if they are in host memory
+    if(disk_hash && module_cost >= DT_PIXELPIPE_CACHE_DISK_MIN_COST && *cl_mem_output == NULL)
+      dt_dev_pixelpipe_cache_disk_write(darktable.pixelpipe_cache_disk, pipe, disk_hash, *output,
+                                        out_bpp * roi_out->width * roi_out->height, *out_format, line_cost);
     if(module == darktable.develop->gui_module)
     {
       // give the input buffer to the currently focused plugin more weight.
@@ -2471,12 +2504,12 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
         module_label = dt_history_item_get_name(module);
         if(hasnan)
           fprintf(stderr, "[dev_pixelpipe] module `%s' outputs NaNs! [%s]\n", module_label,
-                  _pipe_type_to_str(pipe->type));
+                  dt_dev_pixelpipe_type_to_str(pipe->type));
         if(hasinf)
           fprintf(stderr, "[dev_pixelpipe] module `%s' outputs non-finite floats! [%s]\n", module_label,
-                  _pipe_type_to_str(pipe->type));
+                  dt_dev_pixelpipe_type_to_str(pipe->type));
         fprintf(stderr, "[dev_pixelpipe] module `%s' min: (%f; %f; %f) max: (%f; %f; %f) [%s]\n", module_label,
-                min[0], min[1], min[2], max[0], max[1], max[2], _pipe_type_to_str(pipe->type));
+                min[0], min[1], min[2], max[0], max[1], max[2], dt_dev_pixelpipe_type_to_str(pipe->type));
         g_free(module_label);
       }
       else if((*out_format)->datatype == TYPE_FLOAT && (*out_format)->channels == 1)
@@ -2501,12 +2534,12 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
         module_label = dt_history_item_get_name(module);
         if(hasnan)
           fprintf(stderr, "[dev_pixelpipe] module `%s' outputs NaNs! [%s]\n", module_label,
-                  _pipe_type_to_str(pipe->type));
+                  dt_dev_pixelpipe_type_to_str(pipe->type));
         if(hasinf)
           fprintf(stderr, "[dev_pixelpipe] module `%s' outputs non-finite floats! [%s]\n", module_label,
-                  _pipe_type_to_str(pipe->type));
+                  dt_dev_pixelpipe_type_to_str(pipe->type));
         fprintf(stderr, "[dev_pixelpipe] module `%s' min: (%f) max: (%f) [%s]\n", module_label, min, max,
-                _pipe_type_to_str(pipe->type));
+                dt_dev_pixelpipe_type_to_str(pipe->type));
         g_free(module_label);
       }
 
@@ -2556,7 +2589,8 @@ post_process_collect_info:
       // this may lead to some rounding errors
       if(input == NULL)
       {
-        float *input_tmp = (float *)dt_alloc_align(64, roi_out->width * roi_out->height * 4 * sizeof(float));
+        float *input_tmp = (float *)dt_buffer_pool_alloc(&pipe->pool, (size_t)roi_out->width * roi_out->height
+                                                                                * 4 * sizeof(float));
         const uint8_t *const pixel = (uint8_t *)*output;
 
         const int imgsize = roi_out->height * roi_out->width * 4;
@@ -2566,19 +2600,17 @@ post_process_collect_info:
           input_tmp[i + 3] = 0.f;
         }
 
-        _pixelpipe_final_histogram(dev, (const float *const)input_tmp, roi_out);
+        dt_dev_scopes_process(dev, (const float *const)input_tmp, roi_out, FALSE);
 
-        dt_free_align(input_tmp);
+        dt_buffer_pool_free(&pipe->pool, input_tmp);
       }
       else
-        _pixelpipe_final_histogram(dev, (const float *const)input, &roi_in);
-
-      // this HAS to be done on the float input data, otherwise we get really ugly artifacts due to rounding
-      // issues when putting colors into the bins.
-      // FIXME: is above comment true now that waveform is scaled via Cairo?
-      if(input && dev->histogram_type == DT_DEV_HISTOGRAM_WAVEFORM)
       {
-        _pixelpipe_final_histogram_waveform(dev, (const float *const )input, &roi_in);
+        // the waveform HAS to be done on the float input data, otherwise we get really ugly artifacts due to
+        // rounding issues when putting colors into the bins.
+        // FIXME: is above comment true now that waveform is scaled via Cairo?
+        dt_dev_scopes_process(dev, (const float *const)input, &roi_in,
+                              dev->histogram_type == DT_DEV_HISTOGRAM_WAVEFORM);
       }
 
       dt_pthread_mutex_unlock(&pipe->busy_mutex);
@@ -2695,8 +2727,8 @@ int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x,
   pipe->devid = (pipe->opencl_enabled) ? dt_opencl_lock_device(pipe->type)
                                        : -1; // try to get/lock opencl resource
 
-  dt_print(DT_DEBUG_OPENCL, "[pixelpipe_process] [%s] using device %d\n", _pipe_type_to_str(pipe->type),
-           pipe->devid);
+  dt_print(DT_DEBUG_OPENCL, "[pixelpipe_process] [%s] using device %d\n",
+           dt_dev_pixelpipe_type_to_str(pipe->type), pipe->devid);
 
   if(darktable.unmuted & DT_DEBUG_MEMORY)
   {
@@ -2775,7 +2807,7 @@ restart:
     dt_dev_pixelpipe_flush_caches(pipe);
     dt_dev_pixelpipe_change(pipe, dev);
     dt_print(DT_DEBUG_OPENCL, "[pixelpipe_process] [%s] falling back to cpu path\n",
-             _pipe_type_to_str(pipe->type));
+             dt_dev_pixelpipe_type_to_str(pipe->type));
     goto restart; // try again (this time without opencl)
   }
 
@@ -2790,6 +2822,14 @@ restart:
     dt_opencl_unlock_device(pipe->devid);
     pipe->devid = -1;
   }
+  // let go of scratch buffers this run did not need
+  dt_buffer_pool_trim(&pipe->pool);
+  if(darktable.unmuted & DT_DEBUG_MEMORY)
+  {
+    dt_buffer_pool_print(&pipe->pool, dt_dev_pixelpipe_type_to_str(pipe->type));
+    dt_masks_cache_print(pipe->masks_cache, dt_dev_pixelpipe_type_to_str(pipe->type));
+  }
+
   // ... and in case of other errors ...
   if(err)
   {
@@ -2797,10 +2837,11 @@ restart:
     return 1;
   }
 
-  // terminate
+  // terminate. the cache line of the backbuf must not be dropped for the memory budget while it is in use.
   dt_pthread_mutex_lock(&pipe->backbuf_mutex);
   pipe->backbuf_hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, &roi, pipe, 0);
   pipe->backbuf = buf;
+  dt_dev_pixelpipe_cache_pin(&pipe->cache, buf);
   pipe->backbuf_width = width;
   pipe->backbuf_height = height;
 
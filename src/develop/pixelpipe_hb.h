@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include "common/buffer_pool.h"
 #include "common/image.h"
 #include "common/imageio.h"
 #include "common/iop_order.h"
@@ -92,6 +93,10 @@ typedef struct dt_dev_pixelpipe_t
 {
   // store history/zoom caches
   dt_dev_pixelpipe_cache_t cache;
+  // scratch buffers borrowed by the modules while processing
+  dt_buffer_pool_t pool;
+  // rasterized drawn masks, NULL if disabled
+  struct dt_masks_cache_t *masks_cache;
   // set to non-zero in order to obsolete old cache entries on next pixelpipe run
   int cache_obsolete;
   // input buffer
@@ -146,6 +151,8 @@ typedef struct dt_dev_pixelpipe_t
   int devid;
   // image struct as it was when the pixelpipe was initialized. copied to avoid race conditions.
   dt_image_t image;
+  // identifies input image and size for the disk cache, 0 if that is not used
+  uint64_t disk_cache_hash;
   // the user might choose to overwrite the output color space and rendering intent.
   dt_colorspaces_color_profile_type_t icc_type;
   gchar *icc_filename;
@@ -158,6 +165,8 @@ typedef struct dt_dev_pixelpipe_t
   GList *forms;
   // the masks generated in the pipe for later reusal are inside dt_dev_pixelpipe_iop_t
   gboolean store_all_raster_masks;
+  // number of tiles the last tiled process call was split into, for the profiler
+  int tiles;
 } dt_dev_pixelpipe_t;
 
 struct dt_develop_t;
@@ -178,6 +187,9 @@ int dt_dev_pixelpipe_init_thumbnail(dt_dev_pixelpipe_t *pipe, int32_t width, int
 int dt_dev_pixelpipe_init_dummy(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height);
 // inits the pixelpipe with given cacheline size and number of entries.
 int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries);
+// same, but bounds the memory used by all cache lines (0: unlimited)
+int dt_dev_pixelpipe_init_cached_budget(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries,
+                                        size_t max_memory);
 // constructs a new input buffer from given RGB float array.
 void dt_dev_pixelpipe_set_input(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, float *input, int width,
                                 int height, float iscale);
@@ -192,6 +204,9 @@ void dt_dev_pixelpipe_get_dimensions(dt_dev_pixelpipe_t *pipe, struct dt_develop
 // destroys all allocated data.
 void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe);
 
+// human readable name of a dt_dev_pixelpipe_type_t, for debug output.
+const char *dt_dev_pixelpipe_type_to_str(const int pipe_type);
+
 // flushes all cached data. useful if input pixels unexpectedly change.
 void dt_dev_pixelpipe_flush_caches(dt_dev_pixelpipe_t *pipe);
 
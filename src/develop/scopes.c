@@ -0,0 +1,411 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "develop/scopes.h"
+#include "common/colorspaces.h"
+#include "common/darktable.h"
+#include "common/histogram.h"
+#include "common/iop_profile.h"
+#include "control/conf.h"
+#include "control/control.h"
+#include "control/signal.h"
+#include "develop/develop.h"
+#include "develop/imageop.h"
+#include "libs/colorpicker.h"
+#include "libs/lib.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// output columns of the waveform a thread counts at once, so that each thread reads its own part of every row
+#define WAVEFORM_BAND 16
+
+typedef struct dt_dev_scopes_t
+{
+  dt_pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  pthread_t thread;
+  gboolean async;
+  gboolean shutdown;
+  gboolean pending;
+
+  // latest request of the preview pipe, guarded by mutex
+  float *input;
+  size_t input_size;
+  int width, height;
+  dt_histogram_roi_t roi;
+  const dt_iop_order_iccprofile_info_t *profile_from, *profile_to;
+  gboolean waveform;
+
+  // owned by whoever bins: the scopes thread, or the pipe if there is none. the results are swapped with the
+  // ones of dev when they are published.
+  float *work;
+  size_t work_size;
+  float *converted;
+  size_t converted_size;
+  uint32_t *histogram;
+  uint8_t *waveform_img;
+  uint16_t *waveform_counts;
+  size_t waveform_counts_size;
+} dt_dev_scopes_t;
+
+static gboolean _ensure_buffer(float **buf, size_t *size, const size_t needed)
+{
+  if(*size >= needed) return TRUE;
+  dt_free_align(*buf);
+  *buf = dt_alloc_align(64, needed);
+  *size = *buf ? needed : 0;
+  return *buf != NULL;
+}
+
+static void _scopes_histogram(dt_dev_scopes_t *s, const float *const input, dt_histogram_roi_t *roi,
+                              uint32_t *histogram_max)
+{
+  dt_dev_histogram_collection_params_t histogram_params = { 0 };
+  dt_dev_histogram_stats_t histogram_stats = { .bins_count = 256, .ch = 4, .pixels = 0 };
+  uint32_t max[4] = { 0 };
+
+  histogram_params.roi = roi;
+  histogram_params.bins_count = 256;
+  histogram_params.mul = histogram_params.bins_count - 1;
+
+  dt_histogram_helper(&histogram_params, &histogram_stats, iop_cs_rgb, iop_cs_NONE, input, &s->histogram, FALSE,
+                      NULL);
+  dt_histogram_max_helper(&histogram_stats, iop_cs_rgb, iop_cs_NONE, &s->histogram, max);
+  *histogram_max = MAX(MAX(max[0], max[1]), max[2]);
+}
+
+static void _scopes_waveform(dt_dev_scopes_t *s, const float *const input, const int width, const int height,
+                             const int waveform_height, const int waveform_stride, uint32_t *out_width)
+{
+  uint8_t *const waveform = s->waveform_img;
+  // Use integral sized bins for columns, as otherwise they will be
+  // unequal and have banding. Rely on GUI to smoothly do horizontal
+  // scaling.
+  // Note that histogram_waveform_stride is pre-initialized/hardcoded,
+  // but histogram_waveform_width varies, depending on preview image
+  // width and # of bins.
+  const int bin_width = ceilf((float)(width) / (float)(waveform_stride/4));
+  const int waveform_width = ceilf(width / (float)bin_width);
+  *out_width = waveform_width;
+
+  // the widget has waveform_height rows. more than two input rows per output row only smooth what can't be seen,
+  // so the rest of them is skipped.
+  const int row_step = MAX(1, height / (2 * waveform_height));
+  const int rows = (height + row_step - 1) / row_step;
+
+  // max input size should be 1440x900, and with a bin_width of 1,
+  // that makes a maximum possible count of 900 in buf, while even if
+  // waveform buffer is 128 (about smallest possible), bin_width is
+  // 12, making max count of 10,800, still much smaller than uint16_t
+  const size_t counts_size = sizeof(uint16_t) * waveform_width * waveform_height * 3;
+  if(s->waveform_counts_size < counts_size)
+  {
+    free(s->waveform_counts);
+    s->waveform_counts = malloc(counts_size);
+    s->waveform_counts_size = s->waveform_counts ? counts_size : 0;
+  }
+  uint16_t *const buf = s->waveform_counts;
+  if(!buf) return;
+  memset(buf, 0, counts_size);
+  memset(waveform, 0, sizeof(uint8_t) * waveform_height * waveform_stride);
+
+  // 1.0 is at 8/9 of the height!
+  const double _height = (double)(waveform_height - 1);
+
+  // count the colors into buf ...
+  // threads own bands of output columns so they won't conflict, and walk them row by row to read the input in
+  // the order it is stored
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(width, height, row_step, bin_width, _height, waveform_width, input, buf) \
+  schedule(static)
+#endif
+  for(int band = 0; band < waveform_width; band += WAVEFORM_BAND)
+  {
+    const int x_start = band * bin_width;
+    const int x_end = MIN(width, (band + WAVEFORM_BAND) * bin_width);
+    for(int in_y = 0; in_y < height; in_y += row_step)
+    {
+      const float *in = input + 4 * ((size_t)in_y * width + x_start);
+      for(int in_x = x_start; in_x < x_end; in_x++, in += 4)
+      {
+        const int out_x = in_x / bin_width;
+        for(int k = 0; k < 3; k++)
+        {
+          const float c = in[2 - k];
+          // catch NaNs as they don't convert well to integers
+          // FIXME: skip NaN's rather than treating as 0?
+          const float v = isnan(c) ? 0.0f : c;
+          const int out_y = CLAMP(1.0 - (8.0 / 9.0) * v, 0.0, 1.0) * _height;
+          buf[(out_x + waveform_width * out_y) * 3 + k]++;
+        }
+      }
+    }
+  }
+
+  // ... and scale that into a nice image. putting the pixels into the image directly gets too
+  // saturated/clips.
+
+  // new scale factor to do about the same as the old one for 1MP views, but scale to hidpi. only the counted
+  // rows go into it, so skipping rows doesn't darken the waveform.
+  const float scale = 0.5 * 1e6f/((float)rows*width) *
+    (waveform_width*waveform_height) / (350.0f*233.)
+    / 255.0f; // normalization to 0..1 for gamma correction
+  const float gamma = 1.0 / 1.5; // TODO make this settable from the gui?
+  // even bin_width 12 and height 900 image gives 10,800 byte cache, more normal will ~1K
+  const int cache_size = (rows * bin_width) + 1;
+  uint8_t *cache = (uint8_t *)calloc(cache_size, sizeof(uint8_t));
+
+#ifdef _OPENMP
+#pragma omp parallel for SIMD() default(none) \
+  dt_omp_firstprivate(waveform_width, waveform_height, waveform_stride, buf, waveform, cache, scale, gamma) \
+  schedule(static)
+#endif
+  for(int out_y = 0; out_y < waveform_height; out_y++)
+  {
+    for(int out_x = 0; out_x < waveform_width; out_x++)
+    {
+      const uint16_t *const in = buf + (waveform_width * out_y + out_x) * 3;
+      uint8_t *const out = waveform + (out_y * waveform_stride) + (out_x * 4);
+      for(int k = 0; k < 3; k++)
+      {
+        const uint16_t v = in[k];
+        // cache XORd result so common casees cached and cache misses are quick to find
+        if(!cache[v])
+        {
+          // multiple threads may be writing to cache[v], but as
+          // they're writing the same value, don't declare omp atomic
+          cache[v] = (uint8_t)(CLAMP(powf(v * scale, gamma) * 255.0, 0, 255)) ^ 1;
+        }
+        out[k] = cache[v] ^ 1;
+      }
+    }
+  }
+
+  free(cache);
+}
+
+// bin the request and swap the results into dev
+static void _scopes_compute(dt_develop_t *dev, dt_dev_scopes_t *s, const float *const input, const int width,
+                            const int height, dt_histogram_roi_t *roi,
+                            const dt_iop_order_iccprofile_info_t *const profile_from,
+                            const dt_iop_order_iccprofile_info_t *const profile_to, const gboolean waveform)
+{
+  dt_times_t start_time = { 0 };
+  if(darktable.unmuted & DT_DEBUG_PERF) dt_get_times(&start_time);
+
+  const float *histogram_input = input;
+  if(profile_from && profile_to
+     && _ensure_buffer(&s->converted, &s->converted_size, sizeof(float) * 4 * width * height))
+  {
+    dt_ioppr_transform_image_colorspace_rgb(input, s->converted, width, height, profile_from, profile_to,
+                                            "final histogram");
+    histogram_input = s->converted;
+  }
+
+  uint32_t histogram_max = 0;
+  _scopes_histogram(s, histogram_input, roi, &histogram_max);
+
+  uint32_t waveform_width = 0;
+  if(waveform)
+    _scopes_waveform(s, input, width, height, dev->histogram_waveform_height, dev->histogram_waveform_stride,
+                     &waveform_width);
+
+  dt_pthread_mutex_lock(&dev->histogram_mutex);
+  uint32_t *histogram = dev->histogram;
+  dev->histogram = s->histogram;
+  s->histogram = histogram;
+  dev->histogram_max = histogram_max;
+  if(waveform && waveform_width)
+  {
+    uint8_t *img = dev->histogram_waveform;
+    dev->histogram_waveform = s->waveform_img;
+    s->waveform_img = img;
+    dev->histogram_waveform_width = waveform_width;
+  }
+  dt_pthread_mutex_unlock(&dev->histogram_mutex);
+
+  if(darktable.unmuted & DT_DEBUG_PERF)
+  {
+    dt_times_t end_time = { 0 };
+    dt_get_times(&end_time);
+    fprintf(stderr, "final histogram%s took %.3f secs (%.3f CPU)\n", waveform ? " and waveform" : "",
+            end_time.clock - start_time.clock, end_time.user - start_time.user);
+  }
+}
+
+static void *_scopes_thread(void *data)
+{
+  dt_develop_t *dev = (dt_develop_t *)data;
+  dt_dev_scopes_t *s = dev->scopes;
+  dt_pthread_setname("scopes");
+
+  dt_pthread_mutex_lock(&s->mutex);
+  while(TRUE)
+  {
+    while(!s->pending && !s->shutdown) dt_pthread_cond_wait(&s->cond, &s->mutex);
+    if(s->shutdown) break;
+
+    // take the request, the pipe fills the other buffer next time
+    float *input = s->input;
+    const size_t input_size = s->input_size;
+    s->input = s->work;
+    s->input_size = s->work_size;
+    s->work = input;
+    s->work_size = input_size;
+    const int width = s->width, height = s->height;
+    dt_histogram_roi_t roi = s->roi;
+    const dt_iop_order_iccprofile_info_t *const profile_from = s->profile_from;
+    const dt_iop_order_iccprofile_info_t *const profile_to = s->profile_to;
+    const gboolean waveform = s->waveform;
+    s->pending = FALSE;
+    dt_pthread_mutex_unlock(&s->mutex);
+
+    _scopes_compute(dev, s, s->work, width, height, &roi, profile_from, profile_to, waveform);
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_DEVELOP_HISTOGRAM_UPDATED);
+
+    dt_pthread_mutex_lock(&s->mutex);
+  }
+  dt_pthread_mutex_unlock(&s->mutex);
+  return NULL;
+}
+
+void dt_dev_scopes_init(dt_develop_t *dev)
+{
+  dt_dev_scopes_t *s = (dt_dev_scopes_t *)calloc(1, sizeof(dt_dev_scopes_t));
+  s->histogram = (uint32_t *)calloc(4 * 256, sizeof(uint32_t));
+  s->waveform_img = (uint8_t *)calloc(dev->histogram_waveform_height * dev->histogram_waveform_stride,
+                                      sizeof(uint8_t));
+  dt_pthread_mutex_init(&s->mutex, NULL);
+  pthread_cond_init(&s->cond, NULL);
+  dev->scopes = s;
+
+  s->async = dt_conf_get_bool("plugins/darkroom/histogram/async");
+  if(s->async && dt_pthread_create(&s->thread, _scopes_thread, dev))
+  {
+    fprintf(stderr, "[dt_dev_scopes_init] failed to start the scopes thread, computing them in the pipe\n");
+    s->async = FALSE;
+  }
+}
+
+void dt_dev_scopes_cleanup(dt_develop_t *dev)
+{
+  dt_dev_scopes_t *s = dev->scopes;
+  if(!s) return;
+
+  if(s->async)
+  {
+    dt_pthread_mutex_lock(&s->mutex);
+    s->shutdown = TRUE;
+    pthread_cond_signal(&s->cond);
+    dt_pthread_mutex_unlock(&s->mutex);
+    pthread_join(s->thread, NULL);
+  }
+
+  pthread_cond_destroy(&s->cond);
+  dt_pthread_mutex_destroy(&s->mutex);
+  dt_free_align(s->input);
+  dt_free_align(s->work);
+  dt_free_align(s->converted);
+  free(s->histogram);
+  free(s->waveform_img);
+  free(s->waveform_counts);
+  free(s);
+  dev->scopes = NULL;
+}
+
+void dt_dev_scopes_process(dt_develop_t *dev, const float *const input, const dt_iop_roi_t *roi,
+                           const gboolean waveform)
+{
+  dt_dev_scopes_t *s = dev->scopes;
+  if(!s) return;
+
+  dt_histogram_roi_t histogram_roi = { .width = roi->width, .height = roi->height,
+                                       .crop_x = 0, .crop_y = 0, .crop_width = 0, .crop_height = 0 };
+
+  // Constraining the area if the colorpicker is active in area mode
+  if(dev->gui_module && !strcmp(dev->gui_module->op, "colorout")
+     && dev->gui_module->request_color_pick != DT_REQUEST_COLORPICK_OFF
+     && darktable.lib->proxy.colorpicker.restrict_histogram)
+  {
+    if(darktable.lib->proxy.colorpicker.size == DT_COLORPICKER_SIZE_BOX)
+    {
+      histogram_roi.crop_x = MIN(roi->width, MAX(0, dev->gui_module->color_picker_box[0] * roi->width));
+      histogram_roi.crop_y = MIN(roi->height, MAX(0, dev->gui_module->color_picker_box[1] * roi->height));
+      histogram_roi.crop_width = roi->width - MIN(roi->width, MAX(0, dev->gui_module->color_picker_box[2] * roi->width));
+      histogram_roi.crop_height = roi->height - MIN(roi->height, MAX(0, dev->gui_module->color_picker_box[3] * roi->height));
+    }
+    else
+    {
+      histogram_roi.crop_x = MIN(roi->width, MAX(0, dev->gui_module->color_picker_point[0] * roi->width));
+      histogram_roi.crop_y = MIN(roi->height, MAX(0, dev->gui_module->color_picker_point[1] * roi->height));
+      histogram_roi.crop_width = roi->width - MIN(roi->width, MAX(0, dev->gui_module->color_picker_point[0] * roi->width));
+      histogram_roi.crop_height = roi->height - MIN(roi->height, MAX(0, dev->gui_module->color_picker_point[1] * roi->height));
+    }
+  }
+
+  // the profiles are looked up here, dev's list of them belongs to the pipe
+  const dt_iop_order_iccprofile_info_t *profile_from = NULL, *profile_to = NULL;
+  dt_colorspaces_color_profile_type_t histogram_type = DT_COLORSPACE_SRGB;
+  gchar *histogram_filename = NULL;
+  gchar _histogram_filename[1] = { 0 };
+
+  dt_ioppr_get_histogram_profile_type(&histogram_type, &histogram_filename);
+  if(histogram_filename == NULL) histogram_filename = _histogram_filename;
+
+  if((histogram_type != darktable.color_profiles->display_type)
+     || (histogram_type == DT_COLORSPACE_FILE
+         && strcmp(histogram_filename, darktable.color_profiles->display_filename)))
+  {
+    profile_from = dt_ioppr_add_profile_info_to_list(dev, darktable.color_profiles->display_type,
+                                                     darktable.color_profiles->display_filename, INTENT_PERCEPTUAL);
+    profile_to = dt_ioppr_add_profile_info_to_list(dev, histogram_type, histogram_filename, INTENT_PERCEPTUAL);
+  }
+
+  if(!s->async)
+  {
+    _scopes_compute(dev, s, input, roi->width, roi->height, &histogram_roi, profile_from, profile_to, waveform);
+    return;
+  }
+
+  // copy the input, the pipe cache may hand its buffer to the next module before the scopes got to it. a request
+  // that wasn't picked up yet is simply replaced.
+  const size_t size = sizeof(float) * 4 * roi->width * roi->height;
+  dt_pthread_mutex_lock(&s->mutex);
+  if(_ensure_buffer(&s->input, &s->input_size, size))
+  {
+    memcpy(s->input, input, size);
+    s->width = roi->width;
+    s->height = roi->height;
+    s->roi = histogram_roi;
+    s->profile_from = profile_from;
+    s->profile_to = profile_to;
+    // don't lose a waveform that was asked for by the request this one replaces
+    s->waveform = waveform || (s->pending && s->waveform);
+    s->pending = TRUE;
+    pthread_cond_signal(&s->cond);
+  }
+  dt_pthread_mutex_unlock(&s->mutex);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,42 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+
+struct dt_develop_t;
+struct dt_iop_roi_t;
+
+/** histogram and waveform of the darkroom, computed from the input of gamma in the preview pipe.
+ * with plugins/darkroom/histogram/async the pipe only copies its data and the binning runs on a thread of its
+ * own, so the preview is shown without waiting for the scopes. DT_SIGNAL_DEVELOP_HISTOGRAM_UPDATED is raised
+ * whenever new scopes are published. */
+
+/** set up the scopes of a gui attached develop and start their thread if needed. */
+void dt_dev_scopes_init(struct dt_develop_t *dev);
+/** stop the thread and free everything, before the profiles of dev go away. */
+void dt_dev_scopes_cleanup(struct dt_develop_t *dev);
+/** hand the display referred rgb the preview pipe got in gamma to the scopes. the waveform is only updated if
+ * requested. has to be called from the preview pipe. */
+void dt_dev_scopes_process(struct dt_develop_t *dev, const float *const input, const struct dt_iop_roi_t *roi,
+                           const gboolean waveform);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -579,51 +579,39 @@ static int _fit_output_to_input_roi(struct dt_iop_module_t *self, struct dt_dev_
 }
 
 
-/* simple tiling algorithm for roi_in == roi_out, i.e. for pixel to pixel modules/operations */
-static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
-                                        const void *const ivoid, void *const ovoid,
-                                        const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
-                                        const int in_bpp)
+/* shared description of the tiles of _default_process_tiling_ptp() */
+typedef struct _tiling_ptp_t
 {
-  void *input = NULL;
-  void *output = NULL;
-  dt_iop_buffer_dsc_t dsc;
-  self->output_format(self, piece->pipe, piece, &dsc);
-  const int out_bpp = dt_iop_buffer_dsc_to_bpp(&dsc);
-
-  const int ipitch = roi_in->width * in_bpp;
-  const int opitch = roi_out->width * out_bpp;
-  const int max_bpp = _max(in_bpp, out_bpp);
-
-  /* get tiling requirements of module */
-  dt_develop_tiling_t tiling = { 0 };
-  self->tiling_callback(self, piece, roi_in, roi_out, &tiling);
-
-  /* tiling really does not make sense in these cases. standard process() is not better or worse than we are
-   */
-  if(tiling.factor < 2.2f && tiling.overhead < 0.2f * roi_in->width * roi_in->height * max_bpp)
-  {
-    dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] no need to use tiling for module '%s' as no real "
-                           "memory saving to be expected\n",
-             self->op);
-    goto fallback;
-  }
-
-  /* calculate optimal size of tiles */
-  float available = dt_conf_get_float("host_memory_limit") * 1024.0f * 1024.0f;
-  assert(available >= 500.0f * 1024.0f * 1024.0f);
-  /* correct for size of ivoid and ovoid which are needed on top of tiling */
-  available = fmax(available - ((float)roi_out->width * roi_out->height * out_bpp)
-                   - ((float)roi_in->width * roi_in->height * in_bpp) - tiling.overhead,
-                   0);
-
-  /* we ignore the above value if singlebuffer_limit (is defined and) is higher than available/tiling.factor.
+  const void *ivoid;
+  void *ovoid;
+  const dt_iop_roi_t *roi_in;
+  const dt_iop_roi_t *roi_out;
+  /* per slot input and output buffers, slot k starts at k * input_size and k * output_size */
+  char *input;
+  char *output;
+  size_t input_size;
+  size_t output_size;
+  int in_bpp, out_bpp;
+  int ipitch, opitch;
+  int width, height;
+  int tile_wd, tile_ht;
+  int tiles_x, tiles_y;
+  int overlap;
+} _tiling_ptp_t;
+
+/* calculate tile dimensions for the ptp case from the memory in available, which is what one tile in flight
+   may take. */
+static void _tiling_ptp_tile_size(const dt_iop_roi_t *const roi_in, const dt_develop_tiling_t *tiling,
+                                  const int max_bpp, const float available, const unsigned int xyalign, int *w,
+                                  int *h)
+{
+  /* we ignore available if singlebuffer_limit (is defined and) is higher than available/tiling.factor.
      this will mainly allow tiling for modules with high and "unpredictable" memory demand which is
      reflected in high values of tiling.factor (take bilateral noise reduction as an example). */
   float singlebuffer = dt_conf_get_float("singlebuffer_limit") * 1024.0f * 1024.0f;
   singlebuffer = fmax(singlebuffer, 2.0f * 1024.0f * 1024.0f);
-  float factor = fmax(tiling.factor, 1.0f);
-  float maxbuf = fmax(tiling.maxbuf, 1.0f);
+  const float factor = fmax(tiling->factor, 1.0f);
+  const float maxbuf = fmax(tiling->maxbuf, 1.0f);
   singlebuffer = fmax(available / factor, singlebuffer);
 
   int width = roi_in->width;
@@ -651,11 +639,178 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
   }
 
   /* make sure we have a reasonably effective tile dimension. if not try square tiles */
-  if(3 * tiling.overlap > width || 3 * tiling.overlap > height)
+  if(3 * tiling->overlap > width || 3 * tiling->overlap > height)
   {
     width = height = floorf(sqrtf((float)width * height));
   }
 
+  /* properly align tile width and height by making them smaller if needed */
+  if(width < roi_in->width) width = (width / xyalign) * xyalign;
+  if(height < roi_in->height) height = (height / xyalign) * xyalign;
+
+  *w = width;
+  *h = height;
+}
+
+/* modules whose process() only reads piece->data and writes nothing but its output and buffers it allocates
+   per call, and whose output does not depend on how many threads run it, so several tiles may call it at the
+   same time. some of them feed their gui from the darkroom pipes, which is why those always tile one after the
+   other. */
+static const char *_tiling_ptp_reentrant_ops[]
+    = { "atrous", "bloom", "highpass", "lowlight", "lowpass", "shadhi", "sharpen", "soften", NULL };
+
+static gboolean _tiling_ptp_reentrant(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece)
+{
+  if(piece->pipe->type & (DT_DEV_PIXELPIPE_FULL | DT_DEV_PIXELPIPE_PREVIEW | DT_DEV_PIXELPIPE_PREVIEW2))
+    return FALSE;
+  for(const char **op = _tiling_ptp_reentrant_ops; *op; op++)
+    if(!strcmp(self->op, *op))
+    {
+      /* the bilateral grid of shadhi and lowpass is splatted by all threads into one buffer */
+      const char *field = !strcmp(self->op, "shadhi") ? "shadhi_algo"
+                          : !strcmp(self->op, "lowpass") ? "lowpass_algo"
+                          : NULL;
+      if(!field) return TRUE;
+      const int *algo = self->get_p ? (const int *)self->get_p(self->params, field) : NULL;
+      return algo && *algo == 0;
+    }
+  return FALSE;
+}
+
+/* number of tiles which share host_memory_limit, and thus the size of each of them. this only depends on the
+   configuration, never on the number of threads, so the tiles and the output are the same on every machine
+   whether they run in parallel or not. */
+static int _tiling_ptp_slots(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece)
+{
+  if(!_tiling_ptp_reentrant(self, piece)) return 1;
+  return MAX(dt_conf_get_int("tiling_max_parallel"), 1);
+}
+
+/* process tile number t using the buffers of the given slot. returns FALSE if the tile got skipped.
+   every tile only writes to its own "good" part of ovoid, so tiles can be processed in any order. */
+static int _tiling_ptp_process_tile(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                                    const _tiling_ptp_t *const p, const int t, const int slot)
+{
+  const size_t tx = t / p->tiles_y;
+  const size_t ty = t % p->tiles_y;
+  const int in_bpp = p->in_bpp;
+  const int out_bpp = p->out_bpp;
+  const int ipitch = p->ipitch;
+  const int opitch = p->opitch;
+  const int overlap = p->overlap;
+  const void *const ivoid = p->ivoid;
+  void *const ovoid = p->ovoid;
+  char *const input = p->input + slot * p->input_size;
+  char *const output = p->output + slot * p->output_size;
+
+  const size_t wd = tx * p->tile_wd + p->width > p->roi_in->width ? p->roi_in->width - tx * p->tile_wd
+                                                                    : p->width;
+  const size_t ht = ty * p->tile_ht + p->height > p->roi_in->height ? p->roi_in->height - ty * p->tile_ht
+                                                                      : p->height;
+
+  /* no need to process end-tiles that are smaller than the total overlap area */
+  if((wd <= 2 * overlap && tx > 0) || (ht <= 2 * overlap && ty > 0)) return FALSE;
+
+  /* origin and region of effective part of tile, which we want to store later */
+  size_t origin[] = { 0, 0, 0 };
+  size_t region[] = { wd, ht, 1 };
+
+  /* roi_in and roi_out for process_cl on subbuffer */
+  dt_iop_roi_t iroi = { p->roi_in->x + tx * p->tile_wd, p->roi_in->y + ty * p->tile_ht, wd, ht,
+                        p->roi_in->scale };
+  dt_iop_roi_t oroi = { p->roi_out->x + tx * p->tile_wd, p->roi_out->y + ty * p->tile_ht, wd, ht,
+                        p->roi_out->scale };
+
+  /* offsets of tile into ivoid and ovoid */
+  const size_t ioffs = (ty * p->tile_ht) * ipitch + (tx * p->tile_wd) * in_bpp;
+  size_t ooffs = (ty * p->tile_ht) * opitch + (tx * p->tile_wd) * out_bpp;
+
+  dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] tile (%zu, %zu) with %zu x %zu at origin [%zu, %zu]\n",
+           tx, ty, wd, ht, tx * p->tile_wd, ty * p->tile_ht);
+
+/* prepare input tile buffer */
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(ht, in_bpp, ipitch, ivoid, wd, input, ioffs) \
+  schedule(static)
+#endif
+  for(size_t j = 0; j < ht; j++)
+    memcpy(input + j * wd * in_bpp, (char *)ivoid + ioffs + j * ipitch, (size_t)wd * in_bpp);
+
+  /* call process() of module */
+  self->process(self, piece, input, output, &iroi, &oroi);
+
+  /* correct origin and region of tile for overlap.
+     make sure that we only copy back the "good" part. */
+  if(tx > 0)
+  {
+    origin[0] += overlap;
+    region[0] -= overlap;
+    ooffs += overlap * out_bpp;
+  }
+  if(ty > 0)
+  {
+    origin[1] += overlap;
+    region[1] -= overlap;
+    ooffs += overlap * opitch;
+  }
+
+/* copy "good" part of tile to output buffer */
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(opitch, out_bpp, ovoid, wd, output, ooffs) \
+  shared(origin, region) \
+  schedule(static)
+#endif
+  for(size_t j = 0; j < region[1]; j++)
+    memcpy((char *)ovoid + ooffs + j * opitch, output + ((j + origin[1]) * wd + origin[0]) * out_bpp,
+           (size_t)region[0] * out_bpp);
+
+  return TRUE;
+}
+
+/* simple tiling algorithm for roi_in == roi_out, i.e. for pixel to pixel modules/operations */
+static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                                        const void *const ivoid, void *const ovoid,
+                                        const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
+                                        const int in_bpp)
+{
+  char *input = NULL;
+  char *output = NULL;
+  dt_iop_buffer_dsc_t dsc;
+  self->output_format(self, piece->pipe, piece, &dsc);
+  const int out_bpp = dt_iop_buffer_dsc_to_bpp(&dsc);
+
+  const int ipitch = roi_in->width * in_bpp;
+  const int opitch = roi_out->width * out_bpp;
+  const int max_bpp = _max(in_bpp, out_bpp);
+
+  /* get tiling requirements of module */
+  dt_develop_tiling_t tiling = { 0 };
+  self->tiling_callback(self, piece, roi_in, roi_out, &tiling);
+
+  /* tiling really does not make sense in these cases. standard process() is not better or worse than we are
+   */
+  if(tiling.factor < 2.2f && tiling.overhead < 0.2f * roi_in->width * roi_in->height * max_bpp)
+  {
+    dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] no need to use tiling for module '%s' as no real "
+                           "memory saving to be expected\n",
+             self->op);
+    goto fallback;
+  }
+
+  /* calculate optimal size of tiles. this takes all of host_memory_limit for us, so the idle buffers kept by
+     the pipe's pool for the other modules have to go */
+  dt_buffer_pool_release_idle(&piece->pipe->pool);
+  float available = dt_conf_get_float("host_memory_limit") * 1024.0f * 1024.0f;
+  assert(available >= 500.0f * 1024.0f * 1024.0f);
+  /* split it between the tiles which may be in flight at the same time */
+  const int slots = _tiling_ptp_slots(self, piece);
+  /* correct for size of ivoid and ovoid which are needed on top of tiling */
+  available = fmax(available - ((float)roi_out->width * roi_out->height * out_bpp)
+                   - ((float)roi_in->width * roi_in->height * in_bpp) - slots * tiling.overhead,
+                   0) / slots;
+
   /* Alignment rules: we need to make sure that alignment requirements of module are fulfilled.
      Modules will report alignment requirements via xalign and yalign within tiling_callback().
      Typical use case is demosaic where Bayer pattern requires alignment to a multiple of 2 in x and y
@@ -667,14 +822,13 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
 
   assert(xyalign != 0);
 
-  /* properly align tile width and height by making them smaller if needed */
-  if(width < roi_in->width) width = (width / xyalign) * xyalign;
-  if(height < roi_in->height) height = (height / xyalign) * xyalign;
-
-  /* also make sure that overlap follows alignment rules by making it wider when needed */
+  /* make sure that overlap follows alignment rules by making it wider when needed */
   const int overlap = tiling.overlap % xyalign != 0 ? (tiling.overlap / xyalign + 1) * xyalign
                                                     : tiling.overlap;
 
+  int width, height;
+  _tiling_ptp_tile_size(roi_in, &tiling, max_bpp, available, xyalign, &width, &height);
+
   /* calculate effective tile size */
   const int tile_wd = width - 2 * overlap > 0 ? width - 2 * overlap : 1;
   const int tile_ht = height - 2 * overlap > 0 ? height - 2 * overlap : 1;
@@ -692,6 +846,19 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
     goto error;
   }
 
+  const int tiles = tiles_x * tiles_y;
+  piece->pipe->tiles = tiles;
+
+  /* the number of tiles actually processed at the same time, each of them needs its own buffers */
+#ifdef _OPENMP
+  const int threads = omp_in_parallel() ? 1 : omp_get_max_threads();
+#else
+  const int threads = 1;
+#endif
+  const int inflight = MIN(MIN(slots, threads), tiles);
+  if(inflight > 1)
+    dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] module '%s' processes %d tiles in parallel\n",
+             self->op, inflight);
 
   dt_print(DT_DEBUG_DEV,
            "[default_process_tiling_ptp] use tiling on module '%s' for image with full size %d x %d\n",
@@ -700,15 +867,17 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
            "[default_process_tiling_ptp] (%d x %d) tiles with max dimensions %d x %d and overlap %d\n",
            tiles_x, tiles_y, width, height, overlap);
 
-  /* reserve input and output buffers for tiles */
-  input = dt_alloc_align(64, (size_t)width * height * in_bpp);
+  /* reserve input and output buffers for tiles, one pair per tile in flight */
+  const size_t input_size = dt_round_size((size_t)width * height * in_bpp, 64);
+  const size_t output_size = dt_round_size((size_t)width * height * out_bpp, 64);
+  input = dt_buffer_pool_alloc(&piece->pipe->pool, inflight * input_size);
   if(input == NULL)
   {
     dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] could not alloc input buffer for module '%s'\n",
              self->op);
     goto error;
   }
-  output = dt_alloc_align(64, (size_t)width * height * out_bpp);
+  output = dt_buffer_pool_alloc(&piece->pipe->pool, inflight * output_size);
   if(output == NULL)
   {
     dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] could not alloc output buffer for module '%s'\n",
@@ -716,103 +885,70 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
     goto error;
   }
 
+  const _tiling_ptp_t ptp = { .ivoid = ivoid, .ovoid = ovoid, .roi_in = roi_in, .roi_out = roi_out,
+                              .input = input, .output = output,
+                              .input_size = input_size, .output_size = output_size,
+                              .in_bpp = in_bpp, .out_bpp = out_bpp, .ipitch = ipitch, .opitch = opitch,
+                              .width = width, .height = height, .tile_wd = tile_wd, .tile_ht = tile_ht,
+                              .tiles_x = tiles_x, .tiles_y = tiles_y, .overlap = overlap };
+  const _tiling_ptp_t *const p = &ptp;
+
   /* store processed_maximum to be re-used and aggregated */
   float processed_maximum_saved[4];
   float processed_maximum_new[4] = { 1.0f };
   for(int k = 0; k < 4; k++) processed_maximum_saved[k] = piece->pipe->dsc.processed_maximum[k];
 
+  piece->pipe->tiling = 1;
 
-  /* iterate over tiles */
-  for(size_t tx = 0; tx < tiles_x; tx++)
-  {
-    const size_t wd = tx * tile_wd + width > roi_in->width ? roi_in->width - tx * tile_wd : width;
-    for(size_t ty = 0; ty < tiles_y; ty++)
-    {
-      piece->pipe->tiling = 1;
-
-      const size_t ht = ty * tile_ht + height > roi_in->height ? roi_in->height - ty * tile_ht : height;
-
-      /* no need to process end-tiles that are smaller than the total overlap area */
-      if((wd <= 2 * overlap && tx > 0) || (ht <= 2 * overlap && ty > 0)) continue;
-
-      /* origin and region of effective part of tile, which we want to store later */
-      size_t origin[] = { 0, 0, 0 };
-      size_t region[] = { wd, ht, 1 };
-
-      /* roi_in and roi_out for process_cl on subbuffer */
-      dt_iop_roi_t iroi = { roi_in->x + tx * tile_wd, roi_in->y + ty * tile_ht, wd, ht, roi_in->scale };
-      dt_iop_roi_t oroi = { roi_out->x + tx * tile_wd, roi_out->y + ty * tile_ht, wd, ht, roi_out->scale };
-
-      /* offsets of tile into ivoid and ovoid */
-      size_t ioffs = (ty * tile_ht) * ipitch + (tx * tile_wd) * in_bpp;
-      size_t ooffs = (ty * tile_ht) * opitch + (tx * tile_wd) * out_bpp;
-
+  /* the first tile is always processed on its own. it tells us if the module alters processed_maximum
+     of the pipe, which is shared by all tiles. */
+  _tiling_ptp_process_tile(self, piece, p, 0, 0);
+  for(int k = 0; k < 4; k++) processed_maximum_new[k] = piece->pipe->dsc.processed_maximum[k];
 
-      dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] tile (%zu, %zu) with %zu x %zu at origin [%zu, %zu]\n",
-               tx, ty, wd, ht, tx * tile_wd, ty * tile_ht);
+  const int parallel = inflight > 1 && !memcmp(processed_maximum_new, processed_maximum_saved,
+                                            sizeof(processed_maximum_saved));
 
-/* prepare input tile buffer */
+  if(parallel)
+  {
+    /* the tile geometry does not depend on inflight and every tile writes to a disjoint part of ovoid, so the
+       result does not depend on the order of processing. process() of the module runs inside the parallel
+       region here, its own parallel loops thus get executed by the calling thread only. */
 #ifdef _OPENMP
-#pragma omp parallel for default(none) \
-      dt_omp_firstprivate(ht, in_bpp, ipitch, ivoid, wd) \
-      shared(input, width, ioffs) \
-      schedule(static)
+#pragma omp parallel for default(none) num_threads(inflight) \
+    dt_omp_firstprivate(self, piece, p, tiles) \
+    schedule(dynamic, 1)
 #endif
-      for(size_t j = 0; j < ht; j++)
-        memcpy((char *)input + j * wd * in_bpp, (char *)ivoid + ioffs + j * ipitch, (size_t)wd * in_bpp);
-
+    for(int t = 1; t < tiles; t++) _tiling_ptp_process_tile(self, piece, p, t, dt_get_thread_num());
+  }
+  else
+  {
+    for(int t = 1; t < tiles; t++)
+    {
       /* take original processed_maximum as starting point */
       for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_saved[k];
 
-      /* call process() of module */
-      self->process(self, piece, input, output, &iroi, &oroi);
+      if(!_tiling_ptp_process_tile(self, piece, p, t, 0)) continue;
 
       /* aggregate resulting processed_maximum */
       /* TODO: check if there really can be differences between tiles and take
                appropriate action (calculate minimum, maximum, average, ...?) */
       for(int k = 0; k < 4; k++)
       {
-        if(tx + ty > 0 && fabs(processed_maximum_new[k] - piece->pipe->dsc.processed_maximum[k]) > 1.0e-6f)
+        if(fabs(processed_maximum_new[k] - piece->pipe->dsc.processed_maximum[k]) > 1.0e-6f)
           dt_print(
               DT_DEBUG_DEV,
               "[default_process_tiling_ptp] processed_maximum[%d] differs between tiles in module '%s'\n", k,
               self->op);
         processed_maximum_new[k] = piece->pipe->dsc.processed_maximum[k];
       }
-
-      /* correct origin and region of tile for overlap.
-         make sure that we only copy back the "good" part. */
-      if(tx > 0)
-      {
-        origin[0] += overlap;
-        region[0] -= overlap;
-        ooffs += overlap * out_bpp;
-      }
-      if(ty > 0)
-      {
-        origin[1] += overlap;
-        region[1] -= overlap;
-        ooffs += overlap * opitch;
-      }
-
-/* copy "good" part of tile to output buffer */
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-      dt_omp_firstprivate(opitch, out_bpp, ovoid, wd) \
-      shared(ooffs, output, width, origin, region) \
-      schedule(static)
-#endif
-      for(size_t j = 0; j < region[1]; j++)
-        memcpy((char *)ovoid + ooffs + j * opitch,
-               (char *)output + ((j + origin[1]) * wd + origin[0]) * out_bpp, (size_t)region[0] * out_bpp);
     }
   }
 
   /* copy back final processed_maximum */
   for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_new[k];
 
-  if(input != NULL) dt_free_align(input);
-  if(output != NULL) dt_free_align(output);
+  dt_buffer_pool_free(&piece->pipe->pool, input);
+  dt_buffer_pool_free(&piece->pipe->pool, output);
   piece->pipe->tiling = 0;
   return;
 
@@ -821,8 +957,8 @@ error:
 // fall through
 
 fallback:
-  if(input != NULL) dt_free_align(input);
-  if(output != NULL) dt_free_align(output);
+  dt_buffer_pool_free(&piece->pipe->pool, input);
+  dt_buffer_pool_free(&piece->pipe->pool, output);
   piece->pipe->tiling = 0;
   dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] fall back to standard processing for module '%s'\n",
            self->op);
@@ -876,7 +1012,9 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
     goto fallback;
   }
 
-  /* calculate optimal size of tiles */
+  /* calculate optimal size of tiles. this takes all of host_memory_limit for us, so the idle buffers kept by
+     the pipe's pool for the other modules have to go */
+  dt_buffer_pool_release_idle(&piece->pipe->pool);
   float available = dt_conf_get_float("host_memory_limit") * 1024.0f * 1024.0f;
   assert(available >= 500.0f * 1024.0f * 1024.0f);
   /* correct for size of ivoid and ovoid which are needed on top of tiling */
@@ -968,6 +1106,7 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
     goto error;
   }
 
+  piece->pipe->tiles = tiles_x * tiles_y;
 
   /* calculate tile width and height excl. overlap (i.e. the good part) for output.
      values are important for all following processing steps. */
@@ -1086,14 +1225,14 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
 
 
       /* prepare input tile buffer */
-      input = dt_alloc_align(64, (size_t)iroi_full.width * iroi_full.height * in_bpp);
+      input = dt_buffer_pool_alloc(&piece->pipe->pool, (size_t)iroi_full.width * iroi_full.height * in_bpp);
       if(input == NULL)
       {
         dt_print(DT_DEBUG_DEV, "[default_process_tiling_roi] could not alloc input buffer for module '%s'\n",
                  self->op);
         goto error;
       }
-      output = dt_alloc_align(64, (size_t)oroi_full.width * oroi_full.height * out_bpp);
+      output = dt_buffer_pool_alloc(&piece->pipe->pool, (size_t)oroi_full.width * oroi_full.height * out_bpp);
       if(output == NULL)
       {
         dt_print(DT_DEBUG_DEV, "[default_process_tiling_roi] could not alloc output buffer for module '%s'\n",
@@ -1144,16 +1283,16 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
                (char *)output + ((j + origin_y) * oroi_full.width + origin_x) * out_bpp,
                (size_t)oroi_good.width * out_bpp);
 
-      dt_free_align(input);
-      dt_free_align(output);
+      dt_buffer_pool_free(&piece->pipe->pool, input);
+      dt_buffer_pool_free(&piece->pipe->pool, output);
       input = output = NULL;
     }
 
   /* copy back final processed_maximum */
   for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_new[k];
 
-  if(input != NULL) dt_free_align(input);
-  if(output != NULL) dt_free_align(output);
+  dt_buffer_pool_free(&piece->pipe->pool, input);
+  dt_buffer_pool_free(&piece->pipe->pool, output);
   piece->pipe->tiling = 0;
   return;
 
@@ -1162,8 +1301,8 @@ error:
 // fall through
 
 fallback:
-  if(input != NULL) dt_free_align(input);
-  if(output != NULL) dt_free_align(output);
+  dt_buffer_pool_free(&piece->pipe->pool, input);
+  dt_buffer_pool_free(&piece->pipe->pool, output);
   piece->pipe->tiling = 0;
   dt_print(DT_DEBUG_DEV, "[default_process_tiling_roi] fall back to standard processing for module '%s'\n",
            self->op);
@@ -1311,6 +1450,7 @@ static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct d
     return FALSE;
   }
 
+  piece->pipe->tiles = tiles_x * tiles_y;
 
   dt_print(DT_DEBUG_OPENCL,
            "[default_process_tiling_cl_ptp] use tiling on module '%s' for image with full size %d x %d\n",
@@ -1681,6 +1821,8 @@ static int _default_process_tiling_cl_roi(struct dt_iop_module_t *self, struct d
     return FALSE;
   }
 
+  piece->pipe->tiles = tiles_x * tiles_y;
+
   /* calculate tile width and height excl. overlap (i.e. the good part) for output.
      important for all following processing steps. */
   const int tile_wd = _align_up(
@@ -27,7 +27,6 @@
 #include <stdio.h>   // for fprintf, stderr, snprintf, NULL, etc
 #include <stdlib.h>  // for exit, EXIT_FAILURE
 #include <string.h>  // for strcmp
-#include <unistd.h>  // for access, R_OK
 
 #include "common/darktable.h"    // for darktable, darktable_t, dt_cleanup, etc
 #include "common/database.h"     // for dt_database_get
@@ -100,11 +99,8 @@ static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mip
 
     for(int k = max_mip; k >= min_mip && k >= 0; k--)
     {
-      char filename[PATH_MAX] = { 0 };
-      snprintf(filename, sizeof(filename), "%s.d/%d/%d.jpg", darktable.mipmap_cache->cachedir, k, imgid);
-
       // if the thumbnail is already on disc - do nothing
-      if(!access(filename, R_OK)) continue;
+      if(dt_mipmap_cache_ondisk_thumbnail_exists(darktable.mipmap_cache, imgid, k)) continue;
 
       // else, generate thumbnail and store in mipmap cache.
       dt_mipmap_buffer_t buf;
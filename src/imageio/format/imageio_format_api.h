@@ -80,6 +80,15 @@ int bpp(struct dt_imageio_module_data_t *data);
 int write_image(struct dt_imageio_module_data_t *data, const char *filename, const void *in,
                 dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
                 void *exif, int exif_len, int imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe);
+/* optional row based writing, lets the export stream the image while it is being processed.
+   begin returns a handle (NULL on failure), exif has to stay valid until write_image_end(). */
+void *write_image_begin(struct dt_imageio_module_data_t *data, const char *filename,
+                        dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                        void *exif, int exif_len, int imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe);
+/* write the next rows, top to bottom, in the same layout as the buffer passed to write_image(). */
+int write_image_rows(struct dt_imageio_module_data_t *data, void *handle, const void *in, int rows);
+/* finish the file and free the handle. abort != 0 if not all rows could be delivered. return != 0 on fail. */
+int write_image_end(struct dt_imageio_module_data_t *data, void *handle, int abort);
 /* flag that describes the available precision/levels of output format. mainly used for dithering. */
 int levels(struct dt_imageio_module_data_t *data);
 
@@ -310,25 +310,53 @@ read_icc_profile (j_decompress_ptr cinfo,
 #undef MAX_SEQ_NO
 
 
-int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const void *in_tmp,
-                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
-                void *exif, int exif_len, int imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe)
+typedef struct dt_imageio_jpeg_writer_t
 {
-  dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t *)jpg_tmp;
-  const uint8_t *in = (const uint8_t *)in_tmp;
   struct dt_imageio_jpeg_error_mgr jerr;
+  FILE *f;
+  uint8_t *row;
+  gchar *filename;
+  void *exif;
+  int exif_len;
+} dt_imageio_jpeg_writer_t;
 
-  jpg->cinfo.err = jpeg_std_error(&jerr.pub);
-  jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
-  if(setjmp(jerr.setjmp_buffer))
+static void _jpeg_writer_free(dt_imageio_jpeg_writer_t *w)
+{
+  if(w->f) fclose(w->f);
+  dt_free_align(w->row);
+  g_free(w->filename);
+  free(w);
+}
+
+void *write_image_begin(dt_imageio_module_data_t *jpg_tmp, const char *filename,
+                        dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                        void *exif, int exif_len, int imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe)
+{
+  dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t *)jpg_tmp;
+
+  dt_imageio_jpeg_writer_t *w = (dt_imageio_jpeg_writer_t *)calloc(1, sizeof(dt_imageio_jpeg_writer_t));
+  if(!w) return NULL;
+  w->filename = g_strdup(filename);
+  w->exif = exif;
+  w->exif_len = exif_len;
+
+  jpg->cinfo.err = jpeg_std_error(&w->jerr.pub);
+  w->jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
+  if(setjmp(w->jerr.setjmp_buffer))
   {
     jpeg_destroy_compress(&(jpg->cinfo));
-    return 1;
+    _jpeg_writer_free(w);
+    return NULL;
   }
   jpeg_create_compress(&(jpg->cinfo));
-  FILE *f = g_fopen(filename, "wb");
-  if(!f) return 1;
-  jpeg_stdio_dest(&(jpg->cinfo), f);
+  w->f = g_fopen(filename, "wb");
+  if(!w->f)
+  {
+    jpeg_destroy_compress(&(jpg->cinfo));
+    _jpeg_writer_free(w);
+    return NULL;
+  }
+  jpeg_stdio_dest(&(jpg->cinfo), w->f);
 
   jpg->cinfo.image_width = jpg->global.width;
   jpg->cinfo.image_height = jpg->global.height;
@@ -379,25 +407,69 @@ int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const v
     }
   }
 
-  uint8_t *row = dt_alloc_align(64, (size_t)3 * jpg->global.width * sizeof(uint8_t));
-  const uint8_t *buf;
-  while(jpg->cinfo.next_scanline < jpg->cinfo.image_height)
+  w->row = dt_alloc_align(64, (size_t)3 * jpg->global.width * sizeof(uint8_t));
+  if(!w->row)
+  {
+    jpeg_destroy_compress(&(jpg->cinfo));
+    _jpeg_writer_free(w);
+    return NULL;
+  }
+
+  return w;
+}
+
+int write_image_rows(dt_imageio_module_data_t *jpg_tmp, void *handle, const void *in_tmp, int rows)
+{
+  dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t *)jpg_tmp;
+  dt_imageio_jpeg_writer_t *w = (dt_imageio_jpeg_writer_t *)handle;
+  const uint8_t *in = (const uint8_t *)in_tmp;
+  uint8_t *row = w->row;
+
+  if(setjmp(w->jerr.setjmp_buffer)) return 1;
+
+  for(int j = 0; j < rows && jpg->cinfo.next_scanline < jpg->cinfo.image_height; j++)
   {
     JSAMPROW tmp[1];
-    buf = in + (size_t)jpg->cinfo.next_scanline * jpg->cinfo.image_width * 4;
+    const uint8_t *buf = in + (size_t)j * jpg->cinfo.image_width * 4;
     for(int i = 0; i < jpg->global.width; i++)
       for(int k = 0; k < 3; k++) row[3 * i + k] = buf[4 * i + k];
     tmp[0] = row;
     jpeg_write_scanlines(&(jpg->cinfo), tmp, 1);
   }
-  jpeg_finish_compress(&(jpg->cinfo));
-  dt_free_align(row);
+
+  return 0;
+}
+
+int write_image_end(dt_imageio_module_data_t *jpg_tmp, void *handle, int abort)
+{
+  dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t *)jpg_tmp;
+  dt_imageio_jpeg_writer_t *w = (dt_imageio_jpeg_writer_t *)handle;
+  int rc = abort || jpg->cinfo.next_scanline < jpg->cinfo.image_height;
+
+  if(setjmp(w->jerr.setjmp_buffer))
+    rc = 1;
+  else if(!rc)
+    jpeg_finish_compress(&(jpg->cinfo));
   jpeg_destroy_compress(&(jpg->cinfo));
-  fclose(f);
+  fclose(w->f);
+  w->f = NULL;
 
-  dt_exif_write_blob(exif, exif_len, filename, 1);
+  if(!rc) dt_exif_write_blob(w->exif, w->exif_len, w->filename, 1);
 
-  return 0;
+  _jpeg_writer_free(w);
+  return rc;
+}
+
+int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const void *in_tmp,
+                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                void *exif, int exif_len, int imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe)
+{
+  void *w = write_image_begin(jpg_tmp, filename, over_type, over_filename, exif, exif_len, imgid, num, total,
+                              pipe);
+  if(!w) return 1;
+
+  const int err = write_image_rows(jpg_tmp, w, in_tmp, jpg_tmp->height);
+  return write_image_end(jpg_tmp, w, err) || err;
 }
 
 static int __attribute__((__unused__)) read_header(const char *filename, dt_imageio_jpeg_t *jpg)
@@ -28,50 +28,91 @@
 
 DT_MODULE(1)
 
-int write_image(dt_imageio_module_data_t *data, const char *filename, const void *ivoid,
-                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
-                void *exif, int exif_len, int imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe)
+typedef struct dt_imageio_pfm_writer_t
+{
+  FILE *f;
+  long header_len;
+  void *buf_line;
+  int row;
+} dt_imageio_pfm_writer_t;
+
+void *write_image_begin(dt_imageio_module_data_t *data, const char *filename,
+                        dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                        void *exif, int exif_len, int imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe)
 {
   const dt_imageio_module_data_t *const pfm = data;
-  int status = 0;
   FILE *f = g_fopen(filename, "wb");
-  if(f)
+  if(!f) return NULL;
+
+  dt_imageio_pfm_writer_t *w = (dt_imageio_pfm_writer_t *)calloc(1, sizeof(dt_imageio_pfm_writer_t));
+  w->f = f;
+
+  // align pfm header to sse, assuming the file will
+  // be mmapped to page boundaries.
+  char header[1024];
+  snprintf(header, 1024, "PF\n%d %d\n-1.0", pfm->width, pfm->height);
+  size_t len = strlen(header);
+  fprintf(f, "PF\n%d %d\n-1.0", pfm->width, pfm->height);
+  ssize_t off = 0;
+  while((len + 1 + off) & 0xf) off++;
+  while(off-- > 0) fprintf(f, "0");
+  fprintf(f, "\n");
+  w->header_len = ftell(f);
+  w->buf_line = dt_alloc_align(64, 3 * sizeof(float) * pfm->width);
+  if(!w->buf_line)
+  {
+    fclose(f);
+    free(w);
+    return NULL;
+  }
+  return w;
+}
+
+int write_image_rows(dt_imageio_module_data_t *data, void *handle, const void *ivoid, int rows)
+{
+  const dt_imageio_module_data_t *const pfm = data;
+  dt_imageio_pfm_writer_t *w = (dt_imageio_pfm_writer_t *)handle;
+  const size_t linesize = 3 * sizeof(float) * pfm->width;
+
+  for(int j = 0; j < rows; j++, w->row++)
   {
-    // align pfm header to sse, assuming the file will
-    // be mmapped to page boundaries.
-    char header[1024];
-    snprintf(header, 1024, "PF\n%d %d\n-1.0", pfm->width, pfm->height);
-    size_t len = strlen(header);
-    fprintf(f, "PF\n%d %d\n-1.0", pfm->width, pfm->height);
-    ssize_t off = 0;
-    while((len + 1 + off) & 0xf) off++;
-    while(off-- > 0) fprintf(f, "0");
-    fprintf(f, "\n");
-    void *buf_line = dt_alloc_align(64, 3 * sizeof(float) * pfm->width);
-    for(int j = 0; j < pfm->height; j++)
+    // NOTE: pfm has rows in reverse order, we get them top to bottom and place them from the end
+    const int row_out = pfm->height - 1 - w->row;
+    const float *in = (const float *)ivoid + 4 * (size_t)pfm->width * j;
+    float *out = (float *)w->buf_line;
+    for(int i = 0; i < pfm->width; i++, in += 4, out += 3)
     {
-      // NOTE: pfm has rows in reverse order
-      const int row_in = pfm->height - 1 - j;
-      const float *in = (const float *)ivoid + 4 * (size_t)pfm->width * row_in;
-      float *out = (float *)buf_line;
-      for(int i = 0; i < pfm->width; i++, in += 4, out += 3)
-      {
-        memcpy(out, in, 3 * sizeof(float));
-      }
-      // INFO: per-line fwrite call seems to perform best. LebedevRI, 18.04.2014
-      int cnt = fwrite(buf_line, 3 * sizeof(float), pfm->width, f);
-      if(cnt != pfm->width)
-        status = 1;
-      else
-        status = 0;
+      memcpy(out, in, 3 * sizeof(float));
     }
-    dt_free_align(buf_line);
-    buf_line = NULL;
-    fclose(f);
+    if(fseek(w->f, w->header_len + (long)row_out * linesize, SEEK_SET)) return 1;
+    // INFO: per-line fwrite call seems to perform best. LebedevRI, 18.04.2014
+    int cnt = fwrite(w->buf_line, 3 * sizeof(float), pfm->width, w->f);
+    if(cnt != pfm->width) return 1;
   }
+  return 0;
+}
+
+int write_image_end(dt_imageio_module_data_t *data, void *handle, int abort)
+{
+  dt_imageio_pfm_writer_t *w = (dt_imageio_pfm_writer_t *)handle;
+  int status = abort || w->row != data->height;
+  if(fclose(w->f)) status = 1;
+  dt_free_align(w->buf_line);
+  free(w);
   return status;
 }
 
+int write_image(dt_imageio_module_data_t *data, const char *filename, const void *ivoid,
+                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                void *exif, int exif_len, int imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe)
+{
+  void *w = write_image_begin(data, filename, over_type, over_filename, exif, exif_len, imgid, num, total, pipe);
+  if(!w) return 1;
+
+  const int err = write_image_rows(data, w, ivoid, data->height);
+  return write_image_end(data, w, err) || err;
+}
+
 size_t params_size(dt_imageio_module_format_t *self)
 {
   return sizeof(dt_imageio_module_data_t);
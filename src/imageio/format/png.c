@@ -119,41 +119,65 @@ static void PNGwriteRawProfile(png_struct *ping, png_info *ping_info, char *prof
   png_free(ping, text);
 }
 
-int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const void *ivoid,
-                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
-                void *exif, int exif_len, int imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe)
+typedef struct dt_imageio_png_writer_t
+{
+  FILE *f;
+  png_structp png_ptr;
+  png_infop info_ptr;
+  png_bytep *row_pointers;
+  int rows;
+  int row;
+} dt_imageio_png_writer_t;
+
+static void _png_writer_free(dt_imageio_png_writer_t *w)
+{
+  if(w->png_ptr) png_destroy_write_struct(&w->png_ptr, &w->info_ptr);
+  if(w->f) fclose(w->f);
+  dt_free_align(w->row_pointers);
+  free(w);
+}
+
+void *write_image_begin(dt_imageio_module_data_t *p_tmp, const char *filename,
+                        dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                        void *exif, int exif_len, int imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe)
 {
   dt_imageio_png_t *p = (dt_imageio_png_t *)p_tmp;
   const int width = p->global.width, height = p->global.height;
-  FILE *f = g_fopen(filename, "wb");
-  if(!f) return 1;
 
-  png_structp png_ptr;
-  png_infop info_ptr;
+  dt_imageio_png_writer_t *w = (dt_imageio_png_writer_t *)calloc(1, sizeof(dt_imageio_png_writer_t));
+  if(!w) return NULL;
 
-  png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-  if(!png_ptr)
+  w->f = g_fopen(filename, "wb");
+  if(!w->f)
   {
-    fclose(f);
-    return 1;
+    _png_writer_free(w);
+    return NULL;
   }
 
-  info_ptr = png_create_info_struct(png_ptr);
-  if(!info_ptr)
+  w->png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  if(!w->png_ptr)
   {
-    fclose(f);
-    png_destroy_write_struct(&png_ptr, NULL);
-    return 1;
+    _png_writer_free(w);
+    return NULL;
+  }
+
+  w->info_ptr = png_create_info_struct(w->png_ptr);
+  if(!w->info_ptr)
+  {
+    _png_writer_free(w);
+    return NULL;
   }
 
+  png_structp png_ptr = w->png_ptr;
+  png_infop info_ptr = w->info_ptr;
+
   if(setjmp(png_jmpbuf(png_ptr)))
   {
-    fclose(f);
-    png_destroy_write_struct(&png_ptr, &info_ptr);
-    return 1;
+    _png_writer_free(w);
+    return NULL;
   }
 
-  png_init_io(png_ptr, f);
+  png_init_io(png_ptr, w->f);
 
   png_set_compression_level(png_ptr, p->compression);
   png_set_compression_mem_level(png_ptr, 8);
@@ -202,30 +226,73 @@ int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const voi
    */
   png_set_filler(png_ptr, 0, PNG_FILLER_AFTER);
 
-  png_bytep *row_pointers = dt_alloc_align(64, (size_t)height * sizeof(png_bytep));
+  /* swap bytes of 16 bit files to most significant bit first */
+  if(p->bpp > 8) png_set_swap(png_ptr);
 
-  if(p->bpp > 8)
+  return w;
+}
+
+int write_image_rows(dt_imageio_module_data_t *p_tmp, void *handle, const void *ivoid, int rows)
+{
+  dt_imageio_png_t *p = (dt_imageio_png_t *)p_tmp;
+  dt_imageio_png_writer_t *w = (dt_imageio_png_writer_t *)handle;
+  const int width = p->global.width;
+
+  if(rows > w->rows)
   {
-    /* swap bytes of 16 bit files to most significant bit first */
-    png_set_swap(png_ptr);
+    dt_free_align(w->row_pointers);
+    w->row_pointers = dt_alloc_align(64, (size_t)rows * sizeof(png_bytep));
+    w->rows = w->row_pointers ? rows : 0;
+    if(!w->row_pointers) return 1;
+  }
+
+  if(setjmp(png_jmpbuf(w->png_ptr))) return 1;
 
-    for(unsigned i = 0; i < height; i++) row_pointers[i] = (png_bytep)((uint16_t *)ivoid + (size_t)4 * i * width);
+  if(p->bpp > 8)
+  {
+    for(int i = 0; i < rows; i++)
+      w->row_pointers[i] = (png_bytep)((uint16_t *)ivoid + (size_t)4 * i * width);
   }
   else
   {
-    for(unsigned i = 0; i < height; i++) row_pointers[i] = (uint8_t *)ivoid + (size_t)4 * i * width;
+    for(int i = 0; i < rows; i++) w->row_pointers[i] = (uint8_t *)ivoid + (size_t)4 * i * width;
   }
 
-  png_write_image(png_ptr, row_pointers);
-
-  dt_free_align(row_pointers);
+  png_write_rows(w->png_ptr, w->row_pointers, rows);
+  w->row += rows;
 
-  png_write_end(png_ptr, info_ptr);
-  png_destroy_write_struct(&png_ptr, &info_ptr);
-  fclose(f);
   return 0;
 }
 
+int write_image_end(dt_imageio_module_data_t *p_tmp, void *handle, int abort)
+{
+  dt_imageio_png_writer_t *w = (dt_imageio_png_writer_t *)handle;
+  int rc = abort || w->row != p_tmp->height;
+
+  if(!rc)
+  {
+    if(setjmp(png_jmpbuf(w->png_ptr)))
+      rc = 1;
+    else
+      png_write_end(w->png_ptr, w->info_ptr);
+  }
+
+  _png_writer_free(w);
+  return rc;
+}
+
+int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const void *ivoid,
+                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                void *exif, int exif_len, int imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe)
+{
+  void *w = write_image_begin(p_tmp, filename, over_type, over_filename, exif, exif_len, imgid, num, total,
+                              pipe);
+  if(!w) return 1;
+
+  const int err = write_image_rows(p_tmp, w, ivoid, p_tmp->height);
+  return write_image_end(p_tmp, w, err) || err;
+}
+
 static int __attribute__((__unused__)) read_header(const char *filename, dt_imageio_module_data_t *p_tmp)
 {
   dt_imageio_png_t *png = (dt_imageio_png_t *)p_tmp;
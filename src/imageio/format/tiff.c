@@ -50,20 +50,40 @@ typedef struct dt_imageio_tiff_gui_t
 } dt_imageio_tiff_gui_t;
 
 
-int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const void *in_void,
-                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
-                void *exif, int exif_len, int imgid, int num, int total, dt_dev_pixelpipe_t *pipe)
+typedef struct dt_imageio_tiff_writer_t
+{
+  TIFF *tif;
+  uint8_t *profile;
+  void *rowdata;
+  int row;
+  gchar *filename;
+  void *exif;
+  int exif_len;
+} dt_imageio_tiff_writer_t;
+
+static void _tiff_writer_free(dt_imageio_tiff_writer_t *w)
+{
+  // close the file before adding exif data
+  if(w->tif) TIFFClose(w->tif);
+  free(w->profile);
+  free(w->rowdata);
+  g_free(w->filename);
+  free(w);
+}
+
+void *write_image_begin(dt_imageio_module_data_t *d_tmp, const char *filename,
+                        dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                        void *exif, int exif_len, int imgid, int num, int total, dt_dev_pixelpipe_t *pipe)
 {
   const dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)d_tmp;
 
-  uint8_t *profile = NULL;
   uint32_t profile_len = 0;
 
-  TIFF *tif = NULL;
-
-  void *rowdata = NULL;
-
-  int rc = 1; // default to error
+  dt_imageio_tiff_writer_t *w = (dt_imageio_tiff_writer_t *)calloc(1, sizeof(dt_imageio_tiff_writer_t));
+  if(!w) return NULL;
+  w->filename = g_strdup(filename);
+  w->exif = exif;
+  w->exif_len = exif_len;
 
   if(imgid > 0)
   {
@@ -71,29 +91,22 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
     cmsSaveProfileToMem(out_profile, 0, &profile_len);
     if(profile_len > 0)
     {
-      profile = malloc(profile_len);
-      if(!profile)
-      {
-        rc = 1;
-        goto exit;
-      }
-      cmsSaveProfileToMem(out_profile, profile, &profile_len);
+      w->profile = malloc(profile_len);
+      if(!w->profile) goto error;
+      cmsSaveProfileToMem(out_profile, w->profile, &profile_len);
     }
   }
 
   // Create little endian tiff image
 #ifdef _WIN32
   wchar_t *wfilename = g_utf8_to_utf16(filename, -1, NULL, NULL, NULL);
-  tif = TIFFOpenW(wfilename, "wl");
+  w->tif = TIFFOpenW(wfilename, "wl");
   g_free(wfilename);
 #else
-  tif = TIFFOpen(filename, "wl");
+  w->tif = TIFFOpen(filename, "wl");
 #endif
-  if(!tif)
-  {
-    rc = 1;
-    goto exit;
-  }
+  TIFF *tif = w->tif;
+  if(!tif) goto error;
 
   // http://partners.adobe.com/public/developer/en/tiff/TIFFphotoshop.pdf (dated 2002)
   // "A proprietary ZIP/Flate compression code (0x80b2) has been used by some"
@@ -129,9 +142,9 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
   }
 
   TIFFSetField(tif, TIFFTAG_FILLORDER, (uint16_t)FILLORDER_MSB2LSB);
-  if(profile != NULL)
+  if(w->profile != NULL)
   {
-    TIFFSetField(tif, TIFFTAG_ICCPROFILE, (uint32_t)profile_len, profile);
+    TIFFSetField(tif, TIFFTAG_ICCPROFILE, (uint32_t)profile_len, w->profile);
   }
   TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, (uint16_t)3);
   TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (uint16_t)d->bpp);
@@ -152,94 +165,94 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
   }
 
   const size_t rowsize = (d->global.width * 3) * d->bpp / 8;
-  if((rowdata = malloc(rowsize)) == NULL)
-  {
-    rc = 1;
-    goto exit;
-  }
+  if((w->rowdata = malloc(rowsize)) == NULL) goto error;
+
+  return w;
+
+error:
+  _tiff_writer_free(w);
+  return NULL;
+}
+
+int write_image_rows(dt_imageio_module_data_t *d_tmp, void *handle, const void *in_void, int rows)
+{
+  const dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)d_tmp;
+  dt_imageio_tiff_writer_t *w = (dt_imageio_tiff_writer_t *)handle;
+  const int width = d->global.width;
 
-  if(d->bpp == 32)
+  for(int y = 0; y < rows; y++, w->row++)
   {
-    for(int y = 0; y < d->global.height; y++)
+    if(d->bpp == 32)
     {
-      float *in = (float *)in_void + (size_t)4 * y * d->global.width;
-      float *out = (float *)rowdata;
+      const float *in = (const float *)in_void + (size_t)4 * y * width;
+      float *out = (float *)w->rowdata;
 
-      for(int x = 0; x < d->global.width; x++, in += 4, out += 3)
+      for(int x = 0; x < width; x++, in += 4, out += 3)
       {
         memcpy(out, in, 3 * sizeof(float));
       }
-
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-      {
-        rc = 1;
-        goto exit;
-      }
     }
-  }
-  else if(d->bpp == 16)
-  {
-    for(int y = 0; y < d->global.height; y++)
+    else if(d->bpp == 16)
     {
-      uint16_t *in = (uint16_t *)in_void + (size_t)4 * y * d->global.width;
-      uint16_t *out = (uint16_t *)rowdata;
+      const uint16_t *in = (const uint16_t *)in_void + (size_t)4 * y * width;
+      uint16_t *out = (uint16_t *)w->rowdata;
 
-      for(int x = 0; x < d->global.width; x++, in += 4, out += 3)
+      for(int x = 0; x < width; x++, in += 4, out += 3)
       {
         memcpy(out, in, 3 * sizeof(uint16_t));
       }
-
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-      {
-        rc = 1;
-        goto exit;
-      }
     }
-  }
-  else
-  {
-    for(int y = 0; y < d->global.height; y++)
+    else
     {
-      uint8_t *in = (uint8_t *)in_void + (size_t)4 * y * d->global.width;
-      uint8_t *out = (uint8_t *)rowdata;
+      const uint8_t *in = (const uint8_t *)in_void + (size_t)4 * y * width;
+      uint8_t *out = (uint8_t *)w->rowdata;
 
-      for(int x = 0; x < d->global.width; x++, in += 4, out += 3)
+      for(int x = 0; x < width; x++, in += 4, out += 3)
       {
         memcpy(out, in, 3 * sizeof(uint8_t));
       }
-
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-      {
-        rc = 1;
-        goto exit;
-      }
     }
+
+    if(TIFFWriteScanline(w->tif, w->rowdata, w->row, 0) == -1) return 1;
   }
 
-  // success
-  rc = 0;
+  return 0;
+}
+
+int write_image_end(dt_imageio_module_data_t *d_tmp, void *handle, int abort)
+{
+  const dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)d_tmp;
+  dt_imageio_tiff_writer_t *w = (dt_imageio_tiff_writer_t *)handle;
+
+  int rc = abort || w->row != d->global.height;
 
-exit:
   // close the file before adding exif data
-  if(tif)
-  {
-    TIFFClose(tif);
-    tif = NULL;
-  }
-  if(!rc && exif)
+  TIFFClose(w->tif);
+  w->tif = NULL;
+
+  if(!rc && w->exif)
   {
-    rc = dt_exif_write_blob(exif, exif_len, filename, d->compress > 0);
+    rc = dt_exif_write_blob(w->exif, w->exif_len, w->filename, d->compress > 0);
     // Until we get symbolic error status codes, if rc is 1, return 0
     rc = (rc == 1) ? 0 : 1;
   }
-  free(profile);
-  profile = NULL;
-  free(rowdata);
-  rowdata = NULL;
 
+  _tiff_writer_free(w);
   return rc;
 }
 
+int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const void *in_void,
+                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                void *exif, int exif_len, int imgid, int num, int total, dt_dev_pixelpipe_t *pipe)
+{
+  void *w = write_image_begin(d_tmp, filename, over_type, over_filename, exif, exif_len, imgid, num, total,
+                              pipe);
+  if(!w) return 1;
+
+  const int err = write_image_rows(d_tmp, w, in_void, d_tmp->height);
+  return write_image_end(d_tmp, w, err) || err;
+}
+
 #if 0
 int dt_imageio_tiff_read_header(const char *filename, dt_imageio_tiff_t *tiff)
 {
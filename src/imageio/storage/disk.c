@@ -35,6 +35,8 @@
 #ifdef GDK_WINDOWING_QUARTZ
 #include "osx/osx.h"
 #endif
+#include <errno.h>
+#include <fcntl.h>
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <stdio.h>
@@ -236,12 +238,13 @@ int store(dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, co
   g_strlcpy(pattern, d->filename, sizeof(pattern));
   gboolean from_cache = FALSE;
   dt_image_full_path(imgid, input_dir, sizeof(input_dir), &from_cache);
-  // set max_width and max_height values to expand them afterwards in darktable variables
-  dt_variables_set_max_width_height(d->vp, fdata->max_width, fdata->max_height);
   int fail = 0;
+  gboolean reserved = FALSE;
   // we're potentially called in parallel. have sequence number synchronized:
   dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
   {
+    // set max_width and max_height values to expand them afterwards in darktable variables
+    dt_variables_set_max_width_height(d->vp, fdata->max_width, fdata->max_height);
 try_again:
     // avoid braindead export which is bound to overwrite at random:
     if(total > 1 && !g_strrstr(pattern, "$"))
@@ -301,11 +304,24 @@ try_again:
 
     if(!fail && d->onsave_action == DT_EXPORT_ONCONFLICT_UNIQUEFILENAME)
     {
+      // reserve the name, another export pipeline or some other program might be looking for one right now.
+      // if it can't be created at all the export will tell.
       int seq = 1;
-      while(g_file_test(filename, G_FILE_TEST_EXISTS))
+      while(!reserved)
       {
-        snprintf(c, filename_free_space, "_%.2d.%s", seq, ext);
-        seq++;
+        const int fd = g_open(filename, O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if(fd >= 0)
+        {
+          g_close(fd, NULL);
+          reserved = TRUE;
+        }
+        else if(errno == EEXIST)
+        {
+          snprintf(c, filename_free_space, "_%.2d.%s", seq, ext);
+          seq++;
+        }
+        else
+          break;
       }
     }
 
@@ -330,6 +346,8 @@ try_again:
   {
     fprintf(stderr, "[imageio_storage_disk] could not export to file: `%s'!\n", filename);
     dt_control_log(_("could not export to file `%s'!"), filename);
+    // don't leave the empty file behind
+    if(reserved) g_unlink(filename);
     return 1;
   }
 
@@ -339,6 +357,12 @@ try_again:
   return 0;
 }
 
+int parallel_store(dt_imageio_module_storage_t *self)
+{
+  // file names are found under darktable.plugin_threadsafe, everything else is per image
+  return 1;
+}
+
 size_t params_size(dt_imageio_module_storage_t *self)
 {
   return sizeof(dt_imageio_disk_t) - sizeof(void *);
@@ -353,6 +353,8 @@ void amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
   // Tile size; the image is processed in square tiles to lower memory requirements and facilitate
   // multi-threading
   // We assure that Tile size is a multiple of 32 in the range [96;992]
+  // unlike markesteijn's, this isn't picked from the cache size at runtime: the output changes slightly with
+  // the tile size, and an export must not depend on the machine it ran on
   constexpr int ts = (AMAZETS & 992) < 96 ? 96 : (AMAZETS & 992);
   constexpr int tsh = ts / 2; // half of Tile size
 
@@ -418,18 +420,26 @@ void amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
     float v;
   } s_hv;
 
+  constexpr int cldf = 2; // factor to multiply cache line distance. 1 = 64 bytes, 2 = 128 bytes ...
+  // working space of all threads in one allocation from the pipe's pool, every slice aligned to 64 bytes
+  const size_t buffer_size
+      = (14 * sizeof(float) * ts * ts + sizeof(char) * ts * tsh + 18 * cldf * 64 + 63) & ~(size_t)63;
+  char *const all_buffers = (char *)dt_buffer_pool_alloc(&piece->pipe->pool, dt_get_num_threads() * buffer_size);
+  if(!all_buffers)
+  {
+    fprintf(stderr, "[demosaic] not able to allocate AMaZE buffers\n");
+    return;
+  }
+
 #ifdef _OPENMP
 #pragma omp parallel
 #endif
   {
     //     int progresscounter = 0;
 
-    constexpr int cldf = 2; // factor to multiply cache line distance. 1 = 64 bytes, 2 = 128 bytes ...
-    // assign working space
-    char *buffer
-        = (char *)calloc(14 * sizeof(float) * ts * ts + sizeof(char) * ts * tsh + 18 * cldf * 64 + 63, 1);
-    // aligned to 64 byte boundary
-    char *data = (char *)((uintptr_t(buffer) + uintptr_t(63)) / 64 * 64);
+    // assign working space, cleared as calloc did
+    char *data = all_buffers + dt_get_thread_num() * buffer_size;
+    memset(data, 0, buffer_size);
 
     // green values
     float *rgbgreen = (float(*))data;
@@ -483,7 +493,7 @@ void amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
 // Main algorithm: Tile loop
 // use collapse(2) to collapse the 2 loops to one large loop, so there is better scaling
 #ifdef _OPENMP
-#pragma omp for SIMD() schedule(static) collapse(2) nowait
+#pragma omp for SIMD() schedule(dynamic) collapse(2) nowait
 #endif
 
     for(int top = winy - 16; top < winy + height; top += ts - 32)
@@ -2409,11 +2419,10 @@ void amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
         //         }
       }
     } // end of main loop
-
-    // clean up
-    free(buffer);
   }
 
+  dt_buffer_pool_free(&piece->pipe->pool, all_buffers);
+
   //   if(plistener)
   //   {
   //     plistener->setProgress(1.0);
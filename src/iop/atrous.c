@@ -564,6 +564,110 @@ static void eaw_decompose_sse2(float *const out, const float *const in, float *c
 #undef SUM_PIXEL_EPILOGUE_SSE
 #endif
 
+#if defined(DT_HAVE_AVX_CODEPATHS)
+/* dt_fast_expf_sse2() for eight floats */
+__DT_TARGET_AVX2__
+static inline __m256 dt_fast_expf_avx2(const __m256 x)
+{
+  const __m256 f = _mm256_fmadd_ps(x, _mm256_set1_ps(0x00adf880u), _mm256_set1_ps(0x3f800000u));
+  __m256i i = _mm256_cvtps_epi32(f);
+  i = _mm256_andnot_si256(_mm256_srai_epi32(i, 31), i);
+  return _mm256_castsi256_ps(i);
+}
+
+/* weight_sse2() for two adjacent pixels, (wl, wc, wc, 1) each */
+__DT_TARGET_AVX2__
+static inline __m256 weight_avx2(const __m256 c1, const __m256 c2, const float sharpen)
+{
+  const __m256 diff = c1 - c2;
+  const __m256 square = diff * diff;                                      // (?, d3, d2, d1) twice
+  const __m256 square2 = _mm256_permute_ps(square, _MM_SHUFFLE(3, 1, 2, 0)); // (?, d2, d3, d1) twice
+  const __m256 added = _mm256_blend_ps(square + square2, square, 0x11);   // (?, d2+d3, d2+d3, d1) twice
+  const __m256 exp = dt_fast_expf_avx2(added * _mm256_set1_ps(-sharpen));
+  return _mm256_blend_ps(exp, _mm256_set1_ps(1.0f), 0x88);
+}
+
+/* one pixel close to the border, with nearest pixel interpolation outside the image */
+__DT_TARGET_AVX2__
+static inline void eaw_decompose_pixel_avx2(float *const out, const float *const in, float *const detail,
+                                            const float *const filter, const int mult, const float sharpen,
+                                            const int32_t width, const int32_t height, const int i, const int j)
+{
+  const size_t k = (size_t)4 * (i + (size_t)j * width);
+  const __m128 px = _mm_load_ps(in + k);
+  __m128 sum = _mm_setzero_ps();
+  __m128 wgt = _mm_setzero_ps();
+  for(int jj = 0; jj < 5; jj++)
+  {
+    const int y = CLAMPS(j + mult * (jj - 2), 0, height - 1);
+    for(int ii = 0; ii < 5; ii++)
+    {
+      const int x = CLAMPS(i + mult * (ii - 2), 0, width - 1);
+      const __m128 px2 = _mm_load_ps(in + (size_t)4 * (x + (size_t)y * width));
+      const __m128 w = _mm_set1_ps(filter[ii] * filter[jj]) * weight_sse2(&px, &px2, sharpen);
+      sum = _mm_fmadd_ps(w, px2, sum);
+      wgt = wgt + w;
+    }
+  }
+  sum = sum * _mm_rcp_ps(wgt);
+  _mm_store_ps(detail + k, px - sum);
+  _mm_store_ps(out + k, sum);
+}
+
+/* two adjacent pixels whose 5x5 neighbourhood lies inside the image */
+__DT_TARGET_AVX2__
+static inline void eaw_decompose_pair_avx2(float *const out, const float *const in, float *const detail,
+                                           const float *const filter, const int mult, const float sharpen,
+                                           const int32_t width, const int i, const int j)
+{
+  const size_t k = (size_t)4 * (i + (size_t)j * width);
+  const __m256 px = _mm256_loadu_ps(in + k);
+  __m256 sum = _mm256_setzero_ps();
+  __m256 wgt = _mm256_setzero_ps();
+  for(int jj = 0; jj < 5; jj++)
+  {
+    const float *const row = in + (size_t)4 * (j + mult * (jj - 2)) * width;
+    for(int ii = 0; ii < 5; ii++)
+    {
+      const __m256 px2 = _mm256_loadu_ps(row + (size_t)4 * (i + mult * (ii - 2)));
+      const __m256 w = _mm256_set1_ps(filter[ii] * filter[jj]) * weight_avx2(px, px2, sharpen);
+      sum = _mm256_fmadd_ps(w, px2, sum);
+      wgt = wgt + w;
+    }
+  }
+  sum = sum * _mm256_rcp_ps(wgt);
+  _mm256_storeu_ps(detail + k, px - sum);
+  _mm256_storeu_ps(out + k, sum);
+}
+
+__DT_TARGET_AVX2__
+static void eaw_decompose_avx2(float *const out, const float *const in, float *const detail, const int scale,
+                               const float sharpen, const int32_t width, const int32_t height)
+{
+  const int mult = 1 << scale;
+  static const float filter[5] = { 1.0f / 16.0f, 4.0f / 16.0f, 6.0f / 16.0f, 4.0f / 16.0f, 1.0f / 16.0f };
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(detail, filter, height, in, mult, out, sharpen, width) \
+  schedule(static)
+#endif
+  for(int j = 0; j < height; j++)
+  {
+    int i = 0;
+    // the first and last "2*mult" lines and pixels of each line need the slow variant with tests
+    if(j >= 2 * mult && j < height - 2 * mult)
+    {
+      for(; i < 2 * mult; i++)
+        eaw_decompose_pixel_avx2(out, in, detail, filter, mult, sharpen, width, height, i, j);
+      for(; i + 1 < width - 2 * mult; i += 2)
+        eaw_decompose_pair_avx2(out, in, detail, filter, mult, sharpen, width, i, j);
+    }
+    for(; i < width; i++) eaw_decompose_pixel_avx2(out, in, detail, filter, mult, sharpen, width, height, i, j);
+  }
+}
+#endif
+
 typedef void((*eaw_synthesize_t)(float *const out, const float *const in, const float *const detail,
                                  const float *thrsf, const float *boostf, const int32_t width,
                                  const int32_t height));
@@ -732,7 +836,7 @@ static void process_wavelets(struct dt_iop_module_t *self, struct dt_dev_pixelpi
   float *buf2 = NULL;
   float *buf1 = NULL;
 
-  tmp = (float *)dt_alloc_align(64, (size_t)sizeof(float) * 4 * width * height);
+  tmp = (float *)dt_buffer_pool_alloc(&piece->pipe->pool, (size_t)sizeof(float) * 4 * width * height);
   if(tmp == NULL)
   {
     fprintf(stderr, "[atrous] failed to allocate coarse buffer!\n");
@@ -741,7 +845,7 @@ static void process_wavelets(struct dt_iop_module_t *self, struct dt_dev_pixelpi
 
   for(int k = 0; k < max_scale; k++)
   {
-    detail[k] = (float *)dt_alloc_align(64, (size_t)sizeof(float) * 4 * width * height);
+    detail[k] = (float *)dt_buffer_pool_alloc(&piece->pipe->pool, (size_t)sizeof(float) * 4 * width * height);
     if(detail[k] == NULL)
     {
       fprintf(stderr, "[atrous] failed to allocate one of the detail buffers!\n");
@@ -770,17 +874,16 @@ static void process_wavelets(struct dt_iop_module_t *self, struct dt_dev_pixelpi
   }
   /* due to symmetric processing, output will be left in (float *)o */
 
-  for(int k = 0; k < max_scale; k++) dt_free_align(detail[k]);
-  dt_free_align(tmp);
+  for(int k = 0; k < max_scale; k++) dt_buffer_pool_free(&piece->pipe->pool, detail[k]);
+  dt_buffer_pool_free(&piece->pipe->pool, tmp);
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(i, o, width, height);
 
   return;
 
 error:
-  for(int k = 0; k < max_scale; k++)
-    if(detail[k] != NULL) dt_free_align(detail[k]);
-  if(tmp != NULL) dt_free_align(tmp);
+  for(int k = 0; k < max_scale; k++) dt_buffer_pool_free(&piece->pipe->pool, detail[k]);
+  dt_buffer_pool_free(&piece->pipe->pool, tmp);
   return;
 }
 
@@ -798,6 +901,15 @@ void process_sse2(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *p
 }
 #endif
 
+#if defined(DT_HAVE_AVX_CODEPATHS)
+__DT_TARGET_AVX2__
+void process_avx2(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const i,
+                  void *const o, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  process_wavelets(self, piece, i, o, roi_in, roi_out, eaw_decompose_avx2, eaw_synthesize_sse2);
+}
+#endif
+
 #ifdef HAVE_OPENCL
 /* this version is adapted to the new global tiling mechanism. it no longer does tiling by itself. */
 int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
@@ -1441,6 +1441,175 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
 }
 #endif
 
+#if defined(DT_HAVE_AVX_CODEPATHS)
+// the wide codepaths only cover the matrix fast path, which is what nearly every raw takes. the rest is
+// left to process_sse2().
+static int _cmatrix_fastpath_applies(const dt_iop_colorin_data_t *const d, dt_dev_pixelpipe_iop_t *piece)
+{
+  const int blue_mapping = d->blue_mapping && dt_image_is_matrix_correction_supported(&piece->pipe->image);
+  return d->type != DT_COLORSPACE_LAB && !isnan(d->cmatrix[0]) && !blue_mapping && d->nonlinearlut == 0;
+}
+
+// one matrix column for two pixels
+__DT_TARGET_AVX2__
+static inline __m256 _matrix_column_avx2(const float *const mat, const int c)
+{
+  return _mm256_setr_ps(mat[c], mat[c + 3], mat[c + 6], 0.0f, mat[c], mat[c + 3], mat[c + 6], 0.0f);
+}
+
+__DT_TARGET_AVX2__
+static inline __m256 _matrix_mul_avx2(const __m256 m0, const __m256 m1, const __m256 m2, const __m256 v)
+{
+  return _mm256_fmadd_ps(m2, _mm256_permute_ps(v, _MM_SHUFFLE(2, 2, 2, 2)),
+                         _mm256_fmadd_ps(m1, _mm256_permute_ps(v, _MM_SHUFFLE(1, 1, 1, 1)),
+                                         m0 * _mm256_permute_ps(v, _MM_SHUFFLE(0, 0, 0, 0))));
+}
+
+__DT_TARGET_AVX2__
+static inline __m256 _cmatrix_pixels_avx2(const int clipping, const __m256 *const cm, const __m256 *const nm,
+                                          const __m256 *const lm, const __m256 input)
+{
+  if(!clipping) return dt_XYZ_to_Lab_avx2(_matrix_mul_avx2(cm[0], cm[1], cm[2], input));
+
+  const __m256 nrgb = _matrix_mul_avx2(nm[0], nm[1], nm[2], input);
+  const __m256 crgb = _mm256_min_ps(_mm256_max_ps(nrgb, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+  return dt_XYZ_to_Lab_avx2(_matrix_mul_avx2(lm[0], lm[1], lm[2], crgb));
+}
+
+__DT_TARGET_AVX2__
+static void process_avx2_cmatrix_fastpath(dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                                          void *const ovoid, const dt_iop_roi_t *const roi_out)
+{
+  const dt_iop_colorin_data_t *const d = (dt_iop_colorin_data_t *)piece->data;
+  const int clipping = (d->nrgb != NULL);
+  const __m256 cm[3] = { _matrix_column_avx2(d->cmatrix, 0), _matrix_column_avx2(d->cmatrix, 1),
+                         _matrix_column_avx2(d->cmatrix, 2) };
+  const __m256 nm[3] = { _matrix_column_avx2(d->nmatrix, 0), _matrix_column_avx2(d->nmatrix, 1),
+                         _matrix_column_avx2(d->nmatrix, 2) };
+  const __m256 lm[3] = { _matrix_column_avx2(d->lmatrix, 0), _matrix_column_avx2(d->lmatrix, 1),
+                         _matrix_column_avx2(d->lmatrix, 2) };
+  const size_t npixels = (size_t)roi_out->width * roi_out->height;
+  const float *const in = (const float *)ivoid;
+  float *const out = (float *)ovoid;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(clipping, cm, in, lm, nm, npixels, out) \
+  schedule(static)
+#endif
+  for(size_t k = 0; k < npixels / 2; k++)
+    _mm256_storeu_ps(out + 8 * k, _cmatrix_pixels_avx2(clipping, cm, nm, lm, _mm256_loadu_ps(in + 8 * k)));
+
+  // an odd pixel at the end goes through both halves
+  if(npixels & 1)
+  {
+    const size_t k = npixels - 1;
+    const __m256 input = _mm256_broadcast_ps((const __m128 *)(in + 4 * k));
+    const __m256 lab = _cmatrix_pixels_avx2(clipping, cm, nm, lm, input);
+    _mm_store_ps(out + 4 * k, _mm256_castps256_ps128(lab));
+  }
+}
+
+__DT_TARGET_AVX2__
+void process_avx2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                  void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const dt_iop_colorin_data_t *const d = (dt_iop_colorin_data_t *)piece->data;
+
+  if(!_cmatrix_fastpath_applies(d, piece))
+  {
+    process_sse2(self, piece, ivoid, ovoid, roi_in, roi_out);
+    return;
+  }
+
+  process_avx2_cmatrix_fastpath(piece, ivoid, ovoid, roi_out);
+
+  dt_ioppr_set_pipe_work_profile_info(self->dev, piece->pipe, d->type_work, d->filename_work, DT_INTENT_PERCEPTUAL);
+
+  if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
+}
+
+// one matrix column for four pixels
+__DT_TARGET_AVX512__
+static inline __m512 _matrix_column_avx512(const float *const mat, const int c)
+{
+  return _mm512_broadcast_f32x4(_mm_setr_ps(mat[c], mat[c + 3], mat[c + 6], 0.0f));
+}
+
+__DT_TARGET_AVX512__
+static inline __m512 _matrix_mul_avx512(const __m512 m0, const __m512 m1, const __m512 m2, const __m512 v)
+{
+  return _mm512_fmadd_ps(m2, _mm512_permute_ps(v, _MM_SHUFFLE(2, 2, 2, 2)),
+                         _mm512_fmadd_ps(m1, _mm512_permute_ps(v, _MM_SHUFFLE(1, 1, 1, 1)),
+                                         m0 * _mm512_permute_ps(v, _MM_SHUFFLE(0, 0, 0, 0))));
+}
+
+__DT_TARGET_AVX512__
+static inline __m512 _cmatrix_pixels_avx512(const int clipping, const __m512 *const cm, const __m512 *const nm,
+                                            const __m512 *const lm, const __m512 input)
+{
+  if(!clipping) return dt_XYZ_to_Lab_avx512(_matrix_mul_avx512(cm[0], cm[1], cm[2], input));
+
+  const __m512 nrgb = _matrix_mul_avx512(nm[0], nm[1], nm[2], input);
+  const __m512 crgb = _mm512_min_ps(_mm512_max_ps(nrgb, _mm512_setzero_ps()), _mm512_set1_ps(1.0f));
+  return dt_XYZ_to_Lab_avx512(_matrix_mul_avx512(lm[0], lm[1], lm[2], crgb));
+}
+
+__DT_TARGET_AVX512__
+static void process_avx512_cmatrix_fastpath(dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                                            void *const ovoid, const dt_iop_roi_t *const roi_out)
+{
+  const dt_iop_colorin_data_t *const d = (dt_iop_colorin_data_t *)piece->data;
+  const int clipping = (d->nrgb != NULL);
+  const __m512 cm[3] = { _matrix_column_avx512(d->cmatrix, 0), _matrix_column_avx512(d->cmatrix, 1),
+                         _matrix_column_avx512(d->cmatrix, 2) };
+  const __m512 nm[3] = { _matrix_column_avx512(d->nmatrix, 0), _matrix_column_avx512(d->nmatrix, 1),
+                         _matrix_column_avx512(d->nmatrix, 2) };
+  const __m512 lm[3] = { _matrix_column_avx512(d->lmatrix, 0), _matrix_column_avx512(d->lmatrix, 1),
+                         _matrix_column_avx512(d->lmatrix, 2) };
+  const size_t npixels = (size_t)roi_out->width * roi_out->height;
+  const float *const in = (const float *)ivoid;
+  float *const out = (float *)ovoid;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(clipping, cm, in, lm, nm, npixels, out) \
+  schedule(static)
+#endif
+  for(size_t k = 0; k < npixels / 4; k++)
+    _mm512_storeu_ps(out + 16 * k, _cmatrix_pixels_avx512(clipping, cm, nm, lm, _mm512_loadu_ps(in + 16 * k)));
+
+  // up to three pixels left, masked to the floats that exist
+  const size_t rest = npixels & 3;
+  if(rest)
+  {
+    const size_t k = npixels - rest;
+    const __mmask16 mask = (__mmask16)((1u << (4 * rest)) - 1);
+    const __m512 lab = _cmatrix_pixels_avx512(clipping, cm, nm, lm, _mm512_maskz_loadu_ps(mask, in + 4 * k));
+    _mm512_mask_storeu_ps(out + 4 * k, mask, lab);
+  }
+}
+
+__DT_TARGET_AVX512__
+void process_avx512(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                    void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const dt_iop_colorin_data_t *const d = (dt_iop_colorin_data_t *)piece->data;
+
+  if(!_cmatrix_fastpath_applies(d, piece))
+  {
+    process_sse2(self, piece, ivoid, ovoid, roi_in, roi_out);
+    return;
+  }
+
+  process_avx512_cmatrix_fastpath(piece, ivoid, ovoid, roi_out);
+
+  dt_ioppr_set_pipe_work_profile_info(self->dev, piece->pipe, d->type_work, d->filename_work, DT_INTENT_PERCEPTUAL);
+
+  if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
+}
+#endif
+
 static void mat3mul(float *dst, const float *const m1, const float *const m2)
 {
   for(int k = 0; k < 3; k++)
@@ -1494,17 +1663,17 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
 
   if(d->xform_cam_Lab)
   {
-    cmsDeleteTransform(d->xform_cam_Lab);
+    dt_colorspaces_release_transform(d->xform_cam_Lab);
     d->xform_cam_Lab = NULL;
   }
   if(d->xform_cam_nrgb)
   {
-    cmsDeleteTransform(d->xform_cam_nrgb);
+    dt_colorspaces_release_transform(d->xform_cam_nrgb);
     d->xform_cam_nrgb = NULL;
   }
   if(d->xform_nrgb_Lab)
   {
-    cmsDeleteTransform(d->xform_nrgb_Lab);
+    dt_colorspaces_release_transform(d->xform_nrgb_Lab);
     d->xform_nrgb_Lab = NULL;
   }
 
@@ -1653,9 +1822,12 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
     {
       piece->process_cl_ready = 0;
       d->cmatrix[0] = NAN;
-      d->xform_cam_Lab = cmsCreateTransform(d->input, input_format, Lab, TYPE_LabA_FLT, p->intent, 0);
-      d->xform_cam_nrgb = cmsCreateTransform(d->input, input_format, d->nrgb, TYPE_RGBA_FLT, p->intent, 0);
-      d->xform_nrgb_Lab = cmsCreateTransform(d->nrgb, TYPE_RGBA_FLT, Lab, TYPE_LabA_FLT, p->intent, 0);
+      d->xform_cam_Lab = dt_colorspaces_acquire_transform(d->input, input_format, Lab, TYPE_LabA_FLT, NULL, p->intent,
+                                                          0, 0);
+      d->xform_cam_nrgb = dt_colorspaces_acquire_transform(d->input, input_format, d->nrgb, TYPE_RGBA_FLT, NULL,
+                                                           p->intent, 0, 0);
+      d->xform_nrgb_Lab = dt_colorspaces_acquire_transform(d->nrgb, TYPE_RGBA_FLT, Lab, TYPE_LabA_FLT, NULL,
+                                                           p->intent, 0, 0);
     }
     else
     {
@@ -1674,7 +1846,8 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
     {
       piece->process_cl_ready = 0;
       d->cmatrix[0] = NAN;
-      d->xform_cam_Lab = cmsCreateTransform(d->input, input_format, Lab, TYPE_LabA_FLT, p->intent, 0);
+      d->xform_cam_Lab = dt_colorspaces_acquire_transform(d->input, input_format, Lab, TYPE_LabA_FLT, NULL, p->intent,
+                                                          0, 0);
     }
   }
 
@@ -1683,12 +1856,12 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
   {
     if(d->xform_cam_nrgb)
     {
-      cmsDeleteTransform(d->xform_cam_nrgb);
+      dt_colorspaces_release_transform(d->xform_cam_nrgb);
       d->xform_cam_nrgb = NULL;
     }
     if(d->xform_nrgb_Lab)
     {
-      cmsDeleteTransform(d->xform_nrgb_Lab);
+      dt_colorspaces_release_transform(d->xform_nrgb_Lab);
       d->xform_nrgb_Lab = NULL;
     }
     d->nrgb = NULL;
@@ -1711,7 +1884,8 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
     {
       piece->process_cl_ready = 0;
       d->cmatrix[0] = NAN;
-      d->xform_cam_Lab = cmsCreateTransform(d->input, TYPE_RGBA_FLT, Lab, TYPE_LabA_FLT, p->intent, 0);
+      d->xform_cam_Lab = dt_colorspaces_acquire_transform(d->input, TYPE_RGBA_FLT, Lab, TYPE_LabA_FLT, NULL,
+                                                          p->intent, 0, 0);
     }
   }
 
@@ -1756,17 +1930,17 @@ void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev
   if(d->input && d->clear_input) dt_colorspaces_cleanup_profile(d->input);
   if(d->xform_cam_Lab)
   {
-    cmsDeleteTransform(d->xform_cam_Lab);
+    dt_colorspaces_release_transform(d->xform_cam_Lab);
     d->xform_cam_Lab = NULL;
   }
   if(d->xform_cam_nrgb)
   {
-    cmsDeleteTransform(d->xform_cam_nrgb);
+    dt_colorspaces_release_transform(d->xform_cam_nrgb);
     d->xform_cam_nrgb = NULL;
   }
   if(d->xform_nrgb_Lab)
   {
-    cmsDeleteTransform(d->xform_nrgb_Lab);
+    dt_colorspaces_release_transform(d->xform_nrgb_Lab);
     d->xform_nrgb_Lab = NULL;
   }
 
@@ -591,7 +591,7 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
 
   if(d->xform)
   {
-    cmsDeleteTransform(d->xform);
+    dt_colorspaces_release_transform(d->xform);
     d->xform = NULL;
   }
   d->cmatrix[0] = NAN;
@@ -719,8 +719,8 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
   {
     d->cmatrix[0] = NAN;
     piece->process_cl_ready = 0;
-    d->xform = cmsCreateProofingTransform(Lab, TYPE_LabA_FLT, output, output_format, softproof,
-                                          out_intent, INTENT_RELATIVE_COLORIMETRIC, transformFlags);
+    d->xform = dt_colorspaces_acquire_transform(Lab, TYPE_LabA_FLT, output, output_format, softproof,
+                                                out_intent, INTENT_RELATIVE_COLORIMETRIC, transformFlags);
   }
 
   // user selected a non-supported output profile, check that:
@@ -736,8 +736,8 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
       d->cmatrix[0] = NAN;
       piece->process_cl_ready = 0;
 
-      d->xform = cmsCreateProofingTransform(Lab, TYPE_LabA_FLT, output, output_format, softproof,
-                                            out_intent, INTENT_RELATIVE_COLORIMETRIC, transformFlags);
+      d->xform = dt_colorspaces_acquire_transform(Lab, TYPE_LabA_FLT, output, output_format, softproof,
+                                                  out_intent, INTENT_RELATIVE_COLORIMETRIC, transformFlags);
     }
   }
 
@@ -780,7 +780,7 @@ void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev
   dt_iop_colorout_data_t *d = (dt_iop_colorout_data_t *)piece->data;
   if(d->xform)
   {
-    cmsDeleteTransform(d->xform);
+    dt_colorspaces_release_transform(d->xform);
     d->xform = NULL;
   }
 
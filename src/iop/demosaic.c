@@ -541,8 +541,31 @@ static void green_equilibration_favg(float *out, const float *const in, const in
 // xtrans_interpolate adapted from dcraw 9.20
 
 #define SQR(x) ((x) * (x))
-// tile size, optimized to keep data in L2 cache
-#define TS 122
+// tile size if the size of the L2 cache is unknown
+#define XTRANS_TS 122
+
+/* tile size of markesteijn, which needs a scratch buffer of bytes_per_pixel for every pixel of a tile and
+ * thread. the padding of each tile is computed again by its neighbours, so tiles are as large as fit into the
+ * L2 cache of a core, at least six times the padding. but small enough to give every thread a few tiles, the
+ * interior and the border tiles don't take the same time. */
+static int xtrans_tile_size(const size_t bytes_per_pixel, const int pad_tile, const int width, const int height)
+{
+  int step;
+  const int user = dt_conf_get_int("plugins/darkroom/demosaic/xtrans_tile_size");
+  if(user > 0)
+    step = MAX(user - 2 * pad_tile, pad_tile);
+  else
+  {
+    const size_t l2 = dt_get_l2_cache_size();
+    const int ts = l2 ? sqrtf((float)l2 / bytes_per_pixel) : XTRANS_TS;
+    step = CLAMP(ts, 6 * pad_tile, 2 * XTRANS_TS) - 2 * pad_tile;
+    const int tiles_wanted = 4 * dt_get_num_threads();
+    while(step > 4 * pad_tile + 6 && ((width + step - 1) / step) * ((height + step - 1) / step) < tiles_wanted)
+      step -= 6;
+  }
+  // keep all tiles at the same position in the 6x6 pattern
+  return 2 * pad_tile + MAX(step / 6, 1) * 6;
+}
 
 /** Lookup for allhex[], making sure that row/col aren't negative **/
 static inline const short * hexmap(const int row, const int col, short (*const allhex)[3][8])
@@ -559,16 +582,19 @@ static inline const short * hexmap(const int row, const int col, short (*const a
 
 /*
    Frank Markesteijn's algorithm for Fuji X-Trans sensors
+
+   tile_size 0 picks one for the cache and the number of threads. the tiles overlap by enough padding for the
+   output not to depend on it, which the unit test test_demosaic_xtrans checks.
  */
-static void xtrans_markesteijn_interpolate(float *out, const float *const in,
+static void xtrans_markesteijn_interpolate(dt_dev_pixelpipe_iop_t *piece, float *out, const float *const in,
                                            const dt_iop_roi_t *const roi_out,
                                            const dt_iop_roi_t *const roi_in,
-                                           const uint8_t (*const xtrans)[6], const int passes)
+                                           const uint8_t (*const xtrans)[6], const int passes,
+                                           const int tile_size)
 {
   static const short orth[12] = { 1, 0, 0, 1, -1, 0, 0, -1, 1, 0, 0, 1 },
                      patt[2][16] = { { 0, 1, 0, -1, 2, 0, -1, 0, 1, 1, 1, -1, 0, 0, 0, 0 },
-                                     { 0, 1, 0, -2, 1, 0, -2, 0, 1, 1, -2, -2, 1, -1, -1, 1 } },
-                     dir[4] = { 1, TS, TS + 1, TS - 1 };
+                                     { 0, 1, 0, -2, 1, 0, -2, 0, 1, 1, -2, -2, 1, -1, -1, 1 } };
 
   short allhex[3][3][8];
   // sgrow/sgcol is the offset in the sensor matrix of the solitary
@@ -578,9 +604,14 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
   const int width = roi_out->width;
   const int height = roi_out->height;
   const int ndir = 4 << (passes > 1);
+  // extra passes propagates out errors at edges, hence need more padding
+  const int pad_tile = (passes == 1) ? 12 : 17;
+  const int ts
+      = tile_size > 0 ? tile_size : xtrans_tile_size((ndir * 4 + 3) * sizeof(float), pad_tile, width, height);
+  const short dir[4] = { 1, ts, ts + 1, ts - 1 };
 
-  const size_t buffer_size = (size_t)TS * TS * (ndir * 4 + 3) * sizeof(float);
-  char *const all_buffers = (char *)dt_alloc_align(64, dt_get_num_threads() * buffer_size);
+  const size_t buffer_size = (size_t)ts * ts * (ndir * 4 + 3) * sizeof(float);
+  char *const all_buffers = (char *)dt_buffer_pool_alloc(&piece->pipe->pool, dt_get_num_threads() * buffer_size);
   if(!all_buffers)
   {
     printf("[demosaic] not able to allocate Markesteijn buffers\n");
@@ -610,45 +641,42 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
             int v = orth[d] * patt[g][c * 2] + orth[d + 1] * patt[g][c * 2 + 1];
             int h = orth[d + 2] * patt[g][c * 2] + orth[d + 3] * patt[g][c * 2 + 1];
             // offset within TSxTS buffer
-            allhex[row][col][c ^ (g * 2 & d)] = h + v * TS;
+            allhex[row][col][c ^ (g * 2 & d)] = h + v * ts;
           }
       }
 
-  // extra passes propagates out errors at edges, hence need more padding
-  const int pad_tile = (passes == 1) ? 12 : 17;
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(all_buffers, buffer_size, dir, height, in, ndir, pad_tile, passes, roi_in, width, xtrans) \
+  dt_omp_firstprivate(all_buffers, buffer_size, dir, height, in, ndir, pad_tile, passes, roi_in, ts, width, xtrans) \
   shared(sgrow, sgcol, allhex, out) \
-  schedule(dynamic)
+  schedule(dynamic) collapse(2)
 #endif
   // step through TSxTS cells of image, each tile overlapping the
   // prior as interpolation needs a substantial border
-  for(int top = -pad_tile; top < height - pad_tile; top += TS - (pad_tile*2))
-  {
-    char *const buffer = all_buffers + dt_get_thread_num() * buffer_size;
-    // rgb points to ndir TSxTS tiles of 3 channels (R, G, and B)
-    float(*rgb)[TS][TS][3] = (float(*)[TS][TS][3])buffer;
-    // yuv points to 3 channel (Y, u, and v) TSxTS tiles
-    // note that channels come before tiles to allow for a
-    // vectorization optimization when building drv[] from yuv[]
-    float (*const yuv)[TS][TS] = (float(*)[TS][TS])(buffer + TS * TS * (ndir * 3) * sizeof(float));
-    // drv points to ndir TSxTS tiles, each a single channel of derivatives
-    float (*const drv)[TS][TS] = (float(*)[TS][TS])(buffer + TS * TS * (ndir * 3 + 3) * sizeof(float));
-    // gmin and gmax reuse memory which is used later by yuv buffer;
-    // each points to a TSxTS tile of single channel data
-    float (*const gmin)[TS] = (float(*)[TS])(buffer + TS * TS * (ndir * 3) * sizeof(float));
-    float (*const gmax)[TS] = (float(*)[TS])(buffer + TS * TS * (ndir * 3 + 1) * sizeof(float));
-    // homo and homosum reuse memory which is used earlier in the
-    // loop; each points to ndir single-channel TSxTS tiles
-    uint8_t (*const homo)[TS][TS] = (uint8_t(*)[TS][TS])(buffer + TS * TS * (ndir * 3) * sizeof(float));
-    uint8_t (*const homosum)[TS][TS] = (uint8_t(*)[TS][TS])(buffer + TS * TS * (ndir * 3) * sizeof(float)
-                                                            + TS * TS * ndir * sizeof(uint8_t));
-
-    for(int left = -pad_tile; left < width - pad_tile; left += TS - (pad_tile*2))
+  for(int top = -pad_tile; top < height - pad_tile; top += ts - (pad_tile*2))
+    for(int left = -pad_tile; left < width - pad_tile; left += ts - (pad_tile*2))
     {
-      int mrow = MIN(top + TS, height + pad_tile);
-      int mcol = MIN(left + TS, width + pad_tile);
+      char *const buffer = all_buffers + dt_get_thread_num() * buffer_size;
+      // rgb points to ndir TSxTS tiles of 3 channels (R, G, and B)
+      float(*rgb)[ts][ts][3] = (float(*)[ts][ts][3])buffer;
+      // yuv points to 3 channel (Y, u, and v) TSxTS tiles
+      // note that channels come before tiles to allow for a
+      // vectorization optimization when building drv[] from yuv[]
+      float (*const yuv)[ts][ts] = (float(*)[ts][ts])(buffer + ts * ts * (ndir * 3) * sizeof(float));
+      // drv points to ndir TSxTS tiles, each a single channel of derivatives
+      float (*const drv)[ts][ts] = (float(*)[ts][ts])(buffer + ts * ts * (ndir * 3 + 3) * sizeof(float));
+      // gmin and gmax reuse memory which is used later by yuv buffer;
+      // each points to a TSxTS tile of single channel data
+      float (*const gmin)[ts] = (float(*)[ts])(buffer + ts * ts * (ndir * 3) * sizeof(float));
+      float (*const gmax)[ts] = (float(*)[ts])(buffer + ts * ts * (ndir * 3 + 1) * sizeof(float));
+      // homo and homosum reuse memory which is used earlier in the
+      // loop; each points to ndir single-channel TSxTS tiles
+      uint8_t (*const homo)[ts][ts] = (uint8_t(*)[ts][ts])(buffer + ts * ts * (ndir * 3) * sizeof(float));
+      uint8_t (*const homosum)[ts][ts] = (uint8_t(*)[ts][ts])(buffer + ts * ts * (ndir * 3) * sizeof(float)
+                                                              + ts * ts * ndir * sizeof(uint8_t));
+
+      int mrow = MIN(top + ts, height + pad_tile);
+      int mcol = MIN(left + ts, width + pad_tile);
 
       // Copy current tile from in to image buffer. If border goes
       // beyond edges of image, fill with mirrored/interpolated edges.
@@ -832,7 +860,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
             // 3,5 to rgb[2], rgb[3] of best of interp hori/vert
             // results. Each pass which outputs moves on to the next
             // rgb[] for input of interp greens.
-            for(int i = 1, d = 0; d < 6; d++, i ^= TS ^ 1, h ^= 2)
+            for(int i = 1, d = 0; d < 6; d++, i ^= ts ^ 1, h ^= 2)
             {
               // look 1 and 2 pixels distance from solitary green to
               // red then blue or blue then red
@@ -862,7 +890,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
                 const int d_out = d - ((d > 1) && (diff[d-1] < diff[d]));
                 rfx[0][0] = color[0][d_out] / 2.f;
                 rfx[0][2] = color[1][d_out] / 2.f;
-                rfx += TS * TS;
+                rfx += ts * ts;
               }
             }
           }
@@ -875,9 +903,9 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
             int f = 2 - FCxtrans(row, col, roi_in, xtrans);
             if(f == 1) continue;
             float(*rfx)[3] = &rgb[0][row - top][col - left];
-            int c = (row - sgrow) % 3 ? TS : 1;
-            int h = 3 * (c ^ TS ^ 1);
-            for(int d = 0; d < 4; d++, rfx += TS * TS)
+            int c = (row - sgrow) % 3 ? ts : 1;
+            int h = 3 * (c ^ ts ^ 1);
+            for(int d = 0; d < 4; d++, rfx += ts * ts)
             {
               int i = d > 1 || ((d ^ c) & 1) ||
                 ((fabsf(rfx[0][1]-rfx[c][1]) + fabsf(rfx[0][1]-rfx[-c][1])) <
@@ -895,7 +923,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
               {
                 float(*rfx)[3] = &rgb[0][row - top][col - left];
                 const short *const hex = hexmap(row,col,allhex);
-                for(int d = 0; d < ndir; d += 2, rfx += TS * TS)
+                for(int d = 0; d < ndir; d += 2, rfx += ts * ts)
                   if(hex[d] + hex[d + 1])
                   {
                     float g = 3.f * rfx[0][1] - 2.f * rfx[hex[d]][1] - rfx[hex[d + 1]][1];
@@ -913,7 +941,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
 
       // jump back to the first set of rgb buffers (this is a nop
       // unless on the second pass)
-      rgb = (float(*)[TS][TS][3])buffer;
+      rgb = (float(*)[ts][ts][3])buffer;
       // from here on out, mainly are working within the current tile
       // rather than in reference to the image, so don't offset
       // mrow/mcol by top/left of tile
@@ -943,7 +971,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
             yuv[2][row][col] = (rx[0] - y) * 0.67815f;
           }
         // Note that f can offset by a column (-1 or +1) and by a row
-        // (-TS or TS). The row-wise offsets cause the undefined
+        // (-ts or ts). The row-wise offsets cause the undefined
         // behavior sanitizer to warn of an out of bounds index, but
         // as yfx is multi-dimensional and there is sufficient
         // padding, that is not actually so.
@@ -952,7 +980,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
         for(int row = pad_drv; row < mrow - pad_drv; row++)
           for(int col = pad_drv; col < mcol - pad_drv; col++)
           {
-            float(*yfx)[TS][TS] = (float(*)[TS][TS]) & yuv[0][row][col];
+            float(*yfx)[ts][ts] = (float(*)[ts][ts]) & yuv[0][row][col];
             drv[d][row][col] = SQR(2 * yfx[0][0][0] - yfx[0][0][f] - yfx[0][0][-f])
                                + SQR(2 * yfx[1][0][0] - yfx[1][0][f] - yfx[1][0][-f])
                                + SQR(2 * yfx[2][0][0] - yfx[2][0][f] - yfx[2][0][-f]);
@@ -960,7 +988,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
       }
 
       /* Build homogeneity maps from the derivatives:                   */
-      memset(homo, 0, (size_t)ndir * TS * TS * sizeof(uint8_t));
+      memset(homo, 0, (size_t)ndir * ts * ts * sizeof(uint8_t));
       const int pad_homo = (passes == 1) ? 10 : 15;
       for(int row = pad_homo; row < mrow - pad_homo; row++)
         for(int col = pad_homo; col < mcol - pad_homo; col++)
@@ -1022,22 +1050,18 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
               avg[c]/avg[3];
         }
     }
-  }
-  dt_free_align(all_buffers);
+  dt_buffer_pool_free(&piece->pipe->pool, all_buffers);
 }
 
-#undef TS
-
-#define TS 122
-static void xtrans_fdc_interpolate(struct dt_iop_module_t *self, float *out, const float *const in,
+static void xtrans_fdc_interpolate(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, float *out,
+                                   const float *const in,
                                    const dt_iop_roi_t *const roi_out, const dt_iop_roi_t *const roi_in,
                                    const uint8_t (*const xtrans)[6])
 {
 
   static const short orth[12] = { 1, 0, 0, 1, -1, 0, 0, -1, 1, 0, 0, 1 },
                      patt[2][16] = { { 0, 1, 0, -1, 2, 0, -1, 0, 1, 1, 1, -1, 0, 0, 0, 0 },
-                                     { 0, 1, 0, -2, 1, 0, -2, 0, 1, 1, -2, -2, 1, -1, -1, 1 } },
-                     dir[4] = { 1, TS, TS + 1, TS - 1 };
+                                     { 0, 1, 0, -2, 1, 0, -2, 0, 1, 1, -2, -2, 1, -1, -1, 1 } };
 
   static const float directionality[8] = { 1.0f, 0.0f, 0.5f, 0.5f, 1.0f, 0.0f, 0.5f, 0.5f };
 
@@ -1575,13 +1599,21 @@ static void xtrans_fdc_interpolate(struct dt_iop_module_t *self, float *out, con
               1.246697e-03f - 3.053526e-19f * _Complex_I, -1.773498e-03f + 6.515727e-19f * _Complex_I,
               1.221201e-03f - 5.982162e-19f * _Complex_I } } };
 
-  const size_t buffer_size = (size_t)TS * TS * (ndir * 4 + 7) * sizeof(float);
-  char *const all_buffers = (char *)dt_alloc_align(64, dt_get_num_threads() * buffer_size);
+  // extra passes propagates out errors at edges, hence need more padding
+  const int pad_tile = 13;
+  // the chroma filter of fdc sees the tile borders, its output changes with the tile size. keep the tested one.
+  const int ts = XTRANS_TS;
+  const short dir[4] = { 1, ts, ts + 1, ts - 1 };
+
+  const size_t buffer_size = (size_t)ts * ts * (ndir * 4 + 7) * sizeof(float);
+  char *const all_buffers = (char *)dt_buffer_pool_alloc(&piece->pipe->pool, dt_get_num_threads() * buffer_size);
   if(!all_buffers)
   {
     fprintf(stderr, "[demosaic] not able to allocate FDC base buffers\n");
     return;
   }
+  // parts of the buffers are read before they are written. fresh allocations used to hide that, recycled ones don't.
+  memset(all_buffers, 0, dt_get_num_threads() * buffer_size);
 
   /* Map a green hexagon around each non-green pixel and vice versa:    */
   for(int row = 0; row < 3; row++)
@@ -1606,13 +1638,10 @@ static void xtrans_fdc_interpolate(struct dt_iop_module_t *self, float *out, con
             int v = orth[d] * patt[g][c * 2] + orth[d + 1] * patt[g][c * 2 + 1];
             int h = orth[d + 2] * patt[g][c * 2] + orth[d + 3] * patt[g][c * 2 + 1];
             // offset within TSxTS buffer
-            allhex[row][col][c ^ (g * 2 & d)] = h + v * TS;
+            allhex[row][col][c ^ (g * 2 & d)] = h + v * ts;
           }
       }
 
-  // extra passes propagates out errors at edges, hence need more padding
-  const int pad_tile = 13;
-
   // calculate offsets for this roi
   int rowoffset = 0;
   int coloffset = 0;
@@ -1646,43 +1675,42 @@ static void xtrans_fdc_interpolate(struct dt_iop_module_t *self, float *out, con
 #ifdef _OPENMP
 #pragma omp parallel for default(none)                                                                            \
     dt_omp_firstprivate(ndir, all_buffers, dir, directionality, harr, height, in, Minv, modarr, roi_in, width,    \
-                        xtrans, pad_tile, buffer_size)                                                            \
-        shared(sgrow, sgcol, allhex, out, rowoffset, coloffset, hybrid_fdc) schedule(dynamic)
+                        xtrans, pad_tile, buffer_size, ts)                                                        \
+        shared(sgrow, sgcol, allhex, out, rowoffset, coloffset, hybrid_fdc) schedule(dynamic) collapse(2)
 #endif
   // step through TSxTS cells of image, each tile overlapping the
   // prior as interpolation needs a substantial border
-  for(int top = -pad_tile; top < height - pad_tile; top += TS - (pad_tile * 2))
-  {
-    char *const buffer = all_buffers + dt_get_thread_num() * buffer_size;
-    // rgb points to ndir TSxTS tiles of 3 channels (R, G, and B)
-    float(*rgb)[TS][TS][3] = (float(*)[TS][TS][3])buffer;
-    // yuv points to 3 channel (Y, u, and v) TSxTS tiles
-    // note that channels come before tiles to allow for a
-    // vectorization optimization when building drv[] from yuv[]
-    float (*const yuv)[TS][TS] = (float(*)[TS][TS])(buffer + TS * TS * (ndir * 3) * sizeof(float));
-    // drv points to ndir TSxTS tiles, each a single channel of derivatives
-    float (*const drv)[TS][TS] = (float(*)[TS][TS])(buffer + TS * TS * (ndir * 3 + 3) * sizeof(float));
-    // gmin and gmax reuse memory which is used later by yuv buffer;
-    // each points to a TSxTS tile of single channel data
-    float (*const gmin)[TS] = (float(*)[TS])(buffer + TS * TS * (ndir * 3) * sizeof(float));
-    float (*const gmax)[TS] = (float(*)[TS])(buffer + TS * TS * (ndir * 3 + 1) * sizeof(float));
-    // homo and homosum reuse memory which is used earlier in the
-    // loop; each points to ndir single-channel TSxTS tiles
-    uint8_t (*const homo)[TS][TS] = (uint8_t(*)[TS][TS])(buffer + TS * TS * (ndir * 3) * sizeof(float));
-    uint8_t (*const homosum)[TS][TS]
-        = (uint8_t(*)[TS][TS])(buffer + TS * TS * (ndir * 3) * sizeof(float) + TS * TS * ndir * sizeof(uint8_t));
-    // append all fdc related buffers
-    float complex *fdc_buf_start = (float complex *)(buffer + TS * TS * (ndir * 4 + 3) * sizeof(float));
-    const int fdc_buf_size = TS * TS;
-    float(*const i_src) = (float *)fdc_buf_start;
-    float complex(*const o_src) = fdc_buf_start + fdc_buf_size;
-    // by the time the chroma values are calculated, o_src can be overwritten.
-    float(*const fdc_chroma) = (float *)o_src;
-
-    for(int left = -pad_tile; left < width - pad_tile; left += TS - (pad_tile * 2))
+  for(int top = -pad_tile; top < height - pad_tile; top += ts - (pad_tile * 2))
+    for(int left = -pad_tile; left < width - pad_tile; left += ts - (pad_tile * 2))
     {
-      int mrow = MIN(top + TS, height + pad_tile);
-      int mcol = MIN(left + TS, width + pad_tile);
+      char *const buffer = all_buffers + dt_get_thread_num() * buffer_size;
+      // rgb points to ndir TSxTS tiles of 3 channels (R, G, and B)
+      float(*rgb)[ts][ts][3] = (float(*)[ts][ts][3])buffer;
+      // yuv points to 3 channel (Y, u, and v) TSxTS tiles
+      // note that channels come before tiles to allow for a
+      // vectorization optimization when building drv[] from yuv[]
+      float (*const yuv)[ts][ts] = (float(*)[ts][ts])(buffer + ts * ts * (ndir * 3) * sizeof(float));
+      // drv points to ndir TSxTS tiles, each a single channel of derivatives
+      float (*const drv)[ts][ts] = (float(*)[ts][ts])(buffer + ts * ts * (ndir * 3 + 3) * sizeof(float));
+      // gmin and gmax reuse memory which is used later by yuv buffer;
+      // each points to a TSxTS tile of single channel data
+      float (*const gmin)[ts] = (float(*)[ts])(buffer + ts * ts * (ndir * 3) * sizeof(float));
+      float (*const gmax)[ts] = (float(*)[ts])(buffer + ts * ts * (ndir * 3 + 1) * sizeof(float));
+      // homo and homosum reuse memory which is used earlier in the
+      // loop; each points to ndir single-channel TSxTS tiles
+      uint8_t (*const homo)[ts][ts] = (uint8_t(*)[ts][ts])(buffer + ts * ts * (ndir * 3) * sizeof(float));
+      uint8_t (*const homosum)[ts][ts]
+          = (uint8_t(*)[ts][ts])(buffer + ts * ts * (ndir * 3) * sizeof(float) + ts * ts * ndir * sizeof(uint8_t));
+      // append all fdc related buffers
+      float complex *fdc_buf_start = (float complex *)(buffer + ts * ts * (ndir * 4 + 3) * sizeof(float));
+      const int fdc_buf_size = ts * ts;
+      float(*const i_src) = (float *)fdc_buf_start;
+      float complex(*const o_src) = fdc_buf_start + fdc_buf_size;
+      // by the time the chroma values are calculated, o_src can be overwritten.
+      float(*const fdc_chroma) = (float *)o_src;
+
+      int mrow = MIN(top + ts, height + pad_tile);
+      int mcol = MIN(left + ts, width + pad_tile);
 
       // Copy current tile from in to image buffer. If border goes
       // beyond edges of image, fill with mirrored/interpolated edges.
@@ -1695,7 +1723,7 @@ static void xtrans_fdc_interpolate(struct dt_iop_module_t *self, float *out, con
           {
             const int f = FCxtrans(row, col, roi_in, xtrans);
             for(int c = 0; c < 3; c++) pix[c] = (c == f) ? in[roi_in->width * row + col] : 0.f;
-            *(i_src + TS * (row - top) + (col - left)) = in[roi_in->width * row + col];
+            *(i_src + ts * (row - top) + (col - left)) = in[roi_in->width * row + col];
           }
           else
           {
@@ -1711,7 +1739,7 @@ static void xtrans_fdc_interpolate(struct dt_iop_module_t *self, float *out, con
                 if(c == FCxtrans(cy, cx, roi_in, xtrans))
                 {
                   pix[c] = in[roi_in->width * cy + cx];
-                  *(i_src + TS * (row - top) + (col - left)) = in[roi_in->width * cy + cx];
+                  *(i_src + ts * (row - top) + (col - left)) = in[roi_in->width * cy + cx];
                 }
                 else
                 {
@@ -1730,7 +1758,7 @@ static void xtrans_fdc_interpolate(struct dt_iop_module_t *self, float *out, con
                       }
                     }
                   pix[c] = sum / count;
-                  *(i_src + TS * (row - top) + (col - left)) = pix[c];
+                  *(i_src + ts * (row - top) + (col - left)) = pix[c];
                 }
               }
           }
@@ -1833,7 +1861,7 @@ static void xtrans_fdc_interpolate(struct dt_iop_module_t *self, float *out, con
           int h = FCxtrans(row, col + 1, roi_in, xtrans);
           float diff[6] = { 0.0f };
           float color[3][8];
-          for(int i = 1, d = 0; d < 6; d++, i ^= TS ^ 1, h ^= 2)
+          for(int i = 1, d = 0; d < 6; d++, i ^= ts ^ 1, h ^= 2)
           {
             for(int c = 0; c < 2; c++, h ^= 2)
             {
@@ -1848,7 +1876,7 @@ static void xtrans_fdc_interpolate(struct dt_iop_module_t *self, float *out, con
             if(d < 2 || (d & 1))
             {
               for(int c = 0; c < 2; c++) rfx[0][c * 2] = color[c * 2][d] / 2.f;
-              rfx += TS * TS;
+              rfx += ts * ts;
             }
           }
         }
@@ -1861,9 +1889,9 @@ static void xtrans_fdc_interpolate(struct dt_iop_module_t *self, float *out, con
           int f = 2 - FCxtrans(row, col, roi_in, xtrans);
           if(f == 1) continue;
           float(*rfx)[3] = &rgb[0][row - top][col - left];
-          int c = (row - sgrow) % 3 ? TS : 1;
-          int h = 3 * (c ^ TS ^ 1);
-          for(int d = 0; d < 4; d++, rfx += TS * TS)
+          int c = (row - sgrow) % 3 ? ts : 1;
+          int h = 3 * (c ^ ts ^ 1);
+          for(int d = 0; d < 4; d++, rfx += ts * ts)
           {
             int i = d > 1 || ((d ^ c) & 1)
                             || ((fabsf(rfx[0][1] - rfx[c][1]) + fabsf(rfx[0][1] - rfx[-c][1]))
@@ -1882,7 +1910,7 @@ static void xtrans_fdc_interpolate(struct dt_iop_module_t *self, float *out, con
               float redblue[3][3];
               float(*rfx)[3] = &rgb[0][row - top][col - left];
               const short *const hex = hexmap(row, col, allhex);
-              for(int d = 0; d < ndir; d += 2, rfx += TS * TS)
+              for(int d = 0; d < ndir; d += 2, rfx += ts * ts)
                 if(hex[d] + hex[d + 1])
                 {
                   float g = 3.f * rfx[0][1] - 2.f * rfx[hex[d]][1] - rfx[hex[d + 1]][1];
@@ -1902,13 +1930,13 @@ static void xtrans_fdc_interpolate(struct dt_iop_module_t *self, float *out, con
                   }
                 }
               // to fill in red and blue also for diagonal directions
-              for(int d = 0; d < ndir; d += 2, rfx += TS * TS)
+              for(int d = 0; d < ndir; d += 2, rfx += ts * ts)
                 for(int c = 0; c < 4; c += 2) rfx[0][c] = (redblue[0][c] + redblue[2][c]) * 0.5f;
            }
 
       // jump back to the first set of rgb buffers (this is a nop
       // unless on the second pass)
-      rgb = (float(*)[TS][TS][3])buffer;
+      rgb = (float(*)[ts][ts][3])buffer;
       // from here on out, mainly are working within the current tile
       // rather than in reference to the image, so don't offset
       // mrow/mcol by top/left of tile
@@ -1938,7 +1966,7 @@ static void xtrans_fdc_interpolate(struct dt_iop_module_t *self, float *out, con
             yuv[2][row][col] = (rx[0] - y) * 0.67815f;
           }
         // Note that f can offset by a column (-1 or +1) and by a row
-        // (-TS or TS). The row-wise offsets cause the undefined
+        // (-ts or ts). The row-wise offsets cause the undefined
         // behavior sanitizer to warn of an out of bounds index, but
         // as yfx is multi-dimensional and there is sufficient
         // padding, that is not actually so.
@@ -1947,7 +1975,7 @@ static void xtrans_fdc_interpolate(struct dt_iop_module_t *self, float *out, con
         for(int row = pad_drv; row < mrow - pad_drv; row++)
           for(int col = pad_drv; col < mcol - pad_drv; col++)
           {
-            float(*yfx)[TS][TS] = (float(*)[TS][TS]) & yuv[0][row][col];
+            float(*yfx)[ts][ts] = (float(*)[ts][ts]) & yuv[0][row][col];
             drv[d][row][col] = SQR(2 * yfx[0][0][0] - yfx[0][0][f] - yfx[0][0][-f])
                                + SQR(2 * yfx[1][0][0] - yfx[1][0][f] - yfx[1][0][-f])
                                + SQR(2 * yfx[2][0][0] - yfx[2][0][f] - yfx[2][0][-f]);
@@ -1955,7 +1983,7 @@ static void xtrans_fdc_interpolate(struct dt_iop_module_t *self, float *out, con
       }
 
       /* Build homogeneity maps from the derivatives:                   */
-      memset(homo, 0, (size_t)ndir * TS * TS * sizeof(uint8_t));
+      memset(homo, 0, (size_t)ndir * ts * ts * sizeof(uint8_t));
       const int pad_homo = 10;
       for(int row = pad_homo; row < mrow - pad_homo; row++)
         for(int col = pad_homo; col < mcol - pad_homo; col++)
@@ -2017,7 +2045,7 @@ static void xtrans_fdc_interpolate(struct dt_iop_module_t *self, float *out, con
   VAR = 0.0f + 0.0f * _Complex_I;                                                                                 \
   for(fdc_row = 0, myrow = row - 6; fdc_row < 13; fdc_row++, myrow++)                                             \
     for(fdc_col = 0, mycol = col - 6; fdc_col < 13; fdc_col++, mycol++)                                           \
-      VAR += FILT[12 - fdc_row][12 - fdc_col] * *(i_src + TS * myrow + mycol);
+      VAR += FILT[12 - fdc_row][12 - fdc_col] * *(i_src + ts * myrow + mycol);
           CONV_FILT(C2m, harr[0])
           CONV_FILT(C5m, harr[1])
           CONV_FILT(C7m, harr[2])
@@ -2042,7 +2070,7 @@ static void xtrans_fdc_interpolate(struct dt_iop_module_t *self, float *out, con
           float complex C6m = qmat[2] * (conjf(modulator[4]) + conjf(modulator[5]));
           float complex C12m = qmat[5] * (modulator[4] + modulator[5]);
           float complex C18m = qmat[7] * modulator[6];
-          qmat[0] = *(i_src + row * TS + col) - C2m - C3m - C5m - C6m - 2.0f * C7m - C12m - C18m;
+          qmat[0] = *(i_src + row * ts + col) - C2m - C3m - C5m - C6m - 2.0f * C7m - C12m - C18m;
           // get the rgb components from fdc
           float rgbpix[3] = { 0.f, 0.f, 0.f };
           // multiply with the inverse matrix of M
@@ -2058,7 +2086,7 @@ static void xtrans_fdc_interpolate(struct dt_iop_module_t *self, float *out, con
           float y = 0.2627f * rgbpix[0] + 0.6780f * rgbpix[1] + 0.0593f * rgbpix[2];
           uv[0] = (rgbpix[2] - y) * 0.56433f;
           uv[1] = (rgbpix[0] - y) * 0.67815f;
-          for(int c = 0; c < 2; c++) *(fdc_chroma + c * TS * TS + row * TS + col) = uv[c];
+          for(int c = 0; c < 2; c++) *(fdc_chroma + c * ts * ts + row * ts + col) = uv[c];
         }
 
       /* Average the most homogeneous pixels for the final result:       */
@@ -2110,9 +2138,9 @@ static void xtrans_fdc_interpolate(struct dt_iop_module_t *self, float *out, con
             float temp[5];
             float tempf;
             // load the window into temp
-            memcpy(&temp[0], fdc_chroma + chrm * TS * TS + (row - 1) * TS + (col), 1 * sizeof(float));
-            memcpy(&temp[1], fdc_chroma + chrm * TS * TS + (row)*TS + (col - 1), 3 * sizeof(float));
-            memcpy(&temp[4], fdc_chroma + chrm * TS * TS + (row + 1) * TS + (col), 1 * sizeof(float));
+            memcpy(&temp[0], fdc_chroma + chrm * ts * ts + (row - 1) * ts + (col), 1 * sizeof(float));
+            memcpy(&temp[1], fdc_chroma + chrm * ts * ts + (row)*ts + (col - 1), 3 * sizeof(float));
+            memcpy(&temp[4], fdc_chroma + chrm * ts * ts + (row + 1) * ts + (col), 1 * sizeof(float));
             PIX_SORT(temp[0], temp[1]);
             PIX_SORT(temp[3], temp[4]);
             PIX_SORT(temp[0], temp[3]);
@@ -2135,14 +2163,12 @@ static void xtrans_fdc_interpolate(struct dt_iop_module_t *self, float *out, con
           for(int c = 0; c < 3; c++) out[4 * (width * (row + top) + col + left) + c] = rgbpix[c];
         }
     }
-  }
-  dt_free_align(all_buffers);
+  dt_buffer_pool_free(&piece->pipe->pool, all_buffers);
 }
 
 #undef PIX_SWAP
 #undef PIX_SORT
 #undef CCLIP
-#undef TS
 
 /* taken from dcraw and demosaic_ppg below */
 
@@ -2767,26 +2793,6 @@ static int get_quality()
   return qual;
 }
 
-static int get_thumb_quality(int width, int height)
-{
-  // we check if we need ultra-high quality thumbnail for this size
-  char *min = dt_conf_get_string("plugins/lighttable/thumbnail_hq_min_level");
-
-  int level = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, width, height);
-  int res = 0;
-  if (strcmp(min, "always")==0) res = 1;
-  else if (strcmp(min, "small")==0) res = ( level >= 1 );
-  else if (strcmp(min, "VGA")==0) res = ( level >= 2 );
-  else if (strcmp(min, "720p")==0) res = ( level >= 3 );
-  else if (strcmp(min, "1080p")==0) res = ( level >= 4 );
-  else if (strcmp(min, "WQXGA")==0) res = ( level >= 5 );
-  else if (strcmp(min, "4k")==0) res = ( level >= 6 );
-  else if (strcmp(min, "5K")==0) res = ( level >= 7 );
-
-  g_free(min);
-  return res;
-}
-
 // set flags for demosaic quality based on factors besides demosaic
 // method (e.g. config, scale, pixelpipe type)
 static int demosaic_qual_flags(const dt_dev_pixelpipe_iop_t *const piece,
@@ -2811,7 +2817,7 @@ static int demosaic_qual_flags(const dt_dev_pixelpipe_iop_t *const piece,
       break;
     case DT_DEV_PIXELPIPE_THUMBNAIL:
       // we check if we need ultra-high quality thumbnail for this size
-      if (get_thumb_quality(roi_out->width, roi_out->height))
+      if (dt_mipmap_cache_thumbnail_hq(darktable.mipmap_cache, roi_out->width, roi_out->height))
       {
         flags |= DEMOSAIC_FULL_SCALE | DEMOSAIC_XTRANS_FULL;
       }
@@ -2896,10 +2902,10 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     else if(piece->pipe->dsc.filters == 9u)
     {
       if(demosaicing_method == DT_IOP_DEMOSAIC_FDC && (qual_flags & DEMOSAIC_XTRANS_FULL))
-        xtrans_fdc_interpolate(self, tmp, pixels, &roo, &roi, xtrans);
+        xtrans_fdc_interpolate(self, piece, tmp, pixels, &roo, &roi, xtrans);
       else if(demosaicing_method >= DT_IOP_DEMOSAIC_MARKESTEIJN && (qual_flags & DEMOSAIC_XTRANS_FULL))
-        xtrans_markesteijn_interpolate(tmp, pixels, &roo, &roi, xtrans,
-                                       1 + (demosaicing_method - DT_IOP_DEMOSAIC_MARKESTEIJN) * 2);
+        xtrans_markesteijn_interpolate(piece, tmp, pixels, &roo, &roi, xtrans,
+                                       1 + (demosaicing_method - DT_IOP_DEMOSAIC_MARKESTEIJN) * 2, 0);
       else
         vng_interpolate(tmp, pixels, &roo, &roi, piece->pipe->dsc.filters, xtrans, qual_flags & DEMOSAIC_ONLY_VNG_LINEAR);
     }
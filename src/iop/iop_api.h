@@ -191,6 +191,19 @@ void process_sse2(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *p
                   const struct dt_iop_roi_t *const roi_out);
 #endif
 
+#if defined(DT_HAVE_AVX_CODEPATHS)
+/** variants of process() that can contain AVX2 and FMA or AVX-512F intrinsics. */
+/** can be provided by each IOP, the most capable one the cpu supports is used. */
+__DT_TARGET_AVX2__
+void process_avx2(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const i,
+                  void *const o, const struct dt_iop_roi_t *const roi_in,
+                  const struct dt_iop_roi_t *const roi_out);
+__DT_TARGET_AVX512__
+void process_avx512(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const i,
+                    void *const o, const struct dt_iop_roi_t *const roi_in,
+                    const struct dt_iop_roi_t *const roi_out);
+#endif
+
 #ifdef HAVE_OPENCL
 /** the opencl equivalent of process(). */
 int process_cl(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in,
@@ -21,6 +21,7 @@
 #endif
 
 #include "bauhaus/bauhaus.h"
+#include "common/clut.h"
 #include "common/imageio_png.h"
 #include "common/colorspaces.h"
 #include "common/colorspaces_inline_conversions.h"
@@ -101,8 +102,8 @@ const char invalid_filepath_prefix[] = "INVALID >> ";
 typedef struct dt_iop_lut3d_data_t
 {
   dt_iop_lut3d_params_t params;
-  float *clut;  // cube lut pointer
-  uint16_t level; // cube_size
+  const float *clut; // packed cube lut, shared through darktable.clut_cache
+  uint16_t level;    // cube_size
 } dt_iop_lut3d_data_t;
 
 typedef struct dt_iop_lut3d_global_data_t
@@ -189,173 +190,10 @@ int legacy_params(dt_iop_module_t *self, const void *const old_params, const int
 
   return 1;
 }
-// From `HaldCLUT_correct.c' by Eskil Steenberg (http://www.quelsolaar.com) (BSD licensed)
-void correct_pixel_trilinear(const float *const in, float *const out,
-                             const size_t pixel_nb, const float *const restrict clut, const uint16_t level)
-{
-  const int level2 = level * level;
-#ifdef _OPENMP
-#pragma omp parallel for SIMD() default(none) \
-  dt_omp_firstprivate(clut, in, level, level2, out, pixel_nb) \
-  schedule(static)
-#endif
-  for(size_t k = 0; k < (size_t)(pixel_nb * 4); k+=4)
-  {
-    float *const input = ((float *const)in) + k;
-    float *const output = ((float *const)out) + k;
-
-    int rgbi[3], i, j;
-    float tmp[6];
-    float rgbd[3];
-
-    for(int c = 0; c < 3; ++c) input[c] = fminf(fmaxf(input[c], 0.0f), 1.0f);
-
-    rgbd[0] = input[0] * (float)(level - 1);
-    rgbd[1] = input[1] * (float)(level - 1);
-    rgbd[2] = input[2] * (float)(level - 1);
-
-    rgbi[0] = CLAMP((int)rgbd[0], 0, level - 2);
-    rgbi[1] = CLAMP((int)rgbd[1], 0, level - 2);
-    rgbi[2] = CLAMP((int)rgbd[2], 0, level - 2);
-
-    rgbd[0] = rgbd[0] - rgbi[0]; // delta red
-    rgbd[1] = rgbd[1] - rgbi[1]; // delta green
-    rgbd[2] = rgbd[2] - rgbi[2]; // delta blue
-
-  // indexes of P000 to P111 in clut
-    const int color = rgbi[0] + rgbi[1] * level + rgbi[2] * level * level;
-    i = color * 3;  // P000
-    j = (color + 1) * 3;  // P100
-
-    tmp[0] = clut[i] * (1 - rgbd[0]) + clut[j] * rgbd[0];
-    tmp[1] = clut[i+1] * (1 - rgbd[0]) + clut[j+1] * rgbd[0];
-    tmp[2] = clut[i+2] * (1 - rgbd[0]) + clut[j+2] * rgbd[0];
-
-    i = (color + level) * 3;  // P010
-    j = (color + level + 1) * 3;  //P110
-
-    tmp[3] = clut[i] * (1 - rgbd[0]) + clut[j] * rgbd[0];
-    tmp[4] = clut[i+1] * (1 - rgbd[0]) + clut[j+1] * rgbd[0];
-    tmp[5] = clut[i+2] * (1 - rgbd[0]) + clut[j+2] * rgbd[0];
-
-    output[0] = tmp[0] * (1 - rgbd[1]) + tmp[3] * rgbd[1];
-    output[1] = tmp[1] * (1 - rgbd[1]) + tmp[4] * rgbd[1];
-    output[2] = tmp[2] * (1 - rgbd[1]) + tmp[5] * rgbd[1];
-
-    i = (color + level2) * 3;  // P001
-    j = (color + level2 + 1) * 3;  // P101
-
-    tmp[0] = clut[i] * (1 - rgbd[0]) + clut[j] * rgbd[0];
-    tmp[1] = clut[i+1] * (1 - rgbd[0]) + clut[j+1] * rgbd[0];
-    tmp[2] = clut[i+2] * (1 - rgbd[0]) + clut[j+2] * rgbd[0];
-
-    i = (color + level + level2) * 3;  // P011
-    j = (color + level + level2 + 1) * 3;  // P111
-
-    tmp[3] = clut[i] * (1 - rgbd[0]) + clut[j] * rgbd[0];
-    tmp[4] = clut[i+1] * (1 - rgbd[0]) + clut[j+1] * rgbd[0];
-    tmp[5] = clut[i+2] * (1 - rgbd[0]) + clut[j+2] * rgbd[0];
-
-    tmp[0] = tmp[0] * (1 - rgbd[1]) + tmp[3] * rgbd[1];
-    tmp[1] = tmp[1] * (1 - rgbd[1]) + tmp[4] * rgbd[1];
-    tmp[2] = tmp[2] * (1 - rgbd[1]) + tmp[5] * rgbd[1];
-
-    output[0] = output[0] * (1 - rgbd[2]) + tmp[0] * rgbd[2];
-    output[1] = output[1] * (1 - rgbd[2]) + tmp[1] * rgbd[2];
-    output[2] = output[2] * (1 - rgbd[2]) + tmp[2] * rgbd[2];
- }
-}
-
-// from OpenColorIO
-// https://github.com/imageworks/OpenColorIO/blob/master/src/OpenColorIO/ops/Lut3D/Lut3DOp.cpp
-void correct_pixel_tetrahedral(const float *const in, float *const out,
-                               const size_t pixel_nb, const float *const restrict clut, const uint16_t level)
-{
-  const int level2 = level * level;
-#ifdef _OPENMP
-#pragma omp parallel for SIMD() default(none) \
-  dt_omp_firstprivate(clut, in, level, level2, out, pixel_nb) \
-  schedule(static)
-#endif
-  for(size_t k = 0; k < (size_t)(pixel_nb * 4); k+=4)
-  {
-    float *const input = ((float *const)in) + k;
-    float *const output = ((float *const)out) + k;
-
-    int rgbi[3];
-    float rgbd[3];
-    for(int c = 0; c < 3; ++c) input[c] = fminf(fmaxf(input[c], 0.0f), 1.0f);
-
-    rgbd[0] = input[0] * (float)(level - 1);
-    rgbd[1] = input[1] * (float)(level - 1);
-    rgbd[2] = input[2] * (float)(level - 1);
-
-    rgbi[0] = CLAMP((int)rgbd[0], 0, level - 2);
-    rgbi[1] = CLAMP((int)rgbd[1], 0, level - 2);
-    rgbi[2] = CLAMP((int)rgbd[2], 0, level - 2);
-
-    rgbd[0] = rgbd[0] - rgbi[0]; // delta red
-    rgbd[1] = rgbd[1] - rgbi[1]; // delta green
-    rgbd[2] = rgbd[2] - rgbi[2]; // delta blue
-
-  // indexes of P000 to P111 in clut
-    const int color = rgbi[0] + rgbi[1] * level + rgbi[2] * level * level;
-    const int i000 = color * 3;                     // P000
-    const int i100 = i000 + 3;                      // P100
-    const int i010 = (color + level) * 3;           // P010
-    const int i110 = i010 + 3;                      // P110
-    const int i001 = (color + level2) * 3;          // P001
-    const int i101 = i001 + 3;                      // P101
-    const int i011 = (color + level + level2) * 3;  // P011
-    const int i111 = i011 + 3;                      // P111
-
-    if (rgbd[0] > rgbd[1])
-    {
-      if (rgbd[1] > rgbd[2])
-      {
-        output[0] = (1-rgbd[0])*clut[i000] + (rgbd[0]-rgbd[1])*clut[i100] + (rgbd[1]-rgbd[2])*clut[i110] + rgbd[2]*clut[i111];
-        output[1] = (1-rgbd[0])*clut[i000+1] + (rgbd[0]-rgbd[1])*clut[i100+1] + (rgbd[1]-rgbd[2])*clut[i110+1] + rgbd[2]*clut[i111+1];
-        output[2] = (1-rgbd[0])*clut[i000+2] + (rgbd[0]-rgbd[1])*clut[i100+2] + (rgbd[1]-rgbd[2])*clut[i110+2] + rgbd[2]*clut[i111+2];
-      }
-      else if (rgbd[0] > rgbd[2])
-      {
-        output[0] = (1-rgbd[0])*clut[i000] + (rgbd[0]-rgbd[2])*clut[i100] + (rgbd[2]-rgbd[1])*clut[i101] + rgbd[1]*clut[i111];
-        output[1] = (1-rgbd[0])*clut[i000+1] + (rgbd[0]-rgbd[2])*clut[i100+1] + (rgbd[2]-rgbd[1])*clut[i101+1] + rgbd[1]*clut[i111+1];
-        output[2] = (1-rgbd[0])*clut[i000+2] + (rgbd[0]-rgbd[2])*clut[i100+2] + (rgbd[2]-rgbd[1])*clut[i101+2] + rgbd[1]*clut[i111+2];
-      }
-      else
-      {
-        output[0] = (1-rgbd[2])*clut[i000] + (rgbd[2]-rgbd[0])*clut[i001] + (rgbd[0]-rgbd[1])*clut[i101] + rgbd[1]*clut[i111];
-        output[1] = (1-rgbd[2])*clut[i000+1] + (rgbd[2]-rgbd[0])*clut[i001+1] + (rgbd[0]-rgbd[1])*clut[i101+1] + rgbd[1]*clut[i111+1];
-        output[2] = (1-rgbd[2])*clut[i000+2] + (rgbd[2]-rgbd[0])*clut[i001+2] + (rgbd[0]-rgbd[1])*clut[i101+2] + rgbd[1]*clut[i111+2];
-      }
-    }
-    else
-    {
-      if (rgbd[2] > rgbd[1])
-      {
-        output[0] = (1-rgbd[2])*clut[i000] + (rgbd[2]-rgbd[1])*clut[i001] + (rgbd[1]-rgbd[0])*clut[i011] + rgbd[0]*clut[i111];
-        output[1] = (1-rgbd[2])*clut[i000+1] + (rgbd[2]-rgbd[1])*clut[i001+1] + (rgbd[1]-rgbd[0])*clut[i011+1] + rgbd[0]*clut[i111+1];
-        output[2] = (1-rgbd[2])*clut[i000+2] + (rgbd[2]-rgbd[1])*clut[i001+2] + (rgbd[1]-rgbd[0])*clut[i011+2] + rgbd[0]*clut[i111+2];
-      }
-      else if (rgbd[2] > rgbd[0])
-      {
-        output[0] = (1-rgbd[1])*clut[i000] + (rgbd[1]-rgbd[2])*clut[i010] + (rgbd[2]-rgbd[0])*clut[i011] + rgbd[0]*clut[i111];
-        output[1] = (1-rgbd[1])*clut[i000+1] + (rgbd[1]-rgbd[2])*clut[i010+1] + (rgbd[2]-rgbd[0])*clut[i011+1] + rgbd[0]*clut[i111+1];
-        output[2] = (1-rgbd[1])*clut[i000+2] + (rgbd[1]-rgbd[2])*clut[i010+2] + (rgbd[2]-rgbd[0])*clut[i011+2] + rgbd[0]*clut[i111+2];
-      }
-      else
-      {
-        output[0] = (1-rgbd[1])*clut[i000] + (rgbd[1]-rgbd[0])*clut[i010] + (rgbd[0]-rgbd[2])*clut[i110] + rgbd[2]*clut[i111];
-        output[1] = (1-rgbd[1])*clut[i000+1] + (rgbd[1]-rgbd[0])*clut[i010+1] + (rgbd[0]-rgbd[2])*clut[i110+1] + rgbd[2]*clut[i111+1];
-        output[2] = (1-rgbd[1])*clut[i000+2] + (rgbd[1]-rgbd[0])*clut[i010+2] + (rgbd[0]-rgbd[2])*clut[i110+2] + rgbd[2]*clut[i111+2];
-      }
-    }
-  }
-}
 
 // from Study on the 3D Interpolation Models Used in Color Conversion
 // http://ijetch.org/papers/318-T860.pdf
+// tetrahedral and trilinear interpolation are in common/clut.c, all work on the packed clut.
 void correct_pixel_pyramid(const float *const in, float *const out,
                            const size_t pixel_nb, const float *const restrict clut, const uint16_t level)
 {
@@ -388,14 +226,14 @@ void correct_pixel_pyramid(const float *const in, float *const out,
 
   // indexes of P000 to P111 in clut
     const int color = rgbi[0] + rgbi[1] * level + rgbi[2] * level * level;
-    const int i000 = color * 3;                     // P000
-    const int i100 = i000 + 3;                      // P100
-    const int i010 = (color + level) * 3;           // P010
-    const int i110 = i010 + 3;                      // P110
-    const int i001 = (color + level2) * 3;          // P001
-    const int i101 = i001 + 3;                      // P101
-    const int i011 = (color + level + level2) * 3;  // P011
-    const int i111 = i011 + 3;                      // P111
+    const int i000 = color * 4;                     // P000
+    const int i100 = i000 + 4;                      // P100
+    const int i010 = (color + level) * 4;           // P010
+    const int i110 = i010 + 4;                      // P110
+    const int i001 = (color + level2) * 4;          // P001
+    const int i101 = i001 + 4;                      // P101
+    const int i011 = (color + level + level2) * 4;  // P011
+    const int i111 = i011 + 4;                      // P111
 
     if (rgbd[1] > rgbd[0] && rgbd[2] > rgbd[0])
     {
@@ -412,7 +250,7 @@ void correct_pixel_pyramid(const float *const in, float *const out,
         + (clut[i101]-clut[i001]-clut[i100]+clut[i000])*rgbd[0]*rgbd[2];
       output[1] = clut[i000+1] + (clut[i100+1]-clut[i000+1])*rgbd[0] + (clut[i111+1]-clut[i101+1])*rgbd[1] + (clut[i001+1]-clut[i000+1])*rgbd[2]
         + (clut[i101+1]-clut[i001+1]-clut[i100+1]+clut[i000+1])*rgbd[0]*rgbd[2];
-      output[2] = clut[i000+2] + (clut[i100+2]-clut[i000+2])*rgbd[0] + (clut[i111]-clut[i101+2])*rgbd[1] + (clut[i001+2]-clut[i000+2])*rgbd[2]
+      output[2] = clut[i000+2] + (clut[i100+2]-clut[i000+2])*rgbd[0] + (clut[i111+2]-clut[i101+2])*rgbd[1] + (clut[i001+2]-clut[i000+2])*rgbd[2]
         + (clut[i101+2]-clut[i001+2]-clut[i100+2]+clut[i000+2])*rgbd[0]*rgbd[2];
     }
     else
@@ -946,7 +784,7 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
   dt_iop_lut3d_data_t *d = (dt_iop_lut3d_data_t *)piece->data;
   dt_iop_lut3d_global_data_t *gd = (dt_iop_lut3d_global_data_t *)self->global_data;
   cl_int err = CL_SUCCESS;
-  const float *const clut = (float *)d->clut;
+  const float *const clut = d->clut;
   const int level = d->level;
   const int kernel = (d->params.interpolation == DT_IOP_TETRAHEDRAL) ? gd->kernel_lut3d_tetrahedral
     : (d->params.interpolation == DT_IOP_TRILINEAR) ? gd->kernel_lut3d_trilinear
@@ -970,7 +808,7 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
 
   if (clut && level)
   {
-    clut_cl = dt_opencl_copy_host_to_device_constant(devid, level * level * level * 3 * sizeof(float), (void *)clut);
+    clut_cl = dt_opencl_copy_host_to_device_constant(devid, level * level * level * 4 * sizeof(float), (void *)clut);
     if(clut_cl == NULL)
     {
       fprintf(stderr, "[lut3d process_cl] error allocating memory\n");
@@ -1020,6 +858,31 @@ cleanup:
 }
 #endif
 
+static void correct_pixels(const int interpolation, const float *const in, float *const out,
+                           const size_t pixel_nb, const float *const clut, const uint16_t level)
+{
+  if(interpolation == DT_IOP_PYRAMID)
+    correct_pixel_pyramid(in, out, pixel_nb, clut, level);
+  else if(darktable.codepath.OPENMP_SIMD)
+  {
+    if(interpolation == DT_IOP_TETRAHEDRAL)
+      dt_clut_tetrahedral(in, out, pixel_nb, clut, level);
+    else
+      dt_clut_trilinear(in, out, pixel_nb, clut, level);
+  }
+#if defined(__SSE2__)
+  else if(darktable.codepath.SSE2)
+  {
+    if(interpolation == DT_IOP_TETRAHEDRAL)
+      dt_clut_tetrahedral_sse2(in, out, pixel_nb, clut, level);
+    else
+      dt_clut_trilinear_sse2(in, out, pixel_nb, clut, level);
+  }
+#endif
+  else
+    dt_unreachable_codepath();
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ibuf, void *const obuf,
              const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
@@ -1027,7 +890,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   const int width = roi_in->width;
   const int height = roi_in->height;
   const int ch = piece->colors;
-  const float *const clut = (float *)d->clut;
+  const float *const clut = d->clut;
   const uint16_t level = d->level;
   const int interpolation = d->params.interpolation;
   const int colorspace
@@ -1047,23 +910,13 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     {
       dt_ioppr_transform_image_colorspace_rgb(ibuf, obuf, width, height,
         work_profile, lut_profile, "work profile to LUT profile");
-      if (interpolation == DT_IOP_TETRAHEDRAL)
-        correct_pixel_tetrahedral(obuf, obuf, width * height, clut, level);
-      else if (interpolation == DT_IOP_TRILINEAR)
-        correct_pixel_trilinear(obuf, obuf, width * height, clut, level);
-      else
-        correct_pixel_pyramid(obuf, obuf, width * height, clut, level);
+      correct_pixels(interpolation, obuf, obuf, width * height, clut, level);
       dt_ioppr_transform_image_colorspace_rgb(obuf, obuf, width, height,
         lut_profile, work_profile, "LUT profile to work profile");
     }
     else
     {
-      if (interpolation == DT_IOP_TETRAHEDRAL)
-        correct_pixel_tetrahedral(ibuf, obuf, width * height, clut, level);
-      else if (interpolation == DT_IOP_TRILINEAR)
-        correct_pixel_trilinear(ibuf, obuf, width * height, clut, level);
-      else
-        correct_pixel_pyramid(ibuf, obuf, width * height, clut, level);
+      correct_pixels(interpolation, ibuf, obuf, width * height, clut, level);
     }
   }
   else  // no clut
@@ -1139,15 +992,48 @@ void cleanup_global(dt_iop_module_so_t *module)
   module->data = NULL;
 }
 
-static int calculate_clut(dt_iop_lut3d_params_t *const p, float **clut)
+typedef struct dt_iop_lut3d_file_t
 {
-  uint16_t level = 0;
+  dt_iop_lut3d_params_t *p;
+  const char *fullpath;
+} dt_iop_lut3d_file_t;
+
+static uint16_t load_clut_file(void *data, float **clut)
+{
+  dt_iop_lut3d_file_t *file = (dt_iop_lut3d_file_t *)data;
+  const char *filepath = file->p->filepath;
+  if (g_str_has_suffix (filepath, ".png") || g_str_has_suffix (filepath, ".PNG"))
+    return calculate_clut_haldclut(file->p, file->fullpath, clut);
+  else if (g_str_has_suffix (filepath, ".cube") || g_str_has_suffix (filepath, ".CUBE"))
+    return calculate_clut_cube(file->fullpath, clut);
+  else if (g_str_has_suffix (filepath, ".3dl") || g_str_has_suffix (filepath, ".3DL"))
+    return calculate_clut_3dl(file->fullpath, clut);
+  return 0;
+}
+
+#ifdef HAVE_GMIC
+static uint16_t load_clut_compressed(void *data, float **clut)
+{
+  dt_iop_lut3d_params_t *p = (dt_iop_lut3d_params_t *)data;
+  return calculate_clut_compressed(p, p->filepath, clut);
+}
+#endif // HAVE_GMIC
+
+// the packed clut, read and packed only if no pipe has it yet. has to be released with dt_clut_cache_release()
+static const float *calculate_clut(dt_iop_lut3d_params_t *const p, uint16_t *level)
+{
+  const float *clut = NULL;
+  *level = 0;
   const char *filepath = p->filepath;
 #ifdef HAVE_GMIC
   if (p->nb_keypoints && filepath[0])
   {
-    // compressed in params. no need to read the file
-    level = calculate_clut_compressed(p, filepath, clut);
+    // compressed in params. no need to read the file, the keypoints identify the lut
+    gchar *checksum = g_compute_checksum_for_data(G_CHECKSUM_MD5, (const guchar *)p->c_clut, sizeof(p->c_clut));
+    gchar *key = g_strdup_printf("lut3d gmic %s %d %s", p->lutname, p->nb_keypoints, checksum);
+    clut = dt_clut_cache_acquire(key, NULL, load_clut_compressed, p, level);
+    g_free(key);
+    g_free(checksum);
   }
   else
   { // read the file
@@ -1156,25 +1042,17 @@ static int calculate_clut(dt_iop_lut3d_params_t *const p, float **clut)
     if (filepath[0] && lutfolder[0])
     {
       char *fullpath = g_build_filename(lutfolder, filepath, NULL);
-      if (g_str_has_suffix (filepath, ".png") || g_str_has_suffix (filepath, ".PNG"))
-      {
-        level = calculate_clut_haldclut(p, fullpath, clut);
-      }
-      else if (g_str_has_suffix (filepath, ".cube") || g_str_has_suffix (filepath, ".CUBE"))
-      {
-        level = calculate_clut_cube(fullpath, clut);
-      }
-      else if (g_str_has_suffix (filepath, ".3dl") || g_str_has_suffix (filepath, ".3DL"))
-      {
-        level = calculate_clut_3dl(fullpath, clut);
-      }
+      gchar *key = g_strdup_printf("lut3d %s", fullpath);
+      dt_iop_lut3d_file_t file = { p, fullpath };
+      clut = dt_clut_cache_acquire(key, fullpath, load_clut_file, &file, level);
+      g_free(key);
       g_free(fullpath);
     }
     g_free(lutfolder);
 #ifdef HAVE_GMIC
   }
 #endif // HAVE_GMIC
-  return level;
+  return clut;
 }
 
 #ifdef HAVE_GMIC
@@ -1349,13 +1227,9 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
 
   if (strcmp(p->filepath, d->params.filepath) != 0 || strcmp(p->lutname, d->params.lutname) != 0 )
   { // new clut file
-    if (d->clut)
-    { // reset current clut if any
-      dt_free_align(d->clut);
-      d->clut = NULL;
-      d->level = 0;
-    }
-    d->level = calculate_clut(p, &d->clut);
+    // reset current clut if any
+    dt_clut_cache_release(d->clut);
+    d->clut = calculate_clut(p, &d->level);
   }
   memcpy(&d->params, p, sizeof(dt_iop_lut3d_params_t));
 }
@@ -1374,8 +1248,7 @@ void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pi
 void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
   dt_iop_lut3d_data_t *d = (dt_iop_lut3d_data_t *)piece->data;;
-  if (d->clut)
-    dt_free_align(d->clut);
+  dt_clut_cache_release(d->clut);
   d->clut = NULL;
   d->level = 0;
   free(piece->data);
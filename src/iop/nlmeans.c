@@ -508,9 +508,112 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 }
 
 #if defined(__SSE__)
+/** adds the squared differences of the pixels inp, inps and subtracts those of inm, inms to n values of s. */
+typedef void((*nlmeans_slide_row_t)(float *s, const float *inp, const float *inps, const float *inm,
+                                    const float *inms, const float *const norm2, const int n));
+
+static void slide_row_sse2(float *s, const float *inp, const float *inps, const float *inm, const float *inms,
+                           const float *const norm2, const int n)
+{
+  int i = 0;
+  for(; ((intptr_t)s & 0xf) != 0 && i < n; i++, inp += 4, inps += 4, inm += 4, inms += 4, s++)
+  {
+    float stmp = s[0];
+    for(int k = 0; k < 3; k++)
+      stmp += ((inp[k] - inps[k]) * (inp[k] - inps[k]) - (inm[k] - inms[k]) * (inm[k] - inms[k]))
+              * norm2[k];
+    s[0] = stmp;
+  }
+  /* Process most of the line 4 pixels at a time */
+  for(; i < n - 4; i += 4, inp += 16, inps += 16, inm += 16, inms += 16, s += 4)
+  {
+    __m128 sv = _mm_load_ps(s);
+    const __m128 inp1 = _mm_load_ps(inp) - _mm_load_ps(inps);
+    const __m128 inp2 = _mm_load_ps(inp + 4) - _mm_load_ps(inps + 4);
+    const __m128 inp3 = _mm_load_ps(inp + 8) - _mm_load_ps(inps + 8);
+    const __m128 inp4 = _mm_load_ps(inp + 12) - _mm_load_ps(inps + 12);
+
+    const __m128 inp12lo = _mm_unpacklo_ps(inp1, inp2);
+    const __m128 inp34lo = _mm_unpacklo_ps(inp3, inp4);
+    const __m128 inp12hi = _mm_unpackhi_ps(inp1, inp2);
+    const __m128 inp34hi = _mm_unpackhi_ps(inp3, inp4);
+
+    const __m128 inpv0 = _mm_movelh_ps(inp12lo, inp34lo);
+    sv += inpv0 * inpv0 * _mm_set1_ps(norm2[0]);
+
+    const __m128 inpv1 = _mm_movehl_ps(inp34lo, inp12lo);
+    sv += inpv1 * inpv1 * _mm_set1_ps(norm2[1]);
+
+    const __m128 inpv2 = _mm_movelh_ps(inp12hi, inp34hi);
+    sv += inpv2 * inpv2 * _mm_set1_ps(norm2[2]);
+
+    const __m128 inm1 = _mm_load_ps(inm) - _mm_load_ps(inms);
+    const __m128 inm2 = _mm_load_ps(inm + 4) - _mm_load_ps(inms + 4);
+    const __m128 inm3 = _mm_load_ps(inm + 8) - _mm_load_ps(inms + 8);
+    const __m128 inm4 = _mm_load_ps(inm + 12) - _mm_load_ps(inms + 12);
+
+    const __m128 inm12lo = _mm_unpacklo_ps(inm1, inm2);
+    const __m128 inm34lo = _mm_unpacklo_ps(inm3, inm4);
+    const __m128 inm12hi = _mm_unpackhi_ps(inm1, inm2);
+    const __m128 inm34hi = _mm_unpackhi_ps(inm3, inm4);
+
+    const __m128 inmv0 = _mm_movelh_ps(inm12lo, inm34lo);
+    sv -= inmv0 * inmv0 * _mm_set1_ps(norm2[0]);
+
+    const __m128 inmv1 = _mm_movehl_ps(inm34lo, inm12lo);
+    sv -= inmv1 * inmv1 * _mm_set1_ps(norm2[1]);
+
+    const __m128 inmv2 = _mm_movelh_ps(inm12hi, inm34hi);
+    sv -= inmv2 * inmv2 * _mm_set1_ps(norm2[2]);
+
+    _mm_store_ps(s, sv);
+  }
+  for(; i < n; i++, inp += 4, inps += 4, inm += 4, inms += 4, s++)
+  {
+    float stmp = s[0];
+    for(int k = 0; k < 3; k++)
+      stmp += ((inp[k] - inps[k]) * (inp[k] - inps[k]) - (inm[k] - inms[k]) * (inm[k] - inms[k]))
+              * norm2[k];
+    s[0] = stmp;
+  }
+}
+
+#if defined(DT_HAVE_AVX_CODEPATHS)
+__DT_TARGET_AVX2__
+static void slide_row_avx2(float *s, const float *inp, const float *inps, const float *inm, const float *inms,
+                           const float *const norm2, const int n)
+{
+  const __m256 norm = _mm256_setr_ps(norm2[0], norm2[1], norm2[2], 0.0f, norm2[0], norm2[1], norm2[2], 0.0f);
+  // the horizontal adds below leave the pixels in the order 0 2 4 6 | 1 3 5 7
+  const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  int i = 0;
+  /* Process most of the line 8 pixels at a time, 2 pixels per vector */
+  for(; i + 8 <= n; i += 8, inp += 32, inps += 32, inm += 32, inms += 32, s += 8)
+  {
+    __m256 q[4];
+    for(int k = 0; k < 4; k++)
+    {
+      const __m256 dp = _mm256_loadu_ps(inp + 8 * k) - _mm256_loadu_ps(inps + 8 * k);
+      const __m256 dm = _mm256_loadu_ps(inm + 8 * k) - _mm256_loadu_ps(inms + 8 * k);
+      q[k] = _mm256_fmsub_ps(dp, dp, dm * dm) * norm;
+    }
+    const __m256 sums = _mm256_hadd_ps(_mm256_hadd_ps(q[0], q[1]), _mm256_hadd_ps(q[2], q[3]));
+    _mm256_storeu_ps(s, _mm256_loadu_ps(s) + _mm256_permutevar8x32_ps(sums, order));
+  }
+  for(; i < n; i++, inp += 4, inps += 4, inm += 4, inms += 4, s++)
+  {
+    float stmp = s[0];
+    for(int k = 0; k < 3; k++)
+      stmp += ((inp[k] - inps[k]) * (inp[k] - inps[k]) - (inm[k] - inms[k]) * (inm[k] - inms[k])) * norm2[k];
+    s[0] = stmp;
+  }
+}
+#endif
+
 /** process, all real work is done here. */
-void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
-                  void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+static void process_slide(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                          void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
+                          const nlmeans_slide_row_t slide_row)
 {
   // this is called for preview and full pipe separately, each with its own pixelpipe piece.
   // get our data struct:
@@ -544,7 +647,7 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
 // memory
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(ivoid, norm2, ovoid, P, roi_in, roi_out, sharpness) \
+  dt_omp_firstprivate(ivoid, norm2, ovoid, P, roi_in, roi_out, sharpness, slide_row) \
   firstprivate(inited_slide) \
   shared(kj, ki, Sa) \
   schedule(static)
@@ -607,66 +710,7 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
           const float *inm = ((float *)ivoid) + 4 * i + 4 * (size_t)roi_in->width * (j - P);
           const float *inms = ((float *)ivoid) + 4 * i + 4 * ((size_t)roi_in->width * (j - P + kj) + ki);
           const int last = roi_out->width + MIN(0, -ki);
-          for(; ((intptr_t)s & 0xf) != 0 && i < last; i++, inp += 4, inps += 4, inm += 4, inms += 4, s++)
-          {
-            float stmp = s[0];
-            for(int k = 0; k < 3; k++)
-              stmp += ((inp[k] - inps[k]) * (inp[k] - inps[k]) - (inm[k] - inms[k]) * (inm[k] - inms[k]))
-                      * norm2[k];
-            s[0] = stmp;
-          }
-          /* Process most of the line 4 pixels at a time */
-          for(; i < last - 4; i += 4, inp += 16, inps += 16, inm += 16, inms += 16, s += 4)
-          {
-            __m128 sv = _mm_load_ps(s);
-            const __m128 inp1 = _mm_load_ps(inp) - _mm_load_ps(inps);
-            const __m128 inp2 = _mm_load_ps(inp + 4) - _mm_load_ps(inps + 4);
-            const __m128 inp3 = _mm_load_ps(inp + 8) - _mm_load_ps(inps + 8);
-            const __m128 inp4 = _mm_load_ps(inp + 12) - _mm_load_ps(inps + 12);
-
-            const __m128 inp12lo = _mm_unpacklo_ps(inp1, inp2);
-            const __m128 inp34lo = _mm_unpacklo_ps(inp3, inp4);
-            const __m128 inp12hi = _mm_unpackhi_ps(inp1, inp2);
-            const __m128 inp34hi = _mm_unpackhi_ps(inp3, inp4);
-
-            const __m128 inpv0 = _mm_movelh_ps(inp12lo, inp34lo);
-            sv += inpv0 * inpv0 * _mm_set1_ps(norm2[0]);
-
-            const __m128 inpv1 = _mm_movehl_ps(inp34lo, inp12lo);
-            sv += inpv1 * inpv1 * _mm_set1_ps(norm2[1]);
-
-            const __m128 inpv2 = _mm_movelh_ps(inp12hi, inp34hi);
-            sv += inpv2 * inpv2 * _mm_set1_ps(norm2[2]);
-
-            const __m128 inm1 = _mm_load_ps(inm) - _mm_load_ps(inms);
-            const __m128 inm2 = _mm_load_ps(inm + 4) - _mm_load_ps(inms + 4);
-            const __m128 inm3 = _mm_load_ps(inm + 8) - _mm_load_ps(inms + 8);
-            const __m128 inm4 = _mm_load_ps(inm + 12) - _mm_load_ps(inms + 12);
-
-            const __m128 inm12lo = _mm_unpacklo_ps(inm1, inm2);
-            const __m128 inm34lo = _mm_unpacklo_ps(inm3, inm4);
-            const __m128 inm12hi = _mm_unpackhi_ps(inm1, inm2);
-            const __m128 inm34hi = _mm_unpackhi_ps(inm3, inm4);
-
-            const __m128 inmv0 = _mm_movelh_ps(inm12lo, inm34lo);
-            sv -= inmv0 * inmv0 * _mm_set1_ps(norm2[0]);
-
-            const __m128 inmv1 = _mm_movehl_ps(inm34lo, inm12lo);
-            sv -= inmv1 * inmv1 * _mm_set1_ps(norm2[1]);
-
-            const __m128 inmv2 = _mm_movelh_ps(inm12hi, inm34hi);
-            sv -= inmv2 * inmv2 * _mm_set1_ps(norm2[2]);
-
-            _mm_store_ps(s, sv);
-          }
-          for(; i < last; i++, inp += 4, inps += 4, inm += 4, inms += 4, s++)
-          {
-            float stmp = s[0];
-            for(int k = 0; k < 3; k++)
-              stmp += ((inp[k] - inps[k]) * (inp[k] - inps[k]) - (inm[k] - inms[k]) * (inm[k] - inms[k]))
-                      * norm2[k];
-            s[0] = stmp;
-          }
+          slide_row(s, inp, inps, inm, inms, norm2, last - i);
         }
         else
           inited_slide = 0;
@@ -701,6 +745,21 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 }
+
+void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                  void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  process_slide(self, piece, ivoid, ovoid, roi_in, roi_out, slide_row_sse2);
+}
+
+#if defined(DT_HAVE_AVX_CODEPATHS)
+__DT_TARGET_AVX2__
+void process_avx2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                  void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  process_slide(self, piece, ivoid, ovoid, roi_in, roi_out, slide_row_avx2);
+}
+#endif
 #endif
 
 /** this will be called to init new defaults if a new image is loaded from film strip mode. */
@@ -4375,7 +4375,7 @@ static void process_internal(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
 
   // we will do all the clone, heal, etc on the input image,
   // this way the source for one algorithm can be the destination from a previous one
-  in_retouch = dt_alloc_align(64, roi_rt->width * roi_rt->height * ch * sizeof(float));
+  in_retouch = dt_buffer_pool_alloc(&piece->pipe->pool, (size_t)roi_rt->width * roi_rt->height * ch * sizeof(float));
   if(in_retouch == NULL) goto cleanup;
 
   memcpy(in_retouch, ivoid, roi_rt->width * roi_rt->height * ch * sizeof(float));
@@ -4474,7 +4474,7 @@ static void process_internal(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
   rt_copy_in_to_out(in_retouch, roi_rt, ovoid, roi_out, ch, 0, 0);
 
 cleanup:
-  if(in_retouch) dt_free_align(in_retouch);
+  dt_buffer_pool_free(&piece->pipe->pool, in_retouch);
   if(dwt_p) dt_dwt_free(dwt_p);
 }
 
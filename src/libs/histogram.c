@@ -184,7 +184,7 @@ static gboolean _lib_histogram_draw_callback(GtkWidget *widget, cairo_t *crf, gp
   gtk_widget_get_allocation(widget, &allocation);
   const int width = allocation.width, height = allocation.height;
 
-  dt_pthread_mutex_lock(&dev->preview_pipe_mutex);
+  dt_pthread_mutex_lock(&dev->histogram_mutex);
 
   const int waveform_width = dev->histogram_waveform_width;
   const int waveform_height = dev->histogram_waveform_height;
@@ -201,8 +201,9 @@ static gboolean _lib_histogram_draw_callback(GtkWidget *widget, cairo_t *crf, gp
     else
       memcpy(buf, dev->histogram, histsize);
   }
+  const uint32_t histogram_max = dev->histogram_max;
 
-  dt_pthread_mutex_unlock(&dev->preview_pipe_mutex);
+  dt_pthread_mutex_unlock(&dev->histogram_mutex);
   if(buf == NULL) return FALSE;
 
   cairo_surface_t *cst = dt_cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
@@ -274,11 +275,11 @@ static gboolean _lib_histogram_draw_callback(GtkWidget *widget, cairo_t *crf, gp
       cairo_paint(cr);
       cairo_surface_destroy(source);
     }
-    else if(dev->histogram_max)
+    else if(histogram_max)
     {
       uint32_t *hist = buf;
-      const float hist_max = dev->histogram_type == DT_DEV_HISTOGRAM_LINEAR ? dev->histogram_max
-                                                                            : logf(1.0 + dev->histogram_max);
+      const float hist_max = dev->histogram_type == DT_DEV_HISTOGRAM_LINEAR ? histogram_max
+                                                                            : logf(1.0 + histogram_max);
       cairo_translate(cr, 0, height);
       cairo_scale(cr, width / 255.0, -(height - 10) / hist_max);
       cairo_set_operator(cr, CAIRO_OPERATOR_ADD);
@@ -598,6 +599,9 @@ void gui_init(dt_lib_module_t *self)
   /* connect to preview pipe finished  signal */
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_DEVELOP_PREVIEW_PIPE_FINISHED,
                             G_CALLBACK(_lib_histogram_change_callback), self);
+  /* and to the scopes computed after it */
+  dt_control_signal_connect(darktable.signals, DT_SIGNAL_DEVELOP_HISTOGRAM_UPDATED,
+                            G_CALLBACK(_lib_histogram_change_callback), self);
 }
 
 void gui_cleanup(dt_lib_module_t *self)
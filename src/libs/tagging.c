@@ -20,6 +20,7 @@
 #include "common/collection.h"
 #include "common/darktable.h"
 #include "common/debug.h"
+#include "common/tag_index.h"
 #include "common/tags.h"
 #include "control/conf.h"
 #include "control/control.h"
@@ -47,6 +48,7 @@ static gboolean _lib_tagging_tag_show(GtkAccelGroup *accel_group, GObject *accel
 typedef struct dt_lib_tagging_t
 {
   char keyword[1024];
+  GHashTable *matches; // paths of the tags matching keyword, NULL without keyword
   GtkEntry *entry;
   GtkTreeView *attached_view, *dictionary_view;
   int imgsel;
@@ -152,30 +154,31 @@ static void propagate_sel_to_parents(GtkTreeModel *model, GtkTreeIter *iter)
   }
 }
 
+// ask the tag index which tags match the keyword, set_matching_tag_visibility() only looks the rows up in there
+static void update_matches(dt_lib_module_t *self)
+{
+  dt_lib_tagging_t *d = (dt_lib_tagging_t *)self->data;
+  if(d->matches) g_hash_table_destroy(d->matches);
+  d->matches = d->keyword[0] ? dt_tag_index_match(darktable.tag_index, d->keyword) : NULL;
+}
+
 static gboolean set_matching_tag_visibility(GtkTreeModel *model, GtkTreePath *path, GtkTreeIter *iter, dt_lib_module_t *self)
 {
   dt_lib_tagging_t *d = (dt_lib_tagging_t *)self->data;
   gboolean visible;
   gchar *tagname = NULL;
-  gchar *synonyms = NULL;
-  gtk_tree_model_get(model, iter, DT_LIB_TAGGING_COL_PATH, &tagname, DT_LIB_TAGGING_COL_SYNONYM, &synonyms, -1);
-  if (!d->keyword[0])
+  if (!d->matches)
     visible = TRUE;
   else
   {
-    if (synonyms && synonyms[0]) tagname = dt_util_dstrcat(tagname, ", %s", synonyms);
-    gchar *haystack = g_utf8_strdown(tagname, -1);
-    gchar *needle = g_utf8_strdown(d->keyword, -1);
-    visible = (g_strrstr(haystack, needle) != NULL);
-    g_free(haystack);
-    g_free(needle);
+    gtk_tree_model_get(model, iter, DT_LIB_TAGGING_COL_PATH, &tagname, -1);
+    visible = tagname && g_hash_table_contains(d->matches, tagname);
   }
   if (d->tree_flag)
     gtk_tree_store_set(GTK_TREE_STORE(model), iter, DT_LIB_TAGGING_COL_VISIBLE, visible, -1);
   else
     gtk_list_store_set(GTK_LIST_STORE(model), iter, DT_LIB_TAGGING_COL_VISIBLE, visible, -1);
   g_free(tagname);
-  g_free(synonyms);
   return FALSE;
 }
 
@@ -250,6 +253,8 @@ static void init_treeview(dt_lib_module_t *self, int which)
       count = dt_tag_get_suggestions(&tags);
     else
       count = dt_tag_get_with_usage(&tags);
+    // tags may have changed since the keyword was typed
+    update_matches(self);
     view = d->dictionary_view;
     model = gtk_tree_view_get_model(GTK_TREE_VIEW(view));
     if (d->tree_flag)
@@ -763,6 +768,7 @@ static void set_keyword(dt_lib_module_t *self)
     if(*beg == ' ') beg++;
   }
   snprintf(d->keyword, sizeof(d->keyword), "%s", beg);
+  update_matches(self);
 }
 
 static gboolean update_tag_name_per_id(GtkTreeModel *model, GtkTreePath *path, GtkTreeIter *iter, dt_tag_op_t *to)
@@ -2537,6 +2543,8 @@ void gui_init(dt_lib_module_t *self)
   self->data = (void *)d;
   d->imgsel = -1;
   d->last_tag = NULL;
+  d->keyword[0] = '\0';
+  d->matches = NULL;
 
   self->widget = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
   dt_gui_add_help_link(self->widget, dt_get_help_url(self->plugin_name));
@@ -2814,6 +2822,7 @@ void gui_cleanup(dt_lib_module_t *self)
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_lib_selection_changed_callback), self);
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(collection_updated_callback), self);
   g_free(d->collection);
+  if(d->matches) g_hash_table_destroy(d->matches);
   free(self->data);
   self->data = NULL;
 }
@@ -26,6 +26,7 @@
 #include "common/metadata.h"
 #include "common/mipmap_cache.h"
 #include "common/metadata.h"
+#include "control/signal.h"
 #include "lua/database.h"
 #include "lua/film.h"
 #include "lua/glist.h"
@@ -208,7 +209,10 @@ static int rating_member(lua_State *L)
     }
     my_image->flags &= ~0x7;
     my_image->flags |= my_score;
+    GList *imgs = g_list_prepend(NULL, GINT_TO_POINTER(my_image->id));
     releasewriteimage(L, my_image);
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_IMAGE_INFO_CHANGED, imgs);
+    g_list_free(imgs);
     return 0;
   }
 }
@@ -403,6 +407,9 @@ static int colorlabel_member(lua_State *L)
     {
       dt_colorlabels_remove_label(imgid, colorlabel_index);
     }
+    GList *imgs = g_list_prepend(NULL, GINT_TO_POINTER(imgid));
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_IMAGE_INFO_CHANGED, imgs);
+    g_list_free(imgs);
     return 0;
   }
 }
@@ -0,0 +1,165 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2011 johannes hanika.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// unit test and scaling benchmark for the sharded LRU cache. run with --bench for the benchmark.
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmocka.h>
+
+#include "common/cache.h"
+#include "common/darktable.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+static void alloc_dummy(void *data, dt_cache_entry_t *entry)
+{
+  entry->cost = 1; // also the default
+  entry->data_size = sizeof(uint32_t);
+  entry->data = malloc(sizeof(uint32_t));
+  *(uint32_t *)entry->data = entry->key;
+}
+
+static void cleanup_dummy(void *data, dt_cache_entry_t *entry)
+{
+  free(entry->data);
+}
+
+// returns the number of entries that came back with the wrong data. cmocka's asserts can't be used from the
+// worker threads.
+static int hammer(dt_cache_t *cache, const int num_threads, const int n)
+{
+  int wrong = 0;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(guided) dt_omp_firstprivate(cache, n) num_threads(num_threads) \
+    reduction(+ : wrong)
+#endif
+  for(int k = 0; k < n; k++)
+  {
+    dt_cache_entry_t *e1 = dt_cache_get(cache, k, 'r');
+    const uint32_t val1 = *(uint32_t *)e1->data;
+    dt_cache_release(cache, e1);
+    dt_cache_entry_t *e2 = dt_cache_get(cache, k, 'r');
+    const uint32_t val2 = *(uint32_t *)e2->data;
+    dt_cache_release(cache, e2);
+    wrong += (val1 != (uint32_t)k) + (val2 != (uint32_t)k);
+  }
+  return wrong;
+}
+
+static void check(dt_cache_t *cache)
+{
+  const int size = dt_cache_size(cache);
+  const int lru_cnt = dt_cache_check_consistency(cache);
+  assert_true(lru_cnt >= 0);
+  assert_int_equal(size, lru_cnt);
+}
+
+static void test(const uint32_t num_shards, const dt_cache_policy_t policy)
+{
+  dt_cache_t cache;
+  // really hammer it, make quota insanely low:
+  dt_cache_init_sharded(&cache, 0, 100, num_shards);
+  dt_cache_set_policy(&cache, policy);
+  dt_cache_set_allocate_callback(&cache, alloc_dummy, NULL);
+  dt_cache_set_cleanup_callback(&cache, cleanup_dummy, NULL);
+  assert_int_equal(hammer(&cache, 16, 100000), 0);
+  check(&cache);
+  dt_cache_cleanup(&cache);
+
+  // now a harder case: a cache with only one entry and a lot of threads fighting over it:
+  dt_cache_init_sharded(&cache, 0, 2, num_shards);
+  dt_cache_set_policy(&cache, policy);
+  dt_cache_set_allocate_callback(&cache, alloc_dummy, NULL);
+  dt_cache_set_cleanup_callback(&cache, cleanup_dummy, NULL);
+  assert_int_equal(hammer(&cache, 16, 100000), 0);
+  check(&cache);
+  dt_cache_cleanup(&cache);
+}
+
+static void test_single_lock_lru(void **state)
+{
+  test(1, DT_CACHE_POLICY_LRU);
+}
+
+static void test_sharded_lru(void **state)
+{
+  test(DT_CACHE_DEFAULT_SHARDS, DT_CACHE_POLICY_LRU);
+}
+
+static void test_sharded_clock(void **state)
+{
+  test(DT_CACHE_DEFAULT_SHARDS, DT_CACHE_POLICY_CLOCK);
+}
+
+// ops/sec for a lighttable-like access pattern: mostly hits on a working set, some misses.
+static void bench(const uint32_t num_shards, const dt_cache_policy_t policy, const char *name)
+{
+  const int n = 2000000;
+  fprintf(stderr, "[bench] %s\n", name);
+  for(int threads = 1; threads <= 64; threads *= 2)
+  {
+    dt_cache_t cache;
+    dt_cache_init_sharded(&cache, 0, 5000, num_shards);
+    dt_cache_set_policy(&cache, policy);
+    dt_cache_set_allocate_callback(&cache, alloc_dummy, NULL);
+    dt_cache_set_cleanup_callback(&cache, cleanup_dummy, NULL);
+    const double start = dt_get_wtime();
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static) shared(cache) dt_omp_firstprivate(n) num_threads(threads)
+#endif
+    for(int k = 0; k < n; k++)
+    {
+      // 90% of the accesses go to a working set that fits the cache
+      const uint32_t key = (k % 10) ? (k * 7u) % 3000 : 3000 + (k * 13u) % 20000;
+      dt_cache_entry_t *e = dt_cache_get(&cache, key, 'r');
+      dt_cache_release(&cache, e);
+    }
+    const double end = dt_get_wtime();
+    fprintf(stderr, "  %2d threads: %10.0f ops/s\n", threads, n / (end - start));
+    dt_cache_cleanup(&cache);
+  }
+}
+
+int main(int argc, char *arg[])
+{
+  if(argc > 1 && !strcmp(arg[1], "--bench"))
+  {
+    bench(1, DT_CACHE_POLICY_LRU, "single lock lru");
+    bench(DT_CACHE_DEFAULT_SHARDS, DT_CACHE_POLICY_LRU, "sharded lru");
+    bench(DT_CACHE_DEFAULT_SHARDS, DT_CACHE_POLICY_CLOCK, "sharded clock");
+    return 0;
+  }
+
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_single_lock_lru),
+    cmocka_unit_test(test_sharded_lru),
+    cmocka_unit_test(test_sharded_clock)
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,96 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// unit test of the markesteijn tiling: the tile size depends on the cache size and the number of threads of the
+// machine, the demosaiced image must not.
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmocka.h>
+
+#include "iop/demosaic.c"
+
+#define WIDTH 613
+#define HEIGHT 457
+
+static const uint8_t test_xtrans[6][6] = { { 1, 1, 0, 1, 1, 2 }, { 1, 1, 2, 1, 1, 0 }, { 2, 0, 1, 0, 2, 1 },
+                                           { 1, 1, 2, 1, 1, 0 }, { 1, 1, 0, 1, 1, 2 }, { 0, 2, 1, 2, 0, 1 } };
+
+static void test(const int passes, const int *const tile_sizes, const int n)
+{
+  dt_dev_pixelpipe_t pipe = { 0 };
+  dt_dev_pixelpipe_iop_t piece = { .pipe = &pipe };
+
+  // smooth structure plus noise. the offset is a multiple of 3, as modify_roi_in makes it for x-trans.
+  float *in = dt_alloc_align(64, sizeof(float) * WIDTH * HEIGHT);
+  assert_non_null(in);
+  srand(42);
+  for(size_t k = 0; k < (size_t)WIDTH * HEIGHT; k++)
+    in[k] = 0.5f + 0.4f * sinf((k % WIDTH) * 0.21f) * cosf((k / WIDTH) * 0.13f) + (rand() % 1000) / 5000.0f;
+  const dt_iop_roi_t roi = { .x = 6, .y = 3, .width = WIDTH, .height = HEIGHT, .scale = 1.0f };
+
+  const size_t size = sizeof(float) * 4 * WIDTH * HEIGHT;
+  float *first = dt_alloc_align(64, size), *out = dt_alloc_align(64, size);
+  assert_non_null(first);
+  assert_non_null(out);
+  memset(first, 0, size);
+  xtrans_markesteijn_interpolate(&piece, first, in, &roi, &roi, test_xtrans, passes, tile_sizes[0]);
+
+  for(int k = 1; k < n; k++)
+  {
+    memset(out, 0, size);
+    xtrans_markesteijn_interpolate(&piece, out, in, &roi, &roi, test_xtrans, passes, tile_sizes[k]);
+    assert_memory_equal(first, out, size);
+  }
+
+  dt_free_align(in);
+  dt_free_align(first);
+  dt_free_align(out);
+}
+
+// tile sizes are twice the padding plus a multiple of 6, as xtrans_tile_size() makes them
+static void test_markesteijn_1(void **state)
+{
+  const int tile_sizes[] = { 60, 90, 150, 252 };
+  test(1, tile_sizes, sizeof(tile_sizes) / sizeof(tile_sizes[0]));
+}
+
+static void test_markesteijn_3(void **state)
+{
+  const int tile_sizes[] = { 70, 94, 154, 256 };
+  test(3, tile_sizes, sizeof(tile_sizes) / sizeof(tile_sizes[0]));
+}
+
+int main(int argc, char *arg[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_markesteijn_1),
+    cmocka_unit_test(test_markesteijn_3)
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
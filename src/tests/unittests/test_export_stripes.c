@@ -0,0 +1,136 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// unit test of streamed exports: sharpen run stripe by stripe, with the margin of context rows the export
+// gives every stripe, has to come out the same as sharpen run on the whole image in one pass.
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmocka.h>
+
+#include "iop/sharpen.c"
+#include "common/imageio.h"
+
+#define WIDTH 600
+#define HEIGHT 500
+
+typedef void(process_t)(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                        void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out);
+
+// the rows of the image processed stripe by stripe, the way the export streams them
+static void process_stripes(process_t *process_fn, dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece,
+                            const float *const in, float *const out, const int stripe, const int margin)
+{
+  const size_t rowsize = (size_t)4 * WIDTH;
+  float *const buf = dt_alloc_align(64, sizeof(float) * rowsize * (stripe + 2 * margin));
+  assert_non_null(buf);
+  for(int y = 0; y < HEIGHT; y += stripe)
+  {
+    const int rows = MIN(stripe, HEIGHT - y);
+    const int top = MIN(margin, y);
+    const int bottom = MIN(margin, HEIGHT - y - rows);
+    const dt_iop_roi_t roi = { .x = 0, .y = y - top, .width = WIDTH, .height = top + rows + bottom, .scale = 1.0f };
+    process_fn(module, piece, in + rowsize * (y - top), buf, &roi, &roi);
+    memcpy(out + rowsize * y, buf + rowsize * top, sizeof(float) * rowsize * rows);
+  }
+  dt_free_align(buf);
+}
+
+static void test(process_t *process_fn)
+{
+  dt_iop_module_t module = { 0 };
+  g_strlcpy(module.op, "sharpen", sizeof(module.op));
+  module.tiling_callback = tiling_callback;
+  dt_iop_sharpen_params_t p = { .radius = 3.0f, .amount = 1.5f, .threshold = 0.1f };
+  dt_iop_sharpen_data_t d = { 0 };
+  dt_dev_pixelpipe_t pipe = { 0 };
+  dt_dev_pixelpipe_iop_t piece = { .module = &module, .pipe = &pipe, .data = &d, .enabled = 1, .iscale = 1.0f,
+                                   .colors = 4 };
+  commit_params(&module, (dt_iop_params_t *)&p, &pipe, &piece);
+  pipe.nodes = g_list_append(NULL, &piece);
+
+  // lab-ish noise with some structure, sharpen only works on the first channel
+  const size_t size = sizeof(float) * 4 * WIDTH * HEIGHT;
+  float *in = dt_alloc_align(64, size), *single = dt_alloc_align(64, size), *streamed = dt_alloc_align(64, size);
+  assert_non_null(in);
+  assert_non_null(single);
+  assert_non_null(streamed);
+  srand(42);
+  for(size_t k = 0; k < (size_t)WIDTH * HEIGHT; k++)
+  {
+    in[4 * k + 0] = 50.0f + 40.0f * sinf((k % WIDTH) * 0.1f) * cosf((k / WIDTH) * 0.07f) + (rand() % 100) / 10.0f;
+    in[4 * k + 1] = (rand() % 100) / 10.0f - 5.0f;
+    in[4 * k + 2] = (rand() % 100) / 10.0f - 5.0f;
+    in[4 * k + 3] = 1.0f;
+  }
+
+  const dt_iop_roi_t roi = { .x = 0, .y = 0, .width = WIDTH, .height = HEIGHT, .scale = 1.0f };
+  process_fn(&module, &piece, in, single, &roi, &roi);
+
+  const int margin = dt_imageio_export_stripe_margin(&pipe, WIDTH, HEIGHT, 1.0);
+  assert_true(margin >= MIN(MAXR, ceilf(d.radius)));
+
+  const int stripes[] = { 16, 48, 100, 333 };
+  for(int s = 0; s < sizeof(stripes) / sizeof(stripes[0]); s++)
+  {
+    process_stripes(process_fn, &module, &piece, in, streamed, stripes[s], margin);
+    assert_memory_equal(single, streamed, size);
+
+    // without the margin every stripe border is left unsharpened, which is the seam the margin is for
+    process_stripes(process_fn, &module, &piece, in, streamed, stripes[s], 0);
+    assert_memory_not_equal(single, streamed, size);
+  }
+
+  g_list_free(pipe.nodes);
+  dt_free_align(in);
+  dt_free_align(single);
+  dt_free_align(streamed);
+}
+
+static void test_sharpen_plain(void **state)
+{
+  test(process);
+}
+
+static void test_sharpen_sse2(void **state)
+{
+#if defined(__SSE2__)
+  test(process_sse2);
+#else
+  skip();
+#endif
+}
+
+int main(int argc, char *arg[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_sharpen_plain),
+    cmocka_unit_test(test_sharpen_sse2)
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
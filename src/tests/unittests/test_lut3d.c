@@ -0,0 +1,264 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// unit test and benchmark of the packed clut kernels against interpolating the clut with 3 floats per node.
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmocka.h>
+
+#include "common/clut.h"
+
+#define SIZE 1024
+#define PIXELS (SIZE * SIZE)
+#define RUNS 3
+
+// how lut3d interpolated before, 3 floats per node
+static void tetrahedral_reference(const float *const in, float *const out, const size_t pixel_nb,
+                                  const float *const clut, const int level)
+{
+  const int level2 = level * level;
+  for(size_t k = 0; k < pixel_nb * 4; k += 4)
+  {
+    float rgbd[3];
+    int rgbi[3];
+    for(int c = 0; c < 3; c++)
+    {
+      rgbd[c] = fminf(fmaxf(in[k + c], 0.0f), 1.0f) * (float)(level - 1);
+      rgbi[c] = CLAMP((int)rgbd[c], 0, level - 2);
+      rgbd[c] -= rgbi[c];
+    }
+    const int color = rgbi[0] + rgbi[1] * level + rgbi[2] * level2;
+    const int i000 = color * 3, i100 = i000 + 3;
+    const int i010 = (color + level) * 3, i110 = i010 + 3;
+    const int i001 = (color + level2) * 3, i101 = i001 + 3;
+    const int i011 = (color + level + level2) * 3, i111 = i011 + 3;
+    for(int c = 0; c < 3; c++)
+    {
+      float v;
+      if(rgbd[0] > rgbd[1])
+      {
+        if(rgbd[1] > rgbd[2])
+          v = (1 - rgbd[0]) * clut[i000 + c] + (rgbd[0] - rgbd[1]) * clut[i100 + c]
+              + (rgbd[1] - rgbd[2]) * clut[i110 + c] + rgbd[2] * clut[i111 + c];
+        else if(rgbd[0] > rgbd[2])
+          v = (1 - rgbd[0]) * clut[i000 + c] + (rgbd[0] - rgbd[2]) * clut[i100 + c]
+              + (rgbd[2] - rgbd[1]) * clut[i101 + c] + rgbd[1] * clut[i111 + c];
+        else
+          v = (1 - rgbd[2]) * clut[i000 + c] + (rgbd[2] - rgbd[0]) * clut[i001 + c]
+              + (rgbd[0] - rgbd[1]) * clut[i101 + c] + rgbd[1] * clut[i111 + c];
+      }
+      else
+      {
+        if(rgbd[2] > rgbd[1])
+          v = (1 - rgbd[2]) * clut[i000 + c] + (rgbd[2] - rgbd[1]) * clut[i001 + c]
+              + (rgbd[1] - rgbd[0]) * clut[i011 + c] + rgbd[0] * clut[i111 + c];
+        else if(rgbd[2] > rgbd[0])
+          v = (1 - rgbd[1]) * clut[i000 + c] + (rgbd[1] - rgbd[2]) * clut[i010 + c]
+              + (rgbd[2] - rgbd[0]) * clut[i011 + c] + rgbd[0] * clut[i111 + c];
+        else
+          v = (1 - rgbd[1]) * clut[i000 + c] + (rgbd[1] - rgbd[0]) * clut[i010 + c]
+              + (rgbd[0] - rgbd[2]) * clut[i110 + c] + rgbd[2] * clut[i111 + c];
+      }
+      out[k + c] = v;
+    }
+    out[k + 3] = in[k + 3];
+  }
+}
+
+static void trilinear_reference(const float *const in, float *const out, const size_t pixel_nb,
+                                const float *const clut, const int level)
+{
+  const int level2 = level * level;
+  for(size_t k = 0; k < pixel_nb * 4; k += 4)
+  {
+    float rgbd[3];
+    int rgbi[3];
+    for(int c = 0; c < 3; c++)
+    {
+      rgbd[c] = fminf(fmaxf(in[k + c], 0.0f), 1.0f) * (float)(level - 1);
+      rgbi[c] = CLAMP((int)rgbd[c], 0, level - 2);
+      rgbd[c] -= rgbi[c];
+    }
+    const int color = rgbi[0] + rgbi[1] * level + rgbi[2] * level2;
+    for(int c = 0; c < 3; c++)
+    {
+      float v[2];
+      for(int z = 0; z < 2; z++)
+      {
+        const float *const p = clut + (color + z * level2) * 3 + c;
+        const float y0 = p[0] * (1 - rgbd[0]) + p[3] * rgbd[0];
+        const float y1 = p[level * 3] * (1 - rgbd[0]) + p[level * 3 + 3] * rgbd[0];
+        v[z] = y0 * (1 - rgbd[1]) + y1 * rgbd[1];
+      }
+      out[k + c] = v[0] * (1 - rgbd[2]) + v[1] * rgbd[2];
+    }
+    out[k + 3] = in[k + 3];
+  }
+}
+
+// something like a film emulation: a tone curve, some crosstalk and a tint in the shadows
+static float *make_clut(const int level)
+{
+  float *clut = dt_alloc_align(64, sizeof(float) * 3 * level * level * level);
+  for(int b = 0; b < level; b++)
+    for(int g = 0; g < level; g++)
+      for(int r = 0; r < level; r++)
+      {
+        const float rgb[3] = { r / (level - 1.0f), g / (level - 1.0f), b / (level - 1.0f) };
+        const float luma = 0.3f * rgb[0] + 0.6f * rgb[1] + 0.1f * rgb[2];
+        float *node = clut + 3 * (r + level * (g + level * b));
+        for(int c = 0; c < 3; c++)
+        {
+          const float mixed = 0.8f * rgb[c] + 0.2f * luma;
+          node[c] = mixed * mixed * (3.0f - 2.0f * mixed) + (c == 2 ? 0.05f : 0.0f) * (1.0f - luma);
+        }
+      }
+  return clut;
+}
+
+typedef void (*kernel_t)(const float *const in, float *const out, const size_t pixel_nb, const float *const clut,
+                         const uint16_t level);
+
+static double run(kernel_t kernel, const float *in, float *out, const float *clut, const int level)
+{
+  double best = INFINITY;
+  for(int k = 0; k < RUNS; k++)
+  {
+    const double start = dt_get_wtime();
+    kernel(in, out, PIXELS, clut, level);
+    best = fmin(best, dt_get_wtime() - start);
+  }
+  return PIXELS / best * 1e-6;
+}
+
+static double max_difference(const float *a, const float *b)
+{
+  double max = 0.0;
+  for(size_t k = 0; k < (size_t)PIXELS * 4; k++) max = fmax(max, fabsf(a[k] - b[k]));
+  return max;
+}
+
+static void test(const float *const in, const int level)
+{
+  float *clut = make_clut(level);
+  float *packed = dt_clut_pack(clut, level);
+  float *reference = dt_alloc_align(64, sizeof(float) * 4 * PIXELS);
+  float *out = dt_alloc_align(64, sizeof(float) * 4 * PIXELS);
+  assert_non_null(clut);
+  assert_non_null(packed);
+  assert_non_null(reference);
+  assert_non_null(out);
+
+  const char *names[2] = { "tetrahedral", "trilinear" };
+  const kernel_t plain[2] = { dt_clut_tetrahedral, dt_clut_trilinear };
+#if defined(__SSE2__)
+  const kernel_t sse2[2] = { dt_clut_tetrahedral_sse2, dt_clut_trilinear_sse2 };
+#endif
+  for(int i = 0; i < 2; i++)
+  {
+    double best = INFINITY;
+    for(int k = 0; k < RUNS; k++)
+    {
+      const double start = dt_get_wtime();
+      if(i == 0)
+        tetrahedral_reference(in, reference, PIXELS, clut, level);
+      else
+        trilinear_reference(in, reference, PIXELS, clut, level);
+      best = fmin(best, dt_get_wtime() - start);
+    }
+    print_message("%2d^3 %-11s: 3 floats per node %6.1f Mpix/s", level, names[i], PIXELS / best * 1e-6);
+
+    const double mpix = run(plain[i], in, out, packed, level);
+    const double diff = max_difference(reference, out);
+    print_message(", packed %6.1f Mpix/s (max difference %.1e)", mpix, diff);
+    assert_true(diff < 1e-5);
+#if defined(__SSE2__)
+    const double mpix_sse2 = run(sse2[i], in, out, packed, level);
+    const double diff_sse2 = max_difference(reference, out);
+    print_message(", packed sse2 %6.1f Mpix/s (max difference %.1e)", mpix_sse2, diff_sse2);
+    assert_true(diff_sse2 < 1e-5);
+#endif
+    print_message("\n");
+  }
+
+  dt_free_align(clut);
+  dt_free_align(packed);
+  dt_free_align(reference);
+  dt_free_align(out);
+}
+
+// a photo rather than noise: smooth gradients, with some pixels out of [0, 1]
+static int setup(void **state)
+{
+  float *in = dt_alloc_align(64, sizeof(float) * 4 * PIXELS);
+  if(!in) return 1;
+  srand(42);
+  for(size_t k = 0; k < PIXELS; k++)
+  {
+    const float x = (k % SIZE) / (float)SIZE, y = (k / SIZE) / (float)SIZE;
+    const float noise = (rand() % 1000) / 50000.0f;
+    in[4 * k + 0] = 1.1f * x * y + noise - 0.02f;
+    in[4 * k + 1] = 0.5f + 0.5f * sinf(6.0f * x) * y + noise;
+    in[4 * k + 2] = 1.05f * (1.0f - x) * (1.0f - y) + noise;
+    in[4 * k + 3] = (k % 7) / 7.0f;
+  }
+  *state = in;
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  dt_free_align(*state);
+  return 0;
+}
+
+static void test_level_17(void **state)
+{
+  test(*state, 17);
+}
+
+static void test_level_33(void **state)
+{
+  test(*state, 33);
+}
+
+static void test_level_65(void **state)
+{
+  test(*state, 65);
+}
+
+int main(int argc, char *arg[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_level_17),
+    cmocka_unit_test(test_level_33),
+    cmocka_unit_test(test_level_65)
+  };
+
+  return cmocka_run_group_tests(tests, setup, teardown);
+}
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
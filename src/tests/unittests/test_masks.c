@@ -0,0 +1,231 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// unit test and benchmark of the row band falloff rasterizer against walking the segments one by one.
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmocka.h>
+
+#include "common/darktable.h"
+#include "develop/masks.h"
+
+#define WIDTH 2048
+#define HEIGHT 2048
+
+// how brushes drew their falloff before, one segment after the other
+static void falloff_reference(float *buffer, const int *p0, const int *p1, int bw, int bh, float hardness,
+                              float density)
+{
+  const int l = sqrt((p1[0] - p0[0]) * (p1[0] - p0[0]) + (p1[1] - p0[1]) * (p1[1] - p0[1])) + 1;
+  const int solid = hardness * l;
+
+  const float lx = (float)(p1[0] - p0[0]) / (float)l;
+  const float ly = (float)(p1[1] - p0[1]) / (float)l;
+
+  const int dx = lx <= 0 ? -1 : 1;
+  const int dy = ly <= 0 ? -1 : 1;
+
+  float fx = p0[0];
+  float fy = p0[1];
+  float op = density;
+  const float dop = density / (float)(l - solid);
+
+  for(int i = 0; i < l; i++)
+  {
+    const int x = fx;
+    const int y = fy;
+    fx += lx;
+    fy += ly;
+    if(i > solid) op -= dop;
+    if(x < 0 || x >= bw || y < 0 || y >= bh) continue;
+    float *buf = buffer + (size_t)y * bw + x;
+    *buf = MAX(*buf, op);
+    if(x + dx >= 0 && x + dx < bw) buf[dx] = MAX(buf[dx], op);
+    if(y + dy >= 0 && y + dy < bh) buf[dy * bw] = MAX(buf[dy * bw], op);
+  }
+}
+
+// how paths drew their falloff before, one segment after the other
+static void path_falloff_reference(float *buffer, const int *p0, const int *p1, int bw, int bh)
+{
+  // segment length
+  const int l = sqrt((p1[0] - p0[0]) * (p1[0] - p0[0]) + (p1[1] - p0[1]) * (p1[1] - p0[1])) + 1;
+
+  const float lx = p1[0] - p0[0];
+  const float ly = p1[1] - p0[1];
+
+  const int dx = lx < 0 ? -1 : 1;
+  const int dy = ly < 0 ? -1 : 1;
+  const int dpy = dy * bw;
+
+  for(int i = 0; i < l; i++)
+  {
+    // position
+    const int x = (int)((float)i * lx / (float)l) + p0[0];
+    const int y = (int)((float)i * ly / (float)l) + p0[1];
+    const float op = 1.0 - (float)i / (float)l;
+    float *buf = buffer + (size_t)y * bw + x;
+    if(x >= 0 && x < bw && y >= 0 && y < bh) buf[0] = MAX(buf[0], op);
+    if(x + dx >= 0 && x + dx < bw && y >= 0 && y < bh)
+      buf[dx] = MAX(buf[dx], op); // this one is to avoid gap due to int rounding
+    if(x >= 0 && x < bw && y + dy >= 0 && y + dy < bh)
+      buf[dpy] = MAX(buf[dpy], op); // this one is to avoid gap due to int rounding
+  }
+}
+
+// segments like the ones of wavy brush strokes with round ends, partly outside of the buffer
+static dt_masks_falloff_segment_t *make_strokes(const int strokes, const gboolean path, int *count)
+{
+  int size = 4096, n = 0;
+  dt_masks_falloff_segment_t *segments = malloc(sizeof(dt_masks_falloff_segment_t) * size);
+  srand(42);
+  for(int k = 0; k < strokes; k++)
+  {
+    const float cx = rand() % WIDTH, cy = rand() % HEIGHT;
+    const float radius = 10 + rand() % 60, length = 50 + rand() % 300;
+    const float angle = (rand() % 628) / 100.0f;
+    const float hardness = (rand() % 100) / 100.0f, density = 0.5f + (rand() % 50) / 100.0f;
+    const int ends = M_PI * radius;
+    if(n + 2 * ((int)length + 1) + 2 * (ends + 1) > size)
+    {
+      size = 2 * size + 2 * ((int)length + 1) + 2 * (ends + 1);
+      segments = realloc(segments, sizeof(dt_masks_falloff_segment_t) * size);
+    }
+    for(int i = 0; i <= length; i++)
+    {
+      const float x = cx + cosf(angle) * i, y = cy + sinf(angle) * i + 20.0f * sinf(i / 40.0f);
+      float tx = cosf(angle), ty = sinf(angle) + 0.5f * cosf(i / 40.0f);
+      const float norm = sqrtf(tx * tx + ty * ty);
+      tx /= norm;
+      ty /= norm;
+      for(int side = -1; side <= 1; side += 2)
+        segments[n++] = (dt_masks_falloff_segment_t){ .p0 = { x, y },
+                                                      .p1 = { x - side * ty * radius, y + side * tx * radius },
+                                                      .hardness = hardness,
+                                                      .density = density,
+                                                      .path = path };
+    }
+    for(int e = 0; e < 2; e++)
+    {
+      const float x = cx + e * cosf(angle) * length;
+      const float y = cy + e * (sinf(angle) * length + 20.0f * sinf(length / 40.0f));
+      for(int i = 0; i <= ends; i++)
+      {
+        const float a = angle + (e ? -M_PI / 2 : M_PI / 2) + M_PI * i / ends;
+        segments[n++] = (dt_masks_falloff_segment_t){ .p0 = { x, y },
+                                                      .p1 = { x + radius * cosf(a), y + radius * sinf(a) },
+                                                      .hardness = hardness,
+                                                      .density = density,
+                                                      .path = path };
+      }
+    }
+  }
+  *count = n;
+  return segments;
+}
+
+static void test(const int strokes, const gboolean path)
+{
+  int count = 0;
+  dt_masks_falloff_segment_t *segments = make_strokes(strokes, path, &count);
+  float *reference = dt_alloc_align(64, sizeof(float) * WIDTH * HEIGHT);
+  float *banded = dt_alloc_align(64, sizeof(float) * WIDTH * HEIGHT);
+  assert_non_null(reference);
+  assert_non_null(banded);
+  memset(reference, 0, sizeof(float) * WIDTH * HEIGHT);
+  memset(banded, 0, sizeof(float) * WIDTH * HEIGHT);
+
+  const double start = dt_get_wtime();
+  for(int k = 0; k < count; k++)
+  {
+    if(path)
+      path_falloff_reference(reference, segments[k].p0, segments[k].p1, WIDTH, HEIGHT);
+    else
+      falloff_reference(reference, segments[k].p0, segments[k].p1, WIDTH, HEIGHT, segments[k].hardness,
+                        segments[k].density);
+  }
+  const double middle = dt_get_wtime();
+  dt_masks_falloff_render(banded, WIDTH, HEIGHT, segments, count);
+  const double end = dt_get_wtime();
+
+  // brushes: every band starts stepping from the exact position of its first step, which moves a few pixels.
+  // paths compute every step from the start of the segment, so they come out the same.
+  size_t covered = 0, off = 0, differ = 0;
+  double sum = 0.0;
+  for(size_t k = 0; k < (size_t)WIDTH * HEIGHT; k++)
+  {
+    if(reference[k] == 0.0f && banded[k] == 0.0f) continue;
+    const float diff = fabsf(reference[k] - banded[k]);
+    covered++;
+    sum += diff;
+    if(diff > 0.1f) off++;
+    if(diff != 0.0f) differ++;
+  }
+  const double mean = covered ? sum / covered : 0.0;
+  const double outliers = covered ? (double)off / covered : 0.0;
+  print_message("%4d %s, %7d segments: walked %7.2f ms, row bands %7.2f ms, mean difference %.5f, %.3f%% "
+                "pixels off by more than 0.1\n",
+                strokes, path ? "paths" : "strokes", count, 1000.0 * (middle - start), 1000.0 * (end - middle),
+                mean, 100.0 * outliers);
+  assert_true(covered > 0);
+  if(path)
+    assert_int_equal(differ, 0);
+  else
+  {
+    assert_true(mean < 0.002);
+    assert_true(outliers < 0.002);
+  }
+
+  dt_free_align(reference);
+  dt_free_align(banded);
+  free(segments);
+}
+
+static void test_brush(void **state)
+{
+  test(10, FALSE);
+  test(100, FALSE);
+  test(1000, FALSE);
+}
+
+static void test_path(void **state)
+{
+  test(10, TRUE);
+  test(100, TRUE);
+  test(1000, TRUE);
+}
+
+int main(int argc, char *arg[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_brush),
+    cmocka_unit_test(test_path)
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
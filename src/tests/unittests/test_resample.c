@@ -0,0 +1,282 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// unit test and benchmark of the tiled resampler against filtering the full footprint of every output pixel, as
+// it was done before, for all codepaths. flat images stay flat, and empty rois are left alone.
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmocka.h>
+
+// for the plans and the plan cache
+#include "common/interpolation.c"
+
+#define WIDTH 2000
+#define HEIGHT 1500
+
+typedef enum codepath_t
+{
+  CODEPATH_PLAIN,
+  CODEPATH_SSE2,
+  CODEPATH_AVX2
+} codepath_t;
+
+static const char *codepath_names[] = { "plain", "sse2", "avx2" };
+
+static float *image = NULL;
+static float *flat = NULL;
+
+static gboolean set_codepath(const codepath_t codepath)
+{
+#if !defined(__SSE2__)
+  if(codepath != CODEPATH_PLAIN) return FALSE;
+#endif
+#if !defined(DT_HAVE_AVX_CODEPATHS)
+  if(codepath == CODEPATH_AVX2) return FALSE;
+#else
+  if(codepath == CODEPATH_AVX2 && !__builtin_cpu_supports("avx2")) return FALSE;
+#endif
+  darktable.codepath.OPENMP_SIMD = codepath == CODEPATH_PLAIN;
+  darktable.codepath.SSE2 = codepath != CODEPATH_PLAIN;
+  darktable.codepath.AVX2 = codepath == CODEPATH_AVX2;
+  return TRUE;
+}
+
+// how the plain codepath resampled before, every output pixel from all the input pixels under its footprint
+static void resample_reference(const struct dt_interpolation *itor, float *out, const dt_iop_roi_t *const roi_out,
+                               const int32_t out_stride, const float *const in, const dt_iop_roi_t *const roi_in,
+                               const int32_t in_stride)
+{
+  int *hindex = NULL, *hlength = NULL, *vindex = NULL, *vlength = NULL, *vmeta = NULL;
+  float *hkernel = NULL, *vkernel = NULL;
+
+  if(!prepare_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale,
+                              &hlength, &hkernel, &hindex, NULL, TRUE)
+     && !prepare_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale,
+                                 &vlength, &vkernel, &vindex, &vmeta, TRUE))
+  {
+    for(int oy = 0; oy < roi_out->height; oy++)
+    {
+      int vlidx = vmeta[3 * oy + 0];
+      int vkidx = vmeta[3 * oy + 1];
+      int viidx = vmeta[3 * oy + 2];
+      int hlidx = 0, hkidx = 0, hiidx = 0;
+      const int vl = vlength[vlidx++];
+
+      for(int ox = 0; ox < roi_out->width; ox++)
+      {
+        float vs[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        const int hl = hlength[hlidx++];
+
+        for(int iy = 0; iy < vl; iy++)
+        {
+          const float *i = (float *)((char *)in + (size_t)in_stride * vindex[viidx++]);
+          float vhs[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+          for(int ix = 0; ix < hl; ix++)
+          {
+            const size_t baseidx = (size_t)hindex[hiidx++] * 4;
+            const float htap = hkernel[hkidx++];
+            for(int c = 0; c < 3; c++) vhs[c] += i[baseidx + c] * htap;
+          }
+          const float vtap = vkernel[vkidx++];
+          for(int c = 0; c < 3; c++) vs[c] += vhs[c] * vtap;
+          hkidx -= hl;
+          hiidx -= hl;
+        }
+
+        float *o = (float *)((char *)out + (size_t)oy * out_stride + (size_t)ox * 4 * sizeof(float));
+        for(int c = 0; c < 3; c++) o[c] = vs[c];
+        viidx -= vl;
+        vkidx -= vl;
+        hiidx += hl;
+        hkidx += hl;
+      }
+    }
+  }
+
+  dt_free_align(hlength);
+  dt_free_align(vlength);
+}
+
+static double max_difference(const float *a, const float *b, const dt_iop_roi_t *roi)
+{
+  double max = 0.0;
+  for(size_t k = 0; k < (size_t)roi->width * roi->height * 4; k++)
+    if(k % 4 != 3) max = fmax(max, fabsf(a[k] - b[k]));
+  return max;
+}
+
+static void test(const struct dt_interpolation *itor, const float scale)
+{
+  const dt_iop_roi_t roi_in = { .x = 0, .y = 0, .width = WIDTH, .height = HEIGHT, .scale = 1.0f };
+  // a crop of the scaled image, like the pipe asks for
+  const dt_iop_roi_t roi_out = { .x = 3, .y = 5, .width = MIN(WIDTH * scale - 6, 1000),
+                                 .height = MIN(HEIGHT * scale - 10, 750), .scale = scale };
+  const int32_t in_stride = roi_in.width * 4 * sizeof(float), out_stride = roi_out.width * 4 * sizeof(float);
+  const size_t size = sizeof(float) * 4 * roi_out.width * roi_out.height;
+  float *reference = dt_alloc_align(64, size);
+  float *out = dt_alloc_align(64, size);
+  assert_non_null(reference);
+  assert_non_null(out);
+
+  double start = dt_get_wtime();
+  resample_reference(itor, reference, &roi_out, out_stride, image, &roi_in, in_stride);
+  print_message("%-9s %5.3f: reference %7.1f ms", itor->name, scale, 1e3 * (dt_get_wtime() - start));
+
+  for(codepath_t codepath = CODEPATH_PLAIN; codepath <= CODEPATH_AVX2; codepath++)
+  {
+    if(!set_codepath(codepath)) continue;
+
+    // the kernels are normalized, flat stays flat
+    dt_interpolation_resample(itor, out, &roi_out, out_stride, flat, &roi_in, in_stride);
+    for(size_t k = 0; k < (size_t)roi_out.width * roi_out.height * 4; k++)
+      if(k % 4 != 3) assert_true(fabsf(out[k] - 0.5f) < 1e-5f);
+
+    // the second run finds its plans in the cache, and has to come out the same
+    for(int run = 0; run < 2; run++)
+    {
+      start = dt_get_wtime();
+      dt_interpolation_resample(itor, out, &roi_out, out_stride, image, &roi_in, in_stride);
+      const double ms = 1e3 * (dt_get_wtime() - start);
+      const double diff = max_difference(reference, out, &roi_out);
+      if(run) print_message(", %s %7.1f ms (max difference %.1e)", codepath_names[codepath], ms, diff);
+      assert_true(diff < 1e-5);
+    }
+  }
+  print_message("\n");
+
+  dt_free_align(reference);
+  dt_free_align(out);
+}
+
+static void test_interpolators(void **state)
+{
+  const float scales[] = { 0.05f, 0.25f, 0.7731f, 1.5f };
+  // not through dt_interpolation_new(), which takes bicubic for the user preference
+  for(int t = DT_INTERPOLATION_FIRST; t < DT_INTERPOLATION_LAST; t++)
+    for(int s = 0; s < sizeof(scales) / sizeof(scales[0]); s++) test(&dt_interpolator[t], scales[s]);
+}
+
+static void test_plan_cache(void **state)
+{
+  const struct dt_interpolation *itor = dt_interpolation_new(DT_INTERPOLATION_LANCZOS3);
+
+  // the same geometry gets the same plan, which stays cached once released
+  resampling_plan_t *a = resampling_plan_get(itor, WIDTH, 0, 500, 7, 0.25f);
+  resampling_plan_t *b = resampling_plan_get(itor, WIDTH, 0, 500, 7, 0.25f);
+  assert_non_null(a);
+  assert_ptr_equal(a, b);
+  assert_true(a->cached);
+  assert_int_equal(a->users, 2);
+  resampling_plan_release(a);
+  resampling_plan_release(b);
+  assert_int_equal(a->users, 0);
+
+  // any other geometry gets a plan of its own, with the same weights as computing it from scratch
+  resampling_plan_t *c = resampling_plan_get(itor, WIDTH, 0, 500, 8, 0.25f);
+  assert_non_null(c);
+  assert_ptr_not_equal(a, c);
+  int *length, *index, *meta;
+  float *kernel;
+  assert_int_equal(prepare_resampling_plan(itor, WIDTH, 0, 500, 8, 0.25f, &length, &kernel, &index, &meta, TRUE),
+                   0);
+  int taps = 0;
+  for(int k = 0; k < 500; k++) taps += length[k];
+  assert_memory_equal(c->length, length, sizeof(int) * 500);
+  assert_memory_equal(c->meta, meta, sizeof(int) * 3 * 500);
+  assert_memory_equal(c->index, index, sizeof(int) * taps);
+  assert_memory_equal(c->kernel, kernel, sizeof(float) * taps);
+  dt_free_align(length);
+  resampling_plan_release(c);
+
+  // plans in use are never evicted, the ones over the count come out private
+  resampling_plan_t *held[RESAMPLING_PLAN_CACHE + 2];
+  for(int k = 0; k < RESAMPLING_PLAN_CACHE + 2; k++)
+  {
+    held[k] = resampling_plan_get(itor, WIDTH, 0, 100, k, 0.05f);
+    assert_non_null(held[k]);
+    assert_int_equal(held[k]->out_x0, k);
+  }
+  assert_false(held[RESAMPLING_PLAN_CACHE + 1]->cached);
+  for(int k = 0; k < RESAMPLING_PLAN_CACHE + 2; k++) assert_int_equal(held[k]->out_x0, k);
+  for(int k = 0; k < RESAMPLING_PLAN_CACHE + 2; k++) resampling_plan_release(held[k]);
+  assert_true(plan_cache_size <= RESAMPLING_PLAN_CACHE_BYTES);
+}
+
+static void test_empty_roi(void **state)
+{
+  const struct dt_interpolation *itor = dt_interpolation_new(DT_INTERPOLATION_LANCZOS3);
+  const dt_iop_roi_t roi_in = { .x = 0, .y = 0, .width = WIDTH, .height = HEIGHT, .scale = 1.0f };
+  float out[4] = { 42.0f, 42.0f, 42.0f, 42.0f };
+  for(codepath_t codepath = CODEPATH_PLAIN; codepath <= CODEPATH_AVX2; codepath++)
+  {
+    if(!set_codepath(codepath)) continue;
+    const dt_iop_roi_t empty_rows = { .x = 0, .y = 0, .width = 1, .height = 0, .scale = 0.5f };
+    const dt_iop_roi_t empty_columns = { .x = 0, .y = 0, .width = 0, .height = 1, .scale = 0.5f };
+    dt_interpolation_resample(itor, out, &empty_rows, 4 * sizeof(float), image, &roi_in,
+                              roi_in.width * 4 * sizeof(float));
+    dt_interpolation_resample(itor, out, &empty_columns, 0, image, &roi_in, roi_in.width * 4 * sizeof(float));
+    for(int c = 0; c < 4; c++) assert_true(out[c] == 42.0f);
+  }
+}
+
+static int setup(void **state)
+{
+  image = dt_alloc_align(64, sizeof(float) * 4 * WIDTH * HEIGHT);
+  flat = dt_alloc_align(64, sizeof(float) * 4 * WIDTH * HEIGHT);
+  if(!image || !flat) return 1;
+  srand(42);
+  for(size_t k = 0; k < (size_t)WIDTH * HEIGHT; k++)
+  {
+    const float x = (k % WIDTH) / (float)WIDTH, y = (k / WIDTH) / (float)HEIGHT;
+    const float noise = (rand() % 1000) / 10000.0f;
+    image[4 * k + 0] = x * y + noise;
+    image[4 * k + 1] = 0.5f + 0.5f * sinf(40.0f * x) * y + noise;
+    image[4 * k + 2] = (1.0f - x) * (1.0f - y) + noise;
+    image[4 * k + 3] = 1.0f;
+    for(int c = 0; c < 4; c++) flat[4 * k + c] = 0.5f;
+  }
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  dt_free_align(image);
+  dt_free_align(flat);
+  return 0;
+}
+
+int main(int argc, char *arg[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_interpolators),
+    cmocka_unit_test(test_plan_cache),
+    cmocka_unit_test(test_empty_roi)
+  };
+
+  return cmocka_run_group_tests(tests, setup, teardown);
+}
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,344 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// unit test and benchmark of the in-memory tag index: random edits are mirrored in a plain table of
+// tags x images, and the queries have to agree with counting it out. no database needed, the index is
+// marked as loaded right away. run with --bench for the benchmark.
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmocka.h>
+
+#include "common/darktable.h"
+#include "common/tag_index.h"
+#include "common/tags.h"
+
+#define TAGS 200
+#define IMAGES 300
+#define BENCH_TAGS 50000
+#define BENCH_IMAGES 100000
+
+static const char *words[] = { "animal", "Bird", "cat", "europe", "France", "paris", "people", "x" };
+#define WORDS (sizeof(words) / sizeof(words[0]))
+
+typedef struct reference_t
+{
+  char name[128]; // empty if the tag doesn't exist
+  int flags;
+  gboolean attached[IMAGES + 1];
+} reference_t;
+
+static reference_t ref[TAGS + 1];
+
+static void random_name(char *name, const size_t size)
+{
+  name[0] = '\0';
+  if(rand() % 10 == 0) g_strlcat(name, "darktable|", size);
+  const int depth = 1 + rand() % 3;
+  for(int k = 0; k < depth; k++)
+  {
+    if(k) g_strlcat(name, "|", size);
+    g_strlcat(name, words[rand() % WORDS], size);
+  }
+}
+
+static gboolean name_taken(const char *name)
+{
+  for(int t = 1; t <= TAGS; t++)
+    if(!strcmp(ref[t].name, name)) return TRUE;
+  return FALSE;
+}
+
+static gboolean in_family(const char *name, const char *path)
+{
+  const size_t len = strlen(path);
+  return name[0] && !strncmp(name, path, len) && (name[len] == '\0' || name[len] == '|');
+}
+
+static void check(dt_tag_index_t *index, const GArray *selected)
+{
+  for(int t = 1; t <= TAGS; t++)
+  {
+    if(!ref[t].name[0]) continue;
+    guint count = 0;
+    for(int i = 1; i <= IMAGES; i++)
+    {
+      count += ref[t].attached[i];
+      assert_int_equal(dt_tag_index_is_attached(index, t, i), ref[t].attached[i]);
+    }
+    assert_int_equal(dt_tag_index_images_count(index, t), count);
+
+    // the family of the tag itself and of its parent
+    gchar *parent = g_strdup(ref[t].name);
+    gchar *sep = strrchr(parent, '|');
+    if(sep) *sep = '\0';
+    const char *paths[] = { ref[t].name, parent };
+    for(int p = 0; p < 2; p++)
+    {
+      int tag_count = 0, img_count = 0, tags = 0, imgs = 0;
+      for(int i = 1; i <= IMAGES; i++)
+      {
+        gboolean any = FALSE;
+        for(int u = 1; u <= TAGS; u++) any |= in_family(ref[u].name, paths[p]) && ref[u].attached[i];
+        imgs += any;
+      }
+      for(int u = 1; u <= TAGS; u++) tags += in_family(ref[u].name, paths[p]);
+      dt_tag_index_count_family(index, paths[p], &tag_count, &img_count);
+      assert_int_equal(tag_count, tags);
+      assert_int_equal(img_count, imgs);
+    }
+    g_free(parent);
+  }
+
+  // all tags but the darktable ones, sorted by name
+  GList *all = dt_tag_index_get_tags(index, selected);
+  int expected = 0;
+  for(int t = 1; t <= TAGS; t++) expected += ref[t].name[0] && strncmp(ref[t].name, "darktable|", 10);
+  assert_int_equal(g_list_length(all), expected);
+  for(GList *l = all; l; l = g_list_next(l))
+  {
+    const dt_tag_t *tag = (dt_tag_t *)l->data;
+    guint imgnb = 0;
+    for(guint k = 0; k < selected->len; k++) imgnb += ref[tag->id].attached[g_array_index(selected, int, k)];
+    assert_string_equal(tag->tag, ref[tag->id].name);
+    assert_int_equal(tag->select, imgnb == 0 ? 0 : imgnb == selected->len ? 2 : 1);
+    if(l->next) assert_true(strcmp(tag->tag, ((dt_tag_t *)l->next->data)->tag) < 0);
+  }
+  dt_tag_free_result(&all);
+
+  // suggestions leave out categories and what all of the selection has already
+  GList *suggestions = dt_tag_index_get_suggestions(index, selected, 20);
+  for(GList *l = suggestions; l; l = g_list_next(l))
+  {
+    const dt_tag_t *tag = (dt_tag_t *)l->data;
+    assert_true(tag->count > 0);
+    assert_false(tag->flags & DT_TF_CATEGORY);
+    assert_int_not_equal(tag->select, 2);
+    if(l->next) assert_true(tag->count >= ((dt_tag_t *)l->next->data)->count);
+  }
+  dt_tag_free_result(&suggestions);
+
+  // typing a keyword narrows the matches, they stay the same as searching from scratch
+  const char *typed[] = { "a", "an", "ani", "e", "eu", "x", "zz" };
+  for(int k = 0; k < sizeof(typed) / sizeof(typed[0]); k++)
+  {
+    GHashTable *matches = dt_tag_index_match(index, typed[k]);
+    for(int t = 1; t <= TAGS; t++)
+    {
+      if(!ref[t].name[0]) continue;
+      gchar *lower = g_utf8_strdown(ref[t].name, -1);
+      assert_int_equal(g_hash_table_contains(matches, ref[t].name), strstr(lower, typed[k]) != NULL);
+      g_free(lower);
+    }
+    g_hash_table_destroy(matches);
+  }
+}
+
+static void test_edits(void **state)
+{
+  srand(42);
+  dt_tag_index_t index;
+  dt_tag_index_init(&index);
+  index.loaded = TRUE;
+  memset(ref, 0, sizeof(ref));
+  GArray *selected = g_array_new(FALSE, FALSE, sizeof(int));
+  for(int i = 1; i <= IMAGES; i += 3) g_array_append_val(selected, i);
+
+  for(int round = 0; round < 20; round++)
+  {
+    for(int op = 0; op < 500; op++)
+    {
+      const int t = 1 + rand() % TAGS, i = 1 + rand() % IMAGES, r = rand() % 100;
+      char name[128];
+      if(!ref[t].name[0])
+      {
+        random_name(name, sizeof(name));
+        if(name_taken(name)) continue;
+        g_strlcpy(ref[t].name, name, sizeof(ref[t].name));
+        dt_tag_index_tag_new(&index, t, name);
+      }
+      else if(r < 60)
+      {
+        ref[t].attached[i] = TRUE;
+        dt_tag_index_attach(&index, t, i);
+      }
+      else if(r < 85)
+      {
+        ref[t].attached[i] = FALSE;
+        dt_tag_index_detach(&index, t, i);
+      }
+      else if(r < 88)
+      {
+        memset(&ref[t], 0, sizeof(reference_t));
+        dt_tag_index_tag_remove(&index, t);
+      }
+      else if(r < 92)
+      {
+        random_name(name, sizeof(name));
+        if(name_taken(name)) continue;
+        g_strlcpy(ref[t].name, name, sizeof(ref[t].name));
+        dt_tag_index_tag_rename(&index, t, name);
+      }
+      else if(r < 95)
+      {
+        ref[t].flags = rand() % 4;
+        dt_tag_index_tag_set_flags(&index, t, ref[t].flags);
+      }
+      else if(r < 98)
+      {
+        for(int u = 1; u <= TAGS; u++) ref[u].attached[i] = FALSE;
+        dt_tag_index_image_remove(&index, i);
+      }
+      else
+      {
+        const int from = 1 + rand() % IMAGES;
+        for(int u = 1; u <= TAGS; u++) ref[u].attached[i] |= ref[u].attached[from];
+        dt_tag_index_image_copy(&index, i, from);
+      }
+    }
+    check(&index, selected);
+  }
+
+  g_array_free(selected, TRUE);
+  dt_tag_index_cleanup(&index);
+}
+
+static gboolean list_contains(GList *list, const int imgid)
+{
+  return g_list_find(list, GINT_TO_POINTER(imgid)) != NULL;
+}
+
+static void test_changes(void **state)
+{
+  dt_tag_index_t index;
+  dt_tag_index_init(&index);
+  index.loaded = TRUE;
+  dt_tag_index_tag_new(&index, 1, "animal|cat");
+  dt_tag_index_tag_new(&index, 2, "animal|bird");
+
+  GList *imgs = NULL;
+  guint64 now = 0;
+  const guint64 start = dt_tag_index_changes(&index);
+  assert_true(dt_tag_index_changes_since(&index, start, &imgs, &now));
+  assert_null(imgs);
+  assert_true(now == start);
+
+  // every image once, however often it changed
+  dt_tag_index_attach(&index, 1, 10);
+  dt_tag_index_attach(&index, 2, 10);
+  dt_tag_index_detach(&index, 1, 11);
+  dt_tag_index_image_copy(&index, 12, 10);
+  assert_true(dt_tag_index_changes_since(&index, start, &imgs, &now));
+  assert_int_equal(g_list_length(imgs), 3);
+  assert_true(list_contains(imgs, 10) && list_contains(imgs, 11) && list_contains(imgs, 12));
+  g_list_free(imgs);
+
+  // only what happened after since
+  const guint64 later = now;
+  dt_tag_index_image_remove(&index, 13);
+  assert_true(dt_tag_index_changes_since(&index, later, &imgs, &now));
+  assert_int_equal(g_list_length(imgs), 1);
+  assert_true(list_contains(imgs, 13));
+  g_list_free(imgs);
+
+  // renames and removals concern all images of the tag
+  dt_tag_index_tag_rename(&index, 2, "animal|parrot");
+  assert_false(dt_tag_index_changes_since(&index, later, &imgs, &now));
+  assert_null(imgs);
+  const guint64 renamed = now;
+  dt_tag_index_attach(&index, 1, 14);
+  assert_true(dt_tag_index_changes_since(&index, renamed, &imgs, &now));
+  assert_true(list_contains(imgs, 14));
+  g_list_free(imgs);
+
+  // and old changes are forgotten at some point
+  for(int k = 0; k < 10000; k++) dt_tag_index_attach(&index, 1, 20 + k % 100);
+  assert_false(dt_tag_index_changes_since(&index, renamed, &imgs, &now));
+  assert_true(dt_tag_index_changes_since(&index, now - 100, &imgs, &now));
+  assert_int_equal(g_list_length(imgs), 100);
+  g_list_free(imgs);
+
+  dt_tag_index_cleanup(&index);
+}
+
+static void benchmark(void)
+{
+  dt_tag_index_t index;
+  dt_tag_index_init(&index);
+  index.loaded = TRUE;
+  for(int t = 1; t <= BENCH_TAGS; t++)
+  {
+    gchar *name = g_strdup_printf("%s|%s|tag %d", words[t % WORDS], words[(t / WORDS) % WORDS], t);
+    dt_tag_index_tag_new(&index, t, name);
+    g_free(name);
+  }
+  for(int k = 0; k < 10 * BENCH_TAGS; k++)
+    dt_tag_index_attach(&index, 1 + rand() % BENCH_TAGS, 1 + rand() % BENCH_IMAGES);
+  GArray *selected = g_array_new(FALSE, FALSE, sizeof(int));
+  for(int i = 1; i <= 1000; i++) g_array_append_val(selected, i);
+
+  const char *typed[] = { "t", "ta", "tag", "tag ", "tag 1", "tag 12", "tag 123" };
+  double start = dt_get_wtime();
+  for(int k = 0; k < sizeof(typed) / sizeof(typed[0]); k++)
+    g_hash_table_destroy(dt_tag_index_match(&index, typed[k]));
+  fprintf(stderr, "[bench] typing 'tag 123' over %d tags: %.1f ms\n", BENCH_TAGS, 1e3 * (dt_get_wtime() - start));
+
+  start = dt_get_wtime();
+  GList *all = dt_tag_index_get_tags(&index, selected);
+  fprintf(stderr, "[bench] all tags for 1000 selected images: %.1f ms\n", 1e3 * (dt_get_wtime() - start));
+  dt_tag_free_result(&all);
+
+  start = dt_get_wtime();
+  GList *suggestions = dt_tag_index_get_suggestions(&index, selected, 500);
+  fprintf(stderr, "[bench] suggestions: %.1f ms\n", 1e3 * (dt_get_wtime() - start));
+  dt_tag_free_result(&suggestions);
+
+  int tags, imgs;
+  start = dt_get_wtime();
+  dt_tag_index_count_family(&index, words[0], &tags, &imgs);
+  fprintf(stderr, "[bench] family of %d tags on %d images: %.1f ms\n", tags, imgs,
+          1e3 * (dt_get_wtime() - start));
+
+  g_array_free(selected, TRUE);
+  dt_tag_index_cleanup(&index);
+}
+
+int main(int argc, char *arg[])
+{
+  if(argc > 1 && !strcmp(arg[1], "--bench"))
+  {
+    srand(42);
+    benchmark();
+    return 0;
+  }
+
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_edits),
+    cmocka_unit_test(test_changes)
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
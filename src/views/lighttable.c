@@ -741,19 +741,22 @@ static void _update_collected_images(dt_view_t *self)
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.sqlite_sequence WHERE "
                                                        "name='collected_images'", NULL, NULL, NULL);
 
-  // 2. insert collected images into the temporary table
+  // 2. insert collected images into the temporary table, from the result the collection keeps anyway instead
+  //    of running the query once more
 
-  gchar *ins_query = NULL;
-  ins_query = dt_util_dstrcat(ins_query, "INSERT INTO memory.collected_images (imgid) %s", query);
-
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), ins_query, -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, 0);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, -1);
-  sqlite3_step(stmt);
+  GArray *ids = dt_collection_get_ids(darktable.collection);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "INSERT INTO memory.collected_images (imgid) VALUES (?1)", -1, &stmt, NULL);
+  for(guint k = 0; k < ids->len; k++)
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, g_array_index(ids, int, k));
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+  }
   sqlite3_finalize(stmt);
+  g_array_free(ids, TRUE);
 
   g_free(query);
-  g_free(ins_query);
 
   // 3. get new low-bound, then update the full preview rowid accordingly
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT MIN(rowid) FROM memory.collected_images", -1,
@@ -3157,11 +3160,10 @@ static gboolean rating_key_accel_callback(GtkAccelGroup *accel_group, GObject *a
   }
 
   mouse_over_id = dt_view_get_image_to_act_on();
+  // the collection and its count are brought up to date by the rating itself
   dt_ratings_apply(mouse_over_id, num, TRUE, TRUE, TRUE);
   _update_collected_images(self);
 
-  dt_collection_update_query(darktable.collection); // update the counter
-
   if(layout != DT_LIGHTTABLE_LAYOUT_CULLING && lib->collection_count != dt_collection_get_count(darktable.collection))
   {
     // some images disappeared from collection. Selection is now invisible.
@@ -0,0 +1,129 @@
+#!/bin/sh
+
+#
+# Usage: demosaic-benchmark.sh [-t "<thread counts>"] [-m "<methods>"] [-s <xtrans tile size>] <raw files>
+#
+# exports each raw file at full size with every demosaicing method and every number of threads and reports
+# the time demosaic took in the export pipe, in megapixels per second. the export size is read with
+# ImageMagick's identify, without it only the times are shown.
+#
+#   -t  thread counts, default "1 2 4 8" and all cores
+#   -m  methods, default ppg amaze vng4 for bayer and vng markesteijn markesteijn3 fdc for x-trans sensors.
+#       methods that don't fit the sensor fall back to the default one of the module.
+#   -s  tile size of x-trans markesteijn, see plugins/darkroom/demosaic/xtrans_tile_size. 0 picks it from the L2
+#       cache size
+#
+# opencl is disabled, a temporary config dir and an in-memory library keep the user's setup untouched.
+#
+
+CLI=${DARKTABLE_CLI:-darktable-cli}
+CORES=$(getconf _NPROCESSORS_ONLN 2> /dev/null || echo 8)
+THREADS="1 2 4 8 $CORES"
+METHODS="ppg amaze vng4 vng markesteijn markesteijn3 fdc"
+TILE=0
+
+while getopts "t:m:s:" opt; do
+  case $opt in
+    t) THREADS=$OPTARG ;;
+    m) METHODS=$OPTARG ;;
+    s) TILE=$OPTARG ;;
+    *) sed -n '4p' "$0" | cut -c3-; exit 1 ;;
+  esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -eq 0 ]; then
+  sed -n '4p' "$0" | cut -c3-
+  exit 1
+fi
+
+if ! which "$CLI" > /dev/null; then
+  echo error: "$CLI" not found, set DARKTABLE_CLI
+  exit 1
+fi
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# the demosaic parameters are 5 little endian 32 bit words: green_eq, median_thrs, color_smoothing, method and
+# an unused one
+method_params()
+{
+  case $1 in
+    ppg)          echo 000000000000000000000000; echo 00000000 ;;
+    amaze)        echo 000000000000000000000000; echo 01000000 ;;
+    vng4)         echo 000000000000000000000000; echo 02000000 ;;
+    vng)          echo 000000000000000000000000; echo 00040000 ;;
+    markesteijn)  echo 000000000000000000000000; echo 01040000 ;;
+    markesteijn3) echo 000000000000000000000000; echo 02040000 ;;
+    fdc)          echo 000000000000000000000000; echo 04040000 ;;
+    *) return 1 ;;
+  esac
+  echo 00000000
+}
+
+write_xmp()
+{
+  cat > "$2" << EOF
+<?xml version="1.0" encoding="UTF-8"?>
+<x:xmpmeta xmlns:x="adobe:ns:meta/" x:xmptk="XMP Core 4.4.0-Exiv2">
+ <rdf:RDF xmlns:rdf="http://www.w3.org/1999/02/22-rdf-syntax-ns#">
+  <rdf:Description rdf:about=""
+    xmlns:darktable="http://darktable.sf.net/"
+   darktable:xmp_version="4"
+   darktable:raw_params="0"
+   darktable:auto_presets_applied="0"
+   darktable:iop_order_version="2"
+   darktable:history_end="1">
+   <darktable:history>
+    <rdf:Seq>
+     <rdf:li
+      darktable:num="0"
+      darktable:operation="demosaic"
+      darktable:enabled="1"
+      darktable:modversion="3"
+      darktable:params="$1"
+      darktable:multi_name=""
+      darktable:multi_priority="0"/>
+    </rdf:Seq>
+   </darktable:history>
+  </rdf:Description>
+ </rdf:RDF>
+</x:xmpmeta>
+EOF
+}
+
+printf "%-24s %-13s %7s %9s %9s\n" "image" "method" "threads" "seconds" "MP/s"
+
+for RAW in "$@"; do
+  for METHOD in $METHODS; do
+    PARAMS=$(method_params "$METHOD" | tr -d '\n') || { echo error: unknown method "$METHOD"; exit 1; }
+    XMP="$TMP/$METHOD.xmp"
+    write_xmp "$PARAMS" "$XMP"
+
+    for T in $THREADS; do
+      OUT="$TMP/out.pfm"
+      rm -f "$OUT"
+      # streamed or tiled exports run demosaic once per part of the image, add them all up
+      SECS=$("$CLI" "$RAW" "$XMP" "$OUT" --hq true --core --configdir "$TMP/config" --library :memory: \
+               --disable-opencl -t "$T" -d perf --conf plugins/darkroom/demosaic/xtrans_tile_size="$TILE" \
+               --conf export_streaming=false \
+               2>&1 | grep "processed \`demosaic'" | grep "\[export\]" \
+               | sed -n 's/.* took \([0-9.]*\) secs .*/\1/p' \
+               | awk '{ s += $1; n++ } END { if(n) printf "%.3f", s }')
+
+      if [ -z "$SECS" ]; then
+        printf "%-24s %-13s %7s %9s %9s\n" "$(basename "$RAW")" "$METHOD" "$T" "failed" "-"
+        continue
+      fi
+
+      MPS="-"
+      if which identify > /dev/null 2>&1 && [ -f "$OUT" ]; then
+        PIXELS=$(identify -format "%w*%h" "$OUT" 2> /dev/null)
+        [ -n "$PIXELS" ] \
+          && MPS=$(echo "$PIXELS $SECS" | awk '{ split($1, d, "*"); printf "%.1f", d[1] * d[2] / $2 / 1e6 }')
+      fi
+      printf "%-24s %-13s %7s %9s %9s\n" "$(basename "$RAW")" "$METHOD" "$T" "$SECS" "$MPS"
+    done
+  done
+done